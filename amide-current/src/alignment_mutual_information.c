@@ -24,223 +24,418 @@
 
 #include "amide_config.h"
 #include <glib.h>
+#include <string.h>
 #include "amitk_data_set.h"
 #include "amitk_data_set_DOUBLE_0D_SCALING.h"
+#include "amitk_slice_cache.h"
+#include "amitk_parallel.h"
 #include "alignment_mutual_information.h"
 
 /* this algorithm will calculate the amount of mutual information between two data sets in their current orientations    */
 /* it is a re-write of the original algorithm for purposes of improved speed. the hope is that it won't affect accuracy. */
 /* rather than computing mutual information for the whole volume of data, the algorithm computes it for three orthogonal */
 /* slices: axial, sagittal, and coronal */
+/* the fixed slices and the moving data set are binned once up front, each evaluation then just walks the moving */
+/* data set's bins along the (transformed) fixed slices, building up the joint histogram */
 #define NUM_BINS 50
-gdouble calculate_mutual_information(AmitkDataSet * fixed_ds, AmitkDataSet * moving_ds, AmitkSpace * new_space, gint granularity,
-				     gboolean * pfixed_slices_current, AmitkDataSet ** fixed_slice,
-				     AmitkPoint view_center, amide_real_t thickness,
-				     amide_time_t view_start_time, amide_time_t view_duration) {
 
-  /* variables related to datasets, their volumes, coordinate spaces, etc */
-  amide_data_t value_fixed, value_moving;
-  AmitkCanvasPoint pixel_size;
-  
-  /* variables related to binning and mutual information determination*/
-  gdouble bin_width_moving;             // mutual information will be calculated bin-wise
-  gdouble bin_width_fixed;              // these values determine the size of the bins
-  gint current_bin_number_moving;                       // the number of bins for the first dataset
-  gint current_bin_number_fixed;                        // the number of bins for the second dataset
-  gint mutual_information_array[NUM_BINS][NUM_BINS] =  {{ 0 }} ;
-  gint margin_moving[NUM_BINS] = { 0 };
-  gint margin_fixed[NUM_BINS] = { 0 };
-  gint margin_total = 0;
-  gint mi_nan_count;
-  gdouble voxel_probability;            // the probability contribution of a single voxel
-  gdouble incremental_mi;
-  gdouble mutual_information = 0.0;     // this is the return value; the amount of MI computed in the two data sets; default to zero
+/* below this many samples per evaluation, it's not worth handing things off to other threads */
+#define MI_PARALLEL_MIN_SAMPLES 16384
+
+typedef struct {
+  AmitkDataSet * fixed_slice;
+  guint8 * fixed_bins;   /* the fixed slice's pixels, binned */
+  AmitkPoint origin;     /* base coordinate of the center of pixel (0,0) */
+  AmitkPoint step_x;     /* base coordinate displacement of one pixel in x */
+  AmitkPoint step_y;     /* and in y */
+  AmitkPoint start;      /* for the current evaluation, where pixel (0,0) lands in the moving data set (voxel units) */
+  AmitkPoint stride_x;   /* and the corresponding strides, again in moving data set voxel units */
+  AmitkPoint stride_y;
+} mi_view_t;
+
+typedef struct {
+  AmitkDataSet * fixed_ds;
+  AmitkDataSet * moving_ds;
+  gboolean partial_volume;
+  AmitkPoint view_center;
+  amide_real_t thickness;
+  amide_time_t view_start_time;
+  amide_time_t view_duration;
+  amide_data_t fixed_min;
+  amide_data_t fixed_scale;
+  amide_data_t moving_min;
+  amide_data_t moving_scale;
+  AmitkVoxel moving_dim;
+  guint8 * moving_bins;  /* the moving data set's voxels (view frame and gate), binned */
+  guint8 moving_empty_bin; /* the bin for samples that land outside the moving data set */
+  mi_view_t views[AMITK_VIEW_NUM];
+  gint total_rows;
+  gdouble * histogram;   /* [fixed bin][moving bin], protected by mutex */
+  GMutex mutex;
+} mi_evaluator_t;
+
+/* treat any NaN or "out of volume" values as zeros, and clamp so that the max value 
+   lands in the last bin rather than off the end */
+static guint8 mi_bin(amide_data_t value, const amide_data_t min, const amide_data_t scale) {
+
+  gint bin;
+
+  if (isnan(value)) value = 0.0;
+  bin = floor((value-min)*scale);
+
+  return CLAMP(bin, 0, NUM_BINS-1);
+}
+
+static amide_data_t mi_scale(AmitkDataSet * ds, amide_data_t * pmin) {
+
+  amide_data_t diff;
+
+  *pmin = amitk_data_set_get_global_min(ds);
+  diff = amitk_data_set_get_global_max(ds) - *pmin;
+
+  return (diff > 0.0) ? NUM_BINS/diff : 0.0;
+}
+
+static void mi_bin_moving_planes(const gint start, const gint end, gpointer data) {
+
+  mi_evaluator_t * mi = data;
+  AmitkVoxel i_voxel;
+  guint8 * bins;
+
+  i_voxel.t = amitk_data_set_get_frame(mi->moving_ds, mi->view_start_time + mi->view_duration/2.0);
+  i_voxel.g = AMITK_DATA_SET_VIEW_START_GATE(mi->moving_ds);
+
+  for (i_voxel.z = start; i_voxel.z < end; i_voxel.z++) {
+    bins = mi->moving_bins + i_voxel.z*mi->moving_dim.y*mi->moving_dim.x;
+    for (i_voxel.y = 0; i_voxel.y < mi->moving_dim.y; i_voxel.y++)
+      for (i_voxel.x = 0; i_voxel.x < mi->moving_dim.x; i_voxel.x++, bins++)
+	*bins = mi_bin(amitk_data_set_get_value(mi->moving_ds, i_voxel), mi->moving_min, mi->moving_scale);
+  }
+
+  return;
+}
+
+static mi_evaluator_t * mi_evaluator_new(AmitkDataSet * fixed_ds, AmitkDataSet * moving_ds, 
+					 const gboolean partial_volume,
+					 AmitkPoint view_center, amide_real_t thickness,
+					 amide_time_t view_start_time, amide_time_t view_duration) {
+
+  mi_evaluator_t * mi;
+  amide_intpoint_t frame;
+
+  mi = g_new0(mi_evaluator_t, 1);
+  mi->fixed_ds = fixed_ds;
+  mi->moving_ds = moving_ds;
+  mi->partial_volume = partial_volume;
+  mi->view_center = view_center;
+  mi->thickness = thickness;
+  mi->view_start_time = view_start_time;
+  mi->view_duration = view_duration;
+  g_mutex_init(&(mi->mutex));
+
+  /* use the range of values present in the data and the number of bins desired in order to determine how wide the bins should be */
+  mi->fixed_scale = mi_scale(fixed_ds, &(mi->fixed_min));
+  mi->moving_scale = mi_scale(moving_ds, &(mi->moving_min));
+  mi->moving_empty_bin = mi_bin(0.0, mi->moving_min, mi->moving_scale);
+
+  /* the moving data set doesn't change over the course of the search, just where we look at it, 
+     so bin all of it now */
+  mi->moving_dim = AMITK_DATA_SET_DIM(moving_ds);
+  mi->moving_bins = g_try_malloc(sizeof(guint8)*mi->moving_dim.x*mi->moving_dim.y*mi->moving_dim.z);
+  if (mi->moving_bins == NULL) {
+    g_warning(_("couldn't allocate memory space for the binned data set, wanted %dx%dx%d elements"),
+	      mi->moving_dim.x, mi->moving_dim.y, mi->moving_dim.z);
+    g_mutex_clear(&(mi->mutex));
+    g_free(mi);
+    return NULL;
+  }
+  frame = amitk_data_set_get_frame(moving_ds, view_start_time + view_duration/2.0);
+  amitk_raw_data_page_in_frames(AMITK_DATA_SET_RAW_DATA(moving_ds), frame, frame);
+  amitk_data_set_read_lock(moving_ds);
+  amitk_parallel_for(mi->moving_dim.z, mi_bin_moving_planes, mi);
+  amitk_data_set_read_unlock(moving_ds);
 
+  return mi;
+}
+
+static void mi_evaluator_free(mi_evaluator_t * mi) {
+
+  AmitkView i_view;
+
+  for (i_view = 0; i_view < AMITK_VIEW_NUM; i_view++) {
+    if (mi->views[i_view].fixed_slice != NULL)
+      amitk_object_unref(AMITK_OBJECT(mi->views[i_view].fixed_slice));
+    g_free(mi->views[i_view].fixed_bins);
+  }
+  g_free(mi->moving_bins);
+  g_mutex_clear(&(mi->mutex));
+  g_free(mi);
+
+  return;
+}
+
+/* (re)calculates and bins the fixed slices, granularity determines whether we look at all the 
+   voxels, or just a subset. we look at every nth voxel, where n is granularity */
+static gboolean mi_evaluator_set_granularity(mi_evaluator_t * mi, const gint granularity) {
+
+  AmitkCanvasPoint pixel_size;
   AmitkSpace * temp_space;
   GList * fixed_dss;
   AmitkVolume * view_volume;
-  AmitkDataSet * moving_slice;
-  AmitkPoint temp_offset;
-
-  /* loop counters */
+  AmitkDataSet * slice;
+  AmitkVoxel i_voxel, dim;
+  AmitkPoint temp_point;
   AmitkView i_view;
-  AmitkVoxel i_voxel;
-  gint i, j;                             // temporary counters to iterate through the bins for the two datasets
+  mi_view_t * view;
+  guint8 * bins;
 
-  amide_data_t moving_global_min;
-  amide_data_t fixed_global_min;
-  
-     
-  /* use the range of values present in the data and the number of bins desired in order to determine how wide the bins should be */
-  moving_global_min = amitk_data_set_get_global_min(moving_ds);
-  fixed_global_min = amitk_data_set_get_global_min(fixed_ds);
-  bin_width_moving = (amitk_data_set_get_global_max(moving_ds) - moving_global_min) / NUM_BINS;
-  bin_width_fixed  = (amitk_data_set_get_global_max(fixed_ds)  - fixed_global_min)  / NUM_BINS;
-    
-  /* iterate through the dataset, and build up a frequency matrix for binned values */
-  /* granularity determines whether we look at all the voxels, or just a subset. */
-  /* we look at every nth voxel, where n is granularity */
-  pixel_size.x = pixel_size.y = granularity * point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(fixed_ds));
+  pixel_size.x = pixel_size.y = granularity * point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(mi->fixed_ds));
+  mi->total_rows = 0;
 
   /* iterate over the orthogonal directions */
   for (i_view = 0; i_view < AMITK_VIEW_NUM; i_view++) {
+    view = &(mi->views[i_view]);
+#ifdef AMIDE_DEBUG
+    g_print("recompute fixed slice for view %d with pixel size %f\n", i_view, pixel_size.x);
+#endif
+
+    if (view->fixed_slice != NULL) {
+      amitk_object_unref(AMITK_OBJECT(view->fixed_slice));
+      view->fixed_slice = NULL;
+    }
+    g_free(view->fixed_bins);
+    view->fixed_bins = NULL;
 
     /* create a volume for the slice we're going to work on */
     view_volume = amitk_volume_new();
     temp_space = amitk_space_get_view_space(i_view, AMITK_LAYOUT_LINEAR);
 
     /* figure out the dimensions of the slice volume */
-    fixed_dss = g_list_append(NULL, amitk_object_ref(fixed_ds));
+    fixed_dss = g_list_append(NULL, amitk_object_ref(mi->fixed_ds));
     /* note, we don't bother with FOV, as that's actually computed based on all visible data sets, and we only
        have two of the data sets here. We'll just use 100% FOV */
-    amitk_volumes_calc_display_volume(fixed_dss, temp_space, view_center, thickness, 100.0, view_volume);
+    amitk_volumes_calc_display_volume(fixed_dss, temp_space, mi->view_center, mi->thickness, 100.0, view_volume);
     amitk_objects_unref(fixed_dss);
     g_object_unref(temp_space);
 
-    /* (re)calculate the fixed slice if we need to */
-    if ((fixed_slice[i_view] == NULL) || (*pfixed_slices_current == FALSE)) {
-#ifdef AMIDE_DEBUG
-      g_print("recompute fixed slice for view %d with pixel size %f\n", i_view, pixel_size.x);
-#endif
+    /* compute the fixed slices of data, these don't move so can be shared through the slice cache */
+    slice = amitk_slice_cache_lookup(amitk_slice_cache_get_default(), mi->fixed_ds, 
+				     mi->view_start_time, mi->view_duration, -1, pixel_size, view_volume);
+    if (slice == NULL) {
+      amitk_data_set_read_lock(mi->fixed_ds);
+      slice = amitk_data_set_get_slice(mi->fixed_ds, mi->view_start_time, mi->view_duration, -1, pixel_size, 
+				       view_volume);
+      amitk_data_set_read_unlock(mi->fixed_ds);
+      if (slice != NULL)
+	amitk_slice_cache_insert(amitk_slice_cache_get_default(), slice, -1, pixel_size, view_volume);
+    }
+    amitk_object_unref(AMITK_OBJECT(view_volume));
+    if (slice == NULL) return FALSE;
+    view->fixed_slice = slice;
+
+    /* bin the fixed slice, DOUBLE_0D is the type of the slice data sets */
+    dim = AMITK_DATA_SET_DIM(slice);
+    view->fixed_bins = g_try_malloc(sizeof(guint8)*dim.x*dim.y);
+    if (view->fixed_bins == NULL) {
+      g_warning(_("couldn't allocate memory space for the binned slice, wanted %dx%d elements"), dim.x, dim.y);
+      return FALSE;
+    }
+    bins = view->fixed_bins;
+    i_voxel = zero_voxel;
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++)
+      for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, bins++)
+	*bins = mi_bin(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice, i_voxel), mi->fixed_min, mi->fixed_scale);
+    mi->total_rows += dim.y;
+
+    /* where the pixel centers are, we sample the moving data set on the slice's center plane */
+    temp_point.x = 0.5*AMITK_DATA_SET_VOXEL_SIZE_X(slice);
+    temp_point.y = 0.5*AMITK_DATA_SET_VOXEL_SIZE_Y(slice);
+    temp_point.z = 0.5*AMITK_DATA_SET_VOXEL_SIZE_Z(slice);
+    view->origin = amitk_space_s2b(AMITK_SPACE(slice), temp_point);
+    temp_point.x += AMITK_DATA_SET_VOXEL_SIZE_X(slice);
+    view->step_x = point_sub(amitk_space_s2b(AMITK_SPACE(slice), temp_point), view->origin);
+    temp_point.x -= AMITK_DATA_SET_VOXEL_SIZE_X(slice);
+    temp_point.y += AMITK_DATA_SET_VOXEL_SIZE_Y(slice);
+    view->step_y = point_sub(amitk_space_s2b(AMITK_SPACE(slice), temp_point), view->origin);
+  }
 
-      if (fixed_slice[i_view] != NULL)
-	amitk_object_unref(AMITK_OBJECT(fixed_slice[i_view]));
+  return TRUE;
+}
 
-      /* compute the fixed slices of data */
-      fixed_slice[i_view] = amitk_data_set_get_slice(fixed_ds, view_start_time, view_duration, -1, pixel_size, 
-						     view_volume);
-    }
+/* bins the moving data set's value at a point given in voxel units, anything outside of 
+   the data set is treated as zero */
+static inline guint8 mi_moving_bin(const mi_evaluator_t * mi, const amide_intpoint_t x, 
+				   const amide_intpoint_t y, const amide_intpoint_t z) {
 
-    /* update the view volume by a transform to take into account the rotations/translations we're doing */
-    /* first take care of the axis rotation */
-    temp_offset = AMITK_SPACE_OFFSET(view_volume);
-    temp_space = amitk_space_calculate_transform(new_space, AMITK_SPACE(moving_ds));
-    amitk_space_transform(AMITK_SPACE(view_volume), temp_space);
-    g_object_unref(temp_space);
+  if ((x < 0) || (y < 0) || (z < 0) || 
+      (x >= mi->moving_dim.x) || (y >= mi->moving_dim.y) || (z >= mi->moving_dim.z))
+    return mi->moving_empty_bin;
+  else
+    return mi->moving_bins[(z*mi->moving_dim.y + y)*mi->moving_dim.x + x];
+}
+
+/* each range of rows (counted across all the views) gets binned into its own joint histogram, 
+   which is only added into the shared histogram at the end, so the threads don't fight over the bins */
+static void mi_evaluate_rows(const gint start, const gint end, gpointer data) {
 
-    /* second, take care of adjusting the view volume's offset. */
-    temp_offset = amitk_space_b2s(AMITK_SPACE(new_space), temp_offset);
-    temp_offset = amitk_space_s2b(AMITK_SPACE(moving_ds), temp_offset);
-    amitk_space_set_offset(AMITK_SPACE(view_volume), temp_offset);
+  mi_evaluator_t * mi = data;
+  gdouble histogram[NUM_BINS*NUM_BINS];
+  const mi_view_t * view;
+  const guint8 * fixed_bins;
+  AmitkView i_view;
+  AmitkPoint point, diff;
+  amide_intpoint_t x, y, z;
+  amide_data_t weight;
+  gint row, first_row, i_x, width, k;
+  guint l;
 
-    /* now calculate the slice from the moving data set, and calculate the corresponding MI */
-    moving_slice = amitk_data_set_get_slice(moving_ds, view_start_time, view_duration, -1, pixel_size, 
-					    view_volume);
+  memset(histogram, 0, sizeof(histogram));
 
-    /* calculate the mutual information */
-    i_voxel = zero_voxel;
-    for (i_voxel.y = 0; i_voxel.y < AMITK_DATA_SET_DIM_Y(fixed_slice[i_view]); i_voxel.y++) {
-      for (i_voxel.x = 0; i_voxel.x < AMITK_DATA_SET_DIM_X(fixed_slice[i_view]); i_voxel.x++) {
-
-	/* DOUBLE_0D is the type of the slice data sets */
-	value_fixed = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(fixed_slice[i_view]), i_voxel);
-	value_moving = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(moving_slice), i_voxel);
-
-	/* treat any NaN or "out of volume" values as zeros */
-	if (isnan(value_fixed)) value_fixed = 0;
-	if (isnan(value_moving)) value_moving = 0;
-      
-	current_bin_number_fixed = floor((value_fixed-fixed_global_min)/bin_width_fixed);
-	current_bin_number_moving = floor((value_moving-moving_global_min)/bin_width_moving);
-
-	g_assert(current_bin_number_fixed < NUM_BINS);
-	g_assert(current_bin_number_moving < NUM_BINS);
-      
-	/* Update the count in this particular bin combination by incrementing the counter*/
-	mutual_information_array[current_bin_number_fixed][current_bin_number_moving]++;
-      
-	/* Update the *marginal* count. We could derive this, but we'll need it later, and computing
-	   it one time only should improve computation speed */
-	margin_fixed[current_bin_number_fixed]++;
-	margin_moving[current_bin_number_moving]++;
-	margin_total++;
+  first_row = 0;
+  for (i_view = 0; i_view < AMITK_VIEW_NUM; i_view++) {
+    view = &(mi->views[i_view]);
+    width = AMITK_DATA_SET_DIM_X(view->fixed_slice);
+
+    for (row = MAX(start, first_row); row < MIN(end, first_row+AMITK_DATA_SET_DIM_Y(view->fixed_slice)); row++) {
+      fixed_bins = view->fixed_bins + (row-first_row)*width;
+      point = point_add(view->start, point_cmult(row-first_row, view->stride_y));
+
+      for (i_x = 0; i_x < width; i_x++) {
+	k = fixed_bins[i_x]*NUM_BINS;
+
+	if (!mi->partial_volume) { /* nearest neighbor */
+	  x = floor(point.x);
+	  y = floor(point.y);
+	  z = floor(point.z);
+	  histogram[k + mi_moving_bin(mi, x, y, z)] += 1.0;
+
+	} else { /* partial volume, spread the sample over the 8 surrounding voxels' bins */
+	  x = floor(point.x-0.5);
+	  y = floor(point.y-0.5);
+	  z = floor(point.z-0.5);
+	  diff.x = point.x-0.5-x;
+	  diff.y = point.y-0.5-y;
+	  diff.z = point.z-0.5-z;
+	  for (l=0; l<8; l++) {
+	    weight = ((l & 0x1) ? diff.x : 1.0-diff.x) *
+	      ((l & 0x2) ? diff.y : 1.0-diff.y) *
+	      ((l & 0x4) ? diff.z : 1.0-diff.z);
+	    histogram[k + mi_moving_bin(mi, x + ((l & 0x1) ? 1 : 0), 
+					y + ((l & 0x2) ? 1 : 0), 
+					z + ((l & 0x4) ? 1 : 0))] += weight;
+	  }
+	}
+
+	POINT_ADD(point, view->stride_x, point);
       }
     }
 
-    /* garbage collection */
-    amitk_object_unref(AMITK_OBJECT(view_volume));
-    amitk_object_unref(AMITK_OBJECT(moving_slice));
+    first_row += AMITK_DATA_SET_DIM_Y(view->fixed_slice);
   }
 
-  /* mark that we may not need to recompute the fixed slices next time around */
-  *pfixed_slices_current = TRUE;
+  g_mutex_lock(&(mi->mutex));
+  for (k=0; k < NUM_BINS*NUM_BINS; k++)
+    mi->histogram[k] += histogram[k];
+  g_mutex_unlock(&(mi->mutex));
 
+  return;
+}
 
-  
-  /* calculate the "probability weight" of a single voxel */
-  voxel_probability = (1.0 / margin_total);
-
-  /* this is an idea for later: add the MI array to the study as a data set
-  if (mi_matrix != NULL) {
-    // and add the mutual information matrix to the study
-    amitk_object_add_child(AMITK_OBJECT(fixed_ds), AMITK_OBJECT(mi_matrix)); // this adds a reference to the data set
-    amitk_object_unref(mi_matrix); // so remove a reference 
-  } else  {
-    g_warning("Failed to generate filtered data set");
+/* calculates the mutual information with the moving data set placed at new_space */
+static gdouble mi_evaluator_calculate(mi_evaluator_t * mi, AmitkSpace * new_space) {
+
+  gdouble histogram[NUM_BINS*NUM_BINS];
+  gdouble margin_fixed[NUM_BINS];
+  gdouble margin_moving[NUM_BINS];
+  gdouble total;
+  gdouble probability;
+  gdouble mutual_information = 0.0;
+  AmitkPoint voxel_size;
+  AmitkPoint start;
+  mi_view_t * view;
+  AmitkView i_view;
+  gint i, j;
+  glong num_samples=0;
+
+  /* figure out where the fixed slices land in the moving data set. A moving data set voxel at
+     new_space's local coordinate q is at q/voxel_size, and since b2s is affine, stepping along
+     the fixed slice is just a constant stride */
+  voxel_size = AMITK_DATA_SET_VOXEL_SIZE(mi->moving_ds);
+  for (i_view = 0; i_view < AMITK_VIEW_NUM; i_view++) {
+    view = &(mi->views[i_view]);
+    start = amitk_space_b2s(new_space, view->origin);
+    view->start = point_div(start, voxel_size);
+    view->stride_x = point_sub(point_div(amitk_space_b2s(new_space, point_add(view->origin, view->step_x)), voxel_size),
+			       view->start);
+    view->stride_y = point_sub(point_div(amitk_space_b2s(new_space, point_add(view->origin, view->step_y)), voxel_size),
+			       view->start);
+    num_samples += AMITK_DATA_SET_DIM_X(view->fixed_slice)*AMITK_DATA_SET_DIM_Y(view->fixed_slice);
   }
-   */
-
-  mutual_information = 0;
-   
-  /* // print the column headings in order to debug the matrix
-  g_print("\t%i", margin_moving[0]);
-  for (j = 1; j < NUM_BINS ; j++) {
-    g_print("\t%i", margin_moving[j]);
-  } */
-  
-  mi_nan_count=0;
-  for (i = 0; i < NUM_BINS ; i++) {
-    // g_print("\n%i", margin_fixed[i]);  // print the row headings in order to debug the matrix
-    for (j = 0; j < NUM_BINS ; j++) {
-      /* when the probability of (x AND y) == 0, then the log (x AND y) is NaN. Therefore, test for this condition, and add a zero in order
-         to avoid blowing up the equation
-      */
-      if (mutual_information_array[i][j] != 0) {
-        incremental_mi = (mutual_information_array[i][j]*voxel_probability)*(log2((mutual_information_array[i][j] * voxel_probability)  /( (margin_fixed[i] * voxel_probability)*(margin_moving[j] * voxel_probability))));
-      }
-      else {
-        // how do we deal with zero probability? There is probably a theoretical "best" answer, but this should be practical.
-        // we are trying to avoid complete lack of overlap from looking like a "good fit"
-        // things I've tried that *don't* work are i_mi=log2(EPSILON) and =log2(voxel_probability)
-        incremental_mi = 0;
-        mi_nan_count++;
-      }
-      /* you can choose either of the following g_print commands for debugging the matrix */
-      //g_print("\t\%i", mutual_information_array[i][j] );  // for point-wise counts
-      // g_print("\t\%4.3f", incremental_mi );               // for point-wise probability
-      
-      if (isinf(incremental_mi)) {
-        //count it (because lots and lots of zeroes mean bad registration) and go to the next loop
-        mi_nan_count++;
-        // this is most often a problem when the incemental MI is infinity, due to divide by zero
-      } else {
-        // add it to the mutual information metric
-        mutual_information += (incremental_mi);
-      }
 
-/*    // debugging code
-      g_print("Current indices are: %i, %i\n", i, j);
-      g_print("Current prob(x,y) is: %e\n", mutual_information_array[i][j] * voxel_probability);
-      g_print("Current prob(x) is: %e\n", margin_moving[i] * voxel_probability);
-      g_print("Current prob(y) is: %e\n", margin_fixed[j] * voxel_probability);
-      if (margin_moving[i] == 0 || margin_fixed[j] == 0 ) {
-        g_print("there is a zero at i=%i, j=%i!\n", i, j);
-      }
-      g_print("Incremental mutual information is: %e\n", incremental_mi);
-      
-      if (margin_moving[i] == 0 || margin_fixed[j] == 0 ) {
-        g_print("there is a zero at i=%i, j=%i!\n", i, j);
+  memset(histogram, 0, sizeof(histogram));
+  mi->histogram = histogram;
+  if (num_samples < MI_PARALLEL_MIN_SAMPLES)
+    mi_evaluate_rows(0, mi->total_rows, mi);
+  else
+    amitk_parallel_for(mi->total_rows, mi_evaluate_rows, mi);
+  mi->histogram = NULL;
+
+  /* the marginal counts */
+  memset(margin_fixed, 0, sizeof(margin_fixed));
+  memset(margin_moving, 0, sizeof(margin_moving));
+  total = 0.0;
+  for (i = 0; i < NUM_BINS; i++)
+    for (j = 0; j < NUM_BINS; j++) {
+      margin_fixed[i] += histogram[i*NUM_BINS+j];
+      margin_moving[j] += histogram[i*NUM_BINS+j];
+      total += histogram[i*NUM_BINS+j];
+    }
+  if (total <= 0.0) return 0.0;
+
+  /* when the probability of (x AND y) == 0, the bin doesn't contribute. Note that a nonzero
+     joint count means both marginal counts are nonzero as well */
+  for (i = 0; i < NUM_BINS; i++)
+    for (j = 0; j < NUM_BINS; j++)
+      if (histogram[i*NUM_BINS+j] > 0.0) {
+	probability = histogram[i*NUM_BINS+j]/total;
+	mutual_information += probability*log2(probability*total*total/(margin_fixed[i]*margin_moving[j]));
       }
-      g_print("Incremental mutual information is: %e\n", incremental_mi); */
 
-    }
+  return mutual_information;
+}
+
+gboolean alignment_mutual_information_evaluate(AmitkDataSet * moving_ds, 
+					       AmitkDataSet * fixed_ds, 
+					       AmitkPoint view_center,
+					       amide_real_t thickness,
+					       amide_time_t view_start_time,
+					       amide_time_t view_duration,
+					       const gboolean partial_volume,
+					       const gint granularity,
+					       AmitkSpace ** spaces,
+					       const gint num_spaces,
+					       gdouble * mutual_information) {
+
+  mi_evaluator_t * mi;
+  gint i;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(moving_ds), FALSE);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(fixed_ds), FALSE);
+  g_return_val_if_fail(granularity > 0, FALSE);
+
+  mi = mi_evaluator_new(fixed_ds, moving_ds, partial_volume, view_center, thickness, view_start_time, view_duration);
+  if (mi == NULL) return FALSE;
+  if (!mi_evaluator_set_granularity(mi, granularity)) {
+    mi_evaluator_free(mi);
+    return FALSE;
   }
-  // g_print("\nThe mutual information sum is %f\n", mutual_information);
-  // g_print("the count of NAN in the MI algorithm was\t%d\n", mi_nan_count);
 
+  for (i=0; i<num_spaces; i++)
+    mutual_information[i] = mi_evaluator_calculate(mi, spaces[i]);
 
-  return mutual_information;
-  
+  mi_evaluator_free(mi);
+
+  return TRUE;
 }
 
 /* rot_x, y, and z are angles about the respective axes, in radians */
@@ -261,6 +456,7 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
 					  amide_real_t thickness,
 					  amide_time_t view_start_time,
 					  amide_time_t view_duration,
+					  const gboolean partial_volume,
 					  gdouble * pointer_mutual_information_error,
 					  AmitkUpdateFunc update_func,
 					  gpointer update_data) {
@@ -285,9 +481,7 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
   AmitkPoint current_shift, current_rotation;
   gchar * temp_string;
   gboolean continue_work = TRUE;
-  AmitkDataSet * fixed_slice[AMITK_VIEW_NUM] = {NULL, NULL, NULL};
-  gboolean fixed_slices_current;
-  AmitkView i_view;
+  mi_evaluator_t * mi;
 
   //  random_generator = g_rand_new();
   
@@ -303,11 +497,22 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
   translation_precision = TRANSLATION_MAX_DISTANCE;
   rotation_precision = ROTATION_MAX_ANGLE;
   step_size = INITIAL_STEP_SIZE;
-  fixed_slices_current = FALSE;
+
+  mi = mi_evaluator_new(fixed_ds, moving_ds, partial_volume, view_center, thickness, view_start_time, view_duration);
+  if (mi == NULL) {
+    g_object_unref(last_best_space);
+    g_object_unref(new_space);
+    return NULL;
+  }
+  if (!mi_evaluator_set_granularity(mi, step_size)) {
+    mi_evaluator_free(mi);
+    g_object_unref(last_best_space);
+    g_object_unref(new_space);
+    return NULL;
+  }
 
   /* set baseline characteristics, including baseline space and initial error */
-  best_mi = calculate_mutual_information(fixed_ds, moving_ds, new_space, step_size, &fixed_slices_current, fixed_slice,
-					 view_center, thickness, view_start_time, view_duration);
+  best_mi = mi_evaluator_calculate(mi, new_space);
 #ifdef AMIDE_DEBUG
   g_print("initial mi %f\n", best_mi);
 #endif
@@ -341,8 +546,7 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
           
           /* first test whether offset increases the mutual information */
 	  amitk_space_shift_offset(AMITK_SPACE(new_space), current_shift);
-	  current_mi = calculate_mutual_information( fixed_ds, moving_ds, new_space, step_size, &fixed_slices_current, fixed_slice,
-						     view_center, thickness, view_start_time, view_duration);
+	  current_mi = mi_evaluator_calculate(mi, new_space);
           
           /*if this location gives a better mutual information, then keep it */
           if (current_mi > best_mi ) {
@@ -377,8 +581,7 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
           
           /* first test whether offset increases the mutual information */
           rotate(current_rotation, AMITK_SPACE(new_space));
-          current_mi = calculate_mutual_information( fixed_ds, moving_ds, new_space, step_size, &fixed_slices_current, fixed_slice,
-						     view_center, thickness, view_start_time, view_duration);
+          current_mi = mi_evaluator_calculate(mi, new_space);
 
 	  /*if this location gives a better mutual information, then keep it */
           if (current_mi > best_mi ) {
@@ -409,7 +612,8 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
       step_size = step_size / 2.0;
       if (step_size < MIN_STEP_SIZE ) 
 	step_size = MIN_STEP_SIZE;
-      fixed_slices_current = FALSE;
+      if (!mi_evaluator_set_granularity(mi, step_size))
+	continue_work = FALSE;
     }
   }
   
@@ -424,10 +628,7 @@ AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds,
     g_object_unref(last_best_space);
   if (new_space != NULL)
     g_object_unref(new_space);
-  for (i_view = 0; i_view < AMITK_VIEW_NUM; i_view++) {
-    if (fixed_slice[i_view] != NULL)
-      amitk_object_unref(AMITK_OBJECT(fixed_slice[i_view]));
-  }
+  mi_evaluator_free(mi);
     
   *pointer_mutual_information_error = best_mi;
   
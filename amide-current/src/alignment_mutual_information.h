@@ -32,16 +32,34 @@
 /* external functions */
 /* the space returned is the transform needed to change moving_ds's space to the
    aligned space, incoding an axes rotation, as well as the necessary shift
-   with respect to the dataset's center */
+   with respect to the dataset's center. partial_volume selects partial volume
+   interpolation of the moving data set into the joint histogram, otherwise
+   nearest neighbor is used.  Returns NULL on failure */
 AmitkSpace * alignment_mutual_information(AmitkDataSet * moving_ds, 
 					  AmitkDataSet * fixed_ds, 
 					  AmitkPoint view_center,
 					  amide_real_t thickness,
 					  amide_time_t view_start_time,
 					  amide_time_t view_duration,
+					  const gboolean partial_volume,
 					  gdouble * pointer_mutual_information_error,
 					  AmitkUpdateFunc update_func,
 					  gpointer update_data);
 
+/* the mutual information alignment_mutual_information works from, with moving_ds
+   placed at each of the spaces in turn and the fixed data set sampled every
+   granularity voxels. Used by test_alignment. Returns FALSE on failure */
+gboolean alignment_mutual_information_evaluate(AmitkDataSet * moving_ds, 
+					       AmitkDataSet * fixed_ds, 
+					       AmitkPoint view_center,
+					       amide_real_t thickness,
+					       amide_time_t view_start_time,
+					       amide_time_t view_duration,
+					       const gboolean partial_volume,
+					       const gint granularity,
+					       AmitkSpace ** spaces,
+					       const gint num_spaces,
+					       gdouble * mutual_information);
+
 
 #endif /* __ALIGNMENT_MUTUAL_INFORMATION_H__ */
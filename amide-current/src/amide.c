@@ -35,6 +35,7 @@
 #include "amide_gnome.h"
 //#include "amitk_type_builtins.h"
 #include "amitk_common.h"
+#include "amitk_job.h"
 #include "amitk_study.h"
 #include "pixmaps.h"
 #include "ui_study.h"
@@ -50,6 +51,9 @@ gchar * object_menu_names[] = {
   N_("Selected _Alignment Points")
 };
 
+/* the thread running the gtk main loop, the only one that can put up dialogs */
+static GThread * main_thread = NULL;
+
 
 void amide_log_handler_nopopup(const gchar *log_domain,
 			       GLogLevelFlags log_level,
@@ -74,8 +78,17 @@ void amide_log_handler(const gchar *log_domain,
   GtkWidget * message_area;
   GtkWidget * scrolled;
   GtkWidget * label;
+  AmitkJob * job;
+
+  /* a background job's warnings get shown once the job's finished */
+  job = amitk_job_get_current();
+  if (job != NULL) {
+    amitk_job_add_message(job, message);
+    return;
+  }
 
-  if (AMITK_PREFERENCES_WARNINGS_TO_CONSOLE(preferences)) {
+  if (AMITK_PREFERENCES_WARNINGS_TO_CONSOLE(preferences) ||
+      ((main_thread != NULL) && (g_thread_self() != main_thread))) {
     if (log_level & G_LOG_LEVEL_MESSAGE) 
       g_print("AMIDE MESSAGE: %s\n", message);
     else if (log_level & G_LOG_LEVEL_WARNING) /* G_LOG_LEVEL_WARNING */
@@ -185,6 +198,7 @@ int main (int argc, char *argv []) {
   gchar * studyname=NULL;
   // GOptionContext *context;
 
+  main_thread = g_thread_self();
 
   /* setup i18n */
   //  setlocale(LC_ALL, "");
@@ -30,6 +30,7 @@
 #include "amitk_canvas.h"
 #include "amitk_canvas_object.h"
 #include "image.h"
+#include "amitk_slice_cache.h"
 #include "ui_common.h"
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
@@ -174,7 +175,6 @@ static void canvas_time_changed_cb(AmitkStudy * study, gpointer canvas);
 static void canvas_volume_changed_cb(AmitkVolume * vol, gpointer canvas);
 static void canvas_roi_changed_cb(AmitkRoi * roi, gpointer canvas);
 static void canvas_fiducial_mark_changed_cb(AmitkFiducialMark * fm, gpointer canvas);
-static void canvas_data_set_invalidate_slice_cache(AmitkDataSet * ds, gpointer data);
 static void data_set_changed_cb(AmitkDataSet * ds, gpointer canvas);
 static void data_set_subject_orientation_changed_cb(AmitkDataSet * ds, gpointer canvas);
 static void data_set_thresholding_changed_cb(AmitkDataSet * ds, gpointer data);
@@ -195,6 +195,7 @@ static void canvas_update_arrows(AmitkCanvas * canvas);
 static void canvas_update_line_profile(AmitkCanvas * canvas);
 static void canvas_update_time_on_image(AmitkCanvas * canvas);
 static void canvas_update_subject_orientation(AmitkCanvas * canvas);
+static void canvas_prefetch_slices(AmitkCanvas * canvas, GList * data_sets, const amide_real_t pixel_dim);
 static void canvas_update_pixbuf(AmitkCanvas * canvas);
 static void canvas_update_object(AmitkCanvas * canvas, AmitkObject * object);
 static void canvas_update_objects(AmitkCanvas * canvas, gboolean all);
@@ -322,12 +323,11 @@ static void canvas_init (AmitkCanvas *canvas)
   amitk_volume_set_corner(canvas->volume, one_point);
 
   canvas->center = zero_point;
+  canvas->prefetch_center = zero_point;
 
   canvas->active_object = NULL;
 
   canvas->canvas = NULL;
-  canvas->slice_cache = NULL;
-  canvas->max_slice_cache_size = 15;
   canvas->slices=NULL;
   canvas->image=NULL;
   canvas->pixbuf=NULL;
@@ -369,9 +369,7 @@ static void canvas_destroy (GtkObject * object) {
   if (canvas->volume != NULL) 
     canvas->volume = amitk_object_unref(canvas->volume);
 
-  if (canvas->slice_cache != NULL) {
-    canvas->slice_cache = amitk_objects_unref(canvas->slice_cache);
-  }
+  amitk_slice_cache_cancel_prefetch(amitk_slice_cache_get_default(), canvas);
 
   if (canvas->slices != NULL) {
     canvas->slices = amitk_objects_unref(canvas->slices);
@@ -658,17 +656,6 @@ static void canvas_fiducial_mark_changed_cb(AmitkFiducialMark * fm, gpointer dat
   return;
 }
 
-static void canvas_data_set_invalidate_slice_cache(AmitkDataSet * ds, gpointer data) {
-
-  AmitkCanvas * canvas = data;  
-
-  g_return_if_fail(AMITK_IS_CANVAS(canvas));
-  g_return_if_fail(AMITK_IS_DATA_SET(ds));
-
-  canvas->slice_cache = amitk_data_sets_remove_with_slice_parent(canvas->slice_cache, ds);
-
-}
-
 static void data_set_changed_cb(AmitkDataSet * ds, gpointer data) {
 
   AmitkCanvas * canvas = data;  
@@ -3223,6 +3210,66 @@ static void canvas_update_subject_orientation(AmitkCanvas * canvas) {
 
 
 
+/* queue up generating the slices we're likely to be asked for next.  When
+   moving through z, these are the next few slices in the same direction.
+   Otherwise, it's the next gate of any data set showing a single gate, which
+   is what gate autoplay steps through */
+static void canvas_prefetch_slices(AmitkCanvas * canvas, GList * data_sets, const amide_real_t pixel_dim) {
+
+  AmitkSliceCache * slice_cache;
+  AmitkCanvasPoint pixel_size;
+  AmitkVolume * volume;
+  AmitkPoint z_axis;
+  AmitkPoint offset;
+  amide_real_t dz;
+  AmitkDataSet * ds;
+  GList * ds_list;
+  gint i;
+
+  slice_cache = amitk_slice_cache_get_default();
+  amitk_slice_cache_cancel_prefetch(slice_cache, canvas);
+
+  pixel_size.x = pixel_size.y = pixel_dim;
+  dz = amitk_space_b2s(AMITK_SPACE(canvas->volume), canvas->center).z - 
+    amitk_space_b2s(AMITK_SPACE(canvas->volume), canvas->prefetch_center).z;
+  canvas->prefetch_center = canvas->center;
+
+  if (!REAL_EQUAL(dz, 0.0)) {
+    /* big jumps (e.g. clicking in another view) don't tell us where we're going */
+    if (fabs(dz) > AMITK_SLICE_CACHE_PREFETCH_DEPTH*AMITK_VOLUME_Z_CORNER(canvas->volume))
+      return;
+
+    z_axis = amitk_space_get_axis(AMITK_SPACE(canvas->volume), AMITK_AXIS_Z);
+    volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(canvas->volume)));
+    for (i=1; i <= AMITK_SLICE_CACHE_PREFETCH_DEPTH; i++) {
+      offset = point_add(AMITK_SPACE_OFFSET(canvas->volume), point_cmult(i*dz, z_axis));
+      amitk_space_set_offset(AMITK_SPACE(volume), offset);
+      amitk_slice_cache_prefetch(slice_cache, canvas, data_sets,
+				 AMITK_STUDY_VIEW_START_TIME(canvas->study),
+				 AMITK_STUDY_VIEW_DURATION(canvas->study),
+				 -1, pixel_size, volume);
+    }
+    amitk_object_unref(volume);
+
+  } else {
+    for (; data_sets != NULL; data_sets = data_sets->next) {
+      ds = AMITK_DATA_SET(data_sets->data);
+      if ((AMITK_DATA_SET_NUM_GATES(ds) > 1) && 
+	  (AMITK_DATA_SET_VIEW_START_GATE(ds) == AMITK_DATA_SET_VIEW_END_GATE(ds))) {
+	ds_list = g_list_append(NULL, ds);
+	amitk_slice_cache_prefetch(slice_cache, canvas, ds_list,
+				   AMITK_STUDY_VIEW_START_TIME(canvas->study),
+				   AMITK_STUDY_VIEW_DURATION(canvas->study),
+				   (AMITK_DATA_SET_VIEW_START_GATE(ds)+1) % AMITK_DATA_SET_NUM_GATES(ds),
+				   pixel_size, canvas->volume);
+	g_list_free(ds_list);
+      }
+    }
+  }
+
+  return;
+}
+
 static void canvas_update_pixbuf(AmitkCanvas * canvas) {
 
   gint old_width, old_height;
@@ -3280,6 +3327,7 @@ static void canvas_update_pixbuf(AmitkCanvas * canvas) {
     canvas->pixbuf = image_blank(width, height,blank_rgba);
     amitk_objects_unref(canvas->slices);
     canvas->slices = NULL;
+    amitk_slice_cache_cancel_prefetch(amitk_slice_cache_get_default(), canvas);
 
   } else {
     if (AMITK_IS_DATA_SET(canvas->active_object))
@@ -3287,8 +3335,7 @@ static void canvas_update_pixbuf(AmitkCanvas * canvas) {
     else
       active_ds = NULL;
     canvas->pixbuf = image_from_data_sets(&(canvas->slices),
-					  &(canvas->slice_cache),
-					  canvas->max_slice_cache_size,
+					  amitk_slice_cache_get_default(),
 					  data_sets,
 					  active_ds,
 					  AMITK_STUDY_VIEW_START_TIME(canvas->study),
@@ -3298,6 +3345,7 @@ static void canvas_update_pixbuf(AmitkCanvas * canvas) {
 					  canvas->volume,
 					  AMITK_STUDY_FUSE_TYPE(canvas->study),
 					  AMITK_CANVAS_VIEW_MODE(canvas));
+    canvas_prefetch_slices(canvas, data_sets, pixel_dim);
     amitk_objects_unref(data_sets);
   }
 
@@ -3623,7 +3671,6 @@ static void canvas_add_object(AmitkCanvas * canvas, AmitkObject * object) {
   }
   if (AMITK_IS_DATA_SET(object)) {
     g_signal_connect(G_OBJECT(object), "data_set_changed", G_CALLBACK(data_set_changed_cb), canvas);
-    g_signal_connect(G_OBJECT(object), "invalidate_slice_cache", G_CALLBACK(canvas_data_set_invalidate_slice_cache), canvas);
     g_signal_connect(G_OBJECT(object), "interpolation_changed", G_CALLBACK(data_set_changed_cb), canvas);
     g_signal_connect(G_OBJECT(object), "rendering_changed", G_CALLBACK(data_set_changed_cb), canvas);
     g_signal_connect(G_OBJECT(object), "thresholding_changed", G_CALLBACK(data_set_thresholding_changed_cb), canvas);
@@ -3704,11 +3751,9 @@ static void canvas_remove_object(AmitkCanvas * canvas, AmitkObject * object) {
   }
   if (AMITK_IS_DATA_SET(object)) {
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_changed_cb, canvas);
-    g_signal_handlers_disconnect_by_func(G_OBJECT(object), canvas_data_set_invalidate_slice_cache, canvas);
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_thresholding_changed_cb, canvas);
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_color_table_changed_cb, canvas);
     g_signal_handlers_disconnect_by_func(G_OBJECT(object), data_set_subject_orientation_changed_cb, canvas);
-    canvas->slice_cache = amitk_data_sets_remove_with_slice_parent(canvas->slice_cache, AMITK_DATA_SET(object));
   }
   
   /* find corresponding CanvasItem and destroy */
@@ -80,8 +80,7 @@ struct _AmitkCanvas
   AmitkObject * active_object;
 
   GList * slices;
-  GList * slice_cache;
-  gint max_slice_cache_size;
+  AmitkPoint prefetch_center; /* center as of the last slice prefetch */
   gint pixbuf_width, pixbuf_height;
   gdouble border_width;
   GnomeCanvasItem * image;
@@ -25,6 +25,7 @@
 
 #include "amide_config.h"
 #include <limits.h>
+#include <float.h>
 #include <math.h>
 #include "amitk_common.h"
 #include "amitk_color_table.h"
@@ -672,6 +673,109 @@ rgba_t amitk_color_table_lookup(amide_data_t datum, AmitkColorTable which,
   return rgba;
 }
 
+#define LUT_CELL(lut, datum) ((gint) (((datum)-(lut)->min)*(lut)->scale))
+
+/* the smallest datum that falls into the given cell or one after it */
+static amide_data_t lut_cell_start(const color_table_lut_t * lut, gint cell) {
+
+  amide_data_t guess, low, high, mid, step;
+
+  /* the guess is usually off by no more than a few ulps, but can be off by a 
+     lot more in terms of ulps near zero, so bracket it and then bisect */
+  guess = lut->min + cell/lut->scale;
+
+  high = guess;
+  step = MAX(fabs(guess)*DBL_EPSILON, DBL_MIN);
+  while (LUT_CELL(lut, high) < cell) {
+    high = guess + step;
+    step *= 2.0;
+  }
+
+  low = guess;
+  step = MAX(fabs(guess)*DBL_EPSILON, DBL_MIN);
+  while ((low > lut->min) && (LUT_CELL(lut, low) >= cell)) {
+    low = MAX(guess - step, lut->min);
+    step *= 2.0;
+  }
+  if (LUT_CELL(lut, low) >= cell) 
+    return low;
+
+  /* LUT_CELL(low) < cell <= LUT_CELL(high), until there's nothing in between */
+  while (TRUE) {
+    mid = low + (high-low)/2.0;
+    if ((mid <= low) || (mid >= high)) 
+      break;
+    if (LUT_CELL(lut, mid) >= cell) 
+      high = mid;
+    else
+      low = mid;
+  }
+
+  return high;
+}
+
+static gboolean rgba_equal(const rgba_t rgba1, const rgba_t rgba2) {
+  return (amitk_color_table_rgba_to_uint32(rgba1) == amitk_color_table_rgba_to_uint32(rgba2));
+}
+
+/* fill in a lookup table for amitk_color_table_lut_lookup.  None of the color
+   tables has a color that only shows up over less than a cell, so a cell that
+   gives the same color at its first and last datum gives that color throughout.
+   test_color_table checks this against amitk_color_table_lookup. */
+void amitk_color_table_lut_init(color_table_lut_t * lut, AmitkColorTable which,
+				amide_data_t min, amide_data_t max) {
+
+  gint i;
+  amide_data_t start, next_start, end;
+  rgba_t end_rgba;
+
+  lut->which = which;
+  lut->min = min;
+  lut->max = max;
+  lut->nan = amitk_color_table_lookup(NAN, which, min, max);
+
+  if (max > min)
+    lut->scale = AMITK_COLOR_TABLE_LUT_SIZE/(max-min);
+  else
+    lut->scale = 0.0;
+
+  /* degenerate ranges just get looked up directly */
+  if ((lut->scale <= 0.0) || !isfinite(lut->scale)) {
+    lut->scale = 0.0;
+    lut->below_uniform = lut->above_uniform = FALSE;
+    for (i=0; i<=AMITK_COLOR_TABLE_LUT_SIZE; i++)
+      lut->uniform[i] = FALSE;
+    return;
+  }
+
+  /* all the color tables saturate outside of min/max */
+  lut->below = amitk_color_table_lookup(nextafter(min, -HUGE_VAL), which, min, max);
+  lut->below_uniform = rgba_equal(lut->below, amitk_color_table_lookup(-HUGE_VAL, which, min, max));
+  lut->above = amitk_color_table_lookup(nextafter(max, HUGE_VAL), which, min, max);
+  lut->above_uniform = rgba_equal(lut->above, amitk_color_table_lookup(HUGE_VAL, which, min, max));
+
+  next_start = min;
+  for (i=0; i<=AMITK_COLOR_TABLE_LUT_SIZE; i++) {
+    start = next_start;
+    if (i < AMITK_COLOR_TABLE_LUT_SIZE) {
+      next_start = lut_cell_start(lut, i+1);
+      end = MIN(nextafter(next_start, -HUGE_VAL), max);
+    } else {
+      end = max;
+    }
+
+    if (start > end) { /* nothing falls into this cell */
+      lut->uniform[i] = FALSE;
+    } else {
+      lut->entry[i] = amitk_color_table_lookup(start, which, min, max);
+      end_rgba = amitk_color_table_lookup(end, which, min, max);
+      lut->uniform[i] = rgba_equal(lut->entry[i], end_rgba);
+    }
+  }
+
+  return;
+}
+
 rgba_t amitk_color_table_uint32_to_rgba(guint32 color_uint32) {
   rgba_t rgba;
 
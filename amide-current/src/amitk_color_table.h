@@ -95,6 +95,27 @@ typedef struct hsv_t {
   hsv_data_t v;
 } hsv_t;
 
+/* a color table precomputed over a given min/max, for when the same
+   color table gets looked up for every pixel of an image.  min/max is cut
+   into cells, and a cell's entry is only used if the color table gives the
+   same color at both ends of the cell, otherwise the color gets looked up
+   directly.  Either way the result is what amitk_color_table_lookup gives. */
+#define AMITK_COLOR_TABLE_LUT_SIZE 16384
+
+typedef struct color_table_lut_t {
+  AmitkColorTable which;
+  amide_data_t min;
+  amide_data_t max;
+  amide_data_t scale; /* (gint) ((datum-min)*scale) gives the cell */
+  rgba_t below; /* datum < min */
+  rgba_t above; /* datum > max */
+  rgba_t nan;
+  gboolean below_uniform;
+  gboolean above_uniform;
+  rgba_t entry[AMITK_COLOR_TABLE_LUT_SIZE+1]; /* the last one is just for datum == max */
+  guint8 uniform[AMITK_COLOR_TABLE_LUT_SIZE+1];
+} color_table_lut_t;
+
 
 /* defines */
 #define amitk_color_table_rgba_to_uint32(rgba) (((rgba).r<<24) | ((rgba).g<<16) | ((rgba).b<<8) | ((rgba).a<<0))
@@ -104,7 +125,29 @@ rgba_t amitk_color_table_uint32_to_rgba(guint32 color_uint32);
 rgba_t amitk_color_table_outline_color(AmitkColorTable which, gboolean highlight);
 rgba_t amitk_color_table_lookup(amide_data_t datum, AmitkColorTable which,
 				amide_data_t min, amide_data_t max);
+void   amitk_color_table_lut_init(color_table_lut_t * lut, AmitkColorTable which,
+				  amide_data_t min, amide_data_t max);
 const gchar * amitk_color_table_get_name(const AmitkColorTable which);
+
+/* gives the same color as amitk_color_table_lookup, note that comparisons against NAN are always false */
+static inline rgba_t amitk_color_table_lut_lookup(const color_table_lut_t * lut, const amide_data_t datum) {
+  gint i;
+
+  if (datum >= lut->min) {
+    if (datum <= lut->max) {
+      i = (gint) ((datum-lut->min)*lut->scale);
+      if (lut->uniform[i]) 
+	return lut->entry[i];
+    } else if (lut->above_uniform)
+      return lut->above;
+  } else if (datum < lut->min) {
+    if (lut->below_uniform)
+      return lut->below;
+  } else
+    return lut->nan;
+
+  return amitk_color_table_lookup(datum, lut->which, lut->min, lut->max);
+}
 /* external variables */
 extern gchar * color_table_menu_names[];
 
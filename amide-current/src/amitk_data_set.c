@@ -29,6 +29,8 @@
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
 #include "amitk_line_profile.h"
+#include "amitk_parallel.h"
+#include "amitk_slice_cache.h"
 
 /* variable type function declarations */
 #include "amitk_data_set_UBYTE_0D_SCALING.h"
@@ -73,9 +75,6 @@
 #include "libmdc_interface.h"
 #include "vistaio_interface.h" 
 
-//#define SLICE_TIMING
-#undef SLICE_TIMING
-
 /* external variables */
 AmitkColorTable amitk_modality_default_color_table[AMITK_MODALITY_NUM] = {
   AMITK_COLOR_TABLE_NIH, /* PET */
@@ -246,17 +245,19 @@ static gchar *       data_set_read_xml               (AmitkObject       *object,
 						      FILE              *study_file,
 						      gchar             *error_buf);
 static void          data_set_invalidate_slice_cache (AmitkDataSet * ds);
+static void          data_set_drop_color_table_luts  (AmitkDataSet * ds);
+static void          data_set_color_table_changed    (AmitkDataSet * ds,
+						      AmitkViewMode view_mode);
 static void          data_set_set_voxel_size         (AmitkDataSet * ds, 
 						      const AmitkPoint voxel_size);
 static void           data_set_drop_intercept        (AmitkDataSet * ds);
 static void           data_set_reduce_scaling_dimension       (AmitkDataSet * ds);
+static void           data_set_free_plane_min_max    (AmitkDataSet * ds);
 static AmitkVolumeClass * parent_class;
 static guint         data_set_signals[LAST_SIGNAL];
 
 
 static amide_data_t calculate_scale_factor(AmitkDataSet * ds);
-GList * slice_cache_trim(GList * slice_cache, gint max_size);
-#define MIN_LOCAL_CACHE_SIZE 3
 
 GType amitk_data_set_get_type(void) {
 
@@ -303,6 +304,11 @@ static void data_set_class_init (AmitkDataSetClass * class) {
   object_class->object_read_xml = data_set_read_xml;
 
   class->invalidate_slice_cache = data_set_invalidate_slice_cache;
+  class->thresholding_changed = data_set_drop_color_table_luts;
+  class->threshold_style_changed = data_set_drop_color_table_luts;
+  class->thresholds_changed = data_set_drop_color_table_luts;
+  class->color_table_changed = data_set_color_table_changed;
+  class->color_table_independent_changed = data_set_color_table_changed;
 
   gobject_class->finalize = data_set_finalize;
 
@@ -445,14 +451,21 @@ static void data_set_init (AmitkDataSet * data_set) {
   AmitkLimit i_limit;
   AmitkViewMode i_view_mode;
 
+  g_rw_lock_init(&(data_set->data_lock));
+
   /* put in some sensable values */
   data_set->raw_data = NULL;
+  for(i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
+    data_set->color_table_lut[i_view_mode] = NULL;
   data_set->current_scaling_factor = NULL;
   data_set->gate_time = NULL;
   data_set->frame_duration = NULL;
   data_set->min_max_calculated = FALSE;
   data_set->frame_max = NULL;
   data_set->frame_min = NULL;
+  data_set->plane_max = NULL;
+  data_set->plane_min = NULL;
+  data_set->plane_modified = NULL;
   data_set->global_max = 0.0;
   data_set->global_min = 0.0;
   amitk_data_set_set_thresholding(data_set, AMITK_THRESHOLDING_GLOBAL);
@@ -460,6 +473,7 @@ static void data_set_init (AmitkDataSet * data_set) {
   for (i=0; i<2; i++)
     data_set->threshold_ref_frame[i]=0;
   data_set->distribution = NULL;
+  data_set->frame_distributions = NULL;
   data_set->modality = AMITK_MODALITY_PET;
   data_set->voxel_size = one_point;
   data_set->scaling_type = AMITK_SCALING_TYPE_0D;
@@ -495,7 +509,6 @@ static void data_set_init (AmitkDataSet * data_set) {
   data_set->rendering = AMITK_RENDERING_MPR;
   data_set->subject_orientation = AMITK_SUBJECT_ORIENTATION_UNKNOWN;
   data_set->subject_sex = AMITK_SUBJECT_SEX_UNKNOWN;
-  data_set->slice_cache = NULL;
   data_set->slice_parent = NULL;
 
   for (i_window=0; i_window < AMITK_WINDOW_NUM; i_window++)
@@ -551,10 +564,8 @@ static void data_set_finalize (GObject *object)
     data_set->current_scaling_factor = NULL;
   }
 
-  if (data_set->distribution != NULL) {
-    g_object_unref(data_set->distribution);
-    data_set->distribution = NULL;
-  }
+  amitk_data_set_invalidate_distribution(data_set);
+  data_set_drop_color_table_luts(data_set);
 
   if (data_set->gate_time != NULL) {
     g_free(data_set->gate_time);
@@ -576,6 +587,8 @@ static void data_set_finalize (GObject *object)
     data_set->frame_min = NULL;
   }
 
+  data_set_free_plane_min_max(data_set);
+
   if (data_set->scan_date != NULL) {
     g_free(data_set->scan_date);
     data_set->scan_date = NULL;
@@ -601,10 +614,8 @@ static void data_set_finalize (GObject *object)
     data_set->dicom_image_type = NULL;
   }
 
-  if (data_set->slice_cache != NULL) {
-    amitk_objects_unref(data_set->slice_cache);
-    data_set->slice_cache = NULL;
-  }
+  /* make sure nothing in the cache still thinks we're their parent */
+  amitk_slice_cache_remove_with_parent(amitk_slice_cache_get_default(), data_set);
 
   if (data_set->slice_parent != NULL) {
     g_object_remove_weak_pointer(G_OBJECT(data_set->slice_parent),
@@ -612,6 +623,8 @@ static void data_set_finalize (GObject *object)
     data_set->slice_parent = NULL;
   }
 
+  g_rw_lock_clear(&(data_set->data_lock));
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -659,10 +672,9 @@ static void data_set_selection_changed(AmitkObject * object) {
   data_set = AMITK_DATA_SET(object);
 
 
-  if (!amitk_object_get_selected(object, AMITK_SELECTION_ANY)) {
-    data_set->slice_cache = 
-      slice_cache_trim(data_set->slice_cache, MIN_LOCAL_CACHE_SIZE);
-  }
+  /* no longer being shown, don't hold onto its slices */
+  if (!amitk_object_get_selected(object, AMITK_SELECTION_ANY)) 
+    amitk_slice_cache_remove_with_parent(amitk_slice_cache_get_default(), data_set);
 
   return;
 }
@@ -734,6 +746,11 @@ static void data_set_copy_in_place (AmitkObject * dest_object, const AmitkObject
       g_object_unref(dest_ds->distribution);
     dest_ds->distribution = g_object_ref(src_ds->distribution);
   }
+  if (src_ds->frame_distributions != NULL) {
+    if (dest_ds->frame_distributions != NULL)
+      g_object_unref(dest_ds->frame_distributions);
+    dest_ds->frame_distributions = g_object_ref(src_ds->frame_distributions);
+  }
   amitk_data_set_set_scale_factor(dest_ds, AMITK_DATA_SET_SCALE_FACTOR(src_object));
   dest_ds->conversion = AMITK_DATA_SET_CONVERSION(src_object);
   dest_ds->injected_dose = AMITK_DATA_SET_INJECTED_DOSE(src_object);
@@ -792,6 +809,7 @@ static void data_set_copy_in_place (AmitkObject * dest_object, const AmitkObject
     g_free(dest_ds->frame_min);
     dest_ds->frame_min = NULL;
   }
+  data_set_free_plane_min_max(dest_ds); /* the per plane values aren't copied */
 
   if (src_ds->min_max_calculated) {
     dest_ds->global_max = AMITK_DATA_SET(src_object)->global_max;
@@ -1285,12 +1303,28 @@ static gchar * data_set_read_xml(AmitkObject * object, xmlNodePtr nodes,
 static void data_set_invalidate_slice_cache(AmitkDataSet * data_set) {
 
   /* invalidate cache */
-  if (data_set->slice_cache != NULL) {
-    amitk_objects_unref(data_set->slice_cache);
-    data_set->slice_cache = NULL;
-  }
+  amitk_slice_cache_remove_with_parent(amitk_slice_cache_get_default(), data_set);
+
+
+  return;
+}
+
+static void data_set_drop_color_table_luts(AmitkDataSet * ds) {
+
+  AmitkViewMode i_view_mode;
 
+  for(i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
+    if (ds->color_table_lut[i_view_mode] != NULL) {
+      g_free(ds->color_table_lut[i_view_mode]);
+      ds->color_table_lut[i_view_mode] = NULL;
+    }
+
+  return;
+}
 
+/* the independent color tables can change which table a view mode uses, so just drop them all */
+static void data_set_color_table_changed(AmitkDataSet * ds, AmitkViewMode view_mode) {
+  data_set_drop_color_table_luts(ds);
   return;
 }
 
@@ -1856,8 +1890,10 @@ static gboolean export_raw(AmitkDataSet *ds,
 	}
 
 	if (resliced) {
+	  amitk_data_set_read_lock(ds);
 	  slice = amitk_data_set_get_slice(ds, frame_start, frame_duration, i.g,
 					   pixel_size, output_volume);
+	  amitk_data_set_read_unlock(ds);
 
 	  if ((AMITK_DATA_SET_DIM_X(slice) != dim.x) || (AMITK_DATA_SET_DIM_Y(slice) != dim.y)) {
 	    g_warning(_("Error in generating resliced data, %dx%d != %dx%d"),
@@ -2118,7 +2154,7 @@ gboolean amitk_data_sets_export_to_file(GList * data_sets,
 	/* advance the requested slice volume */
 	amitk_space_set_offset(AMITK_SPACE(volume), amitk_space_s2b(AMITK_SPACE(export_ds), new_offset));
 
-	slices = amitk_data_sets_get_slices(data_sets, NULL, 0,
+	slices = amitk_data_sets_get_slices(data_sets, NULL,
 					    amitk_data_set_get_start_time(export_ds, i_voxel.t)+EPSILON,
 					    amitk_data_set_get_frame_duration(export_ds, i_voxel.t)-EPSILON,
 					    i_voxel.g,
@@ -2345,6 +2381,42 @@ AmitkColorTable amitk_data_set_get_color_table_to_use(AmitkDataSet * ds, const A
     return AMITK_DATA_SET_COLOR_TABLE(ds, AMITK_VIEW_MODE_SINGLE);
 }
 
+/* returns the color table lookup table for drawing this data set in the given
+   view mode between min and max.  The last one built for each view mode is kept,
+   and dropped when the color table or thresholds change, so redrawing doesn't
+   rebuild it.  Only to be used from the main thread.  NULL if out of memory */
+const color_table_lut_t * amitk_data_set_get_color_table_lut(AmitkDataSet * ds, 
+							     const AmitkViewMode view_mode,
+							     const amide_data_t min,
+							     const amide_data_t max) {
+
+  AmitkColorTable color_table;
+  color_table_lut_t * lut;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+  g_return_val_if_fail(view_mode >= 0, NULL);
+  g_return_val_if_fail(view_mode < AMITK_VIEW_MODE_NUM, NULL);
+
+  color_table = amitk_data_set_get_color_table_to_use(ds, view_mode);
+  lut = ds->color_table_lut[view_mode];
+
+  /* min/max come from the thresholds and threshold style, and are all the table 
+     depends on besides the color table */
+  if ((lut != NULL) && (lut->which == color_table) && (lut->min == min) && (lut->max == max))
+    return lut;
+
+  if (lut == NULL) {
+    if ((lut = g_try_new(color_table_lut_t, 1)) == NULL) {
+      g_warning(_("couldn't allocate memory space for the color table lookup"));
+      return NULL;
+    }
+    ds->color_table_lut[view_mode] = lut;
+  }
+  amitk_color_table_lut_init(lut, color_table, min, max);
+
+  return lut;
+}
+
 void amitk_data_set_set_modality(AmitkDataSet * ds, const AmitkModality modality) {
 
   g_return_if_fail(AMITK_IS_DATA_SET(ds));
@@ -2719,6 +2791,9 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
 
   if (need_update) {
 
+    /* current_scaling_factor may get reallocated, wait for anyone reading it */
+    amitk_data_set_write_lock(ds);
+
     if (ds->current_scaling_factor == NULL) /* first time */
       scaling = 1.0;
     else
@@ -2764,6 +2839,13 @@ void amitk_data_set_set_scale_factor(AmitkDataSet * ds, amide_data_t new_scale_f
 	ds->frame_max[j] *= scaling;
 	ds->frame_min[j] *= scaling;
       }
+    if ((AMITK_DATA_SET_RAW_DATA(ds) != NULL) && (ds->plane_max != NULL) && (ds->plane_min != NULL))
+      for (j=0; j < AMITK_DATA_SET_TOTAL_PLANES(ds); j++) {
+	ds->plane_max[j] *= scaling;
+	ds->plane_min[j] *= scaling;
+      }
+
+    amitk_data_set_write_unlock(ds);
 
     /* and emit the signal */
     g_signal_emit (G_OBJECT (ds), data_set_signals[SCALE_FACTOR_CHANGED], 0);
@@ -3102,33 +3184,82 @@ void amitk_data_set_slice_calc_min_max (AmitkDataSet * ds,
   (*calc_slice_min_max_func[ds->raw_data->format][ds->scaling_type])(ds, frame, gate, z, pmin, pmax);
 }
 
-/* function to calculate the max and min over the data frames */
-void amitk_data_set_calc_min_max(AmitkDataSet * ds,
-				 AmitkUpdateFunc update_func,
-				 gpointer update_data) {
+static void data_set_free_plane_min_max(AmitkDataSet * ds) {
+
+  if (ds->plane_max != NULL) {
+    g_free(ds->plane_max);
+    ds->plane_max = NULL;
+  }
+
+  if (ds->plane_min != NULL) {
+    g_free(ds->plane_min);
+    ds->plane_min = NULL;
+  }
+
+  if (ds->plane_modified != NULL) {
+    g_free(ds->plane_modified);
+    ds->plane_modified = NULL;
+  }
+
+  return;
+}
+
+typedef struct {
+  AmitkDataSet * ds;
+  gint * planes; /* the planes to calculate */
+  gint offset; /* where in planes the current block starts */
+} calc_planes_t;
+
+/* the planes are independent of each other, so can be done in parallel */
+static void calc_planes_min_max(const gint start, const gint end, gpointer data) {
+
+  calc_planes_t * cp = data;
+  AmitkVoxel dim;
+  gint i, i_plane;
+
+  dim = AMITK_DATA_SET_DIM(cp->ds);
+
+  for (i=start; i<end; i++) {
+    i_plane = cp->planes[cp->offset+i];
+    amitk_data_set_slice_calc_min_max(cp->ds, 
+				      i_plane/(dim.z*dim.g), 
+				      (i_plane/dim.z) % dim.g, 
+				      i_plane % dim.z,
+				      cp->ds->plane_min+i_plane, 
+				      cp->ds->plane_max+i_plane);
+  }
+
+  return;
+}
+
+/* calculates the max/min of the given planes (which should be in increasing order),
+   and then combines all the per plane values into the frame and global max/min */
+static void data_set_calc_planes_min_max(AmitkDataSet * ds,
+					 gint * planes,
+					 const gint num_planes,
+					 AmitkUpdateFunc update_func,
+					 gpointer update_data) {
 
   AmitkVoxel i;
   amide_data_t max, min, temp;
-  amide_data_t slice_max, slice_min;
-  div_t x;
-  gint divider;
-  gint total_planes;
+  calc_planes_t cp;
+  gint planes_per_frame;
+  gint block_size;
+  gint start, end;
   gint i_plane;
   gchar * temp_string;
   AmitkVoxel dim;
+#ifdef AMIDE_DEBUG
+  struct timeval tv1;
+  struct timeval tv2;
+  gdouble time1;
+  gdouble time2;
 
-  g_return_if_fail(AMITK_IS_DATA_SET(ds));
-  g_return_if_fail(ds->raw_data != NULL);
+  gettimeofday(&tv1, NULL);
+#endif
 
   dim = AMITK_DATA_SET_DIM(ds);
-
-  /* allocate the arrays if we haven't already */
-  if (ds->frame_max == NULL) {
-    ds->frame_max = amitk_data_set_get_frame_min_max_mem(ds);
-    ds->frame_min = amitk_data_set_get_frame_min_max_mem(ds);
-  }
-  g_return_if_fail(ds->frame_max != NULL);
-  g_return_if_fail(ds->frame_min != NULL);
+  planes_per_frame = dim.z*dim.g;
 
   /* note, we can't cancel this */
   if (update_func != NULL) {
@@ -3139,8 +3270,30 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
     g_free(temp_string);
   }
 
-  total_planes = AMITK_DATA_SET_TOTAL_PLANES(ds);
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
+  /* work through the planes in blocks, so we can update the progress bar in between,
+     with each block big enough to keep all the threads busy */
+  if (update_func != NULL) 
+    block_size = MAX(num_planes/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = num_planes;
+  block_size = MAX(block_size, 1);
+
+  cp.ds = ds;
+  cp.planes = planes;
+  for (start=0; start < num_planes; start = end) {
+    end = MIN(start+block_size, num_planes);
+    if (update_func != NULL)
+      (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) num_planes));
+
+    amitk_raw_data_page_in_frames(ds->raw_data, 
+				  planes[start]/planes_per_frame, 
+				  planes[end-1]/planes_per_frame);
+    cp.offset = start;
+    amitk_parallel_for(end-start, calc_planes_min_max, &cp);
+  }
+
+  if (update_func != NULL)
+    (*update_func)(update_data, NULL, (gdouble) 2.0); /* remove progress bar */
 
   i_plane=0;
   for (i.t = 0; i.t < dim.t; i.t++) {
@@ -3151,18 +3304,12 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
 
     for (i.g = 0; i.g < dim.g; i.g++) {
       for (i.z = 0; i.z < dim.z; i.z++, i_plane++) {
-	if (update_func != NULL) {
-	  x = div(i_plane, divider);
-	  if (x.rem == 0) 
-	    (*update_func)(update_data, NULL, ((gdouble) i_plane)/((gdouble)total_planes));
-	}
-	amitk_data_set_slice_calc_min_max(ds, i.t, i.g, i.z, &slice_min, &slice_max);
-	if (finite(slice_min))
-	  if (slice_min < min)
-	    min = slice_min;
-	if (finite(slice_max))
-	  if (slice_max > max)
-	    max = slice_max;
+	if (finite(ds->plane_min[i_plane]))
+	  if (ds->plane_min[i_plane] < min)
+	    min = ds->plane_min[i_plane];
+	if (finite(ds->plane_max[i_plane]))
+	  if (ds->plane_max[i_plane] > max)
+	    max = ds->plane_max[i_plane];
       }
     }    
     ds->frame_max[i.t] = max;
@@ -3174,9 +3321,6 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
 #endif
   }
 
-  if (update_func != NULL)
-    (*update_func)(update_data, NULL, (gdouble) 2.0); /* remove progress bar */
-
   /* calc the global max/min */
   ds->global_max = ds->frame_max[0];
   ds->global_min = ds->frame_min[0];
@@ -3191,13 +3335,120 @@ void amitk_data_set_calc_min_max(AmitkDataSet * ds,
   ds->min_max_calculated = TRUE;
 
 #ifdef AMIDE_DEBUG
-  if (AMITK_DATA_SET_DIM_Z(ds) > 1) /* don't print for slices */
+  if (AMITK_DATA_SET_DIM_Z(ds) > 1) { /* don't print for slices */
+    gettimeofday(&tv2, NULL);
+    time1 = ((double) tv1.tv_sec) + ((double) tv1.tv_usec)/1000000.0;
+    time2 = ((double) tv2.tv_sec) + ((double) tv2.tv_usec)/1000000.0;
     g_print("\tglobal max %5.3g global min %5.3g\n",ds->global_max,ds->global_min);
+    g_print("\t%d of %d planes recalculated in %5.3f seconds\n", 
+	    num_planes, AMITK_DATA_SET_TOTAL_PLANES(ds), time2-time1);
+  }
 #endif
    
   return;
 }
 
+/* function to calculate the max and min over the data frames */
+void amitk_data_set_calc_min_max(AmitkDataSet * ds,
+				 AmitkUpdateFunc update_func,
+				 gpointer update_data) {
+
+  gint total_planes;
+  gint i_plane;
+  gint * planes;
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_return_if_fail(ds->raw_data != NULL);
+
+  /* allocate the arrays if we haven't already */
+  if (ds->frame_max == NULL) {
+    ds->frame_max = amitk_data_set_get_frame_min_max_mem(ds);
+    ds->frame_min = amitk_data_set_get_frame_min_max_mem(ds);
+  }
+  g_return_if_fail(ds->frame_max != NULL);
+  g_return_if_fail(ds->frame_min != NULL);
+
+  /* the per plane arrays always get reallocated, as the raw data may have changed size */
+  total_planes = AMITK_DATA_SET_TOTAL_PLANES(ds);
+  data_set_free_plane_min_max(ds);
+  ds->plane_max = g_try_new(amide_data_t, total_planes);
+  ds->plane_min = g_try_new(amide_data_t, total_planes);
+  ds->plane_modified = g_try_new0(gboolean, total_planes);
+  planes = g_try_new(gint, total_planes);
+  if ((ds->plane_max == NULL) || (ds->plane_min == NULL) || 
+      (ds->plane_modified == NULL) || (planes == NULL)) {
+    g_warning(_("couldn't allocate memory space for the max/min values"));
+    data_set_free_plane_min_max(ds);
+    if (planes != NULL) g_free(planes);
+    return;
+  }
+
+  for (i_plane=0; i_plane < total_planes; i_plane++)
+    planes[i_plane] = i_plane;
+
+  data_set_calc_planes_min_max(ds, planes, total_planes, update_func, update_data);
+  g_free(planes);
+   
+  return;
+}
+
+/* only recalculates the max/min of the planes that have been modified since the last time */
+void amitk_data_set_update_min_max(AmitkDataSet * ds,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data) {
+
+  gint total_planes;
+  gint num_planes;
+  gint i_plane;
+  gint * planes;
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_return_if_fail(ds->raw_data != NULL);
+
+  if (!ds->min_max_calculated || (ds->plane_modified == NULL) || (ds->frame_max == NULL)) {
+    amitk_data_set_calc_min_max(ds, update_func, update_data);
+    return;
+  }
+
+  total_planes = AMITK_DATA_SET_TOTAL_PLANES(ds);
+  planes = g_try_new(gint, total_planes);
+  if (planes == NULL) {
+    g_warning(_("couldn't allocate memory space for the max/min values"));
+    return;
+  }
+
+  num_planes = 0;
+  for (i_plane=0; i_plane < total_planes; i_plane++)
+    if (ds->plane_modified[i_plane]) {
+      ds->plane_modified[i_plane] = FALSE;
+      planes[num_planes++] = i_plane;
+    }
+
+  if (num_planes > 0)
+    data_set_calc_planes_min_max(ds, planes, num_planes, update_func, update_data);
+  g_free(planes);
+
+  return;
+}
+
+/* marks a plane as needing its max/min recalculated by amitk_data_set_update_min_max,
+   for when the data has been changed without going through set_value */
+void amitk_data_set_set_plane_modified(AmitkDataSet * ds,
+				       const amide_intpoint_t frame,
+				       const amide_intpoint_t gate,
+				       const amide_intpoint_t z) {
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_return_if_fail((frame >= 0) && (frame < AMITK_DATA_SET_NUM_FRAMES(ds)));
+  g_return_if_fail((gate >= 0) && (gate < AMITK_DATA_SET_NUM_GATES(ds)));
+  g_return_if_fail((z >= 0) && (z < AMITK_DATA_SET_DIM_Z(ds)));
+
+  if (ds->plane_modified != NULL)
+    ds->plane_modified[(frame*AMITK_DATA_SET_NUM_GATES(ds) + gate)*AMITK_DATA_SET_DIM_Z(ds) + z] = TRUE;
+
+  return;
+}
+
 void amitk_data_set_calc_min_max_if_needed(AmitkDataSet * ds,
 					   AmitkUpdateFunc update_func,
 					   gpointer update_data) {
@@ -3391,17 +3642,214 @@ void amitk_data_set_get_thresholding_min_max(AmitkDataSet * ds,
 
   
 
-static void (*calc_distribution_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, AmitkUpdateFunc, gpointer) = {
-  {amitk_data_set_UBYTE_0D_SCALING_calc_distribution, amitk_data_set_UBYTE_1D_SCALING_calc_distribution,  amitk_data_set_UBYTE_2D_SCALING_calc_distribution, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_calc_distribution,  amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_calc_distribution  },
-  {amitk_data_set_SBYTE_0D_SCALING_calc_distribution, amitk_data_set_SBYTE_1D_SCALING_calc_distribution,  amitk_data_set_SBYTE_2D_SCALING_calc_distribution, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_calc_distribution,  amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_calc_distribution  },
-  {amitk_data_set_USHORT_0D_SCALING_calc_distribution,amitk_data_set_USHORT_1D_SCALING_calc_distribution, amitk_data_set_USHORT_2D_SCALING_calc_distribution,amitk_data_set_USHORT_0D_SCALING_INTERCEPT_calc_distribution,amitk_data_set_USHORT_1D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_calc_distribution },
-  {amitk_data_set_SSHORT_0D_SCALING_calc_distribution,amitk_data_set_SSHORT_1D_SCALING_calc_distribution, amitk_data_set_SSHORT_2D_SCALING_calc_distribution,amitk_data_set_SSHORT_0D_SCALING_INTERCEPT_calc_distribution,amitk_data_set_SSHORT_1D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_SSHORT_2D_SCALING_INTERCEPT_calc_distribution },
-  {amitk_data_set_UINT_0D_SCALING_calc_distribution,  amitk_data_set_UINT_1D_SCALING_calc_distribution,   amitk_data_set_UINT_2D_SCALING_calc_distribution,  amitk_data_set_UINT_0D_SCALING_INTERCEPT_calc_distribution,  amitk_data_set_UINT_1D_SCALING_INTERCEPT_calc_distribution,   amitk_data_set_UINT_2D_SCALING_INTERCEPT_calc_distribution   },
-  {amitk_data_set_SINT_0D_SCALING_calc_distribution,  amitk_data_set_SINT_1D_SCALING_calc_distribution,   amitk_data_set_SINT_2D_SCALING_calc_distribution,  amitk_data_set_SINT_0D_SCALING_INTERCEPT_calc_distribution,  amitk_data_set_SINT_1D_SCALING_INTERCEPT_calc_distribution,   amitk_data_set_SINT_2D_SCALING_INTERCEPT_calc_distribution   },
-  {amitk_data_set_FLOAT_0D_SCALING_calc_distribution, amitk_data_set_FLOAT_1D_SCALING_calc_distribution,  amitk_data_set_FLOAT_2D_SCALING_calc_distribution, amitk_data_set_FLOAT_0D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_FLOAT_1D_SCALING_INTERCEPT_calc_distribution,  amitk_data_set_FLOAT_2D_SCALING_INTERCEPT_calc_distribution  },
-  {amitk_data_set_DOUBLE_0D_SCALING_calc_distribution,amitk_data_set_DOUBLE_1D_SCALING_calc_distribution, amitk_data_set_DOUBLE_2D_SCALING_calc_distribution,amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_calc_distribution,amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_calc_distribution, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_calc_distribution }
+static void (*calc_slice_distribution_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(AmitkDataSet *, const amide_intpoint_t, const amide_intpoint_t, const amide_intpoint_t, const amide_data_t, const amide_data_t, const gint, guint *) = {
+  {amitk_data_set_UBYTE_0D_SCALING_calc_slice_distribution, amitk_data_set_UBYTE_1D_SCALING_calc_slice_distribution, amitk_data_set_UBYTE_2D_SCALING_calc_slice_distribution, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_SBYTE_0D_SCALING_calc_slice_distribution, amitk_data_set_SBYTE_1D_SCALING_calc_slice_distribution, amitk_data_set_SBYTE_2D_SCALING_calc_slice_distribution, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_USHORT_0D_SCALING_calc_slice_distribution, amitk_data_set_USHORT_1D_SCALING_calc_slice_distribution, amitk_data_set_USHORT_2D_SCALING_calc_slice_distribution, amitk_data_set_USHORT_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_USHORT_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_SSHORT_0D_SCALING_calc_slice_distribution, amitk_data_set_SSHORT_1D_SCALING_calc_slice_distribution, amitk_data_set_SSHORT_2D_SCALING_calc_slice_distribution, amitk_data_set_SSHORT_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SSHORT_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SSHORT_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_UINT_0D_SCALING_calc_slice_distribution, amitk_data_set_UINT_1D_SCALING_calc_slice_distribution, amitk_data_set_UINT_2D_SCALING_calc_slice_distribution, amitk_data_set_UINT_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_UINT_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_UINT_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_SINT_0D_SCALING_calc_slice_distribution, amitk_data_set_SINT_1D_SCALING_calc_slice_distribution, amitk_data_set_SINT_2D_SCALING_calc_slice_distribution, amitk_data_set_SINT_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SINT_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_SINT_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_FLOAT_0D_SCALING_calc_slice_distribution, amitk_data_set_FLOAT_1D_SCALING_calc_slice_distribution, amitk_data_set_FLOAT_2D_SCALING_calc_slice_distribution, amitk_data_set_FLOAT_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_FLOAT_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_FLOAT_2D_SCALING_INTERCEPT_calc_slice_distribution },
+  {amitk_data_set_DOUBLE_0D_SCALING_calc_slice_distribution, amitk_data_set_DOUBLE_1D_SCALING_calc_slice_distribution, amitk_data_set_DOUBLE_2D_SCALING_calc_slice_distribution, amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_calc_slice_distribution, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_calc_slice_distribution }
 };
 
+typedef struct {
+  AmitkDataSet * ds;
+  amide_data_t min;
+  amide_data_t scale;
+  gint num_bins;
+  gboolean per_frame;
+  gint offset; /* first plane of the current block */
+  amitk_format_DOUBLE_t * histogram; /* protected by mutex */
+  GMutex mutex;
+} calc_histogram_t;
+
+static void histogram_add(calc_histogram_t * ch, const guint * bins, const gint frame) {
+
+  amitk_format_DOUBLE_t * dest;
+  gint k;
+
+  dest = ch->histogram + (ch->per_frame ? frame*ch->num_bins : 0);
+
+  g_mutex_lock(&(ch->mutex));
+  for (k=0; k < ch->num_bins; k++)
+    dest[k] += bins[k];
+  g_mutex_unlock(&(ch->mutex));
+
+  return;
+}
+
+/* each range of planes gets binned into its own histogram, which is only added into
+   the shared histogram at the end (or when moving onto the next frame), so the threads 
+   don't fight over the bins */
+static void calc_histogram_planes(const gint start, const gint end, gpointer data) {
+
+  calc_histogram_t * ch = data;
+  guint * bins;
+  AmitkVoxel dim;
+  gint planes_per_frame;
+  gint i_plane, frame, last_frame;
+
+  dim = AMITK_DATA_SET_DIM(ch->ds);
+  planes_per_frame = dim.z*dim.g;
+  bins = g_new0(guint, ch->num_bins);
+
+  last_frame = (ch->offset+start)/planes_per_frame;
+  for (i_plane=ch->offset+start; i_plane < ch->offset+end; i_plane++) {
+    frame = i_plane/planes_per_frame;
+    if (ch->per_frame && (frame != last_frame)) {
+      histogram_add(ch, bins, last_frame);
+      memset(bins, 0, ch->num_bins*sizeof(guint));
+      last_frame = frame;
+    }
+    (*calc_slice_distribution_func[ch->ds->raw_data->format][ch->ds->scaling_type])
+      (ch->ds, frame, (i_plane/dim.z) % dim.g, i_plane % dim.z, ch->min, ch->scale, ch->num_bins, bins);
+  }
+  histogram_add(ch, bins, last_frame);
+
+  g_free(bins);
+
+  return;
+}
+
+/* returns a histogram of the data set's values, with num_bins bins spread evenly between
+   the global min and max.  If per_frame is true, there's a histogram for each frame 
+   (dim.t of the returned data), otherwise one for the whole data set.
+   Returns NULL if canceled. */
+AmitkRawData * amitk_data_set_calc_histogram(AmitkDataSet * ds,
+					     const gint num_bins,
+					     const gboolean per_frame,
+					     AmitkUpdateFunc update_func,
+					     gpointer update_data) {
+
+  calc_histogram_t ch;
+  AmitkRawData * histogram;
+  AmitkVoxel histogram_dim;
+  amide_data_t diff;
+  gint planes_per_frame;
+  gint total_planes;
+  gint block_size;
+  gint start, end;
+  gchar * temp_string;
+  gboolean continue_work=TRUE;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+  g_return_val_if_fail(ds->raw_data != NULL, NULL);
+  g_return_val_if_fail(num_bins > 0, NULL);
+
+  /* get the min/max before we start, this may need to be calculated */
+  ch.min = amitk_data_set_get_global_min(ds);
+  diff = amitk_data_set_get_global_max(ds) - ch.min;
+  if (diff == 0.0)
+    ch.scale = 0.0;
+  else
+    ch.scale = (num_bins-1)/diff;
+
+  histogram_dim.x = num_bins;
+  histogram_dim.y = histogram_dim.z = histogram_dim.g = 1;
+  histogram_dim.t = per_frame ? AMITK_DATA_SET_NUM_FRAMES(ds) : 1;
+  histogram = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, histogram_dim);
+  if (histogram == NULL) {
+    g_warning(_("couldn't allocate memory space for the data set structure to hold distribution data"));
+    return NULL;
+  }
+  amitk_raw_data_DOUBLE_initialize_data(histogram, 0.0);
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Generating distribution data for:\n   %s"), AMITK_OBJECT_NAME(ds));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+
+  ch.ds = ds;
+  ch.num_bins = num_bins;
+  ch.per_frame = per_frame;
+  ch.histogram = histogram->data;
+  g_mutex_init(&(ch.mutex));
+
+  total_planes = AMITK_DATA_SET_TOTAL_PLANES(ds);
+  planes_per_frame = AMITK_DATA_SET_DIM_Z(ds)*AMITK_DATA_SET_DIM_G(ds);
+  if (update_func != NULL) 
+    block_size = MAX(total_planes/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = total_planes;
+  block_size = MAX(block_size, 1);
+
+  for (start=0; (start < total_planes) && continue_work; start = end) {
+    end = MIN(start+block_size, total_planes);
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) total_planes));
+    if (!continue_work) break;
+
+    amitk_raw_data_page_in_frames(ds->raw_data, start/planes_per_frame, (end-1)/planes_per_frame);
+    ch.offset = start;
+    amitk_parallel_for(end-start, calc_histogram_planes, &ch);
+  }
+
+  g_mutex_clear(&(ch.mutex));
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  if (!continue_work) { /* if we quit, get out of here */
+    g_object_unref(histogram);
+    return NULL;
+  }
+
+  return histogram;
+}
+
+/* calculates the distribution, and the per frame distributions, in one pass */
+static void data_set_calc_distributions(AmitkDataSet * ds,
+					AmitkUpdateFunc update_func,
+					gpointer update_data) {
+
+  AmitkRawData * histogram;
+  AmitkRawData * distribution;
+  AmitkVoxel distribution_dim;
+  AmitkVoxel j;
+  amide_data_t sum;
+
+  histogram = amitk_data_set_calc_histogram(ds, AMITK_DATA_SET_DISTRIBUTION_SIZE, TRUE,
+					    update_func, update_data);
+  if (histogram == NULL) return;
+
+  if (ds->distribution == NULL) {
+    distribution_dim = one_voxel;
+    distribution_dim.x = AMITK_DATA_SET_DISTRIBUTION_SIZE;
+    distribution = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, distribution_dim);
+    if (distribution == NULL) {
+      g_warning(_("couldn't allocate memory space for the data set structure to hold distribution data"));
+      g_object_unref(histogram);
+      return;
+    }
+    amitk_raw_data_DOUBLE_initialize_data(distribution, 0.0);
+
+    /* sum up the frames, and do some log scaling so the distribution is more meaningful, 
+       and doesn't get swamped by outlyers */
+    j = zero_voxel;
+    for (j.x = 0; j.x < distribution_dim.x; j.x++) {
+      for (j.t = 0, sum = 0.0; j.t < AMITK_RAW_DATA_DIM_T(histogram); j.t++)
+	sum += AMITK_RAW_DATA_DOUBLE_CONTENT(histogram, j);
+      j.t = 0;
+      AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution, j) = log10(sum+1.0);
+    }
+    ds->distribution = distribution;
+  }
+
+  j = zero_voxel;
+  for (j.t = 0; j.t < AMITK_RAW_DATA_DIM_T(histogram); j.t++)
+    for (j.x = 0; j.x < AMITK_RAW_DATA_DIM_X(histogram); j.x++)
+      AMITK_RAW_DATA_DOUBLE_SET_CONTENT(histogram, j) = 
+	log10(AMITK_RAW_DATA_DOUBLE_CONTENT(histogram, j)+1.0);
+
+  if (ds->frame_distributions != NULL)
+    g_object_unref(ds->frame_distributions);
+  ds->frame_distributions = histogram;
+
+  return;
+}
+
 /* generate the distribution array for a data set */
 void amitk_data_set_calc_distribution(AmitkDataSet * ds, 
 				      AmitkUpdateFunc update_func,
@@ -3420,7 +3868,50 @@ void amitk_data_set_calc_distribution(AmitkDataSet * ds,
       ds->distribution = NULL;
     }
 
-  (*calc_distribution_func[ds->raw_data->format][ds->scaling_type])(ds, update_func, update_data);
+  if (ds->distribution == NULL)
+    data_set_calc_distributions(ds, update_func, update_data);
+
+  return;
+}
+
+/* returns the distribution of each frame (dim.t of the returned data), binned the same as 
+   the data set's distribution.  These aren't saved with the data set, so they may need
+   to be calculated.  Returns NULL if canceled, the returned data isn't referenced. */
+AmitkRawData * amitk_data_set_get_frame_distributions(AmitkDataSet * ds,
+						      AmitkUpdateFunc update_func,
+						      gpointer update_data) {
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+  g_return_val_if_fail(ds->raw_data != NULL, NULL);
+
+  /* for a single frame, it's the same as the overall distribution */
+  if (AMITK_DATA_SET_NUM_FRAMES(ds) == 1) {
+    amitk_data_set_calc_distribution(ds, update_func, update_data);
+    return ds->distribution;
+  }
+
+  amitk_data_set_calc_distribution(ds, update_func, update_data);
+  if (ds->frame_distributions == NULL)
+    data_set_calc_distributions(ds, update_func, update_data);
+
+  return ds->frame_distributions;
+}
+
+/* call this if the data has changed */
+void amitk_data_set_invalidate_distribution(AmitkDataSet * ds) {
+
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+
+  if (ds->distribution != NULL) {
+    g_object_unref(ds->distribution);
+    ds->distribution = NULL;
+  }
+
+  if (ds->frame_distributions != NULL) {
+    g_object_unref(ds->frame_distributions);
+    ds->frame_distributions = NULL;
+  }
+
   return;
 }
 
@@ -3941,12 +4432,42 @@ amide_data_t amitk_data_set_get_scaling_intercept(const AmitkDataSet * ds, const
 
 
 
+/* anything reading a data set's data or scaling (slice generation, roi statistics,
+   and the jobs reading a data set in the background) holds the read lock while doing
+   so, and anything changing them holds the write lock, so a reader never sees
+   them half changed whichever thread the change is made from.  The locks aren't
+   recursive, so don't call back into the main loop while holding one (e.g. through
+   an update function), as it may go and generate slices */
+void amitk_data_set_read_lock(AmitkDataSet * ds) {
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_rw_lock_reader_lock(&(ds->data_lock));
+}
+
+void amitk_data_set_read_unlock(AmitkDataSet * ds) {
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_rw_lock_reader_unlock(&(ds->data_lock));
+}
+
+void amitk_data_set_write_lock(AmitkDataSet * ds) {
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_rw_lock_writer_lock(&(ds->data_lock));
+}
+
+void amitk_data_set_write_unlock(AmitkDataSet * ds) {
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  g_rw_lock_writer_unlock(&(ds->data_lock));
+}
+
+
 /* sets the current voxel to the given value.  If value/scaling is
    outside of the range of the data set type (i.e. negative for unsigned type),
    it will be truncated to lie at the limits of the range */
 /* note, after using this function, you should
    recalculate the frame's max/min, along with the
-   global max/min, and the distribution data */
+   global max/min (amitk_data_set_update_min_max will only
+   redo the modified planes), and the distribution data */
+/* the caller should hold the write lock if the data set can be read from other
+   threads, but not when signal_change is TRUE */
 void amitk_data_set_set_value(AmitkDataSet * ds, 
 			      const AmitkVoxel i, 
 			      const amide_data_t value,
@@ -4028,6 +4549,10 @@ void amitk_data_set_set_value(AmitkDataSet * ds,
     break;
   }
 
+  /* keep track of which planes need their max/min recalculated */
+  if (ds->plane_modified != NULL)
+    ds->plane_modified[(i.t*AMITK_DATA_SET_DIM_G(ds) + i.g)*AMITK_DATA_SET_DIM_Z(ds) + i.z] = TRUE;
+
   if (signal_change) {
     g_signal_emit (G_OBJECT (ds), data_set_signals[INVALIDATE_SLICE_CACHE], 0);
     g_signal_emit (G_OBJECT (ds), data_set_signals[DATA_SET_CHANGED], 0);
@@ -4120,6 +4645,10 @@ void amitk_data_set_set_internal_value(AmitkDataSet * ds,
     break;
   }
 
+  /* keep track of which planes need their max/min recalculated */
+  if (ds->plane_modified != NULL)
+    ds->plane_modified[(i.t*AMITK_DATA_SET_DIM_G(ds) + i.g)*AMITK_DATA_SET_DIM_Z(ds) + i.z] = TRUE;
+
   if (signal_change) {
     g_signal_emit (G_OBJECT (ds), data_set_signals[INVALIDATE_SLICE_CACHE], 0);
     g_signal_emit (G_OBJECT (ds), data_set_signals[DATA_SET_CHANGED], 0);
@@ -4540,10 +5069,7 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
     cropped->internal_scaling_intercept = NULL;
   }
 
-  if (cropped->distribution != NULL) {
-    g_object_unref(cropped->distribution);
-    cropped->distribution = NULL;  
-  }
+  amitk_data_set_invalidate_distribution(cropped);
 
   /* and unref anything that's obviously now incorrect */
   if (cropped->current_scaling_factor != NULL) {
@@ -4570,6 +5096,7 @@ AmitkDataSet *amitk_data_set_get_cropped(const AmitkDataSet * ds,
     g_free(cropped->frame_min);
     cropped->frame_min = NULL;
   }
+  data_set_free_plane_min_max(cropped);
 
   /* set a new name for this guy */
   temp_string = g_strdup_printf(_("%s, cropped"), AMITK_OBJECT_NAME(ds));
@@ -4871,201 +5398,896 @@ error:
 }
 
 
+static void (*get_internal_line_func[AMITK_FORMAT_NUM][AMITK_SCALING_TYPE_NUM])(const AmitkDataSet *, const AmitkVoxel, const gint, amide_data_t *) = {
+  {amitk_data_set_UBYTE_0D_SCALING_get_internal_line, amitk_data_set_UBYTE_1D_SCALING_get_internal_line, amitk_data_set_UBYTE_2D_SCALING_get_internal_line, amitk_data_set_UBYTE_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_UBYTE_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_UBYTE_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_SBYTE_0D_SCALING_get_internal_line, amitk_data_set_SBYTE_1D_SCALING_get_internal_line, amitk_data_set_SBYTE_2D_SCALING_get_internal_line, amitk_data_set_SBYTE_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SBYTE_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SBYTE_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_USHORT_0D_SCALING_get_internal_line, amitk_data_set_USHORT_1D_SCALING_get_internal_line, amitk_data_set_USHORT_2D_SCALING_get_internal_line, amitk_data_set_USHORT_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_USHORT_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_USHORT_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_SSHORT_0D_SCALING_get_internal_line, amitk_data_set_SSHORT_1D_SCALING_get_internal_line, amitk_data_set_SSHORT_2D_SCALING_get_internal_line, amitk_data_set_SSHORT_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SSHORT_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SSHORT_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_UINT_0D_SCALING_get_internal_line, amitk_data_set_UINT_1D_SCALING_get_internal_line, amitk_data_set_UINT_2D_SCALING_get_internal_line, amitk_data_set_UINT_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_UINT_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_UINT_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_SINT_0D_SCALING_get_internal_line, amitk_data_set_SINT_1D_SCALING_get_internal_line, amitk_data_set_SINT_2D_SCALING_get_internal_line, amitk_data_set_SINT_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SINT_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_SINT_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_FLOAT_0D_SCALING_get_internal_line, amitk_data_set_FLOAT_1D_SCALING_get_internal_line, amitk_data_set_FLOAT_2D_SCALING_get_internal_line, amitk_data_set_FLOAT_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_FLOAT_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_FLOAT_2D_SCALING_INTERCEPT_get_internal_line },
+  {amitk_data_set_DOUBLE_0D_SCALING_get_internal_line, amitk_data_set_DOUBLE_1D_SCALING_get_internal_line, amitk_data_set_DOUBLE_2D_SCALING_get_internal_line, amitk_data_set_DOUBLE_0D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_DOUBLE_1D_SCALING_INTERCEPT_get_internal_line, amitk_data_set_DOUBLE_2D_SCALING_INTERCEPT_get_internal_line }
+};
+
+/* the separable filter works through the data set a line at a time, with each line
+   copied into a buffer with half a kernel's worth of zeros on either side.  The
+   inner loops then don't need any bounds checking, and are simple enough for the
+   compiler to vectorise */
+typedef struct {
+  const AmitkDataSet * data_set;
+  AmitkRawData * filtered; /* FLOAT, same dimensions as data_set */
+  amide_data_t * kernel[AMITK_AXIS_NUM];
+  gint kernel_size;
+  amide_intpoint_t frame;
+  gint offset; /* first item of the current block */
+  gint failed; /* atomic, set if a thread couldn't get its buffers */
+} filter_separable_t;
+
+/* dest[x] = sum over k of kernel[k]*src[k*stride+x], for x from 0 to num-1 */
+static inline void filter_line_convolve(amide_data_t * dest,
+					const amide_data_t * src,
+					const gint stride,
+					const gint num,
+					const amide_data_t * kernel,
+					const gint kernel_size) {
+
+  const amide_data_t * src_k;
+  amide_data_t weight;
+  gint k, x;
+
+  weight = kernel[0];
+  for (x=0; x < num; x++)
+    dest[x] = weight*src[x];
+
+  for (k=1; k < kernel_size; k++) {
+    src_k = src + k*stride;
+    weight = kernel[k];
+    for (x=0; x < num; x++)
+      dest[x] += weight*src_k[x];
+  }
+
+  return;
+}
+
+/* filters along x, reading from the data set and writing to the filtered data,
+   items are the rows ((gate*dim.z+z)*dim.y+y) of the current frame */
+static void filter_separable_x(const gint start, const gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i;
+  amide_data_t * padded;
+  amide_data_t * line;
+  amitk_format_FLOAT_t * out;
+  gint half, k, x;
+
+  dim = AMITK_DATA_SET_DIM(fs->data_set);
+  half = fs->kernel_size >> 1;
+
+  padded = g_try_new0(amide_data_t, dim.x+2*half);
+  line = g_try_new(amide_data_t, dim.x);
+  if ((padded == NULL) || (line == NULL)) {
+    g_atomic_int_set(&(fs->failed), TRUE);
+    goto exit_strategy;
+  }
+
+  i.t = fs->frame;
+  i.x = 0;
+  for (k=fs->offset+start; k < fs->offset+end; k++) {
+    i.g = k / (dim.z*dim.y);
+    i.z = (k / dim.y) % dim.z;
+    i.y = k % dim.y;
+    (*get_internal_line_func[fs->data_set->raw_data->format][fs->data_set->scaling_type])
+      (fs->data_set, i, dim.x, padded+half);
+    filter_line_convolve(line, padded, 1, dim.x, fs->kernel[AMITK_AXIS_X], fs->kernel_size);
+
+    out = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered, i);
+    for (x=0; x < dim.x; x++)
+      out[x] = line[x];
+  }
+
+ exit_strategy:
+  if (padded != NULL) g_free(padded);
+  if (line != NULL) g_free(line);
+
+  return;
+}
+
+/* filters along y, in place on the filtered data, items are the planes (gate*dim.z+z) of the current frame */
+static void filter_separable_y(const gint start, const gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i;
+  amide_data_t * padded;
+  amide_data_t * line;
+  amitk_format_FLOAT_t * out;
+  gint half, k, x, j;
+
+  dim = AMITK_RAW_DATA_DIM(fs->filtered);
+  half = fs->kernel_size >> 1;
+
+  padded = g_try_new0(amide_data_t, (dim.y+2*half)*dim.x);
+  line = g_try_new(amide_data_t, dim.x);
+  if ((padded == NULL) || (line == NULL)) {
+    g_atomic_int_set(&(fs->failed), TRUE);
+    goto exit_strategy;
+  }
+
+  i.t = fs->frame;
+  i.x = 0;
+  for (j=fs->offset+start; j < fs->offset+end; j++) {
+    i.g = j / dim.z;
+    i.z = j % dim.z;
+    for (i.y=0; i.y < dim.y; i.y++) {
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered, i);
+      for (x=0, k=(i.y+half)*dim.x; x < dim.x; x++, k++)
+	padded[k] = out[x];
+    }
+
+    for (i.y=0; i.y < dim.y; i.y++) {
+      filter_line_convolve(line, padded+i.y*dim.x, dim.x, dim.x, 
+			   fs->kernel[AMITK_AXIS_Y], fs->kernel_size);
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered, i);
+      for (x=0; x < dim.x; x++)
+	out[x] = line[x];
+    }
+  }
+
+ exit_strategy:
+  if (padded != NULL) g_free(padded);
+  if (line != NULL) g_free(line);
+
+  return;
+}
+
+/* filters along z, in place on the filtered data, items are the y rows (gate*dim.y+y) of the current frame.
+   Each item gathers that row from every plane, so the inner loops still run along x */
+static void filter_separable_z(const gint start, const gint end, gpointer data) {
+
+  filter_separable_t * fs = data;
+  AmitkVoxel dim, i;
+  amide_data_t * padded;
+  amide_data_t * line;
+  amitk_format_FLOAT_t * out;
+  gint half, k, x, j;
+
+  dim = AMITK_RAW_DATA_DIM(fs->filtered);
+  half = fs->kernel_size >> 1;
+
+  padded = g_try_new0(amide_data_t, (dim.z+2*half)*dim.x);
+  line = g_try_new(amide_data_t, dim.x);
+  if ((padded == NULL) || (line == NULL)) {
+    g_atomic_int_set(&(fs->failed), TRUE);
+    goto exit_strategy;
+  }
+
+  i.t = fs->frame;
+  i.x = 0;
+  for (j=fs->offset+start; j < fs->offset+end; j++) {
+    i.g = j / dim.y;
+    i.y = j % dim.y;
+    for (i.z=0; i.z < dim.z; i.z++) {
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered, i);
+      for (x=0, k=(i.z+half)*dim.x; x < dim.x; x++, k++)
+	padded[k] = out[x];
+    }
+
+    for (i.z=0; i.z < dim.z; i.z++) {
+      filter_line_convolve(line, padded+i.z*dim.x, dim.x, dim.x, 
+			   fs->kernel[AMITK_AXIS_Z], fs->kernel_size);
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fs->filtered, i);
+      for (x=0; x < dim.x; x++)
+	out[x] = line[x];
+    }
+  }
+
+ exit_strategy:
+  if (padded != NULL) g_free(padded);
+  if (line != NULL) g_free(line);
+
+  return;
+}
+
+
+/* fills the data set "filtered_ds" with the data set convolved with a separable kernel,
+   i.e. one that's the product of a 1D kernel along each of x, y, and z.  
+   assumptions:
+   1- filtered_ds is of type FLOAT, 0D scaling
+   2- scale of filtered_ds is 1.0
+   3- kernel holds a 1D kernel of kernel_size (odd) values for each axis
+
+   notes:
+   1. each frame is done separately, x first (which reads from the data set),
+   and then y and z in place on the filtered data.  The gates of a frame are
+   done together, so gated data sets with only a few planes still keep all
+   the threads busy
+   2. like filter_fir, values outside of the data set are taken as zero
+ */
+static gboolean filter_separable(const AmitkDataSet * data_set,
+				 AmitkDataSet * filtered_ds,
+				 amide_data_t * kernel[AMITK_AXIS_NUM],
+				 const gint kernel_size,
+				 AmitkUpdateFunc update_func,
+				 gpointer update_data) {
+
+  filter_separable_t fs;
+  AmitkVoxel dim;
+  AmitkAxis i_axis;
+  AmitkParallelFunc pass_func[AMITK_AXIS_NUM] = {filter_separable_x, filter_separable_y, filter_separable_z};
+  gint num_items[AMITK_AXIS_NUM];
+  gint num_steps, step;
+  gint block_size, start;
+  gchar * temp_string;
+  gboolean continue_work=TRUE;
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(data_set), FALSE);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(filtered_ds), FALSE);
+  g_return_val_if_fail(VOXEL_EQUAL(AMITK_DATA_SET_DIM(data_set), AMITK_DATA_SET_DIM(filtered_ds)), FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(AMITK_DATA_SET_RAW_DATA(filtered_ds)) == AMITK_FORMAT_FLOAT, FALSE);
+  g_return_val_if_fail((kernel_size & 0x1), FALSE); /* needs to be odd */
+
+  dim = AMITK_DATA_SET_DIM(data_set);
+  num_items[AMITK_AXIS_X] = dim.g*dim.z*dim.y;
+  num_items[AMITK_AXIS_Y] = dim.g*dim.z;
+  num_items[AMITK_AXIS_Z] = dim.g*dim.y;
+
+  fs.data_set = data_set;
+  fs.filtered = filtered_ds->raw_data;
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    fs.kernel[i_axis] = kernel[i_axis];
+  fs.kernel_size = kernel_size;
+  fs.failed = FALSE;
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+  num_steps = dim.t*AMITK_AXIS_NUM;
+  step = 0;
+
+  for (fs.frame=0; (fs.frame < dim.t) && continue_work; fs.frame++) {
+    amitk_raw_data_page_in_frames(data_set->raw_data, fs.frame, fs.frame);
+
+    for (i_axis=0; (i_axis < AMITK_AXIS_NUM) && continue_work; i_axis++, step++) {
+      
+      /* break the pass up so the progress bar keeps moving on big single frame data sets */
+      if (update_func != NULL)
+	block_size = MAX(num_items[i_axis]*num_steps/AMITK_UPDATE_DIVIDER, 
+			 4*amitk_parallel_get_num_threads());
+      else
+	block_size = num_items[i_axis];
+      block_size = MAX(block_size, 1);
+      
+      for (start=0; (start < num_items[i_axis]) && continue_work; start += block_size) {
+	if (update_func != NULL)
+	  continue_work = (*update_func)(update_data, NULL, 
+					 (step+((gdouble) start)/num_items[i_axis])/num_steps);
+	if (continue_work) {
+	  fs.offset = start;
+	  amitk_parallel_for(MIN(block_size, num_items[i_axis]-start), pass_func[i_axis], &fs);
+	}
+      }
+      
+      if (g_atomic_int_get(&(fs.failed))) {
+	g_warning(_("couldn't allocate memory space for the filter line buffers"));
+	continue_work = FALSE;
+      }
+    }
+  }
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  return continue_work;
+}
+
 #ifdef AMIDE_LIBGSL_SUPPORT
 
+/* the FFT filter uses overlap-save.  Each block is read from the data set starting
+   half a kernel before the block's output (zero outside the data set), and only
+   the last block_size-kernel_size+1 voxels along each axis of the circular 
+   convolution are kept, so the blocks don't overlap in the output and can be
+   done on different threads */
+typedef struct {
+  const AmitkDataSet * data_set;
+  AmitkRawData * filtered; /* FLOAT, same dimensions as data_set */
+  AmitkRawData * spectrum;
+  AmitkVoxel kernel_size;
+  AmitkVoxel block_size;
+  AmitkVoxel output_size; /* output voxels per block */
+  AmitkVoxel num_blocks; /* per frame/gate */
+  amide_intpoint_t frame;
+  gint offset; /* first block of the current set */
+  gint failed; /* atomic, set if a thread couldn't get its block */
+} filter_fir_t;
+
+static void filter_fir_blocks(const gint start, const gint end, gpointer data) {
+
+  filter_fir_t * ff = data;
+  AmitkFilterFFT * fft=NULL;
+  AmitkRawData * block=NULL;
+  AmitkVoxel dim, n, in_start, out_start, out_end, i, j;
+  amide_intpoint_t x_start, x_end;
+  amitk_format_DOUBLE_t * row;
+  amitk_format_FLOAT_t * out;
+  gint i_block, k, row_stride;
+  gint blocks_per_gate;
+
+  dim = AMITK_DATA_SET_DIM(ff->data_set);
+  n = ff->block_size;
+  blocks_per_gate = ff->num_blocks.z*ff->num_blocks.y*ff->num_blocks.x;
+
+  fft = amitk_filter_fft_new(n);
+  block = amitk_filter_fft_new_block(n);
+  if ((fft == NULL) || (block == NULL)) {
+    g_atomic_int_set(&(ff->failed), TRUE);
+    goto exit_strategy;
+  }
+  row_stride = AMITK_RAW_DATA_DIM_X(block);
+
+  i.t = j.t = ff->frame;
+  for (k=ff->offset+start; k < ff->offset+end; k++) {
+    i.g = j.g = k / blocks_per_gate;
+    i_block = k % blocks_per_gate;
+    out_start.x = (i_block % ff->num_blocks.x)*ff->output_size.x;
+    out_start.y = ((i_block / ff->num_blocks.x) % ff->num_blocks.y)*ff->output_size.y;
+    out_start.z = (i_block / (ff->num_blocks.x*ff->num_blocks.y))*ff->output_size.z;
+    out_end.x = MIN(out_start.x+ff->output_size.x, dim.x);
+    out_end.y = MIN(out_start.y+ff->output_size.y, dim.y);
+    out_end.z = MIN(out_start.z+ff->output_size.z, dim.z);
+    in_start.x = out_start.x - (ff->kernel_size.x>>1);
+    in_start.y = out_start.y - (ff->kernel_size.y>>1);
+    in_start.z = out_start.z - (ff->kernel_size.z>>1);
+
+    /* copy in the data, the line function has to start inside the data set */
+    amitk_raw_data_DOUBLE_initialize_data(block, 0.0);
+    x_start = MAX(in_start.x, 0);
+    x_end = MIN(in_start.x+n.x, dim.x);
+    i.x = x_start;
+    for (i.z = MAX(in_start.z, 0); i.z < MIN(in_start.z+n.z, dim.z); i.z++) {
+      for (i.y = MAX(in_start.y, 0); i.y < MIN(in_start.y+n.y, dim.y); i.y++) {
+	row = ((amitk_format_DOUBLE_t *) block->data) + 
+	  ((i.z-in_start.z)*n.y + (i.y-in_start.y))*row_stride;
+	(*get_internal_line_func[ff->data_set->raw_data->format][ff->data_set->scaling_type])
+	  (ff->data_set, i, x_end-x_start, row + (x_start-in_start.x));
+      }
+    }
+
+    amitk_filter_fft_forward(fft, block);
+    amitk_filter_fft_mult(block, ff->spectrum);
+    amitk_filter_fft_inverse(fft, block);
+
+    /* and copy out the part that didn't wrap around */
+    j.x = out_start.x;
+    for (j.z = out_start.z; j.z < out_end.z; j.z++) {
+      for (j.y = out_start.y; j.y < out_end.y; j.y++) {
+	row = ((amitk_format_DOUBLE_t *) block->data) + 
+	  ((j.z-out_start.z+ff->kernel_size.z-1)*n.y + (j.y-out_start.y+ff->kernel_size.y-1))*row_stride +
+	  ff->kernel_size.x-1;
+	out = AMITK_RAW_DATA_FLOAT_POINTER(ff->filtered, j);
+	for (i.x=0; i.x < out_end.x-out_start.x; i.x++)
+	  out[i.x] = row[i.x];
+      }
+    }
+  }
+
+ exit_strategy:
+  if (fft != NULL) amitk_filter_fft_free(fft);
+  if (block != NULL) g_object_unref(block);
+
+  return;
+}
 
 /* fills the data set "filtered_ds", with the results of the kernel convolved to data_set */
 /* assumptions:
    1- filtered_ds is of type FLOAT, 0D scaling
    2- scale of filtered_ds is 1.0
-   3- kernel is of type DOUBLE, is in complex packed format, and has odd dimensions in x,y,z,
-      and dimension 1 in t
+   3- kernel is of type DOUBLE, and has odd dimensions in x,y,z, and dimension 1 in t and g
 
    notes:
-   1. kernel is modified (FFT'd) 
-   2. don't have a separate function for each data type, as getting the data_set data,
-   is a tiny fraction of the computational time, use amitk_data_set_get_internal_value instead
+   1. the block size is picked to minimize the work for this kernel and data set size,
+   and the transformed kernel for that block size is cached by amitk_filter
  */
 static gboolean filter_fir(const AmitkDataSet * data_set,
 			   AmitkDataSet * filtered_ds,
 			   AmitkRawData * kernel,
-			   AmitkVoxel kernel_size,
 			   AmitkUpdateFunc update_func, 
 			   gpointer update_data) {
   
-  AmitkVoxel subset_size;
-  AmitkVoxel i_outer;
-  AmitkVoxel i_inner;
-  AmitkVoxel j_inner;
-  AmitkVoxel half;
-  AmitkVoxel ds_dim;
-  AmitkRawData * subset=NULL;
-  gsl_fft_complex_wavetable * wavetable=NULL;
-  gsl_fft_complex_workspace * workspace = NULL;
+  filter_fir_t ff;
+  AmitkVoxel dim;
+  gint total_blocks, num_steps, step;
+  gint block_size, start;
   gchar * temp_string;
-  gint image_num;
-  gint total_planes;
   gboolean continue_work=TRUE;
 
-  g_return_val_if_fail(kernel_size.t == 1, FALSE);
-  g_return_val_if_fail(kernel_size.g == 1, FALSE);
-  g_return_val_if_fail((kernel_size.z & 0x1), FALSE); /* needs to be odd */
-  g_return_val_if_fail((kernel_size.y & 0x1), FALSE); 
-  g_return_val_if_fail((kernel_size.x & 0x1), FALSE); 
-  g_return_val_if_fail(2*kernel_size.z < AMITK_FILTER_FFT_SIZE, FALSE);
-  g_return_val_if_fail(2*kernel_size.y < AMITK_FILTER_FFT_SIZE, FALSE);
-  g_return_val_if_fail(2*kernel_size.x < AMITK_FILTER_FFT_SIZE, FALSE);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(data_set), FALSE);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(filtered_ds), FALSE);
+  g_return_val_if_fail(VOXEL_EQUAL(AMITK_DATA_SET_DIM(data_set), AMITK_DATA_SET_DIM(filtered_ds)), FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(AMITK_DATA_SET_RAW_DATA(filtered_ds)) == AMITK_FORMAT_FLOAT, FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(kernel) == AMITK_FORMAT_DOUBLE, FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_DIM_T(kernel) == 1, FALSE);
+  g_return_val_if_fail(AMITK_RAW_DATA_DIM_G(kernel) == 1, FALSE);
+  g_return_val_if_fail((AMITK_RAW_DATA_DIM_Z(kernel) & 0x1), FALSE); /* needs to be odd */
+  g_return_val_if_fail((AMITK_RAW_DATA_DIM_Y(kernel) & 0x1), FALSE); 
+  g_return_val_if_fail((AMITK_RAW_DATA_DIM_X(kernel) & 0x1), FALSE); 
+
+  dim = AMITK_DATA_SET_DIM(data_set);
+
+  ff.data_set = data_set;
+  ff.filtered = filtered_ds->raw_data;
+  ff.kernel_size = AMITK_RAW_DATA_DIM(kernel);
+  ff.block_size = amitk_filter_fft_block_size(ff.kernel_size, dim);
+  ff.output_size.t = ff.output_size.g = ff.num_blocks.t = ff.num_blocks.g = 1;
+  ff.output_size.z = ff.block_size.z-ff.kernel_size.z+1;
+  ff.output_size.y = ff.block_size.y-ff.kernel_size.y+1;
+  ff.output_size.x = ff.block_size.x-ff.kernel_size.x+1;
+  ff.num_blocks.z = (dim.z+ff.output_size.z-1)/ff.output_size.z;
+  ff.num_blocks.y = (dim.y+ff.output_size.y-1)/ff.output_size.y;
+  ff.num_blocks.x = (dim.x+ff.output_size.x-1)/ff.output_size.x;
+  ff.failed = FALSE;
 
-  ds_dim = AMITK_DATA_SET_DIM(data_set);
+#ifdef AMIDE_DEBUG
+  g_print("FFT filtering with %dx%dx%d blocks, %dx%dx%d of them per frame/gate\n",
+	  ff.block_size.x, ff.block_size.y, ff.block_size.z,
+	  ff.num_blocks.x, ff.num_blocks.y, ff.num_blocks.z);
+#endif
 
-  /* initialize gsl's FFT stuff */
-  wavetable = gsl_fft_complex_wavetable_alloc(AMITK_FILTER_FFT_SIZE);
-  workspace = gsl_fft_complex_workspace_alloc (AMITK_FILTER_FFT_SIZE);
-  if ((wavetable == NULL) || (workspace == NULL)) {
-    g_warning(_("Filtering: Failed to allocate wavetable and workspace"));
-    continue_work=FALSE;
-    goto exit_strategy;
+  if ((ff.spectrum = amitk_filter_fft_kernel_spectrum(kernel, ff.block_size)) == NULL) {
+    g_warning(_("failed to transform the filter kernel"));
+    return FALSE;
   }
 
-  /* get space for our data subset*/
-  if ((subset = amitk_raw_data_new()) == NULL) {
-    g_warning(_("couldn't allocate memory space for the subset structure"));
-    continue_work=FALSE;
-    goto exit_strategy;
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
   }
-  subset->format = AMITK_FORMAT_DOUBLE;
-  subset->dim.t = subset->dim.g = 1;
-  subset->dim.z = subset->dim.y = AMITK_FILTER_FFT_SIZE;
-  subset->dim.x = 2*AMITK_FILTER_FFT_SIZE; /* real and complex parts */
 
-  subset_size.t = subset_size.g = 1;
-  subset_size.z = AMITK_FILTER_FFT_SIZE-kernel_size.z+1;
-  subset_size.y = AMITK_FILTER_FFT_SIZE-kernel_size.y+1;
-  subset_size.x = AMITK_FILTER_FFT_SIZE-kernel_size.x+1;
+  /* the blocks of all the gates of a frame are done together */
+  total_blocks = dim.g*ff.num_blocks.z*ff.num_blocks.y*ff.num_blocks.x;
+  num_steps = dim.t;
+  step = 0;
 
-  half.t = half.g = 0;
-  half.z = kernel_size.z>>1;
-  half.y = kernel_size.y>>1;
-  half.x = kernel_size.x>>1;
+  /* do the blocks in sets, so the progress bar keeps moving */
+  if (update_func != NULL) 
+    block_size = MAX(total_blocks*num_steps/AMITK_UPDATE_DIVIDER, 
+		     4*amitk_parallel_get_num_threads());
+  else
+    block_size = total_blocks;
+  block_size = MAX(block_size, 1);
+
+  for (ff.frame=0; (ff.frame < dim.t) && continue_work; ff.frame++, step++) {
+    amitk_raw_data_page_in_frames(data_set->raw_data, ff.frame, ff.frame);
+
+    for (start=0; (start < total_blocks) && continue_work; start += block_size) {
+      if (update_func != NULL)
+	continue_work = (*update_func)(update_data, NULL, 
+				       (step+((gdouble) start)/total_blocks)/num_steps);
+      if (continue_work) {
+	ff.offset = start;
+	amitk_parallel_for(MIN(block_size, total_blocks-start), filter_fir_blocks, &ff);
+      }
+    }
 
-  if ((subset->data = amitk_raw_data_get_data_mem(subset)) == NULL) {
-    g_warning(_("Couldn't allocate memory space for the subset data"));
-    continue_work=FALSE;
-    goto exit_strategy;
+    if (g_atomic_int_get(&(ff.failed))) {
+      g_warning(_("Couldn't allocate memory space for the subset data"));
+      continue_work = FALSE;
+    }
   }
 
-  /* FFT the kernel */
-  amitk_filter_3D_FFT(kernel, wavetable, workspace);
+  g_object_unref(ff.spectrum);
 
-  if (update_func != NULL) {
-    temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
-    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
-    g_free(temp_string);
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  return continue_work;
+}
+
+#endif
+
+static gboolean filter_gaussian_separable(const AmitkDataSet * data_set,
+					  AmitkDataSet * filtered_ds,
+					  const gint kernel_size,
+					  const amide_real_t fwhm,
+					  AmitkUpdateFunc update_func,
+					  gpointer update_data) {
+
+  amide_data_t * kernel[AMITK_AXIS_NUM];
+  AmitkAxis i_axis;
+  gboolean good=TRUE;
+
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++) {
+    kernel[i_axis] = 
+      amitk_filter_calculate_gaussian_kernel_1D(kernel_size, 
+						point_get_component(AMITK_DATA_SET_VOXEL_SIZE(data_set), i_axis),
+						fwhm);
+    if (kernel[i_axis] == NULL) good = FALSE;
   }
-  total_planes = ds_dim.z*ds_dim.t*ds_dim.g;
 
-  /* start the overlap and add FFT method */
-  i_outer.t = i_inner.t = j_inner.t = 0;
-  i_outer.g = i_inner.g = j_inner.g = 0;
-  for (i_outer.t = 0; (i_outer.t < ds_dim.t) && continue_work; i_outer.t++) {
-    for (i_outer.g = 0; (i_outer.g < ds_dim.g) && continue_work; i_outer.g++) {
-#if AMIDE_DEBUG
-      g_print("Filtering Frame %d/Gate %d\n", i_outer.t, i_outer.g);
+  if (good)
+    good = filter_separable(data_set, filtered_ds, kernel, kernel_size, update_func, update_data);
+  else
+    g_warning(_("failed to calculate 1D gaussian kernel"));
+
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++) 
+    if (kernel[i_axis] != NULL)
+      g_free(kernel[i_axis]);
+
+  return good;
+}
+
+#ifdef AMIDE_LIBGSL_SUPPORT
+static gboolean filter_gaussian_fft(const AmitkDataSet * data_set,
+				    AmitkDataSet * filtered_ds,
+				    const gint kernel_size,
+				    const amide_real_t fwhm,
+				    AmitkUpdateFunc update_func,
+				    gpointer update_data) {
+
+  AmitkRawData * kernel;
+  AmitkVoxel kernel_size_3D;
+  gboolean good;
+
+  kernel_size_3D.t=kernel_size_3D.g=1;
+  kernel_size_3D.z=kernel_size_3D.y=kernel_size_3D.x=kernel_size;
+
+  kernel = amitk_filter_calculate_gaussian_kernel(kernel_size_3D, 
+						  AMITK_DATA_SET_VOXEL_SIZE(data_set),
+						  fwhm);
+  if (kernel == NULL) {
+    g_warning(_("failed to calculate 3D gaussian kernel"));
+    return FALSE;
+  }
+
+  good = filter_fir(data_set, filtered_ds, kernel, update_func, update_data);
+  g_object_unref(kernel);
+
+  return good;
+}
 #endif
-      for (i_outer.z = 0; (i_outer.z < ds_dim.z) && continue_work; i_outer.z+= subset_size.z) {
 
-	if (update_func != NULL) {
-	  image_num = i_outer.z+i_outer.t*ds_dim.z+i_outer.g*ds_dim.z*ds_dim.t;
-	  continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
 
-	for (i_outer.y = 0; i_outer.y < ds_dim.y; i_outer.y+= subset_size.y) {
-	  for (i_outer.x = 0; i_outer.x < ds_dim.x; i_outer.x+= subset_size.x) {
-  
-	    /* initialize the subset */
-	    for (j_inner.z = 0; j_inner.z < subset->dim.z; j_inner.z++) 
-	      for (j_inner.y = 0; j_inner.y < subset->dim.y; j_inner.y++) 
-		for (j_inner.x = 0; j_inner.x < subset->dim.x; j_inner.x++) 
-		  AMITK_RAW_DATA_DOUBLE_SET_CONTENT(subset, j_inner) = 0.0;
-	  
-	    /* copy data over from the actual data set */
-	    for (i_inner.z = 0, j_inner.z=0; 
-		 ((i_inner.z < subset_size.z) && (i_inner.z+i_outer.z) < ds_dim.z);
-		 i_inner.z++, j_inner.z++) 
-	      for (i_inner.y = 0, j_inner.y=0; 
-		   ((i_inner.y < subset_size.y) && (i_inner.y+i_outer.y) < ds_dim.y);
-		   i_inner.y++, j_inner.y++) 
-		for (i_inner.x = 0, j_inner.x=0; 
-		     ((i_inner.x < subset_size.x) && (i_inner.x+i_outer.x) < ds_dim.x);
-		     i_inner.x++, j_inner.x+=2) 
-		  AMITK_RAW_DATA_DOUBLE_SET_CONTENT(subset, j_inner) = 
-		    amitk_data_set_get_internal_value(data_set, voxel_add(i_outer, i_inner)); /* should be zero for out of range */
-	  
-	  
-	    /* FFT the data */
-	    amitk_filter_3D_FFT(subset, wavetable, workspace);
-	  
-	    /* multiple the data by the filter */
-	    amitk_filter_complex_mult(subset, kernel);
-	  
-	    /* and inverse FFT */
-	    amitk_filter_inverse_3D_FFT(subset, wavetable, workspace);
-	  
-	    /* and add in, at the same time we're shifting the data set over by half the
-	       kernel size */
-	    for (((i_inner.z = (i_outer.z == 0) ? 0 : -half.z),
-		  (j_inner.z = (i_outer.z == 0) ? half.z : 0)); 
-		 ((j_inner.z < AMITK_FILTER_FFT_SIZE) && 
-		  ((i_inner.z+i_outer.z) < AMITK_DATA_SET_DIM_Z(filtered_ds))); 
-		 i_inner.z++, j_inner.z++)
-	      for (((i_inner.y = (i_outer.y == 0) ? 0 : -half.y),
-		    (j_inner.y = (i_outer.y == 0) ? half.y : 0)); 
-		   ((j_inner.y < AMITK_FILTER_FFT_SIZE) && ((i_inner.y+i_outer.y) < AMITK_DATA_SET_DIM_Y(filtered_ds))); 
-		   i_inner.y++, j_inner.y++) 
-		for (((i_inner.x = (i_outer.x == 0) ? 0 : -half.x),
-		      (j_inner.x = (i_outer.x == 0) ? 2*half.x : 0)); 
-		     ((j_inner.x < 2*AMITK_FILTER_FFT_SIZE) && ((i_inner.x+i_outer.x) < AMITK_DATA_SET_DIM_X(filtered_ds))); 
-		     i_inner.x++, j_inner.x+=2) 
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(filtered_ds->raw_data, voxel_add(i_outer,i_inner)) +=
-		    AMITK_RAW_DATA_DOUBLE_CONTENT(subset, j_inner);
+/* median filtering works along rows, sliding the kernel window along x.  The rows
+   of the data set the window covers are first copied into line buffers, padded
+   on either side with zeros (the data set is taken as zero outside).
+
+   For 8 and 16 bit data with the same scaling over a frame, the window is kept as
+   a histogram of the raw values, and the median is tracked as the window moves
+   (Huang's algorithm), so each step only costs the voxels entering and leaving
+   the window.  Otherwise the window is kept as a sorted list, and each step merges
+   in the sorted column of voxels entering, dropping the ones leaving. */
+typedef struct {
+  const AmitkDataSet * data_set;
+  AmitkRawData * output; /* FLOAT, one frame (all gates) */
+  AmitkVoxel kernel_dim;
+  amide_intpoint_t frame;
+  gint offset; /* first plane of the current block */
+  gint failed; /* atomic, set if a thread couldn't get its buffers */
+
+  /* for the histogram method, the raw values are converted to keys that sort in the
+     same order as the scaled values, with an extra key (pad_key) for the zero padding */
+  gboolean use_histogram;
+  gint num_keys;
+  gint pad_key;
+  gint raw_min;
+  gboolean reversed; /* negative scale factor */
+  amide_data_t factor;
+  amide_data_t intercept;
+} filter_median_t;
+
+typedef struct {
+  amide_data_t value;
+  gint column;
+} median_entry_t;
+
+static inline gint median_raw_to_key(const filter_median_t * fm, const gint raw) {
+  gint key;
+
+  key = raw - fm->raw_min;
+  if (fm->reversed) key = fm->num_keys-2-key;
+  if (key >= fm->pad_key) key++;
+
+  return key;
+}
+
+static inline amide_data_t median_key_to_value(const filter_median_t * fm, gint key) {
 
+  if (key == fm->pad_key) return 0.0;
+  if (key > fm->pad_key) key--;
+  if (fm->reversed) key = fm->num_keys-2-key;
 
+  return fm->factor*((amide_data_t) (key+fm->raw_min)) + fm->intercept;
+}
+
+/* the scaling can change from frame to frame */
+static void median_setup_histogram(filter_median_t * fm) {
+
+  AmitkVoxel i;
+  gint key;
+
+  i = zero_voxel;
+  i.t = fm->frame;
+  fm->factor = amitk_data_set_get_internal_scaling_factor(fm->data_set, i);
+  fm->intercept = amitk_data_set_get_scaling_intercept(fm->data_set, i);
+  fm->reversed = (fm->factor < 0.0);
+
+  /* the padding goes after all the keys with values less than zero */
+  fm->pad_key = fm->num_keys-1; /* so median_key_to_value doesn't skip anything yet */
+  for (key=0; key < fm->num_keys-1; key++)
+    if (median_key_to_value(fm, key) >= 0.0) break;
+  fm->pad_key = key;
+
+  return;
+}
+
+static void median_get_key_line(const filter_median_t * fm, const AmitkVoxel i, 
+				const gint num, gint * keys) {
+
+  gint k;
+
+  switch(fm->data_set->raw_data->format) {
+  case AMITK_FORMAT_UBYTE:
+    {
+      const amitk_format_UBYTE_t * raw = AMITK_RAW_DATA_UBYTE_POINTER(fm->data_set->raw_data, i);
+      for (k=0; k < num; k++) keys[k] = median_raw_to_key(fm, raw[k]);
+    }
+    break;
+  case AMITK_FORMAT_SBYTE:
+    {
+      const amitk_format_SBYTE_t * raw = AMITK_RAW_DATA_SBYTE_POINTER(fm->data_set->raw_data, i);
+      for (k=0; k < num; k++) keys[k] = median_raw_to_key(fm, raw[k]);
+    }
+    break;
+  case AMITK_FORMAT_USHORT:
+    {
+      const amitk_format_USHORT_t * raw = AMITK_RAW_DATA_USHORT_POINTER(fm->data_set->raw_data, i);
+      for (k=0; k < num; k++) keys[k] = median_raw_to_key(fm, raw[k]);
+    }
+    break;
+  case AMITK_FORMAT_SSHORT:
+    {
+      const amitk_format_SSHORT_t * raw = AMITK_RAW_DATA_SSHORT_POINTER(fm->data_set->raw_data, i);
+      for (k=0; k < num; k++) keys[k] = median_raw_to_key(fm, raw[k]);
+    }
+    break;
+  default:
+    g_error("unexpected case in %s at line %d", __FILE__, __LINE__);
+    break;
+  }
+
+  return;
+}
+
+/* items are the planes (gate*dim.z+z) of the current frame */
+static void median_histogram_planes(const gint start, const gint end, gpointer data) {
+
+  filter_median_t * fm = data;
+  AmitkVoxel dim, half, i, j, o;
+  gint * keys=NULL;
+  gint * hist=NULL;
+  gint * key;
+  amitk_format_FLOAT_t * out;
+  gint padded_len, num_lines, median_point;
+  gint med, below;
+  gint item, line, k;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  half.z = fm->kernel_dim.z >> 1;
+  half.y = fm->kernel_dim.y >> 1;
+  half.x = fm->kernel_dim.x >> 1;
+  padded_len = dim.x+2*half.x;
+  num_lines = fm->kernel_dim.z*fm->kernel_dim.y;
+  median_point = (num_lines*fm->kernel_dim.x-1) >> 1;
+
+  keys = g_try_new(gint, num_lines*padded_len);
+  hist = g_try_new0(gint, fm->num_keys);
+  if ((keys == NULL) || (hist == NULL)) {
+    g_atomic_int_set(&(fm->failed), TRUE);
+    goto exit_strategy;
+  }
+
+  /* below is the number of values in the window with keys less than med */
+  med = fm->pad_key;
+  below = 0;
+
+  i.t = j.t = fm->frame;
+  o.t = 0;
+  j.x = o.x = 0;
+  for (item=fm->offset+start; item < fm->offset+end; item++) {
+    i.g = j.g = o.g = item / dim.z;
+    i.z = o.z = item % dim.z;
+    for (i.y = 0; i.y < dim.y; i.y++) {
+
+      /* copy in the rows the window covers */
+      for (line=0; line < num_lines; line++) {
+	key = keys+line*padded_len;
+	j.z = i.z + line/fm->kernel_dim.y - half.z;
+	j.y = i.y + line%fm->kernel_dim.y - half.y;
+	if ((j.z < 0) || (j.z >= dim.z) || (j.y < 0) || (j.y >= dim.y)) {
+	  for (k=0; k < padded_len; k++) key[k] = fm->pad_key;
+	} else {
+	  for (k=0; k < half.x; k++) key[k] = key[padded_len-1-k] = fm->pad_key;
+	  median_get_key_line(fm, j, dim.x, key+half.x);
+	}
+      }
+
+      /* the starting window */
+      for (k=0; k < fm->kernel_dim.x; k++)
+	for (line=0; line < num_lines; line++) {
+	  hist[keys[line*padded_len+k]]++;
+	  if (keys[line*padded_len+k] < med) below++;
+	}
+
+      o.y = i.y;
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fm->output, o);
+      for (i.x=0; i.x < dim.x; i.x++) {
+	if (i.x > 0) { /* slide the window over */
+	  for (line=0; line < num_lines; line++) {
+	    key = keys+line*padded_len+i.x;
+	    hist[key[-1]]--;
+	    if (key[-1] < med) below--;
+	    hist[key[fm->kernel_dim.x-1]]++;
+	    if (key[fm->kernel_dim.x-1] < med) below++;
 	  }
 	}
+
+	/* and move the median to match */
+	while (below > median_point) {
+	  med--;
+	  below -= hist[med];
+	}
+	while (below + hist[med] <= median_point) {
+	  below += hist[med];
+	  med++;
+	}
+
+	out[i.x] = median_key_to_value(fm, med);
       }
+
+      /* take the last window back out, leaving the histogram empty for the next row */
+      for (k=dim.x-1; k < dim.x-1+fm->kernel_dim.x; k++)
+	for (line=0; line < num_lines; line++) {
+	  hist[keys[line*padded_len+k]]--;
+	  if (keys[line*padded_len+k] < med) below--;
+	}
     }
-  } /* i_outer.t */
+  }
 
+ exit_strategy:
+  if (keys != NULL) g_free(keys);
+  if (hist != NULL) g_free(hist);
 
+  return;
+}
 
+static int median_entry_compare(const void * a, const void * b) {
+  const median_entry_t * entry_a = a;
+  const median_entry_t * entry_b = b;
 
+  if (entry_a->value < entry_b->value) return -1;
+  else if (entry_a->value > entry_b->value) return 1;
+  else return 0;
+}
 
+/* the columns are small, so just do an insertion sort */
+static void median_sort_column(median_entry_t * column, const gint num) {
 
- exit_strategy:
+  median_entry_t temp;
+  gint k, l;
 
-  if (wavetable != NULL) {
-    gsl_fft_complex_wavetable_free(wavetable);
-    wavetable = NULL;
+  for (k=1; k < num; k++) {
+    temp = column[k];
+    for (l=k; (l > 0) && (column[l-1].value > temp.value); l--)
+      column[l] = column[l-1];
+    column[l] = temp;
   }
 
-  if (workspace != NULL) {
-    gsl_fft_complex_workspace_free(workspace);
-    workspace = NULL;
-  }
-  
-  if (subset != NULL) {
-    g_object_unref(subset);
-    subset = NULL;
+  return;
+}
+
+/* items are the planes (gate*dim.z+z) of the current frame */
+static void median_sorted_planes(const gint start, const gint end, gpointer data) {
+
+  filter_median_t * fm = data;
+  AmitkVoxel dim, half, i, j, o;
+  amide_data_t * values=NULL;
+  amide_data_t * value;
+  median_entry_t * window=NULL;
+  median_entry_t * merged=NULL;
+  median_entry_t * column=NULL;
+  median_entry_t * temp;
+  amitk_format_FLOAT_t * out;
+  gint padded_len, num_lines, median_size, median_point;
+  gint item, line, k, l, n;
+
+  dim = AMITK_DATA_SET_DIM(fm->data_set);
+  half.z = fm->kernel_dim.z >> 1;
+  half.y = fm->kernel_dim.y >> 1;
+  half.x = fm->kernel_dim.x >> 1;
+  padded_len = dim.x+2*half.x;
+  num_lines = fm->kernel_dim.z*fm->kernel_dim.y;
+  median_size = num_lines*fm->kernel_dim.x;
+  median_point = (median_size-1) >> 1;
+
+  values = g_try_new0(amide_data_t, num_lines*padded_len);
+  window = g_try_new(median_entry_t, median_size);
+  merged = g_try_new(median_entry_t, median_size);
+  column = g_try_new(median_entry_t, num_lines);
+  if ((values == NULL) || (window == NULL) || (merged == NULL) || (column == NULL)) {
+    g_atomic_int_set(&(fm->failed), TRUE);
+    goto exit_strategy;
   }
 
-  if (update_func != NULL) /* remove progress bar */
-    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+  i.t = j.t = fm->frame;
+  o.t = 0;
+  j.x = o.x = 0;
+  for (item=fm->offset+start; item < fm->offset+end; item++) {
+    i.g = j.g = o.g = item / dim.z;
+    i.z = o.z = item % dim.z;
+    for (i.y = 0; i.y < dim.y; i.y++) {
 
-  return continue_work;
+      /* copy in the rows the window covers, the padding's already zero */
+      for (line=0; line < num_lines; line++) {
+	value = values+line*padded_len+half.x;
+	j.z = i.z + line/fm->kernel_dim.y - half.z;
+	j.y = i.y + line%fm->kernel_dim.y - half.y;
+	if ((j.z < 0) || (j.z >= dim.z) || (j.y < 0) || (j.y >= dim.y)) {
+	  for (k=0; k < dim.x; k++) value[k] = 0.0;
+	} else {
+	  (*get_internal_line_func[fm->data_set->raw_data->format][fm->data_set->scaling_type])
+	    (fm->data_set, j, dim.x, value);
+	}
+      }
 
-}
+      /* the starting window */
+      n = 0;
+      for (k=0; k < fm->kernel_dim.x; k++)
+	for (line=0; line < num_lines; line++) {
+	  window[n].value = values[line*padded_len+k];
+	  window[n].column = k;
+	  n++;
+	}
+      qsort(window, median_size, sizeof(median_entry_t), median_entry_compare);
+
+      o.y = i.y;
+      out = AMITK_RAW_DATA_FLOAT_POINTER(fm->output, o);
+      for (i.x=0; i.x < dim.x; i.x++) {
+	if (i.x > 0) { /* slide the window over */
+	  for (line=0; line < num_lines; line++) {
+	    column[line].value = values[line*padded_len+i.x+fm->kernel_dim.x-1];
+	    column[line].column = i.x+fm->kernel_dim.x-1;
+	  }
+	  median_sort_column(column, num_lines);
+
+	  k = l = n = 0;
+	  while (n < median_size) {
+	    if ((k < median_size) && (window[k].column == i.x-1)) {
+	      k++; /* leaving the window */
+	    } else if ((l >= num_lines) || ((k < median_size) && (window[k].value <= column[l].value))) {
+	      merged[n++] = window[k++];
+	    } else {
+	      merged[n++] = column[l++];
+	    }
+	  }
+	  temp = window;
+	  window = merged;
+	  merged = temp;
+	}
 
-#endif
+	out[i.x] = window[median_point].value;
+      }
+    }
+  }
+
+ exit_strategy:
+  if (values != NULL) g_free(values);
+  if (window != NULL) g_free(window);
+  if (merged != NULL) g_free(merged);
+  if (column != NULL) g_free(column);
+
+  return;
+}
 
 /* assumptions:
    1- filtered_ds is of type FLOAT, 0D scaling
@@ -5073,25 +6295,27 @@ static gboolean filter_fir(const AmitkDataSet * data_set,
    3- kernel dimensions are odd
 
    notes:
-   1. don't have a separate function for each data type, as getting the data_set data,
-   is a tiny fraction of the computational time, use amitk_data_set_get_internal_value instead
-   2. data set can be the same as filtered_ds
+   1. data set can be the same as filtered_ds, each frame is filtered into
+   a separate buffer before being copied over
  */
 static gboolean filter_median_3D(const AmitkDataSet * data_set, AmitkDataSet * filtered_ds,
 				 AmitkVoxel kernel_dim, AmitkUpdateFunc update_func, gpointer update_data) {
 
-  amide_data_t * partial_sort_data;
-  AmitkVoxel i,j, mid_dim, output_dim;
-  gint loc, median_size;
+  filter_median_t fm;
   AmitkRawData * output_data;
+  AmitkVoxel i, output_dim;
   AmitkVoxel ds_dim;
+  AmitkParallelFunc planes_func;
   gchar * temp_string;
-  gint image_num;
-  gint total_planes;
-  div_t x;
-  gint divider;
+  gint planes_per_frame, total_planes;
+  gint block_size, start;
   gboolean continue_work=TRUE;
+#ifdef AMIDE_DEBUG
+  struct timeval tv1;
+  struct timeval tv2;
 
+  gettimeofday(&tv1, NULL);
+#endif
 
   g_return_val_if_fail(AMITK_IS_DATA_SET(data_set), FALSE);
   g_return_val_if_fail(AMITK_IS_DATA_SET(filtered_ds), FALSE);
@@ -5122,101 +6346,108 @@ static gboolean filter_median_3D(const AmitkDataSet * data_set, AmitkDataSet * f
     g_warning(_("data set x dimension to small for kernel, setting kernel dimension to 1"));
   }
 
-  mid_dim.t = mid_dim.g = 0;
-  mid_dim.z = kernel_dim.z >> 1;
-  mid_dim.y = kernel_dim.y >> 1;
-  mid_dim.x = kernel_dim.x >> 1;
+  fm.data_set = data_set;
+  fm.kernel_dim = kernel_dim;
+  fm.failed = FALSE;
 
-  median_size = kernel_dim.z*kernel_dim.y*kernel_dim.x;
+  /* the histogram only works if all the voxels in a frame have the same scaling */
+  switch(AMITK_DATA_SET_SCALING_TYPE(data_set)) {
+  case AMITK_SCALING_TYPE_0D:
+  case AMITK_SCALING_TYPE_1D:
+  case AMITK_SCALING_TYPE_0D_WITH_INTERCEPT:
+  case AMITK_SCALING_TYPE_1D_WITH_INTERCEPT:
+    fm.use_histogram = TRUE;
+    break;
+  default:
+    fm.use_histogram = FALSE;
+    break;
+  }
+
+  switch(AMITK_RAW_DATA_FORMAT(AMITK_DATA_SET_RAW_DATA(data_set))) {
+  case AMITK_FORMAT_UBYTE:
+    fm.raw_min = 0;
+    fm.num_keys = 256+1;
+    break;
+  case AMITK_FORMAT_SBYTE:
+    fm.raw_min = -128;
+    fm.num_keys = 256+1;
+    break;
+  case AMITK_FORMAT_USHORT:
+    fm.raw_min = 0;
+    fm.num_keys = 65536+1;
+    break;
+  case AMITK_FORMAT_SSHORT:
+    fm.raw_min = -32768;
+    fm.num_keys = 65536+1;
+    break;
+  default:
+    fm.use_histogram = FALSE;
+    break;
+  }
+  planes_func = fm.use_histogram ? median_histogram_planes : median_sorted_planes;
 
   output_dim = ds_dim;
-  output_dim.t = output_dim.g = 1;
+  output_dim.t = 1;
   if ((output_data = amitk_raw_data_new_with_data(AMITK_FORMAT_FLOAT, output_dim)) == NULL) {
     g_warning(_("couldn't allocate memory space for the internal raw data"));
     return FALSE;
   }
-  amitk_raw_data_FLOAT_initialize_data(output_data, 0.0);
-  partial_sort_data = g_try_new(amide_data_t, median_size);
-  g_return_val_if_fail(partial_sort_data != NULL, FALSE);
+  fm.output = output_data;
 
   if (update_func != NULL) {
     temp_string = g_strdup_printf(_("Filtering Data Set:  %s"), AMITK_OBJECT_NAME(data_set));
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = ds_dim.z*ds_dim.t*ds_dim.g;
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
-
-
-  /* iterate over all the voxels in the data_set */
-  i.t = i.g = 0;
-  for (j.t=0; (j.t < AMITK_DATA_SET_NUM_FRAMES(data_set)) && continue_work; j.t++) {
-    for (j.g=0; (j.g < AMITK_DATA_SET_NUM_GATES(data_set)) && continue_work; j.g++) {
-      for (i.z=0; (i.z < output_dim.z) && continue_work; i.z++) {
-
-	if (update_func != NULL) {
-	  image_num = i.z+j.t*ds_dim.z+j.g*ds_dim.z*ds_dim.t;
-	  x = div(image_num,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
+  planes_per_frame = ds_dim.g*ds_dim.z;
+  total_planes = ds_dim.t*planes_per_frame;
 
-	for (i.y=0; i.y < output_dim.y; i.y++) {
-	  for (i.x=0; i.x < output_dim.x; i.x++) {
-	    
-	    /* initialize the data for the iteration */
-	    loc = 0;
-	    for (j.z = i.z-mid_dim.z; j.z <= i.z+mid_dim.z; j.z++) {
-	      if ((j.z < 0) || (j.z >= ds_dim.z)) {
-		for (j.y=0; j.y < kernel_dim.y; j.y++) {
-		  for (j.x=0; j.x < kernel_dim.x; j.x++) {
-		    partial_sort_data[loc] = 0.0;
-		    loc++;
-		  }
-		}
-	      } else {
-		for (j.y = i.y-mid_dim.y; j.y <= i.y+mid_dim.y; j.y++) {
-		  if ((j.y < 0) || (j.y >= ds_dim.y)) {
-		    for (j.x=0; j.x < kernel_dim.x; j.x++) {
-		      partial_sort_data[loc] = 0.0;
-		      loc++;
-		    }
-		  } else {
-		    for (j.x = i.x-mid_dim.x; j.x <= i.x+mid_dim.x; j.x++) {
-		      if ((j.x < 0) || (j.x >= ds_dim.x)) {
-			partial_sort_data[loc] = 0.0;
-			loc++;
-		      } else {
-			partial_sort_data[loc] = amitk_data_set_get_internal_value(data_set, j);
-			loc++;
-		      }
-		    }
-		  }
-		}
-	      }
-	    } /* end initializing data */
-	    
-	    /* and store median value */
-	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_data, i) = 
-	      amitk_filter_find_median_by_partial_sort(partial_sort_data, median_size);
-	    
-	  } /* i.x */
-	} /* i.y */
-      } /* i.z */
+  /* do the planes in blocks, so the progress bar keeps moving */
+  if (update_func != NULL) 
+    block_size = MAX(total_planes/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = planes_per_frame;
+  block_size = MAX(block_size, 1);
+
+  i = zero_voxel;
+  for (fm.frame=0; (fm.frame < ds_dim.t) && continue_work; fm.frame++) {
+    amitk_raw_data_page_in_frames(data_set->raw_data, fm.frame, fm.frame);
+    if (fm.use_histogram)
+      median_setup_histogram(&fm);
+
+    for (start=0; (start < planes_per_frame) && continue_work; start += block_size) {
+      if (update_func != NULL)
+	continue_work = (*update_func)(update_data, NULL, 
+				       ((gdouble) fm.frame*planes_per_frame+start)/((gdouble) total_planes));
+      if (continue_work) {
+	fm.offset = start;
+	amitk_parallel_for(MIN(block_size, planes_per_frame-start), planes_func, &fm);
+      }
+    }
 
+    if (g_atomic_int_get(&(fm.failed))) {
+      g_warning(_("couldn't allocate memory space for the median filter buffers"));
+      continue_work = FALSE;
+    }
 
-      /* copy the output_data over into the filtered_ds */
-      for (i.z=0, j.z=0; i.z < output_dim.z; i.z++, j.z++)
-	for (i.y=0, j.y=0; i.y < output_dim.y; i.y++, j.y++)
-	  for (i.x=0, j.x=0; i.x < output_dim.x; i.x++, j.x++)
-	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(filtered_ds->raw_data, j) = 
-	      AMITK_RAW_DATA_FLOAT_CONTENT(output_data, i);
-    } /* j.g */
-  } /* j.t */
+    /* copy the output_data over into the filtered_ds */
+    if (continue_work) {
+      i.t = fm.frame;
+      memcpy(AMITK_RAW_DATA_FLOAT_POINTER(filtered_ds->raw_data, i), output_data->data, 
+	     amitk_raw_data_size_data_mem(output_data));
+    }
+  } /* fm.frame */
 
   /* garbage collection */
   g_object_unref(output_data); 
-  g_free(partial_sort_data);
+
+#ifdef AMIDE_DEBUG
+  gettimeofday(&tv2, NULL);
+  g_print("median filtered (%dx%dx%d, %s) in %5.3f seconds\n",
+	  kernel_dim.x, kernel_dim.y, kernel_dim.z,
+	  fm.use_histogram ? "histogram" : "sorted window",
+	  ((tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0));
+#endif
 
   if (update_func != NULL) /* remove progress bar */
     (*update_func)(update_data, NULL, (gdouble) 2.0); 
@@ -5262,13 +6493,14 @@ static gboolean filter_median_linear(const AmitkDataSet * data_set,
 
 
 
-/* returns a filtered version of the given data set */
-AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
-					  const AmitkFilter filter_type,
-					  const gint kernel_size,
-					  const amide_real_t fwhm, 
-					  AmitkUpdateFunc update_func,
-					  gpointer update_data) {
+/* fft is only used for the gaussian filter, and ignored without libgsl */
+static AmitkDataSet * data_set_get_filtered(const AmitkDataSet * ds,
+					    const AmitkFilter filter_type,
+					    const gint kernel_size,
+					    const amide_real_t fwhm, 
+					    const gboolean fft,
+					    AmitkUpdateFunc update_func,
+					    gpointer update_data) {
 
 
   AmitkDataSet * filtered=NULL;
@@ -5297,10 +6529,7 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
     filtered->internal_scaling_intercept = NULL;
   }
 
-  if (filtered->distribution != NULL) {
-    g_object_unref(filtered->distribution);
-    filtered->distribution = NULL;
-  }
+  amitk_data_set_invalidate_distribution(filtered);
 
   /* and unref anything that's obviously now incorrect */
   if (filtered->current_scaling_factor != NULL) {
@@ -5317,6 +6546,7 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
     g_free(filtered->frame_min);
     filtered->frame_min = NULL;
   }
+  data_set_free_plane_min_max(filtered);
 
   /* set a new name for this guy */
   temp_string = g_strdup_printf(_("%s, %s filtered"), AMITK_OBJECT_NAME(ds),
@@ -5341,27 +6571,14 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
 
   switch(filter_type) {
 
-#ifdef AMIDE_LIBGSL_SUPPORT
   case AMITK_FILTER_GAUSSIAN:
-    {
-      AmitkRawData * kernel;
-      AmitkVoxel kernel_size_3D;
-
-      kernel_size_3D.t=kernel_size_3D.g=1;
-      kernel_size_3D.z=kernel_size_3D.y=kernel_size_3D.x=kernel_size;
-
-      kernel = amitk_filter_calculate_gaussian_kernel_complex(kernel_size_3D, 
-							      AMITK_DATA_SET_VOXEL_SIZE(ds),
-							      fwhm);
-      if (kernel == NULL) {
-	g_warning(_("failed to calculate 3D gaussian kernel"));
-	goto error;
-      }
-      good = filter_fir(ds, filtered, kernel, kernel_size_3D, update_func, update_data);
-      g_object_unref(kernel);
-    }
-    break;
+#ifdef AMIDE_LIBGSL_SUPPORT
+    if (fft)
+      good = filter_gaussian_fft(ds, filtered, kernel_size, fwhm, update_func, update_data);
+    else
 #endif
+      good = filter_gaussian_separable(ds, filtered, kernel_size, fwhm, update_func, update_data);
+    break;
 
   case AMITK_FILTER_MEDIAN_LINEAR:
     good = filter_median_linear(ds, filtered, kernel_size, update_func, update_data);
@@ -5392,6 +6609,44 @@ AmitkDataSet *amitk_data_set_get_filtered(const AmitkDataSet * ds,
   return NULL;
 }
 
+/* returns a filtered version of the given data set */
+AmitkDataSet * amitk_data_set_get_filtered(const AmitkDataSet * ds,
+					   const AmitkFilter filter_type,
+					   const gint kernel_size,
+					   const amide_real_t fwhm, 
+					   AmitkUpdateFunc update_func,
+					   gpointer update_data) {
+
+  gboolean fft=FALSE;
+#ifdef AMIDE_LIBGSL_SUPPORT
+  AmitkVoxel kernel_dim;
+#endif
+
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+
+#ifdef AMIDE_LIBGSL_SUPPORT
+  /* the gaussian is separable, so three 1D passes (a multiply and add per kernel
+     voxel per pass) are cheaper than the FFT until the kernel gets quite large */
+  kernel_dim.t = kernel_dim.g = 1;
+  kernel_dim.z = kernel_dim.y = kernel_dim.x = kernel_size;
+  fft = (amitk_filter_fft_cost(kernel_dim, AMITK_DATA_SET_DIM(ds)) < 6.0*kernel_size);
+#endif
+
+  return data_set_get_filtered(ds, filter_type, kernel_size, fwhm, fft, update_func, update_data);
+}
+
+/* as amitk_data_set_get_filtered with AMITK_FILTER_GAUSSIAN, but with the 
+   method given instead of picked by cost.  fft is ignored without libgsl */
+AmitkDataSet * amitk_data_set_get_filtered_gaussian(const AmitkDataSet * ds,
+						    const gint kernel_size,
+						    const amide_real_t fwhm, 
+						    const gboolean fft,
+						    AmitkUpdateFunc update_func,
+						    gpointer update_data) {
+
+  return data_set_get_filtered(ds, AMITK_FILTER_GAUSSIAN, kernel_size, fwhm, fft, update_func, update_data);
+}
+
 
 gint amitk_data_sets_count(GList * objects, gboolean recurse) {
 
@@ -5548,86 +6803,16 @@ GList * amitk_data_sets_remove_with_slice_parent(GList * slices,const AmitkDataS
   return slices;
 }
 
-/* trim cache slice size down to max_size, removes from end */
-GList * slice_cache_trim(GList * slice_cache, gint max_size) {
-
-  GList * last;
-
-  while (g_list_length(slice_cache) > max_size) {
-    last = g_list_last(slice_cache);
-    slice_cache = g_list_remove_link(slice_cache, last);
-    amitk_objects_unref(last);
-  }
-
-  return slice_cache;
-}
-
-/* several things cause slice caches to get invalidated, so they don't need to be
-   explicitly checked here
-
-   1. Scale factor changes
-   2. The parent data set's space changing
-   3. The parent data set's voxel size changing
-   4. Any change to the raw data
-
-*/
-static AmitkDataSet * slice_cache_find (GList * slice_cache, AmitkDataSet * parent_ds, 
-					const amide_time_t start, const amide_time_t duration,
-					const amide_intpoint_t gate,
-					const AmitkCanvasPoint pixel_size, const AmitkVolume * view_volume) {
-
-  AmitkDataSet * slice;
-  AmitkVoxel dim;
-  amide_intpoint_t start_gate, end_gate;
-
-  if (slice_cache == NULL) {
-    return NULL;
-  } else {
-    slice = slice_cache->data;
-    if (AMITK_DATA_SET_SLICE_PARENT(slice) == parent_ds) 
-      if (amitk_space_equal(AMITK_SPACE(slice), AMITK_SPACE(view_volume))) 
-	if (REAL_EQUAL(slice->scan_start, start)) 
-	  if (REAL_EQUAL(amitk_data_set_get_frame_duration(slice,0), duration)) {
-	    if (gate < 0) {
-	      start_gate = AMITK_DATA_SET_VIEW_START_GATE(AMITK_DATA_SET_SLICE_PARENT(slice));
-	      end_gate = AMITK_DATA_SET_VIEW_END_GATE(AMITK_DATA_SET_SLICE_PARENT(slice));
-	    } else {
-	      start_gate = gate;
-	      end_gate = gate;
-	    }
-	    if (AMITK_DATA_SET_VIEW_START_GATE(slice) == start_gate)
-	      if (AMITK_DATA_SET_VIEW_END_GATE(slice) == end_gate)
-		if (REAL_EQUAL(slice->voxel_size.z,AMITK_VOLUME_Z_CORNER(view_volume))) {
-		  dim.x = ceil(fabs(AMITK_VOLUME_X_CORNER(view_volume))/pixel_size.x);
-		  dim.y = ceil(fabs(AMITK_VOLUME_Y_CORNER(view_volume))/pixel_size.y);
-		  dim.z = dim.t = dim.g = 1;
-		  if (VOXEL_EQUAL(dim, AMITK_DATA_SET_DIM(slice))) 
-		    if (AMITK_DATA_SET_INTERPOLATION(slice) == AMITK_DATA_SET_INTERPOLATION(parent_ds)) 
-		      if (AMITK_DATA_SET_RENDERING(slice) == AMITK_DATA_SET_RENDERING(parent_ds)) 
-			return slice;
-		}
-	  }
-  }
-  
-
-  /* this one's not it, keep looking */
-  return slice_cache_find(slice_cache->next, parent_ds, start, duration, gate, pixel_size, view_volume);
-}
-
-
-
 /* give a list of data_sets, returns a list of slices of equal size and orientation
-   intersecting these data_sets.  The slice_cache is a list of already generated slices,
-   if an appropriate slice is found in there, it'll be used */
+   intersecting these data_sets.  The slice_cache holds already generated slices,
+   if an appropriate slice is found in there, it'll be used.  slice_cache can be NULL,
+   in which case the slices are always generated and not cached */
 /* notes
-   - in real practice, the parent data set's local cache is rarely used,
-     as most slices, if there in the local cache, will also be in the passed in cache
    - the "gate" parameter should ordinarily by -1 (ignored).  Only use it to override the
      the data set's view_start_gate/view_end_gate parameters 
  */
 GList * amitk_data_sets_get_slices(GList * objects,
-				   GList ** pslice_cache,
-				   const gint max_slice_cache_size,
+				   AmitkSliceCache * slice_cache,
 				   const amide_time_t start,
 				   const amide_time_t duration,
 				   const amide_intpoint_t gate,
@@ -5636,22 +6821,10 @@ GList * amitk_data_sets_get_slices(GList * objects,
 
 
   GList * slices=NULL;
-  AmitkDataSet * local_slice;
-  AmitkDataSet * canvas_slice=NULL;
   AmitkDataSet * slice;
   AmitkDataSet * parent_ds;
   gint num_data_sets=0;
 
-#ifdef SLICE_TIMING
-  struct timeval tv1;
-  struct timeval tv2;
-  gdouble time1;
-  gdouble time2;
-
-  /* let's do some timing */
-  gettimeofday(&tv1, NULL);
-#endif
-
   g_return_val_if_fail(objects != NULL, NULL);
 
   /* and get the slices */
@@ -5660,55 +6833,89 @@ GList * amitk_data_sets_get_slices(GList * objects,
       num_data_sets++;
       parent_ds = AMITK_DATA_SET(objects->data);
 
-      /* try to find it in the caches first */
-      if (pslice_cache != NULL)
-	canvas_slice = slice_cache_find(*pslice_cache, parent_ds, start, duration, 
-					gate, pixel_size, view_volume);
-
-      local_slice = slice_cache_find(parent_ds->slice_cache, parent_ds, start, duration, 
-				     gate, pixel_size, view_volume);
+      /* try to find it in the cache first */
+      if (slice_cache != NULL)
+	slice = amitk_slice_cache_lookup(slice_cache, parent_ds, start, duration, 
+					 gate, pixel_size, view_volume);
+      else
+	slice = NULL;
 
-      if (canvas_slice != NULL) {
-	slice = amitk_object_ref(canvas_slice);
-      } else if (local_slice != NULL) {
-	slice = amitk_object_ref(local_slice);
-      } else {/* generate a new one */
+      if (slice == NULL) {/* generate a new one */
+	amitk_data_set_read_lock(parent_ds);
 	slice = amitk_data_set_get_slice(parent_ds, start, duration, gate, pixel_size, view_volume);
+	amitk_data_set_read_unlock(parent_ds);
+	g_return_val_if_fail(slice != NULL, slices);
+	if (slice_cache != NULL)
+	  amitk_slice_cache_insert(slice_cache, slice, gate, pixel_size, view_volume);
       }
 
-      g_return_val_if_fail(slice != NULL, slices);
-
       slices = g_list_prepend(slices, slice);
-
-      if ((canvas_slice == NULL) && (pslice_cache != NULL))
-	*pslice_cache = g_list_prepend(*pslice_cache, amitk_object_ref(slice)); /* most recently used first */
-      if (local_slice == NULL) {
-	parent_ds->slice_cache = g_list_prepend(parent_ds->slice_cache, amitk_object_ref(slice));
-
-	/* regulate the size of the local per dataset cache */
-	parent_ds->slice_cache = 
-	  slice_cache_trim(parent_ds->slice_cache, 
-			   3 * MAX(AMITK_DATA_SET_NUM_FRAMES(parent_ds), AMITK_DATA_SET_NUM_GATES(parent_ds)));
-      }
     }
     objects = objects->next;
   }
 
-  /* regulate the size of the global cache */
-  if (pslice_cache != NULL) 
-    *pslice_cache = slice_cache_trim(*pslice_cache, max_slice_cache_size);
-
-#ifdef SLICE_TIMING
-  /* and wrapup our timing */
-  gettimeofday(&tv2, NULL);
-  time1 = ((double) tv1.tv_sec) + ((double) tv1.tv_usec)/1000000.0;
-  time2 = ((double) tv2.tv_sec) + ((double) tv2.tv_usec)/1000000.0;
-  g_print("######## Slice Generating Took %5.3f (s) #########\n",time2-time1);
-#endif
 
   return slices;
 }
 
+/* the math operations are done a plane at a time, spread over the threads.
+   Each plane of the output only depends on the same plane of the input(s),
+   and is only written by the thread that was given it, so the result is the
+   same no matter how the planes get split up */
+typedef struct {
+  const AmitkDataSet * ds1;
+  AmitkDataSet * output_ds;
+  AmitkOperationUnary operation;
+  amide_data_t parameter0;
+  amide_data_t parameter1;
+  gint offset; /* first plane of the current block */
+} math_unary_t;
+
+/* items are the planes ((frame*dim.g+gate)*dim.z+z) of the data set */
+static void math_unary_planes(const gint start, const gint end, gpointer data) {
+
+  math_unary_t * mu = data;
+  AmitkVoxel dim, i_voxel;
+  amide_data_t value;
+  gint k;
+
+  dim = AMITK_DATA_SET_DIM(mu->ds1);
+
+  for (k=mu->offset+start; k < mu->offset+end; k++) {
+    i_voxel.t = k / (dim.g*dim.z);
+    i_voxel.g = (k / dim.z) % dim.g;
+    i_voxel.z = k % dim.z;
+
+    for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) {
+      for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++) {
+	value = amitk_data_set_get_value(mu->ds1, i_voxel);
+	switch(mu->operation) {
+	case AMITK_OPERATION_UNARY_RESCALE:
+	  if (mu->parameter0 >= mu->parameter1) {
+	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(mu->output_ds->raw_data, i_voxel) = (value >= mu->parameter0);
+	  } else {
+	    if (value <= mu->parameter0)
+	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(mu->output_ds->raw_data, i_voxel) = 0.0;
+	    else if (value >= mu->parameter1)
+	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(mu->output_ds->raw_data, i_voxel) = 1.0;
+	    else
+	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(mu->output_ds->raw_data, i_voxel) = 
+		(value - mu->parameter0)/(mu->parameter1-mu->parameter0);
+	  }
+	  break;
+	case AMITK_OPERATION_UNARY_REMOVE_NEGATIVES:
+	  AMITK_RAW_DATA_FLOAT_SET_CONTENT(mu->output_ds->raw_data, i_voxel) = (value < 0.0) ? 0.0 : value;
+	  break;
+	default:
+	  break;
+	}
+      }
+    }
+  }
+
+  return;
+}
+
 /* function to perform the given operation on a single data set
    parameter0 and parameter1 are used by some operations, for instance for the
    threshold operation, values below parameter0 are set to 0, values above
@@ -5721,13 +6928,13 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
 					  gpointer update_data) {
 
   AmitkVoxel i_dim;
-  AmitkDataSet * output_ds;
-  AmitkVoxel i_voxel;
-  amide_data_t value;
+  AmitkDataSet * output_ds=NULL;
+  math_unary_t mu;
   gchar * temp_string;
   AmitkViewMode i_view_mode;
-  div_t x;
-  gint divider, total_planes,image_num;
+  amide_intpoint_t i_frame, i_gate;
+  gint total_planes, planes_per_frame;
+  gint block_size, start, end;
   gboolean continue_work=TRUE;
   AmitkFormat format;
 
@@ -5762,7 +6969,11 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
   amitk_data_set_set_scale_factor(output_ds, 1.0);
   amitk_data_set_set_voxel_size(output_ds, AMITK_DATA_SET_VOXEL_SIZE(ds1));
   amitk_data_set_calc_far_corner(output_ds);
-  amitk_data_set_set_scan_start(output_ds, amitk_data_set_get_start_time(ds1, i_voxel.t));
+  amitk_data_set_set_scan_start(output_ds, amitk_data_set_get_start_time(ds1, 0));
+  for (i_gate = 0; i_gate < i_dim.g; i_gate++)
+    amitk_data_set_set_gate_time(output_ds, i_gate, amitk_data_set_get_gate_time(ds1, i_gate));
+  for (i_frame = 0; i_frame < i_dim.t; i_frame++)
+    amitk_data_set_set_frame_duration(output_ds, i_frame, amitk_data_set_get_frame_duration(ds1, i_frame));
 
   for (i_view_mode=0; i_view_mode < AMITK_VIEW_MODE_NUM; i_view_mode++) 
     amitk_data_set_set_color_table(output_ds, i_view_mode, AMITK_DATA_SET_COLOR_TABLE(ds1, i_view_mode));
@@ -5795,52 +7006,31 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = i_dim.z*i_dim.t*i_dim.g;
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
-
-
-  /* fill in output_ds by performing the operation on the data set */
-  for (i_voxel.g = 0; (i_voxel.g < i_dim.g) && continue_work; i_voxel.g++) {
-    amitk_data_set_set_gate_time(output_ds, i_voxel.g, 
-				 amitk_data_set_get_gate_time(ds1, i_voxel.g));
+  planes_per_frame = i_dim.g*i_dim.z;
+  total_planes = i_dim.t*planes_per_frame;
 
-    for (i_voxel.t = 0; (i_voxel.t < i_dim.t) && continue_work; i_voxel.t++) {
-      amitk_data_set_set_frame_duration(output_ds, i_voxel.t, amitk_data_set_get_frame_duration(ds1, i_voxel.t));
-
-
-      for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z++) {
-	if (update_func != NULL) {
-	  image_num = i_voxel.z+i_voxel.t*i_dim.z+i_voxel.g*i_dim.z*i_dim.t;
-	  x = div(image_num,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
-
-	for (i_voxel.y = 0; i_voxel.y < i_dim.y; i_voxel.y++) {
-	  for (i_voxel.x = 0; i_voxel.x < i_dim.x; i_voxel.x++) {
-	    value = amitk_data_set_get_value(ds1, i_voxel);
-	    switch(operation) {
-	    case AMITK_OPERATION_UNARY_RESCALE:
-	      if (parameter0 > parameter1) {
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(output_ds->raw_data, i_voxel) = (value >= parameter0);
-	      } else {
-		if (value <= parameter0)
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 0.0;
-		else if (value >= parameter1)
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 1.0;
-		else
-		  AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = 
-		    (value - parameter0)/(parameter1-parameter0);
-	      }
-	    case AMITK_OPERATION_UNARY_REMOVE_NEGATIVES:
-	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = (value < 0.0) ? 0.0 : value;
-	      break;
-	    default:
-	      goto error;
-	    }
-	  }
-	}
-      }
+  /* fill in output_ds by performing the operation on the data set, the
+     planes are done in blocks so the progress bar keeps moving */
+  if (update_func != NULL) 
+    block_size = MAX(total_planes/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = total_planes;
+  block_size = MAX(block_size, 1);
+
+  mu.ds1 = ds1;
+  mu.output_ds = output_ds;
+  mu.operation = operation;
+  mu.parameter0 = parameter0;
+  mu.parameter1 = parameter1;
+
+  for (start=0; (start < total_planes) && continue_work; start = end) {
+    end = MIN(start+block_size, total_planes);
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) total_planes));
+    if (continue_work) {
+      amitk_raw_data_page_in_frames(ds1->raw_data, start/planes_per_frame, (end-1)/planes_per_frame);
+      mu.offset = start;
+      amitk_parallel_for(end-start, math_unary_planes, &mu);
     }
   }
   
@@ -5874,6 +7064,129 @@ AmitkDataSet * amitk_data_sets_math_unary(AmitkDataSet * ds1,
 }
 
 
+typedef struct {
+  AmitkDataSet * ds1;
+  AmitkDataSet * ds2;
+  AmitkDataSet * output_ds;
+  const AmitkVolume * volume; /* one output plane thick */
+  AmitkCanvasPoint pixel_size;
+  AmitkVoxel j_dim; /* the frames and gates of ds2 that get used */
+  AmitkOperationBinary operation;
+  amide_data_t parameter0;
+  amide_data_t delta_echo;
+  gboolean by_frames;
+  gint offset; /* first plane of the current block */
+  gint failed; /* atomic, set if a thread couldn't get its slices */
+} math_binary_t;
+
+/* items are the planes ((frame*dim.g+gate)*dim.z+z) of the output data set.
+   Each thread moves its own copy of the slice volume along z */
+static void math_binary_planes(const gint start, const gint end, gpointer data) {
+
+  math_binary_t * mb = data;
+  AmitkVolume * volume;
+  AmitkVoxel i_dim, i_voxel, j_voxel, k_voxel;
+  AmitkPoint new_offset;
+  amide_time_t frame_start, frame_duration;
+  AmitkDataSet * slice1=NULL;
+  AmitkDataSet * slice2=NULL;
+  amitk_format_FLOAT_t value0;
+  amitk_format_FLOAT_t value1;
+  gint k;
+
+  i_dim = AMITK_DATA_SET_DIM(mb->output_ds);
+  volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(mb->volume)));
+  k_voxel = zero_voxel;
+  new_offset = zero_point;
+
+  for (k=mb->offset+start; k < mb->offset+end; k++) {
+    i_voxel.t = k / (i_dim.g*i_dim.z);
+    i_voxel.g = (k / i_dim.z) % i_dim.g;
+    i_voxel.z = k % i_dim.z;
+    j_voxel.t = (i_voxel.t >= mb->j_dim.t) ? 0 : i_voxel.t; /* only used if by_frames is true */
+    j_voxel.g = (i_voxel.g >= mb->j_dim.g) ? 0 : i_voxel.g;
+
+    frame_start = amitk_data_set_get_start_time(mb->ds1, i_voxel.t);
+    frame_duration = amitk_data_set_get_frame_duration(mb->ds1, i_voxel.t);
+
+    /* advance the requested slice volume */
+    new_offset.z = i_voxel.z * AMITK_DATA_SET_VOXEL_SIZE_Z(mb->output_ds);
+    amitk_space_set_offset( AMITK_SPACE(volume), amitk_space_s2b(AMITK_SPACE(mb->output_ds), new_offset));
+
+    slice1 = amitk_data_set_get_slice(mb->ds1,
+				      frame_start, frame_duration,
+				      i_voxel.g,
+				      mb->pixel_size,
+				      volume);
+    slice2 = amitk_data_set_get_slice(mb->ds2,
+				      mb->by_frames ? amitk_data_set_get_start_time(mb->ds2, j_voxel.t) : frame_start,
+				      mb->by_frames ? amitk_data_set_get_frame_duration(mb->ds2, j_voxel.t) : frame_duration,
+				      j_voxel.g,
+				      mb->pixel_size,
+				      volume);
+
+    if ((slice1 == NULL) || (slice2 == NULL)) {
+      g_atomic_int_set(&(mb->failed), TRUE);
+      goto exit_strategy;
+    }
+
+    for (i_voxel.y = 0, k_voxel.y = 0; i_voxel.y < i_dim.y; i_voxel.y++, k_voxel.y++) {
+      for (i_voxel.x = 0, k_voxel.x = 0; i_voxel.x < i_dim.x; i_voxel.x++, k_voxel.x++) {
+	switch(mb->operation) {
+	case AMITK_OPERATION_BINARY_ADD:
+	  value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
+	    + AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
+	  break;
+	case AMITK_OPERATION_BINARY_SUB:
+	  value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
+	    - AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
+	  break;
+	case AMITK_OPERATION_BINARY_MULTIPLY:
+	  value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
+	    * AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
+	  break;
+	case AMITK_OPERATION_BINARY_DIVISION:
+	  value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
+	  if (value0 > mb->parameter0)
+	    value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
+	      / value0;
+	  else
+	    value0 = 0.0;
+	  break;
+	case AMITK_OPERATION_BINARY_T2STAR:
+	  /* we actually compute the relaxation rate, that way we don't run into issues with infinity */
+	  value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel);
+	  value1 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice2), k_voxel);
+	  
+	  if ((value0 <= 0) || (value1 <= 0))
+	    value0 = 0; /* don't have signal, can't assess */
+	  else if (value0 <= value1) /* no decay between two time points */
+	    value0 = 0; /* no relaxation */
+	  else /* compute in units of 1/s */
+	    value0 = 1000.0 * (log(value0)-log(value1)) / (mb->delta_echo);
+	  break;
+	default:
+	  value0 = NAN;
+	  break;
+	}
+	
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(mb->output_ds->raw_data, i_voxel) = value0;
+      }
+    }
+    amitk_object_unref(slice1);
+    slice1 = NULL;
+    amitk_object_unref(slice2);
+    slice2 = NULL;
+  }
+
+ exit_strategy:
+  if (slice1 != NULL) amitk_object_unref(slice1);
+  if (slice2 != NULL) amitk_object_unref(slice2);
+  amitk_object_unref(volume);
+
+  return;
+}
+
 /* function to perform the given operation between two data sets 
    DIVISION: parameter0 used a threshold for the divisor, below which output is set zero. 
    T2STAR: parameter0 is the echo time of ds1
@@ -5895,18 +7208,13 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
   AmitkPoint voxel_size;
   AmitkCanvasPoint pixel_size;
   AmitkVoxel i_dim,j_dim;
-  amide_time_t frame_start, frame_duration;
   AmitkDataSet * output_ds=NULL;
-  AmitkVoxel i_voxel, j_voxel, k_voxel;
-  AmitkPoint new_offset;
-  AmitkDataSet * slice1=NULL;
-  AmitkDataSet * slice2=NULL;
-  amitk_format_FLOAT_t value0;
-  amitk_format_FLOAT_t value1;
+  math_binary_t mb;
+  amide_intpoint_t i_frame, i_gate;
   gchar * temp_string;
   AmitkViewMode i_view_mode;
-  div_t x;
-  gint divider, total_planes,image_num;
+  gint total_planes;
+  gint block_size, start, end;
   gboolean continue_work=TRUE;
   amide_data_t delta_echo=1.0;
 
@@ -6025,110 +7333,50 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
     continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
     g_free(temp_string);
   }
-  total_planes = i_dim.z*i_dim.t*i_dim.g;
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
+  /* copy over the frame and gate timing */
+  amitk_data_set_set_scan_start(output_ds, amitk_data_set_get_start_time(ds1, 0));
+  for (i_frame = 0; i_frame < i_dim.t; i_frame++)
+    amitk_data_set_set_frame_duration(output_ds, i_frame, amitk_data_set_get_frame_duration(ds1, i_frame));
+  for (i_gate = 0; i_gate < i_dim.g; i_gate++)
+    amitk_data_set_set_gate_time(output_ds, i_gate, amitk_data_set_get_gate_time(ds1, i_gate));
 
   /* fill in output_ds by performing the operation on the data sets */
   corner[0] = AMITK_VOLUME_CORNER(volume);
   corner[0].z = voxel_size.z;
   amitk_volume_set_corner(volume, corner[0]); /* set the z dim of the slices */
-  k_voxel = zero_voxel;
-  new_offset = zero_point;
-
-  for (i_voxel.t = 0; (i_voxel.t < i_dim.t) && continue_work; i_voxel.t++) {
-    j_voxel.t = (i_voxel.t >= j_dim.t) ? 0 : i_voxel.t; /* only used if by_frames is true */
-
-    frame_start = amitk_data_set_get_start_time(ds1, i_voxel.t);
-    frame_duration = amitk_data_set_get_frame_duration(ds1, i_voxel.t);
-
-    if (i_voxel.t == 0)
-      amitk_data_set_set_scan_start(output_ds, frame_start);
-    amitk_data_set_set_frame_duration(output_ds, i_voxel.t, frame_duration);
-
-    for (i_voxel.g = 0; (i_voxel.g < i_dim.g) && continue_work; i_voxel.g++) {
-      j_voxel.g = (i_voxel.g >= j_dim.g) ? 0 : i_voxel.g;
-
-      amitk_data_set_set_gate_time(output_ds, i_voxel.g, 
-				   amitk_data_set_get_gate_time(ds1, i_voxel.g));
-
-      for (i_voxel.z = 0; (i_voxel.z < i_dim.z) && continue_work; i_voxel.z++) {
-	j_voxel.z = i_voxel.z;
-	new_offset.z = i_voxel.z * voxel_size.z;
-
-	if (update_func != NULL) {
-	  image_num = i_voxel.z+i_voxel.t*i_dim.z+i_voxel.g*i_dim.z*i_dim.t;
-	  x = div(image_num,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) image_num)/((gdouble) total_planes));
-	}
-
-	/* advance the requested slice volume */
-	amitk_space_set_offset( AMITK_SPACE(volume), amitk_space_s2b(AMITK_SPACE(output_ds), new_offset));
-
-	slice1 = amitk_data_set_get_slice(ds1,
-					  frame_start, frame_duration,
-					  i_voxel.g,
-					  pixel_size,
-					  volume);
-	slice2 = amitk_data_set_get_slice(ds2,
-					  by_frames ? amitk_data_set_get_start_time(ds2, j_voxel.t) : frame_start,
-					  by_frames ? amitk_data_set_get_frame_duration(ds2, j_voxel.t) : frame_duration,
-					  j_voxel.g,
-					  pixel_size,
-					  volume);
-
-	if ((slice1 == NULL) || (slice2 == NULL)) {
-	  g_warning(_("couldn't generate slices from the data set..."));
-	  goto error;
-	}
 
-	for (i_voxel.y = 0, k_voxel.y = 0; i_voxel.y < i_dim.y; i_voxel.y++, k_voxel.y++) {
-	  for (i_voxel.x = 0, k_voxel.x = 0; i_voxel.x < i_dim.x; i_voxel.x++, k_voxel.x++) {
-	    switch(operation) {
-	    case AMITK_OPERATION_BINARY_ADD:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		+ AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_SUB:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		- AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_MULTIPLY:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		* AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      break;
-	    case AMITK_OPERATION_BINARY_DIVISION:
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT( AMITK_DATA_SET(slice2), k_voxel);
-	      if (value0 > parameter0)
-		value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel ) 
-		  / value0;
-	      else
-		value0 = 0.0;
-	      break;
-	    case AMITK_OPERATION_BINARY_T2STAR:
-	      /* we actually compute the relaxation rate, that way we don't run into issues with infinity */
-	      value0 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice1), k_voxel);
-	      value1 = AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(AMITK_DATA_SET(slice2), k_voxel);
-	     
-	      if ((value0 <= 0) || (value1 <= 0))
-		value0 = 0; /* don't have signal, can't assess */
-	      if (value0 <= value1) /* no decay between two time points */
-		value0 = 0; /* no relaxation */
-	      else /* compute in units of 1/s */
-		value0 = 1000.0 * (log(value0)-log(value1)) / (delta_echo);
-	      break;
-	    default:
-	      goto error;
-	    }
+  mb.ds1 = ds1;
+  mb.ds2 = ds2;
+  mb.output_ds = output_ds;
+  mb.volume = volume;
+  mb.pixel_size = pixel_size;
+  mb.j_dim = j_dim;
+  mb.operation = operation;
+  mb.parameter0 = parameter0;
+  mb.delta_echo = delta_echo;
+  mb.by_frames = by_frames;
+  mb.failed = FALSE;
+
+  /* the planes are done in blocks so the progress bar keeps moving */
+  total_planes = i_dim.t*i_dim.g*i_dim.z;
+  if (update_func != NULL) 
+    block_size = MAX(total_planes/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = total_planes;
+  block_size = MAX(block_size, 1);
+
+  for (start=0; (start < total_planes) && continue_work; start = end) {
+    end = MIN(start+block_size, total_planes);
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) total_planes));
+    if (continue_work) {
+      mb.offset = start;
+      amitk_parallel_for(end-start, math_binary_planes, &mb);
+    }
 
-	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(output_ds->raw_data, i_voxel) = value0;
-	  }
-	}
-	amitk_object_unref(slice1);
-	slice1 = NULL;
-	amitk_object_unref(slice2);
-	slice2 = NULL;
-      }
+    if (g_atomic_int_get(&(mb.failed))) {
+      g_warning(_("couldn't generate slices from the data set..."));
+      goto error;
     }
   }
 
@@ -6156,8 +7404,6 @@ AmitkDataSet * amitk_data_sets_math_binary(AmitkDataSet * ds1,
  exit:
   amitk_object_unref(volume);
   g_list_free(data_sets);
-  if (slice1 != NULL) amitk_object_unref(slice1);
-  if (slice2 != NULL) amitk_object_unref(slice2);
 
   if (update_func != NULL) /* remove progress bar */
     (*update_func)(update_data, NULL, (gdouble) 2.0); 
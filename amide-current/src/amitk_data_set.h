@@ -241,6 +241,7 @@ typedef enum { /*< skip >*/
 
 typedef struct _AmitkDataSetClass AmitkDataSetClass;
 typedef struct _AmitkDataSet AmitkDataSet;
+typedef struct _AmitkSliceCache AmitkSliceCache; /* see amitk_slice_cache.h */
 
 
 struct _AmitkDataSet
@@ -300,15 +301,23 @@ struct _AmitkDataSet
   /* parameters calculated as needed or on loading the object */
   /* in theory, could be recalculated on the fly, but used enough we'll store... */
   AmitkRawData * distribution; /* 1D array of data distribution, used in thresholding */
+  AmitkRawData * frame_distributions; /* same, but one per frame, not saved */
   gboolean min_max_calculated; /* the min/max values can be calculated on demand */
   amide_data_t global_max;
   amide_data_t global_min;
   amide_data_t * frame_max; 
   amide_data_t * frame_min;
+  amide_data_t * plane_max; /* per plane values, so only modified planes need recalculating */
+  amide_data_t * plane_min;
+  gboolean * plane_modified;
   AmitkRawData * current_scaling_factor; /* external_scaling * internal_scaling_factor[] */
   amide_intpoint_t num_view_gates;
+  color_table_lut_t * color_table_lut[AMITK_VIEW_MODE_NUM]; /* not saved, see amitk_data_set_get_color_table_lut */
 
-  GList * slice_cache;
+  /* held for reading while the data or scaling are read (slice generation, roi
+     statistics, filtering...), and for writing while they're changed.  See 
+     amitk_data_set_read_lock */
+  GRWLock data_lock;
 
   /* only used by derived data sets (slices and projections)  */
   /* this is a weak pointer, it should be NULL'ed automatically by gtk on the parent's destruction */
@@ -402,6 +411,10 @@ amide_data_t   amitk_data_set_get_frame_min      (AmitkDataSet * ds,
 						  const guint frame);
 AmitkColorTable amitk_data_set_get_color_table_to_use(AmitkDataSet * ds, 
 						      const AmitkViewMode view_mode);
+const color_table_lut_t * amitk_data_set_get_color_table_lut(AmitkDataSet * ds, 
+							     const AmitkViewMode view_mode,
+							     const amide_data_t min,
+							     const amide_data_t max);
 void           amitk_data_set_set_modality       (AmitkDataSet * ds,
 						  const AmitkModality modality);
 void           amitk_data_set_set_scan_start     (AmitkDataSet * ds,
@@ -510,6 +523,15 @@ void           amitk_data_set_calc_min_max       (AmitkDataSet * ds,
 void           amitk_data_set_calc_min_max_if_needed(AmitkDataSet * ds,
 						     AmitkUpdateFunc update_func,
 						     gpointer update_data);
+/* like calc_min_max, but only recalculates the planes that have been changed with
+   set_value/set_internal_value (or marked with set_plane_modified) since the last calculation */
+void           amitk_data_set_update_min_max     (AmitkDataSet * ds,
+						  AmitkUpdateFunc update_func,
+						  gpointer update_data);
+void           amitk_data_set_set_plane_modified (AmitkDataSet * ds,
+						  const amide_intpoint_t frame,
+						  const amide_intpoint_t gate,
+						  const amide_intpoint_t z);
 void           amitk_data_set_slice_calc_min_max (AmitkDataSet * ds,
 						  const amide_intpoint_t frame,
 						  const amide_intpoint_t gate,
@@ -530,6 +552,15 @@ void           amitk_data_set_get_thresholding_min_max(AmitkDataSet * ds,
 void           amitk_data_set_calc_distribution   (AmitkDataSet * ds, 
 						   AmitkUpdateFunc update_func,
 						   gpointer update_data);
+AmitkRawData * amitk_data_set_get_frame_distributions(AmitkDataSet * ds,
+						     AmitkUpdateFunc update_func,
+						     gpointer update_data);
+void           amitk_data_set_invalidate_distribution(AmitkDataSet * ds);
+AmitkRawData * amitk_data_set_calc_histogram      (AmitkDataSet * ds,
+						   const gint num_bins,
+						   const gboolean per_frame,
+						   AmitkUpdateFunc update_func,
+						   gpointer update_data);
 amide_data_t   amitk_data_set_get_internal_value  (const AmitkDataSet * ds, 
 						   const AmitkVoxel i);
 amide_data_t   amitk_data_set_get_value           (const AmitkDataSet * ds, 
@@ -540,6 +571,10 @@ amide_data_t   amitk_data_set_get_scaling_factor  (const AmitkDataSet * ds,
 						   const AmitkVoxel i);
 amide_data_t   amitk_data_set_get_scaling_intercept(const AmitkDataSet * ds, 
 						    const AmitkVoxel i);
+void           amitk_data_set_read_lock           (AmitkDataSet * ds);
+void           amitk_data_set_read_unlock         (AmitkDataSet * ds);
+void           amitk_data_set_write_lock          (AmitkDataSet * ds);
+void           amitk_data_set_write_unlock        (AmitkDataSet * ds);
 void           amitk_data_set_set_value           (AmitkDataSet *ds,
 						   const AmitkVoxel i,
 						   const amide_data_t value,
@@ -567,6 +602,12 @@ AmitkDataSet * amitk_data_set_get_filtered        (const AmitkDataSet * ds,
 						   const amide_real_t fwhm,
 						   AmitkUpdateFunc update_func,
 						   gpointer update_data);
+AmitkDataSet * amitk_data_set_get_filtered_gaussian(const AmitkDataSet * ds,
+						    const gint kernel_size,
+						    const amide_real_t fwhm,
+						    const gboolean fft,
+						    AmitkUpdateFunc update_func,
+						    gpointer update_data);
 AmitkDataSet * amitk_data_set_get_slice           (AmitkDataSet * ds,
 						   const amide_time_t start,
 						   const amide_time_t duration,
@@ -588,8 +629,7 @@ amide_time_t   amitk_data_sets_get_min_frame_duration(GList * objects);
 amide_real_t   amitk_data_sets_get_min_voxel_size    (GList * objects);
 amide_real_t   amitk_data_sets_get_max_min_voxel_size(GList * objects);
 GList *        amitk_data_sets_get_slices            (GList * objects,
-						      GList ** pslice_cache,
-						      const gint max_slice_cache_size,
+						      AmitkSliceCache * slice_cache,
 						      const amide_time_t start,
 						      const amide_time_t duration,
 						      const amide_intpoint_t gate,
@@ -26,6 +26,7 @@
 #include "amide_config.h"
 #include "amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'.h"
 #include "amitk_data_set_FLOAT_0D_SCALING.h"
+#include "amitk_parallel.h"
 
 #ifdef AMIDE_DEBUG
 #include <stdlib.h>
@@ -33,9 +34,13 @@
 
 #define DIM_TYPE_`'m4_Scale_Dim`'
 #define DATA_TYPE_`'m4_Variable_Type`'
+#define INTERCEPT_TYPE_`'m4_Intercept`'
 
 
 /* function to calculate the max/min values of a slice within a data set */
+/* the min/max of the raw values are found first, and then scaled, as the
+   scaling is the same over a plane.  The inner loops are kept simple enough
+   that the compiler can vectorize them. */
 void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_slice_min_max(AmitkDataSet * data_set,
 											     const amide_intpoint_t frame,
 											     const amide_intpoint_t gate,
@@ -45,6 +50,10 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_s
 
   AmitkVoxel i;
   amide_data_t max, min, temp;
+  amide_data_t scale, intercept;
+  amitk_format_`'m4_Variable_Type`'_t * data;
+  amitk_format_`'m4_Variable_Type`'_t raw_max, raw_min;
+  gint num_voxels, k;
   AmitkVoxel dim;
   
   dim = AMITK_DATA_SET_DIM(data_set);
@@ -54,18 +63,52 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_s
   i.z = z;
   i.y = i.x = 0;
 
-  temp = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, i);
-  if (finite(temp)) max = min = temp;   
-  else max = min = 0.0; /* just throw in zero */
+  data = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, i);
+  num_voxels = dim.y*dim.x;
 
-  for (i.y = 0; i.y < dim.y; i.y++) 
-    for (i.x = 0; i.x < dim.x; i.x++) {
-      temp = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, i);
-      if (finite(temp)) {
-	if (temp > max) max = temp;
-	else if (temp < min) min = temp;
-      }
+  scale = *(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->current_scaling_factor, i));
+#ifdef INTERCEPT_TYPE_INTERCEPT_
+  intercept = *(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, i));
+#else
+  intercept = 0.0;
+#endif
+
+#if defined(DATA_TYPE_FLOAT) || defined(DATA_TYPE_DOUBLE)
+  /* skip over NaN's and inf's */
+  for (k=0; (k < num_voxels) && !finite(data[k]); k++);
+  if (k == num_voxels) { /* nothing finite, just throw in zero */
+    if (pmin != NULL) *pmin = 0.0;
+    if (pmax != NULL) *pmax = 0.0;
+    return;
+  }
+  raw_max = raw_min = data[k];
+  for (; k < num_voxels; k++) 
+    if (finite(data[k])) {
+      if (data[k] > raw_max) raw_max = data[k];
+      if (data[k] < raw_min) raw_min = data[k];
     }
+#else
+  raw_max = raw_min = data[0];
+  for (k=1; k < num_voxels; k++) {
+    raw_max = MAX(raw_max, data[k]);
+    raw_min = MIN(raw_min, data[k]);
+  }
+#endif
+
+  max = scale*((amide_data_t) raw_max) + intercept;
+  min = scale*((amide_data_t) raw_min) + intercept;
+  if (min > max) { /* negative scale factor */
+    temp = max;
+    max = min;
+    min = temp;
+  }
+
+  /* the first voxel is always counted, and is taken as zero if not finite */
+  temp = scale*((amide_data_t) data[0]) + intercept;
+  if (!finite(temp)) {
+    if (max < 0.0) max = 0.0;
+    if (min > 0.0) min = 0.0;
+  }
 
   if (pmin != NULL)
     *pmin = min;
@@ -76,93 +119,443 @@ void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_s
   return;
 }
 
-/* generate the distribution array for a data_set */
-void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_distribution(AmitkDataSet * data_set,
-									    AmitkUpdateFunc update_func,
-									    gpointer update_data) {
+/* adds the values of a slice of the data set to the given histogram, bin k
+   covering min+k/scale to min+(k+1)/scale.  Values that aren't finite are skipped. */
+void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'calc_slice_distribution(AmitkDataSet * data_set,
+												   const amide_intpoint_t frame,
+												   const amide_intpoint_t gate,
+												   const amide_intpoint_t z,
+												   const amide_data_t min,
+												   const amide_data_t scale,
+												   const gint num_bins,
+												   guint * bins) {
 
-  AmitkVoxel i,j;
-  amide_data_t scale, diff;
-  AmitkVoxel distribution_dim;
-  AmitkVoxel data_set_dim;
-  gchar * temp_string;
-  div_t x;
-  gint divider;
-  gint total_planes;
-  gint i_plane;
-  gboolean continue_work=TRUE;
-  AmitkRawData * distribution;
-
-  if (data_set->distribution != NULL)
-    return;
+  AmitkVoxel i;
+  amide_data_t value_scale, offset;
+  amide_data_t bin;
+  amitk_format_`'m4_Variable_Type`'_t * data;
+  gint num_voxels, k;
+  AmitkVoxel dim;
 
-  data_set_dim = AMITK_DATA_SET_DIM(data_set);
-  diff = amitk_data_set_get_global_max(data_set) - amitk_data_set_get_global_min(data_set);
-  if (diff == 0.0)
-    scale = 0.0;
-  else
-    scale = (AMITK_DATA_SET_DISTRIBUTION_SIZE-1)/diff;
-  
-  distribution_dim.x = AMITK_DATA_SET_DISTRIBUTION_SIZE;
-  distribution_dim.y = distribution_dim.z = distribution_dim.g = distribution_dim.t = 1;
-  distribution = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, distribution_dim);
-  if (distribution == NULL) {
-    g_warning(_("couldn't allocate memory space for the data set structure to hold distribution data"));
-    return;
-  }
+  dim = AMITK_DATA_SET_DIM(data_set);
 
-  /* initialize the distribution array */
-  amitk_raw_data_DOUBLE_initialize_data(distribution, 0.0);
-  
-  if (update_func != NULL) {
-    temp_string = g_strdup_printf(_("Generating distribution data for:\n   %s"), AMITK_OBJECT_NAME(data_set));
-    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
-    g_free(temp_string);
+  i.t = frame;
+  i.g = gate;
+  i.z = z;
+  i.y = i.x = 0;
+
+  data = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, i);
+  num_voxels = dim.y*dim.x;
+
+  /* fold the scaling of the data and the binning into a single multiply and add */
+  value_scale = scale * *(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->current_scaling_factor, i));
+#ifdef INTERCEPT_TYPE_INTERCEPT_
+  offset = scale*(*(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, i)) - min);
+#else
+  offset = -scale*min;
+#endif
+
+  for (k=0; k < num_voxels; k++) {
+    bin = value_scale*((amide_data_t) data[k]) + offset;
+#if defined(DATA_TYPE_FLOAT) || defined(DATA_TYPE_DOUBLE)
+    if (!finite(bin)) continue;
+#endif
+    if (bin < 0.0) bin = 0.0;
+    else if (bin > num_bins-1) bin = num_bins-1;
+    bins[(gint) bin]++;
   }
-  total_planes = AMITK_DATA_SET_TOTAL_PLANES(data_set);
-  divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
-
-  /* now "bin" the data */
-  j = zero_voxel;
-  i_plane=0;
-  for (i.t = 0; (i.t < data_set_dim.t) && continue_work; i.t++) {
-    for (i.g = 0; (i.g < data_set_dim.g) && continue_work; i.g++) {
-      for ( i.z = 0; (i.z < data_set_dim.z) && continue_work; i.z++, i_plane++) {
-	if (update_func != NULL) {
-	  x = div(i_plane,divider);
-	  if (x.rem == 0)
-	    continue_work = (*update_func)(update_data, NULL, ((gdouble) i_plane)/((gdouble) total_planes));
-	}
 
-	for (i.y = 0; i.y < data_set_dim.y; i.y++) 
-	  for (i.x = 0; i.x < data_set_dim.x; i.x++) {
-	    j.x = scale*(AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,i)-amitk_data_set_get_global_min(data_set));
-	    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) += 1.0;
+  return;
+}
+
+/* copies the internal values (i.e. before the user's scale factor is applied) of num
+   voxels, starting at voxel i and going along x, into line */
+void amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'get_internal_line(const AmitkDataSet * data_set,
+											       const AmitkVoxel i,
+											       const gint num,
+											       amide_data_t * line) {
+
+  const amitk_format_`'m4_Variable_Type`'_t * data;
+  amide_data_t scale;
+#ifdef INTERCEPT_TYPE_INTERCEPT_
+  amide_data_t intercept;
+#endif
+  gint k;
+
+  data = AMITK_RAW_DATA_`'m4_Variable_Type`'_POINTER(data_set->raw_data, i);
+  scale = *(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_factor, i));
+
+#ifdef INTERCEPT_TYPE_INTERCEPT_
+  intercept = *(AMITK_RAW_DATA_DOUBLE_`'m4_Scale_Dim`'_POINTER(data_set->internal_scaling_intercept, i));
+  for (k=0; k < num; k++)
+    line[k] = scale*((amide_data_t) data[k]) + intercept;
+#else
+  for (k=0; k < num; k++)
+    line[k] = scale*((amide_data_t) data[k]);
+#endif
+
+  return;
+}
+
+
+
+
+/* everything the row functions below need to fill in their part of a slice.
+   Points and strides are in data set voxel units (i.e. already divided by the
+   data set's voxel size), the mapping from the slice is affine so this lets the
+   inner loops get away with just additions */
+typedef struct {
+  AmitkDataSet * data_set;
+  AmitkVoxel start;
+  AmitkVoxel end;
+  amide_real_t z_steps;
+  amide_intpoint_t start_frame;
+  amide_intpoint_t end_frame;
+  amide_intpoint_t gate;
+  gint num_gates;
+  amide_data_t * time_weights; /* one per frame, start_frame to end_frame */
+  AmitkPoint start_point; /* center of slice voxel start.x,start.y in the first plane */
+  AmitkPoint stride[AMITK_AXIS_NUM];
+  amide_data_t * intermediate_data;
+  amide_data_t * weights;
+} slice_rows_t;
+
+/* which data set gate corresponds to the i_gate'th gate we're incorporating */
+static amide_intpoint_t slice_rows_gate(const slice_rows_t * rows, const amide_intpoint_t i_gate) {
+
+  amide_intpoint_t ds_gate;
+
+  if (rows->gate < 0)
+    ds_gate = i_gate+AMITK_DATA_SET_VIEW_START_GATE(rows->data_set);
+  else
+    ds_gate = i_gate+rows->gate;
+
+  if (ds_gate >= AMITK_DATA_SET_NUM_GATES(rows->data_set))
+    ds_gate -= AMITK_DATA_SET_NUM_GATES(rows->data_set);
+
+  return ds_gate;
+}
+
+/* where the first voxel of the given row (counted from start.y) and plane falls in
+   the data set.  Calculated directly instead of accumulated, so that it doesn't
+   matter which thread gets which rows */
+static AmitkPoint slice_rows_row_point(const slice_rows_t * rows, const gint row, const amide_intpoint_t z) {
+
+  AmitkPoint point;
+
+  point.x = rows->start_point.x + z*rows->stride[AMITK_AXIS_Z].x + row*rows->stride[AMITK_AXIS_Y].x;
+  point.y = rows->start_point.y + z*rows->stride[AMITK_AXIS_Z].y + row*rows->stride[AMITK_AXIS_Y].y;
+  point.z = rows->start_point.z + z*rows->stride[AMITK_AXIS_Z].z + row*rows->stride[AMITK_AXIS_Y].z;
+
+  return point;
+}
+
+/* trilinear interpolation for slice rows [start_row, end_row), counted from start.y.
+   Each output pixel is only ever touched by one thread, and sees the same frames/gates/planes
+   in the same order as before, so the result doesn't depend on the number of threads */
+static void slice_rows_trilinear(const gint start_row, const gint end_row, gpointer data) {
+
+  slice_rows_t * rows = data;
+  AmitkDataSet * data_set = rows->data_set;
+  amide_data_t * intermediate_data = rows->intermediate_data;
+  amide_data_t * weights = rows->weights;
+  const AmitkPoint * stride = rows->stride;
+  AmitkVoxel i_voxel;
+  AmitkVoxel ds_voxel;
+  amide_intpoint_t z;
+  amide_intpoint_t i_gate;
+  amide_data_t weight, time_weight;
+  amide_data_t weight1, weight2;
+  AmitkPoint box_point[8];
+  AmitkVoxel box_voxel[8];
+  amide_data_t box_value[8];
+  AmitkPoint ds_point, diff;
+  guint k, l;
+  gint row, width;
+  gboolean empties=FALSE;
+
+  width = rows->end.x-rows->start.x+1;
+
+  /* iterate over the frames we'll be incorporating into this slice */
+  for (ds_voxel.t = rows->start_frame; ds_voxel.t <= rows->end_frame; ds_voxel.t++) {
+    time_weight = rows->time_weights[ds_voxel.t-rows->start_frame];
+      
+    for (i_gate=0; i_gate < rows->num_gates; i_gate++) {
+      ds_voxel.g = slice_rows_gate(rows, i_gate);
+
+      /* initialize the .t/.g components of box_voxel */
+      for (l=0; l<8; l=l+1) {
+	box_voxel[l].t = ds_voxel.t;
+	box_voxel[l].g = ds_voxel.g;
+      }
+
+      /* iterate over the number of planes we'll be compressing into this slice */
+      for (z = 0; z < ceil(rows->z_steps); z++) {
+	  
+	/* weight is between 0 and 1, this is used to weight the last voxel in the slice's z direction */
+	if (floor(rows->z_steps) > z)
+	  weight = time_weight/rows->z_steps;
+	else
+	  weight = time_weight*(rows->z_steps-floor(rows->z_steps)) / rows->z_steps;
+	  
+	/* iterate over the y dimension */
+	for (row = start_row, k=start_row*width; row < end_row; row++) {
+	    
+	  /* the data set location of the first slice voxel in this row */
+	  ds_point = slice_rows_row_point(rows, row, z);
+	    
+	  /* iterate over the x dimension */
+	  for (i_voxel.x = rows->start.x; i_voxel.x <= rows->end.x; i_voxel.x++,k++) {
+	      
+	    /* get the nearest neighbor in the data set to this slice voxel, and
+	       figure out which way to go to get the nearest voxels to our slice voxel */
+	    VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(ds_point, ds_voxel);
+	    diff.x = ds_point.x - (((amide_real_t) ds_voxel.x)+0.5);
+	    diff.y = ds_point.y - (((amide_real_t) ds_voxel.y)+0.5);
+	    diff.z = ds_point.z - (((amide_real_t) ds_voxel.z)+0.5);
+	      
+	    /* figure out which voxels to look at */
+	    for (l=0; l<8; l=l+1) {
+	      if (diff.x < 0)
+		box_voxel[l].x = (l & 0x1) ? ds_voxel.x-1 : ds_voxel.x;
+	      else /* diff.x >= 0 */
+		box_voxel[l].x = (l & 0x1) ? ds_voxel.x : ds_voxel.x+1;
+	      if (diff.y < 0)
+		box_voxel[l].y = (l & 0x2) ? ds_voxel.y-1 : ds_voxel.y;
+	      else /* diff.y >= 0 */
+		box_voxel[l].y = (l & 0x2) ? ds_voxel.y : ds_voxel.y+1;
+	      if (diff.z < 0)
+		box_voxel[l].z = (l & 0x4) ? ds_voxel.z-1 : ds_voxel.z;
+	      else /* diff.z >= 0 */
+		box_voxel[l].z = (l & 0x4) ? ds_voxel.z : ds_voxel.z+1;
+		
+	      VOXEL_TO_POINT(box_voxel[l], one_point, box_point[l]);
+		
+	      /* get the value of the point on the box */
+	      if (amitk_raw_data_includes_voxel(data_set->raw_data, box_voxel[l]))
+		box_value[l] = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, box_voxel[l]);
+	      else {
+		box_value[l] = NAN;
+		empties = TRUE;
+	      }
+	    }
+
+	    /* note, in voxel units the distance between box points is 1, which 
+	       simplifies the weights */
+	    if (empties) { /* slow algorithm - checking for empties */
+	      /* reset value */
+	      empties = FALSE; 
+
+	      /* do the x direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+2) {
+		weight1 = 1.0 - (ds_point.x - box_point[l].x);
+		weight2 = 1.0 - (box_point[l+1].x - ds_point.x);
+		if (isnan(box_value[l])) {
+		  if (weight2 >= weight1)
+		    box_value[l] = box_value[l+1];
+		  /* else box_value[l] left as is (NAN/empty) */
+		} else if (isnan(box_value[l+1])) {
+		  if (weight1 < weight2)
+		    box_value[l] = NAN;
+		  /* else box_value[l] left as is */
+		} else
+		  box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
+	      }
+		
+	      /* do the y direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+4) {
+		weight1 = 1.0 - (ds_point.y - box_point[l].y);
+		weight2 = 1.0 - (box_point[l+2].y - ds_point.y);
+		if (isnan(box_value[l])) {
+		  if (weight2 >= weight1)
+		    box_value[l] = box_value[l+2];
+		  /* else box_value[l] left as is (NAN/empty) */
+		} else if (isnan(box_value[l+2])) {
+		  if (weight1 < weight2)
+		    box_value[l] = NAN;
+		  /* else box_value[l] left as is */
+		} else
+		  box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
+	      }
+		
+	      /* do the z direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+8) {
+		weight1 = 1.0 - (ds_point.z - box_point[l].z);
+		weight2 = 1.0 - (box_point[l+4].z - ds_point.z);
+		if (isnan(box_value[l])) {
+		  if (weight2 >= weight1)
+		    box_value[l] = box_value[l+4];
+		  /* else box_value[l] left as is (NAN/empty) */
+		} else if (isnan(box_value[l+4])) {
+		  if (weight1 < weight2)
+		    box_value[l] = NAN;
+		  /* else box_value[l] left as is */
+		} else
+		  box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
+	      }
+
+	      /* separate into MPR/MIP/minIP algorithms */
+	      if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
+		if (!isnan(box_value[0])) {
+		  intermediate_data[k] += weight*box_value[0];
+		  weights[k] += weight;
+		}
+	      } else { /* MIP or MINIP */
+		if ((z == 0) && (ds_voxel.t == rows->start_frame) && (i_gate == 0)) 
+		  intermediate_data[k]=box_value[0];
+		else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
+		  intermediate_data[k] = MAX(box_value[0], intermediate_data[k]);
+		else  /* MINIP */
+		  intermediate_data[k] = MIN(box_value[0], intermediate_data[k]);
+	      }
+
+	    } else { /* faster */
+	      /* do the x direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+2) {
+		weight1 = 1.0 - (ds_point.x - box_point[l].x);
+		weight2 = 1.0 - (box_point[l+1].x - ds_point.x);
+		box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
+	      }
+		
+	      /* do the y direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+4) {
+		weight1 = 1.0 - (ds_point.y - box_point[l].y);
+		weight2 = 1.0 - (box_point[l+2].y - ds_point.y);
+		box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
+	      }
+		
+	      /* do the z direction linear interpolation of the sets of two points */
+	      for (l=0;l<8;l=l+8) {
+		weight1 = 1.0 - (ds_point.z - box_point[l].z);
+		weight2 = 1.0 - (box_point[l+4].z - ds_point.z);
+		box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
+	      }
+
+	      /* separate into MPR/MIP/minIP algorithms */
+	      if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
+		intermediate_data[k] += weight*box_value[0];
+		weights[k] += weight;
+	      } else { /* MIP or MINIP */
+		if ((z == 0) && (ds_voxel.t == rows->start_frame) && (i_gate == 0)) 
+		  intermediate_data[k]=box_value[0];
+		else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
+		  intermediate_data[k] = MAX(intermediate_data[k], box_value[0]);
+		else  /* MINIP */
+		  intermediate_data[k] = MIN(intermediate_data[k], box_value[0]);
+	      }
+	    } /* slow (empties) vs fast algorithm */
+	      
+	    POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
 	  }
+	}
       }
     }
   }
 
-  if (update_func != NULL) /* remove progress bar */
-    continue_work = (*update_func)(update_data, NULL, (gdouble) 2.0); 
-
-  if (!continue_work) {   /* if we quit, get out of here */
-    g_object_unref(distribution);
-    return;
-  }
-  
-  /* do some log scaling so the distribution is more meaningful, and doesn't get
-     swamped by outlyers */
-  for (j.x = 0; j.x < distribution_dim.x ; j.x++) 
-    AMITK_RAW_DATA_DOUBLE_SET_CONTENT(distribution,j) = 
-      log10(AMITK_RAW_DATA_DOUBLE_CONTENT(distribution,j)+1.0);
-
-  /* and store the distribution with the data set */
-  data_set->distribution = distribution;
   return;
 }
 
+/* nearest neighbor version of the above */
+static void slice_rows_nearest_neighbor(const gint start_row, const gint end_row, gpointer data) {
+
+  slice_rows_t * rows = data;
+  AmitkDataSet * data_set = rows->data_set;
+  amide_data_t * intermediate_data = rows->intermediate_data;
+  amide_data_t * weights = rows->weights;
+  const AmitkPoint * stride = rows->stride;
+  AmitkVoxel i_voxel;
+  AmitkVoxel ds_voxel;
+  amide_intpoint_t z;
+  amide_intpoint_t i_gate;
+  amide_data_t weight, time_weight;
+  AmitkPoint ds_point;
+  gboolean first_plane;
+  guint k;
+  gint row, width;
+
+  width = rows->end.x-rows->start.x+1;
+
+  /* iterate over the number of frames we'll be incorporating into this slice */
+  for (ds_voxel.t = rows->start_frame; ds_voxel.t <= rows->end_frame; ds_voxel.t++) {
+    time_weight = rows->time_weights[ds_voxel.t-rows->start_frame];
+
+    /* iterate over gates */
+    for (i_gate=0; i_gate < rows->num_gates; i_gate++) {
+      ds_voxel.g = slice_rows_gate(rows, i_gate);
+
+      /* iterate over the number of planes we'll be compressing into this slice */
+      for (z = 0; z < ceil(rows->z_steps); z++) { 
+
+	/* weight is between 0 and 1, this is used to weight the last voxel  in the slice's z direction */
+	if (floor(rows->z_steps) > z)
+	  weight = time_weight/rows->z_steps;
+	else
+	  weight = time_weight*(rows->z_steps-floor(rows->z_steps)) / rows->z_steps;
+
+	/* MIP/MINIP need to initialize based on the first plane we encounter */
+	first_plane = ((z == 0) && (ds_voxel.t == rows->start_frame) && (i_gate == 0));
+
+	/* iterate over x and y.  The MPR vs MIP/MINIP branch point is kept 
+	   outside of the x loop to speed things up slightly */
+	for (row = start_row, k=start_row*width; row < end_row; row++) { 
+	  ds_point = slice_rows_row_point(rows, row, z);
+
+	  switch(data_set->rendering) {
+	  case AMITK_RENDERING_MPR:
+	    for (i_voxel.x = rows->start.x; i_voxel.x <= rows->end.x; i_voxel.x++, k++) { 
+	      VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(ds_point, ds_voxel);
+	      if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) {
+		intermediate_data[k] +=
+		  weight*AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
+		weights[k] += weight;
+	      }
+	      POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
+	    } /* x */
+	    break;
+
+	  case AMITK_RENDERING_MIP:
+	  case AMITK_RENDERING_MINIP:
+	    if (first_plane) {
+	      for (i_voxel.x = rows->start.x; i_voxel.x <= rows->end.x; i_voxel.x++,k++) {
+		VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(ds_point, ds_voxel);
+		if (!amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		  intermediate_data[k] = NAN;
+		else
+		  intermediate_data[k] =
+		    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
+		POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
+	      } /* x */
+	    } else if (data_set->rendering == AMITK_RENDERING_MIP) {
+	      for (i_voxel.x = rows->start.x; i_voxel.x <= rows->end.x; i_voxel.x++,k++) { 
+		VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(ds_point, ds_voxel);
+		if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		  intermediate_data[k] = 
+		    MAX(intermediate_data[k],
+			AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
+		POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
+	      } /* x */
+	    } else { /* AMITK_RENDERING_MINIP */
+	      for (i_voxel.x = rows->start.x; i_voxel.x <= rows->end.x; i_voxel.x++,k++) { 
+		VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(ds_point, ds_voxel);
+		if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
+		  intermediate_data[k] = 
+		    MIN(intermediate_data[k],
+			AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
+		POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
+	      } /* x */
+	    } 
+	    break;
+
+	  default:
+	    break;
+	  } /* MIP vs NON-MIP */
+	} /* y */
+      } /* z */
+    } /* iterating over gates */
+  } /* iterating over frames */
 
+  return;
+}
 
 
 /* returns a slice  with the appropriate data from the data_set */
@@ -178,41 +571,35 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
 
   AmitkDataSet * slice = NULL;
   AmitkVoxel i_voxel;
-  amide_intpoint_t z;
-  amide_real_t max_diff, voxel_length, z_steps;
+  amide_real_t voxel_length, z_steps;
   AmitkPoint alt;
-  AmitkPoint stride[AMITK_AXIS_NUM], last[AMITK_AXIS_NUM];
+  AmitkPoint stride[AMITK_AXIS_NUM];
   AmitkAxis i_axis;
-  guint k, l;
-  amide_data_t weight;
-  amide_data_t time_weight;
+  guint k;
+  amide_intpoint_t i_frame;
   amide_intpoint_t start_frame, end_frame;
-  amide_intpoint_t i_gate;
   amide_time_t end_time;
-  AmitkPoint box_point[8];
-  AmitkVoxel box_voxel[8];
   AmitkVoxel start, end;
-  amide_data_t box_value[8];
-  AmitkPoint slice_point, ds_point,start_point,diff, nearest_point;
+  AmitkPoint start_point;
   AmitkSpace * slice_space;
   AmitkSpace * data_set_space;
 #if AMIDE_DEBUG
   gchar * temp_string;
   AmitkPoint center_point;
 #endif
-  AmitkVoxel ds_voxel;
-  amide_data_t weight1, weight2;
   amide_data_t * weights=NULL;
   amide_data_t * intermediate_data=NULL;
+  amide_data_t * time_weights=NULL;
   AmitkCorners intersection_corners;
   AmitkVoxel dim;
   gint num_gates;
-  gboolean empties=FALSE;
+  slice_rows_t rows;
 
   /* ----- figure out what frames of this data set to include ----*/
   end_time = start_time+duration;
   start_frame = amitk_data_set_get_frame(data_set, start_time+EPSILON);
   end_frame = amitk_data_set_get_frame(data_set, end_time-EPSILON);
+  amitk_raw_data_page_in_frames(data_set->raw_data, start_frame, end_frame);
 
   /* the number of gates we'll be looking at */
   if (gate < 0)
@@ -240,6 +627,20 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
     goto error;
   }
 
+  /* how much each frame contributes, averaging if more then one frame */
+  time_weights = g_new(amide_data_t, end_frame-start_frame+1);
+  for (i_frame = start_frame; i_frame <= end_frame; i_frame++) {
+    if (end_frame-start_frame > 0) {
+      if (i_frame == start_frame)
+	time_weights[i_frame-start_frame] = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
+      else if (i_frame == end_frame)
+	time_weights[i_frame-start_frame] = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
+      else
+	time_weights[i_frame-start_frame] = amitk_data_set_get_frame_duration(data_set, i_frame)/(duration*num_gates);
+    } else
+      time_weights[i_frame-start_frame] = 1.0/((gdouble) num_gates);
+  }
+
   /* get the return slice */
   slice = amitk_data_set_new_with_data(NULL, AMITK_DATA_SET_MODALITY(data_set), 
 				       AMITK_FORMAT_DOUBLE, dim, AMITK_SCALING_TYPE_0D);
@@ -344,373 +745,49 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
     for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++) 
       AMITK_RAW_DATA_DOUBLE_SET_CONTENT(slice->raw_data,i_voxel) = NAN;
 
+  /* figure out what point in the data set we're going to start at */
+  start_point.x = ((amide_real_t) start.x+0.5) * slice->voxel_size.x;
+  start_point.y = ((amide_real_t) start.y+0.5) * slice->voxel_size.y;
+  if (ceil(z_steps) > 1.0)
+    start_point.z = voxel_length/2.0;
+  else
+    start_point.z = slice->voxel_size.z/2.0; /* only one iteration in z */
+  start_point = amitk_space_s2s(slice_space, data_set_space, start_point);
+
+  /* figure out what stepping one voxel in a given direction in our slice cooresponds to in our data set */
+  for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++) {
+    alt.x = (i_axis == AMITK_AXIS_X) ? slice->voxel_size.x : 0.0;
+    alt.y = (i_axis == AMITK_AXIS_Y) ? slice->voxel_size.y : 0.0;
+    alt.z = (i_axis == AMITK_AXIS_Z) ? voxel_length : 0.0;
+    alt = point_add(point_sub(amitk_space_s2b(slice_space, alt),
+			      AMITK_SPACE_OFFSET(slice_space)),
+		    AMITK_SPACE_OFFSET(data_set_space));
+    stride[i_axis] = amitk_space_b2s(data_set_space, alt);
+  }
+
+  /* everything the threads need, points in data set voxel units */
+  rows.data_set = data_set;
+  rows.start = start;
+  rows.end = end;
+  rows.z_steps = z_steps;
+  rows.start_frame = start_frame;
+  rows.end_frame = end_frame;
+  rows.gate = gate;
+  rows.num_gates = num_gates;
+  rows.time_weights = time_weights;
+  rows.start_point = point_div(start_point, data_set->voxel_size);
+  for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    rows.stride[i_axis] = point_div(stride[i_axis], data_set->voxel_size);
+  rows.intermediate_data = intermediate_data;
+  rows.weights = weights;
 
   switch(data_set->interpolation) {
-    
   case AMITK_INTERPOLATION_TRILINEAR:
-
-    /* iterate over the frames we'll be incorporating into this slice */
-    for (ds_voxel.t = start_frame; ds_voxel.t <= end_frame; ds_voxel.t++) {
-      
-      /* averaging over more then one frame */
-      if (end_frame-start_frame > 0) {
-	if (ds_voxel.t == start_frame)
-	  time_weight = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
-	else if (ds_voxel.t == end_frame)
-	  time_weight = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
-	else
-	  time_weight = amitk_data_set_get_frame_duration(data_set, ds_voxel.t)/(duration*num_gates);
-      } else
-	time_weight = 1.0/((gdouble) num_gates);
-      
-      for (i_gate=0; i_gate < num_gates; i_gate++) {
-	if (gate < 0)
-	  ds_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(data_set);
-	else
-	  ds_voxel.g = i_gate+gate;
-	
-	if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
-	  ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
-
-	/* initialize the .t/.g components of box_voxel */
-	for (l=0; l<8; l=l+1) {
-	  box_voxel[l].t = ds_voxel.t;
-	  box_voxel[l].g = ds_voxel.g;
-	}
-
-	/* iterate over the number of planes we'll be compressing into this slice */
-	for (z = 0; z < ceil(z_steps); z++) {
-	  
-	  /* the slices z_coordinate for this iteration's slice voxel */
-	  if (ceil(z_steps) > 1.0)
-	    slice_point.z = (z+0.5)*voxel_length;
-	  else
-	    slice_point.z = (0.5)*slice->voxel_size.z; /* only one iteration in z */
-	  
-	  /* weight is between 0 and 1, this is used to weight the last voxel in the slice's z direction */
-	  if (floor(z_steps) > z)
-	    weight = time_weight/z_steps;
-	  else
-	    weight = time_weight*(z_steps-floor(z_steps)) / z_steps;
-	  
-	  /* iterate over the y dimension */
-	  for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) {
-	    
-	    /* the slice y_coordinate of the center of this iteration's slice voxel */
-	    slice_point.y = (((amide_real_t) i_voxel.y)+0.5)*slice->voxel_size.y;
-	    
-	    /* the slice x coord of the center of the first slice voxel in this loop */
-	    slice_point.x = (((amide_real_t) start.x)+0.5)*slice->voxel_size.x;
-	    
-	    /* iterate over the x dimension */
-	    for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) {
-	      
-	      /* translate the current point in slice space into the data set's coordinate frame */
-	      ds_point = amitk_space_s2s(slice_space, data_set_space, slice_point);
-	      
-	      /* get the nearest neighbor in the data set to this slice voxel */
-	      POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-	      VOXEL_TO_POINT(ds_voxel, data_set->voxel_size, nearest_point);
-	      
-	      /* figure out which way to go to get the nearest voxels to our slice voxel*/
-	      POINT_SUB(ds_point, nearest_point, diff);
-	      
-	      /* figure out which voxels to look at */
-	      for (l=0; l<8; l=l+1) {
-		if (diff.x < 0)
-		  box_voxel[l].x = (l & 0x1) ? ds_voxel.x-1 : ds_voxel.x;
-		else /* diff.x >= 0 */
-		  box_voxel[l].x = (l & 0x1) ? ds_voxel.x : ds_voxel.x+1;
-		if (diff.y < 0)
-		  box_voxel[l].y = (l & 0x2) ? ds_voxel.y-1 : ds_voxel.y;
-		else /* diff.y >= 0 */
-		  box_voxel[l].y = (l & 0x2) ? ds_voxel.y : ds_voxel.y+1;
-		if (diff.z < 0)
-		  box_voxel[l].z = (l & 0x4) ? ds_voxel.z-1 : ds_voxel.z;
-		else /* diff.z >= 0 */
-		  box_voxel[l].z = (l & 0x4) ? ds_voxel.z : ds_voxel.z+1;
-		
-		VOXEL_TO_POINT(box_voxel[l], data_set->voxel_size, box_point[l]);
-		
-		/* get the value of the point on the box */
-		if (amitk_raw_data_includes_voxel(data_set->raw_data, box_voxel[l]))
-		  box_value[l] = AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set, box_voxel[l]);
-		else {
-		  box_value[l] = NAN;
-		  empties = TRUE;
-		}
-	      }
-	      
-	      if (empties) { /* slow algorithm - checking for empties */
-		/* reset value */
-		empties = FALSE; 
-
-		/* do the x direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+2) {
-		  max_diff = box_point[l+1].x-box_point[l].x;
-		  weight1 = ((max_diff - (ds_point.x - box_point[l].x))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+1].x - ds_point.x))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+1];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+1])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
-		}
-		
-		/* do the y direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+4) {
-		  max_diff = box_point[l+2].y-box_point[l].y;
-		  weight1 = ((max_diff - (ds_point.y - box_point[l].y))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+2].y - ds_point.y))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+2];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+2])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
-		}
-		
-		/* do the z direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+8) {
-		  max_diff = box_point[l+4].z-box_point[l].z;
-		  weight1 = ((max_diff - (ds_point.z - box_point[l].z))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+4].z - ds_point.z))/max_diff);
-		  if (isnan(box_value[l])) {
-		    if (weight2 >= weight1)
-		      box_value[l] = box_value[l+4];
-		    /* else box_value[l] left as is (NAN/empty) */
-		  } else if (isnan(box_value[l+4])) {
-		    if (weight1 < weight2)
-		      box_value[l] = NAN;
-		    /* else box_value[l] left as is */
-		  } else
-		    box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
-		}
-
-		/* separate into MPR/MIP/minIP algorithms */
-		if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
-		  if (!isnan(box_value[0])) {
-		    intermediate_data[k] += weight*box_value[0];
-		    weights[k] += weight;
-		  }
-		} else { /* MIP or MINIP */
-		  if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) 
-		    intermediate_data[k]=box_value[0];
-		  else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
-		    intermediate_data[k] = MAX(box_value[0], intermediate_data[k]);
-		  else  /* MINIP */
-		    intermediate_data[k] = MIN(box_value[0], intermediate_data[k]);
-		}
-
-	      } else { /* faster */
-		/* do the x direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+2) {
-		  max_diff = box_point[l+1].x-box_point[l].x;
-		  weight1 = ((max_diff - (ds_point.x - box_point[l].x))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+1].x - ds_point.x))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+1] * weight2);
-		}
-		
-		/* do the y direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+4) {
-		  max_diff = box_point[l+2].y-box_point[l].y;
-		  weight1 = ((max_diff - (ds_point.y - box_point[l].y))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+2].y - ds_point.y))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+2] * weight2);
-		}
-		
-		/* do the z direction linear interpolation of the sets of two points */
-		for (l=0;l<8;l=l+8) {
-		  max_diff = box_point[l+4].z-box_point[l].z;
-		  weight1 = ((max_diff - (ds_point.z - box_point[l].z))/max_diff);
-		  weight2 = ((max_diff - (box_point[l+4].z - ds_point.z))/max_diff);
-		  box_value[l] = (box_value[l] * weight1) + (box_value[l+4] * weight2);
-		}
-
-		/* separate into MPR/MIP/minIP algorithms */
-		if (data_set->rendering == AMITK_RENDERING_MPR) { /* MPR */
-		  intermediate_data[k] += weight*box_value[0];
-		  weights[k] += weight;
-		} else { /* MIP or MINIP */
-		  if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) 
-		    intermediate_data[k]=box_value[0];
-		  else if (data_set->rendering == AMITK_RENDERING_MIP)  /* MIP */
-		    intermediate_data[k] = MAX(intermediate_data[k], box_value[0]);
-		  else  /* MINIP */
-		    intermediate_data[k] = MIN(intermediate_data[k], box_value[0]);
-		}
-	      } /* slow (empties) vs fast algorithm */
-	      
-	      slice_point.x += slice->voxel_size.x; 
-	    }
-	  }
-	}
-      }
-    }
+    amitk_parallel_for(end.y-start.y+1, slice_rows_trilinear, &rows);
     break;
-
   case AMITK_INTERPOLATION_NEAREST_NEIGHBOR:
   default:  
-    /* figure out what point in the data set we're going to start at */
-    start_point.x = ((amide_real_t) start.x+0.5) * slice->voxel_size.x;
-    start_point.y = ((amide_real_t) start.y+0.5) * slice->voxel_size.y;
-    if (ceil(z_steps) > 1.0)
-      start_point.z = voxel_length/2.0;
-    else
-      start_point.z = slice->voxel_size.z/2.0; /* only one iteration in z */
-    start_point = amitk_space_s2s(slice_space, data_set_space, start_point);
-
-    /* figure out what stepping one voxel in a given direction in our slice cooresponds to in our data set */
-    for (i_axis = 0; i_axis < AMITK_AXIS_NUM; i_axis++) {
-      alt.x = (i_axis == AMITK_AXIS_X) ? slice->voxel_size.x : 0.0;
-      alt.y = (i_axis == AMITK_AXIS_Y) ? slice->voxel_size.y : 0.0;
-      alt.z = (i_axis == AMITK_AXIS_Z) ? voxel_length : 0.0;
-      alt = point_add(point_sub(amitk_space_s2b(slice_space, alt),
-				AMITK_SPACE_OFFSET(slice_space)),
-		      AMITK_SPACE_OFFSET(data_set_space));
-      stride[i_axis] = amitk_space_b2s(data_set_space, alt);
-    }
-
-    /* iterate over the number of frames we'll be incorporating into this slice */
-    for (ds_voxel.t = start_frame; ds_voxel.t <= end_frame; ds_voxel.t++) {
-
-      /* averaging over more then one frame */
-      if (end_frame-start_frame > 0) {
-	if (ds_voxel.t == start_frame)
-	  time_weight = (amitk_data_set_get_end_time(data_set, start_frame)-start_time)/(duration*num_gates);
-	else if (ds_voxel.t == end_frame)
-	  time_weight = (end_time-amitk_data_set_get_start_time(data_set, end_frame))/(duration*num_gates);
-	else
-	  time_weight = amitk_data_set_get_frame_duration(data_set, ds_voxel.t)/(duration*num_gates);
-      } else
-	time_weight = 1.0/((gdouble) num_gates);
-
-      /* iterate over gates */
-      for (i_gate=0; i_gate < num_gates; i_gate++) {
-	if (gate < 0)
-	  ds_voxel.g = i_gate+AMITK_DATA_SET_VIEW_START_GATE(data_set);
-	else
-	  ds_voxel.g = i_gate+gate;
-
-	if (ds_voxel.g >= AMITK_DATA_SET_NUM_GATES(data_set))
-	  ds_voxel.g -= AMITK_DATA_SET_NUM_GATES(data_set);
-
-	ds_point = start_point;
-
-	/* separate into MPR and MIP/MINIP algorithms. A fair amount
-	   of code is duplicated within the algorithms. The reason
-	   they aren't combined is to keep the MPR vs MIP/MINIP branch
-	   point out of the loop and speed things up slightly for the
-	   most commonly used selection (MPR) */
-
-	switch(data_set->rendering) {
-
-	case AMITK_RENDERING_MPR:
-	  /* iterate over the number of planes we'll be compressing into this slice */
-	  for (z = 0; z < ceil(z_steps); z++) { 
-	    last[AMITK_AXIS_Z] = ds_point;
-	  
-	    /* weight is between 0 and 1, this is used to weight the last voxel  in the slice's z direction */
-	    if (floor(z_steps) > z)
-	      weight = time_weight/z_steps;
-	    else
-	      weight = time_weight*(z_steps-floor(z_steps)) / z_steps;
-	  
-	    /* iterate over x and y */
-	    for (i_voxel.y = start.y, k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-	      last[AMITK_AXIS_Y] = ds_point;
-	      for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++, k++) { 
-		POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) {
-		  intermediate_data[k] +=
-		    weight*AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
-		  weights[k] += weight;
-		}
-		POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-	      } /* x */
-	      POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-	    } /* y */
-	    
-	    POINT_ADD(last[AMITK_AXIS_Z], stride[AMITK_AXIS_Z], ds_point); 
-	  } /* z */
-	  break;
-
-	case AMITK_RENDERING_MIP:
-	case AMITK_RENDERING_MINIP:
-
-	  /* iterate over the number of planes we'll be compressing into this slice */
-	  for (z = 0; z < ceil(z_steps); z++) { 
-	    last[AMITK_AXIS_Z] = ds_point;
-
-	    /* need to initialize based on the first plane we encounter */
-	    if ((z == 0) && (ds_voxel.t == start_frame) && (i_gate == 0)) {
-	      /* iterate over x and y */
-	      for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) {
-		last[AMITK_AXIS_Y] = ds_point;
-		for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) {
-		  POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		  if (!amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		    intermediate_data[k] = NAN;
-		  else
-		    intermediate_data[k] =
-		      AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel);
-		  POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		} /* x */
-		POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-	      } /* y */
-
-	    } else { /* iterate over everything that's not the first plane */
-
-	      if (data_set->rendering == AMITK_RENDERING_MIP) {
-		/* iterate over x and y */
-		for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-		  last[AMITK_AXIS_Y] = ds_point;
-		  for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) { 
-		    POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		    if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		      intermediate_data[k] = 
-			MAX(intermediate_data[k],
-			    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
-		    POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		  } /* x */
-		  POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-		} /* y */ 
-	      } else { /* AMITK_RENDERING_MINIP */
-		/* iterate over x and y */
-		for (i_voxel.y = start.y,k=0; i_voxel.y <= end.y; i_voxel.y++) { 
-		  last[AMITK_AXIS_Y] = ds_point;
-		  for (i_voxel.x = start.x; i_voxel.x <= end.x; i_voxel.x++,k++) { 
-		    POINT_TO_VOXEL_COORDS_ONLY(ds_point, data_set->voxel_size, ds_voxel);
-		    if (amitk_raw_data_includes_voxel(data_set->raw_data,ds_voxel)) 
-		      intermediate_data[k] = 
-			MIN(intermediate_data[k],
-			    AMITK_DATA_SET_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Intercept`'CONTENT(data_set,ds_voxel));
-		    POINT_ADD(ds_point, stride[AMITK_AXIS_X], ds_point); 
-		  } /* x */
-		  POINT_ADD(last[AMITK_AXIS_Y], stride[AMITK_AXIS_Y], ds_point);
-		} /* y */ 
-	      } /* end else, MIP vs MINIP */
-	    } /* end else */
-	      
-	    POINT_ADD(last[AMITK_AXIS_Z], stride[AMITK_AXIS_Z], ds_point); 
-	  } /* z */
-	  break;
-
-	default:
-	  break;
-	} /* MIP vs NON-MIP */
-
-      } /* iterating over gates */
-    } /* iterating over frames */
+    amitk_parallel_for(end.y-start.y+1, slice_rows_nearest_neighbor, &rows);
     break;
   }
 
@@ -733,8 +810,8 @@ AmitkDataSet * amitk_data_set_`'m4_Variable_Type`'_`'m4_Scale_Dim`'_`'m4_Interce
 
   if (weights != NULL) g_free(weights);
   if (intermediate_data != NULL) g_free(intermediate_data);
+  if (time_weights != NULL) g_free(time_weights);
 
   return slice;
 }
 
-
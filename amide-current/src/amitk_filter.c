@@ -26,28 +26,66 @@
 #include "amide_config.h"
 #include <math.h>
 #include "amitk_filter.h"
+#include "amitk_parallel.h"
 #include "amitk_type_builtins.h"
-#ifdef AMIDE_LIBGSL_SUPPORT
-#include <gsl/gsl_complex_math.h>
-#endif
+#include <string.h>
 
 static inline amide_real_t gaussian(amide_real_t x, amide_real_t sigma) {
   return exp(-(x*x)/(2.0*sigma*sigma))/(sigma*sqrt(2*M_PI));
 }
 
-/* gaussian kernel is returned in a packad array (alternating real and imaginary parts 
-   since the filter is entirely real, all imaginary parts are zero */
-AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel kernel_size,
-							      const AmitkPoint voxel_size,
-							      const amide_real_t fwhm) {
+/* the gaussian is separable, the 3D kernel is the product of these 1D kernels
+   along x, y, and z.  Returns kernel_size values summing to 1, free with g_free */
+amide_data_t * amitk_filter_calculate_gaussian_kernel_1D(const gint kernel_size,
+							 const amide_real_t voxel_size,
+							 const amide_real_t fwhm) {
 
-  AmitkVoxel i_voxel;
-  AmitkPoint location;
+  amide_data_t * kernel;
   amide_real_t sigma;
-  AmitkVoxel half;
-  AmitkRawData * kernel;
   amide_real_t total;
-  amide_real_t gaussian_value;
+  gint half;
+  gint i;
+
+  g_return_val_if_fail((kernel_size & 0x1), NULL); /* needs to be odd */
+
+  if ((kernel = g_try_new(amide_data_t, kernel_size)) == NULL) {
+    g_warning(_("Couldn't allocate memory space for the kernel data"));
+    return NULL;
+  }
+
+  sigma = fwhm/SIGMA_TO_FWHM;
+  half = kernel_size>>1;
+
+  /* a zero width gaussian doesn't do anything */
+  if (sigma <= 0.0) {
+    for (i=0; i < kernel_size; i++)
+      kernel[i] = (i == half) ? 1.0 : 0.0;
+    return kernel;
+  }
+
+  total = 0.0;
+  for (i=0; i < kernel_size; i++) {
+    kernel[i] = gaussian(voxel_size*(i-half), sigma);
+    total += kernel[i];
+  }
+
+  /* renormalize, as the tails are cut, and we've discretized the gaussian */
+  for (i=0; i < kernel_size; i++)
+    kernel[i] /= total;
+
+  return kernel;
+}
+
+/* returns the 3D gaussian kernel, as a DOUBLE raw data of dimensions kernel_size */
+AmitkRawData * amitk_filter_calculate_gaussian_kernel(const AmitkVoxel kernel_size,
+						      const AmitkPoint voxel_size,
+						      const amide_real_t fwhm) {
+
+  AmitkVoxel i_voxel;
+  AmitkRawData * kernel=NULL;
+  amide_data_t * kernel_x=NULL;
+  amide_data_t * kernel_y=NULL;
+  amide_data_t * kernel_z=NULL;
 
   g_return_val_if_fail((kernel_size.t == 1), NULL); /* can't filter over time */
   g_return_val_if_fail((kernel_size.g == 1), NULL); /* can't filter over gates */
@@ -55,176 +93,445 @@ AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel k
   g_return_val_if_fail((kernel_size.y & 0x1), NULL); 
   g_return_val_if_fail((kernel_size.x & 0x1), NULL); 
 
-  if ((kernel = amitk_raw_data_new()) == NULL) {
-    g_warning(_("couldn't allocate memory space for the kernel structure"));
-    return NULL;
-  }
-  kernel->format = AMITK_FORMAT_DOUBLE;
-
-  g_free(kernel->data);
-  kernel->dim.t = kernel->dim.g = 1;
-  kernel->dim.z = kernel->dim.y = AMITK_FILTER_FFT_SIZE;
-  kernel->dim.x = 2*AMITK_FILTER_FFT_SIZE; /* real and complex */
+  kernel_x = amitk_filter_calculate_gaussian_kernel_1D(kernel_size.x, voxel_size.x, fwhm);
+  kernel_y = amitk_filter_calculate_gaussian_kernel_1D(kernel_size.y, voxel_size.y, fwhm);
+  kernel_z = amitk_filter_calculate_gaussian_kernel_1D(kernel_size.z, voxel_size.z, fwhm);
+  if ((kernel_x == NULL) || (kernel_y == NULL) || (kernel_z == NULL)) 
+    goto exit_strategy;
 
-  /* get mem for the kernel, initialized to 0 */
-  if ((kernel->data = amitk_raw_data_get_data_mem0(kernel)) == NULL) {
+  if ((kernel = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, kernel_size)) == NULL) {
     g_warning(_("Couldn't allocate memory space for the kernel data"));
-    amitk_object_unref(kernel);
-    return NULL;
+    goto exit_strategy;
   }
 
-  sigma = fwhm/SIGMA_TO_FWHM;
-  half.t = half.g = 0;
-  half.z = kernel_size.z>>1;
-  half.y = kernel_size.y>>1;
-  half.x = kernel_size.x>>1;
+  i_voxel.t = i_voxel.g = 0;
+  for (i_voxel.z = 0; i_voxel.z < kernel_size.z; i_voxel.z++) 
+    for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++) 
+      for (i_voxel.x = 0; i_voxel.x < kernel_size.x; i_voxel.x++) 
+	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(kernel, i_voxel) = 
+	  kernel_z[i_voxel.z]*kernel_y[i_voxel.y]*kernel_x[i_voxel.x];
 
-  total = 0.0;
+ exit_strategy:
+  if (kernel_x != NULL) g_free(kernel_x);
+  if (kernel_y != NULL) g_free(kernel_y);
+  if (kernel_z != NULL) g_free(kernel_z);
 
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z = 0; i_voxel.z < kernel_size.z; i_voxel.z++) {
-    location.z = voxel_size.z*(i_voxel.z-half.z);
-    for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++) {
-      location.y = voxel_size.y*(i_voxel.y-half.y);
-      for (i_voxel.x = 0; i_voxel.x < 2*kernel_size.x; i_voxel.x+=2) {
-	location.x = voxel_size.x*(i_voxel.x/2-half.x);
-	gaussian_value = gaussian(point_mag(location), sigma);
-
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(kernel, i_voxel) = gaussian_value;
-	total += gaussian_value;
+  return kernel;
+}
+
+#ifdef AMIDE_LIBGSL_SUPPORT
+
+/* blocks don't get any bigger than this along an axis, unless the kernel needs it */
+#define FFT_MAX_BLOCK_SIZE 128
+
+/* every thread works on its own block, these get split between them (and the kernel's 
+   spectrum, which they share).  Blocks are shrunk to fit, at the cost of more of them */
+#define FFT_MEMORY_BUDGET (256*1024*1024)
+
+/* how many kernel spectra to hang onto */
+#define FFT_SPECTRUM_CACHE_SIZE 4
+
+/* notes
+   - the blocks are real data, so x is done with a real to complex transform, leaving
+     block_size.x/2+1 complex values per row (the rest follow from symmetry).  y and z 
+     are then complex transforms over just those values.  Rows in a block are 
+     2*(block_size.x/2+1) doubles long to make room for this.
+   - gsl's mixed radix transforms work for any size, but are quickest when the 
+     size only has small factors
+*/
+struct _AmitkFilterFFT {
+  AmitkVoxel block_size;
+  gsl_fft_real_wavetable * real_wavetable;
+  gsl_fft_halfcomplex_wavetable * halfcomplex_wavetable;
+  gsl_fft_real_workspace * real_workspace;
+  gsl_fft_complex_wavetable * y_wavetable;
+  gsl_fft_complex_workspace * y_workspace;
+  gsl_fft_complex_wavetable * z_wavetable;
+  gsl_fft_complex_workspace * z_workspace;
+};
+
+typedef struct {
+  AmitkVoxel block_size;
+  AmitkRawData * kernel;
+  AmitkRawData * spectrum;
+} spectrum_cache_t;
+
+static GList * spectrum_cache = NULL;
+G_LOCK_DEFINE_STATIC(spectrum_cache);
+
+
+static gboolean fft_good_size(gint n) {
+  while ((n % 2) == 0) n /= 2;
+  while ((n % 3) == 0) n /= 3;
+  while ((n % 5) == 0) n /= 5;
+  return (n == 1);
+}
+
+static gint fft_next_good_size(gint n) {
+  while (!fft_good_size(n)) n++;
+  return n;
+}
+
+static gint fft_prev_good_size(gint n) {
+  while ((n > 1) && !fft_good_size(n)) n--;
+  return n;
+}
+
+/* the memory taken up by a block, see amitk_filter_fft_new_block */
+static gdouble fft_block_bytes(const AmitkVoxel block_size) {
+  return ((gdouble) block_size.z)*block_size.y*2*(block_size.x/2+1)*sizeof(amitk_format_DOUBLE_t);
+}
+
+/* the amount of work needed along an axis, each block gives n-kernel_size+1 output voxels */
+static gdouble fft_axis_cost(const gint n, const gint kernel_size, const gint dim) {
+  gint num_blocks;
+
+  num_blocks = (dim + n-kernel_size)/(n-kernel_size+1);
+  return num_blocks*n*(1.0+log(n));
+}
+
+static gint fft_block_size_1D(const gint kernel_size, const gint dim) {
+
+  gint n, max_n, best_n;
+  gdouble cost, best_cost;
+
+  /* no point in a block bigger than what covers the whole axis in one go */
+  max_n = fft_next_good_size(dim+kernel_size-1);
+  max_n = MIN(max_n, MAX(FFT_MAX_BLOCK_SIZE, fft_next_good_size(2*kernel_size)));
+
+  best_n = max_n;
+  best_cost = fft_axis_cost(max_n, kernel_size, dim);
+  for (n = fft_next_good_size(kernel_size); n < max_n; n = fft_next_good_size(n+1)) {
+    cost = fft_axis_cost(n, kernel_size, dim);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_n = n;
+    }
+  }
+
+  return best_n;
+}
+
+/* picks the block size that minimizes the amount of work for filtering data of dimension data_dim,
+   and then shrinks the longest side until a block for each thread fits in FFT_MEMORY_BUDGET. 
+   If the kernel's too big for that, blocks are left just big enough to hold it, and 
+   amitk_filter_fft_cost will show that FFT filtering isn't worth it */
+AmitkVoxel amitk_filter_fft_block_size(const AmitkVoxel kernel_size, const AmitkVoxel data_dim) {
+
+  AmitkVoxel block_size;
+  gdouble max_bytes;
+  AmitkDim i_dim, longest_dim;
+  gint n, longest_n;
+
+  block_size.t = block_size.g = 1;
+  block_size.z = fft_block_size_1D(kernel_size.z, data_dim.z);
+  block_size.y = fft_block_size_1D(kernel_size.y, data_dim.y);
+  block_size.x = fft_block_size_1D(kernel_size.x, data_dim.x);
+
+  max_bytes = ((gdouble) FFT_MEMORY_BUDGET)/(amitk_parallel_get_num_threads()+1);
+  while (fft_block_bytes(block_size) > max_bytes) {
+    longest_dim = AMITK_DIM_NUM;
+    longest_n = 0;
+    for (i_dim=AMITK_DIM_X; i_dim<=AMITK_DIM_Z; i_dim++) {
+      n = voxel_get_dim(block_size, i_dim);
+      if ((n > longest_n) && (fft_prev_good_size(n-1) >= voxel_get_dim(kernel_size, i_dim))) {
+	longest_dim = i_dim;
+	longest_n = n;
       }
     }
+    if (longest_dim == AMITK_DIM_NUM) break; /* can't get any smaller */
+    voxel_set_dim(&block_size, longest_dim, fft_prev_good_size(longest_n-1));
   }
 
-  /* renormalize, as the tails are cut, and we've discretized the gaussian */
-  for (i_voxel.z = 0; i_voxel.z < kernel_size.z; i_voxel.z++) 
-    for (i_voxel.y = 0; i_voxel.y < kernel_size.y; i_voxel.y++) 
-      for (i_voxel.x = 0; i_voxel.x < 2*kernel_size.x; i_voxel.x+=2) 
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(kernel, i_voxel) /= total; 
+  return block_size;
+}
 
-  return kernel;
+/* a rough guess of the number of floating point operations per output voxel 
+   needed for FFT filtering, for comparison with direct convolution */
+gdouble amitk_filter_fft_cost(const AmitkVoxel kernel_size, const AmitkVoxel data_dim) {
+
+  AmitkVoxel block_size;
+  gdouble block_voxels;
+  gdouble output_voxels;
+
+  block_size = amitk_filter_fft_block_size(kernel_size, data_dim);
+  block_voxels = ((gdouble) block_size.z)*block_size.y*block_size.x;
+  output_voxels = ((gdouble) block_size.z-kernel_size.z+1)*
+    (block_size.y-kernel_size.y+1)*(block_size.x-kernel_size.x+1);
+
+  /* forward and inverse real transforms at ~2.5 N log2(N), plus the complex multiply */
+  return (5.0*log(block_voxels)/log(2.0) + 3.0)*block_voxels/output_voxels;
 }
 
-#ifdef AMIDE_LIBGSL_SUPPORT
-void amitk_filter_3D_FFT(AmitkRawData * data, 
-			   gsl_fft_complex_wavetable * wavetable,
-			   gsl_fft_complex_workspace * workspace) {
+/* a zero'd block of data, for use with the given block size */
+AmitkRawData * amitk_filter_fft_new_block(const AmitkVoxel block_size) {
 
-  AmitkVoxel i_voxel;
+  AmitkVoxel dim;
 
-  
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_G(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == 2*AMITK_FILTER_FFT_SIZE);
-
-  /* FFT in the X direction */
-  i_voxel.t = i_voxel.g = i_voxel.x = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      1,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* FFT in the Y direction */
-  i_voxel.t = i_voxel.g = i_voxel.y = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			     wavetable, workspace);
-
-  /* FFT in the Z direction */
-  i_voxel.t = i_voxel.g = i_voxel.z = 0;
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_forward(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE*AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
+  dim.t = dim.g = 1;
+  dim.z = block_size.z;
+  dim.y = block_size.y;
+  dim.x = 2*(block_size.x/2+1); /* room for the complex values */
+
+  return amitk_raw_data_new_with_data0(AMITK_FORMAT_DOUBLE, dim);
+}
+
+AmitkFilterFFT * amitk_filter_fft_new(const AmitkVoxel block_size) {
+
+  AmitkFilterFFT * fft;
+
+  fft = g_try_new0(AmitkFilterFFT, 1);
+  if (fft == NULL) return NULL;
+  fft->block_size = block_size;
+
+  fft->real_wavetable = gsl_fft_real_wavetable_alloc(block_size.x);
+  fft->halfcomplex_wavetable = gsl_fft_halfcomplex_wavetable_alloc(block_size.x);
+  fft->real_workspace = gsl_fft_real_workspace_alloc(block_size.x);
+  fft->y_wavetable = gsl_fft_complex_wavetable_alloc(block_size.y);
+  fft->y_workspace = gsl_fft_complex_workspace_alloc(block_size.y);
+  fft->z_wavetable = gsl_fft_complex_wavetable_alloc(block_size.z);
+  fft->z_workspace = gsl_fft_complex_workspace_alloc(block_size.z);
+
+  if ((fft->real_wavetable == NULL) || (fft->halfcomplex_wavetable == NULL) ||
+      (fft->real_workspace == NULL) || 
+      (fft->y_wavetable == NULL) || (fft->y_workspace == NULL) ||
+      (fft->z_wavetable == NULL) || (fft->z_workspace == NULL)) {
+    g_warning(_("Filtering: Failed to allocate wavetable and workspace"));
+    amitk_filter_fft_free(fft);
+    return NULL;
+  }
+
+  return fft;
+}
+
+void amitk_filter_fft_free(AmitkFilterFFT * fft) {
+
+  g_return_if_fail(fft != NULL);
+
+  if (fft->real_wavetable != NULL) gsl_fft_real_wavetable_free(fft->real_wavetable);
+  if (fft->halfcomplex_wavetable != NULL) gsl_fft_halfcomplex_wavetable_free(fft->halfcomplex_wavetable);
+  if (fft->real_workspace != NULL) gsl_fft_real_workspace_free(fft->real_workspace);
+  if (fft->y_wavetable != NULL) gsl_fft_complex_wavetable_free(fft->y_wavetable);
+  if (fft->y_workspace != NULL) gsl_fft_complex_workspace_free(fft->y_workspace);
+  if (fft->z_wavetable != NULL) gsl_fft_complex_wavetable_free(fft->z_wavetable);
+  if (fft->z_workspace != NULL) gsl_fft_complex_workspace_free(fft->z_workspace);
+  g_free(fft);
 
   return;
 }
 
-void amitk_filter_inverse_3D_FFT(AmitkRawData * data, 
-				   gsl_fft_complex_wavetable * wavetable,
-				   gsl_fft_complex_workspace * workspace) {
+/* gsl's real transform leaves things in halfcomplex order (r0, r1, i1, r2, i2, ...), 
+   shift it over into normal complex order.  The row has room for n/2+1 complex values */
+static void fft_unpack_row(double * row, const gint n) {
 
-  AmitkVoxel i_voxel;
+  gint k;
+  double re, im;
+
+  for (k = n/2; k >= 1; k--) {
+    re = row[2*k-1];
+    im = (2*k < n) ? row[2*k] : 0.0;
+    row[2*k] = re;
+    row[2*k+1] = im;
+  }
+  row[1] = 0.0;
 
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_G(data) == 1);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_FILTER_FFT_SIZE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == 2*AMITK_FILTER_FFT_SIZE);
-
-  /* inverse FFT in the X direction */
-  i_voxel.t = i_voxel.g = i_voxel.x = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      1,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* inverse FFT in the Y direction */
-  i_voxel.t = i_voxel.g = i_voxel.y = 0;
-  for (i_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++) 
-    for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-      gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-			      AMITK_FILTER_FFT_SIZE,
-			      AMITK_FILTER_FFT_SIZE,
-			      wavetable, workspace);
-
-  /* inverse FFT in the Z direction */
-  i_voxel.t = i_voxel.g = i_voxel.z = 0;
-    for (i_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2) 
-	gsl_fft_complex_inverse(AMITK_RAW_DATA_DOUBLE_POINTER(data,i_voxel),
-				AMITK_FILTER_FFT_SIZE*AMITK_FILTER_FFT_SIZE,
-				AMITK_FILTER_FFT_SIZE,
-				wavetable, workspace);
   return;
 }
 
-/* multiples the data by the kernel, both of which are in packed complex form */
-void amitk_filter_complex_mult(AmitkRawData * data, AmitkRawData * kernel) {
+/* and back to halfcomplex order */
+static void fft_pack_row(double * row, const gint n) {
 
-  AmitkVoxel i_voxel;
-  AmitkVoxel j_voxel;
-  gsl_complex a,b;
-  
+  gint k;
 
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(data) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_FORMAT(kernel) == AMITK_FORMAT_DOUBLE);
-  g_return_if_fail(AMITK_RAW_DATA_DIM_T(data) == AMITK_RAW_DATA_DIM_T(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Z(data) == AMITK_RAW_DATA_DIM_Z(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_Y(data) == AMITK_RAW_DATA_DIM_Y(kernel));
-  g_return_if_fail(AMITK_RAW_DATA_DIM_X(data) == AMITK_RAW_DATA_DIM_X(kernel));
-
-
-  i_voxel.t = i_voxel.g = j_voxel.t = j_voxel.g = 0;
-  for (i_voxel.z = 0, j_voxel.z=0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(data); i_voxel.z++, j_voxel.z++)
-    for (i_voxel.y = 0, j_voxel.y=0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(data); i_voxel.y++, j_voxel.y++)
-      for (i_voxel.x = 0, j_voxel.x=1; i_voxel.x < AMITK_RAW_DATA_DIM_X(data); i_voxel.x+=2, j_voxel.x+=2) {
-	a.dat[0] = AMITK_RAW_DATA_DOUBLE_CONTENT(data, i_voxel);
-	a.dat[1] = AMITK_RAW_DATA_DOUBLE_CONTENT(data, j_voxel);
-	b.dat[0] = AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, i_voxel);
-	b.dat[1] = AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, j_voxel);
-	a = gsl_complex_mul(a,b);
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(data, i_voxel) = a.dat[0];
-	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(data, j_voxel) = a.dat[1];
-      }
+  for (k=1; 2*k-1 < n; k++) {
+    row[2*k-1] = row[2*k];
+    if (2*k < n)
+      row[2*k] = row[2*k+1];
+  }
+
+  return;
+}
+
+/* the block should hold real data in the first block_size.x values of each row */
+void amitk_filter_fft_forward(AmitkFilterFFT * fft, AmitkRawData * block) {
+
+  double * data;
+  gint row_stride, num_x;
+  gint z, y, k;
+  AmitkVoxel n;
+
+  g_return_if_fail(AMITK_RAW_DATA_FORMAT(block) == AMITK_FORMAT_DOUBLE);
+  n = fft->block_size;
+  g_return_if_fail(AMITK_RAW_DATA_DIM_X(block) == 2*(n.x/2+1));
+
+  data = block->data;
+  num_x = n.x/2+1;
+  row_stride = 2*num_x;
+
+  for (z=0; z < n.z; z++) 
+    for (y=0; y < n.y; y++) {
+      gsl_fft_real_transform(data+(z*n.y+y)*row_stride, 1, n.x,
+			     fft->real_wavetable, fft->real_workspace);
+      fft_unpack_row(data+(z*n.y+y)*row_stride, n.x);
+    }
+
+  for (z=0; z < n.z; z++)
+    for (k=0; k < num_x; k++)
+      gsl_fft_complex_forward(data+z*n.y*row_stride+2*k, num_x, n.y,
+			      fft->y_wavetable, fft->y_workspace);
 
+  for (y=0; y < n.y; y++)
+    for (k=0; k < num_x; k++)
+      gsl_fft_complex_forward(data+y*row_stride+2*k, n.y*num_x, n.z,
+			      fft->z_wavetable, fft->z_workspace);
 
   return;
 }
 
+/* leaves the (real) result in the first block_size.x values of each row */
+void amitk_filter_fft_inverse(AmitkFilterFFT * fft, AmitkRawData * block) {
+
+  double * data;
+  gint row_stride, num_x;
+  gint z, y, k;
+  AmitkVoxel n;
+
+  g_return_if_fail(AMITK_RAW_DATA_FORMAT(block) == AMITK_FORMAT_DOUBLE);
+  n = fft->block_size;
+  g_return_if_fail(AMITK_RAW_DATA_DIM_X(block) == 2*(n.x/2+1));
+
+  data = block->data;
+  num_x = n.x/2+1;
+  row_stride = 2*num_x;
+
+  for (y=0; y < n.y; y++)
+    for (k=0; k < num_x; k++)
+      gsl_fft_complex_inverse(data+y*row_stride+2*k, n.y*num_x, n.z,
+			      fft->z_wavetable, fft->z_workspace);
+
+  for (z=0; z < n.z; z++)
+    for (k=0; k < num_x; k++)
+      gsl_fft_complex_inverse(data+z*n.y*row_stride+2*k, num_x, n.y,
+			      fft->y_wavetable, fft->y_workspace);
+
+  for (z=0; z < n.z; z++) 
+    for (y=0; y < n.y; y++) {
+      fft_pack_row(data+(z*n.y+y)*row_stride, n.x);
+      gsl_fft_halfcomplex_inverse(data+(z*n.y+y)*row_stride, 1, n.x,
+				  fft->halfcomplex_wavetable, fft->real_workspace);
+    }
+
+  return;
+}
+
+/* multiplies the transformed block by the kernel spectrum */
+void amitk_filter_fft_mult(AmitkRawData * block, const AmitkRawData * spectrum) {
+
+  double * a;
+  const double * b;
+  double re, im;
+  gsize k, num;
+
+  g_return_if_fail(AMITK_RAW_DATA_FORMAT(block) == AMITK_FORMAT_DOUBLE);
+  g_return_if_fail(AMITK_RAW_DATA_FORMAT(spectrum) == AMITK_FORMAT_DOUBLE);
+  g_return_if_fail(VOXEL_EQUAL(AMITK_RAW_DATA_DIM(block), AMITK_RAW_DATA_DIM(spectrum)));
+
+  a = block->data;
+  b = spectrum->data;
+  num = amitk_raw_data_num_voxels(block)/2;
+
+  for (k=0; k < num; k++) {
+    re = a[2*k]*b[2*k] - a[2*k+1]*b[2*k+1];
+    im = a[2*k]*b[2*k+1] + a[2*k+1]*b[2*k];
+    a[2*k] = re;
+    a[2*k+1] = im;
+  }
+
+  return;
+}
+
+static gboolean same_kernel(const AmitkRawData * kernel1, const AmitkRawData * kernel2) {
+  return (VOXEL_EQUAL(AMITK_RAW_DATA_DIM(kernel1), AMITK_RAW_DATA_DIM(kernel2)) &&
+	  (memcmp(kernel1->data, kernel2->data, amitk_raw_data_size_data_mem(kernel1)) == 0));
+}
+
+/* returns the transform of the kernel (a DOUBLE raw data with odd dimensions), zero
+   padded out to the block size.  Recently used spectra are cached, as filtering 
+   several data sets with the same settings needs the same one.  Unref when done */
+AmitkRawData * amitk_filter_fft_kernel_spectrum(const AmitkRawData * kernel, 
+						const AmitkVoxel block_size) {
+
+  GList * item;
+  spectrum_cache_t * entry;
+  AmitkRawData * spectrum=NULL;
+  AmitkFilterFFT * fft;
+  AmitkVoxel i_voxel;
+
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(kernel) == AMITK_FORMAT_DOUBLE, NULL);
+  g_return_val_if_fail(AMITK_RAW_DATA_DIM_Z(kernel) <= block_size.z, NULL);
+  g_return_val_if_fail(AMITK_RAW_DATA_DIM_Y(kernel) <= block_size.y, NULL);
+  g_return_val_if_fail(AMITK_RAW_DATA_DIM_X(kernel) <= block_size.x, NULL);
+
+  G_LOCK(spectrum_cache);
+  for (item = spectrum_cache; (item != NULL) && (spectrum == NULL); item = item->next) {
+    entry = item->data;
+    if (VOXEL_EQUAL(entry->block_size, block_size) && same_kernel(entry->kernel, kernel)) {
+      spectrum = g_object_ref(entry->spectrum);
+      spectrum_cache = g_list_remove_link(spectrum_cache, item); /* move to the front */
+      spectrum_cache = g_list_concat(item, spectrum_cache);
+    }
+  }
+  G_UNLOCK(spectrum_cache);
+  if (spectrum != NULL) return spectrum;
+
+  if ((spectrum = amitk_filter_fft_new_block(block_size)) == NULL) {
+    g_warning(_("Couldn't allocate memory space for the kernel data"));
+    return NULL;
+  }
+  if ((fft = amitk_filter_fft_new(block_size)) == NULL) {
+    g_object_unref(spectrum);
+    return NULL;
+  }
+
+  i_voxel.t = i_voxel.g = 0;
+  for (i_voxel.z = 0; i_voxel.z < AMITK_RAW_DATA_DIM_Z(kernel); i_voxel.z++) 
+    for (i_voxel.y = 0; i_voxel.y < AMITK_RAW_DATA_DIM_Y(kernel); i_voxel.y++) 
+      for (i_voxel.x = 0; i_voxel.x < AMITK_RAW_DATA_DIM_X(kernel); i_voxel.x++) 
+	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(spectrum, i_voxel) = 
+	  AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, i_voxel);
+
+  amitk_filter_fft_forward(fft, spectrum);
+  amitk_filter_fft_free(fft);
+
+  /* and stash a copy */
+  entry = g_try_new(spectrum_cache_t, 1);
+  if (entry != NULL) {
+    entry->block_size = block_size;
+    entry->spectrum = g_object_ref(spectrum);
+    entry->kernel = amitk_raw_data_new_with_data(AMITK_FORMAT_DOUBLE, AMITK_RAW_DATA_DIM(kernel));
+    if (entry->kernel == NULL) {
+      g_object_unref(entry->spectrum);
+      g_free(entry);
+    } else {
+      memcpy(entry->kernel->data, kernel->data, amitk_raw_data_size_data_mem(kernel));
+
+      G_LOCK(spectrum_cache);
+      spectrum_cache = g_list_prepend(spectrum_cache, entry);
+      while (g_list_length(spectrum_cache) > FFT_SPECTRUM_CACHE_SIZE) {
+	item = g_list_last(spectrum_cache);
+	entry = item->data;
+	g_object_unref(entry->kernel);
+	g_object_unref(entry->spectrum);
+	g_free(entry);
+	spectrum_cache = g_list_delete_link(spectrum_cache, item);
+      }
+      G_UNLOCK(spectrum_cache);
+    }
+  }
+
+  return spectrum;
+}
+
 #endif
 
 
@@ -34,6 +34,8 @@
 #include "amitk_raw_data.h"
 #ifdef AMIDE_LIBGSL_SUPPORT
 #include <gsl/gsl_fft_complex.h>
+#include <gsl/gsl_fft_real.h>
+#include <gsl/gsl_fft_halfcomplex.h>
 #endif
 
 G_BEGIN_DECLS
@@ -45,22 +47,34 @@ typedef enum {
   AMITK_FILTER_NUM
 } AmitkFilter;
 
-#define AMITK_FILTER_FFT_SIZE 64
-
-
-AmitkRawData * amitk_filter_calculate_gaussian_kernel_complex(const AmitkVoxel kernel_size,
-							      const AmitkPoint voxel_size,
-							      const amide_real_t fwhm);
+AmitkRawData * amitk_filter_calculate_gaussian_kernel(const AmitkVoxel kernel_size,
+						      const AmitkPoint voxel_size,
+						      const amide_real_t fwhm);
+amide_data_t * amitk_filter_calculate_gaussian_kernel_1D(const gint kernel_size,
+							 const amide_real_t voxel_size,
+							 const amide_real_t fwhm);
 
 #ifdef AMIDE_LIBGSL_SUPPORT
-void amitk_filter_3D_FFT(AmitkRawData * data, 
-			 gsl_fft_complex_wavetable * wavetable,
-			 gsl_fft_complex_workspace * workspace);
-void amitk_filter_inverse_3D_FFT(AmitkRawData * data, 
-				 gsl_fft_complex_wavetable * wavetable,
-				 gsl_fft_complex_workspace * workspace);
-void amitk_filter_complex_mult(AmitkRawData * data, AmitkRawData * kernel);
+/* what a thread needs for transforming blocks of a given size */
+typedef struct _AmitkFilterFFT AmitkFilterFFT;
+
+AmitkVoxel       amitk_filter_fft_block_size      (const AmitkVoxel kernel_size,
+						   const AmitkVoxel data_dim);
+gdouble          amitk_filter_fft_cost            (const AmitkVoxel kernel_size,
+						   const AmitkVoxel data_dim);
+AmitkRawData *   amitk_filter_fft_new_block       (const AmitkVoxel block_size);
+AmitkFilterFFT * amitk_filter_fft_new             (const AmitkVoxel block_size);
+void             amitk_filter_fft_free            (AmitkFilterFFT * fft);
+void             amitk_filter_fft_forward         (AmitkFilterFFT * fft,
+						   AmitkRawData * block);
+void             amitk_filter_fft_inverse         (AmitkFilterFFT * fft,
+						   AmitkRawData * block);
+void             amitk_filter_fft_mult            (AmitkRawData * block,
+						   const AmitkRawData * spectrum);
+AmitkRawData *   amitk_filter_fft_kernel_spectrum (const AmitkRawData * kernel,
+						   const AmitkVoxel block_size);
 #endif
+
 amide_data_t amitk_filter_find_median_by_partial_sort(amide_data_t * partial_sort_data, gint size);
 
 const gchar * amitk_filter_get_name(const AmitkFilter filter);
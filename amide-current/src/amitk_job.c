@@ -0,0 +1,346 @@
+/* amitk_job.c - runs long operations in the background
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#include "amide_config.h"
+#include "amitk_job.h"
+#include "amide_intl.h"
+
+/* notes
+   - the job is reference counted. The submitter, the worker thread, and any
+     pending progress/done callbacks each hold a reference.
+   - progress updates from the worker only store the latest message/fraction,
+     at most one progress callback is waiting in the main loop at a time, so a
+     job that updates often can't flood the main loop
+   - callbacks are added to the main loop in order, so the done callback always
+     comes after the last progress callback
+   - the worker can't pop up dialogs, so warnings raised while running the job
+     function are collected in the job (the log handler checks amitk_job_get_current)
+     and shown from the main loop once the job's done
+*/
+struct _AmitkJob {
+  gchar * name;
+  AmitkJobFunc func;
+  AmitkJobProgressFunc progress_func;
+  AmitkJobDoneFunc done_func;
+  gpointer data;
+  GDestroyNotify destroy_data;
+
+  gint ref_count; /* atomic */
+  gint canceled; /* atomic */
+  gint done; /* atomic */
+  gpointer result;
+
+  GMutex mutex; /* protects the below */
+  gchar * message; /* latest message, NULL if not changed since the last progress callback */
+  gdouble fraction;
+  gboolean progress_pending;
+  GString * messages; /* warnings raised by the job function, NULL if none */
+};
+
+static GThreadPool * job_pool = NULL;
+static gint num_pending = 0; /* atomic */
+static GPrivate current_job = G_PRIVATE_INIT(NULL); /* the job a worker thread is running */
+G_LOCK_DEFINE_STATIC(job_pool);
+
+
+
+static gboolean job_progress_idle(gpointer data) {
+
+  AmitkJob * job = data;
+  gchar * message;
+  gdouble fraction;
+
+  g_mutex_lock(&(job->mutex));
+  message = job->message;
+  job->message = NULL;
+  fraction = job->fraction;
+  job->progress_pending = FALSE;
+  g_mutex_unlock(&(job->mutex));
+
+  if (job->progress_func != NULL)
+    (*job->progress_func)(job, message, fraction, job->data);
+
+  if (message != NULL)
+    g_free(message);
+  amitk_job_unref(job);
+
+  return FALSE;
+}
+
+static gboolean job_done_idle(gpointer data) {
+
+  AmitkJob * job = data;
+  gchar * messages;
+
+  if (job->done_func != NULL)
+    (*job->done_func)(job, job->result, job->data);
+  job->result = NULL;
+
+  /* anything the done function didn't report itself */
+  messages = amitk_job_take_messages(job);
+  if (messages != NULL) {
+    g_warning("%s", messages);
+    g_free(messages);
+  }
+
+  /* the data's no longer needed */
+  if (job->destroy_data != NULL)
+    (*job->destroy_data)(job->data);
+  job->data = NULL;
+
+  g_atomic_int_add(&num_pending, -1);
+  amitk_job_unref(job);
+
+  return FALSE;
+}
+
+static void job_pool_func(gpointer data, gpointer user_data) {
+
+  AmitkJob * job = data;
+
+#ifdef AMIDE_DEBUG
+  g_print("starting job %s\n", job->name);
+#endif
+
+  g_private_set(&current_job, job);
+  if (!amitk_job_is_canceled(job))
+    job->result = (*job->func)(job, job->data);
+  g_private_set(&current_job, NULL);
+
+  g_atomic_int_set(&(job->done), TRUE);
+
+#ifdef AMIDE_DEBUG
+  g_print("finished job %s%s\n", job->name, amitk_job_is_canceled(job) ? " (canceled)" : "");
+#endif
+
+  /* hand our reference over to the done callback */
+  g_idle_add(job_done_idle, job);
+
+  return;
+}
+
+static GThreadPool * get_job_pool(void) {
+
+  GError * error=NULL;
+  GThreadPool * pool;
+
+  G_LOCK(job_pool);
+  if (job_pool == NULL) {
+    job_pool = g_thread_pool_new(job_pool_func, NULL, AMITK_JOB_NUM_WORKERS, FALSE, &error);
+    if (job_pool == NULL) {
+      g_warning(_("Could not start worker threads: %s"),
+		(error != NULL) ? error->message : "");
+      if (error != NULL) g_error_free(error);
+    }
+  }
+  pool = job_pool;
+  G_UNLOCK(job_pool);
+
+  return pool;
+}
+
+
+
+/* queues up func to be run in the background.  The returned job should be
+   unref'd by the caller when no longer needed, this doesn't cancel the job.
+   destroy_data (if not NULL) is called on data after the done callback. */
+AmitkJob * amitk_job_submit(const gchar * name,
+			    AmitkJobFunc func,
+			    AmitkJobProgressFunc progress_func,
+			    AmitkJobDoneFunc done_func,
+			    gpointer data,
+			    GDestroyNotify destroy_data) {
+
+  AmitkJob * job;
+  GThreadPool * pool;
+
+  g_return_val_if_fail(func != NULL, NULL);
+
+  job = g_new0(AmitkJob, 1);
+  job->name = g_strdup(name != NULL ? name : "job");
+  job->func = func;
+  job->progress_func = progress_func;
+  job->done_func = done_func;
+  job->data = data;
+  job->destroy_data = destroy_data;
+  job->ref_count = 2; /* one for the caller, one for the worker */
+  job->fraction = 0.0;
+  g_mutex_init(&(job->mutex));
+
+  g_atomic_int_inc(&num_pending);
+
+  pool = get_job_pool();
+  if (pool != NULL) {
+    g_thread_pool_push(pool, job, NULL);
+  } else { /* no threads, just do it here */
+    job_pool_func(job, NULL);
+  }
+
+  return job;
+}
+
+AmitkJob * amitk_job_ref(AmitkJob * job) {
+
+  g_return_val_if_fail(job != NULL, NULL);
+
+  g_atomic_int_inc(&(job->ref_count));
+
+  return job;
+}
+
+void amitk_job_unref(AmitkJob * job) {
+
+  g_return_if_fail(job != NULL);
+
+  if (g_atomic_int_dec_and_test(&(job->ref_count))) {
+    g_free(job->name);
+    if (job->message != NULL)
+      g_free(job->message);
+    if (job->messages != NULL)
+      g_string_free(job->messages, TRUE);
+    g_mutex_clear(&(job->mutex));
+    g_free(job);
+  }
+
+  return;
+}
+
+/* asks the job to stop, it'll stop the next time it reports progress.
+   The done callback still gets called. */
+void amitk_job_cancel(AmitkJob * job) {
+
+  g_return_if_fail(job != NULL);
+
+  g_atomic_int_set(&(job->canceled), TRUE);
+
+  return;
+}
+
+gboolean amitk_job_is_canceled(AmitkJob * job) {
+
+  g_return_val_if_fail(job != NULL, TRUE);
+
+  return g_atomic_int_get(&(job->canceled));
+}
+
+/* true once the job function has returned */
+gboolean amitk_job_is_done(AmitkJob * job) {
+
+  g_return_val_if_fail(job != NULL, TRUE);
+
+  return g_atomic_int_get(&(job->done));
+}
+
+const gchar * amitk_job_get_name(AmitkJob * job) {
+
+  g_return_val_if_fail(job != NULL, NULL);
+
+  return job->name;
+}
+
+gdouble amitk_job_get_fraction(AmitkJob * job) {
+
+  gdouble fraction;
+
+  g_return_val_if_fail(job != NULL, 0.0);
+
+  g_mutex_lock(&(job->mutex));
+  fraction = job->fraction;
+  g_mutex_unlock(&(job->mutex));
+
+  return fraction;
+}
+
+/* the number of jobs that haven't yet finished (including their done callback) */
+gint amitk_job_get_num_pending(void) {
+  return g_atomic_int_get(&num_pending);
+}
+
+/* an AmitkUpdateFunc, with the job as the data.  Can be called from any thread,
+   returns FALSE if the job has been canceled */
+gboolean amitk_job_update(gpointer job_pointer, char * message, gdouble fraction) {
+
+  AmitkJob * job = job_pointer;
+  gboolean add_idle = FALSE;
+
+  g_return_val_if_fail(job != NULL, FALSE);
+
+  g_mutex_lock(&(job->mutex));
+  if (message != NULL) {
+    if (job->message != NULL)
+      g_free(job->message);
+    job->message = g_strdup(message);
+  }
+  job->fraction = fraction;
+  if (!job->progress_pending) {
+    job->progress_pending = TRUE;
+    add_idle = TRUE;
+  }
+  g_mutex_unlock(&(job->mutex));
+
+  if (add_idle)
+    g_idle_add(job_progress_idle, amitk_job_ref(job));
+
+  return !amitk_job_is_canceled(job);
+}
+
+/* the job the calling thread is running, NULL if it's not a job's worker thread */
+AmitkJob * amitk_job_get_current(void) {
+  return g_private_get(&current_job);
+}
+
+/* keeps a warning around for the main loop, can be called from any thread */
+void amitk_job_add_message(AmitkJob * job, const gchar * message) {
+
+  g_return_if_fail(job != NULL);
+  g_return_if_fail(message != NULL);
+
+  g_mutex_lock(&(job->mutex));
+  if (job->messages == NULL)
+    job->messages = g_string_new(message);
+  else
+    g_string_append_printf(job->messages, "\n%s", message);
+  g_mutex_unlock(&(job->mutex));
+
+  return;
+}
+
+/* returns the warnings collected so far (NULL if none), and clears them.
+   The returned string should be freed */
+gchar * amitk_job_take_messages(AmitkJob * job) {
+
+  gchar * messages=NULL;
+
+  g_return_val_if_fail(job != NULL, NULL);
+
+  g_mutex_lock(&(job->mutex));
+  if (job->messages != NULL) {
+    messages = g_string_free(job->messages, FALSE);
+    job->messages = NULL;
+  }
+  g_mutex_unlock(&(job->mutex));
+
+  return messages;
+}
@@ -0,0 +1,79 @@
+/* amitk_job.h
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#ifndef __AMITK_JOB_H__
+#define __AMITK_JOB_H__
+
+/* header files that are always needed with this file */
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* how many jobs can run at the same time, the rest wait their turn.  Each
+   job can still use amitk_parallel_for to spread its own work out */
+#define AMITK_JOB_NUM_WORKERS 2
+
+typedef struct _AmitkJob AmitkJob;
+
+/* does the work, in one of the worker threads.  Anything taking an AmitkUpdateFunc
+   should be passed amitk_job_update and the job, so progress gets reported and
+   cancellation works.  The return value gets passed to the done function. */
+typedef gpointer (*AmitkJobFunc)         (AmitkJob * job, gpointer data);
+
+/* these are called from the main loop.  Fraction follows the AmitkUpdateFunc convention
+   (0 to 1 for progress, >1 when finished, < -0.5 for no idea how far along) */
+typedef void     (*AmitkJobProgressFunc) (AmitkJob * job, const gchar * message,
+					  const gdouble fraction, gpointer data);
+/* always called, result is NULL if the job was canceled before it started.
+   Warnings the job function raised are kept with the job (see amitk_job_take_messages),
+   whatever the done function doesn't take gets shown after it returns */
+typedef void     (*AmitkJobDoneFunc)     (AmitkJob * job, gpointer result, gpointer data);
+
+/* external functions */
+AmitkJob *    amitk_job_submit           (const gchar * name,
+					  AmitkJobFunc func,
+					  AmitkJobProgressFunc progress_func,
+					  AmitkJobDoneFunc done_func,
+					  gpointer data,
+					  GDestroyNotify destroy_data);
+AmitkJob *    amitk_job_ref              (AmitkJob * job);
+void          amitk_job_unref            (AmitkJob * job);
+void          amitk_job_cancel           (AmitkJob * job);
+gboolean      amitk_job_is_canceled      (AmitkJob * job);
+gboolean      amitk_job_is_done          (AmitkJob * job);
+const gchar * amitk_job_get_name         (AmitkJob * job);
+gdouble       amitk_job_get_fraction     (AmitkJob * job);
+gint          amitk_job_get_num_pending  (void);
+gboolean      amitk_job_update           (gpointer job,
+					  char * message,
+					  gdouble fraction);
+AmitkJob *    amitk_job_get_current      (void);
+void          amitk_job_add_message      (AmitkJob * job,
+					  const gchar * message);
+gchar *       amitk_job_take_messages    (AmitkJob * job);
+
+G_END_DECLS
+
+#endif /* __AMITK_JOB_H__ */
@@ -0,0 +1,210 @@
+/* amitk_parallel.c - helper for splitting work across a pool of threads
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#include "amide_config.h"
+#include "amitk_parallel.h"
+#include "amide_intl.h"
+
+/* items get split into about this many chunks per thread, so that uneven
+   work (e.g. part of a slice falling outside of the data set) balances out */
+#define CHUNKS_PER_THREAD 4
+
+/* notes
+   - the calling thread always works on the chunks as well, and only waits for
+     chunks that some other thread has already started on.  This means nested
+     calls (e.g. a parallel filter that generates slices) can't deadlock,
+     even if every thread in the pool is busy.
+   - the job is reference counted, as a pool thread may only get around
+     to a job after all of its chunks have been done
+*/
+typedef struct {
+  AmitkParallelFunc func;
+  gpointer data;
+  gint num_items;
+  gint chunk_size;
+  gint num_chunks;
+  gint next_chunk; /* atomic */
+  gint ref_count; /* atomic */
+  gint chunks_done; /* protected by mutex */
+  GMutex mutex;
+  GCond cond;
+} parallel_job_t;
+
+static GThreadPool * thread_pool = NULL;
+static gint max_threads = 0; /* 0 means use the number of processors */
+G_LOCK_DEFINE_STATIC(thread_pool);
+
+
+
+static void job_unref(parallel_job_t * job) {
+
+  if (g_atomic_int_dec_and_test(&(job->ref_count))) {
+    g_mutex_clear(&(job->mutex));
+    g_cond_clear(&(job->cond));
+    g_free(job);
+  }
+
+  return;
+}
+
+static void job_run_chunks(parallel_job_t * job) {
+
+  gint chunk;
+  gint start, end;
+  gint done=0;
+
+  while ((chunk = g_atomic_int_add(&(job->next_chunk), 1)) < job->num_chunks) {
+    start = chunk*job->chunk_size;
+    end = MIN(start+job->chunk_size, job->num_items);
+    (*job->func)(start, end, job->data);
+    done++;
+  }
+
+  if (done > 0) {
+    g_mutex_lock(&(job->mutex));
+    job->chunks_done += done;
+    if (job->chunks_done >= job->num_chunks)
+      g_cond_broadcast(&(job->cond));
+    g_mutex_unlock(&(job->mutex));
+  }
+
+  return;
+}
+
+static void thread_pool_func(gpointer data, gpointer user_data) {
+
+  parallel_job_t * job = data;
+
+  job_run_chunks(job);
+  job_unref(job);
+
+  return;
+}
+
+/* the pool doesn't include the calling thread, hence the -1 */
+static gint pool_size(void) {
+  return MAX(amitk_parallel_get_num_threads()-1, 1);
+}
+
+static GThreadPool * get_thread_pool(void) {
+
+  GError * error=NULL;
+  GThreadPool * pool;
+
+  G_LOCK(thread_pool);
+  if (thread_pool == NULL) {
+    thread_pool = g_thread_pool_new(thread_pool_func, NULL, pool_size(), FALSE, &error);
+    if (thread_pool == NULL) {
+      g_warning(_("Could not start worker threads: %s"),
+		(error != NULL) ? error->message : "");
+      if (error != NULL) g_error_free(error);
+    }
+  }
+  pool = thread_pool;
+  G_UNLOCK(thread_pool);
+
+  return pool;
+}
+
+
+
+/* the maximum number of threads to use, 0 for as many as there are processors */
+void amitk_parallel_set_max_threads(const gint new_max_threads) {
+
+  g_return_if_fail(new_max_threads >= 0);
+
+  G_LOCK(thread_pool);
+  max_threads = new_max_threads;
+  if (thread_pool != NULL)
+    g_thread_pool_set_max_threads(thread_pool, pool_size(), NULL);
+  G_UNLOCK(thread_pool);
+
+  return;
+}
+
+gint amitk_parallel_get_max_threads(void) {
+  return max_threads;
+}
+
+/* the number of threads (including the calling one) that work gets split over */
+gint amitk_parallel_get_num_threads(void) {
+
+  gint num_threads;
+
+  num_threads = max_threads;
+  if (num_threads <= 0)
+    num_threads = g_get_num_processors();
+
+  return CLAMP(num_threads, 1, AMITK_PARALLEL_MAX_THREADS);
+}
+
+
+/* calls func on ranges of [0,num_items) spread over the thread pool,
+   returns when all items have been processed */
+void amitk_parallel_for(const gint num_items, AmitkParallelFunc func, gpointer data) {
+
+  parallel_job_t * job;
+  GThreadPool * pool;
+  gint num_threads;
+  gint num_helpers;
+  gint i;
+
+  g_return_if_fail(func != NULL);
+
+  if (num_items <= 0) return;
+
+  num_threads = amitk_parallel_get_num_threads();
+  if ((num_threads <= 1) || (num_items == 1) || ((pool = get_thread_pool()) == NULL)) {
+    (*func)(0, num_items, data);
+    return;
+  }
+
+  job = g_new0(parallel_job_t, 1);
+  job->func = func;
+  job->data = data;
+  job->num_items = num_items;
+  job->num_chunks = MIN(num_items, num_threads*CHUNKS_PER_THREAD);
+  job->chunk_size = (num_items + job->num_chunks-1)/job->num_chunks;
+  job->num_chunks = (num_items + job->chunk_size-1)/job->chunk_size;
+  g_mutex_init(&(job->mutex));
+  g_cond_init(&(job->cond));
+
+  num_helpers = MIN(num_threads-1, job->num_chunks-1);
+  job->ref_count = num_helpers+1;
+  for (i=0; i<num_helpers; i++)
+    g_thread_pool_push(pool, job, NULL);
+
+  job_run_chunks(job);
+
+  /* wait for any chunks still being worked on by the other threads */
+  g_mutex_lock(&(job->mutex));
+  while (job->chunks_done < job->num_chunks)
+    g_cond_wait(&(job->cond), &(job->mutex));
+  g_mutex_unlock(&(job->mutex));
+
+  job_unref(job);
+
+  return;
+}
@@ -0,0 +1,51 @@
+/* amitk_parallel.h
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#ifndef __AMITK_PARALLEL_H__
+#define __AMITK_PARALLEL_H__
+
+/* header files that are always needed with this file */
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* upper limit on the number of threads we'll use, no matter what the machine has */
+#define AMITK_PARALLEL_MAX_THREADS 64
+
+/* processes items [start, end).  Called from multiple threads at once,
+   so it should only write to memory owned by the items it is given */
+typedef void (*AmitkParallelFunc) (const gint start, const gint end, gpointer data);
+
+/* external functions */
+void amitk_parallel_set_max_threads(const gint max_threads);
+gint amitk_parallel_get_max_threads(void);
+gint amitk_parallel_get_num_threads(void);
+void amitk_parallel_for            (const gint num_items,
+				    AmitkParallelFunc func,
+				    gpointer data);
+
+G_END_DECLS
+
+#endif /* __AMITK_PARALLEL_H__ */
@@ -230,6 +230,12 @@ SQRT_FLT_EPSILON   3.4526698300124393e-04
 							 ((vox).y = (amide_intpoint_t) ((real).y/(vox_size).y)), \
 							 ((vox).z = (amide_intpoint_t) ((real).z/(vox_size).z)))
 
+/* a version of the above for points that are already in voxel units
+   (i.e. have already been divided by the voxel size) */
+#define VOXEL_UNITS_TO_VOXEL_COORDS_ONLY(units, vox) (((vox).x = (amide_intpoint_t) (units).x), \
+						      ((vox).y = (amide_intpoint_t) (units).y), \
+						      ((vox).z = (amide_intpoint_t) (units).z))
+
 
 /* corner of the voxel in real coordinates */
 #define VOXEL_CORNER(vox, vox_size, corner) (((corner).x = (((amide_real_t) (vox).x)) * (vox_size).x), \
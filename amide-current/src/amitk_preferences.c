@@ -32,6 +32,8 @@
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
 #include "amitk_data_set.h"
+#include "amitk_parallel.h"
+#include "amitk_slice_cache.h"
 
 #define GCONF_AMIDE_ROI "ROI"
 #define GCONF_AMIDE_CANVAS "CANVAS"
@@ -166,6 +168,26 @@ static void preferences_init (AmitkPreferences * preferences) {
   preferences->default_directory = 
     amide_gconf_get_string_with_default(GCONF_AMIDE_MISC,"DefaultDirectory", AMITK_PREFERENCES_DEFAULT_DEFAULT_DIRECTORY);
 
+  preferences->max_threads = 
+    amide_gconf_get_int_with_default(GCONF_AMIDE_MISC,"MaxThreads", AMITK_PREFERENCES_DEFAULT_MAX_THREADS);
+  preferences->max_threads = CLAMP(preferences->max_threads, 0, AMITK_PARALLEL_MAX_THREADS);
+  amitk_parallel_set_max_threads(preferences->max_threads);
+
+  preferences->slice_cache_size = 
+    amide_gconf_get_int_with_default(GCONF_AMIDE_MISC,"SliceCacheSize", AMITK_PREFERENCES_DEFAULT_SLICE_CACHE_SIZE);
+  preferences->slice_cache_size = CLAMP(preferences->slice_cache_size, 1, AMITK_SLICE_CACHE_MAX_MAX_SIZE);
+  amitk_slice_cache_set_max_size(amitk_slice_cache_get_default(), 
+				 ((gsize) preferences->slice_cache_size) << 20);
+
+  /* an empty string is stored when going back to the default directory */
+  preferences->dicom_index_directory = 
+    amide_gconf_get_string_with_default(GCONF_AMIDE_MISC,"DicomIndexDirectory", AMITK_PREFERENCES_DEFAULT_DICOM_INDEX_DIRECTORY);
+  if (preferences->dicom_index_directory != NULL)
+    if (preferences->dicom_index_directory[0] == '\0') {
+      g_free(preferences->dicom_index_directory);
+      preferences->dicom_index_directory = NULL;
+    }
+
   for (i_modality=0; i_modality<AMITK_MODALITY_NUM; i_modality++) {
     temp_str = g_strdup_printf("DefaultColorTable%s", amitk_modality_get_name(i_modality));
     preferences->color_table[i_modality] = 
@@ -191,7 +213,12 @@ static void preferences_init (AmitkPreferences * preferences) {
 
 static void preferences_finalize (GObject *object) {
 
-  //  AmitkPreferences * preferences = AMITK_PREFERENCES(object);
+  AmitkPreferences * preferences = AMITK_PREFERENCES(object);
+
+  if (preferences->dicom_index_directory != NULL) {
+    g_free(preferences->dicom_index_directory);
+    preferences->dicom_index_directory = NULL;
+  }
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -398,6 +425,77 @@ void amitk_preferences_set_default_directory(AmitkPreferences * preferences, con
   return;
 }
 
+/* 0 means use as many threads as we have processors */
+void amitk_preferences_set_max_threads(AmitkPreferences * preferences, const gint max_threads) {
+
+  gint new_value;
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+  new_value = CLAMP(max_threads, 0, AMITK_PARALLEL_MAX_THREADS);
+
+  if (AMITK_PREFERENCES_MAX_THREADS(preferences) != new_value) {
+    preferences->max_threads = new_value;
+    amitk_parallel_set_max_threads(new_value);
+    amide_gconf_set_int(GCONF_AMIDE_MISC,"MaxThreads",new_value);
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  }
+  return;
+}
+
+/* size is in megabytes, the cache is shared by everything in the process */
+void amitk_preferences_set_slice_cache_size(AmitkPreferences * preferences, const gint slice_cache_size) {
+
+  gint new_value;
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+  new_value = CLAMP(slice_cache_size, 1, AMITK_SLICE_CACHE_MAX_MAX_SIZE);
+
+  if (AMITK_PREFERENCES_SLICE_CACHE_SIZE(preferences) != new_value) {
+    preferences->slice_cache_size = new_value;
+    amitk_slice_cache_set_max_size(amitk_slice_cache_get_default(), ((gsize) new_value) << 20);
+    amide_gconf_set_int(GCONF_AMIDE_MISC,"SliceCacheSize",new_value);
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  }
+  return;
+}
+
+/* NULL, or the default directory, means use the default directory */
+void amitk_preferences_set_dicom_index_directory(AmitkPreferences * preferences, const gchar * new_directory) {
+
+  gchar * default_directory;
+  gchar * directory=NULL;
+
+  g_return_if_fail(AMITK_IS_PREFERENCES(preferences));
+
+  default_directory = amitk_preferences_get_dicom_index_directory(NULL);
+  if (new_directory != NULL)
+    if (strcmp(new_directory, default_directory) != 0)
+      directory = g_strdup(new_directory);
+  g_free(default_directory);
+
+  if (g_strcmp0(AMITK_PREFERENCES_DICOM_INDEX_DIRECTORY(preferences), directory) != 0) {
+    if (preferences->dicom_index_directory != NULL)
+      g_free(preferences->dicom_index_directory);
+    preferences->dicom_index_directory = directory;
+    amide_gconf_set_string(GCONF_AMIDE_MISC,"DicomIndexDirectory", (directory != NULL) ? directory : "");
+    g_signal_emit(G_OBJECT(preferences), preferences_signals[MISC_PREFERENCES_CHANGED], 0);
+  } else if (directory != NULL) {
+    g_free(directory);
+  }
+  return;
+}
+
+/* returns the directory DICOM header indexes get written to, needs to be free'd.
+   preferences can be NULL, in which case the default directory is returned */
+gchar * amitk_preferences_get_dicom_index_directory(AmitkPreferences * preferences) {
+
+  if (preferences != NULL)
+    if (AMITK_PREFERENCES_DICOM_INDEX_DIRECTORY(preferences) != NULL)
+      return g_strdup(AMITK_PREFERENCES_DICOM_INDEX_DIRECTORY(preferences));
+
+  return g_build_filename(g_get_user_cache_dir(), PACKAGE, "dicom", NULL);
+}
+
 void amitk_preferences_set_color_table(AmitkPreferences * preferences,
 				       AmitkModality modality,
 				       AmitkColorTable color_table) {
@@ -45,6 +45,9 @@ G_BEGIN_DECLS
 #define AMITK_PREFERENCES_PROMPT_FOR_SAVE_ON_EXIT(object) (AMITK_PREFERENCES(object)->prompt_for_save_on_exit)
 #define AMITK_PREFERENCES_WHICH_DEFAULT_DIRECTORY(object) (AMITK_PREFERENCES(object)->which_default_directory)
 #define AMITK_PREFERENCES_DEFAULT_DIRECTORY(object)       (AMITK_PREFERENCES(object)->default_directory)
+#define AMITK_PREFERENCES_MAX_THREADS(object)             (AMITK_PREFERENCES(object)->max_threads)
+#define AMITK_PREFERENCES_SLICE_CACHE_SIZE(object)        (AMITK_PREFERENCES(object)->slice_cache_size)
+#define AMITK_PREFERENCES_DICOM_INDEX_DIRECTORY(object)   (AMITK_PREFERENCES(object)->dicom_index_directory)
 
 #define AMITK_PREFERENCES_CANVAS_ROI_WIDTH(pref)                (AMITK_PREFERENCES(pref)->canvas_roi_width)
 #ifdef AMIDE_LIBGNOMECANVAS_AA
@@ -85,6 +88,9 @@ typedef enum {
 #define AMITK_PREFERENCES_DEFAULT_SAVE_XIF_AS_DIRECTORY FALSE
 #define AMITK_PREFERENCES_DEFAULT_WHICH_DEFAULT_DIRECTORY AMITK_WHICH_DEFAULT_DIRECTORY_NONE
 #define AMITK_PREFERENCES_DEFAULT_DEFAULT_DIRECTORY NULL
+#define AMITK_PREFERENCES_DEFAULT_MAX_THREADS 0
+#define AMITK_PREFERENCES_DEFAULT_SLICE_CACHE_SIZE 128
+#define AMITK_PREFERENCES_DEFAULT_DICOM_INDEX_DIRECTORY NULL
 #define AMITK_PREFERENCES_DEFAULT_THRESHOLD_STYLE AMITK_THRESHOLD_STYLE_MIN_MAX
 
 #define AMITK_PREFERENCES_MIN_ROI_WIDTH 1
@@ -110,6 +116,11 @@ struct _AmitkPreferences {
   AmitkWhichDefaultDirectory which_default_directory;
   gchar * default_directory;
 
+  /* performance preferences */
+  gint max_threads; /* 0 is one per processor */
+  gint slice_cache_size; /* in MB */
+  gchar * dicom_index_directory; /* NULL is a directory in the user's cache dir */
+
   /* canvas preferences -> study preferences */
   gint canvas_roi_width;
   gdouble canvas_roi_transparency;
@@ -176,6 +187,13 @@ void                amitk_preferences_set_which_default_directory(AmitkPreferenc
 								  const AmitkWhichDefaultDirectory which_default_directory);
 void                amitk_preferences_set_default_directory      (AmitkPreferences * preferences,
 								  const gchar * directory);
+void                amitk_preferences_set_max_threads            (AmitkPreferences * preferences,
+								  const gint max_threads);
+void                amitk_preferences_set_slice_cache_size       (AmitkPreferences * preferences,
+								  const gint slice_cache_size);
+void                amitk_preferences_set_dicom_index_directory  (AmitkPreferences * preferences,
+								  const gchar * directory);
+gchar *             amitk_preferences_get_dicom_index_directory  (AmitkPreferences * preferences);
 void                amitk_preferences_set_color_table            (AmitkPreferences * preferences,
 								  AmitkModality modality,
 								  AmitkColorTable color_table);
@@ -34,6 +34,7 @@
 static void dialog_class_init (AmitkProgressDialogClass *klass);
 static void dialog_init (AmitkProgressDialog *progress_dialog);
 static void dialog_response(GtkDialog * dialog, gint response_id);
+static void dialog_show_fraction(AmitkProgressDialog * dialog, gdouble fraction);
 
 static GtkDialogClass *progress_dialog_parent_class;
 
@@ -129,7 +130,7 @@ void amitk_progress_dialog_set_text(AmitkProgressDialog * dialog, gchar * messag
   gtk_label_set_text(GTK_LABEL(dialog->message_label), message);
 }
 
-gboolean amitk_progress_dialog_set_fraction(AmitkProgressDialog * dialog, gdouble fraction) {
+static void dialog_show_fraction(AmitkProgressDialog * dialog, gdouble fraction) {
 
   if (fraction > 1.0) {
     if (GTK_WIDGET_VISIBLE(dialog))
@@ -151,12 +152,38 @@ gboolean amitk_progress_dialog_set_fraction(AmitkProgressDialog * dialog, gdoubl
 
   }
 
+  return;
+}
+
+gboolean amitk_progress_dialog_set_fraction(AmitkProgressDialog * dialog, gdouble fraction) {
+
+  dialog_show_fraction(dialog, fraction);
+
   /* let spin while events are pending, this allows cancel to happen */
   while (gtk_events_pending()) gtk_main_iteration();
 
   return AMITK_PROGRESS_DIALOG_CAN_CONTINUE(dialog);
 }
 
+/* an AmitkJobProgressFunc, with the dialog as the data.  As this is called from
+   the main loop, there's no need to spin the main loop like amitk_progress_dialog_update */
+void amitk_progress_dialog_job_progress(AmitkJob * job, const gchar * message, 
+					const gdouble fraction, gpointer dialog_pointer) {
+
+  AmitkProgressDialog * dialog = AMITK_PROGRESS_DIALOG(dialog_pointer);
+
+  if (message != NULL)
+    gtk_label_set_text(GTK_LABEL(dialog->message_label), message);
+
+  if ((fraction >= 0.0) || (fraction < -0.5))
+    dialog_show_fraction(dialog, fraction);
+
+  if (!dialog->can_continue)
+    amitk_job_cancel(job);
+
+  return;
+}
+
 GtkWidget* amitk_progress_dialog_new (GtkWindow * parent)
 {
   AmitkProgressDialog *dialog;
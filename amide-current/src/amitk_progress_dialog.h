@@ -30,6 +30,7 @@
 
 /* includes we always need with this widget */
 #include <gtk/gtk.h>
+#include "amitk_job.h"
 
 G_BEGIN_DECLS
 
@@ -70,6 +71,10 @@ void       amitk_progress_dialog_set_text          (AmitkProgressDialog * dialog
 						    gchar * message);
 gboolean   amitk_progress_dialog_set_fraction      (AmitkProgressDialog * dialog, 
 						    gdouble fraction);
+void       amitk_progress_dialog_job_progress      (AmitkJob * job,
+						    const gchar * message,
+						    const gdouble fraction,
+						    gpointer dialog);
 GtkWidget* amitk_progress_dialog_new               (GtkWindow * parent);
 
 G_END_DECLS
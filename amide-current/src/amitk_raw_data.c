@@ -27,6 +27,11 @@
 
 #include <sys/stat.h>
 #include <stdio.h>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#include <unistd.h>
+#define RAW_DATA_USE_MMAP
+#endif
 
 #include "amitk_raw_data.h"
 #include "amitk_marshal.h"
@@ -34,6 +39,12 @@
 
 #define DATA_CONTENT(data, dim, voxel) ((data)[(voxel).x + (dim).x*(voxel).y])
 
+/* smaller than this, it's not worth having a mapping hang around */
+#define MMAP_MIN_SIZE 0x100000
+
+/* in bytes, per raw data set */
+static gsize max_resident_size = ((gsize) AMITK_RAW_DATA_DEFAULT_MAX_RESIDENT_SIZE) << 20;
+
 /* external variables */
 guint amitk_format_sizes[] = {
   sizeof(amitk_format_UBYTE_t),
@@ -213,6 +224,14 @@ static void raw_data_init (AmitkRawData * raw_data) {
   raw_data->dim = zero_voxel;
   raw_data->data = NULL;
   raw_data->format = AMITK_FORMAT_DOUBLE;
+  raw_data->mapping = NULL;
+  raw_data->mapping_size = 0;
+
+  g_mutex_init(&(raw_data->paging_mutex));
+  g_queue_init(&(raw_data->resident_frames));
+  raw_data->frame_resident = NULL;
+  raw_data->page_ins = 0;
+  raw_data->page_outs = 0;
 
   return;
 }
@@ -222,6 +241,23 @@ static void raw_data_finalize (GObject *object) {
 
   AmitkRawData * raw_data = AMITK_RAW_DATA(object);
 
+#ifdef RAW_DATA_USE_MMAP
+  if (raw_data->mapping != NULL) {
+#ifdef AMIDE_DEBUG
+    g_print("\tmapped raw data had %" G_GUINT64_FORMAT " frame page ins, %" G_GUINT64_FORMAT " page outs\n",
+	    raw_data->page_ins, raw_data->page_outs);
+#endif
+    munmap(raw_data->mapping, raw_data->mapping_size);
+    raw_data->mapping = NULL;
+    raw_data->data = NULL;
+  }
+#endif
+
+  g_queue_clear(&(raw_data->resident_frames));
+  g_free(raw_data->frame_resident);
+  raw_data->frame_resident = NULL;
+  g_mutex_clear(&(raw_data->paging_mutex));
+
   if (raw_data->data != NULL) {
 #ifdef AMIDE_DEBUG
     //g_print("\tfreeing raw data\n");
@@ -324,6 +360,101 @@ AmitkRawData* amitk_raw_data_new_with_data0(AmitkFormat format, AmitkVoxel dim)
 
 
 
+#ifdef RAW_DATA_USE_MMAP
+/* points the raw data at a mapping of the file, for when the data's on disk
+   exactly as we'd have it in memory.  The mapping is private, so pages only
+   get read in when touched, and anything that modifies the data gets its
+   own copy of the page rather than writing back to the file.  Saving a
+   study unlinks the old files before writing out the new ones, so this
+   stays valid even when a study gets saved over the file it was read from.
+
+   returns FALSE if the file couldn't be mapped */
+static gboolean raw_data_map_file(AmitkRawData * raw_data, FILE * file_pointer, const long file_offset) {
+
+  struct stat file_info;
+  long page_size;
+  off_t map_offset;
+  gsize num_bytes;
+  gsize mapping_size;
+  gpointer mapping;
+  int fd;
+
+  num_bytes = amitk_raw_data_size_data_mem(raw_data);
+  if (num_bytes < MMAP_MIN_SIZE) return FALSE;
+
+  /* unaligned data is slow, or on some platforms doesn't work at all */
+  if ((file_offset % amitk_format_sizes[raw_data->format]) != 0) return FALSE;
+
+  fd = fileno(file_pointer);
+  if (fstat(fd, &file_info) != 0) return FALSE;
+  if (!S_ISREG(file_info.st_mode)) return FALSE;
+  if (file_info.st_size < file_offset + (off_t) num_bytes) return FALSE;
+
+  /* mappings have to start on a page boundary */
+  page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0) return FALSE;
+  map_offset = file_offset - (file_offset % page_size);
+  mapping_size = num_bytes + (file_offset - map_offset);
+
+  mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, map_offset);
+  if (mapping == MAP_FAILED) return FALSE;
+
+  raw_data->mapping = mapping;
+  raw_data->mapping_size = mapping_size;
+  raw_data->data = ((guchar *) mapping) + (file_offset - map_offset);
+  raw_data->frame_resident = g_new0(gboolean, raw_data->dim.t);
+
+#ifdef AMIDE_DEBUG
+  g_print("\tmapped %zd bytes of raw data from file\n", num_bytes);
+#endif
+
+  return TRUE;
+}
+
+/* tell the kernel we're about to use a frame, or that we're done with it.
+   Pages are only given back if they lie entirely within the frame, so we don't
+   throw out part of a neighbouring frame. Paging out never loses data, pages
+   that have been written to get swapped rather than dropped. */
+static void raw_data_advise_frame(AmitkRawData * raw_data, const amide_intpoint_t frame, 
+				  const gboolean page_in) {
+
+  long system_page_size;
+  guintptr page_size;
+  guintptr frame_size;
+  guintptr start, end;
+  guintptr mapping_start, mapping_end;
+
+  system_page_size = sysconf(_SC_PAGESIZE);
+  if (system_page_size <= 0) return;
+  page_size = system_page_size;
+
+  frame_size = amitk_raw_data_size_data_mem(raw_data)/raw_data->dim.t;
+  start = ((guintptr) raw_data->data) + frame*frame_size;
+  end = start + frame_size;
+  mapping_start = (guintptr) raw_data->mapping;
+  mapping_end = mapping_start + raw_data->mapping_size;
+
+  if (page_in) {
+    start = start - (start % page_size);
+    end = MIN(end, mapping_end);
+    if (end > start)
+      madvise((gpointer) start, end-start, MADV_WILLNEED);
+  } else {
+    start = MAX(start + (page_size - (start % page_size)) % page_size, mapping_start);
+    end = end - (end % page_size);
+    if (end > start) {
+#if defined(MADV_PAGEOUT)
+      madvise((gpointer) start, end-start, MADV_PAGEOUT);
+#elif defined(MADV_COLD)
+      madvise((gpointer) start, end-start, MADV_COLD);
+#endif
+    }
+  }
+
+  return;
+}
+#endif
+
 /* reads the contents of a raw data file into an amide raw data structure,
 
    notes: 
@@ -331,6 +462,8 @@ AmitkRawData* amitk_raw_data_new_with_data0(AmitkFormat format, AmitkVoxel dim)
    1. file_offset is bytes for a binary file, lines for an ascii file
    2. either file_name, of existing_file need to be specified.  
       If existing_file is not being used, it must be NULL
+   3. if the file's in our native in-memory format, it gets memory mapped
+      instead of read in, where supported
 */
 AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name, 
 					      FILE * existing_file,
@@ -365,11 +498,14 @@ AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name,
   total_planes = dim.z*dim.t*dim.g;
   divider = ((total_planes/AMITK_UPDATE_DIVIDER) < 1) ? 1 : (total_planes/AMITK_UPDATE_DIVIDER);
 
-  raw_data = amitk_raw_data_new_with_data(amitk_raw_format_to_format(raw_format), dim);
+  /* the data memory gets allocated below, if we don't map the file */
+  raw_data = amitk_raw_data_new();
   if (raw_data == NULL) {
     g_warning(_("couldn't allocate memory space for the raw data set structure"));
     goto error_condition;
   }
+  raw_data->format = amitk_raw_format_to_format(raw_format);
+  raw_data->dim = dim;
 
   /* open the raw data file for reading */
   if (existing_file == NULL) {
@@ -403,6 +539,19 @@ AmitkRawData * amitk_raw_data_import_raw_file(const gchar * file_name,
       goto error_condition;
     }
   }
+
+#ifdef RAW_DATA_USE_MMAP
+  if ((raw_format != AMITK_RAW_FORMAT_ASCII_8_NE) &&
+      (raw_format == amitk_format_to_raw_format(raw_data->format)))
+    if (raw_data_map_file(raw_data, file_pointer, file_offset))
+      goto exit_condition;
+#endif
+
+  raw_data->data = amitk_raw_data_get_data_mem(raw_data);
+  if (raw_data->data == NULL) {
+    g_warning(_("couldn't allocate memory space for the raw data set structure"));
+    goto error_condition;
+  }
     
   /* read in the contents of the file */
   if (raw_format != AMITK_RAW_FORMAT_ASCII_8_NE) { /* ASCII handled in the loop below */
@@ -1047,6 +1196,66 @@ gpointer amitk_raw_data_get_pointer(const AmitkRawData * rd, const AmitkVoxel i)
 
 
 
+/* note that frames start_frame to end_frame are about to be used.  For data
+   that's memory mapped, the most recently used frames (up to the resident
+   size) are kept paged in, and the rest are given back.  Does nothing
+   for data that's in memory */
+void amitk_raw_data_page_in_frames(AmitkRawData * rd,
+				   const amide_intpoint_t start_frame,
+				   const amide_intpoint_t end_frame) {
+
+#ifdef RAW_DATA_USE_MMAP
+  amide_intpoint_t i_frame, first, last;
+  gsize frame_size;
+  guint max_frames;
+
+  g_return_if_fail(AMITK_IS_RAW_DATA(rd));
+
+  if (rd->mapping == NULL) return;
+
+  first = MAX(start_frame, 0);
+  last = MIN(end_frame, rd->dim.t-1);
+  if (last < first) return;
+
+  frame_size = amitk_raw_data_size_data_mem(rd)/rd->dim.t;
+  max_frames = MAX(max_resident_size/MAX(frame_size,1), (gsize) (last-first+1));
+
+  g_mutex_lock(&(rd->paging_mutex));
+
+  for (i_frame = first; i_frame <= last; i_frame++) {
+    if (rd->frame_resident[i_frame]) {
+      g_queue_remove(&(rd->resident_frames), GINT_TO_POINTER(i_frame));
+    } else {
+      rd->frame_resident[i_frame] = TRUE;
+      rd->page_ins++;
+      raw_data_advise_frame(rd, i_frame, TRUE);
+    }
+    g_queue_push_head(&(rd->resident_frames), GINT_TO_POINTER(i_frame));
+  }
+
+  while (g_queue_get_length(&(rd->resident_frames)) > max_frames) {
+    i_frame = GPOINTER_TO_INT(g_queue_pop_tail(&(rd->resident_frames)));
+    rd->frame_resident[i_frame] = FALSE;
+    rd->page_outs++;
+    raw_data_advise_frame(rd, i_frame, FALSE);
+  }
+
+  g_mutex_unlock(&(rd->paging_mutex));
+#endif
+
+  return;
+}
+
+/* max_size is in bytes */
+void amitk_raw_data_set_max_resident_size(const gsize max_size) {
+  max_resident_size = max_size;
+  return;
+}
+
+gsize amitk_raw_data_get_max_resident_size(void) {
+  return max_resident_size;
+}
+
 /* take in one of the raw data formats, and return the corresponding data format */
 AmitkFormat amitk_raw_format_to_format(AmitkRawFormat raw_format) {
 
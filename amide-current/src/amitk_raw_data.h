@@ -47,6 +47,12 @@ G_BEGIN_DECLS
 #define AMITK_RAW_DATA_DIM_Z(rd)          (AMITK_RAW_DATA(rd)->dim.z)
 #define AMITK_RAW_DATA_DIM_G(rd)          (AMITK_RAW_DATA(rd)->dim.g)
 #define AMITK_RAW_DATA_DIM_T(rd)          (AMITK_RAW_DATA(rd)->dim.t)
+#define AMITK_RAW_DATA_MAPPED(rd)         (AMITK_RAW_DATA(rd)->mapping != NULL)
+#define AMITK_RAW_DATA_PAGE_INS(rd)       (AMITK_RAW_DATA(rd)->page_ins)
+#define AMITK_RAW_DATA_PAGE_OUTS(rd)      (AMITK_RAW_DATA(rd)->page_outs)
+
+/* how much of a mapped data set's frames we try to keep resident, in MB */
+#define AMITK_RAW_DATA_DEFAULT_MAX_RESIDENT_SIZE 2048
 
 /* glib doesn't define these for PDP */
 #ifdef G_BIG_ENDIAN
@@ -121,6 +127,17 @@ struct _AmitkRawData {
   AmitkVoxel dim;
   gpointer data;
   AmitkFormat format;
+
+  /* if non-NULL, data points into this (private) mapping of the file it was read from */
+  gpointer mapping;
+  gsize mapping_size;
+
+  /* which frames of the mapping are resident, see amitk_raw_data_page_in_frames */
+  GMutex paging_mutex;
+  GQueue resident_frames; /* most recently used first */
+  gboolean * frame_resident;
+  guint64 page_ins;
+  guint64 page_outs;
   
 };
 
@@ -184,6 +201,11 @@ amide_data_t    amitk_raw_data_get_value            (const AmitkRawData * rd,
 						     const AmitkVoxel i);
 gpointer        amitk_raw_data_get_pointer          (const AmitkRawData * rd,
 						     const AmitkVoxel i);
+void            amitk_raw_data_page_in_frames       (AmitkRawData * rd,
+						     const amide_intpoint_t start_frame,
+						     const amide_intpoint_t end_frame);
+void            amitk_raw_data_set_max_resident_size(const gsize max_size);
+gsize           amitk_raw_data_get_max_resident_size(void);
 
 AmitkFormat    amitk_raw_format_to_format(AmitkRawFormat raw_format);
 AmitkRawFormat amitk_format_to_raw_format(AmitkFormat data_format);
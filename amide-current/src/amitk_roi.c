@@ -28,6 +28,10 @@
 #include "amitk_roi.h"
 #include "amitk_marshal.h"
 #include "amitk_type_builtins.h"
+#include <string.h>
+#ifdef AMIDE_DEBUG
+#include <sys/time.h>
+#endif
 
 /* variable type function declarations */
 #include "amitk_roi_ELLIPSOID.h"
@@ -70,6 +74,10 @@ enum {
 static void          roi_class_init          (AmitkRoiClass *klass);
 static void          roi_init                (AmitkRoi      *roi);
 static void          roi_finalize            (GObject          *object);
+static void          roi_space_changed       (AmitkSpace        *space);
+static void          roi_volume_changed      (AmitkVolume       *volume);
+static void          roi_roi_changed         (AmitkRoi          *roi);
+static void          roi_invalidate_cache    (AmitkRoi          *roi);
 static void          roi_scale               (AmitkSpace        *space,
 					      AmitkPoint        *ref_point,
 					      AmitkPoint        *scaling);
@@ -129,6 +137,7 @@ static void roi_class_init (AmitkRoiClass * class) {
   parent_class = g_type_class_peek_parent(class);
 
   space_class->space_scale = roi_scale;
+  space_class->space_changed = roi_space_changed;
 
   object_class->object_copy = roi_copy;
   object_class->object_copy_in_place = roi_copy_in_place;
@@ -136,6 +145,9 @@ static void roi_class_init (AmitkRoiClass * class) {
   object_class->object_read_xml = roi_read_xml;
 
   volume_class->volume_get_center = roi_get_center;
+  volume_class->volume_changed = roi_volume_changed;
+
+  class->roi_changed = roi_roi_changed;
 
   gobject_class->finalize = roi_finalize;
 
@@ -163,13 +175,16 @@ static void roi_init (AmitkRoi * roi) {
   roi->color = amitk_color_table_uint32_to_rgba(AMITK_OBJECT_DEFAULT_COLOR);
 
   roi->voxel_size = zero_point;
-  roi->map_data = NULL;
+  roi->map_runs = NULL;
   roi->center_of_mass_calculated=FALSE;
   roi->center_of_mass=zero_point;
 
   roi->isocontour_min_value = 0.0;
   roi->isocontour_max_value = 0.0;
   roi->isocontour_range = AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN;
+
+  g_mutex_init(&(roi->masks_mutex));
+  roi->masks = NULL;
 }
 
 
@@ -177,14 +192,55 @@ static void roi_finalize (GObject *object)
 {
   AmitkRoi * roi = AMITK_ROI(object);
 
-  if (roi->map_data != NULL) {
-    g_object_unref(roi->map_data);
-    roi->map_data = NULL;
-  }
+  amitk_roi_runs_unref(roi->map_runs);
+  roi->map_runs = NULL;
+
+  roi_invalidate_cache(roi);
+  g_mutex_clear(&(roi->masks_mutex));
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+/* anything that moves or reshapes the roi, or changes its map, makes the masks invalid */
+static void roi_space_changed(AmitkSpace * space) {
+
+  g_return_if_fail(AMITK_IS_ROI(space));
+  roi_invalidate_cache(AMITK_ROI(space));
+
+  if (AMITK_SPACE_CLASS(parent_class)->space_changed)
+    AMITK_SPACE_CLASS(parent_class)->space_changed (space);
+}
+
+static void roi_volume_changed(AmitkVolume * volume) {
+
+  g_return_if_fail(AMITK_IS_ROI(volume));
+  roi_invalidate_cache(AMITK_ROI(volume));
+
+  if (parent_class->volume_changed)
+    parent_class->volume_changed (volume);
+}
+
+static void roi_roi_changed(AmitkRoi * roi) {
+  roi_invalidate_cache(roi);
+}
+
+static void roi_invalidate_cache(AmitkRoi * roi) {
+
+  GList * masks;
+
+  g_mutex_lock(&(roi->masks_mutex));
+  masks = roi->masks;
+  roi->masks = NULL;
+  g_mutex_unlock(&(roi->masks_mutex));
+
+  while (masks != NULL) {
+    amitk_roi_mask_unref(masks->data);
+    masks = g_list_delete_link(masks, masks);
+  }
+
+  return;
+}
+
 static void roi_scale(AmitkSpace *space, AmitkPoint *ref_point, AmitkPoint *scaling) {
 
   AmitkRoi * roi;
@@ -201,9 +257,9 @@ static void roi_scale(AmitkSpace *space, AmitkPoint *ref_point, AmitkPoint *scal
     if (AMITK_ROI_TYPE_ISOCONTOUR(roi) || AMITK_ROI_TYPE_FREEHAND(roi)) {
 
       voxel_size = AMITK_VOLUME_CORNER(roi);
-      voxel_size.x /= roi->map_data->dim.x;
-      voxel_size.y /= roi->map_data->dim.y;
-      voxel_size.z /= roi->map_data->dim.z;
+      voxel_size.x /= roi->map_runs->dim.x;
+      voxel_size.y /= roi->map_runs->dim.y;
+      voxel_size.z /= roi->map_runs->dim.z;
       roi_set_voxel_size(roi, voxel_size);
     }
   }
@@ -222,7 +278,8 @@ static AmitkObject * roi_copy (const AmitkObject * object) {
   return AMITK_OBJECT(copy);
 }
 
-/* doesn't copy the data set used by isocontours and freehands, just adds a reference... */
+/* doesn't copy the map of isocontours and freehands, just adds a reference.
+   Editing the map builds new runs, so the copies don't see each other's edits */
 static void roi_copy_in_place (AmitkObject * dest_object, const AmitkObject * src_object) {
 
   AmitkRoi * src_roi;
@@ -239,10 +296,10 @@ static void roi_copy_in_place (AmitkObject * dest_object, const AmitkObject * sr
   dest_roi->specify_color = AMITK_ROI_SPECIFY_COLOR(src_roi);
   dest_roi->color = AMITK_ROI_COLOR(src_roi);
 
-  if (src_roi->map_data != NULL) {
-    if (dest_roi->map_data != NULL)
-      g_object_unref(dest_roi->map_data);
-    dest_roi->map_data = g_object_ref(src_roi->map_data);
+  if ((src_roi->map_runs != NULL) && (src_roi->map_runs != dest_roi->map_runs)) {
+    g_atomic_int_inc(&(src_roi->map_runs->ref_count));
+    amitk_roi_set_map_runs(dest_roi, src_roi->map_runs);
+    roi_invalidate_cache(dest_roi);
   }
 
   dest_roi->center_of_mass_calculated = src_roi->center_of_mass_calculated;
@@ -257,12 +314,137 @@ static void roi_copy_in_place (AmitkObject * dest_object, const AmitkObject * sr
 }
 
 
+/* in xif files, the map of an isocontour/freehand roi is stored as (value,
+   length) pairs running through the whole map in order, zeros included.
+   The pairs are laid out in rows of MAP_RUNS_WIDTH entries of a USHORT
+   raw data, the last row being padded with zero length runs.  amide 1.0.5
+   and earlier can't read these, and load the roi as undrawn, so with
+   AMIDE_WRITE_DENSE_ROI_MAPS (configure --enable-dense-roi-maps) the whole
+   map is written out instead, as it used to be */
+#define MAP_RUNS_WIDTH 4096
+
+#ifndef AMIDE_WRITE_DENSE_ROI_MAPS
+static AmitkRawData * map_runs_encode(const AmitkRoiRuns * runs, guint * pnum_entries) {
+
+  AmitkRawData * encoded;
+  amitk_format_USHORT_t * entries;
+  const AmitkRoiRun * run;
+  AmitkVoxel dim;
+  guint num_entries, i_entry, row, i_run;
+  amide_intpoint_t x;
+
+  /* count how many entries we need */
+  num_entries = 0;
+  for (row=0; row < AMITK_ROI_RUNS_NUM_ROWS(runs); row++) {
+    x = 0;
+    for (i_run = runs->row_start[row]; i_run < runs->row_start[row+1]; i_run++) {
+      run = &(runs->runs[i_run]);
+      if (run->x > x) num_entries += 2;
+      num_entries += 2;
+      x = run->x+run->length;
+    }
+    if (x < runs->dim.x) num_entries += 2;
+  }
+
+  dim = one_voxel;
+  dim.x = MAP_RUNS_WIDTH;
+  dim.y = (num_entries+MAP_RUNS_WIDTH-1)/MAP_RUNS_WIDTH;
+  if ((encoded = amitk_raw_data_new_with_data0(AMITK_FORMAT_USHORT, dim)) == NULL)
+    return NULL;
+  entries = AMITK_RAW_DATA_USHORT_POINTER(encoded, zero_voxel);
+
+  i_entry = 0;
+  for (row=0; row < AMITK_ROI_RUNS_NUM_ROWS(runs); row++) {
+    x = 0;
+    for (i_run = runs->row_start[row]; i_run < runs->row_start[row+1]; i_run++) {
+      run = &(runs->runs[i_run]);
+      if (run->x > x) {
+	entries[i_entry++] = 0;
+	entries[i_entry++] = run->x-x;
+      }
+      entries[i_entry++] = run->value;
+      entries[i_entry++] = run->length;
+      x = run->x+run->length;
+    }
+    if (x < runs->dim.x) {
+      entries[i_entry++] = 0;
+      entries[i_entry++] = runs->dim.x-x;
+    }
+  }
+
+  *pnum_entries = num_entries;
+  return encoded;
+}
+#endif
+
+static AmitkRoiRuns * map_runs_decode(const AmitkRawData * encoded, const AmitkVoxel dim,
+				      const guint num_entries, gchar ** perror_buf) {
+
+  AmitkRoiRuns * runs;
+  amitk_format_USHORT_t * entries;
+  guint num_rows, row, i_entry, remaining=0;
+  amide_intpoint_t x, length;
+
+  if (AMITK_RAW_DATA_FORMAT(encoded) != AMITK_FORMAT_USHORT) {
+    amitk_append_str_with_newline(perror_buf, _("roi map runs are in the wrong format"));
+    return NULL;
+  }
+  if (num_entries > amitk_raw_data_num_voxels(encoded)) {
+    amitk_append_str_with_newline(perror_buf, _("roi map runs are missing entries"));
+    return NULL;
+  }
+  if ((dim.x <= 0) || (dim.y <= 0) || (dim.z <= 0)) {
+    amitk_append_str_with_newline(perror_buf, _("roi map runs don't match the map's dimensions"));
+    return NULL;
+  }
+
+  entries = AMITK_RAW_DATA_USHORT_POINTER(encoded, zero_voxel);
+  runs = amitk_roi_runs_alloc(dim);
+  num_rows = AMITK_ROI_RUNS_NUM_ROWS(runs);
+
+  /* the pairs can run on from one row into the next */
+  row = 0;
+  x = 0;
+  amitk_roi_runs_row_begin(runs, row);
+  for (i_entry=0; i_entry+1 < num_entries; i_entry += 2) {
+    remaining = entries[i_entry+1];
+    while ((remaining > 0) && (row < num_rows)) {
+      length = MIN(remaining, dim.x-x);
+      amitk_roi_runs_append(runs, row, x, length, entries[i_entry]);
+      x += length;
+      remaining -= length;
+      if (x == dim.x) {
+	x = 0;
+	row++;
+	if (row < num_rows)
+	  amitk_roi_runs_row_begin(runs, row);
+      }
+    }
+    if (remaining > 0) break;
+  }
+  amitk_roi_runs_finish(runs);
+
+  if ((row != num_rows) || (remaining > 0)) {
+    amitk_append_str_with_newline(perror_buf, _("roi map runs don't match the map's dimensions"));
+    amitk_roi_runs_unref(runs);
+    return NULL;
+  }
+
+  return runs;
+}
+
 static void roi_write_xml (const AmitkObject * object, xmlNodePtr nodes, FILE * study_file) {
 
   AmitkRoi * roi;
   gchar * name;
   gchar * filename;
   guint64 location, size;
+#ifdef AMIDE_WRITE_DENSE_ROI_MAPS
+  AmitkRawData * map;
+#else
+  AmitkRawData * encoded;
+  guint num_entries=0;
+#endif
 
   AMITK_OBJECT_CLASS(parent_class)->object_write_xml(object, nodes, study_file);
 
@@ -278,16 +460,37 @@ static void roi_write_xml (const AmitkObject * object, xmlNodePtr nodes, FILE *
   xml_save_boolean(nodes, "center_of_mass_calculated", AMITK_ROI(roi)->center_of_mass_calculated);
   amitk_point_write_xml(nodes, "center_of_mass", AMITK_ROI(roi)->center_of_mass);
 
-  if (AMITK_ROI_TYPE_ISOCONTOUR(roi) || AMITK_ROI_TYPE_FREEHAND(roi)) {
+  if ((AMITK_ROI_TYPE_ISOCONTOUR(roi) || AMITK_ROI_TYPE_FREEHAND(roi)) && (roi->map_runs != NULL)) {
+#ifdef AMIDE_WRITE_DENSE_ROI_MAPS
+    map = amitk_roi_runs_get_map(roi->map_runs, zero_voxel, zero_voxel, roi->map_runs->dim);
     name = g_strdup_printf("roi_%s_map_data", AMITK_OBJECT_NAME(roi));
-    amitk_raw_data_write_xml(roi->map_data, name, study_file, &filename, &location, &size);
+    amitk_raw_data_write_xml(map, name, study_file, &filename, &location, &size);
     g_free(name);
+    g_object_unref(map);
     if (study_file == NULL) {
       xml_save_string(nodes,"map_file", filename);
       g_free(filename);
     } else {
       xml_save_location_and_size(nodes, "map_location_and_size", location, size);
     }
+#else
+    if ((encoded = map_runs_encode(roi->map_runs, &num_entries)) == NULL) {
+      g_warning(_("couldn't allocate memory space for saving the map of roi %s"), AMITK_OBJECT_NAME(roi));
+    } else {
+      name = g_strdup_printf("roi_%s_map_runs", AMITK_OBJECT_NAME(roi));
+      amitk_raw_data_write_xml(encoded, name, study_file, &filename, &location, &size);
+      g_free(name);
+      g_object_unref(encoded);
+      amitk_voxel_write_xml(nodes, "map_dim", roi->map_runs->dim);
+      xml_save_uint(nodes, "map_runs_entries", num_entries);
+      if (study_file == NULL) {
+	xml_save_string(nodes,"map_runs_file", filename);
+	g_free(filename);
+      } else {
+	xml_save_location_and_size(nodes, "map_runs_location_and_size", location, size);
+      }
+    }
+#endif
   }
 
   /* isocontour specific stuff */
@@ -306,6 +509,8 @@ static gchar * roi_read_xml (AmitkObject * object, xmlNodePtr nodes, FILE * stud
   gchar * temp_string;
   gchar * map_xml_filename=NULL;
   guint64 location, size;
+  AmitkRawData * map=NULL;
+  AmitkRawData * encoded;
 
   error_buf = AMITK_OBJECT_CLASS(parent_class)->object_read_xml(object, nodes, study_file, error_buf);
 
@@ -346,8 +551,25 @@ static gchar * roi_read_xml (AmitkObject * object, xmlNodePtr nodes, FILE * stud
 	map_xml_filename = xml_get_string(nodes, "isocontour_file");
       else
 	xml_get_location_and_size(nodes, "isocontour_location_and_size", &location, &size, &error_buf);
-      roi->map_data = amitk_raw_data_read_xml(map_xml_filename, study_file, location, 
-						size,&error_buf, NULL, NULL);
+      map = amitk_raw_data_read_xml(map_xml_filename, study_file, location, 
+				    size,&error_buf, NULL, NULL);
+
+    } else if (xml_node_exists(nodes, "map_runs_file") ||
+	       xml_node_exists(nodes, "map_runs_location_and_size")) {
+
+      if (study_file == NULL)
+	map_xml_filename = xml_get_string(nodes, "map_runs_file");
+      else
+	xml_get_location_and_size(nodes, "map_runs_location_and_size", &location, &size, &error_buf);
+      encoded = amitk_raw_data_read_xml(map_xml_filename, study_file, location,
+					size,&error_buf, NULL, NULL);
+      if (encoded != NULL) {
+	amitk_roi_set_map_runs(roi, map_runs_decode(encoded,
+						    amitk_voxel_read_xml(nodes, "map_dim", &error_buf),
+						    xml_get_uint(nodes, "map_runs_entries", &error_buf),
+						    &error_buf));
+	g_object_unref(encoded);
+      }
 
       /* if the ROI's never been drawn, it's possible for this not to exist */
     } else if (xml_node_exists(nodes, "map_file") || 
@@ -357,8 +579,14 @@ static gchar * roi_read_xml (AmitkObject * object, xmlNodePtr nodes, FILE * stud
 	map_xml_filename = xml_get_string(nodes, "map_file");
       else
 	xml_get_location_and_size(nodes, "map_location_and_size", &location, &size, &error_buf);
-      roi->map_data = amitk_raw_data_read_xml(map_xml_filename, study_file, location, 
-					      size,&error_buf, NULL, NULL);
+      map = amitk_raw_data_read_xml(map_xml_filename, study_file, location, 
+				    size,&error_buf, NULL, NULL);
+    }
+
+    /* the whole map, as written by older versions */
+    if (map != NULL) {
+      amitk_roi_set_map_runs(roi, amitk_roi_runs_new(map, zero_voxel, AMITK_RAW_DATA_DIM(map)));
+      g_object_unref(map);
     }
 
     if (map_xml_filename != NULL) g_free(map_xml_filename);
@@ -384,7 +612,7 @@ static gchar * roi_read_xml (AmitkObject * object, xmlNodePtr nodes, FILE * stud
 
   /* make sure to mark the roi as undrawn if needed */
   if (AMITK_ROI_TYPE_ISOCONTOUR(roi)) {
-    if (roi->map_data == NULL) 
+    if (roi->map_runs == NULL) 
       AMITK_VOLUME(roi)->valid = FALSE;
   } else {
     if (POINT_EQUAL(AMITK_VOLUME_CORNER(roi), zero_point)) {
@@ -527,7 +755,7 @@ void amitk_roi_set_voxel_size(AmitkRoi * roi, AmitkPoint voxel_size) {
   if (!POINT_EQUAL(AMITK_ROI_VOXEL_SIZE(roi), voxel_size)) {
     old_corner = AMITK_VOLUME_CORNER(roi);
     roi_set_voxel_size(roi, voxel_size);
-    if (roi->map_data != NULL)
+    if (roi->map_runs != NULL)
       amitk_roi_calc_far_corner(roi);
 
     scaling = point_div(AMITK_VOLUME_CORNER(roi), old_corner);
@@ -554,7 +782,7 @@ void amitk_roi_calc_far_corner(AmitkRoi * roi) {
   g_return_if_fail(AMITK_IS_ROI(roi));
   g_return_if_fail(AMITK_ROI_TYPE_ISOCONTOUR(roi) || AMITK_ROI_TYPE_FREEHAND(roi));
 
-  POINT_MULT(roi->map_data->dim, roi->voxel_size, new_point);
+  POINT_MULT(roi->map_runs->dim, roi->voxel_size, new_point);
   amitk_volume_set_corner(AMITK_VOLUME(roi), new_point);
 
   return;
@@ -641,6 +869,7 @@ void amitk_roi_set_isocontour(AmitkRoi * roi, AmitkDataSet * ds, AmitkVoxel star
     break;
   }
   roi->center_of_mass_calculated = FALSE;
+  roi_invalidate_cache(roi); /* before any handlers get to see the new map */
   
   g_signal_emit(G_OBJECT(roi), roi_signals[ROI_CHANGED], 0);
 
@@ -654,16 +883,16 @@ void amitk_roi_manipulate_area(AmitkRoi * roi, gboolean erase, AmitkVoxel voxel,
   g_return_if_fail(AMITK_ROI_TYPE_ISOCONTOUR(roi) || AMITK_ROI_TYPE_FREEHAND(roi));
   
   /* if we're drawing a single point, do a quick check to see if we're already done */
-  if (!AMITK_ROI_UNDRAWN(roi) && (area_size == 0)) {
-    if (erase) {
-      if (amitk_raw_data_includes_voxel(roi->map_data, voxel)) {
-	if (AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, voxel)==0) {
+  if (!AMITK_ROI_UNDRAWN(roi) && (area_size == 0) && (roi->map_runs != NULL)) {
+    if ((voxel.x >= 0) && (voxel.y >= 0) && (voxel.z >= 0) &&
+	(voxel.x < roi->map_runs->dim.x) && (voxel.y < roi->map_runs->dim.y) &&
+	(voxel.z < roi->map_runs->dim.z)) {
+      if (erase) {
+	if (amitk_roi_runs_get_value(roi->map_runs, voxel, NULL)==0) {
 	  return;
 	}
-      }
-    } else {
-      if (amitk_raw_data_includes_voxel(roi->map_data, voxel)) {
-	if (AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, voxel)) {
+      } else {
+	if (amitk_roi_runs_get_value(roi->map_runs, voxel, NULL)) {
 	  return;
 	}
       }
@@ -688,6 +917,7 @@ void amitk_roi_manipulate_area(AmitkRoi * roi, gboolean erase, AmitkVoxel voxel,
     break;
   }
   roi->center_of_mass_calculated = FALSE;
+  roi_invalidate_cache(roi); /* before any handlers get to see the new map */
 
   g_signal_emit(G_OBJECT(roi), roi_signals[ROI_CHANGED], 0);
 
@@ -743,74 +973,632 @@ void amitk_roi_set_type(AmitkRoi * roi, AmitkRoiType new_type) {
   return;
 }
 
-/* iterates over the voxels in the given data set that are inside the given roi,
-   and performs the specified calculation function for those points */
-/* if inverse is true, the calculation is done for the portion of the data set not in the roi */
-/* if accurate is true, uses much slower but more accurate calculation */
-/* calulation should be a function taking the following arguments:
-   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
-void amitk_roi_calculate_on_data_set(const AmitkRoi * roi,  
-				     const AmitkDataSet * ds, 
-				     const guint frame,
-				     const guint gate,
-				     const gboolean inverse,
-				     const gboolean accurate,
-				     void (*calculation)(),
-				     gpointer data) {
+static gboolean mask_matches(const AmitkRoiMask * mask, 
+			     const AmitkDataSet * ds,
+			     const gboolean accurate) {
 
-  g_return_if_fail(AMITK_IS_ROI(roi));
-  g_return_if_fail(AMITK_IS_DATA_SET(ds));
-  
-  if (AMITK_ROI_UNDRAWN(roi)) return;
+  AmitkAxis i_axis;
+  AmitkPoint voxel_size, offset;
+
+  if (mask->accurate != accurate)
+    return FALSE;
+  if (!VOXEL_EQUAL(mask->dim, AMITK_DATA_SET_DIM(ds)))
+    return FALSE;
+
+  voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+  offset = AMITK_SPACE_OFFSET(ds);
+  if ((mask->voxel_size.x != voxel_size.x) || (mask->voxel_size.y != voxel_size.y) ||
+      (mask->voxel_size.z != voxel_size.z) || (mask->offset.x != offset.x) || 
+      (mask->offset.y != offset.y) || (mask->offset.z != offset.z))
+    return FALSE;
+
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    if ((mask->axes[i_axis].x != AMITK_SPACE_AXES(ds)[i_axis].x) ||
+	(mask->axes[i_axis].y != AMITK_SPACE_AXES(ds)[i_axis].y) ||
+	(mask->axes[i_axis].z != AMITK_SPACE_AXES(ds)[i_axis].z))
+      return FALSE;
+
+  return TRUE;
+}
+
+static AmitkRoiMask * mask_calculate(const AmitkRoi * roi,
+				     const AmitkDataSet * ds,
+				     const gboolean accurate) {
+
+  AmitkRoiMask * mask;
+  AmitkAxis i_axis;
+#ifdef AMIDE_DEBUG
+  struct timeval tv1;
+  struct timeval tv2;
+
+  gettimeofday(&tv1, NULL);
+#endif
+
+  mask = g_new0(AmitkRoiMask, 1);
+  mask->dim = AMITK_DATA_SET_DIM(ds);
+  mask->voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
+  mask->offset = AMITK_SPACE_OFFSET(ds);
+  for (i_axis=0; i_axis < AMITK_AXIS_NUM; i_axis++)
+    mask->axes[i_axis] = AMITK_SPACE_AXES(ds)[i_axis];
+  mask->accurate = accurate;
+  mask->runs = g_array_new(FALSE, FALSE, sizeof(AmitkRoiMaskRun));
+  mask->fractions = g_array_new(FALSE, FALSE, sizeof(gfloat));
+  mask->ref_count = 1;
 
   switch(AMITK_ROI_TYPE(roi)) {
   case AMITK_ROI_TYPE_ELLIPSOID:
     if (accurate)
-      amitk_roi_ELLIPSOID_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ELLIPSOID_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_ELLIPSOID_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ELLIPSOID_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_CYLINDER:
     if (accurate)
-      amitk_roi_CYLINDER_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_CYLINDER_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_CYLINDER_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_CYLINDER_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_BOX:
     if (accurate)
-      amitk_roi_BOX_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_BOX_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_BOX_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_BOX_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_ISOCONTOUR_2D:
     if (accurate)
-      amitk_roi_ISOCONTOUR_2D_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ISOCONTOUR_2D_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_ISOCONTOUR_2D_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ISOCONTOUR_2D_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_ISOCONTOUR_3D:
     if (accurate)
-      amitk_roi_ISOCONTOUR_3D_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ISOCONTOUR_3D_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_ISOCONTOUR_3D_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_ISOCONTOUR_3D_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_FREEHAND_2D:
     if (accurate)
-      amitk_roi_FREEHAND_2D_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_FREEHAND_2D_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_FREEHAND_2D_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_FREEHAND_2D_calculate_mask_fast(roi, ds, mask);
     break;
   case AMITK_ROI_TYPE_FREEHAND_3D:
     if (accurate)
-      amitk_roi_FREEHAND_3D_calculate_on_data_set_accurate(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_FREEHAND_3D_calculate_mask_accurate(roi, ds, mask);
     else
-      amitk_roi_FREEHAND_3D_calculate_on_data_set_fast(roi, ds, frame, gate, inverse, calculation, data);
+      amitk_roi_FREEHAND_3D_calculate_mask_fast(roi, ds, mask);
     break;
   default: 
     g_error("roi type %d not implemented! file %s line %d",AMITK_ROI_TYPE(roi), __FILE__, __LINE__);
     break;
   }
 
+#ifdef AMIDE_DEBUG
+  gettimeofday(&tv2, NULL);
+  g_print("mask for roi %s on grid of %s (%d runs, %d partial voxels) took %5.3f seconds\n",
+	  AMITK_OBJECT_NAME(roi), AMITK_OBJECT_NAME(ds), mask->runs->len, mask->fractions->len,
+	  ((tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0));
+#endif
+
+  return mask;
+}
+
+/* roughly how much memory a mask takes up */
+static gsize mask_size(const AmitkRoiMask * mask) {
+  return sizeof(AmitkRoiMask) + 
+    mask->runs->len*sizeof(AmitkRoiMaskRun) + 
+    mask->fractions->len*sizeof(gfloat);
+}
+
+/* returns the mask of the voxels of the data set's grid that are in the roi.
+   Masks are cached on the roi, up to AMITK_ROI_MASK_CACHE_BYTES, and thrown 
+   out when the roi changes. The
+   returned mask needs to be unref'd.  There's no inverse mask, as that would
+   list nearly every voxel of the data set, amitk_roi_calculate_on_data_set
+   walks around the mask instead */
+AmitkRoiMask * amitk_roi_get_mask(const AmitkRoi * roi,
+				  const AmitkDataSet * ds,
+				  const gboolean accurate) {
+
+  AmitkRoi * cache_roi;
+  AmitkRoiMask * mask=NULL;
+  GList * masks;
+  GList * last;
+  gsize cache_size;
+
+  g_return_val_if_fail(AMITK_IS_ROI(roi), NULL);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
+
+  cache_roi = AMITK_ROI(roi); /* the cache isn't part of the roi's state */
+
+  /* the lock is held while calculating, so if several threads want the
+     same mask, it only gets calculated once */
+  g_mutex_lock(&(cache_roi->masks_mutex));
+
+  for (masks = cache_roi->masks; masks != NULL; masks = masks->next) {
+    if (mask_matches(masks->data, ds, accurate)) {
+      mask = masks->data;
+      cache_roi->masks = g_list_remove_link(cache_roi->masks, masks); /* move to front */
+      g_list_free_1(masks);
+      break;
+    }
+  }
+
+  if (mask == NULL) 
+    mask = mask_calculate(roi, ds, accurate);
+
+  cache_roi->masks = g_list_prepend(cache_roi->masks, mask);
+  g_atomic_int_inc(&(mask->ref_count));
+
+  /* drop the least recently used masks while we're over, the one we're
+     handing out stays even if it's over by itself */
+  cache_size = 0;
+  for (masks = cache_roi->masks; masks != NULL; masks = masks->next)
+    cache_size += mask_size(masks->data);
+  while ((cache_size > AMITK_ROI_MASK_CACHE_BYTES) && (cache_roi->masks->next != NULL)) {
+    last = g_list_last(cache_roi->masks);
+    cache_size -= mask_size(last->data);
+    amitk_roi_mask_unref(last->data);
+    cache_roi->masks = g_list_delete_link(cache_roi->masks, last);
+  }
+
+  g_mutex_unlock(&(cache_roi->masks_mutex));
+
+  return mask;
+}
+
+void amitk_roi_mask_unref(AmitkRoiMask * mask) {
+
+  if (mask == NULL) return;
+
+  if (g_atomic_int_dec_and_test(&(mask->ref_count))) {
+    g_array_free(mask->runs, TRUE);
+    g_array_free(mask->fractions, TRUE);
+    g_free(mask);
+  }
+
+  return;
+}
+
+/* used by the variable type functions, voxels with no fraction in the roi are skipped.
+   Voxels have to be added in the order they're stored in (x fastest, then y,
+   then z), and a voxel following on from
+   the last run gets added to it if both are entirely in the roi, or both aren't,
+   so only the voxels on the roi's edges need a fraction stored */
+void amitk_roi_mask_add_voxel(AmitkRoiMask * mask, const AmitkVoxel voxel, const amide_real_t fraction) {
+
+  AmitkRoiMaskRun * last;
+  AmitkRoiMaskRun run;
+  gfloat partial;
+  gboolean full;
+
+  if (fraction <= 0.0) return;
+
+  full = (fraction >= 1.0);
+  if (!full) {
+    partial = fraction;
+    g_array_append_val(mask->fractions, partial);
+  }
+
+  if (mask->runs->len > 0) {
+    last = &g_array_index(mask->runs, AmitkRoiMaskRun, mask->runs->len-1);
+    if ((last->z == voxel.z) && (last->y == voxel.y) && (last->x+last->length == voxel.x) &&
+	((last->fractions == AMITK_ROI_MASK_RUN_FULL) == full)) {
+      last->length++;
+      return;
+    }
+  }
+
+  run.x = voxel.x;
+  run.y = voxel.y;
+  run.z = voxel.z;
+  run.length = 1;
+  run.fractions = full ? AMITK_ROI_MASK_RUN_FULL : mask->fractions->len-1;
+  g_array_append_val(mask->runs, run);
+
+  return;
+}
+
+/* empty runs of the given dimensions, to be filled in a row at a time, in
+   order, with amitk_roi_runs_row_begin and amitk_roi_runs_append, and then
+   closed off with amitk_roi_runs_finish */
+AmitkRoiRuns * amitk_roi_runs_alloc(const AmitkVoxel dim) {
+
+  AmitkRoiRuns * runs;
+
+  runs = g_new0(AmitkRoiRuns, 1);
+  runs->dim = dim;
+  runs->dim.t = runs->dim.g = 1;
+  runs->row_start = g_new0(guint, AMITK_ROI_RUNS_NUM_ROWS(runs)+1);
+  runs->max_runs = 16;
+  runs->runs = g_new(AmitkRoiRun, runs->max_runs);
+  runs->num_runs = 0;
+  runs->ref_count = 1;
+
+  return runs;
+}
+
+void amitk_roi_runs_row_begin(AmitkRoiRuns * runs, const guint row) {
+  runs->row_start[row] = runs->num_runs;
+  return;
+}
+
+/* adds a run to the end of the given row, which has to be the last one begun.
+   Runs need to be added in order along x, one that touches the previous run
+   and has the same value gets merged into it */
+void amitk_roi_runs_append(AmitkRoiRuns * runs, const guint row, const amide_intpoint_t x, 
+			   const amide_intpoint_t length, const amitk_format_UBYTE_t value) {
+
+  AmitkRoiRun * last;
+
+  if ((length <= 0) || (value == 0)) return;
+
+  if (runs->num_runs > runs->row_start[row]) {
+    last = &(runs->runs[runs->num_runs-1]);
+    if ((last->value == value) && (last->x+last->length == x)) {
+      last->length += length;
+      return;
+    }
+  }
+
+  if (runs->num_runs == runs->max_runs) {
+    runs->max_runs *= 2;
+    runs->runs = g_renew(AmitkRoiRun, runs->runs, runs->max_runs);
+  }
+
+  last = &(runs->runs[runs->num_runs]);
+  last->x = x;
+  last->length = length;
+  last->value = value;
+  runs->num_runs++;
+
+  return;
+}
+
+void amitk_roi_runs_finish(AmitkRoiRuns * runs) {
+
+  runs->row_start[AMITK_ROI_RUNS_NUM_ROWS(runs)] = runs->num_runs;
+  runs->max_runs = MAX(runs->num_runs, 1);
+  runs->runs = g_renew(AmitkRoiRun, runs->runs, runs->max_runs);
+
+  return;
+}
+
+/* run length encodes the dim sized block of the map starting at start.  The map
+   is UBYTE, with anything non-zero being in the roi */
+AmitkRoiRuns * amitk_roi_runs_new(const AmitkRawData * map, const AmitkVoxel start, const AmitkVoxel dim) {
+
+  AmitkRoiRuns * runs;
+  const amitk_format_UBYTE_t * voxels;
+  AmitkVoxel i_voxel;
+  amide_intpoint_t x, run_x;
+  guint row;
+
+  g_return_val_if_fail(AMITK_IS_RAW_DATA(map), NULL);
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(map) == AMITK_FORMAT_UBYTE, NULL);
+
+  runs = amitk_roi_runs_alloc(dim);
+
+  row = 0;
+  i_voxel = start;
+  i_voxel.t = i_voxel.g = 0;
+  for (i_voxel.z=start.z; i_voxel.z < start.z+dim.z; i_voxel.z++) {
+    for (i_voxel.y=start.y; i_voxel.y < start.y+dim.y; i_voxel.y++, row++) {
+      amitk_roi_runs_row_begin(runs, row);
+      voxels = AMITK_RAW_DATA_UBYTE_POINTER(map, i_voxel);
+      x = 0;
+      while (x < dim.x) {
+	run_x = x;
+	while ((x < dim.x) && (voxels[x] == voxels[run_x])) x++;
+	amitk_roi_runs_append(runs, row, run_x, x-run_x, voxels[run_x]);
+      }
+    }
+  }
+  amitk_roi_runs_finish(runs);
+
+  return runs;
+}
+
+void amitk_roi_runs_unref(AmitkRoiRuns * runs) {
+
+  if (runs == NULL) return;
+
+  if (g_atomic_int_dec_and_test(&(runs->ref_count))) {
+    g_free(runs->row_start);
+    g_free(runs->runs);
+    g_free(runs);
+  }
+
+  return;
+}
+
+/* the map value at the given voxel, 0 if that's not in the map.  With a
+   cursor, a voxel in the same row as the last lookup is found by stepping
+   from the run that lookup landed on, otherwise the row gets searched.  The
+   cursor can be NULL */
+amitk_format_UBYTE_t amitk_roi_runs_get_value(const AmitkRoiRuns * runs, const AmitkVoxel voxel,
+					      AmitkRoiRunsCursor * cursor) {
+
+  guint row, row_start, row_end, low, high, mid, i_run;
+  const AmitkRoiRun * run;
+
+  if ((voxel.x < 0) || (voxel.y < 0) || (voxel.z < 0) ||
+      (voxel.x >= runs->dim.x) || (voxel.y >= runs->dim.y) || (voxel.z >= runs->dim.z))
+    return 0;
+
+  row = voxel.z*runs->dim.y+voxel.y;
+  row_start = runs->row_start[row];
+  row_end = runs->row_start[row+1];
+  if (row_start == row_end) return 0;
+
+  if ((cursor != NULL) && (cursor->row == row)) {
+    i_run = cursor->i_run;
+    while ((i_run > row_start) && (runs->runs[i_run].x > voxel.x)) i_run--;
+    while ((i_run+1 < row_end) && (runs->runs[i_run+1].x <= voxel.x)) i_run++;
+  } else {
+    /* find the first run starting after x, the one before it is the only one that can hold x */
+    low = row_start;
+    high = row_end;
+    while (low < high) {
+      mid = (low+high)/2;
+      if (runs->runs[mid].x <= voxel.x)
+	low = mid+1;
+      else
+	high = mid;
+    }
+    i_run = (low > row_start) ? low-1 : row_start;
+  }
+
+  if (cursor != NULL) {
+    cursor->row = row;
+    cursor->i_run = i_run;
+  }
+
+  run = &(runs->runs[i_run]);
+  return ((voxel.x >= run->x) && (voxel.x < run->x+run->length)) ? run->value : 0;
+}
+
+/* the dense map, for the dim sized block starting at start of the map
+   shifted by offset. So voxel i of the block is voxel i+start-offset of
+   the runs.  runs can be NULL, giving an empty block */
+AmitkRawData * amitk_roi_runs_get_map(const AmitkRoiRuns * runs, const AmitkVoxel offset, 
+				      const AmitkVoxel start, const AmitkVoxel dim) {
+
+  AmitkRawData * map;
+  const AmitkRoiRun * run;
+  AmitkVoxel i_voxel, j_voxel;
+  amide_intpoint_t low, high;
+  guint i_run;
+
+  map = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE, dim.z, dim.y, dim.x);
+  if ((map == NULL) || (runs == NULL)) return map;
+
+  i_voxel.t = i_voxel.g = 0;
+  for (i_voxel.z=0; i_voxel.z < dim.z; i_voxel.z++) {
+    j_voxel.z = i_voxel.z+start.z-offset.z;
+    if ((j_voxel.z < 0) || (j_voxel.z >= runs->dim.z)) continue;
+
+    for (i_voxel.y=0; i_voxel.y < dim.y; i_voxel.y++) {
+      j_voxel.y = i_voxel.y+start.y-offset.y;
+      if ((j_voxel.y < 0) || (j_voxel.y >= runs->dim.y)) continue;
+
+      for (i_run = AMITK_ROI_RUNS_ROW_START(runs, j_voxel.z, j_voxel.y);
+	   i_run < AMITK_ROI_RUNS_ROW_END(runs, j_voxel.z, j_voxel.y); i_run++) {
+	run = &(runs->runs[i_run]);
+	low = MAX(run->x+offset.x-start.x, 0);
+	high = MIN(run->x+run->length+offset.x-start.x, dim.x);
+	if (low < high) {
+	  i_voxel.x = low;
+	  memset(AMITK_RAW_DATA_UBYTE_POINTER(map, i_voxel), run->value, high-low);
+	}
+      }
+    }
+  }
+
+  return map;
+}
+
+/* copies the runs of a row shifted by offset along x, keeping the part in [low, high) */
+static void runs_copy_row(AmitkRoiRuns * dest, const guint dest_row, 
+			  const AmitkRoiRuns * src, const guint src_row,
+			  const amide_intpoint_t offset, 
+			  const amide_intpoint_t low, const amide_intpoint_t high) {
+
+  const AmitkRoiRun * run;
+  amide_intpoint_t x, end;
+  guint i_run;
+
+  for (i_run = src->row_start[src_row]; i_run < src->row_start[src_row+1]; i_run++) {
+    run = &(src->runs[i_run]);
+    x = MAX(run->x+offset, low);
+    end = MIN(run->x+run->length+offset, high);
+    if (x < end)
+      amitk_roi_runs_append(dest, dest_row, x, end-x, run->value);
+  }
+
+  return;
+}
+
+/* new runs of the given dim, made of the old runs shifted by offset, with
+   the block of the map starting at start replaced by patch (a UBYTE raw
+   data).  Used for editing the map, the old runs are left as they are. 
+   runs can be NULL for an empty map */
+AmitkRoiRuns * amitk_roi_runs_splice(const AmitkRoiRuns * runs, const AmitkVoxel offset, const AmitkVoxel dim,
+				     const AmitkRawData * patch, const AmitkVoxel start) {
+
+  AmitkRoiRuns * new_runs;
+  const amitk_format_UBYTE_t * voxels;
+  AmitkVoxel i_voxel, j_voxel, patch_dim;
+  amide_intpoint_t x, run_x;
+  guint row;
+  gboolean in_patch, in_old;
+
+  g_return_val_if_fail(AMITK_RAW_DATA_FORMAT(patch) == AMITK_FORMAT_UBYTE, NULL);
+  patch_dim = AMITK_RAW_DATA_DIM(patch);
+
+  new_runs = amitk_roi_runs_alloc(dim);
+
+  row = 0;
+  j_voxel.t = j_voxel.g = 0;
+  for (i_voxel.z=0; i_voxel.z < dim.z; i_voxel.z++) {
+    for (i_voxel.y=0; i_voxel.y < dim.y; i_voxel.y++, row++) {
+      amitk_roi_runs_row_begin(new_runs, row);
+
+      in_old = (runs != NULL) && 
+	(i_voxel.z-offset.z >= 0) && (i_voxel.z-offset.z < runs->dim.z) &&
+	(i_voxel.y-offset.y >= 0) && (i_voxel.y-offset.y < runs->dim.y);
+      in_patch = 
+	(i_voxel.z >= start.z) && (i_voxel.z < start.z+patch_dim.z) &&
+	(i_voxel.y >= start.y) && (i_voxel.y < start.y+patch_dim.y);
+
+      if (!in_patch) {
+	if (in_old)
+	  runs_copy_row(new_runs, row, runs, (i_voxel.z-offset.z)*runs->dim.y+i_voxel.y-offset.y,
+			offset.x, 0, dim.x);
+	continue;
+      }
+
+      if (in_old)
+	runs_copy_row(new_runs, row, runs, (i_voxel.z-offset.z)*runs->dim.y+i_voxel.y-offset.y,
+		      offset.x, 0, start.x);
+
+      j_voxel.z = i_voxel.z-start.z;
+      j_voxel.y = i_voxel.y-start.y;
+      j_voxel.x = 0;
+      voxels = AMITK_RAW_DATA_UBYTE_POINTER(patch, j_voxel);
+      x = 0;
+      while (x < patch_dim.x) {
+	run_x = x;
+	while ((x < patch_dim.x) && (voxels[x] == voxels[run_x])) x++;
+	amitk_roi_runs_append(new_runs, row, run_x+start.x, x-run_x, voxels[run_x]);
+      }
+
+      if (in_old)
+	runs_copy_row(new_runs, row, runs, (i_voxel.z-offset.z)*runs->dim.y+i_voxel.y-offset.y,
+		      offset.x, start.x+patch_dim.x, dim.x);
+    }
+  }
+  amitk_roi_runs_finish(new_runs);
+
+  return new_runs;
+}
+
+/* the run length encoded map of an isocontour or freehand roi, or NULL if
+   the roi hasn't been drawn.  The returned runs need to be unref'd */
+AmitkRoiRuns * amitk_roi_get_runs(const AmitkRoi * roi) {
+
+  AmitkRoi * lock_roi;
+  AmitkRoiRuns * runs;
+
+  g_return_val_if_fail(AMITK_IS_ROI(roi), NULL);
+
+  lock_roi = AMITK_ROI(roi);
+
+  g_mutex_lock(&(lock_roi->masks_mutex));
+  runs = lock_roi->map_runs;
+  if (runs != NULL)
+    g_atomic_int_inc(&(runs->ref_count));
+  g_mutex_unlock(&(lock_roi->masks_mutex));
+
+  return runs;
+}
+
+/* replaces the map of an isocontour or freehand roi, taking over the
+   reference to the runs.  The masks aren't thrown out and roi_changed
+   isn't emitted, callers do that once they're done changing the roi */
+void amitk_roi_set_map_runs(AmitkRoi * roi, AmitkRoiRuns * runs) {
+
+  AmitkRoiRuns * old_runs;
+
+  g_return_if_fail(AMITK_IS_ROI(roi));
+
+  g_mutex_lock(&(roi->masks_mutex));
+  old_runs = roi->map_runs;
+  roi->map_runs = runs;
+  g_mutex_unlock(&(roi->masks_mutex));
+
+  amitk_roi_runs_unref(old_runs);
+
+  return;
+}
+
+/* iterates over the voxels in the given data set that are inside the given roi,
+   and performs the specified calculation function for those points */
+/* if inverse is true, the calculation is done for the portion of the data set not in the roi */
+/* if accurate is true, uses much slower but more accurate calculation */
+/* calulation should be a function taking the following arguments:
+   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
+/* the geometry is only worked out once for a given data set grid (see 
+   amitk_roi_get_mask), after which this is just a gather of the frame/gate's values.
+   For inverse, the data set is walked in the same order as the mask, skipping
+   the voxels that are entirely in it */
+void amitk_roi_calculate_on_data_set(const AmitkRoi * roi,  
+				     const AmitkDataSet * ds, 
+				     const guint frame,
+				     const guint gate,
+				     const gboolean inverse,
+				     const gboolean accurate,
+				     void (*calculation)(),
+				     gpointer data) {
+
+  AmitkRoiMask * mask;
+  AmitkRoiMaskRun * run;
+  AmitkVoxel j, dim;
+  amide_data_t value;
+  amide_real_t fraction;
+  guint i_run, i;
+
+  g_return_if_fail(AMITK_IS_ROI(roi));
+  g_return_if_fail(AMITK_IS_DATA_SET(ds));
+  
+  if (AMITK_ROI_UNDRAWN(roi)) return;
+
+  amitk_raw_data_page_in_frames(AMITK_DATA_SET_RAW_DATA(ds), frame, frame);
+
+  if ((mask = amitk_roi_get_mask(roi, ds, accurate)) == NULL)
+    return;
+
+  j.t = frame;
+  j.g = gate;
+
+  if (!inverse) {
+    for (i_run=0; i_run < mask->runs->len; i_run++) {
+      run = &g_array_index(mask->runs, AmitkRoiMaskRun, i_run);
+      j.z = run->z;
+      j.y = run->y;
+      for (i=0; i < run->length; i++) {
+	j.x = run->x+i;
+	value = amitk_data_set_get_value(ds,j);
+	(*calculation)(j, value, AMITK_ROI_MASK_RUN_FRACTION(mask, run, i), data);
+      }
+    }
+  } else {
+    dim = AMITK_DATA_SET_DIM(ds);
+    i_run = 0;
+    i = 0;
+    run = (mask->runs->len > 0) ? &g_array_index(mask->runs, AmitkRoiMaskRun, 0) : NULL;
+    for (j.z = 0; j.z < dim.z; j.z++) 
+      for (j.y = 0; j.y < dim.y; j.y++) 
+	for (j.x = 0; j.x < dim.x; j.x++) {
+	  fraction = 1.0;
+	  if ((run != NULL) && (run->x+i == j.x) && (run->y == j.y) && (run->z == j.z)) {
+	    fraction = 1.0-AMITK_ROI_MASK_RUN_FRACTION(mask, run, i);
+	    i++;
+	    if (i == run->length) {
+	      i = 0;
+	      i_run++;
+	      run = (i_run < mask->runs->len) ? &g_array_index(mask->runs, AmitkRoiMaskRun, i_run) : NULL;
+	    }
+	  }
+	  if (fraction > 0.0) {
+	    value = amitk_data_set_get_value(ds,j);
+	    (*calculation)(j, value, fraction, data);
+	  }
+	}
+  }
+
+  amitk_roi_mask_unref(mask);
+
   return;
 }
 
@@ -837,18 +1625,21 @@ void amitk_roi_erase_volume(const AmitkRoi * roi,
   guint i_frame;
   guint i_gate;
 
+  /* waits for any readers of the data set (e.g. a filter) to finish */
+  amitk_data_set_write_lock(ds);
+
   for (i_frame=0; i_frame<AMITK_DATA_SET_NUM_FRAMES(ds); i_frame++) 
     for (i_gate=0; i_gate<AMITK_DATA_SET_NUM_GATES(ds); i_gate++) 
       amitk_roi_calculate_on_data_set(roi, ds, i_frame, i_gate, outside, FALSE, erase_volume, ds);
 
-  /* recalc max and min */
-  amitk_data_set_calc_min_max(ds, update_func, update_data);
+  amitk_data_set_write_unlock(ds);
+
+  /* recalc max and min, only the planes we've touched need redoing. This is
+     done after unlocking, as the update function can run the main loop */
+  amitk_data_set_update_min_max(ds, update_func, update_data);
 
   /* mark the distribution data as invalid */
-  if (AMITK_DATA_SET_DISTRIBUTION(ds) != NULL) {
-    g_object_unref(AMITK_DATA_SET_DISTRIBUTION(ds));
-    ds->distribution = NULL;
-  }
+  amitk_data_set_invalidate_distribution(ds);
 
   /* this is a no-op to get a data_set_changed signal */
   amitk_data_set_set_value(AMITK_DATA_SET(ds), zero_voxel,
@@ -56,6 +56,10 @@ G_BEGIN_DECLS
 #define AMITK_ROI_GRANULARITY 4 /* # subvoxels in one dimension, so 1/64 is grain size */
 //#define AMITK_ROI_GRANULARITY 10 - takes way to long
 
+/* how much memory an roi's cached masks can take up (in bytes), the least
+   recently used masks get thrown out past this */
+#define AMITK_ROI_MASK_CACHE_BYTES (32*1024*1024)
+
 typedef enum {
   AMITK_ROI_TYPE_ELLIPSOID, 
   AMITK_ROI_TYPE_CYLINDER, 
@@ -77,6 +81,79 @@ typedef enum {
 
 typedef struct _AmitkRoiClass AmitkRoiClass;
 typedef struct _AmitkRoi AmitkRoi;
+typedef struct _AmitkRoiMask AmitkRoiMask;
+typedef struct _AmitkRoiRuns AmitkRoiRuns;
+
+/* a stretch of voxels along x that are (partially) in an roi.  fractions
+   is where the first voxel's fraction is in the mask's fractions, or
+   AMITK_ROI_MASK_RUN_FULL if the voxels are entirely in the roi */
+typedef struct {
+  amide_intpoint_t x;
+  amide_intpoint_t y;
+  amide_intpoint_t z;
+  amide_intpoint_t length;
+  guint fractions;
+} AmitkRoiMaskRun;
+
+#define AMITK_ROI_MASK_RUN_FULL G_MAXUINT
+
+/* the voxels of a data set's grid that are (partially) in an roi.  Only
+   depends on the roi and the data set's space and voxel grid, so it can
+   be reused for all the frames and gates, and for other data sets on 
+   the same grid */
+struct _AmitkRoiMask
+{
+  /* the grid this mask was calculated for */
+  AmitkVoxel dim;
+  AmitkPoint voxel_size;
+  AmitkPoint offset;
+  AmitkAxes axes;
+  gboolean accurate;
+
+  GArray * runs; /* AmitkRoiMaskRun's, in the order they're visited */
+  GArray * fractions; /* gfloat's, for the voxels partially in the roi */
+  gint ref_count; /* atomic */
+};
+
+#define AMITK_ROI_MASK_RUN_FRACTION(mask, run, i) \
+  (((run)->fractions == AMITK_ROI_MASK_RUN_FULL) ? 1.0 : \
+   g_array_index((mask)->fractions, gfloat, (run)->fractions+(i)))
+
+/* a stretch of voxels along x in an roi's map with the same (non-zero) value */
+typedef struct {
+  amide_intpoint_t x;
+  amide_intpoint_t length;
+  amitk_format_UBYTE_t value;
+} AmitkRoiRun;
+
+/* the map of an isocontour or freehand roi, run length encoded along x.
+   The runs of row (z,y) are runs[row_start[z*dim.y+y]] up to (but not
+   including) runs[row_start[z*dim.y+y+1]].  Values are 1 for an edge
+   voxel, and 2 for a voxel inside the roi.  Once built, runs are never
+   changed, editing the map builds new runs, so they can be shared */
+struct _AmitkRoiRuns
+{
+  AmitkVoxel dim;
+  guint * row_start; /* dim.z*dim.y+1 entries */
+  AmitkRoiRun * runs;
+  guint num_runs;
+  guint max_runs; /* allocated */
+  gint ref_count; /* atomic */
+};
+
+#define AMITK_ROI_RUNS_ROW_START(runs, iz, iy) ((runs)->row_start[(iz)*(runs)->dim.y+(iy)])
+#define AMITK_ROI_RUNS_ROW_END(runs, iz, iy)   ((runs)->row_start[(iz)*(runs)->dim.y+(iy)+1])
+#define AMITK_ROI_RUNS_NUM_ROWS(runs)          ((guint) ((runs)->dim.z*(runs)->dim.y))
+
+/* where the last lookup in the runs landed.  Looking up voxels that follow
+   each other along a row then just steps through the row's runs, instead
+   of searching for each voxel */
+typedef struct {
+  guint row;
+  guint i_run;
+} AmitkRoiRunsCursor;
+
+#define AMITK_ROI_RUNS_CURSOR_RESET(cursor) ((cursor).row = G_MAXUINT)
 
 
 struct _AmitkRoi
@@ -90,7 +167,7 @@ struct _AmitkRoi
 
   /* isocontour and freehand specific stuff */
   AmitkPoint voxel_size;
-  AmitkRawData * map_data; /* raw data */
+  AmitkRoiRuns * map_runs; /* the map, replaced under masks_mutex */
   gboolean center_of_mass_calculated;
   AmitkPoint center_of_mass;
 
@@ -99,6 +176,11 @@ struct _AmitkRoi
   amide_data_t isocontour_max_value; /* what the user draws may lie outside of this range */
   AmitkRoiIsocontourRange isocontour_range;
 
+  /* masks for the data set grids we've been calculated on, most recently
+     used first, protected by the mutex */
+  GMutex masks_mutex;
+  GList * masks;
+
 };
 
 struct _AmitkRoiClass
@@ -146,6 +228,41 @@ void            amitk_roi_manipulate_area         (AmitkRoi * roi,
 						   gint area_size);
 AmitkPoint      amitk_roi_get_center_of_mass      (AmitkRoi * roi);
 void            amitk_roi_set_type                (AmitkRoi * roi, AmitkRoiType new_type);
+AmitkRoiMask *  amitk_roi_get_mask                (const AmitkRoi * roi,
+						   const AmitkDataSet * ds,
+						   const gboolean accurate);
+void            amitk_roi_mask_unref              (AmitkRoiMask * mask);
+void            amitk_roi_mask_add_voxel          (AmitkRoiMask * mask,
+						   const AmitkVoxel voxel,
+						   const amide_real_t fraction);
+AmitkRoiRuns *  amitk_roi_get_runs                (const AmitkRoi * roi);
+void            amitk_roi_set_map_runs            (AmitkRoi * roi,
+						   AmitkRoiRuns * runs);
+AmitkRoiRuns *  amitk_roi_runs_new                (const AmitkRawData * map,
+						   const AmitkVoxel start,
+						   const AmitkVoxel dim);
+AmitkRoiRuns *  amitk_roi_runs_alloc              (const AmitkVoxel dim);
+void            amitk_roi_runs_row_begin          (AmitkRoiRuns * runs,
+						   const guint row);
+void            amitk_roi_runs_append             (AmitkRoiRuns * runs,
+						   const guint row,
+						   const amide_intpoint_t x,
+						   const amide_intpoint_t length,
+						   const amitk_format_UBYTE_t value);
+void            amitk_roi_runs_finish             (AmitkRoiRuns * runs);
+void            amitk_roi_runs_unref              (AmitkRoiRuns * runs);
+amitk_format_UBYTE_t amitk_roi_runs_get_value     (const AmitkRoiRuns * runs,
+						   const AmitkVoxel voxel,
+						   AmitkRoiRunsCursor * cursor);
+AmitkRawData *  amitk_roi_runs_get_map            (const AmitkRoiRuns * runs,
+						   const AmitkVoxel offset,
+						   const AmitkVoxel start,
+						   const AmitkVoxel dim);
+AmitkRoiRuns *  amitk_roi_runs_splice             (const AmitkRoiRuns * runs,
+						   const AmitkVoxel offset,
+						   const AmitkVoxel dim,
+						   const AmitkRawData * patch,
+						   const AmitkVoxel start);
 void            amitk_roi_calculate_on_data_set   (const AmitkRoi * roi,  
 						   const AmitkDataSet * ds, 
 						   const guint frame,
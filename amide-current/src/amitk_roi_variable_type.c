@@ -191,7 +191,8 @@ GSList * amitk_roi_`'m4_Variable_Type`'_get_intersection_line(const AmitkRoi * r
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
 
 
-/* returns 0 for something not in the roi, returns 1 for an edge, and 2 for something in the roi */
+/* returns 0 for something not in the roi, returns 1 for an edge, and 2 for something in the roi.
+   Only used for touching up small areas, see map_mark_edges for the whole map */
 static amitk_format_UBYTE_t map_roi_edge(AmitkRawData * map_roi_ds, AmitkVoxel voxel) {
 
   amitk_format_UBYTE_t edge_value=0;
@@ -271,6 +272,124 @@ static amitk_format_UBYTE_t map_roi_edge(AmitkRawData * map_roi_ds, AmitkVoxel v
   return edge_value;
 }
 
+#if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D)
+
+/* the next stretch of touching runs in a row, as [*pstart, *pend) */
+static gboolean row_next_span(const AmitkRoiRuns * runs, guint * pi_run, const guint row_end,
+			      amide_intpoint_t * pstart, amide_intpoint_t * pend) {
+
+  if (*pi_run >= row_end) return FALSE;
+
+  *pstart = runs->runs[*pi_run].x;
+  *pend = *pstart + runs->runs[*pi_run].length;
+  (*pi_run)++;
+  while ((*pi_run < row_end) && (runs->runs[*pi_run].x == *pend)) {
+    *pend += runs->runs[*pi_run].length;
+    (*pi_run)++;
+  }
+
+  return TRUE;
+}
+
+/* new runs with every voxel of the map that's in the roi set to what
+   map_roi_edge would give.  A voxel is in the interior if it's in the
+   span of its own row shrunk by one at each end, and likewise for the
+   neighboring rows, so each row's interior is the intersection of those */
+static AmitkRoiRuns * runs_mark_edges(const AmitkRoiRuns * runs) {
+
+  AmitkRoiRuns * edged;
+  GArray * interior;
+  GArray * next;
+  GArray * temp;
+  AmitkRoiRun span;
+  AmitkRoiRun * cur;
+  AmitkVoxel i_voxel;
+  amide_intpoint_t start, end, n_start, n_end, low, high, x;
+  gint dz, dy;
+  guint i_run, j_run, i_span, row;
+  gboolean have_span;
+
+  edged = amitk_roi_runs_alloc(runs->dim);
+  interior = g_array_new(FALSE, FALSE, sizeof(AmitkRoiRun));
+  next = g_array_new(FALSE, FALSE, sizeof(AmitkRoiRun));
+  span.value = 2;
+
+  row = 0;
+  i_voxel.t = i_voxel.g = 0;
+  for (i_voxel.z=0; i_voxel.z < runs->dim.z; i_voxel.z++)
+    for (i_voxel.y=0; i_voxel.y < runs->dim.y; i_voxel.y++, row++) {
+      amitk_roi_runs_row_begin(edged, row);
+      i_run = AMITK_ROI_RUNS_ROW_START(runs, i_voxel.z, i_voxel.y);
+      while (row_next_span(runs, &i_run, AMITK_ROI_RUNS_ROW_END(runs, i_voxel.z, i_voxel.y), 
+			   &start, &end)) {
+	g_array_set_size(interior, 0);
+	if (end-start > 2) {
+	  span.x = start+1;
+	  span.length = end-start-2;
+	  g_array_append_val(interior, span);
+	}
+
+#if defined(ROI_TYPE_ISOCONTOUR_3D)
+	for (dz=-1; dz<=1; dz++)
+#else
+	dz = 0;
+#endif
+	  for (dy=-1; dy<=1; dy++) {
+	    if ((dz == 0) && (dy == 0)) continue;
+	    if (interior->len == 0) break;
+	    if ((i_voxel.z+dz < 0) || (i_voxel.z+dz >= runs->dim.z) ||
+		(i_voxel.y+dy < 0) || (i_voxel.y+dy >= runs->dim.y)) {
+	      g_array_set_size(interior, 0);
+	      break;
+	    }
+
+	    /* intersect with the neighboring row's spans, shrunk by one at each end */
+	    g_array_set_size(next, 0);
+	    j_run = AMITK_ROI_RUNS_ROW_START(runs, i_voxel.z+dz, i_voxel.y+dy);
+	    have_span = row_next_span(runs, &j_run, AMITK_ROI_RUNS_ROW_END(runs, i_voxel.z+dz, i_voxel.y+dy),
+				      &n_start, &n_end);
+	    i_span = 0;
+	    while (have_span && (i_span < interior->len)) {
+	      cur = &g_array_index(interior, AmitkRoiRun, i_span);
+	      low = MAX(cur->x, n_start+1);
+	      high = MIN(cur->x+cur->length, n_end-1);
+	      if (low < high) {
+		span.x = low;
+		span.length = high-low;
+		g_array_append_val(next, span);
+	      }
+	      if (cur->x+cur->length < n_end-1)
+		i_span++;
+	      else
+		have_span = row_next_span(runs, &j_run, AMITK_ROI_RUNS_ROW_END(runs, i_voxel.z+dz, i_voxel.y+dy),
+					  &n_start, &n_end);
+	    }
+	    temp = interior;
+	    interior = next;
+	    next = temp;
+	  }
+
+	/* edges around and between the interior stretches */
+	x = start;
+	for (i_span=0; i_span < interior->len; i_span++) {
+	  cur = &g_array_index(interior, AmitkRoiRun, i_span);
+	  amitk_roi_runs_append(edged, row, x, cur->x-x, 1);
+	  amitk_roi_runs_append(edged, row, cur->x, cur->length, 2);
+	  x = cur->x+cur->length;
+	}
+	amitk_roi_runs_append(edged, row, x, end-x, 1);
+      }
+    }
+  amitk_roi_runs_finish(edged);
+
+  g_array_free(interior, TRUE);
+  g_array_free(next, TRUE);
+
+  return edged;
+}
+
+#endif
+
 
 
 #define FAST_INTERSECTION_SLICE 1
@@ -297,6 +416,12 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
   AmitkPoint temp_point;
   AmitkPoint canvas_voxel_size;
   amitk_format_UBYTE_t value;
+  AmitkRoiRuns * runs;
+  AmitkRoiRunsCursor cursor;
+#if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_FREEHAND_2D)
+  AmitkRoiRuns * slice_runs;
+  AmitkRoiRuns * edge_runs;
+#endif
 #if FAST_INTERSECTION_SLICE
   AmitkPoint alt, start_point;
   AmitkPoint stride[AMITK_AXIS_NUM], last_point;
@@ -311,6 +436,9 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 						intersection_corners))
     return NULL; /* no intersection */
 
+  if ((runs = amitk_roi_get_runs(roi)) == NULL)
+    return NULL;
+
   /* translate the intersection into voxel space */
   canvas_voxel_size.x = canvas_voxel_size.y = pixel_dim;
   canvas_voxel_size.z = AMITK_VOLUME_Z_CORNER(canvas_slice);
@@ -348,6 +476,7 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 
   roi_point = start_point;
 #endif
+  AMITK_ROI_RUNS_CURSOR_RESET(cursor);
   i_voxel.z = i_voxel.g = i_voxel.t = 0;
   for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) {
 #if FAST_INTERSECTION_SLICE
@@ -363,8 +492,8 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
       roi_point = amitk_space_s2s(AMITK_SPACE(canvas_slice), AMITK_SPACE(roi), view_point);
 #endif
       POINT_TO_VOXEL(roi_point, roi->voxel_size, 0, 0, roi_voxel);
-      if (amitk_raw_data_includes_voxel(roi->map_data, roi_voxel)) {
-	value = AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, roi_voxel);
+      value = amitk_roi_runs_get_value(runs, roi_voxel, &cursor);
+      if (value > 0) {
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_FREEHAND_2D)
 	if (value > 0)
 	  AMITK_RAW_DATA_UBYTE_SET_CONTENT(intersection->raw_data, i_voxel) = 1;
@@ -393,18 +522,21 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 
   }
 
+  amitk_roi_runs_unref(runs);
+
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_FREEHAND_2D)
 #ifndef AMIDE_LIBGNOMECANVAS_AA
   if (!fill_map_roi) 
 #endif
     {
       /* mark the edges as such on the 2D isocontour or freehand slices */
-      i_voxel.z = i_voxel.g = i_voxel.t = 0;
-      for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) 
-	for (i_voxel.x=0; i_voxel.x<dim.x; i_voxel.x++) 
-	  if (AMITK_RAW_DATA_UBYTE_CONTENT(intersection->raw_data, i_voxel)) 
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(intersection->raw_data, i_voxel) =
-	      map_roi_edge(intersection->raw_data, i_voxel);
+      slice_runs = amitk_roi_runs_new(intersection->raw_data, zero_voxel, 
+				      AMITK_RAW_DATA_DIM(intersection->raw_data));
+      edge_runs = runs_mark_edges(slice_runs);
+      g_object_unref(intersection->raw_data);
+      intersection->raw_data = amitk_roi_runs_get_map(edge_runs, zero_voxel, zero_voxel, edge_runs->dim);
+      amitk_roi_runs_unref(slice_runs);
+      amitk_roi_runs_unref(edge_runs);
     }
 #endif
 
@@ -428,14 +560,48 @@ AmitkDataSet * amitk_roi_`'m4_Variable_Type`'_get_intersection_slice(const Amitk
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) 
 /* the data in temp_rd is setup as follows:
    bit 1 -> is the voxel in the isocontour
-   bit 2 -> has the voxel been checked 
-   bit 3 -> increment x for backup
-   bit 4 -> decrement x for backup
-   bit 5 -> increment y for backup
-   bit 6 -> decrement y for backup
-   bit 7 -> increment z for backup
-   bit 8 -> decrement z for backup
+   bit 2 -> has the voxel's value been checked 
+   bit 3 -> is the voxel's value within the isocontour range
 */
+static inline gboolean isocontour_fillable(const AmitkDataSet * ds,
+					   const AmitkRawData * temp_rd, 
+					   AmitkVoxel ds_voxel, 
+					   const AmitkVoxel roi_voxel,
+					   const amide_data_t iso_min_value,
+					   const amide_data_t iso_max_value,
+					   const AmitkRoiIsocontourRange iso_range) {
+
+  amide_data_t voxel_value;
+  guint8 content;
+
+  content = AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel);
+
+  if (!(content & 0x02)) { /* don't recheck something we've already checked */
+    content |= 0x02;
+
+    ds_voxel.z = roi_voxel.z;
+    ds_voxel.y = roi_voxel.y;
+    ds_voxel.x = roi_voxel.x;
+
+    voxel_value = amitk_data_set_get_value(ds, ds_voxel);
+    if (((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN) && (voxel_value >= iso_min_value)) ||
+	((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX) && (voxel_value <= iso_max_value)) ||
+	((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BETWEEN_MIN_MAX) && (voxel_value >= iso_min_value) && (voxel_value <= iso_max_value)))
+      content |= 0x04;
+
+    AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, roi_voxel) = content;
+  }
+
+  /* in range, and not yet filled */
+  return ((content & 0x05) == 0x04);
+}
+
+/* scanline flood fill from the starting voxel.  Each seed taken off the
+   stack gets extended into a run along x, and the rows next to the run (8
+   of them in 3D, 2 in 2D) are then scanned over the run's extent plus one
+   on either side, with a seed pushed for each stretch of fillable voxels.
+   That gives the same 8 (2D) or 26 (3D) connectivity as checking all the
+   neighbors of each voxel, but every voxel only gets checked once */
 static void isocontour_consider(const AmitkDataSet * ds,
 				const AmitkRawData * temp_rd, 
 				AmitkVoxel ds_voxel, 
@@ -444,103 +610,76 @@ static void isocontour_consider(const AmitkDataSet * ds,
 				const AmitkRoiIsocontourRange iso_range) {
 
 
+  GArray * seeds;
+  AmitkVoxel seed;
   AmitkVoxel i_voxel;
-  AmitkVoxel roi_voxel;
-  gboolean found;
-  gboolean done;
-  amide_data_t voxel_value;
+  amide_intpoint_t left, right;
+  amide_intpoint_t dy, dz, dz_limit;
+  gboolean in_run;
 
-  roi_voxel = ds_voxel;
-  roi_voxel.t = roi_voxel.g = 0;
-  i_voxel =roi_voxel;
-  done=FALSE;
+  seeds = g_array_new(FALSE, FALSE, sizeof(AmitkVoxel));
 
   /* the starting point is in by definition */
-  AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, roi_voxel) |= 0x03;
-
-  /* while we still have neighbor voxels to check */
-  while (!done) {
-
-    found = FALSE;
+  seed = ds_voxel;
+  seed.t = seed.g = 0;
+  AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, seed) |= 0x06;
+  g_array_append_val(seeds, seed);
 
-    /* find a neighbor to check, consider the 8 adjoining voxels, or 26 in the case of 3D */
 #ifdef ROI_TYPE_ISOCONTOUR_3D
-    for (i_voxel.z = (roi_voxel.z >= 1) ? roi_voxel.z-1 : 0;
-	 (i_voxel.z < temp_rd->dim.z) && (i_voxel.z <= roi_voxel.z+1) && (!found);
-	 i_voxel.z++)
-#endif
-      for (i_voxel.y = (roi_voxel.y >= 1) ? roi_voxel.y-1 : 0;
-	   (i_voxel.y < temp_rd->dim.y) && (i_voxel.y <= roi_voxel.y+1) && (!found);
-	   i_voxel.y++)
-	for (i_voxel.x = (roi_voxel.x >= 1) ? roi_voxel.x-1 : 0;
-	     (i_voxel.x < temp_rd->dim.x) && (i_voxel.x <= roi_voxel.x+1) && (!found);
-	     i_voxel.x++) 
-	  if (!(AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, i_voxel) & 0x02)) { /* don't recheck something we've already checked */
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x02; /* it's been checked */
-
-	    ds_voxel.z = i_voxel.z;
-	    ds_voxel.y = i_voxel.y;
-	    ds_voxel.x = i_voxel.x;
-
-	    voxel_value = amitk_data_set_get_value(ds, ds_voxel);
-	    if (((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN) && (voxel_value >= iso_min_value)) ||
-		((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX) && (voxel_value <= iso_max_value)) ||
-		((iso_range == AMITK_ROI_ISOCONTOUR_RANGE_BETWEEN_MIN_MAX) && (voxel_value >= iso_min_value) && (voxel_value <= iso_max_value))) {
-
-	      AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x01; /* it's in */
-
-	      /* store backup info */
-#ifdef ROI_TYPE_ISOCONTOUR_3D
-	      if (i_voxel.z > roi_voxel.z)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x40;
-	      else if (i_voxel.z < roi_voxel.z)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x80;
+  dz_limit = 1;
+#else
+  dz_limit = 0;
 #endif
-	      if (i_voxel.y > roi_voxel.y)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x10;
-	      else if (i_voxel.y < roi_voxel.y)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x20;
-	      if (i_voxel.x > roi_voxel.x)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x04;
-	      else if (i_voxel.x < roi_voxel.x)
-		AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,i_voxel) |= 0x08;
-	      
-	      /* start next iteration at this voxel */
-	      roi_voxel = i_voxel; 
-	      found = TRUE;
-	    }
-	  }
 
-        
-    if (!found) { /* all neighbors exhaustively checked, backup */
+  while (seeds->len > 0) {
+    seed = g_array_index(seeds, AmitkVoxel, seeds->len-1);
+    g_array_set_size(seeds, seeds->len-1);
 
-      /* backup to previous voxel */
-      i_voxel = roi_voxel;
-#ifdef ROI_TYPE_ISOCONTOUR_3D
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x80)
-	i_voxel.z++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x40)
-	i_voxel.z--;
-#endif
+    /* may have been filled as part of another run since it was pushed */
+    if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, seed) & 0x01) continue;
 
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x20)
-	i_voxel.y++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x10)
-	i_voxel.y--;
-
-      if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x08)
-	i_voxel.x++;
-      else if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, roi_voxel) & 0x04)
-	i_voxel.x--;
-
-      /* the inital voxel will backup to itself, which is why we get out of the loop */
-      if (VOXEL_EQUAL(roi_voxel, i_voxel)) 
-	done = TRUE;
-      else
-	roi_voxel = i_voxel;
+    /* extend the seed into a run */
+    i_voxel = seed;
+    for (left = seed.x; left > 0; left--) {
+      i_voxel.x = left-1;
+      if (!isocontour_fillable(ds, temp_rd, ds_voxel, i_voxel, iso_min_value, iso_max_value, iso_range))
+	break;
+    }
+    for (right = seed.x; right < temp_rd->dim.x-1; right++) {
+      i_voxel.x = right+1;
+      if (!isocontour_fillable(ds, temp_rd, ds_voxel, i_voxel, iso_min_value, iso_max_value, iso_range))
+	break;
+    }
+    for (i_voxel.x = left; i_voxel.x <= right; i_voxel.x++)
+      AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, i_voxel) |= 0x01; /* it's in */
+
+    /* look for seeds in the neighboring rows */
+    for (dz = -dz_limit; dz <= dz_limit; dz++) {
+      i_voxel.z = seed.z+dz;
+      if ((i_voxel.z < 0) || (i_voxel.z >= temp_rd->dim.z)) continue;
+
+      for (dy = -1; dy <= 1; dy++) {
+	if ((dy == 0) && (dz == 0)) continue;
+	i_voxel.y = seed.y+dy;
+	if ((i_voxel.y < 0) || (i_voxel.y >= temp_rd->dim.y)) continue;
+
+	in_run = FALSE;
+	for (i_voxel.x = (left >= 1) ? left-1 : 0;
+	     (i_voxel.x < temp_rd->dim.x) && (i_voxel.x <= right+1);
+	     i_voxel.x++) {
+	  if (isocontour_fillable(ds, temp_rd, ds_voxel, i_voxel, iso_min_value, iso_max_value, iso_range)) {
+	    if (!in_run) g_array_append_val(seeds, i_voxel);
+	    in_run = TRUE;
+	  } else {
+	    in_run = FALSE;
+	  }
+	}
+      }
     }
   }
 
+  g_array_free(seeds, TRUE);
+
   return;
 }
   
@@ -554,8 +693,9 @@ void amitk_roi_`'m4_Variable_Type`'_set_isocontour(AmitkRoi * roi, AmitkDataSet
 						   AmitkRoiIsocontourRange iso_range) {
 
   AmitkRawData * temp_rd;
+  AmitkRoiRuns * runs;
   AmitkPoint temp_point;
-  AmitkVoxel min_voxel, max_voxel, i_voxel;
+  AmitkVoxel min_voxel, max_voxel, i_voxel, map_dim;
   amide_data_t temp_min_value, temp_max_value;
 
   g_return_if_fail(roi->type == AMITK_ROI_TYPE_`'m4_Variable_Type`');
@@ -579,14 +719,18 @@ void amitk_roi_`'m4_Variable_Type`'_set_isocontour(AmitkRoi * roi, AmitkDataSet
   /* fill in the data set */
   isocontour_consider(ds, temp_rd, iso_voxel, temp_min_value, temp_max_value, iso_range);
   
-  /* figure out the min and max dimensions */
+  /* figure out the min and max dimensions, and clear out all but the in/out bit */
   min_voxel = max_voxel = iso_voxel;
+#if defined(ROI_TYPE_ISOCONTOUR_2D)
+  min_voxel.z = max_voxel.z = 0;
+#endif
   
   i_voxel.t = i_voxel.g = 0;
   for (i_voxel.z=0; i_voxel.z < temp_rd->dim.z; i_voxel.z++) {
     for (i_voxel.y=0; i_voxel.y < temp_rd->dim.y; i_voxel.y++) {
       for (i_voxel.x=0; i_voxel.x < temp_rd->dim.x; i_voxel.x++) {
-	if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, i_voxel) & 0x1) {
+	AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd, i_voxel) &= 0x1;
+	if (AMITK_RAW_DATA_UBYTE_CONTENT(temp_rd, i_voxel)) {
 	  if (min_voxel.x > i_voxel.x) min_voxel.x = i_voxel.x;
 	  if (max_voxel.x < i_voxel.x) max_voxel.x = i_voxel.x;
 	  if (min_voxel.y > i_voxel.y) min_voxel.y = i_voxel.y;
@@ -600,41 +744,14 @@ void amitk_roi_`'m4_Variable_Type`'_set_isocontour(AmitkRoi * roi, AmitkDataSet
     }
   }
   
-  /* transfer the subset of the data set that contains positive information */
-  if (roi->map_data != NULL)
-    g_object_unref(roi->map_data);
-#if defined(ROI_TYPE_ISOCONTOUR_2D)
-  roi->map_data = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, max_voxel.y-min_voxel.y+1, max_voxel.x-min_voxel.x+1);
-#elif defined(ROI_TYPE_ISOCONTOUR_3D)
-  roi->map_data = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE,
-						   max_voxel.z-min_voxel.z+1,
-						   max_voxel.y-min_voxel.y+1, 
-						   max_voxel.x-min_voxel.x+1);
-#endif
-
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z<roi->map_data->dim.z; i_voxel.z++)
-    for (i_voxel.y=0; i_voxel.y<roi->map_data->dim.y; i_voxel.y++)
-      for (i_voxel.x=0; i_voxel.x<roi->map_data->dim.x; i_voxel.x++) {
-#if defined(ROI_TYPE_ISOCONTOUR_2D)
-	AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) = 
-	  0x01 & AMITK_RAW_DATA_UBYTE_2D_CONTENT(temp_rd, i_voxel.y+min_voxel.y, i_voxel.x+min_voxel.x);
-#elif defined(ROI_TYPE_ISOCONTOUR_3D)
-	AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) =
-	  0x01 & AMITK_RAW_DATA_UBYTE_3D_CONTENT(temp_rd, i_voxel.z+min_voxel.z,i_voxel.y+min_voxel.y, i_voxel.x+min_voxel.x);
-#endif
-      }
-
+  /* run length encode the subset of the data set that contains positive information */
+  map_dim = voxel_add(voxel_sub(max_voxel, min_voxel), one_voxel);
+  runs = amitk_roi_runs_new(temp_rd, min_voxel, map_dim);
   g_object_unref(temp_rd);
 
   /* mark the edges as such */
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z<roi->map_data->dim.z; i_voxel.z++)
-    for (i_voxel.y=0; i_voxel.y<roi->map_data->dim.y; i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x<roi->map_data->dim.x; i_voxel.x++) 
-	if (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, i_voxel)) 
-	  AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) =
-	    map_roi_edge(roi->map_data, i_voxel);
+  amitk_roi_set_map_runs(roi, runs_mark_edges(runs));
+  amitk_roi_runs_unref(runs);
 
   /* and set the rest of the important info for the data set */
   amitk_space_copy_in_place(AMITK_SPACE(roi), AMITK_SPACE(ds));
@@ -661,28 +778,29 @@ void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean era
   AmitkVoxel i_voxel, j_voxel;
   AmitkVoxel new_dim;
   AmitkVoxel offset;
-  AmitkVoxel map_data_dim;
+  AmitkVoxel map_dim;
+  AmitkVoxel patch_start, patch_end, patch_dim;
   AmitkPoint new_offset;
-  AmitkRawData * temp_rd;
+  AmitkRoiRuns * runs;
+  AmitkRawData * patch;
   gboolean dim_changed=FALSE;
 
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D)
-  g_return_if_fail(roi->map_data != NULL);
+  g_return_if_fail(roi->map_runs != NULL);
 #endif
 
-  j_voxel = zero_voxel;
-  i_voxel = zero_voxel;
+  /* the map only gets replaced from here, so no need to lock to look at it */
+  runs = roi->map_runs;
+  map_dim = (runs != NULL) ? runs->dim : zero_voxel;
+  new_dim = map_dim;
+  offset = zero_voxel;
+#if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_FREEHAND_2D)
+  voxel.z = 0;
+  new_dim.z = 1;
+#endif
 
   /* check if we need to increase the size of the roi */
-  if (!erase || (roi->map_data == NULL)) { /* never need to do for an erase, unless map_data hasn't yet been allocated */
-    if (roi->map_data != NULL) {
-      new_dim = roi->map_data->dim;
-      map_data_dim = roi->map_data->dim;
-    } else {
-      new_dim = zero_voxel;
-      map_data_dim = zero_voxel;
-    }
-    offset = zero_voxel;
+  if (!erase || (runs == NULL)) { /* never need to do for an erase, unless the map hasn't yet been allocated */
 
 #if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
     if ((voxel.z-area_size) < 0) {
@@ -690,8 +808,8 @@ void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean era
       new_dim.z += offset.z;
       dim_changed = TRUE;
     }
-    if ((voxel.z+area_size) > (map_data_dim.z-1)) {
-      new_dim.z += (voxel.z-(map_data_dim.z-1))+area_size;
+    if ((voxel.z+area_size) > (map_dim.z-1)) {
+      new_dim.z += (voxel.z-(map_dim.z-1))+area_size;
       dim_changed = TRUE;
     }
 #endif
@@ -700,8 +818,8 @@ void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean era
       new_dim.y += offset.y;
       dim_changed = TRUE;
     }
-    if ((voxel.y+area_size) > (map_data_dim.y-1)) {
-      new_dim.y += (voxel.y-(map_data_dim.y-1))+area_size;
+    if ((voxel.y+area_size) > (map_dim.y-1)) {
+      new_dim.y += (voxel.y-(map_dim.y-1))+area_size;
       dim_changed = TRUE;
     }
     if ((voxel.x-area_size) < 0) {
@@ -709,68 +827,90 @@ void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean era
       new_dim.x += offset.x;
       dim_changed = TRUE;
     }
-    if ((voxel.x+area_size) > (map_data_dim.x-1)) {
-      new_dim.x += (voxel.x-(map_data_dim.x-1))+area_size;
+    if ((voxel.x+area_size) > (map_dim.x-1)) {
+      new_dim.x += (voxel.x-(map_dim.x-1))+area_size;
       dim_changed = TRUE;
     }
+  }
 
-if (dim_changed) {
-#if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_FREEHAND_2D)
-      temp_rd = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, new_dim.y, new_dim.x);
-#else /* ROI_TYPE_ISOCONTOUR_3D or ROI_TYPE_FREEHAND_3D */
-      temp_rd = amitk_raw_data_new_3D_with_data0(AMITK_FORMAT_UBYTE, new_dim.z, new_dim.y, new_dim.x);
-#endif
-      
-      /* copy the old map data over */
-      if (roi->map_data != NULL) {
+  /* where the voxel ends up once the old map's been shifted over */
+  voxel.x += offset.x;
+  voxel.y += offset.y;
+  voxel.z += offset.z;
+
+  /* the block of the map that gets redone, the area itself, the voxels
+     around it that need to be re-edged, and their neighbors */
+  patch_start.x = MAX(voxel.x-area_size-2, 0);
+  patch_start.y = MAX(voxel.y-area_size-2, 0);
+  patch_end.x = MIN(voxel.x+area_size+2, new_dim.x-1);
+  patch_end.y = MIN(voxel.y+area_size+2, new_dim.y-1);
 #if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
-	for (i_voxel.z = 0, j_voxel.z=offset.z; i_voxel.z < map_data_dim.z; i_voxel.z++, j_voxel.z++) 
+  patch_start.z = MAX(voxel.z-area_size-2, 0);
+  patch_end.z = MIN(voxel.z+area_size+2, new_dim.z-1);
+#else
+  patch_start.z = patch_end.z = 0;
 #endif
-	  for (i_voxel.y = 0, j_voxel.y=offset.y; i_voxel.y < map_data_dim.y; i_voxel.y++, j_voxel.y++) 
-	    for (i_voxel.x = 0, j_voxel.x=offset.x; i_voxel.x < map_data_dim.x; i_voxel.x++, j_voxel.x++) 
-	      AMITK_RAW_DATA_UBYTE_SET_CONTENT(temp_rd,j_voxel)=
-		AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data,i_voxel);
-      
-	g_object_unref(roi->map_data);
-      }
-      roi->map_data = temp_rd;
-      
-      /* shift the offset to account for the large ROI */
-      POINT_MULT(offset, roi->voxel_size, new_offset);
-      new_offset = point_cmult(-(1.0+EPSILON), new_offset);
-      new_offset = amitk_space_s2b(AMITK_SPACE(roi), new_offset);
-      amitk_space_set_offset(AMITK_SPACE(roi), new_offset);
-      amitk_roi_calc_far_corner(roi);
-    }
-  }
+  patch_start.t = patch_start.g = patch_end.t = patch_end.g = 0;
+
+  /* nothing of the area is in the map */
+  if ((patch_end.x < patch_start.x) || (patch_end.y < patch_start.y) || (patch_end.z < patch_start.z))
+    return;
 
-  /* sanity check */
-  g_return_if_fail(roi->map_data != NULL);
+  patch_dim = voxel_add(voxel_sub(patch_end, patch_start), one_voxel);
+  if ((patch = amitk_roi_runs_get_map(runs, offset, patch_start, patch_dim)) == NULL) {
+    g_warning(_("couldn't allocate memory space for the roi's map"));
+    return;
+  }
 
   /* do the erase or drawing */
+  j_voxel = zero_voxel;
 #if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
-  for (i_voxel.z = voxel.z-area_size; i_voxel.z <= voxel.z+area_size; i_voxel.z++) 
+  for (i_voxel.z = voxel.z-area_size; i_voxel.z <= voxel.z+area_size; i_voxel.z++) {
+    j_voxel.z = i_voxel.z-patch_start.z;
+#endif
+    for (i_voxel.y = voxel.y-area_size; i_voxel.y <= voxel.y+area_size; i_voxel.y++) {
+      j_voxel.y = i_voxel.y-patch_start.y;
+      for (i_voxel.x = voxel.x-area_size; i_voxel.x <= voxel.x+area_size; i_voxel.x++) {
+	j_voxel.x = i_voxel.x-patch_start.x;
+	if (amitk_raw_data_includes_voxel(patch, j_voxel))
+	  AMITK_RAW_DATA_UBYTE_SET_CONTENT(patch,j_voxel) = erase ? 0 : 1;
+      }
+    }
+#if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
+  }
 #endif
-    for (i_voxel.y = voxel.y-area_size; i_voxel.y <= voxel.y+area_size; i_voxel.y++) 
-      for (i_voxel.x = voxel.x-area_size; i_voxel.x <= voxel.x+area_size; i_voxel.x++) 
-	if (erase) {
-	  if (amitk_raw_data_includes_voxel(roi->map_data, i_voxel))
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data,i_voxel)=0;
-	} else {
-	  if (amitk_raw_data_includes_voxel(roi->map_data, i_voxel))
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data,i_voxel)=1;
-	}
 
   /* re edge the neighboring points */
 #if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
-  for (i_voxel.z = voxel.z-1-area_size; i_voxel.z <= voxel.z+1+area_size; i_voxel.z++) 
+  for (i_voxel.z = voxel.z-1-area_size; i_voxel.z <= voxel.z+1+area_size; i_voxel.z++) {
+    j_voxel.z = i_voxel.z-patch_start.z;
+#endif
+    for (i_voxel.y = voxel.y-1-area_size; i_voxel.y <= voxel.y+1+area_size; i_voxel.y++) {
+      j_voxel.y = i_voxel.y-patch_start.y;
+      for (i_voxel.x = voxel.x-1-area_size; i_voxel.x <= voxel.x+1+area_size; i_voxel.x++) {
+	j_voxel.x = i_voxel.x-patch_start.x;
+	if (amitk_raw_data_includes_voxel(patch, j_voxel)) 
+	  if (AMITK_RAW_DATA_UBYTE_CONTENT(patch, j_voxel)) 
+	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(patch, j_voxel) =
+	      map_roi_edge(patch, j_voxel);
+      }
+    }
+#if defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_3D)
+  }
 #endif
-    for (i_voxel.y = voxel.y-1-area_size; i_voxel.y <= voxel.y+1+area_size; i_voxel.y++) 
-      for (i_voxel.x = voxel.x-1-area_size; i_voxel.x <= voxel.x+1+area_size; i_voxel.x++) 
-	if (amitk_raw_data_includes_voxel(roi->map_data, i_voxel)) 
-  	  if (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, i_voxel)) 
-	    AMITK_RAW_DATA_UBYTE_SET_CONTENT(roi->map_data, i_voxel) =
-	      map_roi_edge(roi->map_data, i_voxel);
+
+  /* the rest of the map comes over from the old runs */
+  amitk_roi_set_map_runs(roi, amitk_roi_runs_splice(runs, offset, new_dim, patch, patch_start));
+  g_object_unref(patch);
+
+  if (dim_changed) {
+    /* shift the offset to account for the large ROI */
+    POINT_MULT(offset, roi->voxel_size, new_offset);
+    new_offset = point_cmult(-(1.0+EPSILON), new_offset);
+    new_offset = amitk_space_s2b(AMITK_SPACE(roi), new_offset);
+    amitk_space_set_offset(AMITK_SPACE(roi), new_offset);
+    amitk_roi_calc_far_corner(roi);
+  }
 
   return;
 }
@@ -778,24 +918,32 @@ if (dim_changed) {
 
 void amitk_roi_`'m4_Variable_Type`'_calc_center_of_mass(AmitkRoi * roi) {
 
-  AmitkVoxel i_voxel;
+  AmitkRoiRuns * runs;
+  const AmitkRoiRun * run;
+  amide_intpoint_t z, y;
+  guint i_run;
   guint voxels=0;
   AmitkPoint center_of_mass;
   AmitkPoint roi_voxel_size;
-  AmitkPoint current_point;
 
   roi_voxel_size = AMITK_ROI_VOXEL_SIZE(roi);
   center_of_mass = zero_point;
 
-  i_voxel.t = i_voxel.g = 0;
-  for (i_voxel.z=0; i_voxel.z<roi->map_data->dim.z; i_voxel.z++)
-    for (i_voxel.y=0; i_voxel.y<roi->map_data->dim.y; i_voxel.y++) 
-      for (i_voxel.x=0; i_voxel.x<roi->map_data->dim.x; i_voxel.x++) 
-	if (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, i_voxel)) {
-	  voxels++;
-	  VOXEL_TO_POINT(i_voxel, roi_voxel_size, current_point);
-	  POINT_ADD(current_point, center_of_mass, center_of_mass);
-	}
+  if ((runs = amitk_roi_get_runs(roi)) == NULL)
+    return;
+
+  /* the voxel centers along a run add up to length*(x+length/2) */
+  for (z=0; z<runs->dim.z; z++)
+    for (y=0; y<runs->dim.y; y++) 
+      for (i_run = AMITK_ROI_RUNS_ROW_START(runs, z, y); i_run < AMITK_ROI_RUNS_ROW_END(runs, z, y); i_run++) {
+	run = &(runs->runs[i_run]);
+	voxels += run->length;
+	center_of_mass.x += run->length*(run->x+0.5*run->length)*roi_voxel_size.x;
+	center_of_mass.y += run->length*(y+0.5)*roi_voxel_size.y;
+	center_of_mass.z += run->length*(z+0.5)*roi_voxel_size.z;
+      }
+
+  amitk_roi_runs_unref(runs);
 
   roi->center_of_mass = point_cmult(1.0/((gdouble) voxels), center_of_mass);
   roi->center_of_mass_calculated=TRUE;
@@ -811,21 +959,15 @@ void amitk_roi_`'m4_Variable_Type`'_calc_center_of_mass(AmitkRoi * roi) {
 
 
 
-/* iterates over the voxels in the given data set that are inside the given roi,
-   and performs the specified calculation function for those points */
-/* calulation should be a function taking the following arguments:
-   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
-void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi * roi,  
-							       const AmitkDataSet * ds, 
-							       const guint frame,
-							       const guint gate,
-							       const gboolean inverse,
-							       void (* calculation)(),
-							       gpointer data) {
+/* fills in the mask with the voxels of the given data set's grid that are 
+   inside the given roi, along with the fraction of each voxel that's in.
+   The voxels are added in order, x fastest */
+void amitk_roi_`'m4_Variable_Type`'_calculate_mask_fast(const AmitkRoi * roi,  
+							 const AmitkDataSet * ds, 
+							 AmitkRoiMask * mask) {
 
   AmitkPoint roi_pt_corner, roi_pt_center, fine_roi_pt;
   AmitkPoint fine_ds_pt, far_ds_pt, center_ds_pt;
-  amide_data_t value;
   amide_real_t voxel_fraction;
   AmitkVoxel i,j, k;
   AmitkVoxel start, dim, ds_dim;
@@ -857,8 +999,20 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
   AmitkPoint roi_voxel_size;
   AmitkVoxel roi_voxel;
+  const AmitkRoiRuns * runs;
+  AmitkRoiRunsCursor corner_cursor, center_cursor;
+  AmitkRoiRunsCursor fine_cursor[AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY];
+  gint i_cursor;
 
   roi_voxel_size = AMITK_ROI_VOXEL_SIZE(roi);
+  runs = roi->map_runs; /* amitk_roi_get_mask holds the masks mutex, so these stay put */
+  g_return_if_fail(runs != NULL);
+
+  /* successive lookups with the same cursor mostly fall in the same row */
+  AMITK_ROI_RUNS_CURSOR_RESET(corner_cursor);
+  AMITK_ROI_RUNS_CURSOR_RESET(center_cursor);
+  for (i_cursor=0; i_cursor < AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY; i_cursor++)
+    AMITK_ROI_RUNS_CURSOR_RESET(fine_cursor[i_cursor]);
 #endif
 
   ds_voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
@@ -868,20 +1022,15 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
   grain_size = 1.0/(AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY);
 
   /* figure out the intersection between the data set and the roi */
-  if (inverse) {
+  if (!amitk_volume_volume_intersection_corners(AMITK_VOLUME(ds),  AMITK_VOLUME(roi), 
+						intersection_corners)) {
+    dim = zero_voxel; /* no intersection */
     start = zero_voxel;
-    dim = ds_dim;
   } else {
-    if (!amitk_volume_volume_intersection_corners(AMITK_VOLUME(ds),  AMITK_VOLUME(roi), 
-						  intersection_corners)) {
-      dim = zero_voxel; /* no intersection */
-      start = zero_voxel;
-    } else {
-      /* translate the intersection into voxel space */
-      POINT_TO_VOXEL(intersection_corners[0], ds_voxel_size, 0, 0, start);
-      POINT_TO_VOXEL(intersection_corners[1], ds_voxel_size, 0, 0, dim);
-      dim = voxel_add(voxel_sub(dim, start), one_voxel);
-    }
+    /* translate the intersection into voxel space */
+    POINT_TO_VOXEL(intersection_corners[0], ds_voxel_size, 0, 0, start);
+    POINT_TO_VOXEL(intersection_corners[1], ds_voxel_size, 0, 0, dim);
+    dim = voxel_add(voxel_sub(dim, start), one_voxel);
   }
 
   /* check if we're done already */
@@ -919,8 +1068,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
   next_plane_in = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, dim.y+1, dim.x+1);
   curr_plane_in = amitk_raw_data_new_2D_with_data0(AMITK_FORMAT_UBYTE, dim.y+1, dim.x+1);
 
-  j.t = frame;
-  j.g = gate;
+  j.t = j.g = 0;
   i.t = k.t = i.g = k.g = 0;
   for (i.z = 0; i.z < dim.z; i.z++) {
     j.z = i.z+start.z;
@@ -958,11 +1106,9 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 #endif
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
 	POINT_TO_VOXEL(roi_pt_corner, roi_voxel_size, 0, 0,roi_voxel);
-	corner_in = (amitk_raw_data_includes_voxel(roi->map_data, roi_voxel) &&
-		     (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, roi_voxel) != 0));
+	corner_in = (amitk_roi_runs_get_value(runs, roi_voxel, &corner_cursor) != 0);
 	POINT_TO_VOXEL(roi_pt_center, roi_voxel_size, 0, 0,roi_voxel);
-	center_in = (amitk_raw_data_includes_voxel(roi->map_data, roi_voxel) &&
-		     (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, roi_voxel) != 0));
+	center_in = (amitk_roi_runs_get_value(runs, roi_voxel, &center_cursor) != 0);
 #endif
 
 	AMITK_RAW_DATA_UBYTE_2D_SET_CONTENT(next_plane_in,i.y+1,i.x+1)=corner_in;
@@ -977,11 +1123,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 	    AMITK_RAW_DATA_UBYTE_2D_CONTENT(next_plane_in,i.y+1,i.x+1) &&
 	    center_in) {
 	  /* this voxel is entirely in the ROI */
-
-	  if (!inverse) {
-	    value = amitk_data_set_get_value(ds,j);
-	    (*calculation)(j, value, 1.0, data);
-	  }
+	  amitk_roi_mask_add_voxel(mask, j, 1.0);
 
 	} else if (AMITK_RAW_DATA_UBYTE_2D_CONTENT(curr_plane_in,i.y,i.x) ||
 		   AMITK_RAW_DATA_UBYTE_2D_CONTENT(curr_plane_in,i.y,i.x+1) ||
@@ -995,7 +1137,6 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 		   small_dimensions) {
 	  /* this voxel is partially in the ROI, will need to do subvoxel analysis */
 
-	  value = amitk_data_set_get_value(ds,j);
 	  voxel_fraction=0;
 
 	  for (k.z = 0;k.z<AMITK_ROI_GRANULARITY;k.z++) {
@@ -1021,26 +1162,17 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 #endif
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
 		POINT_TO_VOXEL(fine_roi_pt, roi_voxel_size, 0, 0, roi_voxel);
-		if (amitk_raw_data_includes_voxel(roi->map_data, roi_voxel) &&
-		    (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, roi_voxel) != 0))
+		if (amitk_roi_runs_get_value(runs, roi_voxel, 
+					     &fine_cursor[k.z*AMITK_ROI_GRANULARITY+k.y]) != 0)
 		  voxel_fraction += grain_size;
 #endif
 	      } /* k.x loop */
 	    } /* k.y loop */
 	  } /* k.z loop */
 
-	  if (!inverse) {
-	    (*calculation)(j, value, voxel_fraction, data);
-	  } else {
-	    (*calculation)(j, value, 1.0-voxel_fraction, data);
-	  }
+	  amitk_roi_mask_add_voxel(mask, j, voxel_fraction);
 
-	} else { /* this voxel is outside the ROI */
-	  if (inverse) {
-	    value = amitk_data_set_get_value(ds,j);
-	    (*calculation)(j, value, 1.0, data);
-	  }
-	}
+	} /* else this voxel is outside the ROI */
       } /* i.x loop */
     } /* i.y loop */
     
@@ -1060,20 +1192,13 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi *
 }
 
 
-/* iterates over the voxels in the given data set that are inside the given roi,
-   and performs the specified calculation function for those points */
-/* calulation should be a function taking the following arguments:
-   calculation(AmitkVoxel dataset_voxel, amide_data_t value, amide_real_t voxel_fraction, gpointer data) */
-void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRoi * roi,  
-								   const AmitkDataSet * ds, 
-								   const guint frame,
-								   const guint gate,
-								   const gboolean inverse,
-								   void (* calculation)(),
-								   gpointer data) {
+/* as amitk_roi_`'m4_Variable_Type`'_calculate_mask_fast, but does the subvoxel
+   analysis for every voxel in the intersection */
+void amitk_roi_`'m4_Variable_Type`'_calculate_mask_accurate(const AmitkRoi * roi,  
+							     const AmitkDataSet * ds, 
+							     AmitkRoiMask * mask) {
 
   AmitkPoint fine_roi_pt, fine_ds_pt;
-  amide_data_t value;
   amide_real_t voxel_fraction;
   AmitkVoxel j, k;
   AmitkVoxel start, end, ds_dim;
@@ -1101,8 +1226,17 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
   AmitkPoint roi_voxel_size;
   AmitkVoxel roi_voxel;
+  const AmitkRoiRuns * runs;
+  AmitkRoiRunsCursor fine_cursor[AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY];
+  gint i_cursor;
 
   roi_voxel_size = AMITK_ROI_VOXEL_SIZE(roi);
+  runs = roi->map_runs; /* amitk_roi_get_mask holds the masks mutex, so these stay put */
+  g_return_if_fail(runs != NULL);
+
+  /* a cursor per line of subvoxels, each of which steps along x */
+  for (i_cursor=0; i_cursor < AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY; i_cursor++)
+    AMITK_ROI_RUNS_CURSOR_RESET(fine_cursor[i_cursor]);
 #endif
 
   ds_voxel_size = AMITK_DATA_SET_VOXEL_SIZE(ds);
@@ -1112,19 +1246,14 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
   grain_size = 1.0/(AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY*AMITK_ROI_GRANULARITY);
 
   /* figure out the intersection between the data set and the roi */
-  if (inverse) {
-    start = zero_voxel;
-    end = voxel_sub(ds_dim, one_voxel);
+  if (!amitk_volume_volume_intersection_corners(AMITK_VOLUME(ds),  AMITK_VOLUME(roi), 
+						intersection_corners)) {
+    end = zero_voxel; /* no intersection */
+    start = one_voxel;
   } else {
-    if (!amitk_volume_volume_intersection_corners(AMITK_VOLUME(ds),  AMITK_VOLUME(roi), 
-						  intersection_corners)) {
-      end = zero_voxel; /* no intersection */
-      start = one_voxel;
-    } else {
-      /* translate the intersection into voxel space */
-      POINT_TO_VOXEL(intersection_corners[0], ds_voxel_size, 0, 0, start);
-      POINT_TO_VOXEL(intersection_corners[1], ds_voxel_size, 0, 0, end);
-    }
+    /* translate the intersection into voxel space */
+    POINT_TO_VOXEL(intersection_corners[0], ds_voxel_size, 0, 0, start);
+    POINT_TO_VOXEL(intersection_corners[1], ds_voxel_size, 0, 0, end);
   }
 
   /* check if we're done already */
@@ -1142,15 +1271,13 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
   /* start and end specify (in the data set's voxel space) the voxels in 
      the volume we should be iterating over */
 
-  j.t = frame;
-  j.g = gate;
+  j.t = j.g = 0;
   k.t = k.g = 0;
 
   for (j.z = start.z; j.z <= end.z; j.z++) {
     for (j.y = start.y; j.y <= end.y; j.y++) {
       for (j.x = start.x; j.x <= end.x; j.x++) {
 
-	value = amitk_data_set_get_value(ds,j);
 	voxel_fraction=0;
 
 	for (k.z = 0;k.z<AMITK_ROI_GRANULARITY;k.z++) {
@@ -1177,8 +1304,8 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
 #endif
 #if defined(ROI_TYPE_ISOCONTOUR_2D) || defined(ROI_TYPE_ISOCONTOUR_3D) || defined(ROI_TYPE_FREEHAND_2D) || defined(ROI_TYPE_FREEHAND_3D)
 	      POINT_TO_VOXEL(fine_roi_pt, roi_voxel_size, 0, 0, roi_voxel);
-	      if (amitk_raw_data_includes_voxel(roi->map_data, roi_voxel) &&
-		  (AMITK_RAW_DATA_UBYTE_CONTENT(roi->map_data, roi_voxel) != 0)) 
+	      if (amitk_roi_runs_get_value(runs, roi_voxel,
+					   &fine_cursor[k.z*AMITK_ROI_GRANULARITY+k.y]) != 0)
 		voxel_fraction+=grain_size;
 #endif
 	      fine_ds_pt.x += sub_voxel_size.x;
@@ -1186,15 +1313,7 @@ void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRo
 	  } /* k.y loop */
 	} /* k.z loop */
 
-	if (!inverse) {
-	  if (voxel_fraction > 0.0) {
-	    (*calculation)(j, value, voxel_fraction, data);
-	  }
-	} else {
-	  if (voxel_fraction < 1.0) {
-	    (*calculation)(j, value, 1.0-voxel_fraction, data);
-	  }
-	}
+	amitk_roi_mask_add_voxel(mask, j, voxel_fraction);
       } /* i.x loop */
     } /* i.y loop */
   } /* i.z loop */
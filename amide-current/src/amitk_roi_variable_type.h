@@ -59,21 +59,12 @@ void amitk_roi_`'m4_Variable_Type`'_manipulate_area(AmitkRoi * roi, gboolean era
 void amitk_roi_`'m4_Variable_Type`'_calc_center_of_mass(AmitkRoi * roi);
 #endif
 
-void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_fast(const AmitkRoi * roi,  
-							       const AmitkDataSet * ds, 
-							       const guint frame,
-							       const guint gate,
-							       const gboolean inverse,
-							       void (*calculation)(),
-							       gpointer data);
-void amitk_roi_`'m4_Variable_Type`'_calculate_on_data_set_accurate(const AmitkRoi * roi,  
-								   const AmitkDataSet * ds, 
-								   const guint frame,
-								   const guint gate,
-								   const gboolean inverse,
-								   void (*calculation)(),
-								   gpointer data);
-
+void amitk_roi_`'m4_Variable_Type`'_calculate_mask_fast(const AmitkRoi * roi,  
+							 const AmitkDataSet * ds, 
+							 AmitkRoiMask * mask);
+void amitk_roi_`'m4_Variable_Type`'_calculate_mask_accurate(const AmitkRoi * roi,  
+							     const AmitkDataSet * ds, 
+							     AmitkRoiMask * mask);
 
 #undef ROI_TYPE_`'m4_Variable_Type`'
 
@@ -0,0 +1,668 @@
+/* amitk_slice_cache.c - a cache of recently generated slices
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#include "amide_config.h"
+#include <math.h>
+#include "amitk_slice_cache.h"
+
+/* offsets and times get rounded to this before hashing.  Keys that are
+   equal (within EPSILON) but land on different sides of a rounding boundary 
+   just end up as a cache miss */
+#define HASH_RESOLUTION 1.0e-3
+
+/* everything that identifies a slice */
+typedef struct {
+  const AmitkDataSet * parent;
+  AmitkPoint offset;
+  AmitkAxes axes;
+  amide_time_t start;
+  amide_time_t duration;
+  amide_intpoint_t start_gate;
+  amide_intpoint_t end_gate;
+  amide_real_t thickness;
+  AmitkVoxel dim;
+  AmitkInterpolation interpolation;
+  AmitkRendering rendering;
+} slice_key_t;
+
+typedef struct {
+  slice_key_t key;
+  AmitkDataSet * slice;
+  gsize size;
+  GList link; /* position in the lru queue, most recently used at the head */
+  GList parent_link; /* position in the parent's queue in the parents table */
+} slice_entry_t;
+
+/* a requester (canvas, series, etc.) that's prefetching slices */
+typedef struct {
+  guint generation; /* unique per batch of requests, a cancel starts a new batch */
+  gsize size; /* bytes prefetched in this batch */
+} prefetch_owner_t;
+
+/* one position to prefetch slices for */
+typedef struct {
+  AmitkSliceCache * slice_cache;
+  gconstpointer owner;
+  guint owner_generation;
+  guint generation;
+  GList * data_sets;
+  amide_time_t start;
+  amide_time_t duration;
+  amide_intpoint_t gate;
+  AmitkCanvasPoint pixel_size;
+  AmitkVolume * view_volume;
+} prefetch_item_t;
+
+struct _AmitkSliceCache {
+  GHashTable * table; /* slice_key_t -> slice_entry_t */
+  GHashTable * parents; /* parent data set -> GQueue of its slice_entry_t's */
+  GQueue lru;
+  gsize size;
+  gsize max_size;
+  guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+  guint64 prefetched;
+
+  /* prefetching */
+  GThreadPool * prefetch_pool;
+  GHashTable * prefetch_owners; /* owner -> prefetch_owner_t */
+  GHashTable * prefetch_parents; /* data set -> number of queued items using it */
+  guint next_owner_generation;
+  guint generation; /* bumped when slices of a data set being prefetched are invalidated */
+
+  GMutex mutex;
+};
+
+
+static AmitkSliceCache * default_slice_cache = NULL;
+G_LOCK_DEFINE_STATIC(default_slice_cache);
+
+
+
+static guint hash_real(const amide_real_t value) {
+
+  gint64 rounded;
+
+  rounded = (gint64) floor(value/HASH_RESOLUTION+0.5);
+
+  return (guint) (rounded ^ (rounded >> 32));
+}
+
+static guint slice_key_hash(gconstpointer data) {
+
+  const slice_key_t * key = data;
+  guint hash;
+
+  hash = g_direct_hash(key->parent);
+  hash = hash*31 + hash_real(key->offset.x);
+  hash = hash*31 + hash_real(key->offset.y);
+  hash = hash*31 + hash_real(key->offset.z);
+  hash = hash*31 + hash_real(key->start);
+  hash = hash*31 + key->start_gate;
+  hash = hash*31 + key->end_gate;
+  hash = hash*31 + key->dim.x;
+  hash = hash*31 + key->dim.y;
+  hash = hash*31 + key->interpolation;
+  hash = hash*31 + key->rendering;
+
+  return hash;
+}
+
+/* same comparisons as the old list based cache used */
+static gboolean slice_key_equal(gconstpointer data1, gconstpointer data2) {
+
+  const slice_key_t * key1 = data1;
+  const slice_key_t * key2 = data2;
+  AmitkAxis i_axis;
+
+  if (key1->parent != key2->parent) return FALSE;
+  if (key1->start_gate != key2->start_gate) return FALSE;
+  if (key1->end_gate != key2->end_gate) return FALSE;
+  if (!VOXEL_EQUAL(key1->dim, key2->dim)) return FALSE;
+  if (key1->interpolation != key2->interpolation) return FALSE;
+  if (key1->rendering != key2->rendering) return FALSE;
+  if (!REAL_EQUAL(key1->start, key2->start)) return FALSE;
+  if (!REAL_EQUAL(key1->duration, key2->duration)) return FALSE;
+  if (!REAL_EQUAL(key1->thickness, key2->thickness)) return FALSE;
+  if (!POINT_EQUAL(key1->offset, key2->offset)) return FALSE;
+  for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+    if (!POINT_EQUAL(key1->axes[i_axis], key2->axes[i_axis])) return FALSE;
+
+  return TRUE;
+}
+
+static gsize slice_size(const AmitkVoxel dim) {
+  return sizeof(AmitkDataSet) + dim.x*dim.y*sizeof(amitk_format_DOUBLE_t);
+}
+
+static void slice_key_init(slice_key_t * key, 
+			   const AmitkDataSet * parent_ds,
+			   const amide_time_t start,
+			   const amide_time_t duration,
+			   const amide_intpoint_t gate,
+			   const AmitkCanvasPoint pixel_size,
+			   const AmitkVolume * view_volume) {
+
+  AmitkAxis i_axis;
+
+  key->parent = parent_ds;
+  key->offset = AMITK_SPACE_OFFSET(view_volume);
+  for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++)
+    key->axes[i_axis] = AMITK_SPACE_AXES(view_volume)[i_axis];
+  key->start = start;
+  key->duration = duration;
+  if (gate < 0) {
+    key->start_gate = AMITK_DATA_SET_VIEW_START_GATE(parent_ds);
+    key->end_gate = AMITK_DATA_SET_VIEW_END_GATE(parent_ds);
+  } else {
+    key->start_gate = gate;
+    key->end_gate = gate;
+  }
+  key->thickness = AMITK_VOLUME_Z_CORNER(view_volume);
+  /* same as what amitk_data_set_get_slice will produce */
+  key->dim.x = ceil(fabs(AMITK_VOLUME_X_CORNER(view_volume))/pixel_size.x);
+  key->dim.y = ceil(fabs(AMITK_VOLUME_Y_CORNER(view_volume))/pixel_size.y);
+  key->dim.z = key->dim.g = key->dim.t = 1;
+  key->interpolation = AMITK_DATA_SET_INTERPOLATION(parent_ds);
+  key->rendering = AMITK_DATA_SET_RENDERING(parent_ds);
+
+  return;
+}
+
+/* removes the entry from the cache, needs to be called with the mutex held.
+   The slice is returned rather than unref'ed, as dropping the last reference
+   to a slice can end up calling back into the cache (from the data set's finalize) */
+static AmitkDataSet * slice_cache_remove_entry(AmitkSliceCache * slice_cache, slice_entry_t * entry) {
+
+  AmitkDataSet * slice;
+  GQueue * parent_queue;
+
+  g_hash_table_remove(slice_cache->table, &(entry->key));
+  g_queue_unlink(&(slice_cache->lru), &(entry->link));
+  parent_queue = g_hash_table_lookup(slice_cache->parents, entry->key.parent);
+  g_queue_unlink(parent_queue, &(entry->parent_link));
+  if (g_queue_is_empty(parent_queue)) {
+    g_hash_table_remove(slice_cache->parents, entry->key.parent);
+    g_queue_free(parent_queue);
+  }
+  slice_cache->size -= entry->size;
+  slice = entry->slice;
+  g_free(entry);
+
+  return slice;
+}
+
+/* evict least recently used slices until we're within budget, needs to be
+   called with the mutex held.  returns the list of slices to unref */
+static GList * slice_cache_trim(AmitkSliceCache * slice_cache, GList * removed) {
+
+  while ((slice_cache->size > slice_cache->max_size) && (slice_cache->lru.tail != NULL)) {
+    removed = g_list_prepend(removed, slice_cache_remove_entry(slice_cache, slice_cache->lru.tail->data));
+    slice_cache->evictions++;
+  }
+
+  return removed;
+}
+
+static slice_entry_t * slice_entry_new(AmitkDataSet * slice,
+				       const amide_intpoint_t gate,
+				       const AmitkCanvasPoint pixel_size,
+				       const AmitkVolume * view_volume) {
+
+  slice_entry_t * entry;
+
+  entry = g_new0(slice_entry_t, 1);
+  slice_key_init(&(entry->key), AMITK_DATA_SET_SLICE_PARENT(slice), 
+		 AMITK_DATA_SET_SCAN_START(slice), 
+		 amitk_data_set_get_frame_duration(slice, 0),
+		 gate, pixel_size, view_volume);
+  entry->slice = amitk_object_ref(slice);
+  entry->size = slice_size(AMITK_DATA_SET_DIM(slice));
+  entry->link.data = entry;
+  entry->parent_link.data = entry;
+
+  return entry;
+}
+
+/* puts the entry at the head of the cache, replacing anything that was already
+   there. needs to be called with the mutex held, returns the list of slices to unref */
+static GList * slice_cache_add_entry(AmitkSliceCache * slice_cache, slice_entry_t * entry, GList * removed) {
+
+  slice_entry_t * old_entry;
+  GQueue * parent_queue;
+
+  old_entry = g_hash_table_lookup(slice_cache->table, &(entry->key));
+  if (old_entry != NULL)
+    removed = g_list_prepend(removed, slice_cache_remove_entry(slice_cache, old_entry));
+
+  g_hash_table_insert(slice_cache->table, &(entry->key), entry);
+  g_queue_push_head_link(&(slice_cache->lru), &(entry->link));
+  parent_queue = g_hash_table_lookup(slice_cache->parents, entry->key.parent);
+  if (parent_queue == NULL) {
+    parent_queue = g_queue_new();
+    g_hash_table_insert(slice_cache->parents, (gpointer) entry->key.parent, parent_queue);
+  }
+  g_queue_push_head_link(parent_queue, &(entry->parent_link));
+  slice_cache->size += entry->size;
+
+  return slice_cache_trim(slice_cache, removed);
+}
+
+/* whether the item hasn't been cancelled or invalidated, needs to be called with the mutex held */
+static prefetch_owner_t * prefetch_item_current(prefetch_item_t * item) {
+
+  prefetch_owner_t * owner;
+
+  if (item->generation != item->slice_cache->generation) return NULL;
+  owner = g_hash_table_lookup(item->slice_cache->prefetch_owners, item->owner);
+  if (owner == NULL) return NULL;
+  if (owner->generation != item->owner_generation) return NULL;
+
+  return owner;
+}
+
+/* the last reference to a data set might be ours, so these get
+   released back in the main loop instead of on the prefetch thread */
+static gboolean prefetch_item_free(gpointer data) {
+
+  prefetch_item_t * item = data;
+
+  amitk_objects_unref(item->data_sets);
+  amitk_object_unref(item->view_volume);
+  g_free(item);
+
+  return FALSE;
+}
+
+static void prefetch_func(gpointer data, gpointer user_data) {
+
+  prefetch_item_t * item = data;
+  AmitkSliceCache * slice_cache = user_data;
+  prefetch_owner_t * owner;
+  GList * data_sets;
+  AmitkDataSet * parent_ds;
+  AmitkDataSet * slice;
+  slice_key_t key;
+  slice_entry_t * entry;
+  GList * removed;
+  gboolean wanted;
+  gint count;
+
+  for (data_sets = item->data_sets; data_sets != NULL; data_sets = data_sets->next) {
+    parent_ds = AMITK_DATA_SET(data_sets->data);
+    slice_key_init(&key, parent_ds, item->start, item->duration, 
+		   item->gate, item->pixel_size, item->view_volume);
+
+    /* skip slices we already have, and stop if cancelled or over budget */
+    g_mutex_lock(&(slice_cache->mutex));
+    owner = prefetch_item_current(item);
+    if (owner == NULL) 
+      wanted = FALSE;
+    else if (owner->size + slice_size(key.dim) > 
+	     AMITK_SLICE_CACHE_PREFETCH_FRACTION*slice_cache->max_size)
+      wanted = FALSE;
+    else
+      wanted = (g_hash_table_lookup(slice_cache->table, &key) == NULL);
+    g_mutex_unlock(&(slice_cache->mutex));
+    if (!wanted) continue;
+
+    /* the main loop can't change the data or scaling while we're reading it */
+    amitk_data_set_read_lock(parent_ds);
+    slice = amitk_data_set_get_slice(parent_ds, item->start, item->duration, 
+				     item->gate, item->pixel_size, item->view_volume);
+    amitk_data_set_read_unlock(parent_ds);
+    if (slice == NULL) continue;
+
+    /* the view or the data may have changed while we were working */
+    entry = slice_entry_new(slice, item->gate, item->pixel_size, item->view_volume);
+    removed = NULL;
+    g_mutex_lock(&(slice_cache->mutex));
+    owner = prefetch_item_current(item);
+    if ((owner != NULL) && (g_hash_table_lookup(slice_cache->table, &(entry->key)) == NULL)) {
+      owner->size += entry->size;
+      slice_cache->prefetched++;
+      removed = slice_cache_add_entry(slice_cache, entry, removed);
+      entry = NULL;
+    }
+    g_mutex_unlock(&(slice_cache->mutex));
+
+    if (entry != NULL) {
+      removed = g_list_prepend(removed, entry->slice);
+      g_free(entry);
+    }
+    removed = g_list_prepend(removed, slice);
+    amitk_objects_unref(removed);
+  }
+
+  g_mutex_lock(&(slice_cache->mutex));
+  for (data_sets = item->data_sets; data_sets != NULL; data_sets = data_sets->next) {
+    count = GPOINTER_TO_INT(g_hash_table_lookup(slice_cache->prefetch_parents, data_sets->data))-1;
+    if (count > 0)
+      g_hash_table_insert(slice_cache->prefetch_parents, data_sets->data, GINT_TO_POINTER(count));
+    else
+      g_hash_table_remove(slice_cache->prefetch_parents, data_sets->data);
+  }
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  g_idle_add(prefetch_item_free, item);
+
+  return;
+}
+
+
+
+/* max_size is in bytes */
+AmitkSliceCache * amitk_slice_cache_new(const gsize max_size) {
+
+  AmitkSliceCache * slice_cache;
+
+  slice_cache = g_new0(AmitkSliceCache, 1);
+  slice_cache->table = g_hash_table_new(slice_key_hash, slice_key_equal);
+  slice_cache->parents = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&(slice_cache->lru));
+  slice_cache->max_size = max_size;
+  slice_cache->prefetch_owners = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  slice_cache->prefetch_parents = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_mutex_init(&(slice_cache->mutex));
+
+  return slice_cache;
+}
+
+void amitk_slice_cache_free(AmitkSliceCache * slice_cache) {
+
+  g_return_if_fail(slice_cache != NULL);
+
+  /* cancel everything, and wait for what's already queued to drain */
+  if (slice_cache->prefetch_pool != NULL) {
+    g_mutex_lock(&(slice_cache->mutex));
+    g_hash_table_remove_all(slice_cache->prefetch_owners);
+    g_mutex_unlock(&(slice_cache->mutex));
+    g_thread_pool_free(slice_cache->prefetch_pool, FALSE, TRUE);
+  }
+
+  amitk_slice_cache_clear(slice_cache);
+  g_hash_table_destroy(slice_cache->table);
+  g_hash_table_destroy(slice_cache->parents);
+  g_hash_table_destroy(slice_cache->prefetch_owners);
+  g_hash_table_destroy(slice_cache->prefetch_parents);
+  g_mutex_clear(&(slice_cache->mutex));
+  g_free(slice_cache);
+
+  return;
+}
+
+/* the cache shared by the canvases, series, etc. */
+AmitkSliceCache * amitk_slice_cache_get_default(void) {
+
+  AmitkSliceCache * slice_cache;
+
+  G_LOCK(default_slice_cache);
+  if (default_slice_cache == NULL)
+    default_slice_cache = amitk_slice_cache_new(((gsize) AMITK_SLICE_CACHE_DEFAULT_MAX_SIZE) << 20);
+  slice_cache = default_slice_cache;
+  G_UNLOCK(default_slice_cache);
+
+  return slice_cache;
+}
+
+/* max_size is in bytes */
+void amitk_slice_cache_set_max_size(AmitkSliceCache * slice_cache, const gsize max_size) {
+
+  GList * removed;
+
+  g_return_if_fail(slice_cache != NULL);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  slice_cache->max_size = max_size;
+  removed = slice_cache_trim(slice_cache, NULL);
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  amitk_objects_unref(removed);
+
+  return;
+}
+
+/* several things cause slices in the cache to get invalidated (and removed
+   with amitk_slice_cache_remove_with_parent), so they don't need to be
+   explicitly checked here
+
+   1. Scale factor changes
+   2. The parent data set's space changing
+   3. The parent data set's voxel size changing
+   4. Any change to the raw data
+
+   returns a reference to the slice if found, NULL otherwise
+*/
+AmitkDataSet * amitk_slice_cache_lookup(AmitkSliceCache * slice_cache,
+					AmitkDataSet * parent_ds,
+					const amide_time_t start,
+					const amide_time_t duration,
+					const amide_intpoint_t gate,
+					const AmitkCanvasPoint pixel_size,
+					const AmitkVolume * view_volume) {
+
+  slice_key_t key;
+  slice_entry_t * entry;
+  AmitkDataSet * slice=NULL;
+
+  g_return_val_if_fail(slice_cache != NULL, NULL);
+  g_return_val_if_fail(AMITK_IS_DATA_SET(parent_ds), NULL);
+
+  slice_key_init(&key, parent_ds, start, duration, gate, pixel_size, view_volume);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  entry = g_hash_table_lookup(slice_cache->table, &key);
+  if (entry != NULL) {
+    /* move to the front of the line */
+    g_queue_unlink(&(slice_cache->lru), &(entry->link));
+    g_queue_push_head_link(&(slice_cache->lru), &(entry->link));
+    slice = amitk_object_ref(entry->slice);
+    slice_cache->hits++;
+  } else {
+    slice_cache->misses++;
+  }
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  return slice;
+}
+
+/* adds a slice generated with the given parameters to the cache, the
+   start/duration are taken from the slice itself */
+void amitk_slice_cache_insert(AmitkSliceCache * slice_cache,
+			      AmitkDataSet * slice,
+			      const amide_intpoint_t gate,
+			      const AmitkCanvasPoint pixel_size,
+			      const AmitkVolume * view_volume) {
+
+  slice_entry_t * entry;
+  GList * removed;
+
+  g_return_if_fail(slice_cache != NULL);
+  g_return_if_fail(AMITK_IS_DATA_SET(slice));
+  g_return_if_fail(AMITK_DATA_SET_SLICE_PARENT(slice) != NULL);
+
+  entry = slice_entry_new(slice, gate, pixel_size, view_volume);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  removed = slice_cache_add_entry(slice_cache, entry, NULL);
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  amitk_objects_unref(removed);
+
+  return;
+}
+
+/* removes all slices derived from the given data set.  Every data set calls
+   this when it's finalized, slices included, so this only looks at the
+   parent's own entries rather than walking the whole cache */
+void amitk_slice_cache_remove_with_parent(AmitkSliceCache * slice_cache,
+					  const AmitkDataSet * parent_ds) {
+
+  GQueue * parent_queue;
+  GList * removed=NULL;
+
+  g_return_if_fail(slice_cache != NULL);
+
+  g_mutex_lock(&(slice_cache->mutex));
+
+  /* anything being prefetched for this data set is now out of date */
+  if (g_hash_table_contains(slice_cache->prefetch_parents, parent_ds))
+    slice_cache->generation++;
+
+  /* the queue is freed along with its last entry */
+  while ((parent_queue = g_hash_table_lookup(slice_cache->parents, parent_ds)) != NULL)
+    removed = g_list_prepend(removed, slice_cache_remove_entry(slice_cache, parent_queue->head->data));
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  amitk_objects_unref(removed);
+
+  return;
+}
+
+void amitk_slice_cache_clear(AmitkSliceCache * slice_cache) {
+
+  GList * removed=NULL;
+
+  g_return_if_fail(slice_cache != NULL);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  slice_cache->generation++;
+  while (slice_cache->lru.head != NULL)
+    removed = g_list_prepend(removed, slice_cache_remove_entry(slice_cache, slice_cache->lru.head->data));
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  amitk_objects_unref(removed);
+
+  return;
+}
+
+void amitk_slice_cache_get_stats(AmitkSliceCache * slice_cache,
+				 AmitkSliceCacheStats * stats) {
+
+  g_return_if_fail(slice_cache != NULL);
+  g_return_if_fail(stats != NULL);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  stats->hits = slice_cache->hits;
+  stats->misses = slice_cache->misses;
+  stats->evictions = slice_cache->evictions;
+  stats->prefetched = slice_cache->prefetched;
+  stats->size = slice_cache->size;
+  stats->max_size = slice_cache->max_size;
+  stats->num_slices = g_hash_table_size(slice_cache->table);
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  return;
+}
+
+/* queues up generating the slices of the given data sets in the background,
+   so they'll be in the cache when asked for.  owner identifies who's asking,
+   and prefetching for an owner is stopped with amitk_slice_cache_cancel_prefetch.
+   Requests are handled in the order given. */
+void amitk_slice_cache_prefetch(AmitkSliceCache * slice_cache,
+				gconstpointer owner,
+				GList * objects,
+				const amide_time_t start,
+				const amide_time_t duration,
+				const amide_intpoint_t gate,
+				const AmitkCanvasPoint pixel_size,
+				const AmitkVolume * view_volume) {
+
+  prefetch_item_t * item;
+  prefetch_owner_t * prefetch_owner;
+  GError * error=NULL;
+  GList * data_sets;
+  gint count;
+
+  g_return_if_fail(slice_cache != NULL);
+  g_return_if_fail(AMITK_IS_VOLUME(view_volume));
+
+  item = g_new0(prefetch_item_t, 1);
+  item->slice_cache = slice_cache;
+  item->owner = owner;
+  item->start = start;
+  item->duration = duration;
+  item->gate = gate;
+  item->pixel_size = pixel_size;
+  item->view_volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(view_volume)));
+  for (; objects != NULL; objects = objects->next)
+    if (AMITK_IS_DATA_SET(objects->data))
+      item->data_sets = g_list_append(item->data_sets, amitk_object_ref(objects->data));
+
+  if (item->data_sets == NULL) {
+    prefetch_item_free(item);
+    return;
+  }
+
+  g_mutex_lock(&(slice_cache->mutex));
+
+  if (slice_cache->prefetch_pool == NULL) {
+    /* a single thread, the slice generation itself is already parallel */
+    slice_cache->prefetch_pool = g_thread_pool_new(prefetch_func, slice_cache, 1, FALSE, &error);
+    if (slice_cache->prefetch_pool == NULL) {
+      g_mutex_unlock(&(slice_cache->mutex));
+      g_warning(_("Could not start slice prefetching thread: %s"),
+		(error != NULL) ? error->message : "");
+      if (error != NULL) g_error_free(error);
+      prefetch_item_free(item);
+      return;
+    }
+  }
+
+  prefetch_owner = g_hash_table_lookup(slice_cache->prefetch_owners, owner);
+  if (prefetch_owner == NULL) {
+    prefetch_owner = g_new0(prefetch_owner_t, 1);
+    prefetch_owner->generation = ++slice_cache->next_owner_generation;
+    g_hash_table_insert(slice_cache->prefetch_owners, (gpointer) owner, prefetch_owner);
+  }
+  item->owner_generation = prefetch_owner->generation;
+  item->generation = slice_cache->generation;
+
+  for (data_sets = item->data_sets; data_sets != NULL; data_sets = data_sets->next) {
+    count = GPOINTER_TO_INT(g_hash_table_lookup(slice_cache->prefetch_parents, data_sets->data));
+    g_hash_table_insert(slice_cache->prefetch_parents, data_sets->data, GINT_TO_POINTER(count+1));
+  }
+
+  g_thread_pool_push(slice_cache->prefetch_pool, item, NULL);
+
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  return;
+}
+
+/* drops any prefetching still queued for the given owner, slices
+   already being generated are thrown away when done */
+void amitk_slice_cache_cancel_prefetch(AmitkSliceCache * slice_cache,
+				       gconstpointer owner) {
+
+  g_return_if_fail(slice_cache != NULL);
+
+  g_mutex_lock(&(slice_cache->mutex));
+  g_hash_table_remove(slice_cache->prefetch_owners, owner);
+  g_mutex_unlock(&(slice_cache->mutex));
+
+  return;
+}
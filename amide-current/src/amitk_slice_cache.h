@@ -0,0 +1,93 @@
+/* amitk_slice_cache.h
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+#ifndef __AMITK_SLICE_CACHE_H__
+#define __AMITK_SLICE_CACHE_H__
+
+/* header files that are always needed with this file */
+#include "amitk_data_set.h"
+
+G_BEGIN_DECLS
+
+/* AmitkSliceCache itself is declared in amitk_data_set.h */
+
+/* in megabytes */
+#define AMITK_SLICE_CACHE_DEFAULT_MAX_SIZE 128
+#define AMITK_SLICE_CACHE_MAX_MAX_SIZE 16384
+
+/* how many positions ahead of the current one the views prefetch */
+#define AMITK_SLICE_CACHE_PREFETCH_DEPTH 4
+
+/* the fraction of the cache a requester's prefetched slices can take up,
+   counted from the last time its prefetching was cancelled */
+#define AMITK_SLICE_CACHE_PREFETCH_FRACTION 0.25
+
+typedef struct _AmitkSliceCacheStats {
+  guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+  guint64 prefetched;
+  gsize size; /* bytes currently in use */
+  gsize max_size; /* in bytes */
+  guint num_slices;
+} AmitkSliceCacheStats;
+
+/* external functions */
+AmitkSliceCache * amitk_slice_cache_new                (const gsize max_size);
+void              amitk_slice_cache_free               (AmitkSliceCache * slice_cache);
+AmitkSliceCache * amitk_slice_cache_get_default        (void);
+void              amitk_slice_cache_set_max_size       (AmitkSliceCache * slice_cache,
+							const gsize max_size);
+AmitkDataSet *    amitk_slice_cache_lookup             (AmitkSliceCache * slice_cache,
+							AmitkDataSet * parent_ds,
+							const amide_time_t start,
+							const amide_time_t duration,
+							const amide_intpoint_t gate,
+							const AmitkCanvasPoint pixel_size,
+							const AmitkVolume * view_volume);
+void              amitk_slice_cache_insert             (AmitkSliceCache * slice_cache,
+							AmitkDataSet * slice,
+							const amide_intpoint_t gate,
+							const AmitkCanvasPoint pixel_size,
+							const AmitkVolume * view_volume);
+void              amitk_slice_cache_remove_with_parent (AmitkSliceCache * slice_cache,
+							const AmitkDataSet * parent_ds);
+void              amitk_slice_cache_clear              (AmitkSliceCache * slice_cache);
+void              amitk_slice_cache_get_stats          (AmitkSliceCache * slice_cache,
+							AmitkSliceCacheStats * stats);
+void              amitk_slice_cache_prefetch           (AmitkSliceCache * slice_cache,
+							gconstpointer owner,
+							GList * objects,
+							const amide_time_t start,
+							const amide_time_t duration,
+							const amide_intpoint_t gate,
+							const AmitkCanvasPoint pixel_size,
+							const AmitkVolume * view_volume);
+void              amitk_slice_cache_cancel_prefetch    (AmitkSliceCache * slice_cache,
+							gconstpointer owner);
+
+G_END_DECLS
+
+#endif /* __AMITK_SLICE_CACHE_H__ */
@@ -77,6 +77,7 @@ static void threshold_construct(AmitkThreshold * threshold, AmitkThresholdLayout
 static void threshold_add_data_set(AmitkThreshold * threshold, AmitkDataSet * ds);
 static void threshold_remove_data_set(AmitkThreshold * threshold);
 static gint threshold_visible_refs(AmitkDataSet * data_set);
+static gint threshold_histogram_frame(AmitkThreshold * threshold);
 static void threshold_update_histogram(AmitkThreshold * threshold);
 static void threshold_update_spin_buttons(AmitkThreshold * threshold);
 static void threshold_update_arrow(AmitkThreshold * threshold, AmitkThresholdArrow arrow);
@@ -183,6 +184,7 @@ static void threshold_init (AmitkThreshold *threshold)
       threshold->connector_line[i_ref][i_line] = NULL;
   }
   threshold->histogram_image = NULL;
+  threshold->histogram_frame = -1;
 
   if (threshold_cursor == NULL)
     threshold_cursor = gdk_cursor_new(GDK_SB_V_DOUBLE_ARROW);
@@ -690,6 +692,16 @@ static gint threshold_visible_refs(AmitkDataSet * data_set) {
     return 1;
 }
 
+/* when thresholding per frame, show the distribution of the reference frame */
+static gint threshold_histogram_frame(AmitkThreshold * threshold) {
+
+  if ((AMITK_DATA_SET_THRESHOLDING(threshold->data_set) == AMITK_THRESHOLDING_PER_FRAME) &&
+      (AMITK_DATA_SET_NUM_FRAMES(threshold->data_set) > 1))
+    return AMITK_DATA_SET_THRESHOLD_REF_FRAME(threshold->data_set, 0);
+  else
+    return -1;
+}
+
 /* refresh what's on the histogram */
 static void threshold_update_histogram(AmitkThreshold * threshold) {
 
@@ -710,7 +722,8 @@ static void threshold_update_histogram(AmitkThreshold * threshold) {
   fg.g = widget_style->fg[GTK_STATE_NORMAL].green >> 8;
   fg.b = widget_style->fg[GTK_STATE_NORMAL].blue >> 8;
 
-  pixbuf = image_of_distribution(threshold->data_set, fg, 
+  threshold->histogram_frame = threshold_histogram_frame(threshold);
+  pixbuf = image_of_distribution(threshold->data_set, threshold->histogram_frame, fg, 
 				 amitk_progress_dialog_update, 
 				 threshold->progress_dialog);
 
@@ -1465,6 +1478,8 @@ static void ds_thresholding_changed_cb(AmitkDataSet * ds, AmitkThreshold * thres
   threshold_update_ref_frames(threshold);
 #endif
   threshold_update_layout(threshold);
+  if (threshold_histogram_frame(threshold) != threshold->histogram_frame)
+    threshold_update_histogram(threshold);
 
   return;
 }
@@ -1500,6 +1515,8 @@ static void ds_thresholds_changed_cb(AmitkDataSet * ds, AmitkThreshold * thresho
   threshold_update_arrow(threshold, AMITK_THRESHOLD_ARROW_FULL_MAX);
   threshold_update_ref_frames(threshold);
   threshold_update_spin_buttons(threshold);
+  if (threshold_histogram_frame(threshold) != threshold->histogram_frame)
+    threshold_update_histogram(threshold);
 
   return;
 }
@@ -95,6 +95,7 @@ struct _AmitkThreshold
   GtkWidget * histogram_label;
   GnomeCanvasItem * color_scale_image[2][AMITK_THRESHOLD_SCALE_NUM_SCALES];
   GnomeCanvasItem * histogram_image;
+  gint histogram_frame; /* frame the histogram is of, -1 for the whole data set */
   GnomeCanvasItem * arrow[2][AMITK_THRESHOLD_ARROW_NUM_ARROWS];
   GnomeCanvasItem * connector_line[2][AMITK_THRESHOLD_LINE_NUM_LINES];
   GtkWidget * spin_button[2][AMITK_THRESHOLD_ENTRY_NUM_ENTRIES];
@@ -25,7 +25,9 @@
 
 #include "amide_config.h"
 #include "analysis.h"
+#include "amitk_parallel.h"
 #include <glib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include <sys/time.h>
@@ -45,62 +47,174 @@
 
 #define EMPTY 0.0
 
+/* the roi statistics are gathered into an accumulator, whose arrays get
+   reused (and only grow) from one frame/gate to the next, so the inner loop
+   doesn't need to allocate anything.  The weighted mean and variance are
+   tracked as the voxels come in, so when all the voxels get used (the usual
+   case) we only need a selection for the median, and no sorting at all */
+typedef struct {
+  guint count;
+  amide_data_t min;
+  amide_data_t max;
+  amide_data_t total;
+  amide_real_t sum_weights;
+  amide_real_t sum_weights_squared;
+  amide_data_t wmean;
+  amide_data_t wsumofsquares;
+} analysis_stats_t;
+
+typedef struct {
+  guint len;
+  guint size;
+  amide_data_t * values;
+  amide_real_t * weights;
+  AmitkVoxel * ds_voxels;
+  amide_data_t * scratch; /* for the selections */
+  gboolean failed;
+  analysis_stats_t stats;
+} analysis_accumulator_t;
+
+/* one roi on one frame/gate of a data set, these are the pieces of work
+   that get spread over the threads.  The result goes straight into the
+   gate analysis, which already sits in its place in the analysis tree */
+typedef struct {
+  const analysis_roi_t * roi_analysis;
+  AmitkDataSet * ds;
+  guint roi_num;
+  guint ds_num;
+  guint frame;
+  guint gate;
+  analysis_gate_t * gate_analysis;
+} analysis_item_t;
+
+typedef struct {
+  analysis_item_t * items;
+  gint offset; /* first item of the current block */
+  gint failed; /* atomic, 1 + the first item we couldn't get memory for */
+} analysis_work_t;
+
 static analysis_gate_t * analysis_gate_unref(analysis_gate_t *gate_analysis);
-static analysis_gate_t * analysis_gate_init(AmitkRoi * roi, AmitkDataSet *ds,guint frame, 
-					    analysis_calculation_t calculation_type,
-					    gboolean accurate,
-					    gdouble subfraction, 
-					    gdouble threshold_percentage, 
-					    gdouble threshold_value);
+static analysis_gate_t * analysis_gate_init(const analysis_roi_t * roi_analysis, 
+					    AmitkDataSet *ds, 
+					    guint ds_num,
+					    guint frame, 
+					    GArray * items);
 static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis);
-static analysis_frame_t * analysis_frame_init(AmitkRoi * roi, AmitkDataSet *ds, 
-					      analysis_calculation_t calculation_type,
-					      gboolean accurate,
-					      gdouble subfraction, 
-					      gdouble threshold_percentage,
-					      gdouble threshold_value);
+static analysis_frame_t * analysis_frame_init(const analysis_roi_t * roi_analysis, 
+					      AmitkDataSet *ds, 
+					      guint ds_num,
+					      GArray * items);
 static analysis_volume_t * analysis_volume_unref(analysis_volume_t *volume_analysis);
-static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * volumes, 
-						analysis_calculation_t calculation_type,
-						gboolean accurate,
-						gdouble subfraction, 
-						gdouble threshold_percentage, 
-						gdouble threshold_value);
+static analysis_volume_t * analysis_volume_init(const analysis_roi_t * roi_analysis, 
+						GList * volumes, 
+						guint ds_num,
+						GArray * items);
 
 
-void free_array_element(gpointer data, gpointer user_data) {
-  analysis_element_t * element = data;
-  g_free(element);
+static analysis_accumulator_t * accumulator_new(void) {
+  return g_new0(analysis_accumulator_t, 1);
 }
 
-static analysis_gate_t * analysis_gate_unref(analysis_gate_t * gate_analysis) {
+static void accumulator_free(analysis_accumulator_t * acc) {
 
-  analysis_gate_t * return_list;
+  if (acc == NULL) return;
 
-  if (gate_analysis == NULL)
-    return gate_analysis;
+  g_free(acc->values);
+  g_free(acc->weights);
+  g_free(acc->ds_voxels);
+  g_free(acc->scratch);
+  g_free(acc);
 
-  /* sanity checks */
-  g_return_val_if_fail(gate_analysis->ref_count > 0, NULL);
+  return;
+}
 
-  /* remove a reference count */
-  gate_analysis->ref_count--;
+static void stats_reset(analysis_stats_t * stats) {
 
-  /* if we've removed all reference's, free the roi */
-  if (gate_analysis->ref_count == 0) {
+  stats->count = 0;
+  stats->min = stats->max = 0.0;
+  stats->total = 0.0;
+  stats->sum_weights = stats->sum_weights_squared = 0.0;
+  stats->wmean = stats->wsumofsquares = 0.0;
 
-    g_ptr_array_foreach(gate_analysis->data_array, free_array_element, NULL); /* free the elements */
-    g_ptr_array_free(gate_analysis->data_array, TRUE); /* TRUE frees the array of pointers to elements as well */
+  return;
+}
 
-    /* recursively delete rest of list */
-    return_list = analysis_gate_unref(gate_analysis->next_gate_analysis);
-    gate_analysis->next_gate_analysis = NULL;
-    g_free(gate_analysis);
-    gate_analysis = NULL;
-  } else
-    return_list = gate_analysis;
+static void accumulator_reset(analysis_accumulator_t * acc) {
+  acc->len = 0;
+  acc->failed = FALSE;
+  stats_reset(&(acc->stats));
+  return;
+}
 
-  return return_list;
+/* doubles the space in the accumulator */
+static gboolean accumulator_grow(analysis_accumulator_t * acc) {
+
+  guint size;
+  amide_data_t * values;
+  amide_real_t * weights;
+  AmitkVoxel * ds_voxels;
+  amide_data_t * scratch;
+
+  size = (acc->size == 0) ? 4096 : 2*acc->size;
+
+  if ((values = g_try_renew(amide_data_t, acc->values, size)) == NULL) return FALSE;
+  acc->values = values;
+  if ((weights = g_try_renew(amide_real_t, acc->weights, size)) == NULL) return FALSE;
+  acc->weights = weights;
+  if ((ds_voxels = g_try_renew(AmitkVoxel, acc->ds_voxels, size)) == NULL) return FALSE;
+  acc->ds_voxels = ds_voxels;
+  if ((scratch = g_try_renew(amide_data_t, acc->scratch, size)) == NULL) return FALSE;
+  acc->scratch = scratch;
+
+  acc->size = size;
+
+  return TRUE;
+}
+
+/* note, the weighted variance follows statistics/wvariance_source.c from
+   gsl version 1.3 (copyright Jim Davies, Brian Gough, released under
+   GPL), but updates the mean as it goes (West's algorithm) so it only
+   needs the one pass */
+static inline void stats_add(analysis_stats_t * stats, 
+			     const amide_data_t value, 
+			     const amide_real_t weight) {
+
+  amide_data_t delta, r;
+
+  if (stats->count == 0) {
+    stats->min = stats->max = value;
+  } else {
+    if (value < stats->min) stats->min = value;
+    if (value > stats->max) stats->max = value;
+  }
+  stats->count++;
+
+  stats->total += weight*value;
+  stats->sum_weights += weight;
+  stats->sum_weights_squared += weight*weight;
+
+  delta = value - stats->wmean;
+  r = delta*weight/stats->sum_weights;
+  stats->wmean += r;
+  stats->wsumofsquares += (stats->sum_weights-weight)*delta*r;
+
+  return;
+}
+
+/* The variance is divided by N-1, since the mean in a sense is being
+   "estimated" from the data set....  If anyone else with more
+   statistical experience disagrees, please speak up */
+static gdouble stats_variance(const analysis_stats_t * stats) {
+
+  gdouble Wa, factor;
+
+  if (stats->count < 2) return NAN;
+
+  /* the weighted version of N/(N-1) */
+  Wa = stats->sum_weights;
+  factor = (Wa*Wa)/((Wa*Wa)-stats->sum_weights_squared);
+
+  return factor*stats->wsumofsquares/Wa;
 }
 
 
@@ -109,97 +223,176 @@ static void record_stats(AmitkVoxel ds_voxel,
 			 amide_real_t voxel_fraction,
 			 gpointer data) {
 
-  GPtrArray * array = data;
-  analysis_element_t * element;
+  analysis_accumulator_t * acc = data;
   
-  /* crashes if alloc fails, but I don't want to do error checking in the inner loop... 
-     let's not run out of memory */
   if (voxel_fraction > 0.0) {
-    element = g_malloc(sizeof(analysis_element_t)); 
+    if (acc->len == acc->size) 
+      if (!accumulator_grow(acc)) {
+	acc->failed = TRUE;
+	return;
+      }
     
-    element->value = value;
-    element->weight = voxel_fraction;
-    element->ds_voxel = ds_voxel;
-    g_ptr_array_add(array, element);
+    acc->values[acc->len] = value;
+    acc->weights[acc->len] = voxel_fraction;
+    acc->ds_voxels[acc->len] = ds_voxel;
+    acc->len++;
+    stats_add(&(acc->stats), value, voxel_fraction);
   }
 
   return;
 }
 
-static gint array_comparison(gconstpointer a, gconstpointer b) {
-
-  const analysis_element_t * ea = *((analysis_element_t **) a);
-  const analysis_element_t * eb = *((analysis_element_t **) b);
+/* returns the k'th smallest of the n values (counting from 0), and leaves the
+   array partitioned around it, i.e. everything before k is <= and everything
+   after is >= the returned value.  Wirth's selection, order N on average */
+static amide_data_t select_kth(amide_data_t * values, const guint n, const guint k) {
+
+  gint i, j, l, m;
+  amide_data_t x, temp;
+
+  l = 0;
+  m = n-1;
+  while (l < m) {
+    x = values[k];
+    i = l;
+    j = m;
+    do {
+      while (values[i] < x) i++;
+      while (x < values[j]) j--;
+      if (i <= j) {
+	temp = values[i];
+	values[i] = values[j];
+	values[j] = temp;
+	i++;
+	j--;
+      }
+    } while (i <= j);
+    if (j < (gint) k) l = i;
+    if ((gint) k < i) m = j;
+  }
 
-  if (ea->value > eb->value) 
-    return -1;
-  else if (ea->value < eb->value) 
-    return 1;
-  else
-    return 0;
+  return values[k];
 }
 
+/* median of the n values, which get reordered */
+static amide_data_t select_median(amide_data_t * values, const guint n) {
 
-
-/* note, the following function for weight variance calculation is
-   derived from statistics/wvariance_source.c from gsl version 1.3.  
-   copyright Jim Davies, Brian Gough, released under GPL. */
-/* The variance is divided by N-1, since the mean in a sense is being
-   "estimated" from the data set....  If anyone else with more
-   statistical experience disagrees, please speak up */
-static gdouble wvariance (GPtrArray * array, guint num_elements, gdouble wmean)
-{
-  analysis_element_t * element;
-  gdouble wsumofsquares = 0 ;
-  gdouble Wa = 0;
-  gdouble Wb = 0;
-  gdouble wi;
-  gdouble delta;
-  gdouble factor;
+  amide_data_t upper, lower;
   guint i;
 
-  if (num_elements < 2) return NAN;
-
-  /* find the weight sum of the squares */
-  /* computes sum(wi*(valuei-mean))/sum(wi) */
-  /* and computes the weighted version of N/(N-1) */
-  for (i = 0; i < num_elements; i++) {
-    element = g_ptr_array_index(array, i);
-    wi = element->weight;
-
-    if (wi > 0) {
-      delta = element->value-wmean;
-      Wa += wi ;
-      Wb += wi*wi;
-      wsumofsquares += (delta * delta - wsumofsquares) * (wi / Wa);
-    } 
+  if (n & 0x1) /* odd */
+    return select_kth(values, n, (n-1)/2);
+
+  /* even, the lower middle value is the largest of the values before the upper one */
+  upper = select_kth(values, n, n/2);
+  lower = values[0];
+  for (i=1; i < n/2; i++)
+    if (values[i] > lower) lower = values[i];
+
+  return 0.5*upper + 0.5*lower;
+}
+
+/* restricts the statistics to the num_voxels largest values, and leaves those 
+   values in the accumulator's scratch array */
+static void accumulator_top_voxels(analysis_accumulator_t * acc, const guint num_voxels) {
+
+  amide_data_t cutoff;
+  guint num_above, num_ties;
+  guint i, j;
+
+  memcpy(acc->scratch, acc->values, acc->len*sizeof(amide_data_t));
+  cutoff = select_kth(acc->scratch, acc->len, acc->len-num_voxels);
+
+  num_above = 0;
+  for (i=0; i < acc->len; i++)
+    if (acc->values[i] > cutoff)
+      num_above++;
+  num_ties = num_voxels-num_above; /* how many voxels equal to the cutoff to use */
+
+  stats_reset(&(acc->stats));
+  for (i=0, j=0; i < acc->len; i++) {
+    if ((acc->values[i] == cutoff) && (num_ties > 0)) {
+      num_ties--;
+      stats_add(&(acc->stats), acc->values[i], acc->weights[i]);
+      acc->scratch[j++] = acc->values[i];
+    } else if (acc->values[i] > cutoff) {
+      stats_add(&(acc->stats), acc->values[i], acc->weights[i]);
+      acc->scratch[j++] = acc->values[i];
+    }
   }
 
-  factor = (Wa*Wa)/((Wa*Wa)-Wb);
+  return;
+}
+
+/* copies the voxels out of the accumulator, the three arrays go in one allocation */
+static gboolean accumulator_copy_voxels(const analysis_accumulator_t * acc, analysis_voxels_t * voxels) {
+
+  guint len;
+  gchar * block;
+
+  len = acc->len;
+  voxels->len = 0;
+  voxels->values = NULL;
+  voxels->weights = NULL;
+  voxels->ds_voxels = NULL;
+  if (len == 0) return TRUE;
 
-  return factor*wsumofsquares;
+  block = g_try_malloc(len*(sizeof(amide_data_t)+sizeof(amide_real_t)+sizeof(AmitkVoxel)));
+  if (block == NULL) return FALSE;
+
+  voxels->len = len;
+  voxels->values = (amide_data_t *) block;
+  voxels->weights = (amide_real_t *) (block + len*sizeof(amide_data_t));
+  voxels->ds_voxels = (AmitkVoxel *) (block + len*(sizeof(amide_data_t)+sizeof(amide_real_t)));
+  memcpy(voxels->values, acc->values, len*sizeof(amide_data_t));
+  memcpy(voxels->weights, acc->weights, len*sizeof(amide_real_t));
+  memcpy(voxels->ds_voxels, acc->ds_voxels, len*sizeof(AmitkVoxel));
+
+  return TRUE;
 }
 
 
+static analysis_gate_t * analysis_gate_unref(analysis_gate_t * gate_analysis) {
 
-/* calculate an analysis of several statistical values for an roi on a given data set frame/gate. */
-static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi, 
-						    AmitkDataSet * ds, 
-						    guint frame,
-						    guint gate,
-						    analysis_calculation_t calculation_type,
-						    gboolean accurate,
-						    gdouble subfraction,
-						    gdouble threshold_percentage,
-						    gdouble threshold_value) {
+  analysis_gate_t * return_list;
 
-  GPtrArray * data_array;
-  analysis_gate_t * analysis;
+  if (gate_analysis == NULL)
+    return gate_analysis;
+
+  /* sanity checks */
+  g_return_val_if_fail(gate_analysis->ref_count > 0, NULL);
+
+  /* remove a reference count */
+  gate_analysis->ref_count--;
+
+  /* if we've removed all reference's, free the roi */
+  if (gate_analysis->ref_count == 0) {
+
+    g_free(gate_analysis->data.values); /* frees the weights and voxels as well */
+
+    /* recursively delete rest of list */
+    return_list = analysis_gate_unref(gate_analysis->next_gate_analysis);
+    gate_analysis->next_gate_analysis = NULL;
+    g_free(gate_analysis);
+    gate_analysis = NULL;
+  } else
+    return_list = gate_analysis;
+
+  return return_list;
+}
+
+
+
+/* calculate an analysis of several statistical values for an roi on a given data set frame/gate. 
+   This gets called from the worker threads, so it doesn't put up any warnings
+   itself, it just returns FALSE if it couldn't get the memory it needed */
+static gboolean analysis_gate_calculate(analysis_item_t * item, analysis_accumulator_t * acc) {
+
+  const analysis_roi_t * roi_analysis = item->roi_analysis;
+  analysis_gate_t * analysis = item->gate_analysis;
   guint subfraction_voxels;
   guint i;
-  analysis_element_t * element;
-  gdouble max;
-  gboolean done;
+  amide_data_t cutoff;
 #ifdef AMIDE_DEBUG
   struct timeval tv1;
   struct timeval tv2;
@@ -210,138 +403,72 @@ static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi,
   gettimeofday(&tv1, NULL);
 #endif
 
-  if (gate == AMITK_DATA_SET_NUM_GATES(ds)) return NULL; /* check if we're done */
-
-  /* and now calculate this gate's data */
-  if ((data_array = g_ptr_array_new()) == NULL) {
-    g_warning(_("couldn't allocate memory space for data array for frame %d/gate %d"), frame, gate);
-    return NULL;
-  }
-  /* fill the array with the appropriate info from the data set */
-  /* note, I really only need a partial sort to get the median value, but
-     glib doesn't have one (only has a full qsort), so I'll just do that.
-     Partial sort would be order(N), qsort is order(NlogN), so it's not that
-     much worse.
-
-     If I used a partial sort, I'd have to iterate over the subfraction to find the 
-     max and min, and I'd have to do another partial sort to find the median 
-  */
-  amitk_roi_calculate_on_data_set(roi, ds, frame, gate,FALSE, accurate, record_stats, data_array);
-  g_ptr_array_sort(data_array, array_comparison);
+  /* fill the accumulator with the appropriate info from the data set, which 
+     can't be changed (e.g. erased) while we're reading it */
+  accumulator_reset(acc);
+  amitk_data_set_read_lock(item->ds);
+  amitk_roi_calculate_on_data_set(roi_analysis->roi, item->ds, item->frame, item->gate, 
+				  FALSE, roi_analysis->accurate, record_stats, acc);
+  amitk_data_set_read_unlock(item->ds);
+  if (acc->failed) return FALSE;
   
-  switch(calculation_type) {
+  /* figure out how many of the voxels (the largest ones) to use */
+  switch(roi_analysis->calculation_type) {
   case ALL_VOXELS:
-    subfraction_voxels = data_array->len;
+    subfraction_voxels = acc->len;
     break;
   case HIGHEST_FRACTION_VOXELS:
-    subfraction_voxels = ceil(subfraction*data_array->len);
+    subfraction_voxels = ceil(roi_analysis->subfraction*acc->len);
 
-    if ((subfraction_voxels == 0) && (data_array->len > 0))
+    if ((subfraction_voxels == 0) && (acc->len > 0))
       subfraction_voxels = 1; /* have at least one voxel if the roi is in the data set*/
 
     break;
   case VOXELS_NEAR_MAX:
     subfraction_voxels = 0;
+    cutoff = acc->stats.max*roi_analysis->threshold_percentage/100.0;
+    for (i=0; i<acc->len; i++)
+      if (acc->values[i] >= cutoff)
+	subfraction_voxels++;
 
-    if (data_array->len > 0) {
-      element = g_ptr_array_index(data_array, 0);
-      max = element->value;
-      done = FALSE;
-      for (i=0; i<data_array->len && !done; i++) {
-	element = g_ptr_array_index(data_array, i);
-	if (element->value >= max*threshold_percentage/100.0)
-	  subfraction_voxels++;
-	else
-	  done = TRUE;
-      }
-    }
-
-    if ((subfraction_voxels == 0) && (data_array->len > 0))
+    if ((subfraction_voxels == 0) && (acc->len > 0))
       subfraction_voxels = 1; /* have at least one voxel if the roi is in the data set*/
 
     break;
   case VOXELS_GREATER_THAN_VALUE:
     subfraction_voxels = 0;
-
-    if (data_array->len > 0) {
-      element = g_ptr_array_index(data_array, 0);
-      max = element->value;
-      done = FALSE;
-      for (i=0; i<data_array->len && !done; i++) {
-	element = g_ptr_array_index(data_array, i);
-	if (element->value >= threshold_value)
-	  subfraction_voxels++;
-	else
-	  done = TRUE;
-      }
-    }
+    for (i=0; i<acc->len; i++)
+      if (acc->values[i] >= roi_analysis->threshold_value)
+	subfraction_voxels++;
     break;
   default:
     subfraction_voxels=0;
     g_error("unexpected case in %s at line %d",__FILE__, __LINE__);
   }
 
+  if (!accumulator_copy_voxels(acc, &(analysis->data)))
+    return FALSE;
 
-  /* fill in our gate_analysis structure */
-  if ((analysis =  g_try_new(analysis_gate_t,1)) == NULL) {
-    g_warning(_("couldn't allocate memory space for roi analysis of frame %d/gate %d"), frame, gate);
-    return analysis;
-  }
-  analysis->ref_count = 1;
-
-  /* set values */
-  analysis->data_array = data_array;
-  analysis->duration = amitk_data_set_get_frame_duration(ds, frame);
-  analysis->time_midpoint = amitk_data_set_get_midpt_time(ds, frame);
-  analysis->gate_time = amitk_data_set_get_gate_time(ds, gate);
-  analysis->total = 0.0;
-  analysis->median = 0.0;
-  analysis->total = 0.0;
+  /* set values, if the roi's not in the data set, 
+     everything stays zero from analysis_gate_init */
   analysis->voxels = subfraction_voxels;
-  analysis->fractional_voxels = 0.0;
-  analysis->correction = 0.0;
-  analysis->var = 0.0;
 
-  
-  if (subfraction_voxels == 0) { /* roi not in data set */
-    analysis->max = 0.0;
-    analysis->min = 0.0;
-    analysis->median = 0.0;
-    analysis->mean = 0.0;
-
-  } else { 
-
-    /* max */
-    element = g_ptr_array_index(data_array, 0);
-    analysis->max = element->value;
-
-    /* min */
-    element = g_ptr_array_index(data_array, subfraction_voxels-1);
-    analysis->min = element->value;
-
-    /* median */
-    if (subfraction_voxels & 0x1) { /* odd */
-      element = g_ptr_array_index(data_array, (subfraction_voxels-1)/2);
-      analysis->median = element->value;
-    } else { /* even */
-      element = g_ptr_array_index(data_array, subfraction_voxels/2-1);
-      analysis->median = 0.5*element->value;
-      element = g_ptr_array_index(data_array, subfraction_voxels/2);
-      analysis->median += 0.5*element->value;
-    }
+  if (subfraction_voxels > 0) {
 
-    /* total and #fractional_voxels */
-    for (i=0; i<subfraction_voxels; i++) {
-      element = g_ptr_array_index(data_array, i);
-      analysis->total += element->weight*element->value;
-      analysis->fractional_voxels += element->weight;
-    }
+    /* the stats gathered while scanning already cover all the voxels, 
+       otherwise redo them over just the voxels we're using */
+    if (subfraction_voxels < acc->len)
+      accumulator_top_voxels(acc, subfraction_voxels);
+    else
+      memcpy(acc->scratch, acc->values, acc->len*sizeof(amide_data_t));
 
-    /* calculate the mean */
+    analysis->max = acc->stats.max;
+    analysis->min = acc->stats.min;
+    analysis->median = select_median(acc->scratch, subfraction_voxels);
+    analysis->total = acc->stats.total;
+    analysis->fractional_voxels = acc->stats.sum_weights;
     analysis->mean = analysis->total/analysis->fractional_voxels;
-
-    /* calculate variance */
-    analysis->var = wvariance(data_array, subfraction_voxels, analysis->mean);
+    analysis->var = stats_variance(&(acc->stats));
   }
   
 #ifdef AMIDE_DEBUG
@@ -351,30 +478,84 @@ static analysis_gate_t * analysis_gate_init_recurse(AmitkRoi * roi,
   time2 = ((double) tv2.tv_sec) + ((double) tv2.tv_usec)/1000000.0;
 
   g_print("Calculated ROI: %s on Data Set: %s Frame %d Gate %d.  Took %5.3f (s) \n", 
-	  AMITK_OBJECT_NAME(roi), AMITK_OBJECT_NAME(ds), frame, gate, time2-time1);
+	  AMITK_OBJECT_NAME(roi_analysis->roi), AMITK_OBJECT_NAME(item->ds), 
+	  item->frame, item->gate, time2-time1);
 #endif
 
+  return TRUE;
+}
+
+/* the items from start to end of the current block */
+static void analysis_items(const gint start, const gint end, gpointer data) {
+
+  analysis_work_t * work = data;
+  analysis_accumulator_t * acc;
+  gint k;
+
+  /* the accumulator gets reused for all the items in the range, but
+     can't be shared with the other threads */
+  acc = accumulator_new();
+
+  for (k=work->offset+start; k < work->offset+end; k++)
+    if (!analysis_gate_calculate(&(work->items[k]), acc))
+      g_atomic_int_compare_and_exchange(&(work->failed), 0, k+1);
+
+  accumulator_free(acc);
+
+  return;
+}
+
+/* sets up the analysis structures for the gates of a data set frame, and
+   adds them to the list of items to calculate */
+static analysis_gate_t * analysis_gate_init_recurse(const analysis_roi_t * roi_analysis,
+						    AmitkDataSet * ds, 
+						    guint ds_num,
+						    guint frame,
+						    guint gate,
+						    GArray * items) {
+
+  analysis_gate_t * analysis;
+  analysis_item_t item;
+
+  if (gate == AMITK_DATA_SET_NUM_GATES(ds)) return NULL; /* check if we're done */
+
+  /* the stats start out as zero, which is what we want if the roi isn't in the data set */
+  if ((analysis =  g_try_new0(analysis_gate_t,1)) == NULL) {
+    g_warning(_("couldn't allocate memory space for roi analysis of frame %d/gate %d"), frame, gate);
+    return analysis;
+  }
+  analysis->ref_count = 1;
+
+  /* set values */
+  analysis->duration = amitk_data_set_get_frame_duration(ds, frame);
+  analysis->time_midpoint = amitk_data_set_get_midpt_time(ds, frame);
+  analysis->gate_time = amitk_data_set_get_gate_time(ds, gate);
+
+  item.roi_analysis = roi_analysis;
+  item.ds = ds;
+  item.roi_num = 0; /* filled in by analysis_roi_init_recurse */
+  item.ds_num = ds_num;
+  item.frame = frame;
+  item.gate = gate;
+  item.gate_analysis = analysis;
+  g_array_append_val(items, item);
 
   /* now let's recurse  */
   analysis->next_gate_analysis = 
-    analysis_gate_init_recurse(roi, ds, frame, gate+1, calculation_type, accurate, 
-			       subfraction, threshold_percentage, threshold_value);
+    analysis_gate_init_recurse(roi_analysis, ds, ds_num, frame, gate+1, items);
 
   return analysis;
 }
 
 
 
-static analysis_gate_t * analysis_gate_init(AmitkRoi * roi, AmitkDataSet * ds,
+static analysis_gate_t * analysis_gate_init(const analysis_roi_t * roi_analysis, 
+					    AmitkDataSet * ds,
+					    guint ds_num,
 					    guint frame, 
-					    analysis_calculation_t calculation_type,
-					    gboolean accurate,
-					    gdouble subfraction,
-					    gdouble threshold_percentage,
-					    gdouble threshold_value) {
-
-  return analysis_gate_init_recurse(roi, ds, frame, 0, calculation_type, accurate,
-				    subfraction, threshold_percentage, threshold_value);
+					    GArray * items) {
+
+  return analysis_gate_init_recurse(roi_analysis, ds, ds_num, frame, 0, items);
 }
 
 
@@ -407,15 +588,12 @@ static analysis_frame_t * analysis_frame_unref(analysis_frame_t * frame_analysis
 }
 
 
-/* returns a calculated analysis structure of an roi on a frame of a data set */
-static analysis_frame_t * analysis_frame_init_recurse(AmitkRoi * roi, 
+/* sets up the analysis structure of an roi on the frames of a data set */
+static analysis_frame_t * analysis_frame_init_recurse(const analysis_roi_t * roi_analysis, 
 						      AmitkDataSet *ds, 
+						      guint ds_num,
 						      guint frame,
-						      analysis_calculation_t calculation_type,
-						      gboolean accurate,
-						      gdouble subfraction,
-						      gdouble threshold_percentage,
-						      gdouble threshold_value) {
+						      GArray * items) {
   
   analysis_frame_t * temp_frame_analysis;
   
@@ -428,37 +606,32 @@ static analysis_frame_t * analysis_frame_init_recurse(AmitkRoi * roi,
   
   temp_frame_analysis->ref_count = 1;
 
-  /* calculate this one */
+  /* set up this one */
   temp_frame_analysis->gate_analyses = 
-    analysis_gate_init(roi, ds, frame, calculation_type, accurate, subfraction, 
-		       threshold_percentage, threshold_value);
+    analysis_gate_init(roi_analysis, ds, ds_num, frame, items);
 
   /* recurse */
   temp_frame_analysis->next_frame_analysis = 
-    analysis_frame_init_recurse(roi, ds, frame+1, calculation_type, accurate, subfraction, 
-				threshold_percentage, threshold_value);
+    analysis_frame_init_recurse(roi_analysis, ds, ds_num, frame+1, items);
 
   return temp_frame_analysis;
 }
 
 
-static analysis_frame_t * analysis_frame_init(AmitkRoi * roi, AmitkDataSet *ds, 
-					      analysis_calculation_t calculation_type,
-					      gboolean accurate,
-					      gdouble subfraction,
-					      gdouble threshold_percentage,
-					      gdouble threshold_value) {
+static analysis_frame_t * analysis_frame_init(const analysis_roi_t * roi_analysis, 
+					      AmitkDataSet *ds, 
+					      guint ds_num,
+					      GArray * items) {
 
   /* sanity checks */
   g_return_val_if_fail(AMITK_IS_DATA_SET(ds), NULL);
 
-  if (AMITK_ROI_UNDRAWN(roi)) {
-    g_warning(_("ROI: %s appears not to have been drawn"), AMITK_OBJECT_NAME(roi));
+  if (AMITK_ROI_UNDRAWN(roi_analysis->roi)) {
+    g_warning(_("ROI: %s appears not to have been drawn"), AMITK_OBJECT_NAME(roi_analysis->roi));
     return NULL;
   }
 
-  return analysis_frame_init_recurse(roi, ds, 0, calculation_type, accurate, subfraction, 
-				     threshold_percentage, threshold_value);
+  return analysis_frame_init_recurse(roi_analysis, ds, ds_num, 0, items);
 }
 
 
@@ -494,12 +667,10 @@ static analysis_volume_t * analysis_volume_unref(analysis_volume_t * volume_anal
 }
 
 /* returns an initialized roi analysis of a list of volumes */
-static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * data_sets, 
-						analysis_calculation_t calculation_type,
-						gboolean accurate,
-						gdouble subfraction,
-						gdouble threshold_percentage,
-						gdouble threshold_value) {
+static analysis_volume_t * analysis_volume_init(const analysis_roi_t * roi_analysis, 
+						GList * data_sets, 
+						guint ds_num,
+						GArray * items) {
   
   analysis_volume_t * temp_volume_analysis;
 
@@ -516,15 +687,13 @@ static analysis_volume_t * analysis_volume_init(AmitkRoi * roi, GList * data_set
   temp_volume_analysis->ref_count = 1;
   temp_volume_analysis->data_set = amitk_object_ref(data_sets->data);
 
-  /* calculate this one */
+  /* set up this one */
   temp_volume_analysis->frame_analyses = 
-    analysis_frame_init(roi, temp_volume_analysis->data_set, calculation_type, accurate,
-			subfraction, threshold_percentage, threshold_value);
+    analysis_frame_init(roi_analysis, temp_volume_analysis->data_set, ds_num, items);
 
   /* recurse */
   temp_volume_analysis->next_volume_analysis = 
-    analysis_volume_init(roi, data_sets->next, calculation_type, accurate,
-			 subfraction, threshold_percentage, threshold_value);
+    analysis_volume_init(roi_analysis, data_sets->next, ds_num+1, items);
 
   
   return temp_volume_analysis;
@@ -567,16 +736,18 @@ analysis_roi_t * analysis_roi_unref(analysis_roi_t * roi_analysis) {
   return return_list;
 }
 
-/* returns an initialized list of roi analyses */
-analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois, 
-				   GList * data_sets, 
-				   analysis_calculation_t calculation_type,
-				   gboolean accurate,
-				   gdouble subfraction, 
-				   gdouble threshold_percentage,
-				   gdouble threshold_value) {
+static analysis_roi_t * analysis_roi_init_recurse(AmitkStudy * study, GList * rois, 
+						  guint roi_num,
+						  GList * data_sets, 
+						  analysis_calculation_t calculation_type,
+						  gboolean accurate,
+						  gdouble subfraction, 
+						  gdouble threshold_percentage,
+						  gdouble threshold_value,
+						  GArray * items) {
   
   analysis_roi_t * temp_roi_analysis;
+  guint first_item, i;
   
   if (rois == NULL)  return NULL;
 
@@ -594,19 +765,147 @@ analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois,
   temp_roi_analysis->threshold_percentage = threshold_percentage;
   temp_roi_analysis->threshold_value = threshold_value;
 
-  /* calculate this one */
+  /* set up this one */
+  first_item = items->len;
   temp_roi_analysis->volume_analyses = 
-    analysis_volume_init(temp_roi_analysis->roi, data_sets, calculation_type, accurate,
-			 subfraction, threshold_percentage, threshold_value);
+    analysis_volume_init(temp_roi_analysis, data_sets, 0, items);
+  for (i=first_item; i < items->len; i++)
+    g_array_index(items, analysis_item_t, i).roi_num = roi_num;
 
   /* recurse */
   temp_roi_analysis->next_roi_analysis = 
-    analysis_roi_init(study, rois->next, data_sets, calculation_type, accurate,
-		      subfraction, threshold_percentage, threshold_value);
+    analysis_roi_init_recurse(study, rois->next, roi_num+1, data_sets, calculation_type, accurate,
+			      subfraction, threshold_percentage, threshold_value, items);
 
   
   return temp_roi_analysis;
 }
 
+/* the items get worked through by data set, frame, and gate, with the rois
+   innermost.  Neighbouring items then need the same frame of data paged in,
+   and the threads mostly work on different rois, so they don't end up
+   waiting on each other for an roi's mask to get calculated */
+static gint item_order_comparison(gconstpointer a, gconstpointer b) {
+
+  const analysis_item_t * item_a = a;
+  const analysis_item_t * item_b = b;
+
+  if (item_a->ds_num != item_b->ds_num)
+    return (item_a->ds_num < item_b->ds_num) ? -1 : 1;
+  else if (item_a->frame != item_b->frame)
+    return (item_a->frame < item_b->frame) ? -1 : 1;
+  else if (item_a->gate != item_b->gate)
+    return (item_a->gate < item_b->gate) ? -1 : 1;
+  else if (item_a->roi_num != item_b->roi_num)
+    return (item_a->roi_num < item_b->roi_num) ? -1 : 1;
+  else
+    return 0;
+}
+
+static gint voxel_order_comparison(gconstpointer a, gconstpointer b, gpointer data) {
+
+  const amide_data_t * values = data;
+  amide_data_t va = values[*((const guint *) a)];
+  amide_data_t vb = values[*((const guint *) b)];
+
+  if (va > vb) 
+    return -1;
+  else if (va < vb) 
+    return 1;
+  else
+    return 0;
+}
+
+/* returns the indices of the gate's voxels, from largest to smallest value.
+   The analysis itself doesn't need them in order, so this is only done on
+   request (e.g. when exporting the raw data).  Free with g_free */
+guint * analysis_gate_sort_voxels(const analysis_gate_t * gate_analysis) {
+
+  guint * order;
+  guint i;
+
+  g_return_val_if_fail(gate_analysis != NULL, NULL);
+
+  order = g_new(guint, MAX(gate_analysis->data.len, 1));
+  for (i=0; i < gate_analysis->data.len; i++)
+    order[i] = i;
+  g_qsort_with_data(order, gate_analysis->data.len, sizeof(guint), 
+		    voxel_order_comparison, gate_analysis->data.values);
+
+  return order;
+}
+
+
+/* returns an initialized list of roi analyses, or NULL if canceled.  
+   The analysis tree gets set up first, and then the statistics for each
+   roi/data set/frame/gate get calculated, spread over the threads */
+analysis_roi_t * analysis_roi_init(AmitkStudy * study, GList * rois, 
+				   GList * data_sets, 
+				   analysis_calculation_t calculation_type,
+				   gboolean accurate,
+				   gdouble subfraction, 
+				   gdouble threshold_percentage,
+				   gdouble threshold_value,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data) {
+
+  analysis_roi_t * roi_analyses;
+  GArray * items;
+  analysis_work_t work;
+  analysis_item_t * failed_item;
+  gint num_items;
+  gint block_size, start, end;
+  gboolean continue_work=TRUE;
+  gchar * temp_string;
+
+  items = g_array_new(FALSE, FALSE, sizeof(analysis_item_t));
+  roi_analyses = analysis_roi_init_recurse(study, rois, 0, data_sets, calculation_type, accurate,
+					   subfraction, threshold_percentage, threshold_value, items);
+  g_array_sort(items, item_order_comparison);
+  num_items = items->len;
+
+  if (update_func != NULL) {
+    temp_string = g_strdup_printf(_("Calculating ROI statistics"));
+    continue_work = (*update_func)(update_data, temp_string, (gdouble) 0.0);
+    g_free(temp_string);
+  }
+
+  /* blocks of items, so the progress bar keeps moving */
+  if (update_func != NULL) 
+    block_size = MAX(num_items/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = num_items;
+  block_size = MAX(block_size, 1);
+
+  work.items = (analysis_item_t *) items->data;
+  work.failed = 0;
+
+  for (start=0; (start < num_items) && continue_work && (work.failed == 0); start = end) {
+    end = MIN(start+block_size, num_items);
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) num_items));
+    if (continue_work) {
+      work.offset = start;
+      amitk_parallel_for(end-start, analysis_items, &work);
+    }
+  }
+
+  if (update_func != NULL) /* remove progress bar */
+    (*update_func)(update_data, NULL, (gdouble) 2.0); 
+
+  if (work.failed != 0) {
+    failed_item = &g_array_index(items, analysis_item_t, work.failed-1);
+    g_warning(_("couldn't allocate memory space for data array for frame %d/gate %d"), 
+	      failed_item->frame, failed_item->gate);
+    continue_work = FALSE;
+  }
+  g_array_free(items, TRUE);
+
+  if (!continue_work)
+    roi_analyses = analysis_roi_unref(roi_analyses);
+
+  return roi_analyses;
+}
+
 
 
@@ -49,17 +49,20 @@ typedef struct _analysis_study_t analysis_study_t;
 
 
 
-typedef struct analysis_element_t {
-  amide_data_t value;
-  amide_real_t weight;
-  AmitkVoxel ds_voxel;
-} analysis_element_t;
+/* the voxels of a data set that are at least partially in an roi, in the
+   order they were visited.  The three arrays share one allocation */
+typedef struct analysis_voxels_t {
+  guint len;
+  amide_data_t * values;
+  amide_real_t * weights;
+  AmitkVoxel * ds_voxels;
+} analysis_voxels_t;
 
 
 struct _analysis_gate_t {
 
-  /* roi data - array of analysis_element's */
-  GPtrArray * data_array;
+  /* roi data */
+  analysis_voxels_t data;
 
   /* stats */
   amide_data_t mean;
@@ -110,6 +113,7 @@ struct _analysis_roi_t {
 
 /* external functions */
 analysis_roi_t * analysis_roi_unref(analysis_roi_t *roi_analysis);
+guint * analysis_gate_sort_voxels(const analysis_gate_t * gate_analysis);
 
 /* note, subfraction is only used for calculation_type == HIGHEST_FRACTION_VOXELS,
    threshold_percentage is only used for calculation_type == VOXELS_NEAR_MAX
@@ -121,7 +125,9 @@ analysis_roi_t * analysis_roi_init(AmitkStudy * study,
 				   gboolean accurate,
 				   gdouble subfraction, 
 				   gdouble threshold_percentage, 
-				   gdouble threshold_value);
+				   gdouble threshold_value,
+				   AmitkUpdateFunc update_func,
+				   gpointer update_data);
 
 #endif /* __ANALYSIS_H__ */
 
@@ -34,7 +34,9 @@
 #include "dcmtk_interface.h" 
 #include <dirent.h>
 #include <sys/stat.h>
+#include <stdlib.h>
 #include "amitk_data_set_DOUBLE_0D_SCALING.h"
+#include "amitk_parallel.h"
 #include <glib/gstdio.h> /* make sure we get g_mkdir on mingw32 */
 
 /* dcmtk redefines a lot of things that they shouldn't... */
@@ -55,7 +57,7 @@
 #include <dcmtk/dcmdata/dcpxitem.h>
 #include <opj_config.h>
 #include <openjpeg.h>
-static void * j2k_to_raw(DcmDataset *pdata, AmitkDataSet const *pds);
+static void * j2k_to_raw(DcmDataset *pdata, const AmitkFormat format, const AmitkVoxel dim);
 #endif
 
 const gchar * dcmtk_version = OFFIS_DCMTK_VERSION;
@@ -87,6 +89,168 @@ gboolean dcmtk_test_dicom(const gchar * filename) {
 
 
 
+/* figures out how the pixel data is encoded, and has dcmtk decompress it if need be. JPEG 2000
+   isn't handled by dcmtk, so that's left compressed and flagged in pvalid_J2K. Registers the 
+   decompression codecs, the caller needs to call DJDecoderRegistration::cleanup() afterwards */
+static gboolean prepare_pixel_data(DcmFileFormat * dcm_format, const gchar * filename, 
+				   gboolean * pvalid_J2K, gchar ** perror_buf) {
+
+  DcmMetaInfo * dcm_metainfo;
+  DcmDataset * dcm_dataset;
+  DcmXfer *dcm_syntax=NULL;
+  OFCondition result;
+  const char * return_str=NULL;
+
+  *pvalid_J2K = FALSE;
+  dcm_dataset = dcm_format->getDataset();
+  g_return_val_if_fail(dcm_dataset != NULL, FALSE);
+
+  dcm_metainfo = dcm_format->getMetaInfo();
+  if (dcm_metainfo == NULL) {
+     amitk_append_str_with_newline(perror_buf, _("could not find metainfo in DICOM file %s"), filename);
+  }
+
+  if (dcm_metainfo == NULL) {
+    dcm_syntax = new DcmXfer(dcm_dataset->getOriginalXfer());
+  } else {
+    /* What TransSyntax is used to encode the image */
+    if (dcm_metainfo->findAndGetString(DCM_TransferSyntaxUID, return_str).good()) {
+      if (return_str != NULL) {
+	//        g_debug("TransferSyntaxUID %s", return_str);
+        dcm_syntax = new DcmXfer(return_str);
+      }
+    }
+  }
+
+  if (dcm_syntax == NULL) {
+    amitk_append_str_with_newline(perror_buf, _("could not determine TransferSyntax %s"), filename);
+    return FALSE;
+  }
+  //    g_debug("TransferSyntax is %s (%d)", dcm_syntax->getXferName(), dcm_syntax->getXfer());
+
+  /* register global decompression codecs */
+  DJDecoderRegistration::registerCodecs(EDC_photometricInterpretation,
+					EUC_default,
+					EPC_default,
+					OFFalse);
+  DcmRLEDecoderRegistration::registerCodecs();
+
+  /* uncompress the raw data in case this is a JPEG encoded file */
+  result = dcm_dataset->chooseRepresentation(EXS_LittleEndianExplicit, NULL);
+  if (result.bad()) {
+
+    /* check if this is JPEG2000, which is not currently freely supported by dcmtk */
+    return_str = dcm_syntax->getXferID();
+    if (return_str != NULL)
+      if ((strcmp(return_str, UID_JPEG2000LosslessOnlyTransferSyntax) == 0) ||
+              (strcmp(return_str, UID_JPEG2000TransferSyntax) == 0) ||
+              (strcmp(return_str, UID_JPEG2000Part2MulticomponentImageCompressionLosslessOnlyTransferSyntax) == 0) ||
+              (strcmp(return_str, UID_JPEG2000Part2MulticomponentImageCompressionTransferSyntax) == 0))
+        *pvalid_J2K = TRUE;
+
+    if (!*pvalid_J2K) 
+      amitk_append_str_with_newline(perror_buf, _("could not decompress data in DICOM file %s, dcmtk returned %s"), filename, result.text());
+  }
+
+  delete dcm_syntax;
+
+  return (result.good() || *pvalid_J2K);
+}
+
+/* copies the pixel data out of the DICOM dataset into dest, which needs room for dim worth of voxels */
+static gboolean copy_pixel_data(DcmDataset * dcm_dataset, 
+				const gboolean valid_J2K,
+				const AmitkFormat format, 
+				const AmitkVoxel dim,
+				void * dest,
+				const gchar * filename,
+				gchar ** perror_buf) {
+
+  OFCondition result;
+  const void * buffer=NULL;
+  size_t num_bytes;
+
+  g_return_val_if_fail(dest != NULL, FALSE);
+  num_bytes = amitk_format_sizes[format]*dim.x*dim.y*dim.z;
+
+  /* a "GetSint16Array" function is also provided, but for some reason I get an error
+     when using it.  I'll just use GetUint16Array even for signed stuff */
+  if (!valid_J2K) {
+    switch (format) {
+      case AMITK_FORMAT_SBYTE:
+      case AMITK_FORMAT_UBYTE:
+      {
+        const Uint8 * temp_buffer=NULL;
+        result = dcm_dataset->findAndGetUint8Array(DCM_PixelData, temp_buffer);
+        buffer = (void *) temp_buffer;
+        break;
+      }
+      case AMITK_FORMAT_SSHORT:
+      case AMITK_FORMAT_USHORT:
+      {
+        const Uint16 * temp_buffer=NULL;
+        result = dcm_dataset->findAndGetUint16Array(DCM_PixelData, temp_buffer);
+        buffer = (void *) temp_buffer;
+        break;
+      }
+      case AMITK_FORMAT_SINT:
+      case AMITK_FORMAT_UINT:
+      {
+        const Uint32 * temp_buffer=NULL;
+        result = dcm_dataset->findAndGetUint32Array(DCM_PixelData, temp_buffer);
+        buffer = (void *) temp_buffer;
+        break;
+      }
+      default:
+        g_warning(_("unsupported data format in %s at %d\n"), __FILE__, __LINE__);
+        return FALSE;
+        break;
+    }
+
+    if (result.bad() || (buffer == NULL)) {
+      amitk_append_str_with_newline(perror_buf, _("error reading in pixel data - DCMTK error: %s - Failed to read file %s"), result.text(), filename);
+      return FALSE;
+    }
+
+    memcpy(dest, buffer, num_bytes);
+  } 
+  else {
+#ifdef AMIDE_LIBOPENJP2_SUPPORT    
+    buffer = j2k_to_raw(dcm_dataset, format, dim);
+    if (!buffer) {
+      amitk_append_str_with_newline(perror_buf, _("error while decompressing JPEG 2000 from DCMTK file %s"), filename);
+      return FALSE;
+    }
+    memcpy(dest, buffer, num_bytes);
+    g_free((gpointer) buffer);
+#else
+    amitk_append_str_with_newline(perror_buf, _("file %s is JPEG 2000 encoded and supporting libraries have not been compiled in."), filename);
+    return FALSE;
+#endif
+  }
+
+  return TRUE;
+}
+
+/* note, dicom is y = RescaleSlope * x + RescaleIntercept.
+   amide is y = scaling_factor * (x + scaling_intercept), hence the division by rescale_slope */
+static void set_slice_scaling(DcmDataset * dcm_dataset, AmitkDataSet * ds, const AmitkVoxel i) {
+
+  Float64 return_float64=0.0;
+  Float64 rescale_slope=1.0;
+
+  if (dcm_dataset->findAndGetFloat64(DCM_RescaleSlope, return_float64, 0, OFTrue).good()) 
+    rescale_slope = return_float64;
+  *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_factor, i) = rescale_slope;
+
+  if (dcm_dataset->findAndGetFloat64(DCM_RescaleIntercept, return_float64, 0, OFTrue).good()) 
+    *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_intercept, i) = return_float64/rescale_slope;
+  else
+    *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_intercept, i) = 0.0;
+
+  return;
+}
+
 static AmitkDataSet * read_dicom_file(const gchar * filename,
 				      gchar ** pstudyname,
 				      AmitkPreferences * preferences,
@@ -98,15 +262,12 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
 				      gchar **perror_buf) {
 
   DcmFileFormat dcm_format;
-  DcmMetaInfo * dcm_metainfo;
-  DcmXfer *dcm_syntax=NULL;
   DcmDataset * dcm_dataset;
   OFCondition result;
   Uint16 return_uint16=0;
   Sint32 return_sint32=0;
   Sint16 return_sint16=0;
   Float64 return_float64=0.0;
-  Float64 rescale_slope=1.0;
   Uint16 bits_allocated;
   Uint16 pixel_representation;
   const char * return_str=NULL;
@@ -121,12 +282,7 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
   AmitkVoxel dim;
   AmitkVoxel i;
   AmitkFormat format;
-  gboolean continue_work=TRUE;
   gboolean found_value;
-  const void * buffer=NULL;
-  void * ds_pointer;
-  /*  long unsigned num_bytes; */
-  gint format_size;
   AmitkPoint new_offset;
   AmitkAxes new_axes;
   AmitkPoint direction;
@@ -145,35 +301,12 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
     goto error;
   }
 
-  dcm_metainfo = dcm_format.getMetaInfo();
-  if (dcm_metainfo == NULL) {
-     g_warning(_("could not find metainfo in DICOM file %s\n"), filename);
-  }
-
   dcm_dataset = dcm_format.getDataset();
   if (dcm_dataset == NULL) {
     g_warning(_("could not find dataset in DICOM file %s\n"), filename);
     goto error;
   }
 
-  if (dcm_metainfo == NULL) {
-    dcm_syntax = new DcmXfer(dcm_dataset->getOriginalXfer());
-  } else {
-    /* What TransSyntax is used to encode the image */
-    if (dcm_metainfo->findAndGetString(DCM_TransferSyntaxUID, return_str).good()) {
-      if (return_str != NULL) {
-	//        g_debug("TransferSyntaxUID %s", return_str);
-        dcm_syntax = new DcmXfer(return_str);
-      }
-    }
-  }
-
-  if (dcm_syntax == NULL) {
-    g_warning(_("could not determine TransferSyntax %s\n"), filename);
-    goto error;
-  }
-  //    g_debug("TransferSyntax is %s (%d)", dcm_syntax->getXferName(), dcm_syntax->getXfer());
-
   modality = AMITK_MODALITY_OTHER;
   if (dcm_dataset->findAndGetString(DCM_Modality, return_str).good()) {
     if (return_str != NULL) {
@@ -210,31 +343,8 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
   }
 
 
-  /* register global decompression codecs */
-  DJDecoderRegistration::registerCodecs(EDC_photometricInterpretation,
-					EUC_default,
-					EPC_default,
-					OFFalse);
-  DcmRLEDecoderRegistration::registerCodecs();
-
-  /* uncompress the raw data in case this is a JPEG encoded file */
-  result = dcm_dataset->chooseRepresentation(EXS_LittleEndianExplicit, NULL);
-  if (result.bad()) {
-
-    /* check if this is JPEG2000, which is not currently freely supported by dcmtk */
-    return_str = dcm_syntax->getXferID();
-    if (return_str != NULL)
-      if ((strcmp(return_str, UID_JPEG2000LosslessOnlyTransferSyntax) == 0) ||
-              (strcmp(return_str, UID_JPEG2000TransferSyntax) == 0) ||
-              (strcmp(return_str, UID_JPEG2000Part2MulticomponentImageCompressionLosslessOnlyTransferSyntax) == 0) ||
-              (strcmp(return_str, UID_JPEG2000Part2MulticomponentImageCompressionTransferSyntax) == 0))
-        valid_J2K = TRUE;
-
-    if (!valid_J2K) {
-      g_warning(_("could not decompress data in DICOM file %s, dcmtk returned %s"), filename, result.text());
-      goto error;
-    }
-  }
+  if (!prepare_pixel_data(&dcm_format, filename, &valid_J2K, perror_buf))
+    goto error;
     
   /* get basic data */
   if (dcm_dataset->findAndGetUint16(DCM_Columns, return_uint16).bad()) {
@@ -687,104 +797,26 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
     }
   }
 
-  format_size = amitk_format_sizes[format];
-  /*  num_bytes = amitk_raw_format_calc_num_bytes(dim, amitk_format_to_raw_format(format)); */
-
-  /* a "GetSint16Array" function is also provided, but for some reason I get an error
-     when using it.  I'll just use GetUint16Array even for signed stuff */
-  if (!valid_J2K) {
-    switch (format) {
-      case AMITK_FORMAT_SBYTE:
-      case AMITK_FORMAT_UBYTE:
-      {
-        const Uint8 * temp_buffer;
-        result = dcm_dataset->findAndGetUint8Array(DCM_PixelData, temp_buffer);
-        buffer = (void *) temp_buffer;
-        break;
-      }
-      case AMITK_FORMAT_SSHORT:
-      case AMITK_FORMAT_USHORT:
-      {
-        const Uint16 * temp_buffer;
-        result = dcm_dataset->findAndGetUint16Array(DCM_PixelData, temp_buffer);
-        buffer = (void *) temp_buffer;
-        break;
-      }
-      case AMITK_FORMAT_SINT:
-      case AMITK_FORMAT_UINT:
-      {
-        const Uint32 * temp_buffer;
-        result = dcm_dataset->findAndGetUint32Array(DCM_PixelData, temp_buffer);
-        //      result = dcm_dataset->findAndGetUint16Array(DCM_PixelData, temp_buffer);
-        buffer = (void *) temp_buffer;
-        break;
-      }
-      default:
-        g_warning(_("unsupported data format in %s at %d\n"), __FILE__, __LINE__);
-        goto error;
-        break;
-    }
-    assert(buffer); 
+  i = zero_voxel;
 
-    if (result.bad()) {
-      g_warning(_("error reading in pixel data - DCMTK error: %s - Failed to read file %s"), result.text(), filename);
-      goto error;
-    }
-  } 
-  else {
-#ifdef AMIDE_LIBOPENJP2_SUPPORT    
-    buffer = j2k_to_raw(dcm_dataset, ds);
-    if (!buffer) {
-      g_warning(_("error while decompressing JPEG 2000 from DCMTK file %s"), filename);
-      goto error;
-    }
-#else
-    g_warning(_("file %s is JPEG 2000 encoded and supporting libraries have not been compiled in."), filename);
+  /* note, we've already flipped the coordinate axis, so reading in the data straight is correct */
+  if (!copy_pixel_data(dcm_dataset, valid_J2K, format, dim, 
+		       amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i), filename, perror_buf))
     goto error;
-#endif
-  }
-  
-  i = zero_voxel;
 
   /* store the scaling factor... if there is one */
-  if (dcm_dataset->findAndGetFloat64(DCM_RescaleSlope, rescale_slope, 0, OFTrue).good()) {
-    *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_factor, i) = rescale_slope;
-    //    g_debug("RescaleSlope: %f", return_float64);
-  }
-
-  /* same for the offset */
-  /* note, dicom is y = RescaleSlope * x + RescaleIntercept.
-     amide is y = scaling_factor * (x + scaling_intercept), hence the division by rescale_slope */
-  if (dcm_dataset->findAndGetFloat64(DCM_RescaleIntercept, return_float64, 0, OFTrue).good()) {
-    *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_intercept, i) = return_float64/rescale_slope;
-    //    g_debug("RescaleIntercept: %f", return_float64);
-  }
+  set_slice_scaling(dcm_dataset, ds, i);
 
   // MR: alternative FrameReferenceDateTime
   if (dcm_dataset->findAndGetFloat64(DCM_FrameReferenceTime, return_float64).good()) 
     amitk_data_set_set_scan_start(ds,return_float64/1000.0);
 
-  /* and load in the data - plane by plane */
-  for (i.t = 0; (i.t < dim.t) && (continue_work); i.t++) {
-
-    /* note ... doesn't seem to be a way to encode different frame durations within one dicom file */
-    if (dcm_dataset->findAndGetSint32(DCM_ActualFrameDuration, return_sint32).good()) {
-      amitk_data_set_set_frame_duration(ds,i.t, ((gdouble) return_sint32)/1000.0);
-      /* make sure it's not zero */
-      if (amitk_data_set_get_frame_duration(ds,i.t) < EPSILON) 
-	amitk_data_set_set_frame_duration(ds,i.t, EPSILON);
-    }
-
-    for (i.g = 0; (i.g < ds->raw_data->dim.g) && (continue_work); i.g++) {
-
-      /* note, we've already flipped the coordinate axis, so reading in the data straight is correct */
-      ds_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i);
-      memcpy(ds_pointer, (guchar *) buffer, format_size*ds->raw_data->dim.x*ds->raw_data->dim.y*ds->raw_data->dim.z);
-      if (valid_J2K) { /* Free allocated buffer */
-        g_free((gpointer)buffer);
-        buffer=NULL;
-      }
-    }
+  /* note ... doesn't seem to be a way to encode different frame durations within one dicom file */
+  if (dcm_dataset->findAndGetSint32(DCM_ActualFrameDuration, return_sint32).good()) {
+    amitk_data_set_set_frame_duration(ds,i.t, ((gdouble) return_sint32)/1000.0);
+    /* make sure it's not zero */
+    if (amitk_data_set_get_frame_duration(ds,i.t) < EPSILON) 
+      amitk_data_set_set_frame_duration(ds,i.t, EPSILON);
   }
 
 
@@ -807,10 +839,6 @@ static AmitkDataSet * read_dicom_file(const gchar * filename,
 
   /* deregister global decompression codecs */
   DJDecoderRegistration::cleanup();
- if (valid_J2K && buffer) { /* Free allocated buffer */
-   //g_free((gpointer)buffer);
-   //buffer=NULL;
- }
  
   return ds;
 }
@@ -821,37 +849,831 @@ void transfer_slice(AmitkDataSet * ds, AmitkDataSet * slice_ds, AmitkVoxel i) {
   void * ds_pointer;
   void * slice_pointer;
 
-  num_bytes_to_transfer =  amitk_raw_format_calc_num_bytes(AMITK_DATA_SET_DIM(slice_ds), AMITK_DATA_SET_FORMAT(slice_ds));
+  num_bytes_to_transfer =  amitk_raw_format_calc_num_bytes(AMITK_DATA_SET_DIM(slice_ds), AMITK_DATA_SET_FORMAT(slice_ds));
+
+  ds_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i);
+  g_return_if_fail(ds_pointer != NULL);
+  slice_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(slice_ds), zero_voxel);
+  g_return_if_fail(slice_pointer != NULL);
+  memcpy(ds_pointer, slice_pointer, num_bytes_to_transfer);
+	  
+  /* copy the scaling factors */
+  *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_factor, i) = 
+    amitk_data_set_get_internal_scaling_factor(slice_ds, zero_voxel);
+  *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_intercept, i) = 
+    amitk_data_set_get_scaling_intercept(slice_ds, zero_voxel);
+
+  return;
+}
+
+/* reads the pixel data of a single slice DICOM file straight into plane i of the data set, the 
+   header's already been dealt with by get_slice_info. The slices get grouped by size and format 
+   beforehand, so a mismatch here means the file's changed since it got scanned */
+static gboolean read_dicom_pixels(const gchar * filename, AmitkDataSet * ds, const AmitkVoxel i,
+				  gchar ** perror_buf) {
+
+  DcmFileFormat dcm_format;
+  DcmDataset * dcm_dataset;
+  OFCondition result;
+  Uint16 return_uint16;
+  AmitkFormat format;
+  AmitkVoxel dim;
+  gboolean is_signed;
+  gboolean valid_J2K=FALSE;
+  gboolean valid=FALSE;
+  void * ds_pointer;
+
+  result = dcm_format.loadFile(filename);
+  if (result.bad()) {
+    amitk_append_str_with_newline(perror_buf, _("could not read DICOM file %s, dcmtk returned %s"), filename, result.text());
+    return FALSE;
+  }
+
+  dcm_dataset = dcm_format.getDataset();
+  if (dcm_dataset == NULL) {
+    amitk_append_str_with_newline(perror_buf, _("could not find dataset in DICOM file %s"), filename);
+    return FALSE;
+  }
+
+  if (!prepare_pixel_data(&dcm_format, filename, &valid_J2K, perror_buf))
+    goto function_end;
+
+  /* make sure the slice fits into the plane we've allocated for it */
+  format = AMITK_DATA_SET_FORMAT(ds);
+  is_signed = ((format == AMITK_FORMAT_SBYTE) || (format == AMITK_FORMAT_SSHORT) || (format == AMITK_FORMAT_SINT));
+  dim = AMITK_DATA_SET_DIM(ds);
+  dim.z = dim.g = dim.t = 1;
+  if ((dcm_dataset->findAndGetUint16(DCM_Columns, return_uint16).bad()) || (return_uint16 != dim.x) ||
+      (dcm_dataset->findAndGetUint16(DCM_Rows, return_uint16).bad()) || (return_uint16 != dim.y) ||
+      (dcm_dataset->findAndGetUint16(DCM_BitsAllocated, return_uint16).bad()) || 
+      (return_uint16 != 8*amitk_format_sizes[format]) ||
+      (dcm_dataset->findAndGetUint16(DCM_PixelRepresentation, return_uint16).bad()) || 
+      ((return_uint16 != 0) != is_signed)) {
+    amitk_append_str_with_newline(perror_buf, _("image size or pixel format of DICOM file %s has changed since it was scanned"), filename);
+    goto function_end;
+  }
+
+  ds_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i);
+  if (!copy_pixel_data(dcm_dataset, valid_J2K, format, dim, ds_pointer, filename, perror_buf))
+    goto function_end;
+
+  set_slice_scaling(dcm_dataset, ds, i);
+  valid = TRUE;
+
+ function_end:
+
+  /* deregister global decompression codecs */
+  DJDecoderRegistration::cleanup();
+
+  return valid;
+}
+
+typedef struct slice_info_t {
+  gchar * filename;
+  gint64 file_size; /* size and time are used to check if the index entry is stale */
+  gint64 modification_time;
+  gchar * series_instance_uid;
+  gchar * modality;
+  gchar * series_description;
+  gchar * patient_digest; /* hash of the patient id and name, so the index holds no identifiers */
+  gint series_number;
+
+  /* what's needed to group the slices into volumes, and put them in order */
+  gchar * image_type;
+  AmitkVoxel dim;
+  gint bits_allocated; /* these two give the data format, -1 if missing */
+  gint pixel_representation;
+  AmitkPoint voxel_size;
+  AmitkAxes axes;
+  AmitkPoint offset;
+  gint instance_number;
+  gint gate_num;
+  amide_time_t gate_time;
+  amide_time_t scan_start;
+  amide_time_t frame_duration;
+  amide_time_t inversion_time;
+  amide_time_t echo_time;
+  gdouble diffusion_b_value;
+  AmitkPoint diffusion_direction;
+
+  /* how the series divides up into frames/gates, -1 if the file doesn't say */
+  gint num_frames;
+  gint num_gates;
+  gint num_slices;
+} slice_info_t;
+
+static void free_slice_info(slice_info_t * info) {
+
+  if (info->filename != NULL)
+    g_free(info->filename);
+
+  if (info->series_instance_uid != NULL)
+    g_free(info->series_instance_uid);
+
+  if (info->modality != NULL)
+    g_free(info->modality);
+  
+  if (info->series_description != NULL)
+    g_free(info->series_description);
+
+  if (info->patient_digest != NULL)
+    g_free(info->patient_digest);
+
+  if (info->image_type != NULL)
+    g_free(info->image_type);
+
+  g_free(info);
+
+  return;
+}
+
+static slice_info_t * slice_info_new(void) {
+
+  slice_info_t * info;
+
+  info = g_try_new(slice_info_t, 1);
+  info->filename=NULL;
+  info->series_instance_uid=NULL;
+  info->modality=NULL;
+  info->series_description=NULL;
+  info->patient_digest=NULL;
+  info->series_number = -1;
+  info->file_size = -1;
+  info->modification_time = -1;
+
+  info->image_type=NULL;
+  info->dim = one_voxel;
+  info->bits_allocated = -1;
+  info->pixel_representation = -1;
+  info->voxel_size = one_point;
+  info->axes[AMITK_AXIS_X] = base_axes[AMITK_AXIS_X];
+  info->axes[AMITK_AXIS_Y] = base_axes[AMITK_AXIS_Y];
+  info->axes[AMITK_AXIS_Z] = base_axes[AMITK_AXIS_Z];
+  info->offset = zero_point;
+  info->instance_number = 0;
+  info->gate_num = -1;
+  info->gate_time = 0.0;
+  info->scan_start = 0.0;
+  info->frame_duration = 1.0;
+  info->inversion_time = NAN;
+  info->echo_time = NAN;
+  info->diffusion_b_value = NAN;
+  info->diffusion_direction = zero_point;
+  info->num_frames = -1;
+  info->num_gates = -1;
+  info->num_slices = -1;
+
+  return info;
+}
+
+/* the geometry and timing of the slice, interpreted the same way as in read_dicom_file */
+static void get_slice_geometry(DcmDataset * dcm_dataset, slice_info_t * info) {
+
+  const char * return_str=NULL;
+  Uint16 return_uint16;
+  Sint16 return_sint16;
+  Sint32 return_sint32;
+  Float64 return_float64;
+  AmitkAxes new_axes;
+  AmitkPoint new_offset;
+  gint i;
+  gboolean found_value;
+
+  if (dcm_dataset->findAndGetString(DCM_ImageType, return_str).good())
+    if (return_str != NULL)
+      info->image_type = g_strdup(return_str);
+
+  if (dcm_dataset->findAndGetUint16(DCM_Columns, return_uint16).good())
+    info->dim.x = return_uint16;
+  if (dcm_dataset->findAndGetUint16(DCM_Rows, return_uint16).good())
+    info->dim.y = return_uint16;
+  if (dcm_dataset->findAndGetUint16(DCM_BitsAllocated, return_uint16).good())
+    info->bits_allocated = return_uint16;
+  if (dcm_dataset->findAndGetUint16(DCM_PixelRepresentation, return_uint16).good())
+    info->pixel_representation = return_uint16;
+  return_str = NULL;
+  if (dcm_dataset->findAndGetString(DCM_NumberOfFrames, return_str, OFTrue).bad()) {
+    if (dcm_dataset->findAndGetUint16(DCM_RETIRED_Planes, return_uint16).good()) 
+      info->dim.z = return_uint16;
+  } else if (return_str != NULL) {
+    if (sscanf(return_str, "%d", &(return_sint32)) == 1)
+      info->dim.z = return_sint32;
+  }
+
+  if (dcm_dataset->findAndGetFloat64(DCM_PixelSpacing, return_float64, 0, OFTrue).good()) {
+    info->voxel_size.y = return_float64;
+    if (dcm_dataset->findAndGetFloat64(DCM_PixelSpacing, return_float64,1, OFTrue).good())
+      info->voxel_size.x = return_float64;
+    else
+      info->voxel_size.x = info->voxel_size.y;
+  }
+  info->voxel_size.z = -1;
+  if (dcm_dataset->findAndGetFloat64(DCM_SpacingBetweenSlices, return_float64, 0, OFTrue).good()) 
+    info->voxel_size.z = return_float64;
+  if (info->voxel_size.z <= 0.0) {
+    if (dcm_dataset->findAndGetFloat64(DCM_SliceThickness, return_float64, 0, OFTrue).good()) 
+      info->voxel_size.z = return_float64;
+    else
+      info->voxel_size.z = 1;
+  }
+
+  if (dcm_dataset->findAndGetSint32(DCM_InstanceNumber, return_sint32).good())
+    info->instance_number = return_sint32;
+
+  /* DICOM is LPH+, AMIDE is LAF+ */
+  new_axes[AMITK_AXIS_X] = base_axes[AMITK_AXIS_X];
+  new_axes[AMITK_AXIS_Y] = base_axes[AMITK_AXIS_Y];
+  found_value = TRUE;
+  for (i=0; (i<6) && found_value; i++) {
+    found_value = dcm_dataset->findAndGetFloat64(DCM_ImageOrientationPatient, return_float64, i, OFTrue).good();
+    if (found_value) {
+      switch(i % 3) {
+      case 0: new_axes[i/3].x = return_float64; break;
+      case 1: new_axes[i/3].y = return_float64; break;
+      default: new_axes[i/3].z = return_float64; break;
+      }
+    }
+  }
+  new_axes[AMITK_AXIS_X].y *= -1.0;
+  new_axes[AMITK_AXIS_X].z *= -1.0;
+  new_axes[AMITK_AXIS_Y].y *= -1.0;
+  new_axes[AMITK_AXIS_Y].z *= -1.0;
+  POINT_CROSS_PRODUCT(new_axes[AMITK_AXIS_X], new_axes[AMITK_AXIS_Y], new_axes[AMITK_AXIS_Z]);
+  for (i=0; i<3; i++)
+    info->axes[i] = new_axes[i];
+
+  found_value=FALSE;
+  if (dcm_dataset->findAndGetFloat64(DCM_ImagePositionPatient, return_float64, 0, OFTrue).good()) {
+    new_offset.x = return_float64;
+    if (dcm_dataset->findAndGetFloat64(DCM_ImagePositionPatient, return_float64, 1, OFTrue).good()) {
+      new_offset.y = -1.0*return_float64; /* DICOM specifies y axis in wrong direction */
+      if (dcm_dataset->findAndGetFloat64(DCM_ImagePositionPatient, return_float64, 2, OFTrue).good()) {
+	new_offset.z = -1.0*return_float64; /* DICOM specifies z axis in wrong direction */
+	info->offset = new_offset;
+	found_value=TRUE;
+      }
+    }
+  }
+  if (!found_value) 
+    if (dcm_dataset->findAndGetFloat64(DCM_SliceLocation, return_float64, 0, OFTrue).good()) {
+      info->offset.x = info->offset.y = 0.0;
+      info->offset.z = -1.0*return_float64;
+    }
+
+  if (dcm_dataset->findAndGetFloat64(DCM_InversionTime, return_float64).good())
+    info->inversion_time = return_float64;
+  if (dcm_dataset->findAndGetFloat64(DCM_EchoTime, return_float64).good())
+    info->echo_time = return_float64;
+  if (dcm_dataset->findAndGetFloat64(DCM_DiffusionBValue, return_float64, 0, OFTrue).good()) 
+    info->diffusion_b_value = return_float64;
+  else if (dcm_dataset->findAndGetSint32(DcmTagKey(0x0043, 0x1039), return_sint32, 0, OFTrue).good()) /* GE */
+    info->diffusion_b_value = return_sint32;
+
+  if (dcm_dataset->findAndGetFloat64(DCM_DiffusionGradientOrientation, return_float64, 0, OFTrue).good())
+    info->diffusion_direction.x = return_float64;
+  if (dcm_dataset->findAndGetFloat64(DCM_DiffusionGradientOrientation, return_float64, 1, OFTrue).good())
+    info->diffusion_direction.y = return_float64;
+  if (dcm_dataset->findAndGetFloat64(DCM_DiffusionGradientOrientation, return_float64, 2, OFTrue).good())
+    info->diffusion_direction.z = return_float64;
+  if (POINT_EQUAL(info->diffusion_direction, zero_point)) { /* GE */
+    if (dcm_dataset->findAndGetFloat64(DcmTagKey(0x0019, 0x10bb), return_float64, 0, OFTrue).good())
+      info->diffusion_direction.x = return_float64;
+    if (dcm_dataset->findAndGetFloat64(DcmTagKey(0x0019, 0x10bc), return_float64, 0, OFTrue).good())
+      info->diffusion_direction.y = return_float64;
+    if (dcm_dataset->findAndGetFloat64(DcmTagKey(0x0019, 0x10bd), return_float64, 0, OFTrue).good())
+      info->diffusion_direction.z = return_float64;
+  }
+
+  /* DICOM stores these in milliseconds */
+  if (dcm_dataset->findAndGetFloat64(DCM_TriggerTime, return_float64).good())
+    info->gate_time = return_float64/1000.0;
+  if (dcm_dataset->findAndGetSint32(DCM_TemporalPositionIdentifier, return_sint32).good())
+    info->gate_num = return_sint32;
+  if (dcm_dataset->findAndGetFloat64(DCM_FrameReferenceTime, return_float64).good()) 
+    info->scan_start = return_float64/1000.0;
+  if (dcm_dataset->findAndGetSint32(DCM_ActualFrameDuration, return_sint32).good()) {
+    info->frame_duration = ((gdouble) return_sint32)/1000.0;
+    if (info->frame_duration < EPSILON) 
+      info->frame_duration = EPSILON;
+  }
+
+  /* TimeSlices can also indicate # of bed positions, so only use for number of frames
+     if this is explicitly a DYNAMIC data set */
+  return_str = NULL;
+  if (dcm_dataset->findAndGetString(DCM_SeriesType, return_str, OFTrue).good()) 
+    if (return_str != NULL) {
+      if (strstr(return_str, "DYNAMIC") != NULL)
+	if (dcm_dataset->findAndGetUint16(DCM_NumberOfTimeSlices, return_uint16).good()) 
+	  info->num_frames = return_uint16;
+      if (strstr(return_str, "GATED\\IMAGE") != NULL)
+	if (dcm_dataset->findAndGetUint16(DCM_NumberOfTimeSlots, return_uint16).good()) 
+	  info->num_gates = return_uint16;
+    }
+
+  /* some files use NumberOfTemporalPositions */
+  if (info->num_gates <= 1)
+    if (dcm_dataset->findAndGetSint32(DCM_NumberOfTemporalPositions, return_sint32).good()) 
+      if (return_sint32 > 0)
+	info->num_gates = return_sint32;
+
+  /* 0x0021,0x104f corresponds to LocationsInAcquisition */
+  if (dcm_dataset->findAndGetSint16(DcmTagKey(0x0021, 0x104f), return_sint16).good())
+    if (return_sint16 > 0)
+      info->num_slices = return_sint16;
+
+  return;
+}
+
+
+/* elements longer than this are left on disk by older versions of dcmtk, 
+   which can't stop parsing at a given tag */
+#define HEADER_MAX_READ_LENGTH 4096
+
+/* a missing tag hashes differently than an empty one, same as check_str tells them apart */
+static void patient_digest_update(GChecksum * checksum, const char * str) {
+
+  if (str == NULL) {
+    g_checksum_update(checksum, (const guchar *) "-", 1);
+  } else {
+    g_checksum_update(checksum, (const guchar *) "+", 1);
+    g_checksum_update(checksum, (const guchar *) str, strlen(str)+1);
+  }
+
+  return;
+}
+
+/* only reads the header, so it's safe to call from multiple threads */
+
+static slice_info_t * get_slice_info(const gchar * filename) {
+
+  OFCondition result;
+  DcmFileFormat dcm_format;
+  DcmDataset * dcm_dataset;
+  const char * return_str=NULL;
+  slice_info_t * info=NULL;
+  Sint32 return_sint32;
+  GChecksum * checksum;
+  GStatBuf file_info;
+
+  if (g_stat(filename, &file_info) != 0) return NULL;
+
+  /* everything we need comes before the pixel data, so don't bother reading it in */
+#if OFFIS_DCMTK_VERSION_NUMBER >= 362
+  result = dcm_format.loadFileUntilTag(filename, EXS_Unknown, EGL_noChange, 
+				       DCM_MaxReadLength, ERM_autoDetect, DCM_PixelData);
+#else
+  result = dcm_format.loadFile(filename, EXS_Unknown, EGL_noChange, HEADER_MAX_READ_LENGTH);
+#endif
+  if (result.bad()) return NULL;
+
+  dcm_dataset = dcm_format.getDataset();
+  if (dcm_dataset == NULL) return NULL;
+
+  info = slice_info_new();
+  info->filename = g_strdup(filename);
+  info->file_size = file_info.st_size;
+  info->modification_time = file_info.st_mtime;
+
+  dcm_dataset->findAndGetString(DCM_SeriesInstanceUID, return_str, OFTrue);
+  if (return_str != NULL)
+      info->series_instance_uid = g_strdup(return_str);
+
+  dcm_dataset->findAndGetString(DCM_Modality, return_str, OFTrue);
+  if (return_str != NULL)
+      info->modality = g_strdup(return_str);
+
+  dcm_dataset->findAndGetString(DCM_SeriesDescription, return_str, OFTrue);
+  if (return_str != NULL) 
+      info->series_description = g_strdup(return_str);
+
+  /* only needed to tell patients apart, the data set gets the actual id and name 
+     from the template file when it's read in */
+  checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  dcm_dataset->findAndGetString(DCM_PatientID, return_str, OFTrue);
+  patient_digest_update(checksum, return_str);
+  dcm_dataset->findAndGetString(DCM_PatientName, return_str, OFTrue);
+  patient_digest_update(checksum, return_str);
+  info->patient_digest = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+
+  if (dcm_dataset->findAndGetSint32(DCM_SeriesNumber, return_sint32).good())
+    info->series_number = return_sint32;
+
+  get_slice_geometry(dcm_dataset, info);
+
+  return info;
+}
+
+
+
+/* the header index - one file per directory in the index directory, holding the slice_info_t 
+   of each DICOM file in that directory, so the files don't have to be parsed again the next 
+   time the directory gets opened */
+#define DICOM_INDEX_VERSION 4
+#define DICOM_INDEX_GROUP "Index"
+#define DICOM_INDEX_MAX_AGE (60*24*60*60) /* seconds an index is kept without its directory being opened */
+
+/* the directory an index is for, made absolute and canonical so the same directory
+   reached by a different path (relative, through "..", or a symlink) gets the same index,
+   and different directories with the same relative name don't.  Needs to be free'd */
+static gchar * dicom_index_dirname(const gchar * dirname) {
+
+  gchar * current_dir;
+  gchar * absolute_dirname;
+#ifndef G_OS_WIN32
+  char * real_dirname;
+#endif
+
+  if (g_path_is_absolute(dirname)) {
+    absolute_dirname = g_strdup(dirname);
+  } else {
+    current_dir = g_get_current_dir();
+    absolute_dirname = g_build_filename(current_dir, dirname, NULL);
+    g_free(current_dir);
+  }
+
+#ifndef G_OS_WIN32
+  if ((real_dirname = realpath(absolute_dirname, NULL)) != NULL) {
+    g_free(absolute_dirname);
+    absolute_dirname = g_strdup(real_dirname);
+    free(real_dirname);
+  }
+#endif
+
+  return absolute_dirname;
+}
+
+/* index_dirname is from dicom_index_dirname */
+static gchar * dicom_index_filename(AmitkPreferences * preferences, const gchar * index_dirname) {
+
+  gchar * checksum;
+  gchar * index_dir;
+  gchar * index_filename;
+
+  checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, index_dirname, -1);
+  index_dir = amitk_preferences_get_dicom_index_directory(preferences);
+  index_filename = g_strdup_printf("%s%s%s.index", index_dir, G_DIR_SEPARATOR_S, checksum);
+
+  g_free(index_dir);
+  g_free(checksum);
+
+  return index_filename;
+}
+
+static gboolean get_index_point(GKeyFile * key_file, const gchar * group, const gchar * key, AmitkPoint * point) {
+
+  gdouble * values;
+  gsize length=0;
+
+  values = g_key_file_get_double_list(key_file, group, key, &length, NULL);
+  if (values == NULL) return FALSE;
+  if (length == 3) {
+    point->x = values[0];
+    point->y = values[1];
+    point->z = values[2];
+  }
+  g_free(values);
+
+  return (length == 3);
+}
+
+static void set_index_point(GKeyFile * key_file, const gchar * group, const gchar * key, const AmitkPoint point) {
+
+  gdouble values[3];
+
+  values[0] = point.x;
+  values[1] = point.y;
+  values[2] = point.z;
+  g_key_file_set_double_list(key_file, group, key, values, 3);
+
+  return;
+}
+
+static void set_index_string(GKeyFile * key_file, const gchar * group, const gchar * key, const gchar * str) {
+  if (str != NULL)
+    g_key_file_set_string(key_file, group, key, str);
+  return;
+}
+
+/* a missing string key is fine, anything else that goes wrong means we just won't use this entry */
+static gboolean get_index_string(GKeyFile * key_file, const gchar * group, const gchar * key, gchar ** pstr) {
+
+  GError * error=NULL;
+
+  if (!g_key_file_has_key(key_file, group, key, NULL)) 
+    return TRUE;
+
+  *pstr = g_key_file_get_string(key_file, group, key, &error);
+  if (error != NULL) {
+    g_error_free(error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static slice_info_t * slice_info_from_index(GKeyFile * key_file, const gchar * group) {
+
+  slice_info_t * info;
+  GError * error=NULL;
+  gint * dims;
+  gsize length=0;
+  gboolean valid;
+
+  info = slice_info_new();
+
+  valid = get_index_string(key_file, group, "Filename", &(info->filename)) && (info->filename != NULL);
+  if (valid) valid = get_index_string(key_file, group, "SeriesInstanceUID", &(info->series_instance_uid));
+  if (valid) valid = get_index_string(key_file, group, "Modality", &(info->modality));
+  if (valid) valid = get_index_string(key_file, group, "SeriesDescription", &(info->series_description));
+  if (valid) valid = get_index_string(key_file, group, "PatientDigest", &(info->patient_digest));
+  if (valid) valid = get_index_string(key_file, group, "ImageType", &(info->image_type));
+
+  if (valid) {
+    info->file_size = g_key_file_get_int64(key_file, group, "FileSize", &error);
+    if (error == NULL) info->modification_time = g_key_file_get_int64(key_file, group, "ModificationTime", &error);
+    if (error == NULL) info->series_number = g_key_file_get_integer(key_file, group, "SeriesNumber", &error);
+    if (error == NULL) info->instance_number = g_key_file_get_integer(key_file, group, "InstanceNumber", &error);
+    if (error == NULL) info->gate_num = g_key_file_get_integer(key_file, group, "GateNumber", &error);
+    if (error == NULL) info->gate_time = g_key_file_get_double(key_file, group, "GateTime", &error);
+    if (error == NULL) info->scan_start = g_key_file_get_double(key_file, group, "ScanStart", &error);
+    if (error == NULL) info->frame_duration = g_key_file_get_double(key_file, group, "FrameDuration", &error);
+    if (error == NULL) info->inversion_time = g_key_file_get_double(key_file, group, "InversionTime", &error);
+    if (error == NULL) info->echo_time = g_key_file_get_double(key_file, group, "EchoTime", &error);
+    if (error == NULL) info->diffusion_b_value = g_key_file_get_double(key_file, group, "DiffusionBValue", &error);
+    if (error == NULL) info->num_frames = g_key_file_get_integer(key_file, group, "NumFrames", &error);
+    if (error == NULL) info->num_gates = g_key_file_get_integer(key_file, group, "NumGates", &error);
+    if (error == NULL) info->num_slices = g_key_file_get_integer(key_file, group, "NumSlices", &error);
+    if (error == NULL) info->bits_allocated = g_key_file_get_integer(key_file, group, "BitsAllocated", &error);
+    if (error == NULL) info->pixel_representation = g_key_file_get_integer(key_file, group, "PixelRepresentation", &error);
+    if (error != NULL) {
+      g_error_free(error);
+      valid = FALSE;
+    }
+  }
+
+  if (valid) {
+    dims = g_key_file_get_integer_list(key_file, group, "Dimensions", &length, NULL);
+    valid = (dims != NULL) && (length == 3);
+    if (valid) {
+      info->dim.x = dims[0];
+      info->dim.y = dims[1];
+      info->dim.z = dims[2];
+    }
+    if (dims != NULL) g_free(dims);
+  }
+
+  if (valid) valid = get_index_point(key_file, group, "VoxelSize", &(info->voxel_size));
+  if (valid) valid = get_index_point(key_file, group, "AxisX", &(info->axes[AMITK_AXIS_X]));
+  if (valid) valid = get_index_point(key_file, group, "AxisY", &(info->axes[AMITK_AXIS_Y]));
+  if (valid) valid = get_index_point(key_file, group, "AxisZ", &(info->axes[AMITK_AXIS_Z]));
+  if (valid) valid = get_index_point(key_file, group, "Offset", &(info->offset));
+  if (valid) valid = get_index_point(key_file, group, "DiffusionDirection", &(info->diffusion_direction));
+
+  if (!valid) {
+    free_slice_info(info);
+    info = NULL;
+  }
+
+  return info;
+}
+
+static void slice_info_to_index(GKeyFile * key_file, const gchar * group, const slice_info_t * info) {
+
+  gint dims[3];
+
+  set_index_string(key_file, group, "Filename", info->filename);
+  g_key_file_set_int64(key_file, group, "FileSize", info->file_size);
+  g_key_file_set_int64(key_file, group, "ModificationTime", info->modification_time);
+  set_index_string(key_file, group, "SeriesInstanceUID", info->series_instance_uid);
+  set_index_string(key_file, group, "Modality", info->modality);
+  set_index_string(key_file, group, "SeriesDescription", info->series_description);
+  set_index_string(key_file, group, "PatientDigest", info->patient_digest);
+  g_key_file_set_integer(key_file, group, "SeriesNumber", info->series_number);
+
+  set_index_string(key_file, group, "ImageType", info->image_type);
+  dims[0] = info->dim.x;
+  dims[1] = info->dim.y;
+  dims[2] = info->dim.z;
+  g_key_file_set_integer_list(key_file, group, "Dimensions", dims, 3);
+  g_key_file_set_integer(key_file, group, "BitsAllocated", info->bits_allocated);
+  g_key_file_set_integer(key_file, group, "PixelRepresentation", info->pixel_representation);
+  set_index_point(key_file, group, "VoxelSize", info->voxel_size);
+  set_index_point(key_file, group, "AxisX", info->axes[AMITK_AXIS_X]);
+  set_index_point(key_file, group, "AxisY", info->axes[AMITK_AXIS_Y]);
+  set_index_point(key_file, group, "AxisZ", info->axes[AMITK_AXIS_Z]);
+  set_index_point(key_file, group, "Offset", info->offset);
+  g_key_file_set_integer(key_file, group, "InstanceNumber", info->instance_number);
+  g_key_file_set_integer(key_file, group, "GateNumber", info->gate_num);
+  g_key_file_set_double(key_file, group, "GateTime", info->gate_time);
+  g_key_file_set_double(key_file, group, "ScanStart", info->scan_start);
+  g_key_file_set_double(key_file, group, "FrameDuration", info->frame_duration);
+  g_key_file_set_double(key_file, group, "InversionTime", info->inversion_time);
+  g_key_file_set_double(key_file, group, "EchoTime", info->echo_time);
+  g_key_file_set_double(key_file, group, "DiffusionBValue", info->diffusion_b_value);
+  set_index_point(key_file, group, "DiffusionDirection", info->diffusion_direction);
+  g_key_file_set_integer(key_file, group, "NumFrames", info->num_frames);
+  g_key_file_set_integer(key_file, group, "NumGates", info->num_gates);
+  g_key_file_set_integer(key_file, group, "NumSlices", info->num_slices);
+
+  return;
+}
+
+/* returns a hash table of filename -> slice_info_t, which is empty if there's no usable index.
+   index_dirname is from dicom_index_dirname */
+static GHashTable * dicom_index_load(const gchar * index_filename, const gchar * index_dirname) {
+
+  GHashTable * index;
+  GKeyFile * key_file;
+  gchar ** groups;
+  gchar * indexed_dirname;
+  slice_info_t * info;
+  gint i;
+
+  index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_slice_info);
+
+  key_file = g_key_file_new();
+  if (!g_key_file_load_from_file(key_file, index_filename, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free(key_file);
+    return index;
+  }
+
+  /* make sure the index is for this directory, and of a version we understand */
+  indexed_dirname = g_key_file_get_string(key_file, DICOM_INDEX_GROUP, "Directory", NULL);
+  if ((g_key_file_get_integer(key_file, DICOM_INDEX_GROUP, "Version", NULL) == DICOM_INDEX_VERSION) &&
+      (g_strcmp0(indexed_dirname, index_dirname) == 0)) {
+    groups = g_key_file_get_groups(key_file, NULL);
+    for (i=0; groups[i] != NULL; i++) {
+      if (strcmp(groups[i], DICOM_INDEX_GROUP) != 0) {
+	info = slice_info_from_index(key_file, groups[i]);
+	if (info != NULL)
+	  g_hash_table_replace(index, info->filename, info);
+      }
+    }
+    g_strfreev(groups);
+  }
+  if (indexed_dirname != NULL) g_free(indexed_dirname);
+  g_key_file_free(key_file);
+
+  return index;
+}
+
+/* our files are the SHA1 of the directory name with an .index extension, plus the 
+   .XXXXXX suffix of a temporary file. The index directory might be shared with other files. */
+static gboolean dicom_index_is_index_file(const gchar * name) {
+
+  gsize length;
+  gsize checksum_length;
+
+  checksum_length = g_checksum_type_get_length(G_CHECKSUM_SHA1)*2;
+  length = strlen(name);
+
+  if ((length != checksum_length+strlen(".index")) && 
+      (length != checksum_length+strlen(".index.XXXXXX")))
+    return FALSE;
+
+  return (strncmp(name+checksum_length, ".index", strlen(".index")) == 0);
+}
+
+/* removes the indexes (and any temporary files left behind by a crash while saving) of 
+   directories that haven't been opened in a while. Opening a directory touches its index, 
+   so this is just the ones that have moved, been deleted, or are no longer of interest. */
+static void dicom_index_prune(AmitkPreferences * preferences) {
+
+  static gboolean pruned=FALSE;
+  gchar * index_dir;
+  GDir * dir;
+  const gchar * name;
+  gchar * filename;
+  GStatBuf file_info;
+  gint64 now;
+
+  /* once a session is plenty */
+  if (pruned) return;
+  pruned = TRUE;
+
+  index_dir = amitk_preferences_get_dicom_index_directory(preferences);
+  now = g_get_real_time()/G_USEC_PER_SEC;
+
+  if ((dir = g_dir_open(index_dir, 0, NULL)) != NULL) {
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      if (dicom_index_is_index_file(name)) {
+	filename = g_build_filename(index_dir, name, NULL);
+	if (g_stat(filename, &file_info) == 0) 
+	  if (S_ISREG(file_info.st_mode) && (now - file_info.st_mtime > DICOM_INDEX_MAX_AGE))
+	    g_unlink(filename);
+	g_free(filename);
+      }
+    }
+    g_dir_close(dir);
+  }
+  g_free(index_dir);
+
+  return;
+}
+
+/* the index is written out to a temporary file which is then renamed into place, so other
+   copies of AMIDE reading the index at the same time see either the old or the new index.
+   Both the index directory and the index files are only accessible by the user. */
+static void dicom_index_save(const gchar * index_filename, const gchar * index_dirname, GList * infos) {
+
+  GKeyFile * key_file;
+  gchar * index_dir;
+  gchar * temp_filename;
+  gchar * group;
+  gchar * data;
+  gsize length;
+  gint i;
+  gint fd;
+  FILE * file;
+  gboolean written;
+
+  index_dir = g_path_get_dirname(index_filename);
+  g_mkdir_with_parents(index_dir, 0700);
+  g_free(index_dir);
+
+  key_file = g_key_file_new();
+  g_key_file_set_integer(key_file, DICOM_INDEX_GROUP, "Version", DICOM_INDEX_VERSION);
+  g_key_file_set_string(key_file, DICOM_INDEX_GROUP, "Directory", index_dirname);
+  for (i=0; infos != NULL; infos = infos->next, i++) {
+    group = g_strdup_printf("Slice %d", i);
+    slice_info_to_index(key_file, group, (slice_info_t *) infos->data);
+    g_free(group);
+  }
+
+  data = g_key_file_to_data(key_file, &length, NULL);
+
+  /* g_mkstemp creates the file with mode 0600 */
+  temp_filename = g_strdup_printf("%s.XXXXXX", index_filename);
+  fd = g_mkstemp(temp_filename);
+  written = FALSE;
+  if (fd >= 0) {
+    if ((file = fdopen(fd, "wb")) != NULL) {
+      written = (fwrite(data, 1, length, file) == length);
+      if (fclose(file) != 0) written = FALSE;
+    } else {
+      g_close(fd, NULL);
+    }
+#ifdef G_OS_WIN32
+    if (written) g_unlink(index_filename); /* rename won't replace an existing file on windows */
+#endif
+    if (written) written = (g_rename(temp_filename, index_filename) == 0);
+    if (!written) g_unlink(temp_filename);
+  }
+#ifdef AMIDE_DEBUG
+  if (!written)
+    g_print("couldn't write DICOM index %s\n", index_filename);
+#endif
+  g_free(temp_filename);
+  g_free(data);
+  g_key_file_free(key_file);
+
+  return;
+}
+
+/* takes the entry for the file out of the index, if it's still up to date */
+static slice_info_t * dicom_index_lookup(GHashTable * index, const gchar * filename) {
+
+  slice_info_t * info;
+  GStatBuf file_info;
+
+  info = (slice_info_t *) g_hash_table_lookup(index, filename);
+  if (info == NULL) return NULL;
+  if (g_stat(filename, &file_info) != 0) return NULL;
+  if ((info->file_size != file_info.st_size) || (info->modification_time != file_info.st_mtime))
+    return NULL;
+
+  g_hash_table_steal(index, filename);
+  return info;
+}
+
+/* ---------- putting the slices together into data sets ----------
+   everything here works off the slice_info_t header summaries, the pixel data of a file
+   only gets read in once we know which plane of which data set it belongs in */
 
-  ds_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i);
-  g_return_if_fail(ds_pointer != NULL);
-  slice_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(slice_ds), zero_voxel);
-  g_return_if_fail(slice_pointer != NULL);
-  memcpy(ds_pointer, slice_pointer, num_bytes_to_transfer);
-	  
-  /* copy the scaling factors */
-  *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_factor, i) = 
-    amitk_data_set_get_internal_scaling_factor(slice_ds, zero_voxel);
-  *AMITK_RAW_DATA_DOUBLE_2D_SCALING_POINTER(ds->internal_scaling_intercept, i) = 
-    amitk_data_set_get_scaling_intercept(slice_ds, zero_voxel);
+static gboolean slice_is_mri(const slice_info_t * info) {
 
-  return;
+  if (info->modality == NULL) return FALSE;
+
+  return ((g_ascii_strcasecmp(info->modality, "MA") == 0) ||
+	  (g_ascii_strcasecmp(info->modality, "MR") == 0) ||
+	  (g_ascii_strcasecmp(info->modality, "MS") == 0));
 }
 
 /* sort by location */
 static gint sort_slices_func(gconstpointer a, gconstpointer b) {
-  AmitkDataSet * slice_a = (AmitkDataSet *) a;
-  AmitkDataSet * slice_b = (AmitkDataSet *) b;
-  AmitkPoint offset_b;
+  const slice_info_t * slice_a = (const slice_info_t *) a;
+  const slice_info_t * slice_b = (const slice_info_t *) b;
+  AmitkPoint diff;
+  amide_real_t z;
 
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_a), -1);
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_b), 1);
+  /* position of slice b along slice a's z axis */
+  POINT_SUB(slice_b->offset, slice_a->offset, diff);
+  z = POINT_DOT_PRODUCT(diff, slice_a->axes[AMITK_AXIS_Z]);
 
-  offset_b = amitk_space_b2s(AMITK_SPACE(slice_a), AMITK_SPACE_OFFSET(slice_b));
-
-  if (offset_b.z > 0.0)
+  if (z > 0.0)
     return -1;
-  else if (offset_b.z < 0.0) 
+  else if (z < 0.0) 
     return 1;
   else
     return 0;
@@ -859,18 +1681,12 @@ static gint sort_slices_func(gconstpointer a, gconstpointer b) {
 
 /* sort by time, then by location */
 static gint sort_slices_func_with_time(gconstpointer a, gconstpointer b) {
-  AmitkDataSet * slice_a = (AmitkDataSet *) a;
-  AmitkDataSet * slice_b = (AmitkDataSet *) b;
-  amide_time_t scan_start_a, scan_start_b;
-
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_a), -1);
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_b), 1);
+  const slice_info_t * slice_a = (const slice_info_t *) a;
+  const slice_info_t * slice_b = (const slice_info_t *) b;
 
   /* first sort by time */
-  scan_start_a = AMITK_DATA_SET_SCAN_START(slice_a);
-  scan_start_b = AMITK_DATA_SET_SCAN_START(slice_b);
-  if (!REAL_EQUAL(scan_start_a, scan_start_b)) {
-    if (scan_start_a < scan_start_b)
+  if (!REAL_EQUAL(slice_a->scan_start, slice_b->scan_start)) {
+    if (slice_a->scan_start < slice_b->scan_start)
       return -1;
     else
       return 1;
@@ -882,14 +1698,10 @@ static gint sort_slices_func_with_time(gconstpointer a, gconstpointer b) {
 
 /* sort by gate, then by location */
 static gint sort_slices_func_with_gate(gconstpointer a, gconstpointer b) {
-  AmitkDataSet * slice_a = (AmitkDataSet *) a;
-  AmitkDataSet * slice_b = (AmitkDataSet *) b;
-  amide_time_t gate_time_a, gate_time_b;
+  const slice_info_t * slice_a = (const slice_info_t *) a;
+  const slice_info_t * slice_b = (const slice_info_t *) b;
 
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_a), -1);
-  g_return_val_if_fail(AMITK_IS_DATA_SET(slice_b), 1);
-
-  /* first sort by gate if we can. Note, we set gate_num to -1 if
+  /* first sort by gate if we can. Note, gate_num is -1 if
      there's no entry for it in the DICOM file */
   if ((slice_a->gate_num >= 0) && (slice_b->gate_num >=0)) {
     if (slice_a->gate_num < slice_b->gate_num)
@@ -899,10 +1711,8 @@ static gint sort_slices_func_with_gate(gconstpointer a, gconstpointer b) {
   }
 
   /* if we don't have gate_num entries, sort by gate time */
-  gate_time_a = amitk_data_set_get_gate_time(slice_a, 0);
-  gate_time_b = amitk_data_set_get_gate_time(slice_b, 0);
-  if (!REAL_EQUAL(gate_time_a, gate_time_b)) {
-    if (gate_time_a < gate_time_b)
+  if (!REAL_EQUAL(slice_a->gate_time, slice_b->gate_time)) {
+    if (slice_a->gate_time < slice_b->gate_time)
       return -1;
     else
       return 1;
@@ -912,134 +1722,189 @@ static gint sort_slices_func_with_gate(gconstpointer a, gconstpointer b) {
   return sort_slices_func(a,b);
 }
 
-static GList * find_slices_that_match(GList ** pslices) {
+/* whether the comparison slice can go into the same data set as the initial slice */
+static gboolean slices_match(const slice_info_t * initial, const slice_info_t * comparison) {
 
-  AmitkDataSet * initial_ds;
-  AmitkDataSet * comparison_ds;
-  GList * matching_slices=NULL;
   gboolean match;
-  GList * current_slices;
+  gint i_axis;
 
-  g_return_val_if_fail(*pslices != NULL, NULL);
+  /* check dimensions are equal */
+  match = VOXEL_EQUAL(initial->dim, comparison->dim);
 
-  /* put the first slice into the matching set */
-  initial_ds = AMITK_DATA_SET(g_list_nth_data(*pslices, 0));
-  *pslices = g_list_remove(*pslices, initial_ds);
-  matching_slices = g_list_append(matching_slices, initial_ds);
-  current_slices = *pslices;
+  /* and that the pixels can go into the same format */
+  if (match)
+    match = ((initial->bits_allocated == comparison->bits_allocated) &&
+	     (initial->pixel_representation == comparison->pixel_representation));
 
-  /* go through the rest of the slices and find what matches */
-  while (current_slices != NULL) {
-    comparison_ds = AMITK_DATA_SET(current_slices->data);
+  /* check voxel sizes are equal */
+  if (match)
+    match = POINT_EQUAL(initial->voxel_size, comparison->voxel_size);
 
-    /* check dimensions are equal */
-    match = (VOXEL_EQUAL(AMITK_DATA_SET_DIM(initial_ds), AMITK_DATA_SET_DIM(comparison_ds)));
+  /* check that the orientation of the slices are equal. Note, we use _close instead of _equal (CLOSE vs EPSILON) because there values
+     are coming from character strings in the DICOM header, and may be a little imprecise. */
+  for (i_axis=0; (i_axis<AMITK_AXIS_NUM) && match; i_axis++)
+    match = POINT_CLOSE(initial->axes[i_axis], comparison->axes[i_axis]);
 
-    /* check voxel sizes are equal */
-    if (match)
-      match = (POINT_EQUAL(AMITK_DATA_SET_VOXEL_SIZE(initial_ds), AMITK_DATA_SET_VOXEL_SIZE(comparison_ds)));
+  /* check that the image type tags are the same. g_strcmp0 handles NULL pointers */
+  if (match)
+    match = (g_strcmp0(initial->image_type, comparison->image_type) == 0);
 
-    /* check that the orientation of the slices are equal. Note, we use _close instead of _equal (CLOSE vs EPSILON) because there values
-       are coming from character strings in the DICOM header, and may be a little imprecise. */
+  /* if MRI, check inversion, echo times, and b-value are equal */
+  if (slice_is_mri(initial)) {
     if (match)
-      match = amitk_space_axes_close(AMITK_SPACE(initial_ds), AMITK_SPACE(comparison_ds));
-
-    /* check that the image type tags are the same. g_strcmp0 handles NULL pointers */
+      if (!isnan(initial->inversion_time) && !isnan(comparison->inversion_time))
+	match = REAL_EQUAL(initial->inversion_time, comparison->inversion_time);
     if (match)
-      match = (g_strcmp0(AMITK_DATA_SET_DICOM_IMAGE_TYPE(initial_ds), AMITK_DATA_SET_DICOM_IMAGE_TYPE(comparison_ds)) == 0);
-
-    /* if MRI, check inversion, echo times, and b-value are equal */
-    if (AMITK_DATA_SET_MODALITY(initial_ds) == AMITK_MODALITY_MRI)  {
-      if (match)
-	if (!isnan (AMITK_DATA_SET_INVERSION_TIME(initial_ds)) && !isnan(AMITK_DATA_SET_INVERSION_TIME(comparison_ds)))
-	  match = REAL_EQUAL(AMITK_DATA_SET_INVERSION_TIME(initial_ds), AMITK_DATA_SET_INVERSION_TIME(comparison_ds));
-      if (match)
-	if (!isnan (AMITK_DATA_SET_ECHO_TIME(initial_ds)) && !isnan(AMITK_DATA_SET_ECHO_TIME(comparison_ds)))
-	  match = REAL_EQUAL(AMITK_DATA_SET_ECHO_TIME(initial_ds), AMITK_DATA_SET_ECHO_TIME(comparison_ds));
-      if (match)
-	if (!isnan (AMITK_DATA_SET_DIFFUSION_B_VALUE(initial_ds)) && !isnan(AMITK_DATA_SET_DIFFUSION_B_VALUE(comparison_ds))) {
-	  match = REAL_EQUAL(AMITK_DATA_SET_DIFFUSION_B_VALUE(initial_ds), AMITK_DATA_SET_DIFFUSION_B_VALUE(comparison_ds));
-	  if (match)
-	    match = POINT_EQUAL(AMITK_DATA_SET_DIFFUSION_DIRECTION(initial_ds), AMITK_DATA_SET_DIFFUSION_DIRECTION(comparison_ds));
-	}
-    }
+      if (!isnan(initial->echo_time) && !isnan(comparison->echo_time))
+	match = REAL_EQUAL(initial->echo_time, comparison->echo_time);
+    if (match)
+      if (!isnan(initial->diffusion_b_value) && !isnan(comparison->diffusion_b_value)) {
+	match = REAL_EQUAL(initial->diffusion_b_value, comparison->diffusion_b_value);
+	if (match)
+	  match = POINT_EQUAL(initial->diffusion_direction, comparison->diffusion_direction);
+      }
+  }
+
+  return match;
+}
 
-    if (match) 
-      matching_slices = g_list_append(matching_slices, comparison_ds);
+typedef struct slice_group_t {
+  slice_info_t * initial; /* what the other slices get compared against */
+  GList * slices; /* kept in reverse order while the groups are being built */
+} slice_group_t;
+
+/* splits the slices into lists that can each go into one data set, in order of first
+   appearance. Slices are bucketed on the parts of the match that have to be exactly equal 
+   (dimensions, data format and image type), so a slice only gets compared against the few groups in its 
+   bucket, rather than against every other slice. Returns a list of lists */
+static GList * group_matching_slices(GList * slices) {
+
+  GHashTable * buckets;
+  GList * bucket;
+  GList * groups=NULL;
+  GList * lists=NULL;
+  GList * current;
+  slice_group_t * group;
+  slice_info_t * info;
+  gchar * key;
+
+  buckets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_list_free);
+
+  for (current = slices; current != NULL; current = current->next) {
+    info = (slice_info_t *) current->data;
+    key = g_strdup_printf("%dx%dx%d %d/%d %s", info->dim.x, info->dim.y, info->dim.z,
+			  info->bits_allocated, info->pixel_representation,
+			  (info->image_type != NULL) ? info->image_type : "");
+
+    /* find the group this slice belongs to */
+    group = NULL;
+    for (bucket = (GList *) g_hash_table_lookup(buckets, key); (bucket != NULL) && (group == NULL); bucket = bucket->next) 
+      if (slices_match(((slice_group_t *) bucket->data)->initial, info))
+	group = (slice_group_t *) bucket->data;
+
+    /* or start a new one */
+    if (group == NULL) {
+      group = g_new(slice_group_t, 1);
+      group->initial = info;
+      group->slices = NULL;
+      groups = g_list_prepend(groups, group);
+
+      /* appending to an existing bucket doesn't change the head of its list */
+      bucket = (GList *) g_hash_table_lookup(buckets, key);
+      if (bucket == NULL) {
+	g_hash_table_insert(buckets, key, g_list_append(NULL, group));
+	key = NULL;
+      } else {
+	bucket = g_list_append(bucket, group);
+      }
+    }
 
-    current_slices = current_slices->next;
+    group->slices = g_list_prepend(group->slices, info);
+    if (key != NULL) g_free(key);
   }
+  g_hash_table_destroy(buckets);
 
-  current_slices = matching_slices;
-  while (current_slices != NULL) {
-    *pslices = g_list_remove(*pslices, current_slices->data);
-    current_slices = current_slices->next;
+  /* hand back just the lists of slices */
+  while (groups != NULL) {
+    group = (slice_group_t *) groups->data;
+    groups = g_list_delete_link(groups, groups);
+    lists = g_list_prepend(lists, g_list_reverse(group->slices));
+    g_free(group);
   }
 
-  return matching_slices;
+  return lists;
 }
 
+/* takes a location sorted list, and throws out any slices that are duplicated in terms of 
+   location, keeping the one with the lower instance number. The discarded slices are prepended
+   onto premaining_slices */
 static GList * separate_duplicate_slices(GList * slices_to_combine, GList ** premaining_slices) {
 
   GList * current_slices;
-  AmitkDataSet * previous_ds;
-  AmitkDataSet * current_ds;
-  AmitkDataSet * discard_ds;
+  GList * kept_slices=NULL;
+  slice_info_t * previous_info;
+  slice_info_t * current_info;
+  slice_info_t * discard_info;
 
   g_return_val_if_fail(slices_to_combine != NULL, NULL);
   g_return_val_if_fail(premaining_slices != NULL, NULL);
 
-  current_slices = g_list_first(slices_to_combine);
-  previous_ds = AMITK_DATA_SET(current_slices->data);
+  previous_info = (slice_info_t *) slices_to_combine->data;
 
-  /* get a list of the duplicates */
-  current_slices = current_slices->next;
-  while (current_slices != NULL) {
-    current_ds = AMITK_DATA_SET(current_slices->data);
-    current_slices = current_slices->next;
+  for (current_slices = slices_to_combine->next; current_slices != NULL; current_slices = current_slices->next) {
+    current_info = (slice_info_t *) current_slices->data;
 
-    if (POINT_EQUAL(AMITK_SPACE_OFFSET(previous_ds),
-		    AMITK_SPACE_OFFSET(current_ds))) {
-      if (current_ds->instance_number < previous_ds->instance_number) {
-	discard_ds = previous_ds;
-	previous_ds = current_ds; /* for next iteration */
+    if (POINT_EQUAL(previous_info->offset, current_info->offset)) {
+      if (current_info->instance_number < previous_info->instance_number) {
+	discard_info = previous_info;
+	previous_info = current_info; /* for next iteration */
       } else {
-	discard_ds = current_ds;
-	/* previous_ds stays the same */
+	discard_info = current_info;
+	/* previous_info stays the same */
       }
-
-      *premaining_slices = g_list_append(*premaining_slices, discard_ds);
-      slices_to_combine = g_list_remove(slices_to_combine, discard_ds);
+      *premaining_slices = g_list_prepend(*premaining_slices, discard_info);
     } else {
-      previous_ds = current_ds;
+      kept_slices = g_list_prepend(kept_slices, previous_info);
+      previous_info = current_info;
     }
   }
+  kept_slices = g_list_prepend(kept_slices, previous_info);
+  g_list_free(slices_to_combine);
 
-  return slices_to_combine;
+  return g_list_reverse(kept_slices);
 }
 
 static AmitkDataSet * import_slices_as_dataset(GList * slices, 
 					       gint num_frames, 
 					       gint num_gates,
 					       gint num_slices,
+					       gchar ** pstudyname,
+					       AmitkPreferences * preferences,
 					       AmitkUpdateFunc update_func,
 					       gpointer update_data,
+					       gboolean * pcontinue_work,
 					       gchar **perror_buf) {
 
   AmitkDataSet * ds=NULL;
   gint num_files;
   gint i_file;
   AmitkDataSet * slice_ds=NULL;
+  slice_info_t * info;
+  GList * current_slices;
   AmitkVoxel dim, scaling_dim;
   div_t x;
   AmitkVoxel i;
-  AmitkPoint offset, initial_offset, diff;
+  AmitkPoint initial_offset, diff;
   gboolean screwed_up_timing;
   gboolean screwed_up_thickness;
   amide_real_t true_thickness=0.0;
   amide_real_t old_thickness=0.0;
   AmitkPoint voxel_size;
   gboolean figured_out_dimz=FALSE;
+  gint file_frames=1;
+  gint file_gates=1;
+  gint file_slices=-1;
+  gint divider;
 
   g_return_val_if_fail(slices != NULL, NULL);
 
@@ -1047,9 +1912,16 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
   screwed_up_thickness=FALSE;
   num_files = g_list_length(slices);
 
+  if (update_func != NULL) 
+    *pcontinue_work = (*update_func)(update_data, _("Importing File(s) Through DCMTK"), (gdouble) 0.0);
+  divider = (num_files/AMITK_UPDATE_DIVIDER < 1.0) ? 1 : (gint) rint(num_files/AMITK_UPDATE_DIVIDER);
   
-  /* special stuff for 1st slice */
-  slice_ds = (AmitkDataSet *) g_list_nth_data(slices,0);
+  /* the 1st slice gets read in completely, and is used as the template for the data set */
+  info = (slice_info_t *) slices->data;
+  slice_ds = read_dicom_file(info->filename, pstudyname, preferences, 
+			     &file_frames, &file_gates, &file_slices, NULL, NULL, perror_buf);
+  if (slice_ds == NULL) 
+    goto error;
 
   dim = AMITK_DATA_SET_DIM(slice_ds);
 
@@ -1142,8 +2014,7 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
     goto error;
   }
 
-  if (ds->distribution != NULL) g_object_unref(ds->distribution);
-  ds->distribution = NULL;
+  amitk_data_set_invalidate_distribution(ds);
   
   /* if we're loading up multiple files, each file has a separate scale factor, so we'll use
      per slice (2D) scaling. If we're loading up a single file with multiple data frames in it,
@@ -1187,11 +2058,19 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
   }
   
       
-  initial_offset = AMITK_SPACE_OFFSET(slice_ds);
+  initial_offset = info->offset;
 
-  /* and process all the images */
-  for (i_file=0; i_file < num_files; i_file++) {
-    slice_ds = (AmitkDataSet *) g_list_nth_data(slices,i_file);
+  /* and process all the images, each gets decoded straight into its plane of the data set */
+  for (i_file=0, current_slices = slices; 
+       (current_slices != NULL) && (*pcontinue_work); 
+       i_file++, current_slices = current_slices->next) {
+    info = (slice_info_t *) current_slices->data;
+
+    if (update_func != NULL) {
+      x = div(i_file,divider);
+      if (x.rem == 0)
+	*pcontinue_work = (*update_func)(update_data, NULL, ((gdouble) i_file)/((gdouble) num_files));
+    }
 
     x = div(i_file, dim.z);
     i=zero_voxel;
@@ -1200,12 +2079,22 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
     else
       i.t = x.quot;
     i.z = x.rem;
-    transfer_slice(ds, slice_ds, i);
+
+    /* slices left over if they didn't divide up evenly */
+    if ((i.t >= dim.t) || (i.g >= dim.g))
+      break;
+
+    if (i_file == 0)
+      transfer_slice(ds, slice_ds, i);
+    else if (!read_dicom_pixels(info->filename, ds, i, perror_buf)) {
+      amitk_append_str_with_newline(perror_buf, _("Failed to load the series containing DICOM file %s"), info->filename);
+      goto error;
+    }
 
     /* record frame/gate duration if needed */
     if (i.z == 0) {
-      amitk_data_set_set_frame_duration(ds, i.t, amitk_data_set_get_frame_duration(slice_ds, 0));
-      amitk_data_set_set_gate_time(ds, i.g, amitk_data_set_get_gate_time(slice_ds, 0));
+      amitk_data_set_set_frame_duration(ds, i.t, info->frame_duration);
+      amitk_data_set_set_gate_time(ds, i.g, info->gate_time);
     }
 
 
@@ -1214,9 +2103,7 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
       /* figure out which direction the slices are going */
       if (i_file == 1) {
 	
-	offset = AMITK_SPACE_OFFSET(slice_ds);
-
-	POINT_SUB(offset, initial_offset, diff);
+	POINT_SUB(info->offset, initial_offset, diff);
 	true_thickness = POINT_MAGNITUDE(diff);
 	old_thickness = AMITK_DATA_SET_VOXEL_SIZE_Z(ds);
 	if (true_thickness > EPSILON)
@@ -1233,135 +2120,29 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
 	  }
       }
 
-      
-      //	  if (i_file != 0) {
-      
-      /* check if we've crossed a frame boundary */
-      //	    if (!REAL_EQUAL(last_scan_start, AMITK_DATA_SET_SCAN_START(slice_ds))) {
-      
-      //	      if (is_dynamic) {
-      //		num_frames++;
-      //	    if (num_frames > 1) {
-      
-      //	      if (!REAL_EQUAL(AMITK_DATA_SET_SCAN_START(slice_ds)-last_scan_start, duration)) 
-      //		screwed_up_timing=TRUE;
-      
-      //		duration = amitk_data_set_get_frame_duration(slice_ds, 0);
-      //		g_array_append_val(durations, duration);
-      
-      //		last_scan_start = AMITK_DATA_SET_SCAN_START(slice_ds);
-      //	      }
-      //	    }
-      //	  }
-
-
       /* check if the curtains match the rug */
       if ((i.z == 0) && (i.t > 0)) {
-	if (!REAL_CLOSE(AMITK_DATA_SET_SCAN_START(slice_ds)-amitk_data_set_get_start_time(ds, i.t-1), 
+	if (!REAL_CLOSE(info->scan_start-amitk_data_set_get_start_time(ds, i.t-1), 
 			amitk_data_set_get_frame_duration(ds, i.t-1)))  {
 	  screwed_up_timing=TRUE;
 	  amitk_data_set_set_frame_duration(ds,i.t-1,
-					    AMITK_DATA_SET_SCAN_START(slice_ds)-
+					    info->scan_start-
 					    amitk_data_set_get_start_time(ds, i.t-1));
 	}
       }
     }
 
-    //    last_offset = AMITK_SPACE_OFFSET(slice_ds);
-
   } /* i_file loop */
 
+  if (!*pcontinue_work)
+    goto error;
+
   if (screwed_up_timing) 
     amitk_append_str_with_newline(perror_buf, _("Detected discontinous frames in data set %s - frame durations have been adjusted to remove interframe time gaps"), AMITK_OBJECT_NAME(ds));
   
   if (screwed_up_thickness)
     amitk_append_str_with_newline(perror_buf, _("Slice thickness (%5.3f mm) not equal to slice spacing (%5.3f mm) in data set %s - will use slice spacing for thickness"), old_thickness, true_thickness, AMITK_OBJECT_NAME(ds));
   
-  /* detected a dynamic data set, massage the data appropriately */
-  //	if (num_frames > 1) {
-  //	  x = div(dim.z, num_frames);
-  //	  if (x.rem != 0) {
-  //	    g_warning(_("Cannot evenly divide the number of slices by the number of frames for data set %s - ignoring dynamic data"), AMITK_OBJECT_NAME(ds));
-  //	  } else {
-	
-  
-  /* hack the data set sizes */
-  //	    ds->raw_data->dim.t = num_frames;
-  //	    ds->raw_data->dim.z = x.quot;
-  //
-  //	    ds->internal_scaling_factor->dim.t = num_frames;
-  //	    ds->internal_scaling_factor->dim.z = x.quot;
-  //
-  //	    ds->internal_scaling_intercept->dim.t = num_frames;
-  //	    ds->internal_scaling_intercept->dim.z = x.quot;
-  
-  /* free the frame max/min arrays - will be realloc's by set_calc_min_max */
-  //	    g_free(ds->frame_max);
-  //	    ds->frame_max=NULL;
-  //	    g_free(ds->frame_min);
-  //	    ds->frame_min=NULL;
-  
-  /* and set the frame durations */
-  //	    if (ds->frame_duration != NULL)
-  //	      g_free(ds->frame_duration);
-  //	    if ((ds->frame_duration = amitk_data_set_get_frame_duration_mem(ds)) == NULL) {
-  //	      g_warning(_("couldn't allocate space for the frame duration info"));
-  //	      amitk_object_unref(ds);
-  //	      return NULL;
-  //	    }
-  //
-  //	    for (j=0; j < AMITK_DATA_SET_NUM_FRAMES(ds); j++) 
-  //	      ds->frame_duration[j] = g_array_index(durations,amide_time_t, j);
-  //	  }
-  //	}
-  //	g_array_free(durations, TRUE);
-  
-  /* correct for a datset where the z direction is reveresed */
-  //	if (reversed_z) {
-  //	  void * buffer;
-  //	  amide_data_t temp_val;
-  
-  //	  buffer = g_try_malloc(num_bytes_per_slice);
-  //	  if (buffer == NULL) {
-  //	    g_warning("could not malloc temp buffer");
-  //	    goto error;
-  //	  }
-  
-  
-  //	  k = zero_voxel;
-  //	  for (i.t = 0,k.t=0; i.t < AMITK_DATA_SET_DIM_T(ds); i.t++,k.t++) {
-  //	    for (i.g = 0,k.g=0; i.g < AMITK_DATA_SET_DIM_G(ds); i.g++,k.g++) {
-  //	      for (i.z = 0,k.z=AMITK_DATA_SET_DIM_Z(ds)-1; i.z < AMITK_DATA_SET_DIM_Z(ds); i.z++,k.z--) {
-  
-  /* exchange the slices*/
-  //		ds_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), i);
-  //		slice_pointer = amitk_raw_data_get_pointer(AMITK_DATA_SET_RAW_DATA(ds), k);
-  //		memcpy(buffer, ds_pointer, num_bytes_per_slice);
-  //		memcpy(ds_pointer, slice_pointer, num_bytes_per_slice);
-  //		memcpy(slice_pointer, buffer, num_bytes_per_slice);
-  //
-  /* exchange the scale factors */
-  //		temp_val = AMITK_RAW_DATA_DOUBLE_CONTENT(ds->internal_scaling_factor, i);
-  //		AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->internal_scaling_factor, i) =
-  //		  AMITK_RAW_DATA_DOUBLE_CONTENT(ds->internal_scaling_factor, k);
-  //		AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->internal_scaling_factor, k) =
-  //		  temp_val;
-  
-  /* exchange the scale offsets */
-  //		temp_val = AMITK_RAW_DATA_DOUBLE_CONTENT(ds->internal_scaling_intercept, i);
-  //		AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->internal_scaling_intercept, i) =
-  //		  AMITK_RAW_DATA_DOUBLE_CONTENT(ds->internal_scaling_intercept, k);
-  //		AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->internal_scaling_intercept, k) =
-  //		  temp_val;
-  //		
-  //	      }
-  //	    }
-  //	  }
-  //
-  //	  g_free(buffer);
-  //	}
-  
-  
   /* make sure remaining values have been calculated */
   amitk_data_set_set_scale_factor(ds, 1.0); /* set the external scaling factor */
   amitk_data_set_calc_far_corner(ds); /* set the far corner of the volume */
@@ -1376,71 +2157,14 @@ static AmitkDataSet * import_slices_as_dataset(GList * slices,
   }
 
  end:
-
-  return ds;
-}
-
-
-
-static GList * free_slices(GList * slices) {
-  AmitkDataSet * slice_ds;
-  
-  while (slices != NULL) {
-    slice_ds = AMITK_DATA_SET(g_list_nth_data(slices,0));
-    slices = g_list_remove(slices, slice_ds);
+  if (slice_ds != NULL)
     amitk_object_unref(slice_ds);
-  }
-
-  return slices;
-}
-
-
- 
-
-static GList * organize_and_import_slices_as_datasets(GList ** premaining_slices, 
-						      gint num_frames, 
-						      gint num_gates,
-						      gint num_slices,
-						      AmitkUpdateFunc update_func,
-						      gpointer update_data,
-						      gchar **perror_buf) {
-
-  GList * slices_to_combine = NULL;
-  GList * returned_sets = NULL;
-  GList * additional_sets = NULL;
-  AmitkDataSet * ds=NULL;
-
-  /* find all the slices that appear to match into one dataset */
-  slices_to_combine = find_slices_that_match(premaining_slices);
-
-  /* sort list based on the slice's time and z position */
-  if (num_frames > 1)
-    slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func_with_time);
-  else if (num_gates > 1)
-    slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func_with_gate);
-  else {
-    slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func);
-    /* throw out any slices that are duplicated in terms of orientation */
-    slices_to_combine = separate_duplicate_slices(slices_to_combine, premaining_slices);
-  }
-
-  /* load in the primary data set */
-  ds = import_slices_as_dataset(slices_to_combine, num_frames, num_gates, num_slices, update_func, update_data, perror_buf);
-  if (ds != NULL)
-    returned_sets = g_list_append(returned_sets, ds);
-  free_slices(slices_to_combine);
-  
-  /* and recurse to try loading in any remaining data sets */
-  if (*premaining_slices != NULL) {
-    additional_sets = organize_and_import_slices_as_datasets(premaining_slices, num_frames, num_gates, num_slices, update_func, update_data, perror_buf);
-    if (additional_sets != NULL)
-      returned_sets = g_list_concat(returned_sets, additional_sets);
-  }
 
-  return returned_sets;
+  return ds;
 }
 
-static GList * import_files_as_datasets(GList * image_files, 
+/* takes a list of slice_info_t's, which are not freed, and returns the data sets they make up */
+static GList * import_files_as_datasets(GList * slice_infos, 
 					gchar ** pstudyname,
 					AmitkPreferences * preferences, 
 					AmitkUpdateFunc update_func,
@@ -1449,164 +2173,102 @@ static GList * import_files_as_datasets(GList * image_files,
 
 
   GList * returned_sets=NULL;
-  AmitkDataSet * slice_ds=NULL;
-  div_t x;
-  gchar * slice_name;
-  gint image;
+  AmitkDataSet * ds;
+  slice_info_t * info;
+  GList * current_slices;
+  GList * slices=NULL;
+  GList * groups=NULL; /* list of lists */
+  GList * slices_to_combine;
+  GList * remaining_slices=NULL;
   gint num_frames=1;
   gint num_gates=1;
   gint num_slices=-1;
   gint num_files;
-  GList * slices=NULL;
   gboolean continue_work=TRUE;
-  gint divider;
 
-  num_files = g_list_length(image_files);
+  num_files = g_list_length(slice_infos);
   g_return_val_if_fail(num_files != 0, NULL);
 
   if (update_func != NULL) 
     continue_work = (*update_func)(update_data, _("Importing File(s) Through DCMTK"), (gdouble) 0.0);
-  divider = (num_files/AMITK_UPDATE_DIVIDER < 1.0) ? 1 : (gint) rint(num_files/AMITK_UPDATE_DIVIDER);
-
-  for (image=0; (image < num_files) && (continue_work); image++) {
-    
-    if (update_func != NULL) {
-      x = div(image,divider);
-      if (x.rem == 0)
-	continue_work = (*update_func)(update_data, NULL, ((gdouble) image)/((gdouble) num_files));
-    }
 
+  for (current_slices = slice_infos; current_slices != NULL; current_slices = current_slices->next) {
+    info = (slice_info_t *) current_slices->data;
 
-    slice_name = (gchar *) g_list_nth_data(image_files,image);
+    /* first, weed out modalities we know we don't read */
+    if ((info->modality != NULL) && (g_ascii_strcasecmp(info->modality, "PR") == 0)) {
+      amitk_append_str_with_newline(perror_buf, _("Modality %s is not understood.  Ignoring File %s"), info->modality, info->filename);
+      continue;
+    }
 
-    slice_ds = read_dicom_file(slice_name, pstudyname,preferences, 
-			       &num_frames, &num_gates, &num_slices, NULL, NULL, perror_buf);
-    if (slice_ds == NULL) {
-      goto cleanup;
-    } else if ((AMITK_DATA_SET_DIM_Z(slice_ds) != 1) && (num_files > 1)) {
-      /* can handle multiple dicom files each with a single slice, or one dicom file with multiple slices,
-	 can't handle multiple files each with multiple slices */
+    /* can handle multiple dicom files each with a single slice, or one dicom file with multiple slices,
+       can't handle multiple files each with multiple slices */
+    if ((info->dim.z != 1) && (num_files > 1)) {
       g_warning(_("no support for multislice files within DICOM directory format"));
-      amitk_object_unref(slice_ds);
-      slice_ds = NULL;
       goto cleanup;
-    } 
-    slices = g_list_append(slices, slice_ds);
+    }
+
+    if (info->num_frames > 0) num_frames = info->num_frames;
+    if (info->num_gates > 0) num_gates = info->num_gates;
+    if (info->num_slices > 0) num_slices = info->num_slices;
+
+    slices = g_list_prepend(slices, info);
   }
-  if (!continue_work) goto cleanup;
+  slices = g_list_reverse(slices);
+  if ((slices == NULL) || (!continue_work)) goto cleanup;
 
   if ((num_frames > 1) && (num_gates > 1)) 
     g_warning("Don't know how to deal with multi-gate and multi-frame data, results will be undefined");
 
+  /* find all the slices that appear to match into one dataset */
+  groups = group_matching_slices(slices);
+
+  while ((groups != NULL) && (continue_work)) {
+    slices_to_combine = (GList *) groups->data;
+    groups = g_list_delete_link(groups, groups);
+
+    /* sort list based on the slice's time and z position */
+    if (num_frames > 1)
+      slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func_with_time);
+    else if (num_gates > 1)
+      slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func_with_gate);
+    else {
+      slices_to_combine = g_list_sort(slices_to_combine, sort_slices_func);
+      /* throw out any slices that are duplicated in terms of orientation */
+      slices_to_combine = separate_duplicate_slices(slices_to_combine, &remaining_slices);
+    }
 
-  returned_sets = organize_and_import_slices_as_datasets(&slices, num_frames, num_gates, num_slices, update_func, update_data, perror_buf);
+    ds = import_slices_as_dataset(slices_to_combine, num_frames, num_gates, num_slices, 
+				  pstudyname, preferences, update_func, update_data, 
+				  &continue_work, perror_buf);
+    if (ds != NULL)
+      returned_sets = g_list_append(returned_sets, ds);
+    g_list_free(slices_to_combine);
+
+    /* and try loading in any slices that were thrown out as duplicates */
+    if ((groups == NULL) && (remaining_slices != NULL)) {
+      remaining_slices = g_list_reverse(remaining_slices);
+      groups = group_matching_slices(remaining_slices);
+      g_list_free(remaining_slices);
+      remaining_slices = NULL;
+    }
+  }
 
 
  cleanup:
   if (update_func != NULL) /* remove progress bar */
     (*update_func) (update_data, NULL, (gdouble) 2.0); 
 
-  slices = free_slices(slices);
+  while (groups != NULL) {
+    g_list_free((GList *) groups->data);
+    groups = g_list_delete_link(groups, groups);
+  }
+  g_list_free(remaining_slices);
+  g_list_free(slices);
 
   return returned_sets;
 }
 
-typedef struct slice_info_t {
-  gchar * filename;
-  gchar * series_instance_uid;
-  gchar * modality;
-  gchar * series_description;
-  gchar * patient_id;
-  gchar * patient_name;
-  gint series_number;
-} slice_info_t;
-
-static void free_slice_info(slice_info_t * info) {
-
-  if (info->filename != NULL)
-    g_free(info->filename);
-
-  if (info->series_instance_uid != NULL)
-    g_free(info->series_instance_uid);
-
-  if (info->modality != NULL)
-    g_free(info->modality);
-  
-  if (info->series_description != NULL)
-    g_free(info->series_description);
-
-  if (info->patient_id != NULL)
-    g_free(info->patient_id);
-
-  if (info->patient_name != NULL)
-    g_free(info->patient_name);
-
-  g_free(info);
-
-  return;
-}
-
-static slice_info_t * slice_info_new(void) {
-
-  slice_info_t * info;
-
-  info = g_try_new(slice_info_t, 1);
-  info->filename=NULL;
-  info->series_instance_uid=NULL;
-  info->modality=NULL;
-  info->series_description=NULL;
-  info->patient_id=NULL;
-  info->patient_name=NULL;
-  info->series_number = -1;
-
-  return info;
-}
-
-
-static slice_info_t * get_slice_info(const gchar * filename) {
-
-  OFCondition result;
-  DcmFileFormat dcm_format;
-  DcmDataset * dcm_dataset;
-  const char * return_str=NULL;
-  slice_info_t * info=NULL;
-  Sint32 return_sint32;
-
-  result = dcm_format.loadFile(filename);
-  if (result.bad()) return NULL;
-
-  dcm_dataset = dcm_format.getDataset();
-  if (dcm_dataset == NULL) return NULL;
-
-  info = slice_info_new();
-  info->filename = g_strdup(filename);
-
-  dcm_dataset->findAndGetString(DCM_SeriesInstanceUID, return_str, OFTrue);
-  if (return_str != NULL)
-      info->series_instance_uid = g_strdup(return_str);
-
-  dcm_dataset->findAndGetString(DCM_Modality, return_str, OFTrue);
-  if (return_str != NULL)
-      info->modality = g_strdup(return_str);
-
-  dcm_dataset->findAndGetString(DCM_SeriesDescription, return_str, OFTrue);
-  if (return_str != NULL) 
-      info->series_description = g_strdup(return_str);
-
-  dcm_dataset->findAndGetString(DCM_PatientID, return_str, OFTrue);
-  if (return_str != NULL) 
-      info->patient_id = g_strdup(return_str);
-
-  dcm_dataset->findAndGetString(DCM_PatientName, return_str, OFTrue);
-  if (return_str != NULL) 
-      info->patient_name = g_strdup(return_str);
-
-  if (dcm_dataset->findAndGetSint32(DCM_SeriesNumber, return_sint32).good())
-    info->series_number = return_sint32;
-
-  return info;
-}
-
 static gboolean check_str(gchar * str1, gchar * str2) {
 
   if ((str1 == NULL) && (str2 == NULL))
@@ -1662,13 +2324,8 @@ static gboolean check_same(slice_info_t * slice1, slice_info_t * slice2) {
   if (!check_str(slice1->modality, slice2->modality))
     return FALSE;
 
-  if (!check_str(slice1->patient_id, slice2->patient_id)) {
-    return FALSE;
-  }
-
-  if (!check_str(slice1->patient_name, slice2->patient_name)) {
+  if (!check_str(slice1->patient_digest, slice2->patient_digest))
     return FALSE;
-  }
 
   return TRUE;
 }
@@ -1688,6 +2345,28 @@ static gint sort_raw_info(gconstpointer a, gconstpointer b) {
   return strcmp(slicea->filename, sliceb->filename);
 }
 
+typedef struct scan_files_t {
+  gchar ** filenames;
+  slice_info_t ** infos;
+  gint offset;
+} scan_files_t;
+
+/* each file gets its own slot in infos, so the results come out in the same
+   order regardless of how many threads were used. Slots already filled in from
+   the index are skipped */
+static void scan_files(const gint start, const gint end, gpointer data) {
+
+  scan_files_t * sf = (scan_files_t *) data;
+  gint i;
+
+  for (i=sf->offset+start; i<sf->offset+end; i++) 
+    if (sf->infos[i] == NULL)
+      if (dcmtk_test_dicom(sf->filenames[i]))
+	sf->infos[i] = get_slice_info(sf->filenames[i]);
+
+  return;
+}
+
 static gint sort_datasets_by_dicom_params(gconstpointer a, gconstpointer b) {
 
   g_return_val_if_fail(a != NULL, 0);
@@ -1720,12 +2399,10 @@ static GList * import_files(const gchar * filename,
   AmitkDataSet * ds;
   GList * data_sets = NULL;
   GList * returned_sets = NULL;
-  GList * image_files=NULL;
   GList * raw_info=NULL;
   GList * all_slices=NULL; /* list of lists */
   GList * temp_all_slices;
   GList * sorted_slices=NULL; /* pointer to a list in all_slices */
-  gchar * image_name;
   gchar * error_buf=NULL;
   slice_info_t * info=NULL;
   slice_info_t * current_info=NULL;
@@ -1735,6 +2412,16 @@ static GList * import_files(const gchar * filename,
   gchar * new_filename;
   DIR* dir;
   struct dirent* entry;
+  GPtrArray * candidates;
+  scan_files_t sf;
+  GHashTable * index;
+  gchar * index_dirname;
+  gchar * index_filename;
+  gboolean index_changed=FALSE;
+  gint num_indexed=0;
+  gint num_found=0;
+  gint num_candidates;
+  gint block_size, start, end, i;
   gboolean continue_work=TRUE;
   gboolean all_datasets;
   gboolean use_this_one;
@@ -1750,10 +2437,25 @@ static GList * import_files(const gchar * filename,
   else
     regularized_filename = g_strdup_printf("%s%s%s", dirname, G_DIR_SEPARATOR_S,basename);
 
+  /* anything in the directory we've already parsed */
+  index_dirname = dicom_index_dirname(dirname);
+  index_filename = dicom_index_filename(preferences, index_dirname);
+  index = dicom_index_load(index_filename, index_dirname);
+
   /* get the intially requested file */
-  info = get_slice_info(regularized_filename);
+  info = dicom_index_lookup(index, regularized_filename);
+  if (info == NULL) {
+    info = get_slice_info(regularized_filename);
+    index_changed = TRUE;
+  }
   if (info == NULL) {
     g_warning(_("could not find dataset in DICOM file %s\n"), regularized_filename);
+    g_hash_table_destroy(index);
+    g_free(index_dirname);
+    g_free(index_filename);
+    g_free(dirname);
+    g_free(basename);
+    g_free(regularized_filename);
     return NULL;
   }
   raw_info = g_list_append(raw_info, info); 
@@ -1761,33 +2463,79 @@ static GList * import_files(const gchar * filename,
   /* ------- find all dicom files in the directory ------------ */
   if (update_func != NULL) 
     continue_work = (*update_func)(update_data, _("Scanning Files to find additional DICOM Slices"), (gdouble) 0.0);
-    
+
+  /* first just collect the names, the headers get read in below */
+  candidates = g_ptr_array_new();
   if ((dir = opendir(dirname))!=NULL) {
     while (((entry = readdir(dir)) != NULL) && (continue_work)) {
 
       if (update_func != NULL)
 	continue_work = (*update_func)(update_data, NULL, -1.0);
 
-      if (dirname == NULL)
-	new_filename = g_strdup_printf("%s", entry->d_name);
-      else
-	new_filename = g_strdup_printf("%s%s%s", dirname, G_DIR_SEPARATOR_S,entry->d_name);
-
       if (strcmp(basename, entry->d_name) != 0) { /* we've already got the initial filename */
-	if (dcmtk_test_dicom(new_filename)) {
-	  info = get_slice_info(new_filename);
-	  if (info != NULL) 
-	    raw_info = g_list_append(raw_info, info); /* we have a match */
-	}
+	if (dirname == NULL)
+	  new_filename = g_strdup_printf("%s", entry->d_name);
+	else
+	  new_filename = g_strdup_printf("%s%s%s", dirname, G_DIR_SEPARATOR_S,entry->d_name);
+	g_ptr_array_add(candidates, new_filename);
       }
-
-      g_free(new_filename);
     }
     if (dir != NULL) closedir(dir);
   }
+
+  /* read the headers in parallel, in blocks so the progress bar keeps moving */
+  num_candidates = candidates->len;
+  sf.filenames = (gchar **) candidates->pdata;
+  sf.infos = g_new0(slice_info_t *, MAX(num_candidates, 1));
+
+  /* files that haven't changed since they were indexed don't need to be parsed */
+  for (i=0; i<num_candidates; i++) 
+    if ((sf.infos[i] = dicom_index_lookup(index, sf.filenames[i])) != NULL)
+      num_indexed++;
+
+  if (update_func != NULL) 
+    block_size = MAX(num_candidates/AMITK_UPDATE_DIVIDER, 4*amitk_parallel_get_num_threads());
+  else
+    block_size = num_candidates;
+  block_size = MAX(block_size, 1);
+
+  for (start=0; (start < num_candidates) && continue_work; start = end) {
+    end = MIN(start+block_size, num_candidates);
+    if (update_func != NULL)
+      continue_work = (*update_func)(update_data, NULL, ((gdouble) start)/((gdouble) num_candidates));
+    if (continue_work) {
+      sf.offset = start;
+      amitk_parallel_for(end-start, scan_files, &sf);
+    }
+  }
+
+  /* and merge the results back in directory order */
+  for (i=num_candidates-1; i >= 0; i--) 
+    if (sf.infos[i] != NULL) {
+      raw_info = g_list_insert(raw_info, sf.infos[i], 1); /* we have a match */
+      num_found++;
+    }
+
+  /* rewrite the index if we parsed anything, or if files have disappeared. Don't bother if 
+     the scan was cut short, as we'd lose the entries for the files we didn't get to */
+  if ((num_found != num_indexed) || (g_hash_table_size(index) > 0))
+    index_changed = TRUE;
+  if (index_changed && continue_work)
+    dicom_index_save(index_filename, index_dirname, raw_info);
+  else if (!index_changed)
+    g_utime(index_filename, NULL); /* mark it as still in use, so it doesn't get pruned */
+  dicom_index_prune(preferences);
+  g_hash_table_destroy(index);
+  g_free(index_dirname);
+  g_free(index_filename);
   if (dirname != NULL) g_free(dirname);
   if (basename != NULL) g_free(basename);
 
+  g_free(sf.infos);
+  for (i=0; i<num_candidates; i++)
+    g_free(g_ptr_array_index(candidates, i));
+  g_ptr_array_free(candidates, TRUE);
+
   if (update_func != NULL) /* remove progress bar */
     (*update_func) (update_data, NULL, (gdouble) 2.0); 
 
@@ -1806,9 +2554,10 @@ static GList * import_files(const gchar * filename,
       g_assert(sorted_slices->data != NULL);
       info = (slice_info_t *) sorted_slices->data;
 
-      /* current slice matches the first slice in the current list, add it to this list */
+      /* current slice matches the first slice in the current list, add it to this list. 
+	 Slices go in right behind the first one, the rest of the list gets put back in order below */
       if (check_same(current_info, info)) {
-	sorted_slices = g_list_append(sorted_slices, current_info);
+	sorted_slices = g_list_insert(sorted_slices, current_info, 1);
 	current_info = NULL;
       }
 
@@ -1819,6 +2568,12 @@ static GList * import_files(const gchar * filename,
     if (current_info != NULL) 
       all_slices = g_list_append(all_slices, g_list_append(NULL, current_info));
   }
+  for (temp_all_slices = all_slices; temp_all_slices != NULL; temp_all_slices = temp_all_slices->next) {
+    sorted_slices = (GList *) temp_all_slices->data;
+    info = (slice_info_t *) sorted_slices->data;
+    sorted_slices = g_list_reverse(g_list_delete_link(sorted_slices, sorted_slices));
+    temp_all_slices->data = g_list_prepend(sorted_slices, info);
+  }
 
 
   g_assert(all_slices != NULL);
@@ -1846,23 +2601,13 @@ static GList * import_files(const gchar * filename,
     all_slices = g_list_remove(all_slices, sorted_slices);
     use_this_one = FALSE;
 
-    /* transfer file names */
-    image_files = NULL;
-    while (sorted_slices != NULL) {
-      info = (slice_info_t *) sorted_slices->data;
-
-      /* see if this group of filenames contains the filename we initially started with */
-      if (strcmp(regularized_filename, info->filename) == 0)
+    /* see if this group of files contains the file we initially started with */
+    for (temp_all_slices = sorted_slices; (temp_all_slices != NULL) && (!use_this_one); temp_all_slices = temp_all_slices->next) 
+      if (strcmp(regularized_filename, ((slice_info_t *) temp_all_slices->data)->filename) == 0)
 	use_this_one = TRUE;
 
-      sorted_slices = g_list_remove(sorted_slices, info);
-      image_files = g_list_append(image_files, info->filename);
-      info->filename=NULL;
-      free_slice_info(info);
-    }
-
     if (all_datasets || (use_this_one)) {
-      returned_sets = import_files_as_datasets(image_files, pstudyname, preferences, update_func, update_data, &error_buf);
+      returned_sets = import_files_as_datasets(sorted_slices, pstudyname, preferences, update_func, update_data, &error_buf);
 
       while (returned_sets != NULL) {
 	ds = AMITK_DATA_SET(returned_sets->data);
@@ -1872,11 +2617,8 @@ static GList * import_files(const gchar * filename,
     }
 
     /* cleanup */
-    while (image_files != NULL) {
-      image_name = (gchar *) g_list_nth_data(image_files,0);
-      image_files = g_list_remove(image_files, image_name); 
-      g_free(image_name);
-    }
+    g_list_foreach(sorted_slices, (GFunc) free_slice_info, NULL);
+    g_list_free(sorted_slices);
   }
 
   /* and sort datasets by series number, echo time, etc.*/
@@ -1922,6 +2664,9 @@ static GList * import_dir(const gchar * filename,
   gchar * temp_name;
   gchar * temp_name2;
   GList * image_files=NULL;
+  GList * current_file;
+  GList * slice_infos=NULL;
+  slice_info_t * info;
   gint j;
 
   gchar * error_buf=NULL;
@@ -2034,17 +2779,29 @@ static GList * import_dir(const gchar * filename,
 
 	    g_free(image_name1);
 	    if (valid_filename)
-	      image_files = g_list_append(image_files, image_name2);
+	      image_files = g_list_prepend(image_files, image_name2);
 	  }
 	}
+	image_files = g_list_reverse(image_files);
 
 #if AMIDE_DEBUG
 	g_print("object name: %s    with %d files (images)\n", object_name, g_list_length(image_files));
 #endif
 
+	/* the headers are all that's needed to sort the slices into data sets */
+	for (current_file = image_files; current_file != NULL; current_file = current_file->next) {
+	  info = get_slice_info((gchar *) current_file->data);
+	  if (info != NULL)
+	    slice_infos = g_list_prepend(slice_infos, info);
+	  else
+	    amitk_append_str_with_newline(&error_buf, _("Could not read the header of DICOM file %s - ignoring"), 
+					  (gchar *) current_file->data);
+	}
+	slice_infos = g_list_reverse(slice_infos);
+
 	/* read in slices as dataset(s) */
-	if (g_list_length(image_files) != 0)
-	  returned_sets = import_files_as_datasets(image_files, pstudyname, preferences, 
+	if (slice_infos != NULL)
+	  returned_sets = import_files_as_datasets(slice_infos, pstudyname, preferences, 
 						   update_func, update_data, &error_buf);
 
 	while (returned_sets != NULL) {
@@ -2073,11 +2830,12 @@ static GList * import_dir(const gchar * filename,
 
 
 	/* cleanup */
-	while (image_files != NULL) {
-	  image_name2 = (gchar *) g_list_nth_data(image_files,0);
-	  image_files = g_list_remove(image_files, image_name2);
-	  g_free(image_name2);
-	}
+	g_list_foreach(slice_infos, (GFunc) free_slice_info, NULL);
+	g_list_free(slice_infos);
+	slice_infos = NULL;
+	g_list_foreach(image_files, (GFunc) g_free, NULL);
+	g_list_free(image_files);
+	image_files = NULL;
 
 	g_free(object_name);
 	object_name=NULL;
@@ -3064,9 +3822,8 @@ static gboolean j2k_decompress(guint32 comp_length, const guint8 *comp_buffer, g
 /* Extract JPEG 2000 encoding PixelData from the DcmDataset and return the buffer containing
  * decompressed image(s). Note that MultiFrame DICOM files nor multi-tile JPEG 2000 images
  * have been tested because of lack of sample data. */
-static void * j2k_to_raw(DcmDataset *dcm_data, AmitkDataSet const *ds) {
+static void * j2k_to_raw(DcmDataset *dcm_data, const AmitkFormat format, const AmitkVoxel dim) {
   /* Amitk stuff */
-  AmitkRawData *raw_data;
   gint format_size;
   amide_intpoint_t z;
   guint32 data_size; // overall buffer size for X * Y * Z dimensions
@@ -3094,11 +3851,10 @@ static void * j2k_to_raw(DcmDataset *dcm_data, AmitkDataSet const *ds) {
   
   OFCondition result;
 
-  raw_data = ds->raw_data;
-  format_size = amitk_format_sizes[AMITK_RAW_DATA_FORMAT(raw_data)];
-  z = AMITK_DATA_SET_DIM_Z(ds);
-  image_size = format_size * AMITK_RAW_DATA_DIM_X(raw_data) * AMITK_RAW_DATA_DIM_Y(raw_data);
-  data_size = image_size * AMITK_RAW_DATA_DIM_Z(raw_data);
+  format_size = amitk_format_sizes[format];
+  z = dim.z;
+  image_size = format_size * dim.x * dim.y;
+  data_size = image_size * dim.z;
   data = (guint8 *)g_try_malloc(data_size);
   if (data == NULL) {
     g_warning(_("Couldn't allocate space for the data structure to hold data %d bytes"), data_size);
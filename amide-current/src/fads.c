@@ -26,11 +26,14 @@
 #include "amide_config.h"
 #ifdef AMIDE_LIBGSL_SUPPORT
 #include <time.h>
+#include <string.h>
 #include <glib.h>
 #include <gsl/gsl_linalg.h>
+#include <gsl/gsl_eigen.h>
 #include <gsl/gsl_multimin.h>
 #include "fads.h"
 #include "amitk_data_set_FLOAT_0D_SCALING.h"
+#include "amitk_parallel.h"
 
 
 #define FINAL_MU 1e-07
@@ -42,6 +45,11 @@ gchar * fads_minimizer_algorithm_name[NUM_FADS_MINIMIZERS] = {
   //  N_("vector BFGS conjugate gradient")
 };
 
+gchar * fads_svd_method_name[NUM_FADS_SVD_METHODS] = {
+  N_("Full SVD"),
+  N_("Gram matrix"),
+  N_("Randomized")
+};
 
 gchar * fads_type_name[] = {
   N_("Principle Component Analysis"),
@@ -86,7 +94,388 @@ static gint perform_svd(gsl_matrix * a, gsl_matrix * v, gsl_vector * s) {
   return status;
 }
 
+/* the Gram matrix and randomized methods never hold the voxels x frames matrix in memory,
+   instead they stream through the data set's voxels in blocks, with each thread summing 
+   into its own matrix, only added into the shared one at the end */
+#define SVD_BLOCK_VOXELS 256
+#define SVD_RANDOMIZED_OVERSAMPLE 10
+#define SVD_RANDOMIZED_POWER_ITERATIONS 2
+#define SVD_RANDOMIZED_VALUES 10 /* singular values to compute for fads_svd_factors */
+
+typedef enum {
+  SVD_PASS_GRAM, /* sum += a'a */
+  SVD_PASS_POWER, /* sum += a'(a*basis) */
+  SVD_PASS_PROJECTED_GRAM, /* sum += (a*basis)'(a*basis) */
+  SVD_PASS_COMPONENTS /* u = a*basis*inverse_s */
+} svd_pass_t;
+
+typedef struct {
+  AmitkDataSet * data_set;
+  AmitkVoxel dim;
+  gint num_voxels;
+  gint num_frames;
+  svd_pass_t pass;
+  gint k; /* number of columns in basis */
+  const gdouble * basis; /* [num_frames*k] */
+  const gdouble * inverse_s; /* [k] */
+  gint sum_size;
+  gdouble * sum; /* protected by mutex */
+  gsl_matrix * u; /* [num_voxels x k] */
+  GMutex mutex;
+} svd_stream_t;
+
+/* read in num voxels, starting at voxel first, as rows of frames */
+static void svd_stream_read_block(const svd_stream_t * ss, const gint first, const gint num, gdouble * rows) {
+
+  AmitkVoxel start_voxel, i_voxel;
+  gint r;
+
+  start_voxel.x = first % ss->dim.x;
+  start_voxel.y = (first / ss->dim.x) % ss->dim.y;
+  start_voxel.z = (first / (ss->dim.x*ss->dim.y)) % ss->dim.z;
+  start_voxel.g = first / (ss->dim.x*ss->dim.y*ss->dim.z);
+
+  for (start_voxel.t=0; start_voxel.t < ss->num_frames; start_voxel.t++) {
+    i_voxel = start_voxel;
+    for (r=0; r<num; r++) {
+      rows[r*ss->num_frames+i_voxel.t] = amitk_data_set_get_value(ss->data_set, i_voxel);
+      if (++i_voxel.x == ss->dim.x) {
+	i_voxel.x = 0;
+	if (++i_voxel.y == ss->dim.y) {
+	  i_voxel.y = 0;
+	  if (++i_voxel.z == ss->dim.z) {
+	    i_voxel.z = 0;
+	    i_voxel.g++;
+	  }
+	}
+      }
+    }
+  }
+
+  return;
+}
+
+static void svd_stream_blocks(const gint start, const gint end, gpointer data) {
+
+  svd_stream_t * ss = data;
+  const gint n = ss->num_frames;
+  const gint k = ss->k;
+  gdouble * rows;
+  gdouble * y;
+  gdouble * sum;
+  const gdouble * a;
+  const gdouble * basis_row;
+  gint b, first, num, r, i, j, c, d;
+
+  rows = g_new(gdouble, SVD_BLOCK_VOXELS*n);
+  y = g_new(gdouble, MAX(k, 1));
+  sum = g_new0(gdouble, MAX(ss->sum_size, 1));
+
+  for (b=start; b<end; b++) {
+    first = b*SVD_BLOCK_VOXELS;
+    num = MIN(SVD_BLOCK_VOXELS, ss->num_voxels-first);
+    svd_stream_read_block(ss, first, num, rows);
+
+    for (r=0, a=rows; r<num; r++, a+=n) {
+      if (ss->pass == SVD_PASS_GRAM) { /* upper triangle only */
+	for (i=0; i<n; i++) 
+	  if (a[i] != 0.0)
+	    for (j=i; j<n; j++)
+	      sum[i*n+j] += a[i]*a[j];
+	continue;
+      }
+
+      /* y = a*basis */
+      for (c=0; c<k; c++) 
+	y[c] = 0.0;
+      for (j=0, basis_row=ss->basis; j<n; j++, basis_row+=k)
+	for (c=0; c<k; c++)
+	  y[c] += a[j]*basis_row[c];
+
+      switch(ss->pass) {
+      case SVD_PASS_POWER:
+	for (j=0; j<n; j++)
+	  for (c=0; c<k; c++)
+	    sum[j*k+c] += a[j]*y[c];
+	break;
+      case SVD_PASS_PROJECTED_GRAM: /* upper triangle only */
+	for (c=0; c<k; c++)
+	  for (d=c; d<k; d++)
+	    sum[c*k+d] += y[c]*y[d];
+	break;
+      case SVD_PASS_COMPONENTS:
+	for (c=0; c<k; c++)
+	  gsl_matrix_set(ss->u, first+r, c, y[c]*ss->inverse_s[c]);
+	break;
+      default:
+	break;
+      }
+    }
+  }
+
+  if (ss->sum_size > 0) {
+    g_mutex_lock(&(ss->mutex));
+    for (i=0; i<ss->sum_size; i++)
+      ss->sum[i] += sum[i];
+    g_mutex_unlock(&(ss->mutex));
+  }
+
+  g_free(sum);
+  g_free(y);
+  g_free(rows);
+
+  return;
+}
+
+/* makes one pass through the data set, sum gets zeroed and summed into (if needed) */
+static void svd_stream_pass(svd_stream_t * ss, const svd_pass_t pass, const gint k,
+			    const gdouble * basis, gdouble * sum) {
+
+  gint i;
+
+  ss->pass = pass;
+  ss->k = k;
+  ss->basis = basis;
+  ss->sum = sum;
+  switch(pass) {
+  case SVD_PASS_GRAM:
+    ss->sum_size = ss->num_frames*ss->num_frames;
+    break;
+  case SVD_PASS_POWER:
+    ss->sum_size = ss->num_frames*k;
+    break;
+  case SVD_PASS_PROJECTED_GRAM:
+    ss->sum_size = k*k;
+    break;
+  case SVD_PASS_COMPONENTS:
+  default:
+    ss->sum_size = 0;
+    break;
+  }
+  for (i=0; i<ss->sum_size; i++)
+    sum[i] = 0.0;
+
+  amitk_parallel_for((ss->num_voxels+SVD_BLOCK_VOXELS-1)/SVD_BLOCK_VOXELS, svd_stream_blocks, ss);
+
+  return;
+}
+
+/* modified Gram-Schmidt on the k columns of the n x k matrix */
+static void orthonormalize_columns(gdouble * matrix, const gint n, const gint k) {
+
+  gint c, d, j;
+  gdouble dot, norm;
+
+  for (c=0; c<k; c++) {
+    for (d=0; d<c; d++) {
+      dot = 0.0;
+      for (j=0; j<n; j++) dot += matrix[j*k+c]*matrix[j*k+d];
+      for (j=0; j<n; j++) matrix[j*k+c] -= dot*matrix[j*k+d];
+    }
+    norm = 0.0;
+    for (j=0; j<n; j++) norm += matrix[j*k+c]*matrix[j*k+c];
+    norm = sqrt(norm);
+    for (j=0; j<n; j++) 
+      matrix[j*k+c] = (norm > EPSILON) ? matrix[j*k+c]/norm : 0.0;
+  }
+
+  return;
+}
+
+/* eigen decomposition of the symmetric k x k matrix, of which only the upper triangle is filled in,
+   eigenvalues are returned largest first */
+static gint symmetric_eigen(const gdouble * upper, const gint k, gsl_vector * eval, gsl_matrix * evec) {
+
+  gsl_matrix * a;
+  gsl_eigen_symmv_workspace * w;
+  gint status;
+  gint c, d;
+
+  a = gsl_matrix_alloc(k, k);
+  g_return_val_if_fail(a != NULL, -1);
+  w = gsl_eigen_symmv_alloc(k);
+  if (w == NULL) {
+    gsl_matrix_free(a);
+    g_return_val_if_reached(-1);
+  }
+
+  for (c=0; c<k; c++)
+    for (d=c; d<k; d++) {
+      gsl_matrix_set(a, c, d, upper[c*k+d]);
+      gsl_matrix_set(a, d, c, upper[c*k+d]);
+    }
+
+  status = gsl_eigen_symmv(a, eval, evec, w);
+  if (status == 0)
+    status = gsl_eigen_symmv_sort(eval, evec, GSL_EIGEN_SORT_VAL_DESC);
+
+  gsl_eigen_symmv_free(w);
+  gsl_matrix_free(a);
+
+  return status;
+}
+
+/* computes the num_factors largest singular values, along with the corresponding right 
+   (frame) and optionally left (voxel) singular vectors of the voxels x frames matrix.
+   The Gram method does an eigen decomposition of the frames x frames matrix A'A.  The
+   randomized method uses subspace iteration from a random start to find the dominant 
+   right singular vectors, and only needs frames x (num_factors+oversampling) storage.
+   Returns 0 on success, the returned matrices/vectors need to be free'd */
+static gint stream_svd(AmitkDataSet * data_set, 
+		       const fads_svd_method_t method,
+		       const gint num_factors,
+		       gsl_vector ** return_s,
+		       gsl_matrix ** return_v,
+		       gsl_matrix ** return_u) {
+
+  svd_stream_t ss;
+  gint n, k, f, j, c, i;
+  gint status=-1;
+  gdouble * basis=NULL;
+  gdouble * sum=NULL;
+  gdouble * inverse_s=NULL;
+  gsl_vector * eval=NULL;
+  gsl_matrix * evec=NULL;
+  gsl_vector * s=NULL;
+  gsl_matrix * v=NULL;
+  gsl_matrix * u=NULL;
+  GRand * rand;
+  gdouble total;
+
+  ss.data_set = data_set;
+  ss.dim = AMITK_DATA_SET_DIM(data_set);
+  ss.num_voxels = ss.dim.x*ss.dim.y*ss.dim.z*ss.dim.g;
+  ss.num_frames = n = ss.dim.t;
+  ss.inverse_s = NULL;
+  ss.u = NULL;
+  g_mutex_init(&(ss.mutex));
+
+  /* no point in being random if we'd end up with the full subspace anyway */
+  if (method == FADS_SVD_RANDOMIZED)
+    k = MIN(num_factors + SVD_RANDOMIZED_OVERSAMPLE, n);
+  else
+    k = n;
+  if (k == n) {
+    basis = g_try_new(gdouble, n*n);
+    sum = g_try_new(gdouble, n*n);
+  } else {
+    basis = g_try_new(gdouble, n*k);
+    sum = g_try_new(gdouble, MAX(n*k, k*k));
+  }
+  eval = gsl_vector_alloc(k);
+  evec = gsl_matrix_alloc(k, k);
+  if ((basis == NULL) || (sum == NULL) || (eval == NULL) || (evec == NULL)) {
+    g_warning(_("Failed to allocate %dx%d array"), n, k);
+    goto ending;
+  }
+
+  amitk_raw_data_page_in_frames(AMITK_DATA_SET_RAW_DATA(data_set), 0, n-1);
+
+  if (k == n) { 
+    /* eigenvectors of A'A are the right singular vectors */
+    svd_stream_pass(&ss, SVD_PASS_GRAM, 0, NULL, sum);
+    status = symmetric_eigen(sum, n, eval, evec);
+    if (status != 0) goto ending;
+    for (j=0; j<n; j++)
+      for (c=0; c<n; c++)
+	basis[j*n+c] = gsl_matrix_get(evec, j, c);
+
+  } else { 
+    /* find a basis for the dominant subspace, A'A applied to a random start */
+    rand = g_rand_new_with_seed(n*k);
+    for (i=0; i<n*k; i++)
+      basis[i] = g_rand_double_range(rand, -1.0, 1.0);
+    g_rand_free(rand);
+    orthonormalize_columns(basis, n, k);
+
+    for (i=0; i<SVD_RANDOMIZED_POWER_ITERATIONS; i++) {
+      svd_stream_pass(&ss, SVD_PASS_POWER, k, basis, sum);
+      memcpy(basis, sum, sizeof(gdouble)*n*k);
+      orthonormalize_columns(basis, n, k);
+    }
+
+    /* and then the eigen decomposition of A'A restricted to that subspace */
+    svd_stream_pass(&ss, SVD_PASS_PROJECTED_GRAM, k, basis, sum);
+    status = symmetric_eigen(sum, k, eval, evec);
+    if (status != 0) goto ending;
+
+    /* rotate the basis into the right singular vectors, V = basis*evec */
+    memcpy(sum, basis, sizeof(gdouble)*n*k);
+    for (j=0; j<n; j++)
+      for (c=0; c<k; c++) {
+	total = 0.0;
+	for (i=0; i<k; i++)
+	  total += sum[j*k+i]*gsl_matrix_get(evec, i, c);
+	basis[j*k+c] = total;
+      }
+  }
+
+  s = gsl_vector_alloc(num_factors);
+  v = gsl_matrix_alloc(n, num_factors);
+  inverse_s = g_try_new(gdouble, num_factors);
+  if ((s == NULL) || (v == NULL) || (inverse_s == NULL)) {
+    g_warning(_("Failed to allocate %dx%d array"), n, num_factors);
+    status = -1;
+    goto ending;
+  }
+
+  /* the eigenvalues are the squares of the singular values, also do some obvious flipping */
+  for (f=0; f<num_factors; f++) {
+    gsl_vector_set(s, f, sqrt(MAX(gsl_vector_get(eval, f), 0.0)));
+    inverse_s[f] = (gsl_vector_get(s, f) > 0.0) ? 1.0/gsl_vector_get(s, f) : 0.0;
+
+    total = 0.0;
+    for (j=0; j<n; j++)
+      total += basis[j*k+f];
+    for (j=0; j<n; j++)
+      gsl_matrix_set(v, j, f, (total < 0) ? -basis[j*k+f] : basis[j*k+f]);
+  }
+
+  /* the left singular vectors, U = A*V*inv(S) */
+  if (return_u != NULL) {
+    u = gsl_matrix_alloc(ss.num_voxels, num_factors);
+    if (u == NULL) {
+      g_warning(_("failed to alloc matrix, size %dx%d"), ss.num_voxels, num_factors);
+      status = -1;
+      goto ending;
+    }
+    for (j=0; j<n; j++)
+      for (f=0; f<num_factors; f++)
+	basis[j*num_factors+f] = gsl_matrix_get(v, j, f);
+    ss.u = u;
+    ss.inverse_s = inverse_s;
+    svd_stream_pass(&ss, SVD_PASS_COMPONENTS, num_factors, basis, NULL);
+    *return_u = u;
+    u = NULL;
+  }
+
+  if (return_s != NULL) {
+    *return_s = s;
+    s = NULL;
+  }
+
+  if (return_v != NULL) {
+    *return_v = v;
+    v = NULL;
+  }
+
+ ending:
+
+  g_mutex_clear(&(ss.mutex));
+  if (basis != NULL) g_free(basis);
+  if (sum != NULL) g_free(sum);
+  if (inverse_s != NULL) g_free(inverse_s);
+  if (eval != NULL) gsl_vector_free(eval);
+  if (evec != NULL) gsl_matrix_free(evec);
+  if (s != NULL) gsl_vector_free(s);
+  if (v != NULL) gsl_matrix_free(v);
+  if (u != NULL) gsl_matrix_free(u);
+
+  return status;
+}
+
 void fads_svd_factors(AmitkDataSet * data_set, 
+		      fads_svd_method_t method,
 		      gint * pnum_factors,
 		      gdouble ** pfactors) {
 
@@ -110,42 +499,55 @@ void fads_svd_factors(AmitkDataSet * data_set,
     goto ending;
   }
 
-  /* do all the memory allocations upfront */
-  if ((matrix_a = gsl_matrix_alloc(m,n)) == NULL) {
-    g_warning(_("Failed to allocate %dx%d array"), m,n);
-    goto ending;
-  }
+  /* the streaming methods skip the voxels x frames matrix, the randomized method
+     only bothers with the leading singular values */
+  if (method != FADS_SVD_FULL) {
+    if (method == FADS_SVD_RANDOMIZED)
+      n = MIN(n, SVD_RANDOMIZED_VALUES);
+    status = stream_svd(data_set, method, n, &vector_s, NULL, NULL);
+    if (status != 0) {
+      g_warning(_("SV decomp returned error: %s"), gsl_strerror(status));
+      goto ending;
+    }
+  } else {
+
+    /* do all the memory allocations upfront */
+    if ((matrix_a = gsl_matrix_alloc(m,n)) == NULL) {
+      g_warning(_("Failed to allocate %dx%d array"), m,n);
+      goto ending;
+    }
   
-  if ((matrix_v = gsl_matrix_alloc(n,n)) == NULL) {
-    g_warning(_("Failed to allocate %dx%d array"), n,n);
-    goto ending;
-  }
+    if ((matrix_v = gsl_matrix_alloc(n,n)) == NULL) {
+      g_warning(_("Failed to allocate %dx%d array"), n,n);
+      goto ending;
+    }
 
-  if ((vector_s = gsl_vector_alloc(n)) == NULL) {
-    g_warning(_("Failed to allocate %d vector"), n);
-    goto ending;
-  }
+    if ((vector_s = gsl_vector_alloc(n)) == NULL) {
+      g_warning(_("Failed to allocate %d vector"), n);
+      goto ending;
+    }
 
-  /* fill in the a matrix */
-  for (i_voxel.t = 0; i_voxel.t < dim.t; i_voxel.t++) {
-    i = 0;
-    for (i_voxel.g = 0; i_voxel.g < dim.g; i_voxel.g++) {
-      for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++)
-	for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++)
-	  for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, i++) {
-	    value = amitk_data_set_get_value(data_set, i_voxel);
-	    gsl_matrix_set(matrix_a, i, i_voxel.t, value);
-	  }
+    /* fill in the a matrix */
+    for (i_voxel.t = 0; i_voxel.t < dim.t; i_voxel.t++) {
+      i = 0;
+      for (i_voxel.g = 0; i_voxel.g < dim.g; i_voxel.g++) {
+	for (i_voxel.z = 0; i_voxel.z < dim.z; i_voxel.z++)
+	  for (i_voxel.y = 0; i_voxel.y < dim.y; i_voxel.y++)
+	    for (i_voxel.x = 0; i_voxel.x < dim.x; i_voxel.x++, i++) {
+	      value = amitk_data_set_get_value(data_set, i_voxel);
+	      gsl_matrix_set(matrix_a, i, i_voxel.t, value);
+	    }
+      }
     }
-  }
 
-  /* get the singular value decomposition of the correlation matrix -> matrix_a = U*S*Vt
-     notes: 
-        the function will place the value of U into matrix_a 
-        gsl_linalg_SV_decomp_jacobi will return an unsuitable matrix_v, don't use it 
-  */
-  status = perform_svd(matrix_a, matrix_v, vector_s);
-  if (status != 0) g_warning(_("SV decomp returned error: %s"), gsl_strerror(status));
+    /* get the singular value decomposition of the correlation matrix -> matrix_a = U*S*Vt
+       notes: 
+	  the function will place the value of U into matrix_a 
+	  gsl_linalg_SV_decomp_jacobi will return an unsuitable matrix_v, don't use it 
+    */
+    status = perform_svd(matrix_a, matrix_v, vector_s);
+    if (status != 0) g_warning(_("SV decomp returned error: %s"), gsl_strerror(status));
+  }
 
   /* transferring data */
   if (pnum_factors != NULL)
@@ -241,6 +643,7 @@ static gsl_multimin_fdfminimizer * alloc_fdfminimizer(fads_minimizer_algorithm_t
 
 static void perform_pca(AmitkDataSet * data_set, 
 			gint num_factors,
+			fads_svd_method_t method,
 			gsl_matrix ** return_u,
 			gsl_vector ** return_s, 
 			gsl_matrix ** return_v) {
@@ -257,6 +660,13 @@ static void perform_pca(AmitkDataSet * data_set,
   gint status;
   gdouble total;
 
+  /* the streaming methods only ever compute the num_factors components we need */
+  if (method != FADS_SVD_FULL) {
+    status = stream_svd(data_set, method, num_factors, return_s, return_v, return_u);
+    if (status != 0) g_warning(_("SV decomp returned error: %s"), gsl_strerror(status));
+    return;
+  }
+
   dim = AMITK_DATA_SET_DIM(data_set);
   num_voxels = dim.x*dim.y*dim.z*dim.g;
   num_frames = dim.t;
@@ -369,7 +779,9 @@ static void perform_pca(AmitkDataSet * data_set,
 
 void fads_pca(AmitkDataSet * data_set, 
 	      gint num_factors,
+	      fads_svd_method_t method,
 	      gchar * output_filename,
+	      GList ** pnew_data_sets,
 	      AmitkUpdateFunc update_func,
 	      gpointer update_data) {
 
@@ -398,8 +810,8 @@ void fads_pca(AmitkDataSet * data_set,
     g_free(temp_string);
   }
 
-  perform_pca(data_set, num_factors, &u, &s, &v);
-
+  perform_pca(data_set, num_factors, method, &u, &s, &v);
+  if ((u == NULL) || (s == NULL) || (v == NULL)) goto ending;
 
 
   /* copy the data on over */
@@ -433,8 +845,7 @@ void fads_pca(AmitkDataSet * data_set,
     amitk_data_set_set_threshold_max(new_ds, 0, amitk_data_set_get_global_max(new_ds));
     amitk_data_set_set_threshold_min(new_ds, 0, amitk_data_set_get_global_min(new_ds));
     amitk_data_set_set_interpolation(new_ds, AMITK_DATA_SET_INTERPOLATION(data_set));
-    amitk_object_add_child(AMITK_OBJECT(data_set), AMITK_OBJECT(new_ds));
-    amitk_object_unref(new_ds); /* add_child adds a reference */
+    *pnew_data_sets = g_list_append(*pnew_data_sets, new_ds);
   }
 
   /* and output the curves */
@@ -491,30 +902,6 @@ void fads_pca(AmitkDataSet * data_set,
   return;
 }
 
-static gdouble calc_magnitude(AmitkDataSet * ds, gdouble * weight) {
-
-  gdouble magnitude;
-  AmitkVoxel i_voxel;
-  AmitkVoxel dim;
-  amide_data_t data;
-
-  dim = AMITK_DATA_SET_DIM(ds);
-  magnitude = 0;
-
-  for (i_voxel.t=0; i_voxel.t<dim.t; i_voxel.t++) 
-    for (i_voxel.g=0; i_voxel.g<dim.g; i_voxel.g++) 
-      for (i_voxel.z=0; i_voxel.z<dim.z; i_voxel.z++) 
-	for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) 
-	  for (i_voxel.x=0; i_voxel.x<dim.x; i_voxel.x++) {
-	    data = amitk_data_set_get_value(ds, i_voxel);
-	    magnitude += weight[i_voxel.t]*data*data;
-	  }
-
-
-  return sqrt(magnitude);
-}
-
-
 /* returned array needs to be free'd */
 gdouble * calc_weights(AmitkDataSet * ds) {
 
@@ -550,6 +937,251 @@ gdouble * calc_weights(AmitkDataSet * ds) {
 
 
 
+/* the least squares terms of the PLS and two compartment objectives are evaluated over the 
+   data packed into a voxel by frame matrix (each voxel's curve is contiguous), worked on in 
+   fixed blocks of voxels so that the threads' partial sums always add up the same way */
+#define PACKED_BLOCK_VOXELS 1024
+
+typedef struct {
+  gint num_voxels;
+  gint num_frames;
+  gint num_factors;
+  gint num_blocks;
+  amitk_format_FLOAT_t * data; /* [num_voxels*num_frames] */
+  gdouble * weight; /* [num_frames], owned by the caller */
+  gdouble * forward_error; /* estimated data minus the actual data, [num_voxels*num_frames] */
+  gdouble * block_ls; /* [num_blocks] */
+  gdouble * block_gradient; /* [num_blocks*num_factors*num_frames] */
+
+  /* used while evaluating */
+  AmitkDataSet * data_set;
+  gint frame;
+  const gdouble * factors; /* [num_factors*num_frames] */
+  const gdouble * alpha; /* [num_voxels*num_factors] */
+  gdouble * alpha_gradient; /* [num_voxels*num_factors] */
+} packed_data_t;
+
+static void packed_data_free(packed_data_t * pd) {
+
+  if (pd == NULL) return;
+
+  g_free(pd->data);
+  g_free(pd->forward_error);
+  g_free(pd->block_ls);
+  g_free(pd->block_gradient);
+  g_free(pd);
+
+  return;
+}
+
+static void packed_data_fill_planes(const gint start, const gint end, gpointer data) {
+
+  packed_data_t * pd = data;
+  AmitkVoxel i_voxel, dim;
+  gint i_plane, k;
+
+  dim = AMITK_DATA_SET_DIM(pd->data_set);
+  i_voxel.t = pd->frame;
+
+  for (i_plane = start; i_plane < end; i_plane++) {
+    i_voxel.g = i_plane / dim.z;
+    i_voxel.z = i_plane % dim.z;
+    k = i_plane*dim.y*dim.x;
+    for (i_voxel.y=0; i_voxel.y<dim.y; i_voxel.y++) 
+      for (i_voxel.x=0; i_voxel.x<dim.x; i_voxel.x++, k++) 
+	pd->data[k*pd->num_frames+pd->frame] = amitk_data_set_get_value(pd->data_set, i_voxel);
+  }
+
+  return;
+}
+
+static packed_data_t * packed_data_new(AmitkDataSet * ds, gdouble * weight, const gint num_factors) {
+
+  packed_data_t * pd;
+  AmitkVoxel dim;
+  gint num_planes;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  num_planes = dim.g*dim.z;
+
+  pd = g_new0(packed_data_t, 1);
+  pd->num_voxels = dim.g*dim.z*dim.y*dim.x;
+  pd->num_frames = dim.t;
+  pd->num_factors = num_factors;
+  pd->num_blocks = (pd->num_voxels + PACKED_BLOCK_VOXELS-1)/PACKED_BLOCK_VOXELS;
+  pd->weight = weight;
+
+  pd->data = g_try_new(amitk_format_FLOAT_t, pd->num_voxels*pd->num_frames);
+  pd->forward_error = g_try_new(gdouble, pd->num_voxels*pd->num_frames);
+  pd->block_ls = g_try_new(gdouble, pd->num_blocks);
+  pd->block_gradient = g_try_new(gdouble, pd->num_blocks*pd->num_factors*pd->num_frames);
+  if ((pd->data == NULL) || (pd->forward_error == NULL) || 
+      (pd->block_ls == NULL) || (pd->block_gradient == NULL)) {
+    g_warning(_("failed to allocate packed data storage"));
+    packed_data_free(pd);
+    return NULL;
+  }
+
+  /* pull the data out of the data set once, so the objective doesn't have to go 
+     through amitk_data_set_get_value on every evaluation */
+  pd->data_set = ds;
+  for (pd->frame = 0; pd->frame < pd->num_frames; pd->frame++) {
+    amitk_raw_data_page_in_frames(AMITK_DATA_SET_RAW_DATA(ds), pd->frame, pd->frame);
+    amitk_parallel_for(num_planes, packed_data_fill_planes, pd);
+  }
+  pd->data_set = NULL;
+
+  return pd;
+}
+
+static gdouble packed_data_magnitude(const packed_data_t * pd) {
+
+  gdouble magnitude=0.0;
+  amitk_format_FLOAT_t data;
+  gint i, j;
+
+  for (i=0; i<pd->num_voxels; i++) 
+    for (j=0; j<pd->num_frames; j++) {
+      data = pd->data[i*pd->num_frames+j];
+      magnitude += pd->weight[j]*data*data;
+    }
+
+  return sqrt(magnitude);
+}
+
+static void packed_data_forward_error_blocks(const gint start, const gint end, gpointer data) {
+
+  packed_data_t * pd = data;
+  const gint num_frames = pd->num_frames;
+  const gint num_factors = pd->num_factors;
+  const gdouble * alpha;
+  const gdouble * factor;
+  const amitk_format_FLOAT_t * actual;
+  gdouble * error;
+  gdouble ls;
+  gint b, i, j, f;
+
+  for (b = start; b < end; b++) {
+    ls = 0.0;
+    for (i = b*PACKED_BLOCK_VOXELS; i < MIN((b+1)*PACKED_BLOCK_VOXELS, pd->num_voxels); i++) {
+      alpha = pd->alpha + i*num_factors;
+      actual = pd->data + i*num_frames;
+      error = pd->forward_error + i*num_frames;
+
+      for (j=0; j<num_frames; j++)
+	error[j] = -actual[j];
+      for (f=0, factor=pd->factors; f<num_factors; f++, factor+=num_frames)
+	for (j=0; j<num_frames; j++)
+	  error[j] += alpha[f]*factor[j];
+
+      for (j=0; j<num_frames; j++)
+	ls += pd->weight[j]*error[j]*error[j];
+    }
+    pd->block_ls[b] = ls;
+  }
+
+  return;
+}
+
+/* forward_error = alpha*factors - data, returns the weighted sum of the squared errors.
+   factors is [num_factors*num_frames], alpha is [num_voxels*num_factors] */
+static gdouble packed_data_forward_error(packed_data_t * pd, const gdouble * factors, const gdouble * alpha) {
+
+  gdouble ls=0.0;
+  gint b;
+
+  pd->factors = factors;
+  pd->alpha = alpha;
+  amitk_parallel_for(pd->num_blocks, packed_data_forward_error_blocks, pd);
+
+  for (b=0; b<pd->num_blocks; b++)
+    ls += pd->block_ls[b];
+
+  return ls;
+}
+
+static void packed_data_gradient_blocks(const gint start, const gint end, gpointer data) {
+
+  packed_data_t * pd = data;
+  const gint num_frames = pd->num_frames;
+  const gint num_factors = pd->num_factors;
+  const gdouble * alpha;
+  const gdouble * factor;
+  const gdouble * error;
+  gdouble * gradient;
+  gdouble * alpha_gradient;
+  gdouble weighted, total;
+  gint b, i, j, f;
+
+  for (b = start; b < end; b++) {
+    gradient = pd->block_gradient + b*num_factors*num_frames;
+    for (j=0; j<num_factors*num_frames; j++)
+      gradient[j] = 0.0;
+
+    for (i = b*PACKED_BLOCK_VOXELS; i < MIN((b+1)*PACKED_BLOCK_VOXELS, pd->num_voxels); i++) {
+      alpha = pd->alpha + i*num_factors;
+      alpha_gradient = pd->alpha_gradient + i*num_factors;
+      error = pd->forward_error + i*num_frames;
+
+      for (f=0, factor=pd->factors; f<num_factors; f++, factor+=num_frames) {
+	total = 0.0;
+	for (j=0; j<num_frames; j++) {
+	  weighted = pd->weight[j]*error[j];
+	  total += weighted*factor[j];
+	  gradient[f*num_frames+j] += alpha[f]*weighted;
+	}
+	alpha_gradient[f] = 2.0*total;
+      }
+    }
+  }
+
+  return;
+}
+
+/* the least squares part of the gradient, needs a current forward error.
+   factor_gradient[f*num_frames+j] = 2*weight[j]*sum_i alpha[i,f]*forward_error[i,j]
+   alpha_gradient[i*num_factors+f] = 2*sum_j weight[j]*forward_error[i,j]*factors[f,j] */
+static void packed_data_gradient(packed_data_t * pd, const gdouble * factors, const gdouble * alpha,
+				 gdouble * factor_gradient, gdouble * alpha_gradient) {
+
+  gint b, k;
+  const gdouble * gradient;
+
+  pd->factors = factors;
+  pd->alpha = alpha;
+  pd->alpha_gradient = alpha_gradient;
+  amitk_parallel_for(pd->num_blocks, packed_data_gradient_blocks, pd);
+
+  for (k=0; k<pd->num_factors*pd->num_frames; k++)
+    factor_gradient[k] = 0.0;
+  for (b=0, gradient=pd->block_gradient; b<pd->num_blocks; b++, gradient+=pd->num_factors*pd->num_frames)
+    for (k=0; k<pd->num_factors*pd->num_frames; k++)
+      factor_gradient[k] += 2.0*gradient[k];
+
+  return;
+}
+
+
+/* the timing of each iteration goes at the top of the output file */
+static void write_iteration_times(FILE * file_pointer, GArray * iteration_times) {
+
+  gdouble total=0.0;
+  guint i;
+
+  fprintf(file_pointer, "# iteration\ttime (s)\n");
+  for (i=0; i<iteration_times->len; i++) {
+    fprintf(file_pointer, "#   %d\t%g\n", i+1, g_array_index(iteration_times, gdouble, i));
+    total += g_array_index(iteration_times, gdouble, i);
+  }
+  fprintf(file_pointer, "# total\t%g\n", total);
+  fprintf(file_pointer, "#\n");
+
+  return;
+}
+
+
+
+
 typedef struct pls_params_t {
   AmitkDataSet * data_set;
   AmitkVoxel dim;
@@ -561,7 +1193,7 @@ typedef struct pls_params_t {
   gint alpha_offset; /* num_factors*num_frames */
   gint num_variables; /* alpha_offset+num_voxels*num_factors*/
 
-  gdouble * forward_error; /* our estimated data (the forward problem), subtracted by the actual data */
+  packed_data_t * packed; /* the data, and our estimated data subtracted by the actual data */
   gdouble * weight; /* the appropriate weight (frame dependent) */
   gdouble * ec_a; /* used for sum alpha == 1.0 */
   gdouble * ec_bc;
@@ -614,33 +1246,12 @@ static void pls_calc_constraints(pls_params_t * p, const gsl_vector *v) {
 
 }
 
+/* note, the minimizer's vectors are always contiguous, so the factors and coefficients can be
+   handed straight to the packed data routines */
 static void pls_calc_forward_error(pls_params_t * p, const gsl_vector *v) {
 
-  gint i, k, f;
-  AmitkVoxel i_voxel;
-  gdouble inner;
-  gdouble alpha;
-  gdouble factor;
-
-  for (i_voxel.t=0; i_voxel.t<p->dim.t; i_voxel.t++) {
-    i=p->alpha_offset; /* what to skip in v to get to the coefficients */
-    k=0;
-    for (i_voxel.g=0; i_voxel.g<p->dim.g; i_voxel.g++) {
-      for (i_voxel.z=0; i_voxel.z<p->dim.z; i_voxel.z++) {
-	for (i_voxel.y=0; i_voxel.y<p->dim.y; i_voxel.y++) {
-	  for (i_voxel.x=0; i_voxel.x<p->dim.x; i_voxel.x++, i+=p->num_factors, k+=p->num_frames) {
-	    inner = 0.0;
-	    for (f=0;  f< p->num_factors; f++) {
-	      alpha = gsl_vector_get(v, i+f);
-	      factor = gsl_vector_get(v, f*p->num_frames+i_voxel.t);
-	      inner += alpha*factor;
-	    }
-	    p->forward_error[k+i_voxel.t] = inner - amitk_data_set_get_value(p->data_set,i_voxel);
-	  }
-	}
-      }
-    }
-  }
+  p->ls = packed_data_forward_error(p->packed, gsl_vector_const_ptr(v, 0), 
+				    gsl_vector_const_ptr(v, p->alpha_offset));
 
   return;
 }
@@ -652,18 +1263,11 @@ static gdouble pls_calc_function(pls_params_t * p, const gsl_vector *v) {
   gdouble neg_answer=0.0;
   gdouble orth_answer=0.0;
   gdouble blood_answer=0.0;
-  gdouble temp, lambda, factor, alpha;
+  gdouble lambda, factor, alpha;
   gint i, j, f, l;
 
-  /* the Least Squares objective */
-  ls_answer = 0.0;
-  for (j=0; j<p->num_frames; j++) {
-    for (i=0; i<p->num_voxels; i++) {
-      temp = p->forward_error[i*p->num_frames+j];
-      ls_answer += p->weight[j]*temp*temp;
-    }
-  }
-  p->ls = ls_answer;
+  /* the Least Squares objective, calculated along with the forward error */
+  ls_answer = p->ls;
 
   /* the non-negativity constraints */
   neg_answer = 0.0;
@@ -719,28 +1323,23 @@ static gdouble pls_calc_function(pls_params_t * p, const gsl_vector *v) {
 
 static void pls_calc_derivative(pls_params_t * p, const gsl_vector *v, gsl_vector *df) {
 
-  gdouble ls_answer=0.0;
   gdouble neg_answer=0.0;
   gdouble orth_answer;
   gdouble blood_answer=0.0;
   gdouble factor, alpha, lambda;
-  gint i, j, k, l, q; //f
+  gdouble * gradient;
+  gint i, j, l, q;
 
+  /* the Least Squares objective, for both the factors and the coefficients */
+  gradient = gsl_vector_ptr(df, 0);
+  packed_data_gradient(p->packed, gsl_vector_const_ptr(v, 0), gsl_vector_const_ptr(v, p->alpha_offset),
+		       gradient, gradient+p->alpha_offset);
 
   /* calculate first for the factor variables */
   for (q= 0; q < p->num_factors; q++) {
     for (j=0; j<p->num_frames; j++) {
       factor = gsl_vector_get(v, q*p->num_frames+j);
       
-      /* the Least Squares objective */
-      ls_answer = 0.0;
-      /* p->coef_offset is what to skip in v to get to the coefficients */
-      for (i=p->alpha_offset, k=0; k < p->num_frames*p->num_voxels; i+=p->num_factors, k+=p->num_frames) {
-	alpha = gsl_vector_get(v, i+q);
-	ls_answer += alpha*p->forward_error[k+j];
-      }
-      ls_answer *= 2.0*p->weight[j];
-
       /* the non-negativity objective */
       lambda = p->lmi_f[q*p->num_frames+j];
       if ((factor - p->mu*lambda) < 0.0)
@@ -755,24 +1354,16 @@ static void pls_calc_derivative(pls_params_t * p, const gsl_vector *v, gsl_vecto
 	  if (p->blood_curve_constraint_frame[i] == j) 
 	    blood_answer += p->ec_bc[i]/p->mu - p->lme_bc[i];
 
-      gsl_vector_set(df, q*p->num_frames+j, ls_answer+neg_answer+blood_answer);
+      gradient[q*p->num_frames+j] += neg_answer+blood_answer;
     }
   }
 
   /* now calculate for the coefficient variables */
   for (q= 0; q < p->num_factors; q++) {
 
-    for (i=p->alpha_offset, k=0, l=0; i < p->num_variables; i+=p->num_factors, k+=p->num_frames, l++) {
+    for (i=p->alpha_offset, l=0; i < p->num_variables; i+=p->num_factors, l++) {
       alpha = gsl_vector_get(v, i+q);
 
-      /* the Least Squares objective */
-      ls_answer = 0;
-      for (j=0; j<p->num_frames; j++) {
-	factor = gsl_vector_get(v, q*p->num_frames+j);
-	ls_answer += p->weight[j]*p->forward_error[k+j]*factor;
-      }
-      ls_answer *= 2.0;
-
       /* the non-negativity and <= 1 objective */
       lambda = p->lmi_a[l*p->num_factors+q];
       if ((alpha-p->mu*lambda) < 0.0)
@@ -793,7 +1384,7 @@ static void pls_calc_derivative(pls_params_t * p, const gsl_vector *v, gsl_vecto
 #endif
 	orth_answer = 0;
       
-      gsl_vector_set(df, i+q, ls_answer+neg_answer+orth_answer);
+      gradient[i+q] += neg_answer+orth_answer;
     }
   }
 
@@ -898,6 +1489,7 @@ void fads_pls(AmitkDataSet * data_set,
 	      gint * blood_curve_constraint_frame,
 	      gdouble * blood_curve_constraint_val,
 	      GArray * initial_curves,
+	      GList ** pnew_data_sets,
 	      AmitkUpdateFunc update_func,
 	      gpointer update_data) {
 
@@ -909,6 +1501,9 @@ void fads_pls(AmitkDataSet * data_set,
   gint outer_iter=0;
   gsl_vector * initial=NULL;
   gint i, f, j;
+  GTimer * iteration_timer=NULL;
+  GArray * iteration_times=NULL;
+  gdouble iteration_time;
   gint status;
   FILE * file_pointer=NULL;
   gchar * temp_string;
@@ -950,7 +1545,7 @@ void fads_pls(AmitkDataSet * data_set,
   p.num_blood_curve_constraints = num_blood_curve_constraints;
   p.blood_curve_constraint_frame = blood_curve_constraint_frame;
   p.blood_curve_constraint_val = blood_curve_constraint_val;
-  p.forward_error = NULL;
+  p.packed = NULL;
   p.weight = NULL;
   p.ec_a = NULL;
   p.ec_bc = NULL;
@@ -972,19 +1567,17 @@ void fads_pls(AmitkDataSet * data_set,
     }
   }
 
-  p.forward_error = g_try_new(gdouble, p.num_frames*p.num_voxels);
-  if (p.forward_error == NULL) {
-    g_warning(_("failed forward error malloc"));
-    goto ending;
-  }
-
-  /* calculate the weights and magnitude */
+  /* calculate the weights */
   p.weight = calc_weights(p.data_set);
   if (p.weight == NULL) {
     g_warning(_("failed weight malloc"));
     goto ending;
   }
-  magnitude = calc_magnitude(p.data_set, p.weight);
+
+  /* pack the data, and calculate the magnitude */
+  p.packed = packed_data_new(p.data_set, p.weight, p.num_factors);
+  if (p.packed == NULL) goto ending;
+  magnitude = packed_data_magnitude(p.packed);
 
   if (p.sum_factors_equal_one) {
     p.ec_a = g_try_new(gdouble, p.num_voxels);
@@ -1069,14 +1662,19 @@ void fads_pls(AmitkDataSet * data_set,
     /* if not given initial curves, try to come up with something reasonable as the initial condition */
     gdouble time_constant;
     gdouble time_start;
-    gsl_vector * s;
-    gsl_matrix * u;
-    gsl_matrix * v;
+    gsl_vector * s=NULL;
+    gsl_matrix * v=NULL;
     gdouble temp1, temp2, mult;
 
 
-    /* setting the factors to the principle components */
-    perform_pca(p.data_set, p.num_factors, &u, &s, &v);
+    /* setting the factors to the principle components, the Gram matrix method is
+       plenty accurate for a starting guess and doesn't need a voxels x frames matrix */
+    perform_pca(p.data_set, p.num_factors, FADS_SVD_GRAM, NULL, &s, &v);
+    if ((s == NULL) || (v == NULL)) {
+      if (s != NULL) gsl_vector_free(s);
+      if (v != NULL) gsl_matrix_free(v);
+      goto ending;
+    }
     
     /* need to initialize the factors, picking some quasi-exponential curves */
     /* use a time constant of 100th of the study length, as a guess */
@@ -1126,7 +1724,6 @@ void fads_pls(AmitkDataSet * data_set,
 	time_constant *=2.0;
     }
     gsl_vector_free(s);
-    gsl_matrix_free(u);
     gsl_matrix_free(v);
 
   
@@ -1165,6 +1762,9 @@ void fads_pls(AmitkDataSet * data_set,
   g_print("iteration\t%10s = %5s + %5s + %5s + %5s\tmu\tbeta\n", "total err", "lsq", "noneg", "ortho", "blood");
 #endif
 
+  iteration_timer = g_timer_new();
+  iteration_times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
 
   do { /* outer loop */
     outer_iter++;
@@ -1177,7 +1777,10 @@ void fads_pls(AmitkDataSet * data_set,
     do { /* inner loop */
       inner_iter++;
       
+      g_timer_start(iteration_timer);
       status = gsl_multimin_fdfminimizer_iterate (multimin_minimizer);
+      iteration_time = g_timer_elapsed(iteration_timer, NULL);
+      g_array_append_val(iteration_times, iteration_time);
       
       if (!status) 
 	status = gsl_multimin_test_gradient (multimin_minimizer->gradient, stopping_criteria);
@@ -1297,7 +1900,7 @@ void fads_pls(AmitkDataSet * data_set,
   if (update_func != NULL) /* remove progress bar */
     continue_work = (*update_func)(update_data, NULL, (gdouble) 2.0); 
 
-  /* add the different coefficients to the tree */
+  /* make data sets of the different coefficients */
   dim.t = 1;
   i_voxel.t = 0;
   for (f=0; f<p.num_factors; f++) {
@@ -1330,8 +1933,7 @@ void fads_pls(AmitkDataSet * data_set,
     amitk_data_set_set_threshold_max(new_ds, 0, amitk_data_set_get_global_max(new_ds));
     amitk_data_set_set_threshold_min(new_ds, 0, amitk_data_set_get_global_min(new_ds));
     amitk_data_set_set_interpolation(new_ds, AMITK_DATA_SET_INTERPOLATION(p.data_set));
-    amitk_object_add_child(AMITK_OBJECT(p.data_set), AMITK_OBJECT(new_ds));
-    amitk_object_unref(new_ds); /* add_child adds a reference */
+    *pnew_data_sets = g_list_append(*pnew_data_sets, new_ds);
   }
 
 
@@ -1343,6 +1945,7 @@ void fads_pls(AmitkDataSet * data_set,
   }
 
   write_header(file_pointer, status, FADS_TYPE_PLS, data_set, inner_iter);
+  write_iteration_times(file_pointer, iteration_times);
 
   fprintf(file_pointer, "# frame\tduration (s)\ttime midpt (s)\tfactor:\n");
   fprintf(file_pointer, "#\t");
@@ -1385,9 +1988,9 @@ void fads_pls(AmitkDataSet * data_set,
     p.weight = NULL;
   }
 
-  if (p.forward_error != NULL) {
-    g_free(p.forward_error);
-    p.forward_error = NULL;
+  if (p.packed != NULL) {
+    packed_data_free(p.packed);
+    p.packed = NULL;
   }
 
   if (p.ec_a != NULL) {
@@ -1424,6 +2027,16 @@ void fads_pls(AmitkDataSet * data_set,
     g_timer_destroy(timer);
     timer = NULL;
   }
+
+  if (iteration_timer != NULL) {
+    g_timer_destroy(iteration_timer);
+    iteration_timer = NULL;
+  }
+
+  if (iteration_times != NULL) {
+    g_array_free(iteration_times, TRUE);
+    iteration_times = NULL;
+  }
 };
 
 
@@ -1450,7 +2063,11 @@ typedef struct two_comp_params_t {
   /* tc_unscaled[f]*k21(f) would be our estimate for compartment 2 (tissue component) */
   gdouble * tc_unscaled; 
 
-  gdouble * forward_error; /* our estimated data (the forward problem), subtracted by the actual data */
+  /* the curves the alpha's multiply, k21(f)*tc_unscaled[f] for the tissues, then the blood curve, [F*N] */
+  gdouble * factors;
+  gdouble * factor_gradient; /* least squares gradient wrt factors, [F*N] */
+
+  packed_data_t * packed; /* the data, and our estimated data subtracted by the actual data */
   gdouble * weight; /* the appropriate weight (frame dependent) */
   gdouble * start; /* start time of each frame */
   gdouble * end; /* end time of each frame */
@@ -1545,38 +2162,19 @@ static void two_comp_calc_compartments(two_comp_params_t * p, const gsl_vector *
 
 static void two_comp_calc_forward_error(two_comp_params_t * p, const gsl_vector *v) {
 
-  gint i, k, t;
-  AmitkVoxel i_voxel;
-  gdouble bc;
+  gint j, t;
   gdouble k21;
-  gdouble inner, alpha;
-
-
-  for (i_voxel.t=0; i_voxel.t<p->dim.t; i_voxel.t++) {
-    i=p->alpha_offset;
-    k=0;
-    bc = gsl_vector_get(v, p->bc_offset+i_voxel.t);
-    for (i_voxel.g=0; i_voxel.g<p->dim.g; i_voxel.g++) {
-      for (i_voxel.z=0; i_voxel.z<p->dim.z; i_voxel.z++) {
-	for (i_voxel.y=0; i_voxel.y<p->dim.y; i_voxel.y++) {
-	  for (i_voxel.x=0; i_voxel.x<p->dim.x; i_voxel.x++, k++, i+=p->num_factors) {
-	    
-	    inner=0;
-	    for (t=0; t < p->num_tissues; t++) {
-	      k21 = gsl_vector_get(v, p->k21_offset+t);
-	      alpha = gsl_vector_get(v, i+t);
-	      inner += alpha*k21*p->tc_unscaled[i_voxel.t*p->num_tissues+t];
-	    }
-	    
-	    alpha = gsl_vector_get(v, i+p->num_tissues);
-	    p->forward_error[k*p->num_frames+i_voxel.t] = 
-	      alpha*bc+inner-amitk_data_set_get_value(p->data_set,i_voxel);
-	    
-	  }
-	}
-      }
-    }
+
+  for (t=0; t < p->num_tissues; t++) {
+    k21 = gsl_vector_get(v, p->k21_offset+t);
+    for (j=0; j<p->num_frames; j++) 
+      p->factors[t*p->num_frames+j] = k21*p->tc_unscaled[j*p->num_tissues+t];
   }
+  for (j=0; j<p->num_frames; j++) 
+    p->factors[p->num_tissues*p->num_frames+j] = gsl_vector_get(v, p->bc_offset+j);
+
+  /* the minimizer's vectors are always contiguous */
+  p->ls = packed_data_forward_error(p->packed, p->factors, gsl_vector_const_ptr(v, p->alpha_offset));
 
   return;
 }
@@ -1587,17 +2185,11 @@ static gdouble two_comp_calc_function(two_comp_params_t * p, const gsl_vector *v
   gdouble ls_answer=0.0;
   gdouble neg_answer=0.0;
   gdouble blood_answer=0.0;
-  gdouble temp, bc, k12, k21, alpha, lambda;
+  gdouble bc, k12, k21, alpha, lambda;
   gint i, k, j, f, t;
 
-  /* the Least Squares objective */
-  ls_answer = 0.0;
-  for (i=0; i<p->num_voxels; i++) {
-    for (j=0; j<p->num_frames; j++) {
-      temp = p->forward_error[i*p->num_frames+j];
-      ls_answer += p->weight[j]*temp*temp;
-    }
-  }
+  /* the Least Squares objective, calculated along with the forward error */
+  ls_answer = p->ls;
 
 
   neg_answer = 0.0;
@@ -1663,13 +2255,21 @@ static gdouble two_comp_calc_function(two_comp_params_t * p, const gsl_vector *v
   return ls_answer+neg_answer+blood_answer;
 }
 
+/* the least squares terms all come out of the gradient wrt the factors, as none of the 
+   kinetic terms depend on the voxel */
 static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v, gsl_vector *df) {
 
   gdouble ls_answer, neg_answer, blood_answer;
   gint f, i, j, k, t;
   gdouble k12, k21,  bc, inner, kernel, alpha;
   gdouble delta1, delta2, lambda;
-  
+  gdouble * gradient;
+  const gdouble * factor_gradient;
+
+  gradient = gsl_vector_ptr(df, 0);
+  factor_gradient = p->factor_gradient;
+  packed_data_gradient(p->packed, p->factors, gsl_vector_const_ptr(v, p->alpha_offset),
+		       p->factor_gradient, gradient+p->alpha_offset);
 
   /* partial derivative of f wrt to the k12's */
   for (t=0; t<p->num_tissues; t++) {
@@ -1677,38 +2277,34 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
     k21 = gsl_vector_get(v, p->k21_offset+t);
 
     ls_answer=0;
-    for (i=0; i<p->num_voxels; i++) {
-      for (j=0; j<p->num_frames; j++) {
-
-	inner = 0;
-	for (k=0; k<j ; k++) {
-	  delta1 = p->midpt[j]-p->end[k];
-	  delta2 = p->midpt[j]-p->start[k];
-	  if (fabs(k12) < EPSILON) 
-	    kernel = 0.5*(delta1*delta1-delta2*delta2);
-	  else
-	    kernel = (-delta1*exp(-k12*delta1)+delta2*exp(-k12*delta2))/k12;
-	  bc = gsl_vector_get(v, p->bc_offset+k);
-	  inner += bc*kernel;
-	}
+    for (j=0; j<p->num_frames; j++) {
 
-	/* k == j */
-	delta2 = p->midpt[j]-p->start[j];
+      inner = 0;
+      for (k=0; k<j ; k++) {
+	delta1 = p->midpt[j]-p->end[k];
+	delta2 = p->midpt[j]-p->start[k];
 	if (fabs(k12) < EPSILON) 
-	  kernel = -0.5*(delta2*delta2);
+	  kernel = 0.5*(delta1*delta1-delta2*delta2);
 	else
-	  kernel = (delta2*exp(-k12*delta2))/k12;
-	bc = gsl_vector_get(v, p->bc_offset+j);
+	  kernel = (-delta1*exp(-k12*delta1)+delta2*exp(-k12*delta2))/k12;
+	bc = gsl_vector_get(v, p->bc_offset+k);
 	inner += bc*kernel;
+      }
 
-	if (fabs(k12) > EPSILON) 
-	  inner -= p->tc_unscaled[j*p->num_tissues+t]/k12;
+      /* k == j */
+      delta2 = p->midpt[j]-p->start[j];
+      if (fabs(k12) < EPSILON) 
+	kernel = -0.5*(delta2*delta2);
+      else
+	kernel = (delta2*exp(-k12*delta2))/k12;
+      bc = gsl_vector_get(v, p->bc_offset+j);
+      inner += bc*kernel;
 
-	alpha = gsl_vector_get(v, p->alpha_offset+i*p->num_factors+t);
-	ls_answer += p->weight[j]*p->forward_error[i*p->num_frames+j] * alpha*k21*inner;
-      }
+      if (fabs(k12) > EPSILON) 
+	inner -= p->tc_unscaled[j*p->num_tissues+t]/k12;
+
+      ls_answer += factor_gradient[t*p->num_frames+j]*k21*inner;
     }
-    ls_answer *=2;
 
     /* the non-negatvity objective */
     lambda = p->lmi_k12[t];
@@ -1717,7 +2313,7 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
     else
       neg_answer = 0.0;
 
-    gsl_vector_set(df, p->k12_offset+t, ls_answer+neg_answer);
+    gradient[p->k12_offset+t] = ls_answer+neg_answer;
   }
 
   /* partial derivative of f wrt to the k21's */
@@ -1725,17 +2321,8 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
     k21 = gsl_vector_get(v, p->k21_offset+t);
 
     ls_answer=0;
-    for (i=0; i<p->num_voxels; i++) {
-      alpha = gsl_vector_get(v, p->alpha_offset+i*p->num_factors +t);
-      for (j=0; j<p->num_frames; j++) {
-	ls_answer += 
-	  p->weight[j]*
-	  p->forward_error[i*p->num_frames+j] *
-	  alpha*
-	  p->tc_unscaled[j*p->num_tissues+t];
-      }
-    }
-    ls_answer *=2;
+    for (j=0; j<p->num_frames; j++) 
+      ls_answer += factor_gradient[t*p->num_frames+j]*p->tc_unscaled[j*p->num_tissues+t];
 
     /* the non-negatvity objective */
     lambda = p->lmi_k21[t];
@@ -1744,51 +2331,38 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
     else
       neg_answer = 0.0;
 
-    gsl_vector_set(df, p->k21_offset+t, ls_answer+neg_answer);
+    gradient[p->k21_offset+t] = ls_answer+neg_answer;
   }
 
   /* partial derivative of f wrt to the blood curve */
   for (j=0; j<p->num_frames; j++) {
     bc = gsl_vector_get(v, p->bc_offset+j);
 
-    ls_answer=0;
-    for (i=0; i<p->num_voxels; i++) {
+    /* the blood fraction */
+    ls_answer = factor_gradient[p->num_tissues*p->num_frames+j];
+
+    for (t=0; t< p->num_tissues; t++) {
+      k12 = gsl_vector_get(v, p->k12_offset+t);
+      k21 = gsl_vector_get(v, p->k21_offset+t);
 
       /* k == j */
-      inner = gsl_vector_get(v, p->alpha_offset+i*p->num_factors+p->num_tissues);
-      for (t=0; t< p->num_tissues; t++) {
-	alpha = gsl_vector_get(v, p->alpha_offset+i*p->num_factors+t);
-	k12 = gsl_vector_get(v, p->k12_offset+t);
-	k21 = gsl_vector_get(v, p->k21_offset+t);
-	if (fabs(k12) < EPSILON) {
-	  kernel = p->midpt[j]-p->start[j];
-	} else {
-	  kernel = (1-exp(-k12*(p->midpt[j]-p->start[j])))/k12;
-	}
-	inner += alpha*k21*kernel;
+      if (fabs(k12) < EPSILON) {
+	kernel = p->midpt[j]-p->start[j];
+      } else {
+	kernel = (1-exp(-k12*(p->midpt[j]-p->start[j])))/k12;
       }
-      ls_answer += p->weight[j]*p->forward_error[i*p->num_frames+j]*inner;
-
+      ls_answer += k21*kernel*factor_gradient[t*p->num_frames+j];
 
       /* k > j */
       for (k=j+1; k<p->num_frames; k++) {
-	
-	inner = 0;
-	for (t=0; t< p->num_tissues; t++) {
-	  alpha = gsl_vector_get(v, p->alpha_offset+i*p->num_factors+t);
-	  k12 = gsl_vector_get(v, p->k12_offset+t);
-	  k21 = gsl_vector_get(v, p->k21_offset+t);
-	  if (fabs(k12) < EPSILON) {
-	    kernel = p->end[j]-p->start[j];
-	  } else {
-	    kernel = (exp(-k12*(p->midpt[k]-p->end[j]))-exp(-k12*(p->midpt[k]-p->start[j])))/k12;
-	  }
-	  inner += alpha*k21*kernel;
+	if (fabs(k12) < EPSILON) {
+	  kernel = p->end[j]-p->start[j];
+	} else {
+	  kernel = (exp(-k12*(p->midpt[k]-p->end[j]))-exp(-k12*(p->midpt[k]-p->start[j])))/k12;
 	}
-	ls_answer += p->weight[k]*p->forward_error[i*p->num_frames+k]*inner;
+	ls_answer += k21*kernel*factor_gradient[t*p->num_frames+k];
       }
     }
-    ls_answer *= 2;
 
     /* the non-negatvity objective */
     lambda = p->lmi_bc[j];
@@ -1803,28 +2377,15 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
       if (p->blood_curve_constraint_frame[i] == j) 
 	blood_answer += p->ec_bc[i]/p->mu - p->lme_bc[i];
 
-    gsl_vector_set(df, p->bc_offset+j, ls_answer+neg_answer+blood_answer);
+    gradient[p->bc_offset+j] = ls_answer+neg_answer+blood_answer;
   }
 
 
-  /* partial derivative of f wrt to the alpha's */
+  /* partial derivative of f wrt to the alpha's, the least squares part is already in place */
   for (i=0; i<p->num_voxels; i++) {
     for (f=0; f< p->num_factors; f++) {
       alpha = gsl_vector_get(v, p->alpha_offset+i*p->num_factors+f);
 
-      ls_answer = 0;
-      for (j=0; j< p->num_frames; j++) {
-	if (f < p->num_tissues) {
-	  k21 = gsl_vector_get(v, p->k21_offset+f);
-	  inner = k21*p->tc_unscaled[j*p->num_tissues+f];
-	} else {
-	  bc = gsl_vector_get(v, p->bc_offset+j);
-	  inner = bc;
-	}
-	ls_answer += p->weight[j]*p->forward_error[i*p->num_frames+j]*inner;
-      }
-      ls_answer *=2;
-
       /* the non-negatvity and <= 1 objective */
       lambda = p->lmi_a[i*p->num_factors+f];
       if ((alpha - p->mu*lambda) < 0.0)
@@ -1837,7 +2398,7 @@ static void two_comp_calc_derivative(two_comp_params_t * p, const gsl_vector *v,
 	neg_answer += p->ec_a[i]/p->mu - p->lme_a[i];
       }
 
-      gsl_vector_set(df, p->alpha_offset+i*p->num_factors+f, ls_answer + neg_answer);
+      gradient[p->alpha_offset+i*p->num_factors+f] += neg_answer;
     }
   }
 
@@ -1928,6 +2489,7 @@ void fads_two_comp(AmitkDataSet * data_set,
 		   gint num_blood_curve_constraints,
 		   gint * blood_curve_constraint_frame,
 		   gdouble * blood_curve_constraint_val,
+		   GList ** pnew_data_sets,
 		   AmitkUpdateFunc update_func,
 		   gpointer update_data) {
 
@@ -1953,6 +2515,9 @@ void fads_two_comp(AmitkDataSet * data_set,
   gdouble init_value, alpha;
   AmitkViewMode i_view_mode;
   GTimer * timer=NULL;
+  GTimer * iteration_timer=NULL;
+  GArray * iteration_times=NULL;
+  gdouble iteration_time;
   gboolean new_outer;
 #if AMIDE_DEBUG
   div_t x;
@@ -1980,7 +2545,10 @@ void fads_two_comp(AmitkDataSet * data_set,
   p.alpha_offset = p.bc_offset+p.num_frames;
   p.num_variables = p.alpha_offset + p.num_factors*p.num_voxels;
   p.tc_unscaled = NULL;
-  p.forward_error = NULL;
+  p.factors = NULL;
+  p.factor_gradient = NULL;
+  p.packed = NULL;
+  p.weight = NULL;
   p.start = NULL;
   p.end = NULL;
   p.ec_a = NULL;
@@ -2008,9 +2576,10 @@ void fads_two_comp(AmitkDataSet * data_set,
     goto ending;
   }
 
-  p.forward_error = g_try_new(gdouble, p.num_frames*p.num_voxels);
-  if (p.forward_error == NULL) {
-    g_warning(_("failed to allocate intermediate data storage for forward error"));
+  p.factors = g_try_new(gdouble, p.num_factors*p.num_frames);
+  p.factor_gradient = g_try_new(gdouble, p.num_factors*p.num_frames);
+  if ((p.factors == NULL) || (p.factor_gradient == NULL)) {
+    g_warning(_("failed to allocate intermediate data storage for factors"));
     goto ending;
   }
   
@@ -2104,10 +2673,17 @@ void fads_two_comp(AmitkDataSet * data_set,
 
   
 
-  /* calculate the weights and magnitude */
+  /* calculate the weights */
   p.weight = calc_weights(p.data_set);
-  g_return_if_fail(p.weight != NULL); /* make sure we've malloc'd it */
-  magnitude = calc_magnitude(p.data_set, p.weight);
+  if (p.weight == NULL) {
+    g_warning(_("failed weight malloc"));
+    goto ending;
+  }
+
+  /* pack the data, and calculate the magnitude */
+  p.packed = packed_data_new(p.data_set, p.weight, p.num_factors);
+  if (p.packed == NULL) goto ending;
+  magnitude = packed_data_magnitude(p.packed);
 
   
   /* set up gsl */
@@ -2168,6 +2744,9 @@ void fads_two_comp(AmitkDataSet * data_set,
     timer = g_timer_new();
 #endif
 
+  iteration_timer = g_timer_new();
+  iteration_times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
   do { /* outer loop */
     outer_iter++;
     new_outer=TRUE;
@@ -2179,7 +2758,10 @@ void fads_two_comp(AmitkDataSet * data_set,
     do { /* inner loop */
       inner_iter++;
 
+      g_timer_start(iteration_timer);
       status = gsl_multimin_fdfminimizer_iterate (multimin_minimizer);
+      iteration_time = g_timer_elapsed(iteration_timer, NULL);
+      g_array_append_val(iteration_times, iteration_time);
 
       if (!status) 
       	status = gsl_multimin_test_gradient (multimin_minimizer->gradient, stopping_criteria);
@@ -2313,7 +2895,7 @@ void fads_two_comp(AmitkDataSet * data_set,
     continue_work = (*update_func)(update_data, NULL, (gdouble) 2.0); 
 
 
-  /* add the different coefficients to the tree */
+  /* make data sets of the different coefficients */
   dim.t = 1;
   i_voxel.t = 0;
   for (f=0; f < p.num_factors; f++) {
@@ -2351,8 +2933,7 @@ void fads_two_comp(AmitkDataSet * data_set,
     amitk_data_set_set_threshold_max(new_ds, 0, amitk_data_set_get_global_max(new_ds));
     amitk_data_set_set_threshold_min(new_ds, 0, amitk_data_set_get_global_min(new_ds));
     amitk_data_set_set_interpolation(new_ds, AMITK_DATA_SET_INTERPOLATION(p.data_set));
-    amitk_object_add_child(AMITK_OBJECT(p.data_set), AMITK_OBJECT(new_ds));
-    amitk_object_unref(new_ds); /* add_child adds a reference */
+    *pnew_data_sets = g_list_append(*pnew_data_sets, new_ds);
   }
 
 
@@ -2363,6 +2944,7 @@ void fads_two_comp(AmitkDataSet * data_set,
   }
 
   write_header(file_pointer, status, FADS_TYPE_TWO_COMPARTMENT, data_set, inner_iter);
+  write_iteration_times(file_pointer, iteration_times);
 
   fprintf(file_pointer, "# frame\tduration (s)\ttime midpt (s)\tblood curve");
   for (t=0; t<p.num_tissues; t++)
@@ -2416,9 +2998,19 @@ void fads_two_comp(AmitkDataSet * data_set,
     p.weight = NULL;
   }
 
-  if (p.forward_error != NULL) {
-    g_free(p.forward_error);
-    p.forward_error = NULL;
+  if (p.packed != NULL) {
+    packed_data_free(p.packed);
+    p.packed = NULL;
+  }
+
+  if (p.factors != NULL) {
+    g_free(p.factors);
+    p.factors = NULL;
+  }
+
+  if (p.factor_gradient != NULL) {
+    g_free(p.factor_gradient);
+    p.factor_gradient = NULL;
   }
 
   if (p.tc_unscaled != NULL) {
@@ -2486,6 +3078,16 @@ void fads_two_comp(AmitkDataSet * data_set,
     timer = NULL;
   }
 
+  if (iteration_timer != NULL) {
+    g_timer_destroy(iteration_timer);
+    iteration_timer = NULL;
+  }
+
+  if (iteration_times != NULL) {
+    g_array_free(iteration_times, TRUE);
+    iteration_times = NULL;
+  }
+
 };
 
  
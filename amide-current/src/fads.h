@@ -46,18 +46,30 @@ typedef enum {
   NUM_FADS_MINIMIZERS
 } fads_minimizer_algorithm_t;
 
+typedef enum {
+  FADS_SVD_FULL,
+  FADS_SVD_GRAM,
+  FADS_SVD_RANDOMIZED,
+  NUM_FADS_SVD_METHODS
+} fads_svd_method_t;
 
 extern gchar * fads_minimizer_algorithm_name[];
+extern gchar * fads_svd_method_name[];
 extern gchar * fads_type_name[];
 extern gchar * fads_type_explanation[];
 extern const guint8 * fads_type_icon[];
 
 void fads_svd_factors(AmitkDataSet * data_set, 
+		      fads_svd_method_t method,
 		      gint * pnum_factors,
 		      gdouble ** pfactors);
+/* these can run outside the main loop, so the factor/component data sets
+   are appended to *pnew_data_sets for the caller to add to the tree */
 void fads_pca(AmitkDataSet * data_set, 
 	      gint num_factors,
+	      fads_svd_method_t method,
 	      gchar * output_filename,
+	      GList ** pnew_data_sets,
 	      AmitkUpdateFunc update_func,
 	      gpointer update_data);
 void fads_pls(AmitkDataSet * data_set, 
@@ -72,6 +84,7 @@ void fads_pls(AmitkDataSet * data_set,
 	      gint * blood_curve_constraint_frame,
 	      gdouble * blood_curve_constraint_val,
 	      GArray * initial_curves,
+	      GList ** pnew_data_sets,
 	      AmitkUpdateFunc update_func,
 	      gpointer update_data);
 void fads_two_comp(AmitkDataSet * data_set, 
@@ -86,6 +99,7 @@ void fads_two_comp(AmitkDataSet * data_set,
 		   gint num_blood_curve_constraints,
 		   gint * blood_curve_constraint_frame,
 		   gdouble * blood_curve_constraint_val,
+		   GList ** pnew_data_sets,
 		   AmitkUpdateFunc update_func,
 		   gpointer update_data);
 
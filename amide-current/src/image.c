@@ -425,8 +425,9 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
 }
 #endif
 
-/* function to make the bar graph to put next to the color_strip image */
-GdkPixbuf * image_of_distribution(AmitkDataSet * ds, rgb_t fg,
+/* function to make the bar graph to put next to the color_strip image,
+   frame < 0 gives the distribution of the whole data set */
+GdkPixbuf * image_of_distribution(AmitkDataSet * ds, const gint frame, rgb_t fg,
 				  AmitkUpdateFunc update_func,
 				  gpointer update_data) {
 
@@ -437,14 +438,21 @@ GdkPixbuf * image_of_distribution(AmitkDataSet * ds, rgb_t fg,
   amide_data_t max, scale;
   AmitkRawData * distribution;
   gint dim_x;
+  amide_intpoint_t distribution_frame;
 
   /* make sure we have a distribution calculated */
-  amitk_data_set_calc_distribution(ds, update_func, update_data);
-  distribution = AMITK_DATA_SET_DISTRIBUTION(ds);
+  if (frame < 0) {
+    amitk_data_set_calc_distribution(ds, update_func, update_data);
+    distribution = AMITK_DATA_SET_DISTRIBUTION(ds);
+  } else {
+    distribution = amitk_data_set_get_frame_distributions(ds, update_func, update_data);
+  }
   if(distribution==NULL) {
     dim_x = AMITK_DATA_SET_DISTRIBUTION_SIZE;
+    distribution_frame = 0;
   } else {
     dim_x = AMITK_RAW_DATA_DIM_X(distribution);
+    distribution_frame = CLAMP(frame, 0, AMITK_RAW_DATA_DIM_T(distribution)-1);
   }
 
   if ((rgba_data = g_try_new(guchar,4*IMAGE_DISTRIBUTION_WIDTH*dim_x)) == NULL) {
@@ -464,7 +472,8 @@ GdkPixbuf * image_of_distribution(AmitkDataSet * ds, rgb_t fg,
   } else {
     /* figure out the max of the distribution, so we can normalize the distribution to the width */
     max = 0.0;
-    j.t = j.g = j.z = j.y = 0;
+    j.g = j.z = j.y = 0;
+    j.t = distribution_frame;
     for (j.x = 0; j.x < dim_x ; j.x++) 
     if (*AMITK_RAW_DATA_DOUBLE_POINTER(distribution,j) > max)
       max = *AMITK_RAW_DATA_DOUBLE_POINTER(distribution,j);
@@ -474,7 +483,8 @@ GdkPixbuf * image_of_distribution(AmitkDataSet * ds, rgb_t fg,
       scale = 0;
     
     /* figure out what the rgb data is */
-    j.t = j.g = j.z = j.y = 0;
+    j.g = j.z = j.y = 0;
+    j.t = distribution_frame;
     for (l=0 ; l < dim_x ; l++) {
       j.x = dim_x-l-1;
       for (k=0; k < floor(((gdouble) IMAGE_DISTRIBUTION_WIDTH)-
@@ -667,8 +677,7 @@ GdkPixbuf * image_from_slice(AmitkDataSet * slice, AmitkViewMode view_mode) {
 /* note, generally call this function with gate -1, only use the gate
    parameter if you want to override the data set's specified gate */
 GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
-				 GList ** pslice_cache,
-				 const gint max_slice_cache_size,
+				 AmitkSliceCache * slice_cache,
 				 GList * objects,
 				 const AmitkDataSet * active_ds,
 				 const amide_time_t start,
@@ -683,6 +692,9 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
   guint32 total_alpha;
   guchar * rgb_data;
   rgba16_t * rgba16_data;
+  rgba16_t * rgba16_temp;
+  const color_table_lut_t * lut;
+  guint32 weight16, weight, divisor;
   guint location;
   AmitkVoxel i;
   AmitkVoxel dim;
@@ -692,9 +704,7 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
   GList * slices;
   GList * temp_slices;
   AmitkDataSet * slice;
-  AmitkColorTable color_table;
   AmitkDataSet * overlay_slice = NULL;
-  gint j;
   AmitkCanvasPoint pixel_size2;
   
 
@@ -702,7 +712,7 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
   g_return_val_if_fail(objects != NULL, NULL);
 
   pixel_size2.x = pixel_size2.y = pixel_size;
-  slices = amitk_data_sets_get_slices(objects, pslice_cache, max_slice_cache_size,
+  slices = amitk_data_sets_get_slices(objects, slice_cache,
 				      start, duration, gate, pixel_size2,view_volume);
   g_return_val_if_fail(slices != NULL, NULL);
 
@@ -710,16 +720,9 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
   dim = AMITK_DATA_SET_DIM(slices->data);
 
   /* allocate and initialize space for a temporary storage buffer */
-  rgba16_data = g_try_new(rgba16_t,dim.y*dim.x);
+  rgba16_data = g_try_new0(rgba16_t,dim.y*dim.x);
   g_return_val_if_fail(rgba16_data != NULL, NULL);
 
-  for (j=0; j<dim.y*dim.x; j++) {
-    rgba16_data[j].r = 0;
-    rgba16_data[j].g = 0;
-    rgba16_data[j].b = 0;
-    rgba16_data[j].a = 0;
-  }
-
   /* iterate through all the slices */
   temp_slices = slices;
   slice_num = 0;
@@ -735,63 +738,69 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
 					      AMITK_DATA_SET(slice),
 					      start, duration, &min, &max);
       
-      
-      color_table = amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(slice), view_mode);
-      /* now add this slice into the rgba16 data */
+      /* the lookup table is kept on the data set, so it's only rebuilt when
+	 the color table or thresholds change */
+      lut = amitk_data_set_get_color_table_lut(AMITK_DATA_SET_SLICE_PARENT(slice), view_mode, min, max);
+      if (lut == NULL) {
+	g_free(rgba16_data);
+	amitk_objects_unref(slices);
+	return NULL;
+      }
+
       i.t = i.g = i.z = 0;
       location=0;
-      /* compensate for the fact that X defines the origin as top left, not bottom left */
-      for (i.y = dim.y-1; i.y >= 0; i.y--) 
-	for (i.x = 0; i.x < dim.x; i.x++, location++) {
-	  rgba_temp = 
-	    amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i), color_table,min, max);
-	  
-	  total_alpha = rgba16_data[location].a + rgba_temp.a;
-	  if (total_alpha == 0) {
-	    rgba16_data[location].r = (((slice_num-1)*rgba16_data[location].r + 
-					rgba_temp.r)/
-				       ((gdouble) slice_num));
-	    rgba16_data[location].g = (((slice_num-1)*rgba16_data[location].g + 
-					rgba_temp.g)/
-				       ((gdouble) slice_num));
-	    rgba16_data[location].b = (((slice_num-1)*rgba16_data[location].b + 
-					rgba_temp.b)/
-				       ((gdouble) slice_num));
-	  } else if (rgba16_data[location].a == 0) {
+      if (slice_num == 1) { 
+	/* nothing to blend with yet, what's in rgba16_data is all zero */
+	for (i.y = dim.y-1; i.y >= 0; i.y--) 
+	  for (i.x = 0; i.x < dim.x; i.x++, location++) {
+	    rgba_temp = 
+	      amitk_color_table_lut_lookup(lut, AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i));
 	    rgba16_data[location].r = rgba_temp.r;
 	    rgba16_data[location].g = rgba_temp.g;
 	    rgba16_data[location].b = rgba_temp.b;
 	    rgba16_data[location].a = rgba_temp.a;
-	  } else if (rgba_temp.a != 0) {
-	    rgba16_data[location].r = ((rgba16_data[location].r*rgba16_data[location].a 
-					+ rgba_temp.r*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].g = ((rgba16_data[location].g*rgba16_data[location].a 
-					+ rgba_temp.g*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].b = ((rgba16_data[location].b*rgba16_data[location].a 
-					+ rgba_temp.b*rgba_temp.a)/
-				       ((gdouble) total_alpha));
-	    rgba16_data[location].a = total_alpha;
 	  }
-	}
+      } else {
+	/* now add this slice into the rgba16 data, weighting by alpha, or averaging
+	   if both are transparent.  When only one side has any alpha, this just 
+	   keeps that side's color.  Integer division gives the same result as the
+	   truncated floating point division would */
+	/* compensate for the fact that X defines the origin as top left, not bottom left */
+	for (i.y = dim.y-1; i.y >= 0; i.y--) 
+	  for (i.x = 0; i.x < dim.x; i.x++, location++) {
+	    rgba_temp = 
+	      amitk_color_table_lut_lookup(lut, AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice,i));
+	    rgba16_temp = rgba16_data+location;
+	    
+	    total_alpha = rgba16_temp->a + rgba_temp.a;
+	    weight16 = (total_alpha == 0) ? slice_num-1 : rgba16_temp->a;
+	    weight = (total_alpha == 0) ? 1 : rgba_temp.a;
+	    divisor = (total_alpha == 0) ? slice_num : total_alpha;
+	    rgba16_temp->r = (weight16*rgba16_temp->r + weight*rgba_temp.r)/divisor;
+	    rgba16_temp->g = (weight16*rgba16_temp->g + weight*rgba_temp.g)/divisor;
+	    rgba16_temp->b = (weight16*rgba16_temp->b + weight*rgba_temp.b)/divisor;
+	    rgba16_temp->a = total_alpha;
+	  }
+      }
     }
     temp_slices = temp_slices->next;
   }
 
   /* allocate space for the true rgb buffer */
   rgb_data = g_try_new(guchar,3*dim.y*dim.x);
-  g_return_val_if_fail(rgb_data != NULL, NULL);
+  if (rgb_data == NULL) {
+    g_free(rgba16_data);
+    amitk_objects_unref(slices);
+    g_return_val_if_fail(rgb_data != NULL, NULL);
+  }
 
-  /* now convert our temp rgb data to real rgb data */
-  i.z = 0;
-  location=0;
-  for (i.y = 0; i.y < dim.y; i.y++) 
-    for (i.x = 0; i.x < dim.x; i.x++, location++) {
-      rgb_data[3*location+0] = rgba16_data[location].r < 0xFF ? rgba16_data[location].r : 0xFF;
-      rgb_data[3*location+1] = rgba16_data[location].g < 0xFF ? rgba16_data[location].g : 0xFF;
-      rgb_data[3*location+2] = rgba16_data[location].b < 0xFF ? rgba16_data[location].b : 0xFF;
-    }
+  /* now convert our temp rgb data to real rgb data, kept as a simple
+     loop without branches so the compiler can vectorize it */
+  for (location=0; location < dim.y*dim.x; location++) {
+    rgb_data[3*location+0] = MIN(rgba16_data[location].r, 0xFF);
+    rgb_data[3*location+1] = MIN(rgba16_data[location].g, 0xFF);
+    rgb_data[3*location+2] = MIN(rgba16_data[location].b, 0xFF);
+  }
 
   /* if we have a data set we're overlaying, add it in now */
   if (overlay_slice != NULL) {
@@ -799,23 +808,24 @@ GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
 					      AMITK_DATA_SET(overlay_slice),
 					      start, duration, &min, &max);
       
-      color_table = amitk_data_set_get_color_table_to_use(AMITK_DATA_SET_SLICE_PARENT(overlay_slice), view_mode);
+      lut = amitk_data_set_get_color_table_lut(AMITK_DATA_SET_SLICE_PARENT(overlay_slice), 
+						 view_mode, min, max);
 
       i.t = i.g = i.z = 0;
-      for (i.y = 0; i.y < dim.y; i.y++) 
-	for (i.x = 0; i.x < dim.x; i.x++) {
-	  rgba_temp = 
-	    amitk_color_table_lookup(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(overlay_slice,i), 
-				     color_table,min, max);
-
-	  /* compensate for the fact that X defines the origin as top left, not bottom left */
-	  location = (dim.y - i.y - 1)*dim.x+i.x;
-	  if (rgba_temp.a != 0) {
-	    rgb_data[3*location+0] = rgba_temp.r;
-	    rgb_data[3*location+1] = rgba_temp.g;
-	    rgb_data[3*location+2] = rgba_temp.b;
+      if (lut != NULL) /* out of memory, leave the overlay off */
+	for (i.y = 0; i.y < dim.y; i.y++) 
+	  for (i.x = 0; i.x < dim.x; i.x++) {
+	    rgba_temp = 
+	      amitk_color_table_lut_lookup(lut, AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(overlay_slice,i));
+	    
+	    /* compensate for the fact that X defines the origin as top left, not bottom left */
+	    location = (dim.y - i.y - 1)*dim.x+i.x;
+	    if (rgba_temp.a != 0) {
+	      rgb_data[3*location+0] = rgba_temp.r;
+	      rgb_data[3*location+1] = rgba_temp.g;
+	      rgb_data[3*location+2] = rgba_temp.b;
+	    }
 	  }
-	}
   }
   
 
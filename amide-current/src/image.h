@@ -62,7 +62,7 @@ GdkPixbuf * image_from_renderings(renderings_t * renderings,
 				  gdouble eye_angle, 
 				  gint16 eye_width);
 #endif
-GdkPixbuf * image_of_distribution(AmitkDataSet * ds, rgb_t fg,
+GdkPixbuf * image_of_distribution(AmitkDataSet * ds, const gint frame, rgb_t fg,
 				  AmitkUpdateFunc update_func,
 				  gpointer update_data);
 GdkPixbuf * image_from_colortable(const AmitkColorTable color_table,
@@ -77,8 +77,7 @@ GdkPixbuf * image_from_projection(AmitkDataSet * projection);
 GdkPixbuf * image_from_slice(AmitkDataSet * slice,
 			     AmitkViewMode view_mode);
 GdkPixbuf * image_from_data_sets(GList ** pdisp_slices,
-				 GList ** pslice_cache,
-				 const gint max_slice_cache_size,
+				 AmitkSliceCache * slice_cache,
 				 GList * objects,
 				 const AmitkDataSet * active_ds,
 				 const amide_time_t start,
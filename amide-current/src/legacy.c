@@ -495,6 +495,7 @@ AmitkRoi * roi_load_xml(gchar * roi_xml_filename, gchar **perror_buf) {
   AmitkRoiType i_roi_type;
   gchar * temp_string;
   gchar * isocontour_xml_filename;
+  AmitkRawData * map = NULL;
   AmitkSpace * space;
 
 
@@ -544,14 +545,18 @@ AmitkRoi * roi_load_xml(gchar * roi_xml_filename, gchar **perror_buf) {
 
     isocontour_xml_filename = xml_get_string(nodes, "isocontour_file");
     if (isocontour_xml_filename != NULL)
-      new_roi->map_data = data_set_load_xml(isocontour_xml_filename, perror_buf);
+      map = data_set_load_xml(isocontour_xml_filename, perror_buf);
+    if (map != NULL) {
+      amitk_roi_set_map_runs(new_roi, amitk_roi_runs_new(map, zero_voxel, AMITK_RAW_DATA_DIM(map)));
+      g_object_unref(map);
+    }
   }
 
   /* children were never used */
 
   /* make sure to mark the roi as undrawn if needed */
   if (AMITK_ROI_TYPE_ISOCONTOUR(new_roi)) {
-    if (new_roi->map_data == NULL) 
+    if (new_roi->map_runs == NULL) 
       AMITK_VOLUME(new_roi)->valid = FALSE;
   } else {
     if (POINT_EQUAL(AMITK_VOLUME_CORNER(new_roi), zero_point)) {
@@ -1145,8 +1145,10 @@ gboolean libmdc_export(AmitkDataSet * ds,
 	}
 	
 	if (resliced) {
+	  amitk_data_set_read_lock(ds);
 	  slice = amitk_data_set_get_slice(ds, frame_start, frame_duration, i.g,
 					   pixel_size, output_volume);
+	  amitk_data_set_read_unlock(ds);
 
 	  if ((AMITK_DATA_SET_DIM_X(slice) != dim.x) || (AMITK_DATA_SET_DIM_Y(slice) != dim.y)) {
 	    g_warning(_("Error in generating resliced data, %dx%d != %dx%d"),
@@ -466,8 +466,12 @@ gboolean rendering_load_object(rendering_t * rendering,
     AmitkVoxel start, end;
     AmitkCorners intersection_corners;
     AmitkPoint voxel_size;
+    AmitkRoiRuns * runs;
+    AmitkRoiRunsCursor cursor;
 
     voxel_size.x = voxel_size.y = voxel_size.z = rendering->voxel_size;
+    runs = amitk_roi_get_runs(AMITK_ROI(rendering->object)); /* NULL unless it's a drawn map roi */
+    AMITK_ROI_RUNS_CURSOR_RESET(cursor);
     
     radius = point_cmult(0.5, AMITK_VOLUME_CORNER(rendering->object));
     center = amitk_space_b2s(AMITK_SPACE(rendering->object),
@@ -510,14 +514,11 @@ gboolean rendering_load_object(rendering_t * rendering,
 	  case AMITK_ROI_TYPE_FREEHAND_2D:
 	  case AMITK_ROI_TYPE_FREEHAND_3D:
 	    POINT_TO_VOXEL(temp_point, AMITK_ROI(rendering->object)->voxel_size, 0, 0, j_voxel);
-	    if (amitk_raw_data_includes_voxel(AMITK_ROI(rendering->object)->map_data, j_voxel)) {
-	      temp_int = *AMITK_RAW_DATA_UBYTE_POINTER(AMITK_ROI(rendering->object)->map_data, j_voxel);
-	      if (temp_int == 2)
-		temp_int = RENDERING_DENSITY_MAX;
-	      else if (temp_int == 1)
-		temp_int = RENDERING_DENSITY_MAX/2.0;
-	    } else
-	      temp_int = 0;
+	    temp_int = (runs != NULL) ? amitk_roi_runs_get_value(runs, j_voxel, &cursor) : 0;
+	    if (temp_int == 2)
+	      temp_int = RENDERING_DENSITY_MAX;
+	    else if (temp_int == 1)
+	      temp_int = RENDERING_DENSITY_MAX/2.0;
 	    break;
 	  case AMITK_ROI_TYPE_ELLIPSOID:
 	    if (point_in_ellipsoid(temp_point, center, radius)) 
@@ -547,6 +548,7 @@ gboolean rendering_load_object(rendering_t * rendering,
 	}
     }
 
+    amitk_roi_runs_unref(runs);
 
 
   } else { /* DATA SET */
@@ -582,12 +584,14 @@ gboolean rendering_load_object(rendering_t * rendering,
       }
       
       pixel_size.x = pixel_size.y = rendering->voxel_size;
+      amitk_data_set_read_lock(AMITK_DATA_SET(rendering->object));
       slice = amitk_data_set_get_slice(AMITK_DATA_SET(rendering->object), 
 				       rendering->start, 
 				       rendering->duration, 
 				       -1,
 				       pixel_size,
 				       slice_volume);
+      amitk_data_set_read_unlock(AMITK_DATA_SET(rendering->object));
 
       if (!unmatched_dimensions && 
 	  ((rendering->dim.x != AMITK_DATA_SET_DIM_X(slice)) || 
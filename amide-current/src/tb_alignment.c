@@ -116,6 +116,7 @@ typedef struct tb_alignment_t {
   AmitkDataSet * moving_ds;
   AmitkDataSet * fixed_ds;
   which_alignment_t alignment_type;
+  gboolean partial_volume; /* for mutual information */
   GList * selected_marks;
   AmitkSpace * transform_space; /* the new coordinate space for the moving volume */
   amide_time_t view_start_time;
@@ -137,6 +138,7 @@ static void close_cb(GtkAssistant * assistant, gpointer data);
 static void data_sets_update_model(tb_alignment_t * alignment);
 static void points_update_model(tb_alignment_t * alignment);
 static void alignment_type_changed_cb(GtkRadioButton * clicked_button, gpointer data );
+static void partial_volume_cb(GtkWidget * widget, gpointer data);
 static void data_set_selection_changed_cb(GtkTreeSelection * selection, gpointer data);
 static gboolean points_button_press_event(GtkWidget * list, GdkEventButton * event, gpointer data);
 
@@ -219,6 +221,7 @@ static tb_alignment_t * tb_alignment_init(void) {
   tb_alignment->moving_ds = NULL;
   tb_alignment->fixed_ds = NULL;
   tb_alignment->alignment_type = 0; /* PROCRUSTES if with GSL support */
+  tb_alignment->partial_volume = FALSE;
   tb_alignment->selected_marks = NULL;
   tb_alignment->transform_space = NULL;
 
@@ -359,6 +362,15 @@ static void alignment_type_changed_cb(GtkRadioButton * rb, gpointer data ) {
   return;
 }
 
+static void partial_volume_cb(GtkWidget * widget, gpointer data) {
+
+  tb_alignment_t * tb_alignment = data;
+
+  tb_alignment->partial_volume = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+
+  return;
+}
+
 static void data_set_selection_changed_cb(GtkTreeSelection * selection, gpointer data) {
 
   tb_alignment_t * tb_alignment = data;
@@ -457,6 +469,7 @@ static gboolean points_button_press_event(GtkWidget * list, GdkEventButton * eve
 static GtkWidget * create_alignment_type_page(tb_alignment_t * tb_alignment) {
   GtkWidget * vbox;
   GtkWidget * rb[NUM_ALIGNMENT_TYPES];
+  GtkWidget * check_button;
   which_alignment_t i_alignment;
 
   vbox = gtk_vbox_new (TRUE, 2);
@@ -475,6 +488,11 @@ static GtkWidget * create_alignment_type_page(tb_alignment_t * tb_alignment) {
   for (i_alignment = 0; i_alignment < NUM_ALIGNMENT_TYPES; i_alignment ++) {
     g_signal_connect(G_OBJECT(rb[i_alignment]), "clicked", G_CALLBACK(alignment_type_changed_cb), tb_alignment);
   }
+
+  check_button = gtk_check_button_new_with_label(_("Use partial volume interpolation for mutual information"));
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check_button), tb_alignment->partial_volume);
+  g_signal_connect(G_OBJECT(check_button), "toggled", G_CALLBACK(partial_volume_cb), tb_alignment);
+  gtk_box_pack_start (GTK_BOX (vbox), check_button, TRUE, TRUE, 2);
   
   return vbox;
 }
@@ -642,11 +660,15 @@ static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer da
 								   tb_alignment->view_thickness,
 								   tb_alignment->view_start_time,
 								   tb_alignment->view_duration,
+								   tb_alignment->partial_volume,
 								   &performance_metric,
       								   amitk_progress_dialog_update,
       								   tb_alignment->progress_dialog);
-      temp_string = g_strdup_printf(_("The alignment has been calculated, press Apply, or Cancel to quit.\n\nThe calculated mutual information metric is:\n\t %5.2f"),
-				    performance_metric);
+      if (tb_alignment->transform_space == NULL)
+	temp_string = g_strdup(_("The alignment could not be calculated, press Cancel to quit."));
+      else
+	temp_string = g_strdup_printf(_("The alignment has been calculated, press Apply, or Cancel to quit.\n\nThe calculated mutual information metric is:\n\t %5.2f"),
+				      performance_metric);
       break;
     default:
       g_return_if_reached();
@@ -654,7 +676,8 @@ static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer da
     }
     gtk_label_set_text(GTK_LABEL(page), temp_string);
     g_free(temp_string);
-    gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_alignment->dialog), page, TRUE);
+    gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_alignment->dialog), page, 
+				    tb_alignment->transform_space != NULL);
     break;
   case NO_FIDUCIAL_MARKS_PAGE:
   default:
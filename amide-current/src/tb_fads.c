@@ -47,7 +47,11 @@ N_("This page allows the computation of the singular value decomposition "
    "how many important factors the data set has."
    "\n\n"
    "This process can be extremely slow, so skip this page if you already "
-   "know the answer.");
+   "know the answer.  The Gram matrix and randomized methods are much "
+   "faster on large data sets, but are less accurate for the smallest "
+   "singular values.  The randomized method only computes the largest "
+   "singular values.  The chosen method is also used for principle "
+   "component analysis.");
 
 static const char * finish_page_text = 
 N_("When the apply button is hit, the appropriate factor analysis data "
@@ -103,10 +107,10 @@ typedef struct tb_fads_t {
   gdouble k32;
   fads_type_t fads_type;
   fads_minimizer_algorithm_t algorithm;
+  fads_svd_method_t svd_method;
   GArray * initial_curves; 
 
   GtkWidget * page[NUM_PAGES];
-  GtkWidget * progress_dialog;
   GtkWidget * algorithm_menu;
   GtkWidget * num_factors_spin;
   GtkWidget * num_iterations_spin;
@@ -128,6 +132,27 @@ typedef struct tb_fads_t {
   guint reference_count;
 } tb_fads_t;
 
+/* everything the analysis needs, as it carries on after the wizard's closed */
+typedef struct fads_job_t {
+  AmitkDataSet * data_set;
+  fads_type_t fads_type;
+  fads_minimizer_algorithm_t algorithm;
+  fads_svd_method_t svd_method;
+  gint num_factors;
+  gint max_iterations;
+  gdouble stopping_criteria;
+  gboolean sum_factors_equal_one;
+  gdouble beta;
+  gdouble k12;
+  gdouble k21;
+  GArray * initial_curves; 
+  gchar * output_filename;
+  gint num_blood;
+  gint * blood_frames;
+  amide_data_t * blood_vals;
+  GtkWidget * progress_dialog;
+} fads_job_t;
+
 
 
 static void set_text(tb_fads_t * tb_fads);
@@ -136,6 +161,7 @@ static gchar * get_filename(tb_fads_t * tb_fads);
 
 static void fads_type_cb(GtkWidget * widget, gpointer data);
 static void algorithm_cb(GtkWidget * widget, gpointer data);
+static void svd_method_cb(GtkWidget * widget, gpointer data);
 static void svd_pressed_cb(GtkButton * button, gpointer data);
 static void blood_cell_edited(GtkCellRendererText *cellrenderertext,
 			      gchar *arg1, gchar *arg2,gpointer data);
@@ -152,6 +178,10 @@ static void beta_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 static void k12_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 static void k21_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 
+static gpointer fads_job_run(AmitkJob * job, gpointer data);
+static void fads_job_progress(AmitkJob * job, const gchar * message, const gdouble fraction, gpointer data);
+static void fads_job_done(AmitkJob * job, gpointer result, gpointer data);
+static void fads_job_free(gpointer data);
 static void apply_cb(GtkAssistant * assistant, gpointer data);
 static void close_cb(GtkAssistant * assistant, gpointer data);
 
@@ -288,7 +318,7 @@ static void svd_pressed_cb(GtkButton * button, gpointer data) {
 
   /* calculate factors */
   ui_common_place_cursor(UI_CURSOR_WAIT, tb_fads->page[PARAMETERS_PAGE]);
-  fads_svd_factors(tb_fads->data_set, &num_factors, &factors);
+  fads_svd_factors(tb_fads->data_set, tb_fads->svd_method, &num_factors, &factors);
   ui_common_remove_wait_cursor(tb_fads->page[PARAMETERS_PAGE]);
 
   for (i=0; i<num_factors; i++) {
@@ -494,6 +524,12 @@ static void algorithm_cb(GtkWidget * widget, gpointer data) {
   return;
 }
 
+static void svd_method_cb(GtkWidget * widget, gpointer data) {
+  tb_fads_t * tb_fads = data;
+  tb_fads->svd_method = gtk_combo_box_get_active(GTK_COMBO_BOX(widget));
+  return;
+}
+
 static void num_factors_spinner_cb(GtkSpinButton * spin_button, gpointer data) {
   tb_fads_t * tb_fads = data;
   tb_fads->num_factors = gtk_spin_button_get_value_as_int(spin_button);
@@ -537,10 +573,93 @@ static void k21_spinner_cb(GtkSpinButton * spin_button, gpointer data) {
   return;
 }
 
+/* does the analysis, runs in a worker thread.  The data set's read lock
+   keeps it from being changed underneath us */
+static gpointer fads_job_run(AmitkJob * job, gpointer data) {
+
+  fads_job_t * fads_job = data;
+  GList * new_data_sets=NULL;
+
+  amitk_data_set_read_lock(fads_job->data_set);
+  switch(fads_job->fads_type) {
+  case FADS_TYPE_PCA:
+    fads_pca(fads_job->data_set, fads_job->num_factors, fads_job->svd_method, 
+	     fads_job->output_filename, &new_data_sets, amitk_job_update, job);
+    break;
+  case FADS_TYPE_PLS:
+    fads_pls(fads_job->data_set, fads_job->num_factors, fads_job->algorithm, 
+	     fads_job->max_iterations, fads_job->stopping_criteria, 
+	     fads_job->sum_factors_equal_one, fads_job->beta, fads_job->output_filename, 
+	     fads_job->num_blood, fads_job->blood_frames, fads_job->blood_vals, 
+	     fads_job->initial_curves, &new_data_sets, amitk_job_update, job);
+    break;
+  case FADS_TYPE_TWO_COMPARTMENT:
+    fads_two_comp(fads_job->data_set, fads_job->algorithm, fads_job->max_iterations, 
+		  fads_job->num_factors-1, fads_job->k12, fads_job->k21, 
+		  fads_job->stopping_criteria, fads_job->sum_factors_equal_one,
+		  fads_job->output_filename, fads_job->num_blood, 
+		  fads_job->blood_frames, fads_job->blood_vals, 
+		  &new_data_sets, amitk_job_update, job);
+    break;
+  default:
+    g_error("fads type %d not defined", fads_job->fads_type);
+    break;
+  }
+  amitk_data_set_read_unlock(fads_job->data_set);
+
+  return new_data_sets;
+}
+
+static void fads_job_progress(AmitkJob * job, const gchar * message, 
+			      const gdouble fraction, gpointer data) {
+
+  fads_job_t * fads_job = data;
+
+  if (fads_job->progress_dialog != NULL)
+    amitk_progress_dialog_job_progress(job, message, fraction, fads_job->progress_dialog);
+
+  return;
+}
+
+/* the factor data sets go under the analyzed data set, anything that went 
+   wrong is kept with the job and shown after this returns */
+static void fads_job_done(AmitkJob * job, gpointer result, gpointer data) {
+
+  fads_job_t * fads_job = data;
+  GList * new_data_sets = result;
+  GList * temp_data_sets;
+
+  for (temp_data_sets = new_data_sets; temp_data_sets != NULL; temp_data_sets = temp_data_sets->next) 
+    amitk_object_add_child(AMITK_OBJECT(fads_job->data_set), temp_data_sets->data);
+  amitk_objects_unref(new_data_sets);
+
+  if (fads_job->progress_dialog != NULL)
+    gtk_widget_destroy(fads_job->progress_dialog);
+
+  return;
+}
+
+static void fads_job_free(gpointer data) {
+
+  fads_job_t * fads_job = data;
+
+  amitk_object_unref(fads_job->data_set);
+  if (fads_job->initial_curves != NULL)
+    g_array_free(fads_job->initial_curves, TRUE);
+  g_free(fads_job->output_filename);
+  g_free(fads_job->blood_frames);
+  g_free(fads_job->blood_vals);
+  g_free(fads_job);
+
+  return;
+}
+
 /* function called when the finish button is hit */
 static void apply_cb(GtkAssistant * assistant, gpointer data) {
 
   tb_fads_t * tb_fads = data;
+  fads_job_t * fads_job;
+  AmitkJob * job;
   gchar * output_filename;
   gint num=0;
   gint i;
@@ -562,12 +681,14 @@ static void apply_cb(GtkAssistant * assistant, gpointer data) {
   if (num > 0) {
     if ((frames = g_try_new(gint, num)) == NULL) {
       g_warning(_("failed malloc for frames array"));
+      g_free(output_filename);
       return;
     }
     
     if ((vals = g_try_new(amide_data_t, num)) == NULL) {
       g_warning(_("failed malloc for vals array"));
       g_free(frames);
+      g_free(output_filename);
       return;
     }
 
@@ -591,45 +712,35 @@ static void apply_cb(GtkAssistant * assistant, gpointer data) {
 #endif
   }
 
-  ui_common_place_cursor(UI_CURSOR_WAIT, tb_fads->page[CONCLUSION_PAGE]);
-  switch(tb_fads->fads_type) {
-  case FADS_TYPE_PCA:
-    fads_pca(tb_fads->data_set, tb_fads->num_factors, output_filename,
-	     amitk_progress_dialog_update, tb_fads->progress_dialog);
-    break;
-  case FADS_TYPE_PLS:
-    fads_pls(tb_fads->data_set, tb_fads->num_factors, tb_fads->algorithm, tb_fads->max_iterations,
-	     tb_fads->stopping_criteria, tb_fads->sum_factors_equal_one,
-	     tb_fads->beta, output_filename, num, frames, vals, tb_fads->initial_curves,
-	     amitk_progress_dialog_update, tb_fads->progress_dialog);
-    break;
-  case FADS_TYPE_TWO_COMPARTMENT:
-    fads_two_comp(tb_fads->data_set, tb_fads->algorithm, tb_fads->max_iterations, 
-		  tb_fads->num_factors-1, tb_fads->k12, tb_fads->k21, tb_fads->stopping_criteria,
-		  tb_fads->sum_factors_equal_one,
-		  output_filename, num, frames, vals, 
-		  amitk_progress_dialog_update, tb_fads->progress_dialog);
-    break;
-  default:
-    g_error("fads type %d not defined", tb_fads->fads_type);
-    break;
-  }
-  ui_common_remove_wait_cursor(tb_fads->page[CONCLUSION_PAGE]);
-
-  if (frames != NULL) {
-    g_free(frames);
-    frames = NULL;
-  }
-
-  if (vals != NULL) {
-    g_free(vals);
-    vals = NULL;
-  }
-
-  if (output_filename != NULL) {
-    g_free(output_filename);
-    output_filename = NULL;
-  }
+  fads_job = g_new0(fads_job_t, 1);
+  fads_job->data_set = amitk_object_ref(tb_fads->data_set);
+  fads_job->fads_type = tb_fads->fads_type;
+  fads_job->algorithm = tb_fads->algorithm;
+  fads_job->svd_method = tb_fads->svd_method;
+  fads_job->num_factors = tb_fads->num_factors;
+  fads_job->max_iterations = tb_fads->max_iterations;
+  fads_job->stopping_criteria = tb_fads->stopping_criteria;
+  fads_job->sum_factors_equal_one = tb_fads->sum_factors_equal_one;
+  fads_job->beta = tb_fads->beta;
+  fads_job->k12 = tb_fads->k12;
+  fads_job->k21 = tb_fads->k21;
+  fads_job->initial_curves = tb_fads->initial_curves; /* the job takes these over */
+  tb_fads->initial_curves = NULL;
+  fads_job->output_filename = output_filename;
+  fads_job->num_blood = num;
+  fads_job->blood_frames = frames;
+  fads_job->blood_vals = vals;
+
+  /* the wizard closes after this, so hang the progress dialog off the data set's window */
+  fads_job->progress_dialog = 
+    amitk_progress_dialog_new(gtk_window_get_transient_for(GTK_WINDOW(assistant)));
+  g_signal_connect(G_OBJECT(fads_job->progress_dialog), "destroy",
+		   G_CALLBACK(gtk_widget_destroyed), &(fads_job->progress_dialog));
+
+  /* do the analysis in the background */
+  job = amitk_job_submit(_(wizard_name), fads_job_run, fads_job_progress, 
+			 fads_job_done, fads_job, fads_job_free);
+  amitk_job_unref(job);
 
   return;
 }
@@ -653,8 +764,6 @@ static void close_cb(GtkAssistant * assistant, gpointer data) {
 
 static tb_fads_t * tb_fads_free(tb_fads_t * tb_fads) {
 
-  gboolean return_val;
-
   /* sanity checks */
   g_return_val_if_fail(tb_fads != NULL, NULL);
   g_return_val_if_fail(tb_fads->reference_count > 0, NULL);
@@ -683,11 +792,6 @@ static tb_fads_t * tb_fads_free(tb_fads_t * tb_fads) {
       tb_fads->preferences = NULL;
     }
 
-    if (tb_fads->progress_dialog != NULL) {
-      g_signal_emit_by_name(G_OBJECT(tb_fads->progress_dialog), "delete_event", NULL, &return_val);
-      tb_fads->progress_dialog = NULL;
-    }
-
     g_free(tb_fads);
     tb_fads = NULL;
   }
@@ -721,9 +825,9 @@ static tb_fads_t * tb_fads_init(void) {
   tb_fads->fads_type = FADS_TYPE_PCA;
   //  tb_fads->algorithm = FADS_MINIMIZER_VECTOR_BFGS;
   tb_fads->algorithm = FADS_MINIMIZER_CONJUGATE_PR;
+  tb_fads->svd_method = FADS_SVD_FULL;
   tb_fads->initial_curves = NULL;
   tb_fads->explanation_buffer = NULL;
-  tb_fads->progress_dialog = NULL;
 
   return tb_fads;
 }
@@ -811,6 +915,7 @@ static GtkWidget * create_page(tb_fads_t * tb_fads, which_page_t i_page) {
 
   fads_type_t i_fads_type;
   fads_minimizer_algorithm_t i_algorithm;
+  fads_svd_method_t i_svd_method;
   GtkWidget * label;
   GtkWidget * button;
   GtkCellRenderer *renderer;
@@ -824,6 +929,7 @@ static GtkWidget * create_page(tb_fads_t * tb_fads, which_page_t i_page) {
   GtkWidget * view;
   GtkWidget * vseparator;
   GtkWidget * hseparator;
+  GtkWidget * hbox;
   GtkTextBuffer *buffer;
 
   table = gtk_table_new(8,6,FALSE);
@@ -834,7 +940,7 @@ static GtkWidget * create_page(tb_fads_t * tb_fads, which_page_t i_page) {
     view = gtk_text_view_new ();
     buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (view));
     gtk_text_buffer_set_text (buffer, _(svd_page_text), -1);
-    gtk_table_attach(GTK_TABLE(table), view, 0,1, table_row,table_row+2,
+    gtk_table_attach(GTK_TABLE(table), view, 0,1, table_row,table_row+3,
 		     FALSE,FALSE, X_PADDING, Y_PADDING);
     gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(view), GTK_WRAP_WORD);
     gtk_text_view_set_editable(GTK_TEXT_VIEW(view), FALSE);
@@ -842,7 +948,21 @@ static GtkWidget * create_page(tb_fads_t * tb_fads, which_page_t i_page) {
     
     /* a separator for clarity */
     vseparator = gtk_vseparator_new();
-    gtk_table_attach(GTK_TABLE(table), vseparator, 1,2,table_row, table_row+2,0, GTK_FILL, X_PADDING, Y_PADDING);
+    gtk_table_attach(GTK_TABLE(table), vseparator, 1,2,table_row, table_row+3,0, GTK_FILL, X_PADDING, Y_PADDING);
+
+    /* how to compute the singular values */
+    hbox = gtk_hbox_new(FALSE, 0);
+    label = gtk_label_new(_("SVD Method:"));
+    gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, X_PADDING);
+    menu = gtk_combo_box_new_text();
+    for (i_svd_method = 0; i_svd_method < NUM_FADS_SVD_METHODS; i_svd_method++) 
+      gtk_combo_box_append_text(GTK_COMBO_BOX(menu), _(fads_svd_method_name[i_svd_method]));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(menu), tb_fads->svd_method);
+    g_signal_connect(G_OBJECT(menu), "changed", G_CALLBACK(svd_method_cb), tb_fads);
+    gtk_box_pack_start(GTK_BOX(hbox), menu, FALSE, FALSE, X_PADDING);
+    gtk_table_attach(GTK_TABLE(table), hbox, 2,3, table_row,table_row+1,
+		     FALSE,FALSE, X_PADDING, Y_PADDING);
+    table_row++;
 
     /* do I need to compute factors? */
     button = gtk_button_new_with_label(_("Compute Singular Values?"));
@@ -1161,8 +1281,6 @@ void tb_fads(AmitkDataSet * active_ds, AmitkPreferences * preferences, GtkWindow
   g_signal_connect(G_OBJECT(tb_fads->dialog), "apply", G_CALLBACK(apply_cb), tb_fads);
   g_signal_connect(G_OBJECT(tb_fads->dialog), "prepare",  G_CALLBACK(prepare_page_cb), tb_fads);
 
-  tb_fads->progress_dialog = amitk_progress_dialog_new(GTK_WINDOW(tb_fads->dialog));
-
   /* --------------- initial page ------------------ */
   tb_fads->page[INTRO_PAGE]= gtk_label_new(((AMITK_DATA_SET_NUM_FRAMES(tb_fads->data_set) > 1) ? 
 					    _(start_page_text) : _(not_enough_frames_text)));
@@ -34,7 +34,7 @@
 #define LABEL_WIDTH 375
 
 #define MIN_FIR_FILTER_SIZE 7
-#define MAX_FIR_FILTER_SIZE 31
+#define MAX_FIR_FILTER_SIZE 127
 #define MIN_NONLINEAR_FILTER_SIZE 3
 #define MAX_NONLINEAR_FILTER_SIZE 11
 #define DEFAULT_GAUSSIAN_FILTER_SIZE 15
@@ -50,10 +50,8 @@ N_("When the apply button is hit, a new data set will be created "
    "and placed into the study's tree, consisting of the appropriately "
    "filtered data\n");
 
-#ifdef AMIDE_LIBGSL_SUPPORT
 static const char * gaussian_filter_text = 
 N_("The Gaussian filter is an effective smoothing filter");
-#endif
 
 
 static const char * median_3d_filter_text = 
@@ -71,12 +69,6 @@ N_("Median filters work relatively well at preserving edges while\n"
    "determining the median will be of the given kernel size, and the\n"
    "data set will be filtered 3x (once for each direction).");
 
-#ifndef AMIDE_LIBGSL_SUPPORT
-static const char *no_libgsl_text =
-N_("This filter requires support from the GNU Scientific Library (GSL).\n"
-   "This version of AMIDE has not been compiled with GSL support enabled.");
-#endif
-
 
 typedef enum {
   PICK_FILTER_PAGE,
@@ -99,16 +91,29 @@ typedef struct tb_filter_t {
   AmitkStudy * study;
 
   GtkWidget * page[NUM_PAGES];
-  GtkWidget * progress_dialog;
 
   guint reference_count;
 } tb_filter_t;
 
+/* everything the filtering needs, as it carries on after the wizard's closed */
+typedef struct filter_job_t {
+  AmitkDataSet * data_set;
+  AmitkStudy * study;
+  AmitkFilter filter;
+  gint kernel_size;
+  amide_real_t fwhm;
+  GtkWidget * progress_dialog;
+} filter_job_t;
+
 
 static void filter_cb(GtkWidget * widget, gpointer data);
 static void kernel_size_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 static void fwhm_spinner_cb(GtkSpinButton * spin_button, gpointer data);
 
+static gpointer filter_job_run(AmitkJob * job, gpointer data);
+static void filter_job_progress(AmitkJob * job, const gchar * message, const gdouble fraction, gpointer data);
+static void filter_job_done(AmitkJob * job, gpointer result, gpointer data);
+static void filter_job_free(gpointer data);
 static void apply_cb(GtkAssistant * assistant, gpointer data);
 static void close_cb(GtkAssistant * assistant, gpointer data);
 static gint forward_page_function (gint current_page, gpointer data);
@@ -174,29 +179,101 @@ static void fwhm_spinner_cb(GtkSpinButton * spin_button, gpointer data) {
 
 
 
+/* generates the new data set, runs in a worker thread.  The data set's read
+   lock keeps it from being changed (e.g. erased) underneath us */
+static gpointer filter_job_run(AmitkJob * job, gpointer data) {
+
+  filter_job_t * filter_job = data;
+  AmitkDataSet * filtered;
+
+  amitk_data_set_read_lock(filter_job->data_set);
+  filtered = amitk_data_set_get_filtered(filter_job->data_set, 
+					 filter_job->filter,
+					 filter_job->kernel_size,
+					 filter_job->fwhm,
+					 amitk_job_update,
+					 job);
+  amitk_data_set_read_unlock(filter_job->data_set);
+
+  return filtered;
+}
+
+static void filter_job_progress(AmitkJob * job, const gchar * message, 
+				const gdouble fraction, gpointer data) {
+
+  filter_job_t * filter_job = data;
+
+  if (filter_job->progress_dialog != NULL)
+    amitk_progress_dialog_job_progress(job, message, fraction, filter_job->progress_dialog);
+
+  return;
+}
+
+static void filter_job_done(AmitkJob * job, gpointer result, gpointer data) {
+
+  filter_job_t * filter_job = data;
+  AmitkDataSet * filtered = result;
+  gchar * messages;
+
+  if (filtered != NULL) {
+    /* and add the new data set to the study */
+    amitk_object_add_child(AMITK_OBJECT(filter_job->study), AMITK_OBJECT(filtered)); /* this adds a reference to the data set*/
+    amitk_object_unref(filtered); /* so remove a reference */
+  } else if (!amitk_job_is_canceled(job)) {
+    /* anything that went wrong while filtering was kept in the job */
+    messages = amitk_job_take_messages(job);
+    if (messages != NULL) {
+      g_warning(_("Failed to generate filtered data set:\n%s"), messages);
+      g_free(messages);
+    } else {
+      g_warning(_("Failed to generate filtered data set"));
+    }
+  }
+
+  if (filter_job->progress_dialog != NULL)
+    gtk_widget_destroy(filter_job->progress_dialog);
+
+  return;
+}
+
+static void filter_job_free(gpointer data) {
+
+  filter_job_t * filter_job = data;
+
+  amitk_object_unref(filter_job->data_set);
+  amitk_object_unref(filter_job->study);
+  g_free(filter_job);
+
+  return;
+}
+
 /* function called when the finish button is hit */
 static void apply_cb(GtkAssistant * assistant, gpointer data) {
 
   tb_filter_t * tb_filter = data;
-  AmitkDataSet * filtered;
+  filter_job_t * filter_job;
+  AmitkJob * job;
 
   /* disable the buttons */
   gtk_widget_set_sensitive(GTK_WIDGET(assistant), FALSE);
 
-  /* generate the new data set */
-  filtered = amitk_data_set_get_filtered(tb_filter->data_set, 
-  					 tb_filter->filter,
-  					 tb_filter->kernel_size,
-  					 tb_filter->fwhm,
-					 amitk_progress_dialog_update,
-					 tb_filter->progress_dialog);
+  filter_job = g_new0(filter_job_t, 1);
+  filter_job->data_set = amitk_object_ref(tb_filter->data_set);
+  filter_job->study = amitk_object_ref(tb_filter->study);
+  filter_job->filter = tb_filter->filter;
+  filter_job->kernel_size = tb_filter->kernel_size;
+  filter_job->fwhm = tb_filter->fwhm;
 
-  if (filtered != NULL) {
-    /* and add the new data set to the study */
-    amitk_object_add_child(AMITK_OBJECT(tb_filter->study), AMITK_OBJECT(filtered)); /* this adds a reference to the data set*/
-    amitk_object_unref(filtered); /* so remove a reference */
-  } else 
-    g_warning("Failed to generate filtered data set");
+  /* the wizard closes after this, so hang the progress dialog off the study's window */
+  filter_job->progress_dialog = 
+    amitk_progress_dialog_new(gtk_window_get_transient_for(GTK_WINDOW(assistant)));
+  g_signal_connect(G_OBJECT(filter_job->progress_dialog), "destroy",
+		   G_CALLBACK(gtk_widget_destroyed), &(filter_job->progress_dialog));
+
+  /* generate the new data set in the background */
+  job = amitk_job_submit(_(wizard_name), filter_job_run, filter_job_progress, 
+			 filter_job_done, filter_job, filter_job_free);
+  amitk_job_unref(job);
 
   return;
 }
@@ -236,8 +313,6 @@ static gint forward_page_function (gint current_page, gpointer data) {
 
 static tb_filter_t * tb_filter_free(tb_filter_t * tb_filter) {
 
-  gboolean return_val;
-
   /* sanity checks */
   g_return_val_if_fail(tb_filter != NULL, NULL);
   g_return_val_if_fail(tb_filter->reference_count > 0, NULL);
@@ -261,11 +336,6 @@ static tb_filter_t * tb_filter_free(tb_filter_t * tb_filter) {
       tb_filter->study = NULL;
     }
 
-    if (tb_filter->progress_dialog != NULL) {
-      g_signal_emit_by_name(G_OBJECT(tb_filter->progress_dialog), "delete_event", NULL, &return_val);
-      tb_filter->progress_dialog = NULL;
-    }
-    
     g_free(tb_filter);
     tb_filter = NULL;
   }
@@ -330,7 +400,6 @@ static GtkWidget * create_page(tb_filter_t * tb_filter, which_page_t i_page) {
     
     break;
   case GAUSSIAN_FILTER_PAGE:
-#ifdef AMIDE_LIBGSL_SUPPORT
     tb_filter->kernel_size = DEFAULT_GAUSSIAN_FILTER_SIZE;
     
     label = gtk_label_new(_(gaussian_filter_text));
@@ -372,13 +441,6 @@ static GtkWidget * create_page(tb_filter_t * tb_filter, which_page_t i_page) {
     gtk_table_attach(GTK_TABLE(table), spin_button, 
 		     table_column+1,table_column+2, table_row,table_row+1,
 		     FALSE,FALSE, X_PADDING, Y_PADDING);
-#else /* no libgsl support */
-    label = gtk_label_new(_(no_libgsl_text));
-    gtk_table_attach(GTK_TABLE(table), label, 
-		     table_column,table_column+2, table_row,table_row+1,
-		     FALSE,FALSE, X_PADDING, Y_PADDING);
-    table_row++;
-#endif
     break;
   case MEDIAN_3D_FILTER_PAGE:
   case MEDIAN_LINEAR_FILTER_PAGE:
@@ -447,8 +509,6 @@ void tb_filter(AmitkStudy * study, AmitkDataSet * active_ds, GtkWindow * parent)
 				      forward_page_function,
 				      tb_filter, NULL);
 
-  tb_filter->progress_dialog = amitk_progress_dialog_new(GTK_WINDOW(tb_filter->dialog));
-
 
   /* --------------intro page and the various filter pages ------------------- */
   for (i_page=PICK_FILTER_PAGE; i_page<CONCLUSION_PAGE; i_page++) {
@@ -476,10 +536,6 @@ void tb_filter(AmitkStudy * study, AmitkDataSet * active_ds, GtkWindow * parent)
   }
   g_object_unref(logo);
 
-#ifndef AMIDE_LIBGSL_SUPPORT
-  gtk_assistant_set_page_complete(GTK_ASSISTANT(tb_filter->dialog), tb_filter->page[GAUSSIAN_FILTER_PAGE], FALSE);
-#endif
-
   gtk_widget_show_all(tb_filter->dialog);
 
   return;
@@ -73,7 +73,6 @@ typedef enum {
 typedef struct tb_math_t {
   GtkWidget * dialog;
   GtkWidget * page[NUM_PAGES];
-  GtkWidget * progress_dialog;
   GtkWidget * scrolled_ds1;
   GtkWidget * list_ds1;
   GtkWidget * scrolled_ds2;
@@ -99,6 +98,19 @@ typedef struct tb_math_t {
   guint reference_count;
 } tb_math_t;
 
+/* everything the math needs, as it carries on after the wizard's closed */
+typedef struct math_job_t {
+  AmitkStudy * study;
+  AmitkDataSet * ds1;
+  AmitkDataSet * ds2;
+  gint operation; 
+  amide_data_t parameter0;
+  amide_data_t parameter1;
+  gboolean by_frames;
+  gboolean maintain_ds1_dim;
+  GtkWidget * progress_dialog;
+} math_job_t;
+
 
 
 static void operation_update_model(tb_math_t * math);
@@ -115,6 +127,10 @@ static tb_math_t * tb_math_free(tb_math_t * math);
 static tb_math_t * tb_math_init(void);
 
 static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer data);
+static gpointer math_job_run(AmitkJob * job, gpointer data);
+static void math_job_progress(AmitkJob * job, const gchar * message, const gdouble fraction, gpointer data);
+static void math_job_done(AmitkJob * job, gpointer result, gpointer data);
+static void math_job_free(gpointer data);
 static void apply_cb(GtkAssistant * assistant, gpointer data);
 static void close_cb(GtkAssistant * assistant, gpointer data);
 
@@ -394,43 +410,124 @@ static void prepare_page_cb(GtkAssistant * wizard, GtkWidget * page, gpointer da
 }
 
 
-/* function called when the finish button is hit */
-static void apply_cb(GtkAssistant * assistant, gpointer data) {
-  tb_math_t * tb_math = data;
-  AmitkDataSet * output_ds;
-
-  /* sanity check */
-  g_return_if_fail(tb_math->ds1 != NULL);
+/* generates the new data set, runs in a worker thread.  The data sets' read
+   locks keep them from being changed (e.g. erased) underneath us */
+static gpointer math_job_run(AmitkJob * job, gpointer data) {
 
-  /* apply the math */
+  math_job_t * math_job = data;
+  AmitkDataSet * output_ds;
 
-  if (tb_math->operation < AMITK_OPERATION_UNARY_NUM) {
-    output_ds = amitk_data_sets_math_unary(tb_math->ds1, 
-					   tb_math->operation,
-					   tb_math->parameter0,
-					   tb_math->parameter1,
-					   amitk_progress_dialog_update,
-					   tb_math->progress_dialog);
+  amitk_data_set_read_lock(math_job->ds1);
+  if (math_job->operation < AMITK_OPERATION_UNARY_NUM) {
+    output_ds = amitk_data_sets_math_unary(math_job->ds1, 
+					   math_job->operation,
+					   math_job->parameter0,
+					   math_job->parameter1,
+					   amitk_job_update,
+					   job);
   } else {
-    g_return_if_fail(tb_math->ds2 != NULL); /* sanity check */
-    output_ds = amitk_data_sets_math_binary(tb_math->ds1, 
-					    tb_math->ds2, 
-					    tb_math->operation-AMITK_OPERATION_UNARY_NUM,
-					    tb_math->parameter0,
-					    tb_math->parameter1,
-					    tb_math->by_frames,
-					    tb_math->maintain_ds1_dim,
-					    amitk_progress_dialog_update,
-					    tb_math->progress_dialog);
+    if (math_job->ds2 != math_job->ds1) /* the locks aren't recursive */
+      amitk_data_set_read_lock(math_job->ds2);
+    output_ds = amitk_data_sets_math_binary(math_job->ds1, 
+					    math_job->ds2, 
+					    math_job->operation-AMITK_OPERATION_UNARY_NUM,
+					    math_job->parameter0,
+					    math_job->parameter1,
+					    math_job->by_frames,
+					    math_job->maintain_ds1_dim,
+					    amitk_job_update,
+					    job);
+    if (math_job->ds2 != math_job->ds1)
+      amitk_data_set_read_unlock(math_job->ds2);
   }
+  amitk_data_set_read_unlock(math_job->ds1);
+
+  return output_ds;
+}
+
+static void math_job_progress(AmitkJob * job, const gchar * message, 
+			      const gdouble fraction, gpointer data) {
+
+  math_job_t * math_job = data;
+
+  if (math_job->progress_dialog != NULL)
+    amitk_progress_dialog_job_progress(job, message, fraction, math_job->progress_dialog);
+
+  return;
+}
+
+static void math_job_done(AmitkJob * job, gpointer result, gpointer data) {
+
+  math_job_t * math_job = data;
+  AmitkDataSet * output_ds = result;
+  gchar * messages;
 
   if (output_ds != NULL) {
-    amitk_object_add_child(AMITK_OBJECT(tb_math->study), AMITK_OBJECT(output_ds));
+    amitk_object_add_child(AMITK_OBJECT(math_job->study), AMITK_OBJECT(output_ds));
     amitk_object_unref(output_ds);
-  } else {
-    g_warning(_("Math operation failed - results not added to study"));
+  } else if (!amitk_job_is_canceled(job)) {
+    /* anything that went wrong was kept in the job */
+    messages = amitk_job_take_messages(job);
+    if (messages != NULL) {
+      g_warning(_("Math operation failed - results not added to study:\n%s"), messages);
+      g_free(messages);
+    } else {
+      g_warning(_("Math operation failed - results not added to study"));
+    }
   }
 
+  if (math_job->progress_dialog != NULL)
+    gtk_widget_destroy(math_job->progress_dialog);
+
+  return;
+}
+
+static void math_job_free(gpointer data) {
+
+  math_job_t * math_job = data;
+
+  amitk_object_unref(math_job->study);
+  amitk_object_unref(math_job->ds1);
+  if (math_job->ds2 != NULL)
+    amitk_object_unref(math_job->ds2);
+  g_free(math_job);
+
+  return;
+}
+
+/* function called when the finish button is hit */
+static void apply_cb(GtkAssistant * assistant, gpointer data) {
+  tb_math_t * tb_math = data;
+  math_job_t * math_job;
+  AmitkJob * job;
+
+  /* sanity check */
+  g_return_if_fail(tb_math->ds1 != NULL);
+  if (tb_math->operation >= AMITK_OPERATION_UNARY_NUM)
+    g_return_if_fail(tb_math->ds2 != NULL); 
+
+  math_job = g_new0(math_job_t, 1);
+  math_job->study = amitk_object_ref(tb_math->study);
+  math_job->ds1 = amitk_object_ref(tb_math->ds1);
+  if (tb_math->operation >= AMITK_OPERATION_UNARY_NUM)
+    math_job->ds2 = amitk_object_ref(tb_math->ds2);
+  math_job->operation = tb_math->operation;
+  math_job->parameter0 = tb_math->parameter0;
+  math_job->parameter1 = tb_math->parameter1;
+  math_job->by_frames = tb_math->by_frames;
+  math_job->maintain_ds1_dim = tb_math->maintain_ds1_dim;
+
+  /* the wizard closes after this, so hang the progress dialog off the study's window */
+  math_job->progress_dialog = 
+    amitk_progress_dialog_new(gtk_window_get_transient_for(GTK_WINDOW(assistant)));
+  g_signal_connect(G_OBJECT(math_job->progress_dialog), "destroy",
+		   G_CALLBACK(gtk_widget_destroyed), &(math_job->progress_dialog));
+
+  /* apply the math in the background */
+  job = amitk_job_submit(_("Data Set Math Wizard"), math_job_run, math_job_progress, 
+			 math_job_done, math_job, math_job_free);
+  amitk_job_unref(job);
+
   return;
 }
 
@@ -454,8 +551,6 @@ static void close_cb(GtkAssistant * assistant, gpointer data) {
 /* destroy a math data structure */
 static tb_math_t * tb_math_free(tb_math_t * tb_math) {
 
-  gboolean return_val;
-
   g_return_val_if_fail(tb_math != NULL, NULL);
 
   /* sanity checks */
@@ -485,11 +580,6 @@ static tb_math_t * tb_math_free(tb_math_t * tb_math) {
       tb_math->ds2 = NULL;
     }
 
-    if (tb_math->progress_dialog != NULL) {
-      g_signal_emit_by_name(G_OBJECT(tb_math->progress_dialog), "delete_event", NULL, &return_val);
-      tb_math->progress_dialog = NULL;
-    }
-    
     g_free(tb_math);
     tb_math = NULL;
   }
@@ -703,8 +793,6 @@ void tb_math(AmitkStudy * study, GtkWindow * parent) {
   g_signal_connect(G_OBJECT(tb_math->dialog), "prepare",  G_CALLBACK(prepare_page_cb), tb_math);
 
 
-  tb_math->progress_dialog = amitk_progress_dialog_new(GTK_WINDOW(tb_math->dialog));
-
   /* --------------- initial page ------------------ */
   /* figure out how many data sets there are */
   data_sets = amitk_object_get_children_of_type(AMITK_OBJECT(tb_math->study), AMITK_OBJECT_TYPE_DATA_SET, TRUE);
@@ -30,6 +30,7 @@
 #include "amide.h"
 #include "amide_gconf.h"
 #include "amitk_common.h"
+#include "amitk_progress_dialog.h"
 #include "analysis.h"
 #include "tb_roi_analysis.h"
 #include "ui_common.h"
@@ -107,6 +108,21 @@ typedef struct tb_roi_analysis_t {
   analysis_roi_t * roi_analyses;
   guint reference_count;
 } tb_roi_analysis_t;
+
+/* everything the calculation needs, as it runs in the background */
+typedef struct analysis_job_t {
+  AmitkStudy * study;
+  AmitkPreferences * preferences;
+  GList * rois;
+  GList * data_sets;
+  analysis_calculation_t calculation_type;
+  gboolean accurate;
+  gdouble subfraction;
+  gdouble threshold_percentage;
+  gdouble threshold_value;
+  GtkWindow * parent; /* weak pointer */
+  GtkWidget * progress_dialog;
+} analysis_job_t;
   
 
 static void export_data(tb_roi_analysis_t * tb_roi_analysis, gboolean raw_values);
@@ -126,6 +142,12 @@ static void read_preferences(gboolean * all_data_sets,
 			     gdouble * threshold_value);
 static tb_roi_analysis_t * tb_roi_analysis_free(tb_roi_analysis_t * tb_roi_analysis);
 static tb_roi_analysis_t * tb_roi_analysis_init(void);
+static void show_analyses(AmitkStudy * study, AmitkPreferences * preferences, 
+			  analysis_roi_t * roi_analyses, GtkWindow * parent);
+static gpointer analysis_job_run(AmitkJob * job, gpointer data);
+static void analysis_job_progress(AmitkJob * job, const gchar * message, const gdouble fraction, gpointer data);
+static void analysis_job_done(AmitkJob * job, gpointer result, gpointer data);
+static void analysis_job_free(gpointer data);
 
 
 
@@ -191,7 +213,8 @@ static void export_analyses(const gchar * save_filename, analysis_roi_t * roi_an
   amide_real_t voxel_volume;
   gboolean title_printed;
   AmitkPoint location;
-  analysis_element_t * element;
+  guint * order;
+  guint j;
 
   /* sanity checks */
   g_return_if_fail(save_filename != NULL);
@@ -318,12 +341,15 @@ static void export_analyses(const gchar * save_filename, analysis_roi_t * roi_an
 	  } else { /* raw data */
 	    fprintf(file_pointer, "#   Frame %d, Gate %d, Gate Time %5.3f\n", frame, gate,gate_analyses->gate_time);
 	    fprintf(file_pointer, "#      Value\t      Weight\t      X (mm)\t      Y (mm)\t      Z (mm)\n");
-	    for (i=0; i < gate_analyses->data_array->len; i++) {
-	      element = g_ptr_array_index(gate_analyses->data_array, i);
-	      VOXEL_TO_POINT(element->ds_voxel, AMITK_DATA_SET_VOXEL_SIZE(volume_analyses->data_set),location);
+	    order = analysis_gate_sort_voxels(gate_analyses);
+	    for (i=0; i < gate_analyses->data.len; i++) {
+	      j = order[i];
+	      VOXEL_TO_POINT(gate_analyses->data.ds_voxels[j], AMITK_DATA_SET_VOXEL_SIZE(volume_analyses->data_set),location);
 	      location = amitk_space_s2b(AMITK_SPACE(volume_analyses->data_set), location);
-	      fprintf(file_pointer, "%12g\t%12g\t%12g\t%12g\t%12g\n", element->value, element->weight, location.x, location.y, location.z);
+	      fprintf(file_pointer, "%12g\t%12g\t%12g\t%12g\t%12g\n", 
+		      gate_analyses->data.values[j], gate_analyses->data.weights[j], location.x, location.y, location.z);
 	    }
+	    g_free(order);
 	  }
 
 	  gate_analyses = gate_analyses->next_gate_analysis;
@@ -767,66 +793,25 @@ static tb_roi_analysis_t * tb_roi_analysis_init(void) {
 }
 
 
-void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWindow * parent) {
+/* puts up the dialog with the results, which takes over the reference to roi_analyses */
+static void show_analyses(AmitkStudy * study, AmitkPreferences * preferences, 
+			  analysis_roi_t * roi_analyses, GtkWindow * parent) {
 
   tb_roi_analysis_t * tb_roi_analysis;
   GtkWidget * notebook;
   gchar * title;
-  GList * rois;
-  GList * data_sets;
-
-  gboolean all_data_sets;
-  gboolean all_rois;
-  analysis_calculation_t calculation_type;
-  gboolean accurate;
-  gdouble subfraction;
-  gdouble threshold_percentage;
-  gdouble threshold_value;
-
-  read_preferences(&all_data_sets, &all_rois, &calculation_type, &accurate, &subfraction, 
-		   &threshold_percentage, &threshold_value);
-
-  tb_roi_analysis = tb_roi_analysis_init();
-  tb_roi_analysis->preferences = g_object_ref(preferences);
-
-  /* figure out which data sets we're dealing with */
-  if (all_data_sets)
-    data_sets = amitk_object_get_children_of_type(AMITK_OBJECT(study), 
-						  AMITK_OBJECT_TYPE_DATA_SET, TRUE);
-  else
-    data_sets = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
-							   AMITK_OBJECT_TYPE_DATA_SET, AMITK_SELECTION_ANY, TRUE);
-
-  if (data_sets == NULL) {
-    g_warning(_("No Data Sets selected for calculating analyses"));
-    return;
-  }
-
-  /* get the list of roi's we're going to be calculating over */
-  if (all_rois)
-    rois = amitk_object_get_children_of_type(AMITK_OBJECT(study), AMITK_OBJECT_TYPE_ROI, TRUE);
-  else 
-    rois = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
-						      AMITK_OBJECT_TYPE_ROI, AMITK_SELECTION_ANY, TRUE);
 
-  if (rois == NULL) {
-    g_warning(_("No ROI's selected for calculating analyses"));
-    amitk_objects_unref(data_sets);
+  if ((tb_roi_analysis = tb_roi_analysis_init()) == NULL) {
+    analysis_roi_unref(roi_analyses);
     return;
   }
-
-  /* calculate all our data */
-  tb_roi_analysis->roi_analyses = analysis_roi_init(study, rois, data_sets, calculation_type, accurate, 
-						    subfraction, threshold_percentage, threshold_value);
-
-  rois = amitk_objects_unref(rois);
-  data_sets = amitk_objects_unref(data_sets);
-  g_return_if_fail(tb_roi_analysis->roi_analyses != NULL);
+  tb_roi_analysis->preferences = g_object_ref(preferences);
+  tb_roi_analysis->roi_analyses = roi_analyses;
   
   /* start setting up the widget we'll display the info from */
   title = g_strdup_printf(_("%s Roi Analysis: Study %s"), PACKAGE, 
 			  AMITK_OBJECT_NAME(study));
-  tb_roi_analysis->dialog = gtk_dialog_new_with_buttons(title, GTK_WINDOW(parent),
+  tb_roi_analysis->dialog = gtk_dialog_new_with_buttons(title, parent,
 							GTK_DIALOG_DESTROY_WITH_PARENT,
 							GTK_STOCK_SAVE_AS, AMITK_RESPONSE_SAVE_AS,
 							GTK_STOCK_COPY, AMITK_RESPONSE_COPY,
@@ -859,6 +844,121 @@ void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWind
   return;
 }
 
+/* calculates the statistics, runs in a worker thread.  The data sets get read 
+   locked as they're gone through, see analysis_roi_init */
+static gpointer analysis_job_run(AmitkJob * job, gpointer data) {
+
+  analysis_job_t * analysis_job = data;
+
+  return analysis_roi_init(analysis_job->study, analysis_job->rois, analysis_job->data_sets, 
+			   analysis_job->calculation_type, analysis_job->accurate, 
+			   analysis_job->subfraction, analysis_job->threshold_percentage, 
+			   analysis_job->threshold_value, amitk_job_update, job);
+}
+
+static void analysis_job_progress(AmitkJob * job, const gchar * message, 
+				  const gdouble fraction, gpointer data) {
+
+  analysis_job_t * analysis_job = data;
+
+  if (analysis_job->progress_dialog != NULL)
+    amitk_progress_dialog_job_progress(job, message, fraction, analysis_job->progress_dialog);
+
+  return;
+}
+
+/* result is NULL if canceled or we ran out of memory, in which case the
+   job has kept the warning, and shows it after this returns */
+static void analysis_job_done(AmitkJob * job, gpointer result, gpointer data) {
+
+  analysis_job_t * analysis_job = data;
+
+  if (analysis_job->progress_dialog != NULL)
+    gtk_widget_destroy(analysis_job->progress_dialog);
+
+  if (result != NULL)
+    show_analyses(analysis_job->study, analysis_job->preferences, result, analysis_job->parent);
+
+  return;
+}
+
+static void analysis_job_free(gpointer data) {
+
+  analysis_job_t * analysis_job = data;
+
+  amitk_object_unref(analysis_job->study);
+  g_object_unref(analysis_job->preferences);
+  amitk_objects_unref(analysis_job->rois);
+  amitk_objects_unref(analysis_job->data_sets);
+  if (analysis_job->parent != NULL)
+    g_object_remove_weak_pointer(G_OBJECT(analysis_job->parent), (gpointer *) &(analysis_job->parent));
+  g_free(analysis_job);
+
+  return;
+}
+
+void tb_roi_analysis(AmitkStudy * study, AmitkPreferences * preferences, GtkWindow * parent) {
+
+  analysis_job_t * analysis_job;
+  AmitkJob * job;
+  GList * rois;
+  GList * data_sets;
+  gboolean all_data_sets;
+  gboolean all_rois;
+
+  analysis_job = g_new0(analysis_job_t, 1);
+  read_preferences(&all_data_sets, &all_rois, &(analysis_job->calculation_type), 
+		   &(analysis_job->accurate), &(analysis_job->subfraction), 
+		   &(analysis_job->threshold_percentage), &(analysis_job->threshold_value));
+
+  /* figure out which data sets we're dealing with */
+  if (all_data_sets)
+    data_sets = amitk_object_get_children_of_type(AMITK_OBJECT(study), 
+						  AMITK_OBJECT_TYPE_DATA_SET, TRUE);
+  else
+    data_sets = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
+							   AMITK_OBJECT_TYPE_DATA_SET, AMITK_SELECTION_ANY, TRUE);
+
+  if (data_sets == NULL) {
+    g_warning(_("No Data Sets selected for calculating analyses"));
+    g_free(analysis_job);
+    return;
+  }
+
+  /* get the list of roi's we're going to be calculating over */
+  if (all_rois)
+    rois = amitk_object_get_children_of_type(AMITK_OBJECT(study), AMITK_OBJECT_TYPE_ROI, TRUE);
+  else 
+    rois = amitk_object_get_selected_children_of_type(AMITK_OBJECT(study), 
+						      AMITK_OBJECT_TYPE_ROI, AMITK_SELECTION_ANY, TRUE);
+
+  if (rois == NULL) {
+    g_warning(_("No ROI's selected for calculating analyses"));
+    amitk_objects_unref(data_sets);
+    g_free(analysis_job);
+    return;
+  }
+
+  analysis_job->study = amitk_object_ref(study);
+  analysis_job->preferences = g_object_ref(preferences);
+  analysis_job->rois = rois;
+  analysis_job->data_sets = data_sets;
+  analysis_job->parent = parent;
+  if (parent != NULL)
+    g_object_add_weak_pointer(G_OBJECT(parent), (gpointer *) &(analysis_job->parent));
+
+  analysis_job->progress_dialog = amitk_progress_dialog_new(parent);
+  g_signal_connect(G_OBJECT(analysis_job->progress_dialog), "destroy",
+		   G_CALLBACK(gtk_widget_destroyed), &(analysis_job->progress_dialog));
+
+  /* calculate all our data in the background, the results get shown when it's done */
+  job = amitk_job_submit(_("Calculating ROI statistics"), analysis_job_run, analysis_job_progress,
+			 analysis_job_done, analysis_job, analysis_job_free);
+  amitk_job_unref(job);
+
+  return;
+}
+
 
 
 
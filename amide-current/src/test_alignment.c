@@ -0,0 +1,526 @@
+/* test_alignment.c - checks the mutual information evaluator used for alignment
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* compares the mutual information worked out by alignment_mutual_information_evaluate,
+   nearest neighbor and partial volume, against sampling the moving data set one point
+   at a time, with the moving data set on a different grid and at random positions, with
+   one thread and with several.  Then checks that it and the old evaluator (which
+   generated a slice of the moving data set with amitk_data_set_get_slice for every
+   evaluation) both find the best fit at the right place, and times the two.
+   Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "amitk_data_set.h"
+#include "amitk_data_set_DOUBLE_0D_SCALING.h"
+#include "amitk_parallel.h"
+#include "alignment_mutual_information.h"
+
+/* as in alignment_mutual_information.c */
+#define NUM_BINS 50
+
+#define NUM_RANDOM_SPACES 6
+#define NUM_SHIFTS 7 /* -3 to 3 mm */
+#define NUM_TIMED_SPACES 50
+
+/* the evaluator adds up its histogram in a different order */
+#define TOLERANCE 1e-6
+
+/* the old evaluator averaged over the slice thickness */
+#define OLD_TOLERANCE 0.1
+
+static amide_data_t blob(AmitkPoint point, AmitkPoint center, amide_real_t sigma) {
+
+  AmitkPoint diff;
+
+  diff = point_sub(point, center);
+
+  return exp(-point_dot_product(diff, diff)/(2.0*sigma*sigma));
+}
+
+/* a few blobs on a gentle slope, in mm */
+static amide_data_t phantom_value(AmitkPoint point) {
+
+  AmitkPoint center1 = {30.0, 35.0, 30.0};
+  AmitkPoint center2 = {60.0, 50.0, 40.0};
+  AmitkPoint center3 = {45.0, 25.0, 55.0};
+
+  return 100.0*blob(point, center1, 6.0) + 60.0*blob(point, center2, 4.0) + 
+    80.0*blob(point, center3, 9.0) + 0.2*point.x + 0.1*point.z;
+}
+
+/* inverted is used for the moving data sets, so there's something for mutual information to do */
+static AmitkDataSet * phantom_data_set(AmitkVoxel dim, AmitkPoint voxel_size, gboolean inverted) {
+
+  AmitkDataSet * ds;
+  AmitkVoxel voxel;
+  AmitkPoint point;
+  amide_data_t value;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+  if (ds == NULL) return NULL;
+  amitk_data_set_set_voxel_size(ds, voxel_size);
+  amitk_data_set_set_interpolation(ds, AMITK_INTERPOLATION_NEAREST_NEIGHBOR);
+
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	VOXEL_TO_POINT(voxel, voxel_size, point);
+	value = phantom_value(point);
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) = inverted ? 200.0-1.5*value : value;
+      }
+  amitk_data_set_calc_min_max(ds, NULL, NULL);
+
+  return ds;
+}
+
+static amide_data_t bin_scale(AmitkDataSet * ds, amide_data_t * pmin) {
+
+  amide_data_t diff;
+
+  *pmin = amitk_data_set_get_global_min(ds);
+  diff = amitk_data_set_get_global_max(ds) - *pmin;
+
+  return (diff > 0.0) ? NUM_BINS/diff : 0.0;
+}
+
+static gint bin(amide_data_t value, const amide_data_t min, const amide_data_t scale) {
+
+  gint i_bin;
+
+  if (isnan(value)) value = 0.0;
+  i_bin = floor((value-min)*scale);
+
+  return CLAMP(i_bin, 0, NUM_BINS-1);
+}
+
+static gdouble histogram_mi(const gdouble * histogram) {
+
+  gdouble margin_fixed[NUM_BINS];
+  gdouble margin_moving[NUM_BINS];
+  gdouble total=0.0;
+  gdouble probability;
+  gdouble mi=0.0;
+  gint i, j;
+
+  memset(margin_fixed, 0, sizeof(margin_fixed));
+  memset(margin_moving, 0, sizeof(margin_moving));
+  for (i=0; i<NUM_BINS; i++)
+    for (j=0; j<NUM_BINS; j++) {
+      margin_fixed[i] += histogram[i*NUM_BINS+j];
+      margin_moving[j] += histogram[i*NUM_BINS+j];
+      total += histogram[i*NUM_BINS+j];
+    }
+  if (total <= 0.0) return 0.0;
+
+  for (i=0; i<NUM_BINS; i++)
+    for (j=0; j<NUM_BINS; j++)
+      if (histogram[i*NUM_BINS+j] > 0.0) {
+	probability = histogram[i*NUM_BINS+j]/total;
+	mi += probability*log2(probability*total*total/(margin_fixed[i]*margin_moving[j]));
+      }
+
+  return mi;
+}
+
+/* the slices alignment looks at, through the fixed data set's extent */
+static AmitkVolume * view_volume_new(AmitkDataSet * fixed_ds, AmitkView view,
+				     AmitkPoint view_center, amide_real_t thickness) {
+
+  AmitkVolume * view_volume;
+  AmitkSpace * view_space;
+  GList * fixed_dss;
+
+  view_volume = amitk_volume_new();
+  view_space = amitk_space_get_view_space(view, AMITK_LAYOUT_LINEAR);
+  fixed_dss = g_list_append(NULL, fixed_ds);
+  amitk_volumes_calc_display_volume(fixed_dss, view_space, view_center, thickness, 100.0, view_volume);
+  g_list_free(fixed_dss);
+  g_object_unref(view_space);
+
+  return view_volume;
+}
+
+typedef struct {
+  AmitkDataSet * fixed_ds;
+  AmitkDataSet * moving_ds;
+  AmitkPoint view_center;
+  amide_real_t thickness;
+  amide_time_t start;
+  amide_time_t duration;
+  gint granularity;
+} mi_test_t;
+
+/* samples the moving data set at the center of each fixed slice pixel, one point at a time */
+static gdouble reference_mi(const mi_test_t * mt, AmitkSpace * new_space, gboolean partial_volume) {
+
+  gdouble * histogram;
+  AmitkCanvasPoint pixel_size;
+  AmitkVolume * view_volume;
+  AmitkDataSet * slice;
+  AmitkView view;
+  AmitkVoxel i_pixel, moving_voxel;
+  AmitkPoint point, diff, moving_voxel_size;
+  amide_data_t fixed_min, fixed_scale, moving_min, moving_scale;
+  amide_data_t weight;
+  gint fixed_bin;
+  guint l;
+  gdouble mi;
+
+  histogram = g_new0(gdouble, NUM_BINS*NUM_BINS);
+  fixed_scale = bin_scale(mt->fixed_ds, &fixed_min);
+  moving_scale = bin_scale(mt->moving_ds, &moving_min);
+  moving_voxel_size = AMITK_DATA_SET_VOXEL_SIZE(mt->moving_ds);
+  moving_voxel.t = amitk_data_set_get_frame(mt->moving_ds, mt->start + mt->duration/2.0);
+  moving_voxel.g = AMITK_DATA_SET_VIEW_START_GATE(mt->moving_ds);
+  pixel_size.x = pixel_size.y = mt->granularity * point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(mt->fixed_ds));
+
+  for (view=0; view<AMITK_VIEW_NUM; view++) {
+    view_volume = view_volume_new(mt->fixed_ds, view, mt->view_center, mt->thickness);
+    slice = amitk_data_set_get_slice(mt->fixed_ds, mt->start, mt->duration, -1, pixel_size, view_volume);
+    amitk_object_unref(view_volume);
+
+    i_pixel = zero_voxel;
+    for (i_pixel.y=0; i_pixel.y<AMITK_DATA_SET_DIM_Y(slice); i_pixel.y++)
+      for (i_pixel.x=0; i_pixel.x<AMITK_DATA_SET_DIM_X(slice); i_pixel.x++) {
+	fixed_bin = bin(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(slice, i_pixel), fixed_min, fixed_scale);
+
+	point.x = (i_pixel.x+0.5)*AMITK_DATA_SET_VOXEL_SIZE_X(slice);
+	point.y = (i_pixel.y+0.5)*AMITK_DATA_SET_VOXEL_SIZE_Y(slice);
+	point.z = 0.5*AMITK_DATA_SET_VOXEL_SIZE_Z(slice);
+	point = point_div(amitk_space_b2s(new_space, amitk_space_s2b(AMITK_SPACE(slice), point)),
+			  moving_voxel_size);
+
+	if (!partial_volume) {
+	  moving_voxel.x = floor(point.x);
+	  moving_voxel.y = floor(point.y);
+	  moving_voxel.z = floor(point.z);
+	  histogram[fixed_bin*NUM_BINS +
+		    bin(amitk_data_set_get_value(mt->moving_ds, moving_voxel), moving_min, moving_scale)] += 1.0;
+	} else {
+	  diff.x = point.x-0.5-floor(point.x-0.5);
+	  diff.y = point.y-0.5-floor(point.y-0.5);
+	  diff.z = point.z-0.5-floor(point.z-0.5);
+	  for (l=0; l<8; l++) {
+	    moving_voxel.x = floor(point.x-0.5) + ((l & 0x1) ? 1 : 0);
+	    moving_voxel.y = floor(point.y-0.5) + ((l & 0x2) ? 1 : 0);
+	    moving_voxel.z = floor(point.z-0.5) + ((l & 0x4) ? 1 : 0);
+	    weight = ((l & 0x1) ? diff.x : 1.0-diff.x) *
+	      ((l & 0x2) ? diff.y : 1.0-diff.y) *
+	      ((l & 0x4) ? diff.z : 1.0-diff.z);
+	    histogram[fixed_bin*NUM_BINS +
+		      bin(amitk_data_set_get_value(mt->moving_ds, moving_voxel), moving_min, moving_scale)] += weight;
+	  }
+	}
+      }
+    amitk_object_unref(slice);
+  }
+
+  mi = histogram_mi(histogram);
+  g_free(histogram);
+
+  return mi;
+}
+
+/* the evaluator alignment used before, which moved the view volume into the moving
+   data set's frame of reference and generated a slice there */
+static gdouble old_mi(const mi_test_t * mt, AmitkSpace * new_space) {
+
+  gdouble * histogram;
+  AmitkCanvasPoint pixel_size;
+  AmitkVolume * view_volume;
+  AmitkSpace * transform;
+  AmitkDataSet * fixed_slice;
+  AmitkDataSet * moving_slice;
+  AmitkView view;
+  AmitkVoxel i_pixel;
+  AmitkPoint offset;
+  amide_data_t fixed_min, fixed_scale, moving_min, moving_scale;
+  gdouble mi;
+
+  histogram = g_new0(gdouble, NUM_BINS*NUM_BINS);
+  fixed_scale = bin_scale(mt->fixed_ds, &fixed_min);
+  moving_scale = bin_scale(mt->moving_ds, &moving_min);
+  pixel_size.x = pixel_size.y = mt->granularity * point_min_dim(AMITK_DATA_SET_VOXEL_SIZE(mt->fixed_ds));
+
+  for (view=0; view<AMITK_VIEW_NUM; view++) {
+    view_volume = view_volume_new(mt->fixed_ds, view, mt->view_center, mt->thickness);
+    fixed_slice = amitk_data_set_get_slice(mt->fixed_ds, mt->start, mt->duration, -1, pixel_size, view_volume);
+
+    offset = AMITK_SPACE_OFFSET(view_volume);
+    transform = amitk_space_calculate_transform(new_space, AMITK_SPACE(mt->moving_ds));
+    amitk_space_transform(AMITK_SPACE(view_volume), transform);
+    g_object_unref(transform);
+    offset = amitk_space_b2s(new_space, offset);
+    offset = amitk_space_s2b(AMITK_SPACE(mt->moving_ds), offset);
+    amitk_space_set_offset(AMITK_SPACE(view_volume), offset);
+    moving_slice = amitk_data_set_get_slice(mt->moving_ds, mt->start, mt->duration, -1, pixel_size, view_volume);
+    amitk_object_unref(view_volume);
+
+    i_pixel = zero_voxel;
+    for (i_pixel.y=0; i_pixel.y<AMITK_DATA_SET_DIM_Y(fixed_slice); i_pixel.y++)
+      for (i_pixel.x=0; i_pixel.x<AMITK_DATA_SET_DIM_X(fixed_slice); i_pixel.x++)
+	histogram[bin(AMITK_DATA_SET_DOUBLE_0D_SCALING_CONTENT(fixed_slice, i_pixel), fixed_min, fixed_scale)*NUM_BINS +
+		  bin(amitk_data_set_get_value(moving_slice, i_pixel), moving_min, moving_scale)] += 1.0;
+
+    amitk_object_unref(fixed_slice);
+    amitk_object_unref(moving_slice);
+  }
+
+  mi = histogram_mi(histogram);
+  g_free(histogram);
+
+  return mi;
+}
+
+/* the moving data set's space, turned and shifted a bit about the fixed data set's center */
+static AmitkSpace * random_space(GRand * rand, AmitkDataSet * moving_ds, AmitkPoint center) {
+
+  AmitkSpace * space;
+  AmitkPoint axis, shift;
+
+  space = amitk_space_copy(AMITK_SPACE(moving_ds));
+
+  axis.x = g_rand_double_range(rand, -1.0, 1.0);
+  axis.y = g_rand_double_range(rand, -1.0, 1.0);
+  axis.z = g_rand_double_range(rand, -1.0, 1.0);
+  if (point_mag(axis) > 0.01) {
+    axis = point_cmult(1.0/point_mag(axis), axis);
+    amitk_space_rotate_on_vector(space, axis, g_rand_double_range(rand, -0.2, 0.2), center);
+  }
+
+  shift.x = g_rand_double_range(rand, -3.0, 3.0);
+  shift.y = g_rand_double_range(rand, -3.0, 3.0);
+  shift.z = g_rand_double_range(rand, -3.0, 3.0);
+  amitk_space_shift_offset(space, shift);
+
+  return space;
+}
+
+static gboolean test_random(GRand * rand, mi_test_t * mt) {
+
+  AmitkSpace * spaces[NUM_RANDOM_SPACES];
+  gdouble mis[NUM_RANDOM_SPACES];
+  gdouble expected;
+  gboolean partial_volume;
+  gboolean passed=TRUE;
+  gint i;
+
+  for (i=0; i<NUM_RANDOM_SPACES; i++)
+    spaces[i] = random_space(rand, mt->moving_ds, mt->view_center);
+
+  for (partial_volume=FALSE; partial_volume<=TRUE; partial_volume++) {
+    if (!alignment_mutual_information_evaluate(mt->moving_ds, mt->fixed_ds, mt->view_center, mt->thickness,
+					       mt->start, mt->duration, partial_volume, mt->granularity,
+					       spaces, NUM_RANDOM_SPACES, mis)) {
+      g_print("couldn't evaluate the mutual information\n");
+      passed = FALSE;
+      continue;
+    }
+
+    for (i=0; i<NUM_RANDOM_SPACES; i++) {
+      expected = reference_mi(mt, spaces[i], partial_volume);
+      if (fabs(mis[i]-expected) > TOLERANCE*MAX(fabs(expected), 1.0)) {
+	g_print("%s mutual information is %f, expected %f (granularity %d, %d threads)\n",
+		partial_volume ? "partial volume" : "nearest neighbor", mis[i], expected,
+		mt->granularity, amitk_parallel_get_num_threads());
+	passed = FALSE;
+      }
+    }
+  }
+
+  for (i=0; i<NUM_RANDOM_SPACES; i++)
+    g_object_unref(spaces[i]);
+
+  return passed;
+}
+
+/* with the moving data set on the same grid, shifting it along each axis
+   should only lose information */
+static gboolean test_shifts(mi_test_t * mt) {
+
+  AmitkSpace * spaces[NUM_SHIFTS];
+  gdouble mis[NUM_SHIFTS];
+  gdouble old_mis[NUM_SHIFTS];
+  AmitkPoint shift;
+  AmitkAxis axis;
+  gboolean partial_volume;
+  gboolean passed=TRUE;
+  gint i, best, old_best;
+
+  for (axis=0; axis<AMITK_AXIS_NUM; axis++) {
+    for (i=0; i<NUM_SHIFTS; i++) {
+      shift = zero_point;
+      point_set_component(&shift, axis, i-NUM_SHIFTS/2);
+      spaces[i] = amitk_space_copy(AMITK_SPACE(mt->moving_ds));
+      amitk_space_shift_offset(spaces[i], shift);
+      old_mis[i] = old_mi(mt, spaces[i]);
+    }
+
+    old_best = 0;
+    for (i=1; i<NUM_SHIFTS; i++)
+      if (old_mis[i] > old_mis[old_best]) old_best = i;
+    if (old_best != NUM_SHIFTS/2) {
+      g_print("old evaluator best fit at a %d mm shift along %s\n",
+	      old_best-NUM_SHIFTS/2, amitk_axis_get_name(axis));
+      passed = FALSE;
+    }
+
+    for (partial_volume=FALSE; partial_volume<=TRUE; partial_volume++) {
+      if (!alignment_mutual_information_evaluate(mt->moving_ds, mt->fixed_ds, mt->view_center, mt->thickness,
+						 mt->start, mt->duration, partial_volume, mt->granularity,
+						 spaces, NUM_SHIFTS, mis)) {
+	g_print("couldn't evaluate the mutual information\n");
+	passed = FALSE;
+	continue;
+      }
+
+      best = 0;
+      for (i=1; i<NUM_SHIFTS; i++)
+	if (mis[i] > mis[best]) best = i;
+      if (best != NUM_SHIFTS/2) {
+	g_print("%s best fit at a %d mm shift along %s\n", partial_volume ? "partial volume" : "nearest neighbor",
+		best-NUM_SHIFTS/2, amitk_axis_get_name(axis));
+	passed = FALSE;
+      }
+
+      if (!partial_volume)
+	if (fabs(mis[NUM_SHIFTS/2]-old_mis[NUM_SHIFTS/2]) > OLD_TOLERANCE*old_mis[NUM_SHIFTS/2]) {
+	  g_print("aligned mutual information is %f, the old evaluator gave %f\n",
+		  mis[NUM_SHIFTS/2], old_mis[NUM_SHIFTS/2]);
+	  passed = FALSE;
+	}
+    }
+
+    for (i=0; i<NUM_SHIFTS; i++)
+      g_object_unref(spaces[i]);
+  }
+
+  return passed;
+}
+
+static void time_evaluators(GRand * rand, mi_test_t * mt) {
+
+  AmitkSpace * spaces[NUM_TIMED_SPACES];
+  gdouble mis[NUM_TIMED_SPACES];
+  gboolean partial_volume;
+  GTimer * timer;
+  gint i;
+
+  for (i=0; i<NUM_TIMED_SPACES; i++)
+    spaces[i] = random_space(rand, mt->moving_ds, mt->view_center);
+
+  timer = g_timer_new();
+  for (i=0; i<NUM_TIMED_SPACES; i++)
+    mis[i] = old_mi(mt, spaces[i]);
+  g_timer_stop(timer);
+  g_print("%d evaluations with the old evaluator took %5.3f seconds\n", NUM_TIMED_SPACES, g_timer_elapsed(timer, NULL));
+
+  for (partial_volume=FALSE; partial_volume<=TRUE; partial_volume++) {
+    g_timer_start(timer);
+    alignment_mutual_information_evaluate(mt->moving_ds, mt->fixed_ds, mt->view_center, mt->thickness,
+					  mt->start, mt->duration, partial_volume, mt->granularity,
+					  spaces, NUM_TIMED_SPACES, mis);
+    g_timer_stop(timer);
+    g_print("%d %s evaluations took %5.3f seconds, including binning the data sets (%d threads)\n",
+	    NUM_TIMED_SPACES, partial_volume ? "partial volume" : "nearest neighbor",
+	    g_timer_elapsed(timer, NULL), amitk_parallel_get_num_threads());
+  }
+  g_timer_destroy(timer);
+
+  for (i=0; i<NUM_TIMED_SPACES; i++)
+    g_object_unref(spaces[i]);
+
+  return;
+}
+
+int main(int argc, char * argv[]) {
+
+  GRand * rand;
+  mi_test_t mt;
+  AmitkDataSet * moving_ds;
+  AmitkDataSet * shifted_ds;
+  AmitkVoxel fixed_dim, moving_dim;
+  AmitkPoint fixed_voxel_size, moving_voxel_size;
+  gint threads;
+  gboolean passed=TRUE;
+
+  /* big enough that the evaluator splits the work over the threads */
+  fixed_dim.t = fixed_dim.g = 1;
+  fixed_dim.x = 96;
+  fixed_dim.y = 88;
+  fixed_dim.z = 72;
+  fixed_voxel_size = one_point;
+  moving_dim.t = moving_dim.g = 1;
+  moving_dim.x = 72;
+  moving_dim.y = 90;
+  moving_dim.z = 100;
+  moving_voxel_size.x = 1.25;
+  moving_voxel_size.y = 1.0;
+  moving_voxel_size.z = 0.75;
+
+  mt.fixed_ds = phantom_data_set(fixed_dim, fixed_voxel_size, FALSE);
+  moving_ds = phantom_data_set(moving_dim, moving_voxel_size, TRUE);
+  shifted_ds = phantom_data_set(fixed_dim, fixed_voxel_size, TRUE);
+  if ((mt.fixed_ds == NULL) || (moving_ds == NULL) || (shifted_ds == NULL)) {
+    g_print("couldn't allocate the data sets\n");
+    return EXIT_FAILURE;
+  }
+
+  /* a slice one voxel thick, centered on a voxel */
+  mt.view_center = amitk_volume_get_center(AMITK_VOLUME(mt.fixed_ds));
+  mt.view_center = point_add(mt.view_center, point_cmult(0.5, fixed_voxel_size));
+  mt.thickness = fixed_voxel_size.z;
+  mt.start = amitk_data_set_get_start_time(mt.fixed_ds, 0);
+  mt.duration = amitk_data_set_get_frame_duration(mt.fixed_ds, 0);
+
+  rand = g_rand_new_with_seed(1);
+
+  for (threads=1; threads<=4; threads+=3) {
+    amitk_parallel_set_max_threads(threads);
+    mt.moving_ds = moving_ds;
+    for (mt.granularity=1; mt.granularity<=2; mt.granularity++)
+      if (!test_random(rand, &mt)) passed = FALSE;
+
+    mt.moving_ds = shifted_ds;
+    mt.granularity = 1;
+    if (!test_shifts(&mt)) passed = FALSE;
+  }
+
+  amitk_parallel_set_max_threads(0);
+  mt.moving_ds = moving_ds;
+  mt.granularity = 1;
+  time_evaluators(rand, &mt);
+
+  g_rand_free(rand);
+  amitk_object_unref(mt.fixed_ds);
+  amitk_object_unref(moving_ds);
+  amitk_object_unref(shifted_ds);
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+/* test_color_table.c - checks the color table lookup tables
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* amitk_color_table_lut_lookup has to give exactly what amitk_color_table_lookup
+   gives, for every color table, so images come out the same either way.  This
+   checks the two against each other over and beyond min/max, right at and next
+   to the cell boundaries, and for the special values. Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <math.h>
+#include "amitk_color_table.h"
+
+#define NUM_RANDOM 100000
+#define NUM_GRID 20000
+
+static const amide_data_t ranges[][2] = {
+  {0.0, 1.0},
+  {-3.5, 7.25},
+  {0.0, 255.0},
+  {0.0, 65535.0},
+  {-1000.0, -999.0},
+  {0.1, 0.3},
+  {1.0e6, 1.0e6+1.0e-6}, /* only a handful of doubles per cell */
+  {-1.0e-20, 1.0e-20}, /* spans the denormals */
+  {5.0, 5.0},
+  {3.0, 2.0}
+};
+
+static gint num_failed=0;
+
+static void check(const color_table_lut_t * lut, const amide_data_t datum) {
+
+  rgba_t lut_rgba;
+  rgba_t rgba;
+
+  lut_rgba = amitk_color_table_lut_lookup(lut, datum);
+  rgba = amitk_color_table_lookup(datum, lut->which, lut->min, lut->max);
+
+  if (amitk_color_table_rgba_to_uint32(lut_rgba) != amitk_color_table_rgba_to_uint32(rgba)) {
+    if (num_failed < 20)
+      g_print("%s, min %g max %g: %.17g gives %08x from the lookup table, %08x directly\n",
+	      amitk_color_table_get_name(lut->which), lut->min, lut->max, datum,
+	      amitk_color_table_rgba_to_uint32(lut_rgba), amitk_color_table_rgba_to_uint32(rgba));
+    num_failed++;
+  }
+
+  return;
+}
+
+int main(int argc, char * argv[]) {
+
+  color_table_lut_t * lut;
+  GRand * rand;
+  AmitkColorTable which;
+  amide_data_t min, max, range, datum;
+  guint i_range;
+  gint i;
+
+  lut = g_new(color_table_lut_t, 1);
+  rand = g_rand_new_with_seed(1);
+
+  for (which=0; which<AMITK_COLOR_TABLE_NUM; which++)
+    for (i_range=0; i_range < G_N_ELEMENTS(ranges); i_range++) {
+      min = ranges[i_range][0];
+      max = ranges[i_range][1];
+      range = (max > min) ? max-min : 1.0;
+      amitk_color_table_lut_init(lut, which, min, max);
+
+      /* anywhere, including a good ways outside of min/max */
+      for (i=0; i<NUM_RANDOM; i++)
+	check(lut, g_rand_double_range(rand, min-range/2.0, max+range/2.0));
+
+      /* evenly spread, along with the doubles on either side */
+      for (i=0; i<=NUM_GRID; i++) {
+	datum = min+range*i/NUM_GRID;
+	check(lut, datum);
+	check(lut, nextafter(datum, -HUGE_VAL));
+	check(lut, nextafter(datum, HUGE_VAL));
+      }
+
+      /* the cell boundaries */
+      if (lut->scale > 0.0)
+	for (i=0; i<=AMITK_COLOR_TABLE_LUT_SIZE; i++) {
+	  datum = min+i/lut->scale;
+	  check(lut, datum);
+	  check(lut, nextafter(datum, -HUGE_VAL));
+	  check(lut, nextafter(datum, HUGE_VAL));
+	}
+
+      check(lut, min);
+      check(lut, max);
+      check(lut, NAN);
+      check(lut, HUGE_VAL);
+      check(lut, -HUGE_VAL);
+      check(lut, G_MAXDOUBLE);
+      check(lut, -G_MAXDOUBLE);
+    }
+
+  g_rand_free(rand);
+  g_free(lut);
+
+  if (num_failed > 0) {
+    g_print("%d lookups differed\n", num_failed);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+/* test_filter.c - checks the data set filters against plain serial versions
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* compares the separable and FFT gaussian filters and the linear and 3D median
+   filters against a direct convolution and a sort of every voxel's neighborhood,
+   on random data sets with odd dimensions and several frames and gates, with
+   one thread and with several (so each thread gets more than one plane).  Then
+   times the two gaussian methods on large data sets.  Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "amitk_data_set.h"
+#include "amitk_parallel.h"
+
+#define NUM_RANDOM_TRIALS 4
+
+/* the filters store floats, this is plenty for that and the FFT's rounding */
+#define GAUSSIAN_TOLERANCE 1e-4
+#define MEDIAN_TOLERANCE 1e-6
+
+#define REF_INDEX(dim, v) ((v).x + (dim).x*((v).y + (dim).y*((v).z + (dim).z*((v).g + (dim).g*(v).t))))
+
+/* zero outside the data set, like the filters */
+static amide_data_t padded_value(const amide_data_t * values, AmitkVoxel dim, AmitkVoxel voxel) {
+  if ((voxel.x < 0) || (voxel.y < 0) || (voxel.z < 0) ||
+      (voxel.x >= dim.x) || (voxel.y >= dim.y) || (voxel.z >= dim.z))
+    return 0.0;
+  else
+    return values[REF_INDEX(dim, voxel)];
+}
+
+static amide_data_t * data_set_values(const AmitkDataSet * ds) {
+
+  AmitkVoxel dim, voxel;
+  amide_data_t * values;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  values = g_new(amide_data_t, dim.x*dim.y*dim.z*dim.g*dim.t);
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	    values[REF_INDEX(dim, voxel)] = amitk_data_set_get_value(ds, voxel);
+
+  return values;
+}
+
+static amide_data_t * reference_gaussian(const AmitkDataSet * ds, const gint kernel_size,
+					 const amide_real_t fwhm) {
+
+  AmitkVoxel dim, voxel, k, neighbor, kernel_dim;
+  AmitkRawData * kernel;
+  amide_data_t * values;
+  amide_data_t * filtered;
+  amide_data_t total;
+  gint half;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  kernel_dim.t = kernel_dim.g = 1;
+  kernel_dim.z = kernel_dim.y = kernel_dim.x = kernel_size;
+  kernel = amitk_filter_calculate_gaussian_kernel(kernel_dim, AMITK_DATA_SET_VOXEL_SIZE(ds), fwhm);
+  half = kernel_size >> 1;
+
+  values = data_set_values(ds);
+  filtered = g_new(amide_data_t, dim.x*dim.y*dim.z*dim.g*dim.t);
+
+  k.t = k.g = 0;
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	    total = 0.0;
+	    neighbor = voxel;
+	    for (k.z=0; k.z<kernel_size; k.z++)
+	      for (k.y=0; k.y<kernel_size; k.y++)
+		for (k.x=0; k.x<kernel_size; k.x++) {
+		  neighbor.x = voxel.x+k.x-half;
+		  neighbor.y = voxel.y+k.y-half;
+		  neighbor.z = voxel.z+k.z-half;
+		  total += AMITK_RAW_DATA_DOUBLE_CONTENT(kernel, k)*padded_value(values, dim, neighbor);
+		}
+	    filtered[REF_INDEX(dim, voxel)] = total;
+	  }
+
+  g_free(values);
+  g_object_unref(kernel);
+
+  return filtered;
+}
+
+static gint compare_values(gconstpointer a, gconstpointer b) {
+  amide_data_t value_a = *((const amide_data_t *) a);
+  amide_data_t value_b = *((const amide_data_t *) b);
+
+  if (value_a < value_b) return -1;
+  else if (value_a > value_b) return 1;
+  else return 0;
+}
+
+/* one pass of the median, the output is rounded to float like the filter's */
+static void reference_median_pass(const amide_data_t * values, amide_data_t * filtered,
+				  AmitkVoxel dim, AmitkVoxel kernel_dim) {
+
+  AmitkVoxel voxel, k, neighbor;
+  amide_data_t * window;
+  gint num;
+
+  window = g_new(amide_data_t, kernel_dim.x*kernel_dim.y*kernel_dim.z);
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	    num = 0;
+	    neighbor = voxel;
+	    for (k.z=0; k.z<kernel_dim.z; k.z++)
+	      for (k.y=0; k.y<kernel_dim.y; k.y++)
+		for (k.x=0; k.x<kernel_dim.x; k.x++) {
+		  neighbor.x = voxel.x+k.x-(kernel_dim.x>>1);
+		  neighbor.y = voxel.y+k.y-(kernel_dim.y>>1);
+		  neighbor.z = voxel.z+k.z-(kernel_dim.z>>1);
+		  window[num++] = padded_value(values, dim, neighbor);
+		}
+	    qsort(window, num, sizeof(amide_data_t), compare_values);
+	    filtered[REF_INDEX(dim, voxel)] = (amitk_format_FLOAT_t) window[num>>1];
+	  }
+
+  g_free(window);
+
+  return;
+}
+
+static amide_data_t * reference_median(const AmitkDataSet * ds, const AmitkFilter filter_type,
+				       const gint kernel_size) {
+
+  AmitkVoxel dim, kernel_dim;
+  amide_data_t * values;
+  amide_data_t * filtered;
+  AmitkAxis i_axis;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  values = data_set_values(ds);
+  filtered = g_new(amide_data_t, dim.x*dim.y*dim.z*dim.g*dim.t);
+  kernel_dim.t = kernel_dim.g = 1;
+
+  if (filter_type == AMITK_FILTER_MEDIAN_3D) {
+    kernel_dim.z = kernel_dim.y = kernel_dim.x = kernel_size;
+    reference_median_pass(values, filtered, dim, kernel_dim);
+  } else { /* x, then y, then z, each pass working on the last one's output */
+    for (i_axis=0; i_axis<AMITK_AXIS_NUM; i_axis++) {
+      kernel_dim.x = (i_axis == AMITK_AXIS_X) ? kernel_size : 1;
+      kernel_dim.y = (i_axis == AMITK_AXIS_Y) ? kernel_size : 1;
+      kernel_dim.z = (i_axis == AMITK_AXIS_Z) ? kernel_size : 1;
+      reference_median_pass(values, filtered, dim, kernel_dim);
+      memcpy(values, filtered, sizeof(amide_data_t)*dim.x*dim.y*dim.z*dim.g*dim.t);
+    }
+  }
+
+  g_free(values);
+
+  return filtered;
+}
+
+/* tolerance is relative to the largest reference value */
+static gboolean compare_filtered(const AmitkDataSet * filtered, const amide_data_t * reference,
+				 const amide_data_t tolerance) {
+
+  AmitkVoxel dim, voxel;
+  amide_data_t max_value, diff;
+  gsize i, num_voxels;
+
+  dim = AMITK_DATA_SET_DIM(filtered);
+  num_voxels = dim.x*dim.y*dim.z*dim.g*dim.t;
+  max_value = 0.0;
+  for (i=0; i<num_voxels; i++)
+    max_value = MAX(max_value, fabs(reference[i]));
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	    diff = fabs(amitk_data_set_get_value(filtered, voxel) - reference[REF_INDEX(dim, voxel)]);
+	    if (diff > tolerance*MAX(max_value, 1.0)) {
+	      g_print("voxel %d %d %d gate %d frame %d is %g, expected %g\n",
+		      voxel.x, voxel.y, voxel.z, voxel.g, voxel.t,
+		      amitk_data_set_get_value(filtered, voxel), reference[REF_INDEX(dim, voxel)]);
+	      return FALSE;
+	    }
+	  }
+
+  return TRUE;
+}
+
+/* integer formats get a different scaling factor for each frame (1D) or plane
+   (2D), some of them negative, so the median's histogram and sorted list
+   methods both get used */
+static AmitkDataSet * random_data_set(GRand * rand, AmitkFormat format,
+				      AmitkScalingType scaling_type, AmitkVoxel dim) {
+
+  AmitkDataSet * ds;
+  AmitkVoxel voxel, scaling_dim;
+  AmitkPoint voxel_size;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, format, dim, scaling_type);
+  voxel_size.x = g_rand_double_range(rand, 0.5, 2.0);
+  voxel_size.y = g_rand_double_range(rand, 0.5, 2.0);
+  voxel_size.z = g_rand_double_range(rand, 0.5, 2.0);
+  amitk_data_set_set_voxel_size(ds, voxel_size);
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	    switch(format) {
+	    case AMITK_FORMAT_UBYTE:
+	      AMITK_RAW_DATA_UBYTE_SET_CONTENT(ds->raw_data, voxel) = g_rand_int_range(rand, 0, 256);
+	      break;
+	    case AMITK_FORMAT_SSHORT:
+	      AMITK_RAW_DATA_SSHORT_SET_CONTENT(ds->raw_data, voxel) = g_rand_int_range(rand, -1000, 1000);
+	      break;
+	    case AMITK_FORMAT_FLOAT:
+	    default:
+	      AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) = g_rand_double_range(rand, -1.0, 1.0);
+	      break;
+	    }
+
+  scaling_dim = AMITK_RAW_DATA_DIM(ds->internal_scaling_factor);
+  voxel.x = voxel.y = 0;
+  for (voxel.t=0; voxel.t<scaling_dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<scaling_dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<scaling_dim.z; voxel.z++)
+	AMITK_RAW_DATA_DOUBLE_SET_CONTENT(ds->internal_scaling_factor, voxel) =
+	  g_rand_double_range(rand, 0.1, 2.0) * (g_rand_boolean(rand) ? 1.0 : -1.0);
+
+  /* and get the current scaling factors recalculated */
+  amitk_data_set_set_scale_factor(ds, 1.0);
+
+  return ds;
+}
+
+static gboolean test_random(GRand * rand, AmitkFormat format, AmitkScalingType scaling_type) {
+
+  AmitkDataSet * ds;
+  AmitkDataSet * filtered;
+  AmitkVoxel dim;
+  amide_data_t * reference;
+  amide_real_t fwhm;
+  gint kernel_size;
+  gboolean fft;
+  gboolean passed=TRUE;
+  AmitkFilter filter_type;
+
+  /* odd kernels up to 9 wide, and data sets at least that big, mostly odd */
+  kernel_size = 2*g_rand_int_range(rand, 1, 5)+1;
+  dim.x = kernel_size + g_rand_int_range(rand, 0, 20);
+  dim.y = kernel_size + g_rand_int_range(rand, 0, 20);
+  dim.z = kernel_size + g_rand_int_range(rand, 0, 10);
+  dim.g = g_rand_int_range(rand, 1, 4);
+  dim.t = g_rand_int_range(rand, 1, 4);
+  ds = random_data_set(rand, format, scaling_type, dim);
+  fwhm = g_rand_double_range(rand, 0.0, 2.0*kernel_size);
+
+  reference = reference_gaussian(ds, kernel_size, fwhm);
+  for (fft=FALSE; fft<=TRUE; fft++) {
+#ifndef AMIDE_LIBGSL_SUPPORT
+    if (fft) continue;
+#endif
+    filtered = amitk_data_set_get_filtered_gaussian(ds, kernel_size, fwhm, fft, NULL, NULL);
+    if ((filtered == NULL) || !compare_filtered(filtered, reference, GAUSSIAN_TOLERANCE)) {
+      g_print("%s gaussian filter failed, kernel %d fwhm %f\n",
+	      fft ? "FFT" : "separable", kernel_size, fwhm);
+      passed = FALSE;
+    }
+    if (filtered != NULL) amitk_object_unref(filtered);
+  }
+  g_free(reference);
+
+  for (filter_type=AMITK_FILTER_MEDIAN_LINEAR; filter_type<=AMITK_FILTER_MEDIAN_3D; filter_type++) {
+    reference = reference_median(ds, filter_type, kernel_size);
+    filtered = amitk_data_set_get_filtered(ds, filter_type, kernel_size, 0.0, NULL, NULL);
+    if ((filtered == NULL) || !compare_filtered(filtered, reference, MEDIAN_TOLERANCE)) {
+      g_print("%s filter failed, kernel %d\n", amitk_filter_get_name(filter_type), kernel_size);
+      passed = FALSE;
+    }
+    if (filtered != NULL) amitk_object_unref(filtered);
+    g_free(reference);
+  }
+
+  if (!passed)
+    g_print("failed on a %dx%dx%d data set, %d gates %d frames, format %s, %s scaling, %d threads\n",
+	    dim.x, dim.y, dim.z, dim.g, dim.t, amitk_format_names[format],
+	    amitk_scaling_type_get_name(scaling_type), amitk_parallel_get_num_threads());
+
+  amitk_object_unref(ds);
+
+  return passed;
+}
+
+/* runs both gaussian methods over a typical volume, to see which is quicker for
+   what kernel, and how far apart they end up */
+static void benchmark(AmitkVoxel dim, const gint kernel_size) {
+
+  AmitkDataSet * ds;
+  AmitkDataSet * filtered[2] = {NULL, NULL};
+  AmitkVoxel voxel;
+  GTimer * timer;
+  gdouble seconds[2];
+  amide_data_t diff, max_diff;
+  gboolean fft;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_UBYTE, dim, AMITK_SCALING_TYPE_0D);
+  if (ds == NULL) {
+    g_print("couldn't allocate a %dx%dx%d data set, skipping\n", dim.x, dim.y, dim.z);
+    return;
+  }
+
+  /* a hot ball in a warm background */
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	AMITK_RAW_DATA_UBYTE_SET_CONTENT(ds->raw_data, voxel) =
+	  ((pow(voxel.x-dim.x/2.0, 2) + pow(voxel.y-dim.y/2.0, 2) + pow(voxel.z-dim.z/2.0, 2)) <
+	   pow(dim.x/4.0, 2)) ? 200 : 50;
+
+  timer = g_timer_new();
+  for (fft=FALSE; fft<=TRUE; fft++) {
+#ifndef AMIDE_LIBGSL_SUPPORT
+    if (fft) continue;
+#endif
+    g_timer_start(timer);
+    filtered[fft] = amitk_data_set_get_filtered_gaussian(ds, kernel_size, 2.0, fft, NULL, NULL);
+    g_timer_stop(timer);
+    seconds[fft] = g_timer_elapsed(timer, NULL);
+    g_print("%s gaussian filter, %d voxel kernel on a %dx%dx%d data set took %5.3f seconds (%d threads)\n",
+	    fft ? "FFT" : "separable", kernel_size, dim.x, dim.y, dim.z, seconds[fft],
+	    amitk_parallel_get_num_threads());
+  }
+  g_timer_destroy(timer);
+
+  if ((filtered[FALSE] != NULL) && (filtered[TRUE] != NULL)) {
+    max_diff = 0.0;
+    for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+      for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	  diff = fabs(amitk_data_set_get_value(filtered[FALSE], voxel) -
+		      amitk_data_set_get_value(filtered[TRUE], voxel));
+	  max_diff = MAX(max_diff, diff);
+	}
+    g_print("the methods differ by at most %5.3g\n", max_diff);
+  }
+
+  if (filtered[FALSE] != NULL) amitk_object_unref(filtered[FALSE]);
+  if (filtered[TRUE] != NULL) amitk_object_unref(filtered[TRUE]);
+  amitk_object_unref(ds);
+
+  return;
+}
+
+int main(int argc, char * argv[]) {
+
+  GRand * rand;
+  AmitkVoxel dim;
+  gint i, threads;
+  gboolean passed=TRUE;
+
+  rand = g_rand_new_with_seed(1);
+
+  for (threads=1; threads<=4; threads+=3) {
+    amitk_parallel_set_max_threads(threads);
+    for (i=0; i<NUM_RANDOM_TRIALS; i++) {
+      if (!test_random(rand, AMITK_FORMAT_FLOAT, AMITK_SCALING_TYPE_0D)) passed = FALSE;
+      if (!test_random(rand, AMITK_FORMAT_UBYTE, AMITK_SCALING_TYPE_1D)) passed = FALSE;
+      if (!test_random(rand, AMITK_FORMAT_SSHORT, AMITK_SCALING_TYPE_2D)) passed = FALSE;
+    }
+  }
+  g_rand_free(rand);
+
+  if (!passed) return EXIT_FAILURE;
+
+  amitk_parallel_set_max_threads(0); /* all of them */
+  dim.t = dim.g = 1;
+  dim.x = dim.y = dim.z = 256;
+  benchmark(dim, 7);
+  benchmark(dim, 21);
+  dim.x = dim.y = dim.z = 512;
+  benchmark(dim, 7);
+  benchmark(dim, 21);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/* test_isocontour.c - checks and times the isocontour roi flood fill
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* compares the roi generated by amitk_roi_set_isocontour against a plain
+   breadth first fill over all 8 (2D) or 26 (3D) neighbors, on random data
+   sets, and then times a large fill. Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <math.h>
+#include "amitk_roi.h"
+
+#define NUM_RANDOM_TRIALS 8
+
+static gboolean in_range(amide_data_t value, amide_data_t min, amide_data_t max,
+			 AmitkRoiIsocontourRange range) {
+  switch(range) {
+  case AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN:
+    return (value >= min);
+  case AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX:
+    return (value <= max);
+  case AMITK_ROI_ISOCONTOUR_RANGE_BETWEEN_MIN_MAX:
+  default:
+    return ((value >= min) && (value <= max));
+  }
+}
+
+#define REF_INDEX(dim, v) ((v).x + (dim).x*((v).y + (dim).y*(v).z))
+
+/* the reference fill, returns one byte per voxel of the data set */
+static guint8 * reference_fill(AmitkDataSet * ds, AmitkVoxel start,
+			       amide_data_t min, amide_data_t max,
+			       AmitkRoiIsocontourRange range) {
+
+  AmitkVoxel dim;
+  AmitkVoxel voxel, neighbor;
+  guint8 * in;
+  GArray * stack;
+  gint dx, dy, dz;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  in = g_new0(guint8, dim.x*dim.y*dim.z);
+  stack = g_array_new(FALSE, FALSE, sizeof(AmitkVoxel));
+
+  in[REF_INDEX(dim, start)] = 1;
+  g_array_append_val(stack, start);
+
+  while (stack->len > 0) {
+    voxel = g_array_index(stack, AmitkVoxel, stack->len-1);
+    g_array_set_size(stack, stack->len-1);
+
+    for (dz=-1; dz<=1; dz++)
+      for (dy=-1; dy<=1; dy++)
+	for (dx=-1; dx<=1; dx++) {
+	  neighbor = voxel;
+	  neighbor.x += dx;
+	  neighbor.y += dy;
+	  neighbor.z += dz;
+	  if ((neighbor.x < 0) || (neighbor.y < 0) || (neighbor.z < 0) ||
+	      (neighbor.x >= dim.x) || (neighbor.y >= dim.y) || (neighbor.z >= dim.z))
+	    continue;
+	  if (in[REF_INDEX(dim, neighbor)]) continue;
+	  if (!in_range(amitk_data_set_get_value(ds, neighbor), min, max, range)) continue;
+	  in[REF_INDEX(dim, neighbor)] = 1;
+	  g_array_append_val(stack, neighbor);
+	}
+  }
+
+  g_array_free(stack, TRUE);
+
+  return in;
+}
+
+/* the map only covers the bounding box of the filled voxels */
+static gboolean compare_fill(AmitkRoi * roi, AmitkDataSet * ds, const guint8 * in) {
+
+  AmitkVoxel dim, voxel, map_voxel;
+  AmitkVoxel min_voxel, max_voxel;
+  gboolean first=TRUE;
+  gboolean in_map;
+  AmitkRoiRunsCursor cursor;
+
+  dim = AMITK_DATA_SET_DIM(ds);
+  min_voxel = max_voxel = zero_voxel;
+
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	if (in[REF_INDEX(dim, voxel)]) {
+	  if (first) {
+	    min_voxel = max_voxel = voxel;
+	    first = FALSE;
+	  }
+	  min_voxel.x = MIN(min_voxel.x, voxel.x);
+	  min_voxel.y = MIN(min_voxel.y, voxel.y);
+	  min_voxel.z = MIN(min_voxel.z, voxel.z);
+	  max_voxel.x = MAX(max_voxel.x, voxel.x);
+	  max_voxel.y = MAX(max_voxel.y, voxel.y);
+	  max_voxel.z = MAX(max_voxel.z, voxel.z);
+	}
+
+  if ((roi->map_runs->dim.x != max_voxel.x-min_voxel.x+1) ||
+      (roi->map_runs->dim.y != max_voxel.y-min_voxel.y+1) ||
+      (roi->map_runs->dim.z != max_voxel.z-min_voxel.z+1)) {
+    g_print("map is %dx%dx%d, expected %dx%dx%d\n",
+	    roi->map_runs->dim.x, roi->map_runs->dim.y, roi->map_runs->dim.z,
+	    max_voxel.x-min_voxel.x+1, max_voxel.y-min_voxel.y+1, max_voxel.z-min_voxel.z+1);
+    return FALSE;
+  }
+
+  map_voxel.t = map_voxel.g = 0;
+  AMITK_ROI_RUNS_CURSOR_RESET(cursor);
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	map_voxel.x = voxel.x-min_voxel.x;
+	map_voxel.y = voxel.y-min_voxel.y;
+	map_voxel.z = voxel.z-min_voxel.z;
+	in_map = (amitk_roi_runs_get_value(roi->map_runs, map_voxel, &cursor) != 0);
+	if (in_map != (in[REF_INDEX(dim, voxel)] != 0)) {
+	  g_print("voxel %d %d %d is %s the roi, but %s the reference fill\n",
+		  voxel.x, voxel.y, voxel.z, in_map ? "in" : "out of",
+		  in_map ? "out of" : "in");
+	  return FALSE;
+	}
+      }
+
+  return TRUE;
+}
+
+static AmitkDataSet * random_data_set(GRand * rand, AmitkVoxel dim) {
+
+  AmitkDataSet * ds;
+  AmitkVoxel voxel;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) = g_rand_double(rand);
+
+  return ds;
+}
+
+static gboolean test_random(GRand * rand, AmitkRoiType type, AmitkRoiIsocontourRange range) {
+
+  AmitkDataSet * ds;
+  AmitkRoi * roi;
+  AmitkVoxel dim, start;
+  amide_data_t min, max;
+  guint8 * in;
+  gboolean passed;
+
+  dim.x = g_rand_int_range(rand, 1, 80);
+  dim.y = g_rand_int_range(rand, 1, 80);
+  dim.z = (type == AMITK_ROI_TYPE_ISOCONTOUR_2D) ? 1 : g_rand_int_range(rand, 1, 40);
+  dim.g = dim.t = 1;
+  ds = random_data_set(rand, dim);
+
+  /* anything from isolated specks to everything being connected */
+  min = g_rand_double_range(rand, 0.0, 1.0);
+  max = g_rand_double_range(rand, min, 1.0);
+  if (range == AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN)
+    min = 1.0-0.5*g_rand_double(rand);
+  else if (range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX)
+    max = 0.5*g_rand_double(rand);
+  min = (gfloat) min; /* what the data set can hold, so the seed's value is exactly the limit */
+  max = (gfloat) max;
+
+  /* start somewhere that's in range, so the reference fill agrees on the seed */
+  start.t = start.g = 0;
+  start.x = g_rand_int_range(rand, 0, dim.x);
+  start.y = g_rand_int_range(rand, 0, dim.y);
+  start.z = g_rand_int_range(rand, 0, dim.z);
+  AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, start) =
+    (range == AMITK_ROI_ISOCONTOUR_RANGE_BELOW_MAX) ? max : min;
+
+  roi = amitk_roi_new(type);
+  amitk_roi_set_isocontour(roi, ds, start, min, max, range);
+  in = reference_fill(ds, start, min, max, range);
+  passed = compare_fill(roi, ds, in);
+  if (!passed)
+    g_print("failed on a %dx%dx%d data set, range %d, min %f max %f\n",
+	    dim.x, dim.y, dim.z, range, min, max);
+
+  g_free(in);
+  amitk_object_unref(roi);
+  amitk_object_unref(ds);
+
+  return passed;
+}
+
+/* a fill over a good chunk of a typical volume, to see how long it takes */
+static void benchmark(AmitkRoiType type, AmitkVoxel dim) {
+
+  AmitkDataSet * ds;
+  AmitkRoi * roi;
+  AmitkVoxel voxel, start;
+  GTimer * timer;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+
+  /* a ball, with a hollow shell around the middle so the fill has to go around */
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	amide_real_t r;
+	r = sqrt(pow((voxel.x-dim.x/2.0)/dim.x, 2) +
+		 pow((voxel.y-dim.y/2.0)/dim.y, 2) +
+		 pow((voxel.z-dim.z/2.0)/dim.z, 2));
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) =
+	  ((r < 0.45) && ((r < 0.2) || (r > 0.22) || (voxel.x < dim.x/8))) ? 1.0 : 0.0;
+      }
+
+  start.t = start.g = 0;
+  start.x = dim.x/2;
+  start.y = dim.y/2;
+  start.z = dim.z/2;
+
+  roi = amitk_roi_new(type);
+  timer = g_timer_new();
+  amitk_roi_set_isocontour(roi, ds, start, 0.5, 1.0, AMITK_ROI_ISOCONTOUR_RANGE_ABOVE_MIN);
+  g_timer_stop(timer);
+  g_print("isocontour fill over a %dx%dx%d data set took %5.3f seconds\n",
+	  dim.x, dim.y, dim.z, g_timer_elapsed(timer, NULL));
+
+  g_timer_destroy(timer);
+  amitk_object_unref(roi);
+  amitk_object_unref(ds);
+
+  return;
+}
+
+int main(int argc, char * argv[]) {
+
+  GRand * rand;
+  AmitkRoiIsocontourRange range;
+  AmitkVoxel dim;
+  gint i;
+  gboolean passed=TRUE;
+
+  rand = g_rand_new_with_seed(1);
+
+  for (i=0; i<NUM_RANDOM_TRIALS; i++)
+    for (range=0; range<AMITK_ROI_ISOCONTOUR_RANGE_NUM; range++) {
+      if (!test_random(rand, AMITK_ROI_TYPE_ISOCONTOUR_2D, range)) passed = FALSE;
+      if (!test_random(rand, AMITK_ROI_TYPE_ISOCONTOUR_3D, range)) passed = FALSE;
+    }
+  g_rand_free(rand);
+
+  if (!passed) return EXIT_FAILURE;
+
+  dim.t = dim.g = 1;
+  dim.x = dim.y = 512;
+  dim.z = 1;
+  benchmark(AMITK_ROI_TYPE_ISOCONTOUR_2D, dim);
+  dim.x = dim.y = dim.z = 256;
+  benchmark(AMITK_ROI_TYPE_ISOCONTOUR_3D, dim);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/* test_math.c - checks the data set math operations against plain serial versions
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* compares the unary and binary math operations against doing the operation
+   voxel by voxel, on random data sets with odd dimensions and several frames
+   and gates, with one thread and with several.  The binary operations are done
+   on data sets sharing a grid, so the slices they're worked out from land on
+   the voxels.  Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <math.h>
+#include "amitk_data_set.h"
+#include "amitk_parallel.h"
+
+#define NUM_RANDOM_TRIALS 4
+
+/* the output is float */
+#define TOLERANCE 1e-5
+
+/* the echo times for T2STAR, in ms */
+#define ECHO_TIME_1 10.0
+#define ECHO_TIME_2 25.0
+
+/* exact in binary, so the output dimensions worked out from the data sets'
+   corners come out the same as the data sets' */
+static const amide_real_t voxel_sizes[] = {0.5, 0.75, 1.0, 1.25, 2.0};
+
+static amide_data_t unary_value(AmitkOperationUnary operation, amide_data_t value,
+				amide_data_t parameter0, amide_data_t parameter1) {
+  switch(operation) {
+  case AMITK_OPERATION_UNARY_RESCALE:
+    if (parameter0 >= parameter1)
+      return (value >= parameter0) ? 1.0 : 0.0;
+    else if (value <= parameter0)
+      return 0.0;
+    else if (value >= parameter1)
+      return 1.0;
+    else
+      return (value-parameter0)/(parameter1-parameter0);
+  case AMITK_OPERATION_UNARY_REMOVE_NEGATIVES:
+  default:
+    return (value < 0.0) ? 0.0 : value;
+  }
+}
+
+static amide_data_t binary_value(AmitkOperationBinary operation,
+				 amide_data_t value1, amide_data_t value2,
+				 amide_data_t parameter0) {
+  switch(operation) {
+  case AMITK_OPERATION_BINARY_ADD:
+    return value1+value2;
+  case AMITK_OPERATION_BINARY_SUB:
+    return value1-value2;
+  case AMITK_OPERATION_BINARY_MULTIPLY:
+    return value1*value2;
+  case AMITK_OPERATION_BINARY_DIVISION:
+    return (value2 > parameter0) ? value1/value2 : 0.0;
+  case AMITK_OPERATION_BINARY_T2STAR:
+  default:
+    if ((value1 <= 0.0) || (value2 <= 0.0) || (value1 <= value2))
+      return 0.0;
+    else
+      return 1000.0*(log(value1)-log(value2))/(ECHO_TIME_2-ECHO_TIME_1);
+  }
+}
+
+static AmitkDataSet * random_data_set(GRand * rand, AmitkVoxel dim, AmitkPoint voxel_size) {
+
+  AmitkDataSet * ds;
+  AmitkVoxel voxel;
+
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+  amitk_data_set_set_voxel_size(ds, voxel_size);
+  amitk_data_set_set_interpolation(ds, AMITK_INTERPOLATION_NEAREST_NEIGHBOR);
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	    AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) = g_rand_double_range(rand, -0.5, 1.0);
+
+  amitk_data_set_calc_min_max(ds, NULL, NULL);
+
+  return ds;
+}
+
+/* expected is passed the voxel, and the data sets the test was given */
+typedef amide_data_t (*ExpectedFunc) (AmitkVoxel voxel, gpointer data);
+
+static gboolean compare_output(AmitkDataSet * output, AmitkVoxel dim,
+			       ExpectedFunc expected_func, gpointer data) {
+
+  AmitkVoxel voxel;
+  amide_data_t value, expected;
+
+  if (output == NULL) {
+    g_print("no output\n");
+    return FALSE;
+  }
+
+  if (!VOXEL_EQUAL(AMITK_DATA_SET_DIM(output), dim)) {
+    g_print("output is %dx%dx%d, %d gates %d frames\n",
+	    AMITK_DATA_SET_DIM_X(output), AMITK_DATA_SET_DIM_Y(output), AMITK_DATA_SET_DIM_Z(output),
+	    AMITK_DATA_SET_DIM_G(output), AMITK_DATA_SET_DIM_T(output));
+    return FALSE;
+  }
+
+  for (voxel.t=0; voxel.t<dim.t; voxel.t++)
+    for (voxel.g=0; voxel.g<dim.g; voxel.g++)
+      for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+	for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+	  for (voxel.x=0; voxel.x<dim.x; voxel.x++) {
+	    value = amitk_data_set_get_value(output, voxel);
+	    expected = (*expected_func)(voxel, data);
+	    if (fabs(value-expected) > TOLERANCE*MAX(fabs(expected), 1.0)) {
+	      g_print("voxel %d %d %d gate %d frame %d is %g, expected %g\n",
+		      voxel.x, voxel.y, voxel.z, voxel.g, voxel.t, value, expected);
+	      return FALSE;
+	    }
+	  }
+
+  return TRUE;
+}
+
+typedef struct {
+  AmitkDataSet * ds1;
+  AmitkDataSet * ds2;
+  gint operation;
+  amide_data_t parameter0;
+  amide_data_t parameter1;
+} math_test_t;
+
+static amide_data_t unary_expected(AmitkVoxel voxel, gpointer data) {
+  math_test_t * mt = data;
+  return unary_value(mt->operation, amitk_data_set_get_value(mt->ds1, voxel),
+		     mt->parameter0, mt->parameter1);
+}
+
+/* the slices the binary operations work from are float */
+static amide_data_t binary_expected(AmitkVoxel voxel, gpointer data) {
+  math_test_t * mt = data;
+  return binary_value(mt->operation,
+		      (amitk_format_FLOAT_t) amitk_data_set_get_value(mt->ds1, voxel),
+		      (amitk_format_FLOAT_t) amitk_data_set_get_value(mt->ds2, voxel),
+		      mt->parameter0);
+}
+
+static gboolean test_random(GRand * rand) {
+
+  math_test_t mt;
+  AmitkDataSet * output;
+  AmitkVoxel dim;
+  AmitkPoint voxel_size;
+  gboolean passed=TRUE;
+
+  dim.x = g_rand_int_range(rand, 1, 24);
+  dim.y = g_rand_int_range(rand, 1, 24);
+  dim.z = g_rand_int_range(rand, 1, 12);
+  dim.g = g_rand_int_range(rand, 1, 4);
+  dim.t = g_rand_int_range(rand, 1, 4);
+  voxel_size.x = voxel_sizes[g_rand_int_range(rand, 0, G_N_ELEMENTS(voxel_sizes))];
+  voxel_size.y = voxel_sizes[g_rand_int_range(rand, 0, G_N_ELEMENTS(voxel_sizes))];
+  voxel_size.z = voxel_sizes[g_rand_int_range(rand, 0, G_N_ELEMENTS(voxel_sizes))];
+  mt.ds1 = random_data_set(rand, dim, voxel_size);
+  mt.ds2 = random_data_set(rand, dim, voxel_size);
+
+  for (mt.operation=0; mt.operation<AMITK_OPERATION_UNARY_NUM; mt.operation++) {
+    mt.parameter0 = g_rand_double_range(rand, -0.5, 0.5);
+    mt.parameter1 = g_rand_double_range(rand, -0.5, 1.0); /* sometimes below parameter0 */
+    output = amitk_data_sets_math_unary(mt.ds1, mt.operation, mt.parameter0, mt.parameter1, NULL, NULL);
+    if (!compare_output(output, dim, unary_expected, &mt)) {
+      g_print("%s failed, parameters %f %f\n", amitk_operation_unary_get_name(mt.operation),
+	      mt.parameter0, mt.parameter1);
+      passed = FALSE;
+    }
+    if (output != NULL) amitk_object_unref(output);
+  }
+
+  for (mt.operation=0; mt.operation<AMITK_OPERATION_BINARY_NUM; mt.operation++) {
+    if (mt.operation == AMITK_OPERATION_BINARY_T2STAR) {
+      mt.parameter0 = ECHO_TIME_1;
+      mt.parameter1 = ECHO_TIME_2;
+    } else {
+      mt.parameter0 = g_rand_double_range(rand, -0.5, 0.5); /* the divisor threshold */
+      mt.parameter1 = 0.0;
+    }
+    output = amitk_data_sets_math_binary(mt.ds1, mt.ds2, mt.operation, mt.parameter0, mt.parameter1,
+					 FALSE, TRUE, NULL, NULL);
+    if (!compare_output(output, dim, binary_expected, &mt)) {
+      g_print("%s failed, parameter %f\n", amitk_operation_binary_get_name(mt.operation),
+	      mt.parameter0);
+      passed = FALSE;
+    }
+    if (output != NULL) amitk_object_unref(output);
+  }
+
+  if (!passed)
+    g_print("failed on a %dx%dx%d data set, %d gates %d frames, %d threads\n",
+	    dim.x, dim.y, dim.z, dim.g, dim.t, amitk_parallel_get_num_threads());
+
+  amitk_object_unref(mt.ds1);
+  amitk_object_unref(mt.ds2);
+
+  return passed;
+}
+
+int main(int argc, char * argv[]) {
+
+  GRand * rand;
+  gint i, threads;
+  gboolean passed=TRUE;
+
+  rand = g_rand_new_with_seed(1);
+
+  for (threads=1; threads<=4; threads+=3) {
+    amitk_parallel_set_max_threads(threads);
+    for (i=0; i<NUM_RANDOM_TRIALS; i++)
+      if (!test_random(rand)) passed = FALSE;
+  }
+  g_rand_free(rand);
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
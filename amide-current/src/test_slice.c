@@ -0,0 +1,163 @@
+/* test_slice.c - times oblique slice generation
+ *
+ * Part of amide - Amide's a Medical Image Dataset Examiner
+ * Copyright (C) 2017 Andy Loening
+ *
+ * Author: Andy Loening <loening@alum.mit.edu>
+ */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+  02111-1307, USA.
+*/
+
+/* steps an oblique view through a data set, as when scrolling through it,
+   and prints how many slice pixels a second get generated with each
+   interpolation, and then how the slice cache does going back over the same
+   positions.  Run by "make check". */
+
+#include "amide_config.h"
+#include <stdlib.h>
+#include <math.h>
+#include "amitk_data_set.h"
+#include "amitk_parallel.h"
+#include "amitk_slice_cache.h"
+
+#define NUM_SLICES 64
+
+/* returns the number of slice pixels generated, or -1 if a slice couldn't be */
+static glong step_through(AmitkDataSet * ds, AmitkSliceCache * slice_cache,
+			  const AmitkVolume * view_volume, const AmitkCanvasPoint pixel_size) {
+
+  AmitkVolume * volume;
+  AmitkPoint shift;
+  GList * data_sets;
+  GList * slices;
+  glong num_pixels=0;
+  gint i;
+
+  volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(view_volume)));
+  data_sets = g_list_append(NULL, ds);
+
+  /* start half way back, and move a slice thickness at a time */
+  shift = point_cmult(-AMITK_VOLUME_Z_CORNER(volume)*NUM_SLICES/2,
+		      amitk_space_get_axis(AMITK_SPACE(volume), AMITK_AXIS_Z));
+  amitk_space_shift_offset(AMITK_SPACE(volume), shift);
+  shift = point_cmult(AMITK_VOLUME_Z_CORNER(volume),
+		      amitk_space_get_axis(AMITK_SPACE(volume), AMITK_AXIS_Z));
+
+  for (i=0; i<NUM_SLICES; i++) {
+    slices = amitk_data_sets_get_slices(data_sets, slice_cache,
+					amitk_data_set_get_start_time(ds, 0),
+					amitk_data_set_get_frame_duration(ds, 0),
+					-1, pixel_size, volume);
+    if (slices == NULL) {
+      num_pixels = -1;
+      break;
+    }
+    num_pixels += AMITK_DATA_SET_DIM_X(slices->data)*AMITK_DATA_SET_DIM_Y(slices->data);
+    amitk_objects_unref(slices);
+    amitk_space_shift_offset(AMITK_SPACE(volume), shift);
+  }
+
+  g_list_free(data_sets);
+  amitk_object_unref(volume);
+
+  return num_pixels;
+}
+
+int main(int argc, char * argv[]) {
+
+  AmitkDataSet * ds;
+  AmitkVolume * view_volume;
+  AmitkSliceCache * slice_cache;
+  AmitkSliceCacheStats stats;
+  AmitkVoxel dim, voxel;
+  AmitkPoint center, corner, axis;
+  AmitkCanvasPoint pixel_size;
+  AmitkInterpolation interpolation;
+  GTimer * timer;
+  gdouble seconds;
+  glong num_pixels;
+  gint pass;
+
+  dim.t = dim.g = 1;
+  dim.x = dim.y = dim.z = 256;
+  ds = amitk_data_set_new_with_data(NULL, AMITK_MODALITY_PET, AMITK_FORMAT_FLOAT, dim, AMITK_SCALING_TYPE_0D);
+  if (ds == NULL) {
+    g_print("couldn't allocate a %dx%dx%d data set\n", dim.x, dim.y, dim.z);
+    return EXIT_FAILURE;
+  }
+
+  voxel.t = voxel.g = 0;
+  for (voxel.z=0; voxel.z<dim.z; voxel.z++)
+    for (voxel.y=0; voxel.y<dim.y; voxel.y++)
+      for (voxel.x=0; voxel.x<dim.x; voxel.x++)
+	AMITK_RAW_DATA_FLOAT_SET_CONTENT(ds->raw_data, voxel) =
+	  sin(voxel.x/10.0)*cos(voxel.y/13.0)+sin(voxel.z/7.0);
+  amitk_data_set_calc_min_max(ds, NULL, NULL);
+
+  /* a view through the middle, tipped off all three axes */
+  center = amitk_volume_get_center(AMITK_VOLUME(ds));
+  view_volume = amitk_volume_new();
+  corner.x = corner.y = dim.x;
+  corner.z = 1.0;
+  amitk_volume_set_corner(view_volume, corner);
+  amitk_volume_set_center(view_volume, center);
+  axis.x = axis.y = M_SQRT1_2;
+  axis.z = 0.0;
+  amitk_space_rotate_on_vector(AMITK_SPACE(view_volume), axis, M_PI/6.0, center);
+  axis.x = axis.y = 0.0;
+  axis.z = 1.0;
+  amitk_space_rotate_on_vector(AMITK_SPACE(view_volume), axis, M_PI/5.0, center);
+  pixel_size.x = pixel_size.y = 1.0;
+
+  timer = g_timer_new();
+  for (interpolation=0; interpolation<AMITK_INTERPOLATION_NUM; interpolation++) {
+    amitk_data_set_set_interpolation(ds, interpolation);
+    g_timer_start(timer);
+    num_pixels = step_through(ds, NULL, view_volume, pixel_size);
+    g_timer_stop(timer);
+    seconds = g_timer_elapsed(timer, NULL);
+    if (num_pixels < 0) {
+      g_print("couldn't generate the %s slices\n", amitk_interpolation_get_name(interpolation));
+      return EXIT_FAILURE;
+    }
+    g_print("%d %s oblique slices of a %dx%dx%d data set took %5.3f seconds, %5.3g pixels/s (%d threads)\n",
+	    NUM_SLICES, amitk_interpolation_get_name(interpolation), dim.x, dim.y, dim.z,
+	    seconds, (seconds > 0.0) ? num_pixels/seconds : 0.0, amitk_parallel_get_num_threads());
+  }
+
+  /* and again through a cache, the second time through should all be hits */
+  slice_cache = amitk_slice_cache_new(64*1024*1024);
+  for (pass=0; pass<2; pass++) {
+    g_timer_start(timer);
+    num_pixels = step_through(ds, slice_cache, view_volume, pixel_size);
+    g_timer_stop(timer);
+    amitk_slice_cache_get_stats(slice_cache, &stats);
+    g_print("pass %d through the slice cache took %5.3f seconds: %u slices, %5.1f/%5.1f MB, %"
+	    G_GUINT64_FORMAT " hits %" G_GUINT64_FORMAT " misses %" G_GUINT64_FORMAT " evictions\n",
+	    pass+1, g_timer_elapsed(timer, NULL), stats.num_slices,
+	    stats.size/1048576.0, stats.max_size/1048576.0,
+	    stats.hits, stats.misses, stats.evictions);
+  }
+  amitk_slice_cache_free(slice_cache);
+
+  g_timer_destroy(timer);
+  amitk_object_unref(view_volume);
+  amitk_object_unref(ds);
+
+  return EXIT_SUCCESS;
+}
@@ -33,6 +33,8 @@
 #include "amitk_threshold.h"
 #include "amitk_window_edit.h"
 #include "ui_common.h"
+#include "amitk_parallel.h"
+#include "amitk_slice_cache.h"
 
 
 static gchar * study_preference_text = 
@@ -64,6 +66,9 @@ static void warnings_to_console_cb(GtkWidget * widget, gpointer data);
 static void save_on_exit_cb(GtkWidget * widget, gpointer data);
 static void which_default_directory_cb(GtkWidget * widget, gpointer data);
 static void default_directory_cb(GtkWidget * fc, gpointer data);
+static void max_threads_cb(GtkWidget * widget, gpointer data);
+static void slice_cache_size_cb(GtkWidget * widget, gpointer data);
+static void dicom_index_directory_cb(GtkWidget * fc, gpointer data);
 static void response_cb (GtkDialog * dialog, gint response_id, gpointer data);
 static gboolean delete_event_cb(GtkWidget* widget, GdkEvent * event, gpointer preferences);
 
@@ -232,6 +237,35 @@ static void default_directory_cb(GtkWidget * fc, gpointer data) {
 }
 
 
+static void max_threads_cb(GtkWidget * widget, gpointer data) {
+
+  ui_study_t * ui_study = data;
+  amitk_preferences_set_max_threads(ui_study->preferences, 
+				    gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)));
+  return;
+}
+
+static void slice_cache_size_cb(GtkWidget * widget, gpointer data) {
+
+  ui_study_t * ui_study = data;
+  amitk_preferences_set_slice_cache_size(ui_study->preferences, 
+					 gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(widget)));
+  return;
+}
+
+static void dicom_index_directory_cb(GtkWidget * fc, gpointer data) { 
+
+  ui_study_t * ui_study = data;
+  gchar * str;
+
+  str = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(fc));
+  amitk_preferences_set_dicom_index_directory(ui_study->preferences, str);
+  g_free(str);
+
+  return;
+}
+
+
 /* changing the color table of a rendering context */
 static void color_table_cb(GtkWidget * widget, gpointer data) {
 
@@ -311,6 +345,7 @@ void ui_preferences_dialog_create(ui_study_t * ui_study) {
   GtkWidget * windows_widget;
   GtkWidget * scrolled;
   GtkWidget * entry;
+  GtkWidget * spin_button;
   AmitkModality i_modality;
   AmitkWhichDefaultDirectory i_which_default_directory;
   GnomeCanvasItem * roi_item;
@@ -618,6 +653,54 @@ void ui_preferences_dialog_create(ui_study_t * ui_study) {
 
   table_row++;
 
+
+  label = gtk_label_new(_("Worker Threads (0 = one per processor):"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  spin_button = gtk_spin_button_new_with_range(0, AMITK_PARALLEL_MAX_THREADS, 1);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(spin_button), 0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), 
+			    AMITK_PREFERENCES_MAX_THREADS(ui_study->preferences));
+  g_signal_connect(G_OBJECT(spin_button), "value_changed", G_CALLBACK(max_threads_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), spin_button, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
+  label = gtk_label_new(_("Slice Cache Size (MB):"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  spin_button = gtk_spin_button_new_with_range(1, AMITK_SLICE_CACHE_MAX_MAX_SIZE, 16);
+  gtk_spin_button_set_digits(GTK_SPIN_BUTTON(spin_button), 0);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin_button), 
+			    AMITK_PREFERENCES_SLICE_CACHE_SIZE(ui_study->preferences));
+  g_signal_connect(G_OBJECT(spin_button), "value_changed", G_CALLBACK(slice_cache_size_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), spin_button, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
+  label = gtk_label_new(_("DICOM Index Directory:"));
+  gtk_table_attach(GTK_TABLE(packing_table), label, 
+		   0,1, table_row, table_row+1,
+		   GTK_FILL, 0, X_PADDING, Y_PADDING);
+
+  entry =  gtk_file_chooser_button_new(_("DICOM Index Directory:"),
+  				       GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+  temp_string = amitk_preferences_get_dicom_index_directory(ui_study->preferences);
+  g_mkdir_with_parents(temp_string, 0700); /* so the chooser has something to show, private like the indexes */
+  gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(entry), temp_string);
+  g_free(temp_string);
+  g_signal_connect(G_OBJECT(entry), "current-folder-changed", G_CALLBACK(dicom_index_directory_cb), ui_study);
+  gtk_table_attach(GTK_TABLE(packing_table), entry, 
+		   1,2, table_row, table_row+1,
+		   GTK_FILL|GTK_EXPAND, 0, X_PADDING, Y_PADDING);
+  table_row++;
+
   gtk_widget_show_all(packing_table);
 
   /* and show all our widgets */
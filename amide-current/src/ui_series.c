@@ -31,6 +31,7 @@
 #include "amitk_canvas_object.h"
 #include "amitk_tree_view.h"
 #include "image.h"
+#include "amitk_slice_cache.h"
 #include "ui_common.h"
 #include "ui_series.h"
 
@@ -65,8 +66,6 @@ static gchar * series_explanations[] = {
 typedef struct ui_series_t {
   GtkWindow * window;
   GtkWidget * window_vbox;
-  GList * slice_cache;
-  gint max_slice_cache_size;
   GList * objects;
   AmitkDataSet * active_ds;
   GtkWidget * canvas;
@@ -113,6 +112,7 @@ typedef struct ui_series_t {
 
   guint next_update;
   guint idle_handler_id;
+  gint last_start_i; /* first image shown last time, for prefetching */
 
   guint reference_count;
 } ui_series_t;
@@ -136,6 +136,7 @@ static ui_series_t * ui_series_unref(ui_series_t * ui_series);
 static ui_series_t * ui_series_init(GtkWindow * window, GtkWidget * window_vbox);
 static GtkAdjustment * ui_series_create_scroll_adjustment(ui_series_t * ui_series);
 static void add_update(ui_series_t * ui_series);
+static void prefetch_slices(ui_series_t * ui_series, const gint start_i);
 static gboolean update_immediate(gpointer ui_series);
 static void read_series_preferences(series_type_t * series_type, AmitkView * view);
 
@@ -282,10 +283,6 @@ static void color_table_changed_cb(gpointer dummy, AmitkViewMode view_mode, gpoi
 static void data_set_invalidate_slice_cache(AmitkDataSet *ds, gpointer data) {
   ui_series_t * ui_series=data;
 
-  if (ui_series->slice_cache != NULL) {
-    ui_series->slice_cache = amitk_objects_unref(ui_series->slice_cache);
-  }
-
   add_update(ui_series);
   return;
 }
@@ -469,6 +466,8 @@ static ui_series_t * ui_series_unref(ui_series_t * ui_series) {
       ui_series->idle_handler_id = 0;
     }
 
+    amitk_slice_cache_cancel_prefetch(amitk_slice_cache_get_default(), ui_series);
+
     if (ui_series->active_ds != NULL) 
       ui_series->active_ds = amitk_object_unref(ui_series->active_ds);
 
@@ -492,10 +491,6 @@ static ui_series_t * ui_series_unref(ui_series_t * ui_series) {
       ui_series->objects = NULL;
     }
 
-    if (ui_series->slice_cache != NULL) {
-      ui_series->slice_cache = amitk_objects_unref(ui_series->slice_cache);
-    }
-
     if (ui_series->volume != NULL) {
       amitk_object_unref(ui_series->volume);
       ui_series->volume = NULL;
@@ -566,8 +561,6 @@ static ui_series_t * ui_series_init(GtkWindow * window, GtkWidget * window_vbox)
   /* set any needed parameters */
   ui_series->window = window;
   ui_series->window_vbox = window_vbox;
-  ui_series->slice_cache = NULL;
-  ui_series->max_slice_cache_size=10;
   ui_series->num_slices = 0;
   ui_series->rows = 0;
   ui_series->columns = 0;
@@ -612,6 +605,7 @@ static ui_series_t * ui_series_init(GtkWindow * window, GtkWidget * window_vbox)
 
   ui_series->next_update = UPDATE_NONE;
   ui_series->idle_handler_id = 0;
+  ui_series->last_start_i = -1;
 
   return ui_series;
 }
@@ -658,6 +652,73 @@ static void add_update(ui_series_t * ui_series) {
 }
 
 
+/* queue up generating the page of images past the one starting at start_i,
+   in the direction we've been scrolling */
+static void prefetch_slices(ui_series_t * ui_series, const gint start_i) {
+
+  AmitkSliceCache * slice_cache;
+  AmitkCanvasPoint pixel_size;
+  AmitkVolume * view_volume;
+  AmitkPoint temp_point;
+  amide_time_t temp_time, temp_duration;
+  gint temp_gate;
+  gint page_size;
+  gint direction;
+  gint i, j, k;
+
+  slice_cache = amitk_slice_cache_get_default();
+  amitk_slice_cache_cancel_prefetch(slice_cache, ui_series);
+
+  if ((ui_series->last_start_i < 0) || (ui_series->last_start_i == start_i))
+    direction = 0;
+  else if (start_i > ui_series->last_start_i)
+    direction = 1;
+  else
+    direction = -1;
+  ui_series->last_start_i = start_i;
+  if (direction == 0) return;
+
+  page_size = ui_series->rows*ui_series->columns;
+  pixel_size.x = pixel_size.y = ui_series->pixel_dim;
+  view_volume = AMITK_VOLUME(amitk_object_copy(AMITK_OBJECT(ui_series->volume)));
+  temp_point = zero_point;
+
+  for (j=0; j < page_size; j++) {
+    i = (direction > 0) ? start_i+page_size+j : start_i-1-j;
+    if ((i < 0) || (i >= ui_series->num_slices)) break;
+
+    /* same positions as update_immediate uses */
+    temp_time = ui_series->view_time;
+    temp_duration = ui_series->view_duration;
+    temp_gate = -1;
+    switch (ui_series->series_type) {
+    case OVER_GATES:
+      temp_gate = i;
+      break;
+    case OVER_FRAMES:
+      temp_time = ui_series->start_time;
+      for (k=0; k < i; k++)
+	temp_time += ui_series->frame_durations[k];
+      temp_duration = ui_series->frame_durations[i];
+      break;
+    case OVER_SPACE:
+    default:
+      temp_point.z = i*AMITK_VOLUME_Z_CORNER(ui_series->volume)+ui_series->start_z;
+      break;
+    }
+
+    amitk_space_set_offset(AMITK_SPACE(view_volume), 
+			   amitk_space_s2b(AMITK_SPACE(ui_series->volume), temp_point));
+    amitk_slice_cache_prefetch(slice_cache, ui_series, ui_series->objects,
+			       temp_time+EPSILON*fabs(temp_time),
+			       temp_duration-EPSILON*fabs(temp_duration),
+			       temp_gate, pixel_size, view_volume);
+  }
+  amitk_object_unref(view_volume);
+
+  return;
+}
+
 /* funtion to update the canvas */
 static gboolean update_immediate(gpointer data) {
 
@@ -824,8 +885,7 @@ static gboolean update_immediate(gpointer data) {
 
     if (amitk_objects_has_type(ui_series->objects, AMITK_OBJECT_TYPE_DATA_SET, FALSE)) {
       pixbuf = image_from_data_sets(NULL,
-				    &(ui_series->slice_cache),
-				    ui_series->max_slice_cache_size,
+				    amitk_slice_cache_get_default(),
 				    ui_series->objects,
 				    ui_series->active_ds,
 				    temp_time+EPSILON*fabs(temp_time),
@@ -926,6 +986,9 @@ static gboolean update_immediate(gpointer data) {
   }
   amitk_object_unref(view_volume);
 
+  if (can_continue && !ui_series->quit_generation)
+    prefetch_slices(ui_series, start_i);
+
   return_val = FALSE;
 
 
@@ -1239,8 +1302,6 @@ void ui_series_create(AmitkStudy * study,
     break;
   }
 
-  ui_series->max_slice_cache_size = ui_series->num_slices*num_data_sets+5;
-
   /* connect the thresholding and color table signals */
   temp_objects = ui_series->objects;
   while (temp_objects != NULL) {